@@ -0,0 +1,302 @@
+//
+//  benchmarks.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+//  Times the core data path on synthetic, in-memory data, so it runs anywhere -- no database, no config. Covers
+//  point record insert and lookup for each in-memory backend, range evaluation through the resampler, moving
+//  average and aggregator, zone demand allocation, and extended period runs of sampletown and of generated grids.
+//
+//  usage: rtx-benchmarks [scale]
+//  scale (1 by default) multiplies every problem size. results go to stdout as CSV, one line per measurement:
+//    benchmark,case,size,operations,seconds,ns_per_op
+//  so a run can be kept and compared with another one's (e.g. make benchmark > benchmarks-1.2.csv). anything else,
+//  the engine's chatter included, goes to stderr.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <boost/foreach.hpp>
+#include <boost/timer/timer.hpp>
+
+#include "BufferPointRecord.h"
+#include "VectorPointRecord.h"
+#include "CompressedPointRecord.h"
+#include "RegularPointRecord.h"
+#include "RollupPointRecord.h"
+#include "MmapPointRecord.h"
+#include "TimeSeries.h"
+#include "Resampler.h"
+#include "MovingAverage.h"
+#include "AggregatorTimeSeries.h"
+#include "Zone.h"
+#include "EpanetModel.h"
+
+using namespace RTX;
+using namespace std;
+
+const time_t startTime = 1222873200; // on the hour, so any clock lines up with it
+const time_t step = 60;
+FILE* results = stdout;
+
+void report(const string& benchmark, const string& name, size_t size, size_t operations, boost::timer::cpu_timer& timer);
+void benchmarkRecord(const string& name, PointRecord::sharedPointer record, size_t count);
+void benchmarkRecords(size_t count);
+void benchmarkSeries(size_t count);
+void benchmarkZone(int side, size_t steps);
+void benchmarkModel(const string& name, const string& path, time_t duration, int hydraulicStep);
+void benchmarkGrid(int side, time_t duration);
+string gridNetwork(int side);
+
+int main(int argc, const char * argv[])
+{
+  int scale = (argc > 1) ? atoi(argv[1]) : 1;
+  scale = RTX_MAX(scale, 1);
+
+  // the engine writes its report to stdout; it goes to stderr instead, and the results to what was stdout
+  int resultsDescriptor = dup(fileno(stdout));
+  if (resultsDescriptor >= 0 && dup2(fileno(stderr), fileno(stdout)) >= 0) {
+    results = fdopen(resultsDescriptor, "w");
+  }
+  fputs("benchmark,case,size,operations,seconds,ns_per_op\n", results);
+
+  benchmarkRecords(100000 * scale);
+  benchmarkSeries(100000 * scale);
+  benchmarkZone(32, 1000 * scale);
+  benchmarkZone(100, 100 * scale);
+  benchmarkModel("sampletown", "../validator/sampletown.inp", 86400 * scale, 300);
+  benchmarkGrid(32, 86400 * scale);
+  benchmarkGrid(100, 3600 * scale);
+
+  fclose(results);
+  return 0;
+}
+
+
+void report(const string& benchmark, const string& name, size_t size, size_t operations, boost::timer::cpu_timer& timer) {
+  timer.stop();
+  double seconds = (double)timer.elapsed().wall / 1.e9;
+  operations = RTX_MAX(operations, (size_t)1);
+  stringstream line;
+  line << benchmark << "," << name << "," << size << "," << operations << ","
+       << fixed << setprecision(6) << seconds << "," << setprecision(1) << (1.e9 * seconds / operations) << endl;
+  fputs(line.str().c_str(), results);
+  fflush(results);
+}
+
+
+#pragma mark - Point Records
+
+// one series of count points on a regular step: appended one at a time, then looked up at scattered times, then
+// read back in ranges of an hour.
+void benchmarkRecord(const string& name, PointRecord::sharedPointer record, size_t count) {
+  string id = record->registerAndGetIdentifier("benchmark series");
+
+  boost::timer::cpu_timer insertTimer;
+  for (size_t i = 0; i < count; ++i) {
+    record->addPoint(id, Point(startTime + (time_t)i * step, (double)(i % 97), Point::good));
+  }
+  report("record_insert", name, count, count, insertTimer);
+
+  srand(1);
+  double sum = 0;
+  boost::timer::cpu_timer pointTimer;
+  for (size_t i = 0; i < count; ++i) {
+    sum += record->point(id, startTime + (time_t)(rand() % count) * step).value;
+  }
+  report("record_point", name, count, count, pointTimer);
+
+  size_t returned = 0;
+  time_t span = 60 * step;
+  boost::timer::cpu_timer rangeTimer;
+  for (time_t t = startTime; t < startTime + (time_t)count * step; t += span) {
+    returned += record->pointsInRange(id, t, t + span - 1).size();
+  }
+  report("record_range", name, count, RTX_MAX(returned, (size_t)1), rangeTimer);
+
+  if (sum < 0) {
+    cerr << "unexpected sum" << endl;
+  }
+}
+
+void benchmarkRecords(size_t count) {
+  BufferPointRecord::sharedPointer buffer(new BufferPointRecord());
+  buffer->setMemoryBudget(count * 2 * sizeof(Point));
+  benchmarkRecord("buffer", buffer, count);
+  benchmarkRecord("vector", PointRecord::sharedPointer(new VectorPointRecord()), count);
+  benchmarkRecord("compressed", PointRecord::sharedPointer(new CompressedPointRecord()), count);
+  benchmarkRecord("regular", PointRecord::sharedPointer(new RegularPointRecord(step, startTime, count)), count);
+  vector<time_t> resolutions;
+  resolutions.push_back(3600);
+  benchmarkRecord("rollup", PointRecord::sharedPointer(new RollupPointRecord(PointRecord::sharedPointer(new VectorPointRecord()), resolutions)), count);
+
+  char directory[] = "/tmp/rtx-benchmarks-XXXXXX";
+  if (mkdtemp(directory)) {
+    MmapPointRecord::sharedPointer mmap(new MmapPointRecord());
+    mmap->setPath(directory);
+    benchmarkRecord("mmap", mmap, count);
+    BOOST_FOREACH(const string& id, mmap->identifiers()) {
+      remove((string(directory) + "/" + id).c_str());
+    }
+    mmap.reset();
+    rmdir(directory);
+  }
+}
+
+
+#pragma mark - Time Series
+
+// the first evaluation of a range through each kind of derived series, over count source points. caches are
+// emptied between runs, so every run computes its points afresh.
+void benchmarkSeries(size_t count) {
+  time_t end = startTime + (time_t)count * step;
+  vector<TimeSeries::sharedPointer> sources;
+  for (int i = 0; i < 4; ++i) {
+    TimeSeries::sharedPointer source(new TimeSeries());
+    source->setRecord(PointRecord::sharedPointer(new VectorPointRecord()));
+    source->setName("source " + string(1, (char)('a' + i)));
+    source->setClock(Clock::sharedPointer(new Clock(step, startTime)));
+    vector<Point> points;
+    points.reserve(count);
+    for (size_t k = 0; k < count; ++k) {
+      points.push_back(Point(startTime + (time_t)k * step, 10. + (double)((k * (i + 3)) % 17), Point::good));
+    }
+    source->insertPoints(points);
+    sources.push_back(source);
+  }
+
+  Resampler::sharedPointer resampler(new Resampler());
+  resampler->setName("resampled");
+  resampler->setSource(sources[0]);
+  resampler->setClock(Clock::sharedPointer(new Clock(step * 5, startTime)));
+  resampler->resetCache();
+  boost::timer::cpu_timer resampleTimer;
+  size_t resampled = resampler->points(startTime, end).size();
+  report("series_range", "resampler", count, resampled, resampleTimer);
+
+  MovingAverage::sharedPointer average(new MovingAverage());
+  average->setName("averaged");
+  average->setSource(sources[0]);
+  average->setWindowSize(15);
+  average->resetCache();
+  boost::timer::cpu_timer averageTimer;
+  size_t averaged = average->points(startTime, end).size();
+  report("series_range", "moving_average", count, averaged, averageTimer);
+
+  AggregatorTimeSeries::sharedPointer aggregator(new AggregatorTimeSeries());
+  aggregator->setName("aggregated");
+  aggregator->setClock(Clock::sharedPointer(new Clock(step, startTime)));
+  for (size_t i = 0; i < sources.size(); ++i) {
+    aggregator->addSource(sources[i], (i % 2) ? -1. : 1.);
+  }
+  aggregator->resetCache();
+  boost::timer::cpu_timer aggregateTimer;
+  size_t aggregated = aggregator->points(startTime, end).size();
+  report("series_range", "aggregator", count, aggregated, aggregateTimer);
+}
+
+
+#pragma mark - Zones
+
+// a zone over a whole grid, its demand shared out to the junctions a step at a time.
+void benchmarkZone(int side, size_t steps) {
+  string path = gridNetwork(side);
+  EpanetModel::sharedPointer model(new EpanetModel());
+  model->loadModelFromFile(path);
+  remove(path.c_str());
+
+  Zone::sharedPointer zone(new Zone("benchmark"));
+  zone->enumerateJunctionsWithRootNode(model->junctions().front());
+  TimeSeries::sharedPointer demand(new TimeSeries());
+  demand->setName("zone demand");
+  demand->setUnits(RTX_LITER_PER_SECOND);
+  demand->setClock(Clock::sharedPointer(new Clock(step, startTime)));
+  for (size_t i = 0; i < steps; ++i) {
+    demand->insert(Point(startTime + (time_t)i * step, 100. + (double)(i % 10), Point::good));
+  }
+  zone->setDemand(demand);
+
+  stringstream name;
+  name << "grid_" << side << "x" << side;
+  boost::timer::cpu_timer timer;
+  for (size_t i = 0; i < steps; ++i) {
+    zone->allocateDemandToJunctions(startTime + (time_t)i * step);
+  }
+  report("zone_allocate", name.str(), zone->junctions().size(), steps, timer);
+}
+
+
+#pragma mark - Extended Period Runs
+
+// a model run of the given length, from loading the file to the end of the run; one operation is a hydraulic step.
+// results go into an in-memory record, as they would into a database.
+void benchmarkModel(const string& name, const string& path, time_t duration, int hydraulicStep) {
+  boost::timer::cpu_timer loadTimer;
+  Model::sharedPointer model(new EpanetModel());
+  try {
+    model->loadModelFromFile(path);
+  } catch (...) {
+    cerr << name << ": could not load " << path << endl;
+    return;
+  }
+  report("model_load", name, model->junctions().size(), 1, loadTimer);
+
+  model->setStorage(PointRecord::sharedPointer(new VectorPointRecord()));
+  model->setHydraulicTimeStep(hydraulicStep);
+  boost::timer::cpu_timer runTimer;
+  model->runExtendedPeriod(startTime, startTime + duration);
+  report("model_run", name, model->junctions().size(), (size_t)(duration / hydraulicStep), runTimer);
+}
+
+void benchmarkGrid(int side, time_t duration) {
+  string path = gridNetwork(side);
+  stringstream name;
+  name << "grid_" << side << "x" << side;
+  benchmarkModel(name.str(), path, duration, 900);
+  remove(path.c_str());
+}
+
+
+// a side x side mesh of 100 m pipes, fed from its corners by two reservoirs (as in solver_profiling)
+string gridNetwork(int side) {
+  stringstream name;
+  name << "benchmark_grid_" << side << ".inp";
+  ofstream inp(name.str().c_str());
+
+  inp << "[JUNCTIONS]" << endl;
+  for (int r = 0; r < side; ++r) {
+    for (int c = 0; c < side; ++c) {
+      inp << "J" << r << "_" << c << " 0 0.1" << endl;
+    }
+  }
+  inp << "[RESERVOIRS]" << endl << "R1 60" << endl << "R2 60" << endl;
+
+  inp << "[PIPES]" << endl;
+  for (int r = 0; r < side; ++r) {
+    for (int c = 0; c < side; ++c) {
+      if (c + 1 < side) {
+        inp << "H" << r << "_" << c << " J" << r << "_" << c << " J" << r << "_" << (c + 1) << " 100 300 100" << endl;
+      }
+      if (r + 1 < side) {
+        inp << "V" << r << "_" << c << " J" << r << "_" << c << " J" << (r + 1) << "_" << c << " 100 300 100" << endl;
+      }
+    }
+  }
+  inp << "F1 R1 J0_0 100 600 100" << endl;
+  inp << "F2 R2 J" << (side - 1) << "_" << (side - 1) << " 100 600 100" << endl;
+
+  inp << "[OPTIONS]" << endl << "Units LPS" << endl << "Headloss H-W" << endl;
+  inp << "[TIMES]" << endl << "Duration 8760:00" << endl;
+  inp << "[END]" << endl;
+
+  return name.str();
+}
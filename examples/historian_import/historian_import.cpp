@@ -0,0 +1,130 @@
+//
+//  historian_import.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+//  Seeds a record with history, through HistorianImport: from another record defined in the same config (the
+//  historian, say), or from a CSV file of tag,time,value[,quality[,confidence]] lines.
+//
+//  usage: rtx-import config destination (--source record [--tags a,b,c] | --csv file) [options]
+//    --start t, --end t     unix times to import between. needed with --source
+//    --partition seconds    how much of a tag each partition takes (a day by default)
+//    --threads n            worker threads (one per core by default)
+//    --checkpoint file      notes what's done, so that running again carries on from there
+//  progress, and anything that fails, goes to stderr. the exit status is 1 if any partition failed.
+//
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <boost/foreach.hpp>
+
+#include "ConfigFactory.h"
+#include "HistorianImport.h"
+#include "Log.h"
+
+using namespace std;
+using namespace RTX;
+
+static void usage() {
+  cerr << "usage: rtx-import config destination (--source record [--tags a,b,c] | --csv file) [--start t] [--end t] [--partition seconds] [--threads n] [--checkpoint file]" << endl;
+}
+
+static PointRecord::sharedPointer recordNamed(ConfigFactory& config, const string& name) {
+  map<string, PointRecord::sharedPointer> records = config.pointRecords();
+  if (records.find(name) == records.end()) {
+    cerr << "no record named " << name << " in the config" << endl;
+    exit(1);
+  }
+  return records[name];
+}
+
+int main (int argc, const char * argv[])
+{
+  if (argc < 5) {
+    usage();
+    return 1;
+  }
+  string configPath(argv[1]), destinationName(argv[2]);
+  string sourceName, csvPath, checkpointPath;
+  vector<string> tags;
+  time_t start = 0, end = 0, partition = 0;
+  size_t threads = 0;
+  for (int iArg = 3; iArg + 1 < argc; iArg += 2) {
+    string option(argv[iArg]), value(argv[iArg + 1]);
+    if (option == "--source") {
+      sourceName = value;
+    }
+    else if (option == "--csv") {
+      csvPath = value;
+    }
+    else if (option == "--tags") {
+      stringstream list(value);
+      string tag;
+      while (getline(list, tag, ',')) {
+        tags.push_back(tag);
+      }
+    }
+    else if (option == "--start") {
+      start = (time_t)atol(value.c_str());
+    }
+    else if (option == "--end") {
+      end = (time_t)atol(value.c_str());
+    }
+    else if (option == "--partition") {
+      partition = (time_t)atol(value.c_str());
+    }
+    else if (option == "--threads") {
+      threads = (size_t)atol(value.c_str());
+    }
+    else if (option == "--checkpoint") {
+      checkpointPath = value;
+    }
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (sourceName.empty() == csvPath.empty()) {
+    usage();
+    return 1;
+  }
+
+  Log::setLevel("HistorianImport", Log::infoLevel);
+  ConfigFactory config;
+  config.loadConfigFile(configPath);
+
+  HistorianImport import(recordNamed(config, destinationName));
+  if (!sourceName.empty()) {
+    import.setSource(recordNamed(config, sourceName), tags);
+  }
+  else {
+    import.setCsvSource(csvPath);
+  }
+  import.setTimeRange(start, end);
+  if (partition > 0) {
+    import.setPartitionLength(partition);
+  }
+  import.setThreadCount(threads);
+  if (!checkpointPath.empty()) {
+    import.setCheckpointFile(checkpointPath);
+  }
+
+  try {
+    import.run();
+  } catch (RtxException& e) {
+    cerr << "import failed: " << e.what() << endl;
+    return 1;
+  }
+  HistorianImport::progress_t progress = import.progress();
+  cerr << progress.finished << " partitions imported, " << progress.skipped << " already done, " << progress.failed << " failed; " << progress.points << " points";
+  if (progress.rejectedLines > 0) {
+    cerr << ", " << progress.rejectedLines << " lines not understood";
+  }
+  cerr << endl;
+  return (progress.failed > 0) ? 1 : 0;
+}
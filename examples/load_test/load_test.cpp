@@ -0,0 +1,533 @@
+//
+//  load_test.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+//  Drives a model in real-time mode from a synthetic SCADA feed, to find how many tags and how large a network a
+//  machine can keep up with at a given cadence. Each tag is a raw series in an in-memory (or mmap) record, fed by a
+//  poller that delivers samples with jittered stamps, some of them late or out of order, and with gaps. The first
+//  tags are the model's boundaries -- reservoir heads, then junction demands, each resampled onto the cadence -- and
+//  the rest are only ingested. Every cadence the feed delivers what has arrived, and the model runs the live period
+//  a holdback behind the clock (the resamplers need a sample after each time they interpolate).
+//
+//  usage: rtx-loadtest [network.inp | --grid side] [options]
+//    --tags n            synthetic tags (500); at least the model's boundaries are fed
+//    --rate s            seconds between a tag's samples (60)
+//    --jitter s          each stamp moves up to this far either way (5)
+//    --late f            fraction of samples that arrive late (0.01), by up to --late-delay s (600)
+//    --out-of-order f    fraction that arrive after the sample following them (0.01)
+//    --gaps f            chance a sample starts a gap (0.001) of --gap-length s (900)
+//    --cadence s         live period, and the hydraulic step (60)
+//    --steps n           live periods to run (60)
+//    --speedup x         run the clock x times faster (1); 0 runs the periods back to back
+//    --holdback s        how far behind the clock each period is run (twice the rate)
+//    --catch-up s        the model's catch-up lag (0, never)
+//    --prefetch s        the model's prefetch window (0)
+//    --outage s          the model isn't run for this long from the middle of the test; the feed carries on
+//    --history s         feed delivered before the first period (3600)
+//    --streaming         resamplers compute as samples arrive
+//    --mmap dir          raw tags in an mmap record in dir, rather than a buffer
+//    --queue n           samples go through an ingest queue of n slots, drained at the start of each period
+//    --every n           periods per line of results (10)
+//    --metrics file      Prometheus text written there each line (see Metrics)
+//    --seed n            for the feed's random numbers (1)
+//  results go to stdout as CSV, a line every so many periods:
+//    periods,sim_time,latency_p50_ms,latency_p99_ms,latency_max_ms,lag_s,ingest_ms,samples,hit_rate,model_bytes,rss_bytes
+//  lag is how far the last period's results were behind the (scaled) wall clock when they were done; a lag that keeps
+//  growing is a machine that can't keep up. a summary, with the model's step profile, goes to stderr at the end.
+//  the model's catch-up compares live times with the real wall clock, so it only comes into play at --speedup 1.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/timer/timer.hpp>
+
+#include "BufferPointRecord.h"
+#include "IngestQueue.h"
+#include "MmapPointRecord.h"
+#include "TimeSeries.h"
+#include "Resampler.h"
+#include "EpanetModel.h"
+#include "Metrics.h"
+
+using namespace RTX;
+using namespace std;
+
+FILE* results = stdout;
+
+static void usage() {
+  cerr << "usage: rtx-loadtest [network.inp | --grid side] [--tags n] [--rate s] [--jitter s] [--late f] [--late-delay s]" << endl;
+  cerr << "         [--out-of-order f] [--gaps f] [--gap-length s] [--cadence s] [--steps n] [--speedup x] [--holdback s]" << endl;
+  cerr << "         [--catch-up s] [--prefetch s] [--outage s] [--history s] [--streaming] [--mmap dir] [--queue n]" << endl;
+  cerr << "         [--every n] [--metrics file] [--seed n]" << endl;
+}
+
+static double uniform() {
+  return (double)rand() / ((double)RAND_MAX + 1.);
+}
+
+string gridNetwork(int side);
+size_t residentBytes();
+double percentile(vector<double> values, double fraction);
+
+
+#pragma mark - Synthetic Feed
+
+// samples are generated as the clock passes their (jittered) stamps, and held until their arrival time -- later
+// for the late ones, just after the next sample for the out-of-order ones -- when the poller inserts them.
+class SyntheticFeed {
+public:
+  class tag_t {
+  public:
+    tag_t() : handle(0), base(0), next(0), gapUntil(0) {};
+    // simple tuple class, so no getters/setters
+    TimeSeries::sharedPointer raw;
+    PointRecord::handle_t handle; // in the raw record, for the queue
+    double base;      // the value the tag swings around, diurnally
+    time_t next;      // the next nominal sample time
+    time_t gapUntil;  // no samples before this
+  };
+  class counts_t {
+  public:
+    counts_t() : generated(0), delivered(0), late(0), reordered(0), gaps(0) {};
+    // simple tuple class, so no getters/setters
+    unsigned long generated, delivered, late, reordered, gaps;
+  };
+
+  SyntheticFeed() : rate(60), jitter(5), lateFraction(0.01), lateDelay(600), reorderFraction(0.01), gapChance(0.001), gapLength(900), _sequence(0) {};
+  // settings, then tags, then generate and deliver as the clock goes on
+  time_t rate, jitter;
+  double lateFraction;
+  time_t lateDelay;
+  double reorderFraction, gapChance;
+  time_t gapLength;
+  IngestQueue::sharedPointer queue; // if set, samples are pushed into it rather than inserted
+
+  void addTag(TimeSeries::sharedPointer raw, double base, time_t start) {
+    tag_t tag;
+    tag.raw = raw;
+    tag.handle = raw->record()->registerAndGetHandle(raw->name());
+    tag.base = base;
+    tag.next = start;
+    _tags.push_back(tag);
+  }
+  size_t tagCount() { return _tags.size(); };
+  counts_t counts() { return _counts; };
+
+  void generate(time_t until) {
+    for (size_t iTag = 0; iTag < _tags.size(); ++iTag) {
+      tag_t& tag = _tags[iTag];
+      for ( ; tag.next <= until; tag.next += rate) {
+        if (tag.next < tag.gapUntil) {
+          continue;
+        }
+        if (uniform() < gapChance) {
+          tag.gapUntil = tag.next + gapLength;
+          ++_counts.gaps;
+          continue;
+        }
+        time_t stamp = tag.next + (jitter > 0 ? (time_t)(rand() % (2 * jitter + 1)) - jitter : 0);
+        double diurnal = 1. + 0.3 * sin(2. * M_PI * (double)(stamp % 86400) / 86400.);
+        double value = tag.base * diurnal * (1. + 0.02 * (uniform() - 0.5));
+        arrival_t arrival;
+        arrival.time = stamp;
+        arrival.sequence = _sequence++;
+        arrival.tag = iTag;
+        arrival.point = Point(stamp, value, Point::good);
+        double draw = uniform();
+        if (draw < lateFraction) {
+          time_t maximumDelay = std::max(lateDelay, (time_t)1);
+          arrival.time += 1 + rand() % maximumDelay;
+          ++_counts.late;
+        }
+        else if (draw < lateFraction + reorderFraction) {
+          arrival.time += rate + 1;
+          ++_counts.reordered;
+        }
+        _pending.push(arrival);
+        ++_counts.generated;
+      }
+    }
+  }
+
+  // what has arrived by this time, inserted (or queued) in arrival order. returns how many.
+  size_t deliver(time_t until) {
+    size_t delivered = 0;
+    while (!_pending.empty() && _pending.top().time <= until) {
+      const arrival_t& arrival = _pending.top();
+      if (queue) {
+        queue->push(_tags[arrival.tag].handle, arrival.point);
+      }
+      else {
+        _tags[arrival.tag].raw->insert(arrival.point);
+      }
+      _pending.pop();
+      ++delivered;
+    }
+    _counts.delivered += delivered;
+    return delivered;
+  }
+
+private:
+  class arrival_t {
+  public:
+    time_t time;
+    unsigned long sequence; // ties go in the order generated
+    size_t tag;
+    Point point;
+    bool operator>(const arrival_t& other) const {
+      return (time != other.time) ? (time > other.time) : (sequence > other.sequence);
+    }
+  };
+  vector<tag_t> _tags;
+  priority_queue<arrival_t, vector<arrival_t>, greater<arrival_t> > _pending;
+  unsigned long _sequence;
+  counts_t _counts;
+};
+
+
+#pragma mark - Test
+
+int main(int argc, const char * argv[])
+{
+  string path = "../validator/sampletown.inp";
+  int gridSide = 0;
+  size_t tagCount = 500, steps = 60, every = 10, queueSlots = 0;
+  time_t cadence = 60, holdback = -1, catchUpLag = 0, prefetch = 0, outage = 0, history = 3600;
+  double speedup = 1;
+  bool streaming = false;
+  string mmapPath, metricsPath;
+  unsigned int seed = 1;
+  SyntheticFeed feed;
+
+  int iArg = 1;
+  if (argc > 1 && string(argv[1]).compare(0, 2, "--") != 0) {
+    path = argv[1];
+    iArg = 2;
+  }
+  for ( ; iArg < argc; ++iArg) {
+    string option(argv[iArg]);
+    if (option == "--streaming") {
+      streaming = true;
+      continue;
+    }
+    if (iArg + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    string value(argv[++iArg]);
+    double number = atof(value.c_str());
+    if      (option == "--grid")         gridSide = (int)number;
+    else if (option == "--tags")         tagCount = (size_t)number;
+    else if (option == "--rate")         feed.rate = RTX_MAX((time_t)number, (time_t)1);
+    else if (option == "--jitter")       feed.jitter = (time_t)number;
+    else if (option == "--late")         feed.lateFraction = number;
+    else if (option == "--late-delay")   feed.lateDelay = (time_t)number;
+    else if (option == "--out-of-order") feed.reorderFraction = number;
+    else if (option == "--gaps")         feed.gapChance = number;
+    else if (option == "--gap-length")   feed.gapLength = (time_t)number;
+    else if (option == "--cadence")      cadence = RTX_MAX((time_t)number, (time_t)1);
+    else if (option == "--steps")        steps = (size_t)number;
+    else if (option == "--speedup")      speedup = RTX_MAX(number, 0.);
+    else if (option == "--holdback")     holdback = (time_t)number;
+    else if (option == "--catch-up")     catchUpLag = (time_t)number;
+    else if (option == "--prefetch")     prefetch = (time_t)number;
+    else if (option == "--outage")       outage = (time_t)number;
+    else if (option == "--history")      history = (time_t)number;
+    else if (option == "--mmap")         mmapPath = value;
+    else if (option == "--queue")        queueSlots = (size_t)number;
+    else if (option == "--every")        every = RTX_MAX((size_t)number, (size_t)1);
+    else if (option == "--metrics")      metricsPath = value;
+    else if (option == "--seed")         seed = (unsigned int)number;
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (holdback < 0) {
+    holdback = 2 * feed.rate;
+  }
+  srand(seed);
+
+  // the engine writes its report to stdout; it goes to stderr instead, and the results to what was stdout
+  int resultsDescriptor = dup(fileno(stdout));
+  if (resultsDescriptor >= 0 && dup2(fileno(stderr), fileno(stdout)) >= 0) {
+    results = fdopen(resultsDescriptor, "w");
+  }
+
+  Model::sharedPointer model(new EpanetModel());
+  try {
+    if (gridSide > 0) {
+      path = gridNetwork(gridSide);
+      model->loadModelFromFile(path);
+      remove(path.c_str());
+    }
+    else {
+      model->loadModelFromFile(path);
+    }
+  } catch (...) {
+    cerr << "could not load " << path << endl;
+    return 1;
+  }
+  model->setStorage(PointRecord::sharedPointer(new BufferPointRecord()));
+  model->setHydraulicTimeStep((int)cadence);
+  model->overrideControls();
+  model->setCatchUpLag(catchUpLag);
+  model->setPrefetchWindow(prefetch);
+  model->setProfilesSteps(true);
+
+  Metrics::sharedPointer metrics;
+  if (!metricsPath.empty()) {
+    metrics.reset(new Metrics());
+    model->setMetrics(metrics, "loadtest");
+    metrics->watchModel(model, "loadtest");
+    metrics->addSink(Metrics::Sink::sharedPointer(new PrometheusSink(metricsPath)));
+  }
+
+  // the tags: raw series in one record, and -- for the boundaries -- resamplers onto the cadence, in another
+  PointRecord::sharedPointer rawRecord;
+  if (!mmapPath.empty()) {
+    MmapPointRecord::sharedPointer mmap(new MmapPointRecord());
+    mmap->setPath(mmapPath);
+    rawRecord = mmap;
+  }
+  else {
+    rawRecord.reset(new BufferPointRecord());
+  }
+  PointRecord::sharedPointer resampledRecord(new BufferPointRecord());
+
+  time_t now = time(NULL);
+  time_t simStart = now - now % cadence;
+  time_t feedStart = simStart - history - holdback;
+  Clock::sharedPointer cadenceClock(new Clock((int)cadence, simStart % cadence));
+  vector<TimeSeries::sharedPointer> watched;
+
+  vector<Junction::sharedPointer> boundaries;
+  BOOST_FOREACH(Reservoir::sharedPointer reservoir, model->reservoirs()) {
+    boundaries.push_back(reservoir);
+  }
+  BOOST_FOREACH(Junction::sharedPointer junction, model->junctions()) {
+    boundaries.push_back(junction);
+  }
+  tagCount = RTX_MAX(tagCount, boundaries.size());
+
+  for (size_t iTag = 0; iTag < tagCount; ++iTag) {
+    stringstream name;
+    name << "tag " << iTag;
+    TimeSeries::sharedPointer raw(new TimeSeries());
+    raw->setName(name.str());
+    double base = 1 + (double)(iTag % 17);
+
+    if (iTag < boundaries.size()) {
+      Junction::sharedPointer junction = boundaries[iTag];
+      Reservoir::sharedPointer reservoir = boost::dynamic_pointer_cast<Reservoir>(junction);
+      raw->setUnits(reservoir ? reservoir->head()->units() : junction->demand()->units());
+      base = reservoir ? reservoir->elevation() : junction->baseDemand();
+      Resampler::sharedPointer resampled(new Resampler());
+      resampled->setName(name.str() + " resampled");
+      resampled->setUnits(raw->units());
+      resampled->setSource(raw);
+      resampled->setClock(cadenceClock);
+      resampled->setRecord(resampledRecord);
+      resampled->setStreaming(streaming);
+      if (reservoir) {
+        reservoir->setBoundaryHead(resampled);
+      }
+      else {
+        junction->setBoundaryFlow(resampled);
+      }
+      watched.push_back(resampled);
+    }
+    raw->setRecord(rawRecord);
+    watched.push_back(raw);
+    feed.addTag(raw, base, feedStart);
+  }
+
+  // history, so the first periods have something to look back on
+  feed.generate(simStart);
+  feed.deliver(simStart);
+  // the queue is for what arrives from here on -- the history is more than it's meant to hold between periods
+  if (queueSlots > 0) {
+    feed.queue.reset(new IngestQueue(rawRecord, queueSlots));
+    model->addIngestQueue(feed.queue);
+  }
+
+  cerr << "load test: " << model->junctions().size() << " junctions, " << feed.tagCount() << " tags ("
+       << boundaries.size() << " boundaries), " << steps << " periods of " << cadence << " s at " << speedup << "x" << endl;
+  fputs("periods,sim_time,latency_p50_ms,latency_p99_ms,latency_max_ms,lag_s,ingest_ms,samples,hit_rate,model_bytes,rss_bytes\n", results);
+
+  time_t outageStart = simStart + (time_t)(steps / 2) * cadence;
+  vector<double> latencies, interval, lags;
+  double ingestSeconds = 0, overruns = 0;
+  size_t samples = 0, catchUps = 0, skipped = 0;
+  boost::timer::cpu_timer wall;
+
+  for (size_t iStep = 0; iStep < steps; ++iStep) {
+    time_t simNow = simStart + (time_t)(iStep + 1) * cadence;
+    double due = (double)(iStep + 1) * (double)cadence / (speedup > 0 ? speedup : 1.);
+    if (speedup > 0) {
+      double ahead = due - (double)wall.elapsed().wall / 1.e9;
+      if (ahead > 0) {
+        boost::this_thread::sleep(boost::posix_time::microseconds((long)(ahead * 1.e6)));
+      }
+    }
+    else {
+      due = (double)wall.elapsed().wall / 1.e9;
+    }
+
+    boost::timer::cpu_timer ingestTimer;
+    feed.generate(simNow);
+    samples += feed.deliver(simNow);
+    ingestSeconds += (double)ingestTimer.elapsed().wall / 1.e9;
+
+    if (outage > 0 && simNow >= outageStart && simNow < outageStart + outage) {
+      ++skipped;
+    }
+    else {
+      time_t liveTime = simNow - holdback;
+      if (catchUpLag > 0 && model->liveTime() > 0 && time(NULL) - model->liveTime() > catchUpLag) {
+        ++catchUps;
+      }
+      boost::timer::cpu_timer stepTimer;
+      try {
+        model->runLivePeriod(liveTime);
+      } catch (exception& e) {
+        cerr << "period at " << liveTime << " failed: " << e.what() << endl;
+      }
+      double latency = (double)stepTimer.elapsed().wall / 1.e9;
+      latencies.push_back(latency);
+      interval.push_back(latency);
+      if (speedup > 0 && latency > (double)cadence / speedup) {
+        ++overruns;
+      }
+      double late = RTX_MAX((double)wall.elapsed().wall / 1.e9 - due, 0.);
+      lags.push_back((double)holdback + late * (speedup > 0 ? speedup : 1.));
+    }
+
+    if ((iStep + 1) % every == 0 || iStep + 1 == steps) {
+      unsigned long hits = 0, misses = 0;
+      BOOST_FOREACH(TimeSeries::sharedPointer series, watched) {
+        TimeSeries::stats_t stats = series->stats();
+        hits += stats.cacheHits;
+        misses += stats.cacheMisses;
+      }
+      stringstream line;
+      line << (iStep + 1) << "," << simNow << "," << fixed << setprecision(3)
+           << 1000. * percentile(interval, 0.5) << "," << 1000. * percentile(interval, 0.99) << ","
+           << 1000. * percentile(interval, 1.) << "," << setprecision(1) << (lags.empty() ? 0. : lags.back()) << ","
+           << setprecision(3) << 1000. * ingestSeconds << "," << samples << "," << setprecision(4)
+           << ((hits + misses) ? (double)hits / (double)(hits + misses) : 0.) << ","
+           << model->memoryFootprint().total() << "," << residentBytes() << endl;
+      fputs(line.str().c_str(), results);
+      fflush(results);
+      interval.clear();
+      ingestSeconds = 0;
+      samples = 0;
+      if (metrics) {
+        metrics->publish();
+      }
+    }
+  }
+
+  SyntheticFeed::counts_t counts = feed.counts();
+  ios_base::fmtflags cerrFlags = cerr.flags();
+  streamsize cerrPrecision = cerr.precision();
+  cerr << endl << "periods run      " << latencies.size() << " (" << skipped << " in the outage, " << catchUps << " catching up)" << endl;
+  cerr << fixed << setprecision(3);
+  cerr << "latency ms       p50 " << 1000. * percentile(latencies, 0.5) << "  p90 " << 1000. * percentile(latencies, 0.9)
+       << "  p99 " << 1000. * percentile(latencies, 0.99) << "  max " << 1000. * percentile(latencies, 1.) << endl;
+  cerr << setprecision(1);
+  cerr << "lag s            last " << (lags.empty() ? 0. : lags.back()) << "  max " << percentile(lags, 1.) << endl;
+  cerr << "over cadence     " << (size_t)overruns << " periods" << endl;
+  cerr << "samples          " << counts.generated << " generated, " << counts.delivered << " delivered, " << counts.late
+       << " late, " << counts.reordered << " out of order, " << counts.gaps << " gaps" << endl;
+  if (feed.queue) {
+    cerr << "ingest queue     " << feed.queue->capacity() << " slots, " << feed.queue->overflowCount() << " overflowed" << endl;
+  }
+  cerr.flags(cerrFlags);
+  cerr.precision(cerrPrecision);
+  cerr << endl;
+  model->profileToStream(cerr);
+  model->memoryToStream(cerr);
+
+  fclose(results);
+  return 0;
+}
+
+
+// the value below which the fraction of them fall; 0 if there are none
+double percentile(vector<double> values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  // nearest rank: the ceil(fraction * n)th smallest, counting from 1
+  size_t rank = (size_t)ceil(fraction * (double)values.size());
+  rank = std::min(std::max(rank, (size_t)1), values.size());
+  size_t index = rank - 1;
+  nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+
+// the process's resident memory now where the system says (linux), otherwise its peak
+size_t residentBytes() {
+  ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  if (statm >> pages >> resident) {
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (size_t)usage.ru_maxrss;
+}
+
+
+// a side x side mesh of 100 m pipes, fed from its corners by two reservoirs (as in benchmarks)
+string gridNetwork(int side) {
+  stringstream name;
+  name << "loadtest_grid_" << side << ".inp";
+  ofstream inp(name.str().c_str());
+
+  inp << "[JUNCTIONS]" << endl;
+  for (int r = 0; r < side; ++r) {
+    for (int c = 0; c < side; ++c) {
+      inp << "J" << r << "_" << c << " 0 0.1" << endl;
+    }
+  }
+  inp << "[RESERVOIRS]" << endl << "R1 60" << endl << "R2 60" << endl;
+
+  inp << "[PIPES]" << endl;
+  for (int r = 0; r < side; ++r) {
+    for (int c = 0; c < side; ++c) {
+      if (c + 1 < side) {
+        inp << "H" << r << "_" << c << " J" << r << "_" << c << " J" << r << "_" << (c + 1) << " 100 300 100" << endl;
+      }
+      if (r + 1 < side) {
+        inp << "V" << r << "_" << c << " J" << r << "_" << c << " J" << (r + 1) << "_" << c << " 100 300 100" << endl;
+      }
+    }
+  }
+  inp << "F1 R1 J0_0 100 600 100" << endl;
+  inp << "F2 R2 J" << (side - 1) << "_" << (side - 1) << " 100 600 100" << endl;
+
+  inp << "[OPTIONS]" << endl << "Units LPS" << endl << "Headloss H-W" << endl;
+  inp << "[TIMES]" << endl << "Duration 8760:00" << endl;
+  inp << "[END]" << endl;
+
+  return name.str();
+}
@@ -0,0 +1,519 @@
+//
+//  regression.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+//  Checks for behavior that has gone wrong before, on small networks and in-memory data -- no database, no config.
+//  Each check prints a line, ok or FAILED with what it saw; the exit status is the number that failed.
+//
+//  usage: rtx-regression (or make check)
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+
+#include "EpanetModel.h"
+#include "EnergyAccounting.h"
+#include "BufferPointRecord.h"
+#include "Resampler.h"
+#include "MovingAverage.h"
+#include "OffsetTimeSeries.h"
+#include "CurveFunction.h"
+#include "AggregatorTimeSeries.h"
+
+using namespace RTX;
+using namespace std;
+
+FILE* results = stdout;
+int failures = 0;
+
+void check(const string& name, bool passed, const string& detail) {
+  stringstream line;
+  line << (passed ? "ok      " : "FAILED  ") << name;
+  if (!passed) {
+    line << ": " << detail;
+    ++failures;
+  }
+  line << endl;
+  fputs(line.str().c_str(), results);
+  fflush(results);
+}
+
+bool isClose(double value, double expected, double tolerance) {
+  return fabs(value - expected) <= tolerance * fabs(expected);
+}
+
+void checkPumpEnergy();
+void checkCorrections();
+void checkResampledUnits();
+void checkResampledPoints();
+void checkDerivedQuality();
+void checkIrregularMovingAverage();
+void checkChunkedMovingAverage();
+void checkMixedAggregator();
+
+
+int main(int argc, const char * argv[])
+{
+  // the engine writes its report to stdout; it goes to stderr instead, and the checks to what was stdout
+  int resultsDescriptor = dup(fileno(stdout));
+  if (resultsDescriptor >= 0 && dup2(fileno(stderr), fileno(stdout)) >= 0) {
+    results = fdopen(resultsDescriptor, "w");
+  }
+
+  checkPumpEnergy();
+  checkCorrections();
+  checkResampledUnits();
+  checkResampledPoints();
+  checkDerivedQuality();
+  checkIrregularMovingAverage();
+  checkChunkedMovingAverage();
+  checkMixedAggregator();
+
+  fclose(results);
+  return failures;
+}
+
+
+#pragma mark - Energy
+
+// a reservoir feeding a dead-end junction through one pump, whose single-point curve gives 100 ft at the junction's
+// 1000 gpm demand -- so the pump's operating point, and the engine's power for it, are known in advance.
+void checkPumpEnergy() {
+  const double headGain = 100;      // ft
+  const double flow = 1000;         // gpm
+  const double efficiency = 80;     // %
+  const double specificGravity = 1;
+
+  string path = "regression_pump.inp";
+  {
+    ofstream inp(path.c_str());
+    inp << "[JUNCTIONS]" << endl << "J1 0 " << flow << endl;
+    inp << "[RESERVOIRS]" << endl << "R1 100" << endl;
+    inp << "[PUMPS]" << endl << "P1 R1 J1 HEAD C1" << endl;
+    inp << "[CURVES]" << endl << "C1 " << flow << " " << headGain << endl;
+    inp << "[ENERGY]" << endl << "Global Efficiency " << efficiency << endl << "Global Price 0.1" << endl;
+    inp << "[OPTIONS]" << endl << "Units GPM" << endl << "Headloss H-W" << endl << "Specific Gravity " << specificGravity << endl;
+    inp << "[TIMES]" << endl << "Duration 24:00" << endl << "Hydraulic Timestep 1:00" << endl;
+    inp << "[END]" << endl;
+  }
+
+  Model::sharedPointer model(new EpanetModel());
+  try {
+    model->loadModelFromFile(path);
+  } catch (...) {
+    remove(path.c_str());
+    check("pump energy", false, "could not load the network");
+    return;
+  }
+  remove(path.c_str());
+  model->setStorage(PointRecord::sharedPointer(new BufferPointRecord()));
+  model->setHydraulicTimeStep(3600);
+  const time_t start = 1222873200, end = start + 4 * 3600;
+  model->runExtendedPeriod(start, end + 2 * 3600); // past the window, so its last interval is closed by a later result
+
+  // as the engine's getenergy: kw = dh (ft) * q (cfs) * sp. gravity / 8.814 / e * kw per hp
+  const double expectedKw = headGain * (flow / 448.831) * specificGravity / 8.814 / (efficiency / 100.) * 0.7457;
+
+  Pump::sharedPointer pump = boost::dynamic_pointer_cast<Pump>(model->linkWithName("P1"));
+  EnergyAccounting accounting(model);
+  EnergyAccounting::Totals totals = accounting.totals(pump, start, end);
+  stringstream detail;
+  detail << "peak " << totals.peakKw << " kW, " << totals.kwh << " kWh over 4 h; expected " << expectedKw << " kW";
+  check("pump energy: power at the operating point", isClose(totals.peakKw, expectedKw, 0.01), detail.str());
+  check("pump energy: energy over the window", isClose(totals.kwh, 4. * expectedKw, 0.01), detail.str());
+  check("pump energy: cost at the global price", isClose(totals.cost, 0.1 * 4. * expectedKw, 0.01), detail.str());
+}
+
+
+#pragma mark - Point Records
+
+// a point corrected in place has to be what point() gives afterwards, even on the thread that just read -- and so
+// cached -- the value it replaced.
+void checkCorrections() {
+  BufferPointRecord::sharedPointer record(new BufferPointRecord());
+  const string id = "corrected";
+  record->registerAndGetIdentifier(id);
+  vector<Point> range;
+  range.push_back(Point(0, 0));
+  range.push_back(Point(100, 1));
+  range.push_back(Point(200, 2));
+  record->addPoints(id, range);
+
+  const char* ways[] = {"addPoint", "addPoints", "mergePoints"};
+  for (int iWay = 0; iWay < 3; ++iWay) {
+    double corrected = 10 + iWay;
+    record->point(id, 100); // cached
+    vector<Point> batch;
+    batch.push_back(Point(100, corrected));
+    batch.push_back(Point(200, 2));
+    if (iWay == 0) {
+      record->addPoint(id, batch.front());
+    }
+    else if (iWay == 1) {
+      record->addPoints(id, batch);
+    }
+    else {
+      record->mergePoints(id, batch);
+    }
+    Point read = record->point(id, 100);
+    vector<Point> held = record->pointsInRange(id, 100, 100);
+    stringstream detail;
+    detail << "point() gave " << read.value << ", pointsInRange() " << (held.empty() ? -1. : held.front().value)
+           << "; expected " << corrected;
+    check(string("corrected point read back after ") + ways[iWay], read.value == corrected && held.size() == 1 && held.front().value == corrected, detail.str());
+  }
+}
+
+
+#pragma mark - Derived Series
+
+// a source in gpm, resampled in cfs: the same point has to come out of point() as out of points(), converted either
+// way -- whichever of the two fills the cache first decides what's held there.
+void checkResampledUnits() {
+  const time_t start = 1222873200, end = start + 6 * 3600;
+  TimeSeries::sharedPointer flow(new TimeSeries());
+  flow->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+  flow->setUnits(RTX_GALLON_PER_MINUTE);
+  vector<Point> measured;
+  for (time_t time = start - 700; time <= end + 700; time += 700) {
+    measured.push_back(Point(time, 100. + (double)((time - start) % 3700) / 37.));
+  }
+  flow->insertPoints(measured);
+
+  Resampler::sharedPointer pointwise(new Resampler()), ranged(new Resampler());
+  Resampler::sharedPointer resamplers[] = {pointwise, ranged};
+  for (int i = 0; i < 2; ++i) {
+    resamplers[i]->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+    resamplers[i]->setClock(Clock::sharedPointer(new Clock(300)));
+    resamplers[i]->setSource(flow);
+    resamplers[i]->setUnits(RTX_CUBIC_FOOT_PER_SECOND);
+  }
+
+  vector<Point> range = ranged->points(start, end);
+  size_t mismatches = 0;
+  stringstream detail;
+  for (size_t iPoint = 0; iPoint < range.size(); ++iPoint) {
+    const Point& expected = range[iPoint];
+    Point p = pointwise->point(expected.time);
+    if (!p.isValid || p.value != expected.value) {
+      if (mismatches++ == 0) {
+        detail << "at " << expected.time << " point() gave " << p.value << ", points() " << expected.value;
+      }
+    }
+  }
+  if (mismatches > 0) {
+    detail << " (" << mismatches << " of " << range.size() << " differ)";
+  }
+  check("resampler: point() matches points() in other units", !range.empty() && mismatches == 0, range.empty() ? "points() gave nothing" : detail.str());
+}
+
+// point() on its own, with only what the source has around that one time: a source point at the very time is the
+// answer even if the next one is missing, and a time between a slower source's points is interpolated.
+void checkResampledPoints() {
+  const time_t start = 1222873200;
+  const char* cases[] = {"exact source points either side of a gap", "between a slower source's points"};
+  const int sourcePeriods[] = {300, 600}, resampledPeriods[] = {600, 300};
+  const time_t missing[] = {2100, -1};
+  const time_t asked[][2] = {{1800, 2400}, {900, 900}};
+  for (int iCase = 0; iCase < 2; ++iCase) {
+    TimeSeries::sharedPointer source(new TimeSeries());
+    source->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+    source->setClock(Clock::sharedPointer(new Clock(sourcePeriods[iCase], start)));
+    vector<Point> measured;
+    for (time_t offset = 0; offset <= 3600; offset += sourcePeriods[iCase]) {
+      if (offset != missing[iCase]) {
+        measured.push_back(Point(start + offset, (double)offset / 300.));
+      }
+    }
+    source->insertPoints(measured);
+
+    stringstream detail;
+    bool passed = true;
+    for (int iTime = 0; iTime < 2; ++iTime) {
+      Resampler::sharedPointer resampler(new Resampler());
+      resampler->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+      resampler->setClock(Clock::sharedPointer(new Clock(resampledPeriods[iCase], start)));
+      resampler->setSource(source);
+      time_t offset = asked[iCase][iTime];
+      Point p = resampler->point(start + offset);
+      double expected = (double)offset / 300.;
+      if (passed && (!p.isValid || p.value != expected)) {
+        detail << "at +" << offset << " point() gave " << (p.isValid ? p.value : -1.) << "; expected " << expected;
+        passed = false;
+      }
+    }
+    check(string("resampler: point() ") + cases[iCase], passed, detail.str());
+  }
+}
+
+// an offset or a curve over a resampled source computes new values, whether a point at a time or a range in one
+// (fused) pass -- and the two have to agree on the quality, or which ran first decides what's cached.
+void checkDerivedQuality() {
+  const time_t start = 1222873200, end = start + 6 * 3600;
+  TimeSeries::sharedPointer measured(new TimeSeries());
+  measured->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+  vector<Point> raw;
+  for (time_t time = start - 700; time <= end + 700; time += 700) {
+    raw.push_back(Point(time, 10. + (double)((time - start) % 3700) / 370., Point::interpolated));
+  }
+  measured->insertPoints(raw);
+  Resampler::sharedPointer resampled(new Resampler());
+  resampled->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+  resampled->setClock(Clock::sharedPointer(new Clock(300)));
+  resampled->setSource(measured);
+
+  const char* kinds[] = {"offset", "curve function"};
+  for (int kind = 0; kind < 2; ++kind) {
+    ModularTimeSeries::sharedPointer derived[2];
+    for (int i = 0; i < 2; ++i) {
+      if (kind == 0) {
+        OffsetTimeSeries::sharedPointer offset(new OffsetTimeSeries());
+        offset->setOffset(5);
+        derived[i] = offset;
+      }
+      else {
+        CurveFunction::sharedPointer curve(new CurveFunction());
+        curve->addCurveCoordinate(0, 0);
+        curve->addCurveCoordinate(100, 50);
+        derived[i] = curve;
+      }
+      derived[i]->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+      derived[i]->setClock(Clock::sharedPointer(new Clock(300)));
+      derived[i]->setSource(resampled);
+    }
+
+    vector<Point> range = derived[1]->points(start, end);
+    size_t mismatches = 0;
+    stringstream detail;
+    for (size_t iPoint = 0; iPoint < range.size(); ++iPoint) {
+      Point p = derived[0]->point(range[iPoint].time);
+      if (!p.isValid || p.quality != range[iPoint].quality) {
+        if (mismatches++ == 0) {
+          detail << "at " << range[iPoint].time << " point() gave quality " << p.quality << ", points() " << range[iPoint].quality;
+        }
+      }
+    }
+    if (mismatches > 0) {
+      detail << " (" << mismatches << " of " << range.size() << " differ)";
+    }
+    check(string(kinds[kind]) + ": point() quality matches points()", !range.empty() && mismatches == 0, range.empty() ? "points() gave nothing" : detail.str());
+  }
+}
+
+// an irregular source's window is its nearest points, so a point or a range has to reach past the times asked for
+// to find them -- and a point on its own, a short range and a long one all have to give the same centered mean.
+void checkIrregularMovingAverage() {
+  const time_t start = 1222873200;
+  const int windowSize = 4, count = 40;
+  TimeSeries::sharedPointer source(new TimeSeries());
+  source->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+  vector<Point> measured;
+  time_t time = start;
+  for (int i = 0; i < count; ++i) {
+    time += 60 + (i * 37) % 250; // irregular steps
+    measured.push_back(Point(time, (double)((i * 53) % 17)));
+  }
+  source->insertPoints(measured);
+
+  size_t mismatches = 0;
+  stringstream detail;
+  for (int i = windowSize; i < count - windowSize; ++i) {
+    double sum = 0;
+    for (int j = i - windowSize / 2; j <= i + windowSize / 2; ++j) {
+      sum += measured[j].value;
+    }
+    double expected = sum / (windowSize / 2 * 2 + 1);
+    time_t q = measured[i].time;
+
+    double found[3];
+    for (int way = 0; way < 3; ++way) {
+      MovingAverage::sharedPointer average(new MovingAverage());
+      average->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+      average->setSource(source);
+      average->setWindowSize(windowSize);
+      found[way] = -1;
+      if (way == 0) {
+        Point p = average->point(q);
+        found[way] = p.isValid ? p.value : -1;
+      }
+      else {
+        time_t reach = (way == 1) ? 0 : 3600;
+        vector<Point> range = average->points(q - reach, q + reach);
+        for (size_t k = 0; k < range.size(); ++k) {
+          if (range[k].time == q) {
+            found[way] = range[k].value;
+          }
+        }
+      }
+    }
+    if (!isClose(found[0], expected, 1e-12) || !isClose(found[1], expected, 1e-12) || !isClose(found[2], expected, 1e-12)) {
+      if (mismatches++ == 0) {
+        detail << "at " << q << " point() gave " << found[0] << ", a short range " << found[1] << ", a long one "
+               << found[2] << "; expected " << expected;
+      }
+    }
+  }
+  if (mismatches > 0) {
+    detail << " (" << mismatches << " times differ)";
+  }
+  check("moving average: irregular source, point() and ranges agree", mismatches == 0, detail.str());
+}
+
+// a long range is split into chunks, one per evaluation thread. the running window sum mustn't start over wherever
+// a chunk does: the same times have to come out bit-for-bit the same on one thread or several, and from point().
+
+void checkChunkedMovingAverage() {
+  const time_t start = 1222873200;
+  const int count = 40000;
+  TimeSeries::sharedPointer source(new TimeSeries());
+  source->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+  source->setClock(Clock::sharedPointer(new Clock(60)));
+  vector<Point> measured;
+  for (int i = 0; i < count; ++i) {
+    measured.push_back(Point(start + 60 * i, 100. + 10. * sin(i / 7.) + 1. / (1 + i % 13)));
+  }
+  source->insertPoints(measured);
+  const time_t end = start + 60 * (count - 1);
+
+  vector<Point> found[2];
+  MovingAverage::sharedPointer averages[2];
+  const size_t threads[] = {1, 4};
+  for (int i = 0; i < 2; ++i) {
+    Resampler::sharedPointer resampled(new Resampler());
+    resampled->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+    resampled->setClock(Clock::sharedPointer(new Clock(60)));
+    resampled->setSource(source);
+    averages[i].reset(new MovingAverage());
+    averages[i]->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+    averages[i]->setClock(Clock::sharedPointer(new Clock(60)));
+    averages[i]->setSource(resampled);
+    averages[i]->setWindowSize(7);
+    averages[i]->setEvaluationThreads(threads[i]);
+    found[i] = averages[i]->points(start, end);
+  }
+
+  size_t mismatches = 0;
+  stringstream detail;
+  if (found[0].size() != found[1].size()) {
+    detail << "1 thread gave " << found[0].size() << " points, 4 threads " << found[1].size();
+    ++mismatches;
+  }
+  for (size_t iPoint = 0; mismatches == 0 && iPoint < found[0].size(); ++iPoint) {
+    const Point& one = found[0][iPoint];
+    const Point& several = found[1][iPoint];
+    if (one.time != several.time || one.value != several.value) {
+      detail.precision(17);
+      detail << "at " << one.time << " 1 thread gave " << one.value << ", 4 threads " << several.value;
+      ++mismatches;
+    }
+  }
+  check("moving average: chunked evaluation matches one thread", !found[0].empty() && mismatches == 0, found[0].empty() ? "points() gave nothing" : detail.str());
+
+  // and a point on its own, on a fresh series, at either side of each chunk boundary
+  mismatches = 0;
+  stringstream pointDetail;
+  for (size_t i = 1; i < 4; ++i) {
+    size_t boundary = i * found[0].size() / 4;
+    for (size_t iPoint = boundary - 1; iPoint <= boundary; ++iPoint) {
+      MovingAverage::sharedPointer average(new MovingAverage());
+      average->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+      average->setClock(Clock::sharedPointer(new Clock(60)));
+      average->setSource(averages[0]->source());
+      average->setWindowSize(7);
+      Point p = average->point(found[0][iPoint].time);
+      if (!p.isValid || p.value != found[0][iPoint].value) {
+        if (mismatches++ == 0) {
+          pointDetail.precision(17);
+          pointDetail << "at " << found[0][iPoint].time << " point() gave " << p.value << ", points() " << found[0][iPoint].value;
+        }
+      }
+    }
+  }
+  check("moving average: point() matches a chunked range", mismatches == 0, pointDetail.str());
+}
+
+// a zone's meters needn't be on one clock: a holding aggregator of a regular meter and an irregular one, added in
+// either order, sums at every time either has -- it mustn't take (or check against) the regular meter's clock.
+void checkMixedAggregator() {
+  const time_t start = 1222873200, end = start + 2 * 3600;
+  TimeSeries::sharedPointer regular(new TimeSeries()), irregular(new TimeSeries());
+  regular->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+  regular->setClock(Clock::sharedPointer(new Clock(300, start)));
+  irregular->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+  vector<Point> regularPoints, irregularPoints;
+  for (time_t time = start - 300; time <= end; time += 300) {
+    regularPoints.push_back(Point(time, (double)((time - start) / 300)));
+  }
+  for (time_t time = start - 71; time <= end; time += 211) {
+    irregularPoints.push_back(Point(time, 1000. + (double)((time - start) % 97)));
+  }
+  regular->insertPoints(regularPoints);
+  irregular->insertPoints(irregularPoints);
+
+  // at each time either source gives in the range, each source's latest value at or before it, summed
+  map<time_t, double> expected;
+  TimeSeries::sharedPointer sources[] = {regular, irregular};
+  for (int iSource = 0; iSource < 2; ++iSource) {
+    vector<Point> inRange = sources[iSource]->points(start, end);
+    for (size_t i = 0; i < inRange.size(); ++i) {
+      expected[inRange[i].time] = 0;
+    }
+  }
+  for (map<time_t, double>::iterator it = expected.begin(); it != expected.end(); ++it) {
+    const vector<Point>* series[] = {&regularPoints, &irregularPoints};
+    for (int iSource = 0; iSource < 2; ++iSource) {
+      double held = 0;
+      for (size_t k = 0; k < series[iSource]->size() && (*series[iSource])[k].time <= it->first; ++k) {
+        held = (*series[iSource])[k].value;
+      }
+      it->second += held;
+    }
+  }
+
+  const char* orders[] = {"regular first", "irregular first"};
+  for (int order = 0; order < 2; ++order) {
+    AggregatorTimeSeries::sharedPointer zone(new AggregatorTimeSeries());
+    zone->setRecord(PointRecord::sharedPointer(new BufferPointRecord()));
+    zone->setAlignment(AggregatorTimeSeries::holdAlignment);
+    stringstream detail;
+    bool passed = true;
+    try {
+      zone->addSource(order == 0 ? regular : irregular);
+      zone->addSource(order == 0 ? irregular : regular);
+    } catch (...) {
+      detail << "addSource threw";
+      passed = false;
+    }
+    if (passed && zone->clock()->isRegular()) {
+      detail << "took a regular clock, period " << zone->clock()->period();
+      passed = false;
+    }
+    if (passed) {
+      vector<Point> sums = zone->points(start, end);
+      size_t mismatches = 0;
+      if (sums.size() != expected.size()) {
+        detail << "gave " << sums.size() << " points; expected " << expected.size();
+        passed = false;
+      }
+      for (size_t k = 0; passed && k < sums.size(); ++k) {
+        map<time_t, double>::iterator it = expected.find(sums[k].time);
+        if (it == expected.end() || !isClose(sums[k].value, it->second, 1e-12)) {
+          if (mismatches++ == 0) {
+            detail << "at " << sums[k].time << " gave " << sums[k].value << "; expected " << (it == expected.end() ? -1. : it->second);
+          }
+        }
+      }
+      passed = passed && mismatches == 0;
+    }
+    check(string("aggregator: held regular and irregular sources, ") + orders[order], passed, detail.str());
+  }
+}
@@ -0,0 +1,139 @@
+//
+//  scenario_dispatch.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+//  Runs a sweep of scenarios across machines that share a spool directory (see ScenarioDispatcher). Start one
+//  coordinator with the sweep, and a worker on each machine with the model's config; workers can come and go.
+//
+//  usage: rtx-dispatch coordinator spool sweep start end [--lease seconds] [--attempts n]
+//         rtx-dispatch worker config spool [--record name] [--threads n] [--name worker] [--exit-when-idle]
+//    sweep        a file of scenarios (see ScenarioDispatcher::readScenarios)
+//    start, end   unix times to run each scenario over
+//    --record     the record in the config to store results in, under each scenario's name
+//  the coordinator's exit status is 1 if any scenario ran out of attempts; when it's done, the workers stop too.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <boost/foreach.hpp>
+
+#include "ConfigFactory.h"
+#include "ScenarioDispatch.h"
+#include "Log.h"
+
+using namespace std;
+using namespace RTX;
+
+static void usage() {
+  cerr << "usage: rtx-dispatch coordinator spool sweep start end [--lease seconds] [--attempts n]" << endl;
+  cerr << "       rtx-dispatch worker config spool [--record name] [--threads n] [--name worker] [--exit-when-idle]" << endl;
+}
+
+static int coordinate(int argc, const char * argv[]) {
+  if (argc < 6) {
+    usage();
+    return 1;
+  }
+  ScenarioDispatcher dispatcher(argv[2]);
+  time_t start = (time_t)atol(argv[4]), end = (time_t)atol(argv[5]);
+  for (int iArg = 6; iArg + 1 < argc; iArg += 2) {
+    string option(argv[iArg]), value(argv[iArg + 1]);
+    if (option == "--lease") {
+      dispatcher.setLeaseTimeout((time_t)atol(value.c_str()));
+    }
+    else if (option == "--attempts") {
+      dispatcher.setMaxAttempts((size_t)atol(value.c_str()));
+    }
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  try {
+    BOOST_FOREACH(ScenarioEnsemble::Scenario::sharedPointer scenario, ScenarioDispatcher::readScenarios(argv[3])) {
+      dispatcher.addScenario(scenario);
+    }
+    dispatcher.run(start, end);
+  } catch (RtxException& e) {
+    cerr << "dispatch failed: " << e.what() << endl;
+    return 1;
+  }
+  dispatcher.stopWorkers();
+  ScenarioDispatcher::progress_t progress = dispatcher.progress();
+  cerr << progress.finished << " of " << progress.scenarios << " scenarios finished, " << progress.failed << " failed, " << progress.retried << " retried" << endl;
+  return (progress.failed > 0) ? 1 : 0;
+}
+
+static int work(int argc, const char * argv[]) {
+  if (argc < 4) {
+    usage();
+    return 1;
+  }
+  string recordName, workerName;
+  size_t threads = 1;
+  bool exitsWhenIdle = false;
+  for (int iArg = 4; iArg < argc; ++iArg) {
+    string option(argv[iArg]);
+    if (option == "--exit-when-idle") {
+      exitsWhenIdle = true;
+      continue;
+    }
+    if (iArg + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    string value(argv[++iArg]);
+    if (option == "--record") {
+      recordName = value;
+    }
+    else if (option == "--threads") {
+      threads = (size_t)atol(value.c_str());
+    }
+    else if (option == "--name") {
+      workerName = value;
+    }
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  ConfigFactory config;
+  config.loadConfigFile(argv[2]);
+  ScenarioWorker worker(config.model(), argv[3], threads);
+  if (!recordName.empty()) {
+    map<string, PointRecord::sharedPointer> records = config.pointRecords();
+    if (records.find(recordName) == records.end()) {
+      cerr << "no record named " << recordName << " in the config" << endl;
+      return 1;
+    }
+    worker.setStorage(records[recordName]);
+  }
+  if (!workerName.empty()) {
+    worker.setName(workerName);
+  }
+  worker.setExitsWhenIdle(exitsWhenIdle);
+  worker.run();
+  return 0;
+}
+
+int main (int argc, const char * argv[])
+{
+  Log::setLevel("ScenarioDispatcher", Log::infoLevel);
+  Log::setLevel("ScenarioWorker", Log::infoLevel);
+  string mode = (argc > 1) ? argv[1] : "";
+  if (mode == "coordinator") {
+    return coordinate(argc, argv);
+  }
+  if (mode == "worker") {
+    return work(argc, argv);
+  }
+  usage();
+  return 1;
+}
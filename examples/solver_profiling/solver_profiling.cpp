@@ -0,0 +1,153 @@
+//
+//  solver_profiling.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+//  Times the embedded engine's hydraulic solver on its own -- no time series, no model wrapper. Each network is
+//  solved a number of times from a cold start, so every solve takes the same Newton iterations, and the time per
+//  iteration is (almost all) linsolve's. The one-off setup -- reading the file, and ordering and symbolically
+//  factorizing the matrix -- is timed separately.
+//
+//  usage: solver_profiling [network.inp | grid side ...]
+//  with no arguments it runs sampletown and synthetic square grids of 100, 1k and 10k junctions. Larger grids can be
+//  asked for by side (316 is 100k junctions), though the one-off minimum-degree ordering grows quickly with size.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <boost/timer/timer.hpp>
+
+#include "rtxMacros.h"
+
+extern "C" {
+  #include "epanet/src/toolkit.h"
+}
+
+using namespace std;
+
+string gridNetwork(int side);
+void profileGrid(int side);
+void profile(const string& label, const string& path, int solves);
+
+int main(int argc, const char * argv[])
+{
+  cout << left << setw(16) << "network" << right << setw(10) << "junctions" << setw(12) << "setup ms"
+       << setw(8) << "iter" << setw(12) << "ms/solve" << setw(12) << "us/iter" << endl;
+
+  if (argc > 1) {
+    for (int i = 1; i < argc; ++i) {
+      string arg(argv[i]);
+      if (arg.find_first_not_of("0123456789") == string::npos) {
+        profileGrid(atoi(argv[i]));
+      }
+      else {
+        profile(arg, arg, 20);
+      }
+    }
+    return 0;
+  }
+
+  profile("sampletown", "../validator/sampletown.inp", 1000);
+  profileGrid(10);
+  profileGrid(32);
+  profileGrid(100);
+
+  return 0;
+}
+
+
+void profileGrid(int side) {
+  string path = gridNetwork(side);
+  stringstream label;
+  label << "grid " << side << "x" << side;
+  profile(label.str(), path, (side < 100) ? 100 : 5);
+  remove(path.c_str());
+}
+
+
+// solve the network from scratch the given number of times, and print the average cost of a solve and an iteration.
+void profile(const string& label, const string& path, int solves) {
+  const char* report = "solver_profiling.rpt";
+  boost::timer::cpu_timer setup;
+  if (ENopen((char*)path.c_str(), (char*)report, (char*)"") > 10) {
+    cerr << label << ": could not open " << path << endl;
+    ENclose();
+    remove(report);
+    return;
+  }
+  int junctions = 0, tanks = 0, iterations = 0, totalIterations = 0;
+  long t;
+  ENgetcount(EN_NODECOUNT, &junctions);
+  ENgetcount(EN_TANKCOUNT, &tanks);
+  junctions -= tanks;
+
+  ENopenH();
+  ENinitH(0);
+  setup.stop();
+  ENsetoption(EN_STARTMODE, EN_COLDSTART);
+
+  boost::timer::cpu_timer timer;
+  for (int i = 0; i < solves; ++i) {
+    ENsettimeparam(EN_HTIME, 0);
+    ENrunH(&t);
+    ENgetstatistic(EN_ITERATIONS, &iterations);
+    totalIterations += iterations;
+  }
+  timer.stop();
+
+  ENcloseH();
+  ENclose();
+  remove(report);
+
+  double seconds = (double)timer.elapsed().wall / 1.e9;
+  totalIterations = RTX_MAX(totalIterations, 1);
+  cout << left << setw(16) << label << right << setw(10) << junctions
+       << setw(12) << fixed << setprecision(1) << ((double)setup.elapsed().wall / 1.e6)
+       << setw(8) << (totalIterations / solves)
+       << setw(12) << setprecision(3) << (1.e3 * seconds / solves)
+       << setw(12) << setprecision(1) << (1.e6 * seconds / totalIterations) << endl;
+}
+
+
+// a side x side mesh of 100 m pipes, fed from its corners by two reservoirs -- the kind of looped city grid that
+// makes the factorization the dominant cost of a solve.
+string gridNetwork(int side) {
+  stringstream name;
+  name << "grid_" << side << ".inp";
+  ofstream inp(name.str().c_str());
+
+  inp << "[JUNCTIONS]" << endl;
+  for (int r = 0; r < side; ++r) {
+    for (int c = 0; c < side; ++c) {
+      inp << "J" << r << "_" << c << " 0 0.1" << endl;
+    }
+  }
+  inp << "[RESERVOIRS]" << endl << "R1 60" << endl << "R2 60" << endl;
+
+  inp << "[PIPES]" << endl;
+  for (int r = 0; r < side; ++r) {
+    for (int c = 0; c < side; ++c) {
+      if (c + 1 < side) {
+        inp << "H" << r << "_" << c << " J" << r << "_" << c << " J" << r << "_" << (c + 1) << " 100 300 100" << endl;
+      }
+      if (r + 1 < side) {
+        inp << "V" << r << "_" << c << " J" << r << "_" << c << " J" << (r + 1) << "_" << c << " 100 300 100" << endl;
+      }
+    }
+  }
+  inp << "F1 R1 J0_0 100 600 100" << endl;
+  inp << "F2 R2 J" << (side - 1) << "_" << (side - 1) << " 100 600 100" << endl;
+
+  inp << "[OPTIONS]" << endl << "Units LPS" << endl << "Headloss H-W" << endl;
+  inp << "[TIMES]" << endl << "Duration 0" << endl;
+  inp << "[END]" << endl;
+
+  return name.str();
+}
@@ -7,16 +7,111 @@
 //  
 
 #include <iostream>
+#include <algorithm>
 
 #include "AggregatorTimeSeries.h"
+#include "Log.h"
+#include "Tracer.h"
 #include "boost/foreach.hpp"
+#include <boost/thread/locks.hpp>
 
 using namespace RTX;
 
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+namespace {
+  bool isUsable(const Point& p) {
+    return p.isValid && p.quality != Point::missing;
+  }
+  
+  // collects visited points into a vector
+  class PointCollector : public PointVisitor {
+  public:
+    PointCollector(std::vector<Point>& points) : _points(points) {};
+    virtual bool visit(const Point& point) {
+      _points.push_back(point);
+      return true;
+    }
+  private:
+    std::vector<Point>& _points;
+  };
+  
+  // one term per source, summed pairwise up a binary tree. changing a term re-adds just its path to the root, so
+  // the total is current in O(log k), without the drift of adding to and subtracting from a running total.
+  class TermTree {
+  public:
+    TermTree(size_t count) : _leaves(1) {
+      while (_leaves < count) {
+        _leaves *= 2;
+      }
+      _sums.assign(2 * _leaves, 0.);
+    };
+    void set(size_t i, double term) {
+      size_t node = _leaves + i;
+      _sums[node] = term;
+      for (node /= 2; node > 0; node /= 2) {
+        _sums[node] = _sums[2 * node] + _sums[2 * node + 1];
+      }
+    };
+    double total() {
+      return _sums[1];
+    };
+  private:
+    size_t _leaves;
+    std::vector<double> _sums;
+  };
+  
+  // a source's usable points over the range, with its last one before it and (when interpolating) its first after
+  class AlignedSource {
+  public:
+    // simple tuple class, so no getters/setters
+    std::vector<Point> points;
+    size_t next;  // the first of points after the time the merge has reached
+    size_t end;   // one past the last of points in the range
+    bool hasTerm; // has something to add to the sum
+  };
+  
+  // the source's term, from the segment it's on: points[next-1] to points[next]
+  void setTerm(const AlignedSource& source, size_t i, TermTree& levels, TermTree& slopes, TermTree& confidences, double factor, time_t start, bool isLinear) {
+    const Point& previous = source.points[source.next - 1];
+    double level = previous.value, slope = 0;
+    if (isLinear && source.next < source.points.size()) {
+      const Point& following = source.points[source.next];
+      slope = (following.value - previous.value) / (double)(following.time - previous.time);
+      level += slope * (double)(start - previous.time);
+    }
+    levels.set(i, factor * level);
+    slopes.set(i, factor * slope);
+    confidences.set(i, previous.confidence);
+  }
+  
+  // heap entries: the time of a source's next point in the range, and the source. earliest on top.
+  typedef std::pair<time_t, size_t> mergeEntry_t;
+  bool isLater(const mergeEntry_t& left, const mergeEntry_t& right) {
+    return left > right;
+  }
+}
+
+AggregatorTimeSeries::AggregatorTimeSeries() : _alignment(exactAlignment) {
+  
+}
+
+AggregatorTimeSeries::~AggregatorTimeSeries() {
+  typedef std::pair< TimeSeries::sharedPointer, double > tsPair_t;
+  BOOST_FOREACH(tsPair_t tsPair , _tsList) {
+    tsPair.first->removeDependent(this);
+  }
+}
+
 void AggregatorTimeSeries::addSource(TimeSeries::sharedPointer timeSeries, double multiplier) throw(RtxException) {
   
-  // check compatibility
-  if (!isCompatibleWith(timeSeries)) throw IncompatibleComponent();
+  // check compatibility. aligned sources keep their own times, so only the units have to agree.
+  if (_alignment == exactAlignment) {
+    if (!isCompatibleWith(timeSeries)) throw IncompatibleComponent();
+  }
+  else if (!units().isDimensionless() && !units().isSameDimensionAs(timeSeries->units())) {
+    throw IncompatibleComponent();
+  }
   
   if (units().isDimensionless() && sources().size() == 0) {
     // we have default units and no sources yet, so it would be safe to adopt the new source's units.
@@ -25,9 +120,14 @@ void AggregatorTimeSeries::addSource(TimeSeries::sharedPointer timeSeries, doubl
   
   std::pair<TimeSeries::sharedPointer,double> aggregatorItem(timeSeries, multiplier);
   _tsList.push_back(aggregatorItem);
+  timeSeries->addDependent(this);
+  updateFactors();
   
-  // set my clock to the lesser-period of any source.
-  if (this->clock()->period() < timeSeries->clock()->period()) {
+  // the sums are different now
+  resetCache();
+  
+  // set my clock to the lesser-period of any source -- unless my times are the union of the sources' own.
+  if (_alignment == exactAlignment && this->clock()->period() < timeSeries->clock()->period()) {
     this->setClock(timeSeries->clock());
   }
   
@@ -42,6 +142,7 @@ void AggregatorTimeSeries::removeSource(TimeSeries::sharedPointer timeSeries) {
   BOOST_FOREACH(tsDoublePairType ts, _tsList) {
     if (timeSeries == ts.first) {
       // don't copy
+      ts.first->removeDependent(this);
     }
     else {
       newSourceList.push_back(ts);
@@ -49,6 +150,8 @@ void AggregatorTimeSeries::removeSource(TimeSeries::sharedPointer timeSeries) {
   }
   // save the new source list
   _tsList = newSourceList;
+  updateFactors();
+  resetCache();
 }
 
 std::vector< std::pair<TimeSeries::sharedPointer,double> > AggregatorTimeSeries::sources() {
@@ -56,40 +159,410 @@ std::vector< std::pair<TimeSeries::sharedPointer,double> > AggregatorTimeSeries:
 }
 
 
+std::vector<TimeSeries::sharedPointer> AggregatorTimeSeries::upstreamSeries() {
+  typedef std::pair< TimeSeries::sharedPointer, double > tsPair_t;
+  std::vector<TimeSeries::sharedPointer> upstream;
+  BOOST_FOREACH(tsPair_t tsPair , _tsList) {
+    upstream.push_back(tsPair.first);
+  }
+  return upstream;
+}
+
+void AggregatorTimeSeries::setAlignment(alignment_t alignment) {
+  _alignment = alignment;
+  resetCache();
+}
+
+AggregatorTimeSeries::alignment_t AggregatorTimeSeries::alignment() {
+  return _alignment;
+}
+
+PointRecord::time_pair_t AggregatorTimeSeries::affectedRange(time_t start, time_t end) {
+  if (_alignment == exactAlignment) {
+    return TimeSeries::affectedRange(start, end);
+  }
+  // a changed source point is held (or interpolated) up to that source's next point, and interpolated back to its
+  // previous one. which source changed isn't known here, so reach as far as any of them would.
+  PointRecord::time_pair_t range(start, end);
+  typedef std::pair< TimeSeries::sharedPointer, double > tsPair_t;
+  BOOST_FOREACH(const tsPair_t& tsPair, _tsList) {
+    Point after = tsPair.first->pointAfter(end);
+    if (after.isValid && after.time > range.second) {
+      range.second = after.time;
+    }
+    if (_alignment == linearAlignment) {
+      Point before = tsPair.first->pointBefore(start);
+      if (before.isValid && before.time < range.first) {
+        range.first = before.time;
+      }
+    }
+  }
+  return range;
+}
+
 Point AggregatorTimeSeries::point(time_t time) {
+  if (_alignment != exactAlignment) {
+    return alignedPoint(time);
+  }
+  
   // call the base class method first, to see if the point is accessible via cache.
   Point aPoint = TimeSeries::point(time);
-
+  
   // if not, we construct it.
   if (!aPoint.isValid || aPoint.quality == Point::missing) {
+    // one thread sums a missing point. anyone else asking for it waits, then finds it cached.
+    ComputeLock computing(*this, time, time);
+    aPoint = TimeSeries::point(time);
+    if (aPoint.isValid && aPoint.quality != Point::missing) {
+      return aPoint;
+    }
+    std::vector<double> factors = this->factors();
     aPoint = Point(time, 0, Point::good);
     // start at zero, and sum other TS's values.
-    std::vector< std::pair<TimeSeries::sharedPointer,double> >::iterator it;
-    typedef std::pair< TimeSeries::sharedPointer, double > tsPair_t;
-    BOOST_FOREACH(tsPair_t tsPair , _tsList) {
-      double multiplier;
-      Point sourcePoint = tsPair.first->point(time);
-      Units sourceUnits = tsPair.first->units();
-      Units myUnits = units();
-      Point thisPoint = Point::convertPoint(sourcePoint, sourceUnits, myUnits);
-      multiplier = tsPair.second;
-      aPoint += ( thisPoint * multiplier );
+    for (size_t i = 0; i < _tsList.size(); ++i) {
+      countUpstreamCalls();
+      Point sourcePoint = _tsList[i].first->point(time);
+      if (!sourcePoint.isValid || sourcePoint.quality == Point::missing) {
+        aPoint.quality = Point::missing;
+      }
+      double factor = factors[i];
+      aPoint.value += factor * sourcePoint.value;
+      aPoint.confidence = (aPoint.confidence + factor * sourcePoint.confidence) / 2.;
     }
-    this->insert(aPoint);
+    this->cachePoint(aPoint);
   }
   
   return aPoint;
 }
 
 std::vector< Point > AggregatorTimeSeries::points(time_t start, time_t end) {
+  RTX_TRACE_SPAN(span, ("points", "series", name(), start, end));
   typedef std::pair< TimeSeries::sharedPointer, double > tsPair_t;
-  BOOST_FOREACH(tsPair_t tsPair , _tsList) {
-    // run the query, so that the source time series are ready
-    tsPair.first->points(start, end);
+  std::vector<Point> aggregated;
+  
+  // sanity
+  if ((start == end) || (start < 0) || (end < 0)) {
+    return aggregated;
+  }
+  
+  if (_alignment != exactAlignment) {
+    PointCollector collector(aggregated);
+    visitAlignedPoints(start, end, collector);
+    return aggregated;
+  }
+  
+  // sort out which clock times the record already has, and which need summing. claim those, then look again:
+  // another thread may have summed (or still be summing) some of them.
+  std::vector<time_t> timeList = clock()->timeValuesInRange(start, end);
+  std::vector<Point> cached, fresh;
+  std::vector<time_t> needed;
+  while (neededTimes(timeList, start, end, cached, needed)) {
+    time_t claimedFirst = needed.front(), claimedLast = needed.back();
+    ComputeLock computing(*this, claimedFirst, claimedLast);
+    if (!neededTimes(timeList, start, end, cached, needed)) {
+      break;
+    }
+    if (needed.front() < claimedFirst || claimedLast < needed.back()) {
+      continue; // more went stale in the meantime
+    }
+    std::vector<double> factors = this->factors();
+    size_t count = needed.size();
+    // flat accumulators, one slot per needed time
+    std::vector<double> sum(count, 0.), confidence(count, 0.), sourceValues(count), sourceConfidences(count);
+    std::vector<unsigned char> missing(count, 0);
+  
+    for (size_t i = 0; i < _tsList.size(); ++i) {
+      const tsPair_t& tsPair = _tsList[i];
+      // one range query per source, aligned to the needed times.
+      countUpstreamCalls();
+      std::vector<Point> sourcePoints = tsPair.first->points(start, end);
+      std::vector<Point>::const_iterator it = sourcePoints.begin();
+      for (size_t k = 0; k < count; ++k) {
+        while (it != sourcePoints.end() && it->time < needed[k]) {
+          ++it;
+        }
+        // a source that didn't produce this time in its range still gets asked for it directly
+        bool inRange = (it != sourcePoints.end() && it->time == needed[k]);
+        countUpstreamCalls(inRange ? 0 : 1);
+        Point sourcePoint = (inRange) ? *it : tsPair.first->point(needed[k]);
+        sourceValues[k] = sourcePoint.value;
+        sourceConfidences[k] = sourcePoint.confidence;
+        missing[k] |= (!sourcePoint.isValid || sourcePoint.quality == Point::missing);
+      }
+      // the multiplier and the unit conversion fold into one factor per source
+      accumulateColumn(count, &sourceValues[0], &sourceConfidences[0], factors[i], &sum[0], &confidence[0]);
+    }
+  
+    fresh.reserve(count);
+    for (size_t k = 0; k < count; ++k) {
+      fresh.push_back(Point(needed[k], sum[k], (missing[k] ? Point::missing : Point::good), confidence[k]));
+    }
+    this->cachePoints(fresh);
+    break;
+  }
+  
+  // stitch the summed points in with the cached ones.
+  aggregated.reserve(timeList.size());
+  size_t hits = 0;
+  std::vector<Point>::const_iterator cacheIt = cached.begin();
+  std::vector<Point>::const_iterator freshIt = fresh.begin();
+  BOOST_FOREACH(time_t time, timeList) {
+    if (!aggregated.empty() && aggregated.back().time >= time) {
+      continue;
+    }
+    while (freshIt != fresh.end() && freshIt->time < time) {
+      ++freshIt;
+    }
+    while (cacheIt != cached.end() && cacheIt->time < time) {
+      ++cacheIt;
+    }
+    if (freshIt != fresh.end() && freshIt->time == time) {
+      aggregated.push_back(*freshIt);
+    }
+    else if (cacheIt != cached.end() && cacheIt->time == time && !isDirty(time)) {
+      aggregated.push_back(*cacheIt);
+      ++hits;
+    }
   }
+  countCacheHits(hits);
   
-  return TimeSeries::points(start, end);
+  return aggregated;
+}
+
+void AggregatorTimeSeries::visitPoints(time_t start, time_t end, PointVisitor& visitor) {
+  if (_alignment != exactAlignment) {
+    if ((start != end) && (start >= 0) && (end >= 0)) {
+      visitAlignedPoints(start, end, visitor);
+    }
+    return;
+  }
+  // the range is produced in one pass, so there's nothing to stream -- just hand the result over.
+  std::vector<Point> thePoints = this->points(start, end);
+  BOOST_FOREACH(const Point& p, thePoints) {
+    if (!visitor.visit(p)) {
+      break;
+    }
+  }
+}
+
+void AggregatorTimeSeries::setUnits(Units newUnits) {
+  TimeSeries::setUnits(newUnits);
+  updateFactors();
+}
+
+void AggregatorTimeSeries::sourceUnitsDidChange(TimeSeries* source) {
+  updateFactors();
+}
+
+void AggregatorTimeSeries::accumulateColumn(size_t count, const double* values, const double* confidences, double factor, double* sum, double* confidence) {
+  // branch-free and alias-free, so the compiler can vectorize it.
+  // confidence keeps the running pairwise average that Point::operator+= uses.
+  for (size_t k = 0; k < count; ++k) {
+    sum[k] += factor * values[k];
+    confidence[k] = (confidence[k] + factor * confidences[k]) * 0.5;
+  }
+}
+
+bool AggregatorTimeSeries::neededTimes(const std::vector<time_t>& timeList, time_t start, time_t end, std::vector<Point>& cached, std::vector<time_t>& needed) {
+  cached = record()->pointsInRange(name(), start, end);
+  needed.clear();
+  std::vector<Point>::const_iterator cacheIt = cached.begin();
+  BOOST_FOREACH(time_t time, timeList) {
+    if (!needed.empty() && needed.back() >= time) {
+      continue;
+    }
+    while (cacheIt != cached.end() && cacheIt->time < time) {
+      ++cacheIt;
+    }
+    if (cacheIt != cached.end() && cacheIt->time == time && cacheIt->isValid && cacheIt->quality != Point::missing && !isDirty(time)) {
+      continue;
+    }
+    needed.push_back(time);
+  }
+  return !needed.empty();
+}
+
+Point AggregatorTimeSeries::alignedPoint(time_t time) {
+  // my times are the sources' times, so there's only a sum where at least one of them has a point
+  std::vector<double> factors = this->factors();
+  double sum = 0, confidence = 0;
+  size_t exactCount = 0;
+  bool isMissing = false;
+  for (size_t i = 0; i < _tsList.size(); ++i) {
+    TimeSeries::sharedPointer source = _tsList[i].first;
+    countUpstreamCalls();
+    Point sourcePoint = source->point(time);
+    if (isUsable(sourcePoint)) {
+      ++exactCount;
+    }
+    else {
+      countUpstreamCalls();
+      Point before = source->pointBefore(time);
+      sourcePoint = Point();
+      if (isUsable(before) && _alignment == holdAlignment) {
+        sourcePoint = before;
+      }
+      else if (isUsable(before)) {
+        countUpstreamCalls();
+        Point after = source->pointAfter(time);
+        if (isUsable(after) && before.time < time && time < after.time) {
+          double slope = (after.value - before.value) / (double)(after.time - before.time);
+          sourcePoint = Point(time, before.value + slope * (double)(time - before.time), Point::interpolated, before.confidence);
+        }
+      }
+    }
+    if (!isUsable(sourcePoint)) {
+      isMissing = true;
+      continue;
+    }
+    sum += factors[i] * sourcePoint.value;
+    confidence += sourcePoint.confidence;
+  }
+  if (exactCount == 0) {
+    return Point();
+  }
+  if (isMissing) {
+    return Point(time, 0, Point::missing);
+  }
+  Point::Qual_t quality = (exactCount == _tsList.size()) ? Point::good : Point::interpolated;
+  return Point(time, sum, quality, confidence / _tsList.size());
 }
 
+void AggregatorTimeSeries::visitAlignedPoints(time_t start, time_t end, PointVisitor& visitor) {
+  RTX_TRACE_SPAN(span, ("alignedPoints", "series", name(), start, end));
+  std::vector<double> factors = this->factors();
+  size_t sourceCount = _tsList.size();
+  bool isLinear = (_alignment == linearAlignment);
+  if (sourceCount == 0) {
+    return;
+  }
+  
+  // each source's usable points, with the heap of the times they reach next
+  std::vector<AlignedSource> sources(sourceCount);
+  std::vector<mergeEntry_t> heap;
+  heap.reserve(sourceCount);
+  for (size_t i = 0; i < sourceCount; ++i) {
+    TimeSeries::sharedPointer ts = _tsList[i].first;
+    AlignedSource& source = sources[i];
+    countUpstreamCalls();
+    std::vector<Point> inRange = ts->points(start, end);
+    if (inRange.empty() || inRange.front().time > start) {
+      countUpstreamCalls();
+      Point before = ts->pointBefore(start);
+      if (isUsable(before) && before.time < start) {
+        source.points.push_back(before);
+      }
+    }
+    source.next = source.points.size();
+    BOOST_FOREACH(const Point& p, inRange) {
+      if (isUsable(p) && (source.points.empty() || p.time > source.points.back().time)) {
+        source.points.push_back(p);
+      }
+    }
+    source.end = source.points.size();
+    if (isLinear && (inRange.empty() || inRange.back().time < end)) {
+      countUpstreamCalls();
+      Point after = ts->pointAfter(end);
+      if (isUsable(after) && after.time > end && (source.points.empty() || after.time > source.points.back().time)) {
+        source.points.push_back(after);
+      }
+    }
+    if (source.next < source.end) {
+      heap.push_back(std::make_pair(source.points[source.next].time, i));
+    }
+  }
+  std::make_heap(heap.begin(), heap.end(), &isLater);
+  
+  // a source's term is a level (its value at the start of the range, along its current segment) and a slope --
+  // held values have none -- so that the sum at any time is one multiply-add of the totals.
+  TermTree levels(sourceCount), slopes(sourceCount), confidences(sourceCount);
+  size_t missingCount = 0;
+  std::vector<size_t> expiring; // interpolated sources at their last point, with nothing to add after it
+  
+  // where the sources stand before their first points in the range
+  for (size_t i = 0; i < sourceCount; ++i) {
+    AlignedSource& source = sources[i];
+    source.hasTerm = (source.next > 0) && (!isLinear || source.next < source.points.size());
+    if (source.hasTerm) {
+      setTerm(source, i, levels, slopes, confidences, factors[i], start, isLinear);
+    }
+    else {
+      ++missingCount;
+    }
+  }
+  
+  std::vector<size_t> advanced;
+  while (!heap.empty()) {
+    time_t time = heap.front().first;
+    
+    // sources that ran out of points before now have nothing more to add
+    BOOST_FOREACH(size_t i, expiring) {
+      sources[i].hasTerm = false;
+      ++missingCount;
+      levels.set(i, 0.);
+      slopes.set(i, 0.);
+      confidences.set(i, 0.);
+    }
+    expiring.clear();
+    
+    // the sources with a point at this time move on to it
+    advanced.clear();
+    while (!heap.empty() && heap.front().first == time) {
+      std::pop_heap(heap.begin(), heap.end(), &isLater);
+      size_t i = heap.back().second;
+      heap.pop_back();
+      AlignedSource& source = sources[i];
+      ++source.next;
+      if (source.next < source.end) {
+        heap.push_back(std::make_pair(source.points[source.next].time, i));
+        std::push_heap(heap.begin(), heap.end(), &isLater);
+      }
+      advanced.push_back(i);
+    }
+    BOOST_FOREACH(size_t i, advanced) {
+      AlignedSource& source = sources[i];
+      if (!source.hasTerm) {
+        source.hasTerm = true;
+        --missingCount;
+      }
+      setTerm(source, i, levels, slopes, confidences, factors[i], start, isLinear);
+      if (isLinear && source.next == source.points.size()) {
+        expiring.push_back(i);
+      }
+    }
+    
+    Point aligned;
+    if (missingCount > 0) {
+      aligned = Point(time, 0, Point::missing);
+    }
+    else {
+      double value = levels.total() + slopes.total() * (double)(time - start);
+      Point::Qual_t quality = (advanced.size() == sourceCount) ? Point::good : Point::interpolated;
+      aligned = Point(time, value, quality, confidences.total() / sourceCount);
+    }
+    if (!visitor.visit(aligned)) {
+      return;
+    }
+  }
+}
 
+std::vector<double> AggregatorTimeSeries::factors() {
+  scopedLock_t lock(_factorsMutex);
+  return _factors;
+}
 
+void AggregatorTimeSeries::updateFactors() {
+  // worked out once here, rather than for every point summed
+  Units myUnits = units();
+  std::vector<double> factors;
+  typedef std::pair< TimeSeries::sharedPointer, double > tsPair_t;
+  BOOST_FOREACH(const tsPair_t& tsPair, _tsList) {
+    UnitConverter converter(tsPair.first->units(), myUnits);
+    if (!converter.isValid()) {
+      RTX_LOG(warning, "AggregatorTimeSeries", "Units are not dimensionally consistent");
+    }
+    factors.push_back(tsPair.second * converter.scale());
+  }
+  scopedLock_t lock(_factorsMutex);
+  _factors.swap(factors);
+}
@@ -19,31 +19,69 @@ namespace RTX {
   /*!
    \class AggregatorTimeSeries
    \brief Aggregates (and optionally scales) arbitrary many input time series.
-   
+  
    Use addSource to add an input time series, with optional multiplier (-1 for subtraction).
-   
+  
+   By default each sum is of the sources' points at exactly my clock's times, which suits sources on one regular
+   clock. For sources whose points fall at their own times (irregular meters), set an alignment instead: then my
+   times are the union of every source's, and at each of them every source contributes its latest point
+   (holdAlignment) or a straight line between the points either side (linearAlignment). A sum is missing where a
+   source has nothing to contribute, interpolated where any source's value isn't a point at that very time, and
+   its confidence is the average of the sources' latest points'. Set the alignment before adding sources: aligned
+   sources needn't share a clock, and I don't take one from them.
+  
+   An aligned range is produced by one pass over the sources' points: a k-way merge of their timelines through a
+   heap, with each source's current term kept in a tree of pairwise sums, so a range costs O(n log k) for n points
+   from k sources. Aligned sums aren't cached -- they're a merge of what the sources have cached.
    */
   
   class AggregatorTimeSeries : public TimeSeries {
   
   public:
     RTX_SHARED_POINTER(AggregatorTimeSeries);
+    AggregatorTimeSeries();
+    virtual ~AggregatorTimeSeries();
     // add a time series to this aggregator. optional parameter "multiplier" allows you to scale
     // the aggregated time series (for instance, by -1 if it needs to be subtracted).
     void addSource(TimeSeries::sharedPointer timeSeries, double multiplier = 1.) throw(RtxException);
     void removeSource(TimeSeries::sharedPointer timeSeries);
     std::vector< std::pair<TimeSeries::sharedPointer,double> > sources();
-    
+    virtual std::vector<TimeSeries::sharedPointer> upstreamSeries();
+  
+    // how sources' points at different times are lined up
+    typedef enum {
+      exactAlignment,  //! the sources' points at my clock's times (the default)
+      holdAlignment,   //! at each time any source has, each source's latest point
+      linearAlignment  //! at each time any source has, each source interpolated between its points
+    } alignment_t;
+    void setAlignment(alignment_t alignment);
+    alignment_t alignment();
+    virtual PointRecord::time_pair_t affectedRange(time_t start, time_t end);
+  
     // reimplement the base class methods
     virtual Point point(time_t time);
     virtual std::vector< Point > points(time_t start, time_t end);
-
-    
+    virtual void visitPoints(time_t start, time_t end, PointVisitor& visitor);
+    virtual void setUnits(Units newUnits);
+    virtual void sourceUnitsDidChange(TimeSeries* source);
+  
+  
   private:
+    //! sum[k] += factor * values[k], over flat arrays
+    static void accumulateColumn(size_t count, const double* values, const double* confidences, double factor, double* sum, double* confidence);
     // need to store several TimeSeries references...
     // _tsList[x].first == TimeSeries, _tsList[x].second == multipier
     std::vector< std::pair<TimeSeries::sharedPointer,double> > _tsList;
-    
+    // _factors[x] == _tsList[x].second, times the conversion from that source's units to mine
+    std::vector<double> _factors;
+    boost::mutex _factorsMutex; // units can change while points are being summed
+    std::vector<double> factors();
+    void updateFactors();
+    bool neededTimes(const std::vector<time_t>& timeList, time_t start, time_t end, std::vector<Point>& cached, std::vector<time_t>& needed);
+    Point alignedPoint(time_t time);
+    void visitAlignedPoints(time_t start, time_t end, PointVisitor& visitor); //! the k-way merge
+    alignment_t _alignment;
+  
   };
   
 }
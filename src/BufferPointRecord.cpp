@@ -6,18 +6,217 @@
 //  See README.md and license.txt for more information
 //
 
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
 #include "BufferPointRecord.h"
 
 #include "boost/foreach.hpp"
+#include <boost/thread/locks.hpp>
 
 using namespace RTX;
 using namespace std;
 
-//bool compareTimePointPair(const BufferPointRecord::TimePointPair_t& lhs, const BufferPointRecord::TimePointPair_t& rhs);
 
-BufferPointRecord::BufferPointRecord() {
+#pragma mark - Columnar Buffer
+
+BufferPointRecord::PointBuffer_t::PointBuffer_t() {
+  
+}
+
+size_t BufferPointRecord::PointBuffer_t::size() const {
+  return _times.size();
+}
+
+size_t BufferPointRecord::PointBuffer_t::capacity() const {
+  return _times.capacity();
+}
+
+bool BufferPointRecord::PointBuffer_t::empty() const {
+  return _times.empty();
+}
+
+bool BufferPointRecord::PointBuffer_t::full() const {
+  return _times.full();
+}
+
+void BufferPointRecord::PointBuffer_t::set_capacity(size_t capacity) {
+  _times.set_capacity(capacity);
+  _values.set_capacity(capacity);
+  _qualities.set_capacity(capacity);
+  _confidences.set_capacity(capacity);
+}
+
+void BufferPointRecord::PointBuffer_t::rset_capacity(size_t capacity) {
+  _times.rset_capacity(capacity);
+  _values.rset_capacity(capacity);
+  _qualities.rset_capacity(capacity);
+  _confidences.rset_capacity(capacity);
+}
+
+void BufferPointRecord::PointBuffer_t::clear() {
+  _times.clear();
+  _values.clear();
+  _qualities.clear();
+  _confidences.clear();
+}
+
+Point BufferPointRecord::PointBuffer_t::at(size_t index) const {
+  return Point(_times[index], _values[index], _qualities[index], _confidences[index]);
+}
+
+Point BufferPointRecord::PointBuffer_t::front() const {
+  return at(0);
+}
+
+Point BufferPointRecord::PointBuffer_t::back() const {
+  return at(size() - 1);
+}
+
+time_t BufferPointRecord::PointBuffer_t::timeAt(size_t index) const {
+  return _times[index];
+}
+
+time_t BufferPointRecord::PointBuffer_t::firstTime() const {
+  return _times.front();
+}
+
+time_t BufferPointRecord::PointBuffer_t::lastTime() const {
+  return _times.back();
+}
+
+size_t BufferPointRecord::PointBuffer_t::lowerBound(time_t time) const {
+  // the time column is at most two contiguous segments -- search the dense arrays directly.
+  boost::circular_buffer<time_t>::const_array_range one = _times.array_one();
+  boost::circular_buffer<time_t>::const_array_range two = _times.array_two();
+  if (one.second > 0 && time <= one.first[one.second - 1]) {
+    return std::lower_bound(one.first, one.first + one.second, time) - one.first;
+  }
+  return one.second + (std::lower_bound(two.first, two.first + two.second, time) - two.first);
+}
+
+size_t BufferPointRecord::PointBuffer_t::upperBound(time_t time) const {
+  boost::circular_buffer<time_t>::const_array_range one = _times.array_one();
+  boost::circular_buffer<time_t>::const_array_range two = _times.array_two();
+  if (one.second > 0 && time < one.first[one.second - 1]) {
+    return std::upper_bound(one.first, one.first + one.second, time) - one.first;
+  }
+  return one.second + (std::upper_bound(two.first, two.first + two.second, time) - two.first);
+}
+
+void BufferPointRecord::PointBuffer_t::push_back(const Point& point) {
+  _times.push_back(point.time);
+  _values.push_back(point.value);
+  _qualities.push_back(point.quality);
+  _confidences.push_back(point.confidence);
+}
+
+void BufferPointRecord::PointBuffer_t::push_front(const Point& point) {
+  _times.push_front(point.time);
+  _values.push_front(point.value);
+  _qualities.push_front(point.quality);
+  _confidences.push_front(point.confidence);
+}
+
+bool BufferPointRecord::PointBuffer_t::insertOrdered(const Point& point, bool dropOldest) {
+  size_t index = lowerBound(point.time);
+  if (index < size() && _times[index] == point.time) {
+    // a correction: the newer point wins
+    _values[index] = point.value;
+    _qualities[index] = point.quality;
+    _confidences[index] = point.confidence;
+    return false;
+  }
+  if (index == size()) {
+    push_back(point);
+    return true;
+  }
+  if (index == 0) {
+    push_front(point);
+    return true;
+  }
+  // all columns have identical size and capacity, so the circular_buffer insert semantics
+  // (insert drops the front element when full, rinsert the back) keep them aligned.
+  if (dropOldest) {
+    _times.insert(_times.begin() + index, point.time);
+    _values.insert(_values.begin() + index, point.value);
+    _qualities.insert(_qualities.begin() + index, point.quality);
+    _confidences.insert(_confidences.begin() + index, point.confidence);
+  }
+  else {
+    _times.rinsert(_times.begin() + index, point.time);
+    _values.rinsert(_values.begin() + index, point.value);
+    _qualities.rinsert(_qualities.begin() + index, point.quality);
+    _confidences.rinsert(_confidences.begin() + index, point.confidence);
+  }
+  return true;
+}
+
+size_t BufferPointRecord::PointBuffer_t::mergeOrdered(const std::vector<Point>& points, bool dropOldest, bool& replaced) {
+  replaced = false;
+  if (points.empty()) {
+    return 0;
+  }
+  // only what's held from the batch's first time on has to move: lift it off the end, then lay it and the batch
+  // back down together in one pass.
+  size_t first = lowerBound(points.front().time);
+  std::vector<Point> held;
+  held.reserve(size() - first);
+  for (size_t i = first; i < size(); ++i) {
+    held.push_back(at(i));
+  }
+  _times.erase_end(held.size());
+  _values.erase_end(held.size());
+  _qualities.erase_end(held.size());
+  _confidences.erase_end(held.size());
+  
+  // whatever's left ends before the batch, so equal times only meet here, below.
+  size_t dropped = 0;
+  std::vector<Point>::const_iterator heldIt = held.begin(), newIt = points.begin();
+  while (heldIt != held.end() || newIt != points.end()) {
+    Point next;
+    if (newIt == points.end() || (heldIt != held.end() && heldIt->time < newIt->time)) {
+      next = *heldIt++;
+    }
+    else {
+      if (heldIt != held.end() && heldIt->time == newIt->time) {
+        ++heldIt; // replaced
+        replaced = true;
+      }
+      next = *newIt++;
+    }
+    if (!empty() && _times.back() == next.time) {
+      // a repeated time within the batch -- the later one wins
+      _values.back() = next.value;
+      _qualities.back() = next.quality;
+      _confidences.back() = next.confidence;
+      continue;
+    }
+    if (full()) {
+      ++dropped;
+      if (!dropOldest) {
+        continue;
+      }
+    }
+    push_back(next);
+  }
+  return dropped;
+}
+
+
+#pragma mark - Buffer Point Record
+
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
+const size_t BufferPointRecord::bytesPerPoint = sizeof(time_t) + 2*sizeof(double) + sizeof(Point::Qual_t);
+
+
+BufferPointRecord::BufferPointRecord() : _generation(0), _evictionPolicy(evictOldest), _totalCapacity(0), _excessCapacity(0), _epoch(0) {
   
   _defaultCapacity = 100;
+  _memoryBudget = 0;
 }
 
 std::ostream& RTX::operator<< (std::ostream &out, BufferPointRecord &pr) {
@@ -33,15 +232,17 @@ std::ostream& BufferPointRecord::toStream(std::ostream &stream) {
 
 std::string BufferPointRecord::registerAndGetIdentifier(std::string recordName) {
   // register the recordName internally and generate a buffer and mutex
+  writeLock_t registryLock(_registryMutex);
   
   // check to see if it's there first
   if (_keyedBufferMutex.find(recordName) == _keyedBufferMutex.end()) {
     PointBuffer_t buffer;
-    buffer.set_capacity(_defaultCapacity);
     // shared pointer since it's not copy-constructable.
-    boost::shared_ptr< boost::signals2::mutex >mutexPtr(new boost::signals2::mutex );
-    BufferMutexPair_t bmPair(buffer, mutexPtr);
-    _keyedBufferMutex.insert(make_pair(recordName, bmPair));
+    boost::shared_ptr< BufferGuard_t >guardPtr(new BufferGuard_t );
+    guardPtr->lastAccess = _epoch.load();
+    BufferMutexPair_t bmPair(buffer, guardPtr);
+    BufferMutexPair_t& inserted = _keyedBufferMutex.insert(make_pair(recordName, bmPair)).first->second;
+    setBufferCapacity(inserted, _defaultCapacity);
   }
   
   return recordName;
@@ -52,446 +253,740 @@ std::string BufferPointRecord::registerAndGetIdentifier(std::string recordName)
 
 std::vector<std::string> BufferPointRecord::identifiers() {
   typedef std::map<std::string, BufferMutexPair_t >::value_type& nameMapValue_t;
+  readLock_t registryLock(_registryMutex);
   vector<string> names;
   BOOST_FOREACH(nameMapValue_t name, _keyedBufferMutex) {
     names.push_back(name.first);
   }
   return names;
 }
-/*
-bool compareTimePointPair(const BufferPointRecord::TimePointPair_t& lhs, const BufferPointRecord::TimePointPair_t& rhs) {
-  return lhs.first < rhs.first;
+
+
+#pragma mark - Thread Cache
+
+BufferPointRecord::CachedPoint_t& BufferPointRecord::threadCache() {
+  CachedPoint_t* cache = _threadCache.get();
+  if (!cache) {
+    cache = new CachedPoint_t();
+    _threadCache.reset(cache);
+  }
+  return *cache;
 }
-*/
-/*
-// convenience method for making a new point from a buffer iterator
-Point BufferPointRecord::makePoint(PointBuffer_t::const_iterator iterator) {
-  return Point((*iterator).first, (*iterator).second.first, Point::good, (*iterator).second.second);
+
+unsigned long BufferPointRecord::generation() {
+  return _generation.load();
 }
-*/
+
+// a writer bumps the generation once its change is in the buffer, so a point read after taking the generation is
+// at least as new as it -- and one that's older is cached under a generation that has already gone.
+void BufferPointRecord::setThreadCache(const std::string& identifier, const Point& point, unsigned long generation) {
+  CachedPoint_t& cache = threadCache();
+  cache.generation = generation;
+  cache.id = identifier;
+  cache.point = point;
+}
+
+
+#pragma mark - Named Access
+
+BufferPointRecord::BufferMutexPair_t* BufferPointRecord::bufferForName(const std::string& identifier) {
+  // map nodes are never erased, so the returned pointer stays good after the registry lock is released.
+  readLock_t registryLock(_registryMutex);
+  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
+  if (it == _keyedBufferMutex.end()) {
+    return NULL;
+  }
+  return &(it->second);
+}
+
 
 Point BufferPointRecord::point(const string& identifier, time_t time) {
   
-  bool isAvailable = false;
-  
   // quick check for repeated calls
-  if (_cachedPoint.time == time && RTX_STRINGS_ARE_EQUAL_CS(_cachedPointId, identifier) ) {
-    return _cachedPoint;
+  CachedPoint_t& cache = threadCache();
+  unsigned long current = generation();
+  if (cache.point.time == time && RTX_STRINGS_ARE_EQUAL_CS(cache.id, identifier) && cache.generation == current) {
+    return cache.point;
   }
   
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
-  if (it == _keyedBufferMutex.end()) {
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (!bm) {
     // nobody here by that name
     return Point();
   }
   
-  // get the constituents
-  boost::signals2::mutex *mutex = (it->second.second.get());
-  PointBuffer_t& buffer = (it->second.first);
+  Point p = pointFromBuffer(*bm, time);
+  if (p.isValid) {
+    setThreadCache(identifier, p, current);
+  }
+  return p;
+}
+
+
+
+Point BufferPointRecord::pointBefore(const string& identifier, time_t time) {
+  
+  Point foundPoint;
   
-  if (buffer.empty()) {
-    return Point();
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    unsigned long current = generation();
+    foundPoint = pointBeforeFromBuffer(*bm, time);
+    if (foundPoint.isValid) {
+      setThreadCache(identifier, foundPoint, current);
+    }
   }
   
-  // lock the buffer
-  mutex->lock();
+  return foundPoint;
+}
+
+
+Point BufferPointRecord::pointAfter(const string& identifier, time_t time) {
   
-  Point pFirst = buffer.front();
-  Point pLast = buffer.back();
+  Point foundPoint;
   
-  if (pFirst.time <= time && time <= pLast.time) {
-    // search the buffer
-    //TimePointPair_t finder(time, PointPair_t(0,0));
-    Point finder(time, 0);
-    PointBuffer_t::const_iterator pbIt = std::lower_bound(buffer.begin(), buffer.end(), finder, &Point::comparePointTime);
-    if (pbIt != buffer.end() && pbIt->time == time) {
-      isAvailable = true;
-      _cachedPoint = *pbIt;
-      _cachedPointId = identifier;
-    }
-    else {
-      //cerr << "whoops, not found" << endl;
-      // try brute-force (debug)
-      PointBuffer_t::const_iterator pbIt = buffer.begin();
-      while (pbIt != buffer.end()) {
-        time_t foundTime = pbIt->time;
-        if (foundTime == time) {
-          cout << "found it anyway!!" << endl;
-          Point aPoint = *pbIt;
-          _cachedPoint = aPoint;
-        }
-        ++pbIt;
-      }
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    unsigned long current = generation();
+    foundPoint = pointAfterFromBuffer(*bm, time);
+    if (foundPoint.isValid) {
+      setThreadCache(identifier, foundPoint, current);
     }
   }
   
+  return foundPoint;
+}
+
+
+std::vector<Point> BufferPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
   
-  // ok, all done
-  mutex->unlock();
-  
-  if (isAvailable) {
-    return _cachedPoint;
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    return pointsInRangeFromBuffer(*bm, startTime, endTime);
   }
-  else {
-    return Point();//this->pointBefore(identifier, time);
+  
+  return std::vector<Point>();
+}
+
+
+void BufferPointRecord::visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    visitPointsInBuffer(*bm, startTime, endTime, visitor);
   }
   
 }
 
 
+void BufferPointRecord::addPoint(const string& identifier, Point point) {
+  
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    addPointToBuffer(*bm, point);
+  }
+  
+}
+
 
-Point BufferPointRecord::pointBefore(const string& identifier, time_t time) {
+void BufferPointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
   
-  Point foundPoint;
-  //TimePointPair_t finder(time, PointPair_t(0,0));
-  Point finder(time, 0);
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    addPointsToBuffer(*bm, points);
+  }
   
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
-  if (it != _keyedBufferMutex.end()) {
-    // get the constituents
-    boost::signals2::mutex *mutex = (it->second.second.get());
-    PointBuffer_t& buffer = (it->second.first);
-    // lock the buffer
-    mutex->lock();
-    
-    PointBuffer_t::const_iterator it  = lower_bound(buffer.begin(), buffer.end(), finder, &Point::comparePointTime);
-    if (it != buffer.end() && it != buffer.begin()) {
-      if (--it != buffer.end()) {
-        foundPoint = *it;
-        _cachedPoint = foundPoint;
-        _cachedPointId = identifier;
-      }
-    }
-    
-    // all done.
-    mutex->unlock();
+}
+
+
+void BufferPointRecord::mergePoints(const string& identifier, const std::vector<Point>& points) {
+  
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    mergePointsIntoBuffer(*bm, points);
   }
   
-  return foundPoint;
 }
 
 
-Point BufferPointRecord::pointAfter(const string& identifier, time_t time) {
+void BufferPointRecord::reset() {
+  // keep the registrations (and so any outstanding handles) -- just empty the buffers.
+  typedef std::map<std::string, BufferMutexPair_t >::value_type& nameMapValue_t;
+  writeLock_t registryLock(_registryMutex);
+  BOOST_FOREACH(nameMapValue_t entry, _keyedBufferMutex) {
+    writeLock_t bufferLock(entry.second.second->mutex);
+    entry.second.first.clear();
+  }
+  ++_generation;
+}
+
+void BufferPointRecord::reset(const string& identifier) {
   
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (bm) {
+    writeLock_t bufferLock(bm->second->mutex);
+    bm->first.clear();
+  }
+  writeLock_t registryLock(_registryMutex);
+  ++_generation;
+  
+}
+
+
+
+Point BufferPointRecord::firstPoint(const string& id) {
   Point foundPoint;
-  //TimePointPair_t finder(time, PointPair_t(0,0));
-  Point finder(time, 0);
+  BufferMutexPair_t* bm = bufferForName(id);
+  if (bm) {
+    readLock_t bufferLock(bm->second->mutex);
+    PointBuffer_t& buffer = (bm->first);
   
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
-  if (it != _keyedBufferMutex.end()) {
-    // get the constituents
-    boost::signals2::mutex *mutex = (it->second.second.get());
-    PointBuffer_t& buffer = (it->second.first);
-    // lock the buffer
-    mutex->lock();
-    
-    PointBuffer_t::const_iterator it = upper_bound(buffer.begin(), buffer.end(), finder, &Point::comparePointTime);
-    if (it != buffer.end()) {
-      foundPoint = *it;
-      _cachedPoint = foundPoint;
-      _cachedPointId = identifier;
+    if (buffer.empty()) {
+      return foundPoint;
     }
-    
-    // all done.
-    mutex->unlock();
-  }
   
+    foundPoint = buffer.front();
+  
+  }
   return foundPoint;
 }
 
-
-std::vector<Point> BufferPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
+Point BufferPointRecord::lastPoint(const string& id) {
+  Point foundPoint;
+  BufferMutexPair_t* bm = bufferForName(id);
+  if (bm) {
+    readLock_t bufferLock(bm->second->mutex);
+    PointBuffer_t& buffer = (bm->first);
   
-  std::vector<Point> pointVector;
+    if (buffer.empty()) {
+      return foundPoint;
+    }
   
-  //TimePointPair_t finder(startTime, PointPair_t(0,0));
-  Point finder(startTime, 0);
+    foundPoint = buffer.back();
   
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
-  if (it != _keyedBufferMutex.end()) {
-    // get the constituents
-    boost::signals2::mutex *mutex = (it->second.second.get());
-    PointBuffer_t& buffer = (it->second.first);
-    // lock the buffer
-    mutex->lock();
-    
-    PointBuffer_t::const_iterator it = lower_bound(buffer.begin(), buffer.end(), finder, &Point::comparePointTime);
-    while ( (it != buffer.end()) && (it->time <= endTime) ) {
-      Point newPoint = *it;
-      pointVector.push_back(newPoint);
-      it++;
+  }
+  return foundPoint;
+}
+
+PointRecord::time_pair_t BufferPointRecord::range(const string& id) {
+  time_pair_t range(0,0);
+  BufferMutexPair_t* bm = bufferForName(id);
+  if (bm) {
+    // both ends under one lock, so a concurrent writer can't hand us an inconsistent pair.
+    readLock_t bufferLock(bm->second->mutex);
+    PointBuffer_t& buffer = (bm->first);
+    if (!buffer.empty()) {
+      range = make_pair(buffer.firstTime(), buffer.lastTime());
     }
-    
-    // all done.
-    mutex->unlock();
   }
-  
-  return pointVector;
+  return range;
 }
 
 
-void BufferPointRecord::addPoint(const string& identifier, Point point) {
-  
-  //if (BufferPointRecord::isPointAvailable(identifier, point.time)) {
-    //cout << "skipping duplicate point" << endl;
-   // return;
-  //}
+#pragma mark - Handle Access
+
+BufferPointRecord::BufferMutexPair_t* BufferPointRecord::bufferForHandle(handle_t handle) {
+  // flat lookup table, filled in lazily. map nodes are never erased, so the pointers stay good.
+  {
+    readLock_t registryLock(_registryMutex);
+    if (handle < _handleBuffers.size() && _handleBuffers[handle] != NULL) {
+      return _handleBuffers[handle];
+    }
+  }
   
-  /*
-  vector<Point> single;
-  single.push_back(point);
-  BufferPointRecord::addPoints(identifier, single);
+  const std::string& identifier = identifierForHandle(handle);
+  writeLock_t registryLock(_registryMutex);
+  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
+  if (it == _keyedBufferMutex.end()) {
+    return NULL;
+  }
   
-  */
-  /*
-   bool unordered = false;
-   // test for continuity
-   KeyedBufferMutexMap_t::iterator kbmmit = _keyedBufferMutex.find(identifier);
-   if (kbmmit != _keyedBufferMutex.end()) {
-   // get the constituents
-   boost::signals2::mutex *mutex = (kbmmit->second.second.get());
-   PointBuffer_t& buffer = (kbmmit->second.first);
-   // lock the buffer
-   mutex->lock();
-   
-   // check for monotonically increasing time values.
-   PointBuffer_t::const_iterator pIt = buffer.begin();
-   
-   while (pIt != buffer.end()) {
-   time_t t1 = pIt->first;
-   ++pIt;
-   if (pIt == buffer.end()) { break; }
-   time_t t2 = pIt->first;
-   
-   if (t1 >= t2) {
-   cerr << "Points unordered" << endl;
-   unordered = true;
-   break;
-   }
-   }
-   
-   if (unordered) {
-   // make sure the points are in order.
-   sort(buffer.begin(), buffer.end(), compareTimePointPair);
-   }
-   
-   mutex->unlock();
-   }
-   
-   */
+  if (handle >= _handleBuffers.size()) {
+    _handleBuffers.resize(handle + 1, NULL);
+  }
+  _handleBuffers[handle] = &(it->second);
+  return &(it->second);
+}
+
+Point BufferPointRecord::point(handle_t handle, time_t time) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  return (bm ? pointFromBuffer(*bm, time) : Point());
+}
+
+Point BufferPointRecord::pointBefore(handle_t handle, time_t time) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  return (bm ? pointBeforeFromBuffer(*bm, time) : Point());
+}
+
+Point BufferPointRecord::pointAfter(handle_t handle, time_t time) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  return (bm ? pointAfterFromBuffer(*bm, time) : Point());
+}
+
+std::vector<Point> BufferPointRecord::pointsInRange(handle_t handle, time_t startTime, time_t endTime) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  return (bm ? pointsInRangeFromBuffer(*bm, startTime, endTime) : std::vector<Point>());
+}
+
+void BufferPointRecord::visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  if (bm) {
+    visitPointsInBuffer(*bm, startTime, endTime, visitor);
+  }
+}
+
+void BufferPointRecord::addPoint(handle_t handle, Point point) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  if (bm) {
+    addPointToBuffer(*bm, point);
+  }
+}
+
+void BufferPointRecord::addPoints(handle_t handle, const std::vector<Point>& points) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  if (bm) {
+    addPointsToBuffer(*bm, points);
+  }
+}
+
+void BufferPointRecord::mergePoints(handle_t handle, const std::vector<Point>& points) {
+  BufferMutexPair_t* bm = bufferForHandle(handle);
+  if (bm) {
+    mergePointsIntoBuffer(*bm, points);
+  }
+}
+
+
+#pragma mark - Buffer Operations
+
+// readers take a shared lock on the buffer; anything that changes the buffer takes it exclusively.
+
+Point BufferPointRecord::pointFromBuffer(BufferMutexPair_t& bufferMutex, time_t time) {
   
+  Point foundPoint;
   
+  touch(bufferMutex);
+  readLock_t bufferLock(bufferMutex.second->mutex);
+  PointBuffer_t& buffer = (bufferMutex.first);
   
+  if (!buffer.empty() && buffer.firstTime() <= time && time <= buffer.lastTime()) {
+    // search the time column
+    size_t index = buffer.lowerBound(time);
+    if (index < buffer.size() && buffer.timeAt(index) == time) {
+      foundPoint = buffer.at(index);
+    }
+  }
   
+  return foundPoint;
+}
+
+
+Point BufferPointRecord::pointBeforeFromBuffer(BufferMutexPair_t& bufferMutex, time_t time) {
   
+  Point foundPoint;
   
+  touch(bufferMutex);
+  readLock_t bufferLock(bufferMutex.second->mutex);
+  PointBuffer_t& buffer = (bufferMutex.first);
   
+  size_t index = buffer.lowerBound(time);
+  if (index < buffer.size() && index > 0) {
+    foundPoint = buffer.at(index - 1);
+  }
   
+  return foundPoint;
+}
+
+
+Point BufferPointRecord::pointAfterFromBuffer(BufferMutexPair_t& bufferMutex, time_t time) {
   
+  Point foundPoint;
   
+  touch(bufferMutex);
+  readLock_t bufferLock(bufferMutex.second->mutex);
+  PointBuffer_t& buffer = (bufferMutex.first);
   
-  double value, confidence;
-  time_t time;
-  bool skipped = true;
+  size_t index = buffer.upperBound(time);
+  if (index < buffer.size()) {
+    foundPoint = buffer.at(index);
+  }
   
-  time = point.time;
-  value = point.value;
-  confidence = point.confidence;
+  return foundPoint;
+}
+
+
+std::vector<Point> BufferPointRecord::pointsInRangeFromBuffer(BufferMutexPair_t& bufferMutex, time_t startTime, time_t endTime) {
   
-  //PointPair_t newPoint(value, confidence);
+  std::vector<Point> pointVector;
   
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
-  if (it != _keyedBufferMutex.end()) {
-    // get the constituents
-    boost::signals2::mutex *mutex = (it->second.second.get());
-    PointBuffer_t& buffer = (it->second.first);
-    // lock the buffer
-    mutex->lock();
-    
-    if (buffer.size() == buffer.capacity()) {
-      //cout << "buffer full" << endl;
+  touch(bufferMutex);
+  readLock_t bufferLock(bufferMutex.second->mutex);
+  PointBuffer_t& buffer = (bufferMutex.first);
+  
+  // both bounds come from binary searches over the time column, so we know the result size up front.
+  size_t first = buffer.lowerBound(startTime);
+  size_t last = buffer.upperBound(endTime);
+  if (first < last) {
+    pointVector.reserve(last - first);
+    for (size_t i = first; i < last; ++i) {
+      pointVector.push_back(buffer.at(i));
     }
-    
-    
-    time_t firstTime = BufferPointRecord::firstPoint(identifier).time;
-    time_t lastTime = BufferPointRecord::lastPoint(identifier).time;
-    if (time == lastTime || time == firstTime) {
-      // skip it
-      skipped = false;
+  }
+  
+  return pointVector;
+}
+
+void BufferPointRecord::visitPointsInBuffer(BufferMutexPair_t& bufferMutex, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  touch(bufferMutex);
+  readLock_t bufferLock(bufferMutex.second->mutex);
+  PointBuffer_t& buffer = (bufferMutex.first);
+  
+  size_t last = buffer.upperBound(endTime);
+  for (size_t i = buffer.lowerBound(startTime); i < last; ++i) {
+    if (!visitor.visit(buffer.at(i))) {
+      break;
     }
-    if (time > lastTime) {
-      // end of the buffer
+  }
+}
+
+
+bool BufferPointRecord::insertIntoBuffer(PointBuffer_t& buffer, const Point& point, bool& replaced) {
+  
+  replaced = false;
+  time_t time = point.time;
+  bool wasFull = buffer.full();
+  bool dropOldest = (_evictionPolicy == evictOldest);
+  
+  if (buffer.empty() || time > buffer.lastTime()) {
+    // end of the buffer
+    if (!wasFull || dropOldest) {
       buffer.push_back(point);
-      skipped = false;
     }
-    else if (time < firstTime) {
-      // front of the buffer
+  }
+  else if (time < buffer.firstTime()) {
+    // front of the buffer -- when full, a point older than all the rest is the oldest, so it's the one to go.
+    if (!wasFull || !dropOldest) {
       buffer.push_front(point);
-      skipped = false;
     }
-    
-    if (skipped) {
-      //cout << "point skipped: " << identifier;
-      //TimePointPair_t finder(time, PointPair_t(0,0));
-      Point finder(time, 0);
-      PointBuffer_t::const_iterator it = lower_bound(buffer.begin(), buffer.end(), finder, &Point::comparePointTime);
-      if (it->time != time) {
-        // if the time is not found here, then it's a new point.
-        buffer.push_front(point);
-        // make sure the points are in order.
-        sort(buffer.begin(), buffer.end(), &Point::comparePointTime);
-      }
-      
+  }
+  else {
+    // somewhere in the middle -- insert in order, replacing duplicate times.
+    bool inserted = buffer.insertOrdered(point, dropOldest);
+    replaced = !inserted;
+    return (inserted && wasFull);
+  }
+  return wasFull;
+}
+
+
+void BufferPointRecord::addPointToBuffer(BufferMutexPair_t& bufferMutex, const Point& point) {
+  touch(bufferMutex);
+  bool grew = false, replaced = false;
+  {
+    writeLock_t bufferLock(bufferMutex.second->mutex);
+    grew = growForInsert(bufferMutex);
+    if (insertIntoBuffer(bufferMutex.first, point, replaced)) {
+      ++bufferMutex.second->evictions;
     }
-    
-    
-    
-    
-    
-    
-    // all done.
-    mutex->unlock();
   }
+  if (replaced) {
+    ++_generation; // a correction -- a cached copy of the point it replaced is stale
+  }
+  if (grew) {
+    enforceMemoryBudget(&bufferMutex);
+  }
+}
+
+
+void BufferPointRecord::addPointsToBuffer(BufferMutexPair_t& bufferMutex, const std::vector<Point>& batch) {
+  if (batch.size() == 0) {
+    return;
+  }
+  
+  // make sure they're in order, before taking the lock
+  std::vector<Point> scratch;
+  const std::vector<Point>& points = orderedPoints(batch, scratch);
   
-  if (skipped) {
-    //cout << "(" << isPointAvailable(identifier, time) << ")" << endl;
+  touch(bufferMutex);
+  bool grew = false;
+  
+  // the whole merge happens under one exclusive lock.
+  writeLock_t bufferLock(bufferMutex.second->mutex);
+  PointBuffer_t& buffer = (bufferMutex.first);
+  
+  // check the cache size, and upgrade if needed.
+  size_t capacity = buffer.capacity();
+  if (capacity < points.size()) {
+    // plenty of room
+    setBufferCapacity(bufferMutex, points.size() + capacity);
+    grew = true;
+  }
+  
+  // figure out the insert order...
+  // if the set we're inserting has to be prepended to the buffer...
+  
+  time_t insertFirst = points.front().time;
+  time_t insertLast = points.back().time;
+  
+  PointRecord::time_pair_t range(0,0);
+  if (!buffer.empty()) {
+    range = make_pair(buffer.firstTime(), buffer.lastTime());
   }
   
+  bool dropped = false, cleared = false, replaced = false;
   
+  if (!(range.first <= insertLast && insertFirst <= range.second)) {
+    // discontinuous with what we have -- clear the buffer first.
+    dropped = cleared = !buffer.empty();
+    buffer.clear();
+  }
+  
+  // overlapping or not, one merge -- replacing the cached value wherever a time is already present.
+  if (buffer.mergeOrdered(points, (_evictionPolicy == evictOldest), replaced) > 0) {
+    dropped = true;
+  }
+  
+  if (dropped) {
+    ++bufferMutex.second->evictions;
+  }
+  
+  bufferLock.unlock();
+  if (cleared || replaced) {
+    ++_generation;
+  }
+  if (grew) {
+    enforceMemoryBudget(&bufferMutex);
+  }
   
 }
 
 
-void BufferPointRecord::addPoints(const string& identifier, std::vector<Point> points) {
-  if (points.size() == 0) {
+void BufferPointRecord::mergePointsIntoBuffer(BufferMutexPair_t& bufferMutex, const std::vector<Point>& batch) {
+  if (batch.empty()) {
     return;
   }
-  // check the cache size, and upgrade if needed.
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
-  if (it != _keyedBufferMutex.end()) {
-    PointBuffer_t& buffer = (it->second.first);
-    size_t capacity = buffer.capacity();
-    if (capacity < points.size()) {
-      // plenty of room
-      buffer.set_capacity(points.size() + capacity);
-    }
-    
-    // figure out the insert order...
-    // if the set we're inserting has to be prepended to the buffer...
-    
-    time_t insertFirst = points.front().time;
-    time_t insertLast = points.back().time;
-    
-    PointRecord::time_pair_t range = BufferPointRecord::range(identifier);
-    
-    // make sure they're in order
-    std::sort(points.begin(), points.end(), &Point::comparePointTime);
-    
-   
-    bool gap = true;
-    
-    if (insertFirst < range.second && range.second < insertLast) {
-      // insert onto end.
-      gap = false;
-      Point finder(range.second, 0);
-      vector<Point>::const_iterator pIt = upper_bound(points.begin(), points.end(), finder, &Point::comparePointTime);
-      while (pIt != points.end()) {
-        // skip points that fall before the end of the buffer.
-        
-        if (pIt->time > range.second) {
-          BufferPointRecord::addPoint(identifier, *pIt);
-        }
-        ++pIt;
-      }
-    }
-    if (insertFirst < range.first && range.first < insertLast) {
-      // insert onto front (reverse iteration)
-      gap = false;
-      vector<Point>::const_reverse_iterator pIt = points.rbegin();
-      while (pIt != points.rend()) {
-        
-        // skip overlapping points.
-        if (pIt->time < range.first) {
-          BufferPointRecord::addPoint(identifier, *pIt);
-        }
-        // else { /* skip */ }
-        
-        ++pIt;
-      }
-    }
-    if (range.first <= insertFirst && insertLast <= range.second) {
-      // complete overlap -- why did we even try to add these?
-      gap = false;
-    }
-    
-    if (gap) {
-      // clear the buffer first.
-      buffer.clear();
-      
-      // add new points.
-      BOOST_FOREACH(Point p, points) {
-        BufferPointRecord::addPoint(identifier, p);
-      }
+  if (batch.size() == 1) {
+    addPointToBuffer(bufferMutex, batch.front());
+    return;
+  }
+  
+  std::vector<Point> scratch;
+  const std::vector<Point>& points = orderedPoints(batch, scratch);
+  
+  touch(bufferMutex);
+  bool grew = false, replaced = false;
+  {
+    // nothing held is let go for being apart from the batch -- only what there's no room for, as addPoint would.
+    writeLock_t bufferLock(bufferMutex.second->mutex);
+    grew = growForInsert(bufferMutex);
+    if (bufferMutex.first.mergeOrdered(points, (_evictionPolicy == evictOldest), replaced) > 0) {
+      ++bufferMutex.second->evictions;
     }
-    
+  }
+  if (replaced) {
+    ++_generation;
+  }
+  if (grew) {
+    enforceMemoryBudget(&bufferMutex);
   }
 }
 
 
-void BufferPointRecord::reset() {
-  _keyedBufferMutex.clear();
+#pragma mark - Eviction Tracking
+
+void BufferPointRecord::setEvictionPolicy(evictionPolicy_t policy) {
+  _evictionPolicy = policy;
 }
 
-void BufferPointRecord::reset(const string& identifier) {
+BufferPointRecord::evictionPolicy_t BufferPointRecord::evictionPolicy() {
+  return _evictionPolicy;
+}
+
+unsigned long BufferPointRecord::evictionCount(const std::string& identifier) {
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  return (bm ? bm->second->evictions.load() : 0);
+}
+
+
+#pragma mark - Memory Budget
+
+void BufferPointRecord::setMemoryBudget(size_t bytes) {
+  _memoryBudget = bytes / bytesPerPoint;
+  enforceMemoryBudget(NULL);
+}
+
+size_t BufferPointRecord::memoryBudget() {
+  return _memoryBudget * bytesPerPoint;
+}
+
+size_t BufferPointRecord::memoryFootprint() {
+  size_t bytes = _totalCapacity.load() * bytesPerPoint;
+  notePeakFootprint(bytes);
+  return bytes;
+}
+
+size_t BufferPointRecord::seriesMemoryFootprint(const std::string& identifier) {
+  BufferMutexPair_t* bm = bufferForName(identifier);
+  if (!bm) {
+    return 0;
+  }
+  readLock_t bufferLock(bm->second->mutex);
+  return bm->first.capacity() * bytesPerPoint;
+}
+
+void BufferPointRecord::touch(BufferMutexPair_t& bufferMutex) {
+  // cheap, contention-free recency stamp. the epoch only moves when the budget is enforced.
+  bufferMutex.second->lastAccess.store(_epoch.load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+}
+
+void BufferPointRecord::setBufferCapacity(BufferMutexPair_t& bufferMutex, size_t capacity) {
+  PointBuffer_t& buffer = bufferMutex.first;
+  size_t previous = buffer.capacity();
+  if (capacity < previous) {
+    if (buffer.size() > capacity) {
+      ++bufferMutex.second->evictions;
+    }
+    buffer.rset_capacity(capacity);
+    _totalCapacity -= (previous - capacity);
+  }
+  else {
+    buffer.set_capacity(capacity);
+    size_t total = (_totalCapacity += (capacity - previous));
+    notePeakFootprint(total * bytesPerPoint);
+  }
   
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(identifier);
-  if (it != _keyedBufferMutex.end()) {
-    PointBuffer_t& buffer = (it->second.first);
-    buffer.clear();
+  size_t excess = (capacity > _defaultCapacity) ? (capacity - _defaultCapacity) : 0;
+  _excessCapacity -= bufferMutex.second->excess;
+  _excessCapacity += excess;
+  bufferMutex.second->excess = excess;
+}
+
+bool BufferPointRecord::growForInsert(BufferMutexPair_t& bufferMutex) {
+  // with a budget, a full buffer that's in active use gets more room instead of dropping its oldest point.
+  PointBuffer_t& buffer = bufferMutex.first;
+  if (_memoryBudget == 0 || !buffer.full()) {
+    return false;
+  }
+  if (bufferMutex.second->lastAccess.load(boost::memory_order_relaxed) != _epoch.load(boost::memory_order_relaxed)) {
+    return false;
+  }
+  size_t growBy = RTX_MAX(buffer.capacity(), _defaultCapacity);
+  size_t total = _totalCapacity.load();
+  if (total + growBy > _memoryBudget) {
+    // over budget -- only grow if we can take the room back from other series.
+    size_t reclaimable = _excessCapacity.load() - bufferMutex.second->excess;
+    if (total + growBy - _memoryBudget > reclaimable) {
+      return false;
+    }
+  }
+  setBufferCapacity(bufferMutex, buffer.capacity() + growBy);
+  return true;
+}
+
+void BufferPointRecord::enforceMemoryBudget(BufferMutexPair_t* keep) {
+  if (_memoryBudget == 0 || _totalCapacity.load() <= _memoryBudget) {
+    return;
+  }
+  
+  // collect trimmable series, oldest access first.
+  typedef std::map<std::string, BufferMutexPair_t >::value_type& nameMapValue_t;
+  std::vector< std::pair<unsigned long, BufferMutexPair_t*> > candidates;
+  readLock_t registryLock(_registryMutex);
+  BOOST_FOREACH(nameMapValue_t entry, _keyedBufferMutex) {
+    BufferMutexPair_t* bm = &(entry.second);
+    if (bm != keep) {
+      candidates.push_back(make_pair(bm->second->lastAccess.load(), bm));
+    }
   }
+  std::sort(candidates.begin(), candidates.end());
   
+  typedef std::pair<unsigned long, BufferMutexPair_t*> candidate_t;
+  BOOST_FOREACH(const candidate_t& candidate, candidates) {
+    if (_totalCapacity.load() <= _memoryBudget) {
+      break;
+    }
+    BufferMutexPair_t* bm = candidate.second;
+    writeLock_t bufferLock(bm->second->mutex);
+    if (bm->first.capacity() > _defaultCapacity) {
+      setBufferCapacity(*bm, _defaultCapacity);
+    }
+  }
+  
+  // start a new access epoch, so that recency is measured from here.
+  ++_epoch;
 }
 
 
+#pragma mark - Snapshots
 
-Point BufferPointRecord::firstPoint(const string& id) {
-  Point foundPoint;
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(id);
-  if (it != _keyedBufferMutex.end()) {
-    // get the constituents
-    //boost::signals2::mutex *mutex = (it->second.second.get());
-    PointBuffer_t& buffer = (it->second.first);
-    
-    if (buffer.empty()) {
-      return foundPoint;
-    }
-    
-    //TimePointPair_t tpPair = buffer.front();
-    foundPoint = buffer.front(); // Point(tpPair.first, tpPair.second.first);
-    
+static const char snapshotMagic[8] = {'R','T','X','B','U','F','F','1'};
+static const uint32_t snapshotVersion = 1;
+static const uint32_t snapshotMaxString = 1 << 16;
+
+void BufferPointRecord::writeString(std::ostream& stream, const std::string& text) {
+  writeValue(stream, (uint32_t)text.size());
+  stream.write(text.data(), text.size());
+}
+
+bool BufferPointRecord::readString(std::istream& stream, std::string& text) {
+  uint32_t length = 0;
+  if (!readValue(stream, length) || length > snapshotMaxString) {
+    return false;
   }
-  return foundPoint;
+  text.resize(length);
+  return (length == 0 || !stream.read(&text[0], length).fail());
 }
 
-Point BufferPointRecord::lastPoint(const string& id) {
-  Point foundPoint;
-  KeyedBufferMutexMap_t::iterator it = _keyedBufferMutex.find(id);
-  if (it != _keyedBufferMutex.end()) {
-    // get the constituents
-    //boost::signals2::mutex *mutex = (it->second.second.get());
-    PointBuffer_t& buffer = (it->second.first);
-    
-    if (buffer.empty()) {
-      return foundPoint;
+void BufferPointRecord::writeSnapshot(std::ostream& stream) {
+  typedef std::map<std::string, BufferMutexPair_t >::value_type& nameMapValue_t;
+  stream.write(snapshotMagic, sizeof(snapshotMagic));
+  writeValue(stream, snapshotVersion);
+  
+  readLock_t registryLock(_registryMutex);
+  writeValue(stream, (uint64_t)_keyedBufferMutex.size());
+  BOOST_FOREACH(nameMapValue_t entry, _keyedBufferMutex) {
+    readLock_t bufferLock(entry.second.second->mutex);
+    const PointBuffer_t& buffer = entry.second.first;
+    writeString(stream, entry.first);
+    writeValue(stream, (uint64_t)buffer.size());
+    for (size_t iPoint = 0; iPoint < buffer.size(); ++iPoint) {
+      Point point = buffer.at(iPoint);
+      writeValue(stream, (int64_t)point.time);
+      writeValue(stream, point.value);
+      writeValue(stream, (int32_t)point.quality);
+      writeValue(stream, point.confidence);
     }
-    
-    //TimePointPair_t tpPair = buffer.back();
-    foundPoint = buffer.back(); // Point(tpPair.first, tpPair.second.first);
-    
   }
-  return foundPoint;
 }
 
-PointRecord::time_pair_t BufferPointRecord::range(const string& id) {
-  return make_pair(BufferPointRecord::firstPoint(id).time, BufferPointRecord::lastPoint(id).time);
+bool BufferPointRecord::readSnapshot(std::istream& stream) {
+  char magic[sizeof(snapshotMagic)];
+  uint32_t version = 0;
+  uint64_t seriesCount = 0;
+  if (stream.read(magic, sizeof(magic)).fail() || memcmp(magic, snapshotMagic, sizeof(magic)) != 0 || !readValue(stream, version) || version != snapshotVersion || !readValue(stream, seriesCount)) {
+    return false;
+  }
+  
+  for (uint64_t iSeries = 0; iSeries < seriesCount; ++iSeries) {
+    std::string id;
+    uint64_t count = 0;
+    if (!readString(stream, id) || !readValue(stream, count)) {
+      return false;
+    }
+    vector<Point> points;
+    for (uint64_t iPoint = 0; iPoint < count; ++iPoint) {
+      int64_t time;
+      double value, confidence;
+      int32_t quality;
+      if (!readValue(stream, time) || !readValue(stream, value) || !readValue(stream, quality) || !readValue(stream, confidence)) {
+        return false;
+      }
+      points.push_back(Point((time_t)time, value, (Point::Qual_t)quality, confidence));
+    }
+    // straight into the buffer -- a subclass' addPoints would send them on to wherever it stores them
+    if (!points.empty() && bufferForName(id)) {
+      BufferPointRecord::addPoints(id, points);
+    }
+  }
+  return true;
 }
@@ -15,6 +15,7 @@
 #include <vector>
 #include <deque>
 #include <fstream>
+#include <stdint.h>
 
 #include "Point.h"
 #include "rtxMacros.h"
@@ -22,12 +23,36 @@
 #include "PointRecord.h"
 
 #include <boost/circular_buffer.hpp>
-#include <boost/signals2/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/atomic.hpp>
 
 using std::string;
 
 namespace RTX {
   
+  /*!
+   \class BufferPointRecord
+   \brief An in-memory PointRecord with a fixed-capacity buffer per series.
+   
+   BufferPointRecord is safe to share between threads. Each series buffer is guarded by a reader/writer lock, so
+   any number of readers can search a warm buffer at the same time while writers get exclusive access. The
+   single-entry "last point" cache is kept per-thread, so readers never write shared state.
+   
+   By default each series holds a fixed window of _defaultCapacity points. Setting a memory budget shares one
+   pool across all series instead: busy series grow their buffers on demand, and when the pool is exhausted the
+   least-recently-used series are trimmed back to the default window (oldest points first).
+   
+   Late and backfilled points go straight to their place in time: a single point is inserted where it belongs, and a
+   batch that overlaps what's held is merged with it in one pass. mergePoints merges a batch whatever it overlaps, as
+   so many addPoint calls would, but under one lock -- for samples off a feed (see IngestQueue). When a full buffer
+   can't grow, its eviction policy says which end gives way -- the oldest points by default.
+   
+   writeSnapshot() dumps every series' points to a stream, and readSnapshot() puts them back, so that a service can
+   start again with the caches it had (see ConfigFactory::setCacheSnapshotFile). Only series registered by then are
+   restored; the rest of the snapshot is skipped.
+   */
+  
   class BufferPointRecord : public PointRecord{
     
   public:
@@ -43,31 +68,168 @@ namespace RTX {
     virtual Point pointBefore(const string& identifier, time_t time);
     virtual Point pointAfter(const string& identifier, time_t time);
     virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor);
     virtual void addPoint(const string& identifier, Point point);
-    virtual void addPoints(const string& identifier, std::vector<Point> points);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
+    virtual void mergePoints(const string& identifier, const std::vector<Point>& points);
     virtual void reset();
     virtual void reset(const string& identifier);
     virtual Point firstPoint(const string& id);
     virtual Point lastPoint(const string& id);
     virtual time_pair_t range(const string& id);
+    //! bumped whenever a series loses points it was holding (capacity overflow, trimming, or a discontinuous addPoints),
+    //! or can't keep one it's given
+    virtual unsigned long evictionCount(const std::string& identifier);
+    
+    // what a full buffer gives up for a new point, when it can't grow
+    typedef enum {
+      evictOldest,  // the default. a late point older than everything held is the one not kept
+      evictNewest   // for a fixed stretch of history: a point newer than everything held is the one not kept
+    } evictionPolicy_t;
+    void setEvictionPolicy(evictionPolicy_t policy);
+    evictionPolicy_t evictionPolicy();
+    
+    // handle-based access
+    virtual Point point(handle_t handle, time_t time);
+    virtual Point pointBefore(handle_t handle, time_t time);
+    virtual Point pointAfter(handle_t handle, time_t time);
+    virtual std::vector<Point> pointsInRange(handle_t handle, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(handle_t handle, Point point);
+    virtual void addPoints(handle_t handle, const std::vector<Point>& points);
+    virtual void mergePoints(handle_t handle, const std::vector<Point>& points);
     
     virtual std::ostream& toStream(std::ostream &stream);
     
+    // warm-cache snapshots
+    virtual void writeSnapshot(std::ostream& stream); //! every series' points, in a compact binary form
+    virtual bool readSnapshot(std::istream& stream);  //! into the series already registered. false if it isn't one
+    
+    // the snapshot encoding, for subclasses' sections and whatever frames them
+    template<typename T> static void writeValue(std::ostream& stream, const T& value) {
+      stream.write((const char*)&value, sizeof(T));
+    };
+    template<typename T> static bool readValue(std::istream& stream, T& value) {
+      return !stream.read((char*)&value, sizeof(T)).fail();
+    };
+    static void writeString(std::ostream& stream, const std::string& text);
+    static bool readString(std::istream& stream, std::string& text);
+    
+    // memory budget
+    void setMemoryBudget(size_t bytes);   //! 0 (the default) means no budget -- fixed per-series windows
+    size_t memoryBudget();
+    virtual size_t memoryFootprint();     //! bytes currently reserved by all series buffers
+    virtual size_t seriesMemoryFootprint(const std::string& identifier);
+    static const size_t bytesPerPoint;
+    
     // types
-    //typedef std::pair<double,double> PointPair_t;
-    //typedef std::pair<time_t, PointPair_t > TimePointPair_t;
-    //typedef boost::circular_buffer<TimePointPair_t> PointBuffer_t;
-    typedef boost::circular_buffer<Point> PointBuffer_t;
-    typedef std::pair<PointBuffer_t, boost::shared_ptr<boost::signals2::mutex> > BufferMutexPair_t;
+    
+    /*!
+     \class PointBuffer_t
+     \brief Columnar (structure-of-arrays) storage for a single series.
+     
+     Time, value, quality and confidence are kept in separate contiguous circular buffers that always share
+     the same size and capacity. Searches run over the time column alone, and Point objects are only
+     assembled for the elements that are actually returned.
+     */
+    class PointBuffer_t {
+    public:
+      PointBuffer_t();
+      
+      size_t size() const;
+      size_t capacity() const;
+      bool empty() const;
+      bool full() const;
+      void set_capacity(size_t capacity);
+      void rset_capacity(size_t capacity); //! shrinks by dropping the oldest points
+      void clear();
+      
+      Point at(size_t index) const;
+      Point front() const;
+      Point back() const;
+      time_t timeAt(size_t index) const;
+      time_t firstTime() const;
+      time_t lastTime() const;
+      
+      //! index of the first element with time >= t, or size() if none
+      size_t lowerBound(time_t time) const;
+      //! index of the first element with time > t, or size() if none
+      size_t upperBound(time_t time) const;
+      
+      void push_back(const Point& point);
+      void push_front(const Point& point);
+      //! insert point at its sorted position. returns false if the time was already present (its values are replaced).
+      //! when full, the front (or with dropOldest false, the back) makes way.
+      bool insertOrdered(const Point& point, bool dropOldest);
+      //! merge in time-ordered points, a batch's point replacing any held at its time (and a later one in the batch,
+      //! an earlier one). returns how many points were dropped, or not kept, for want of room. replaced is set if a
+      //! point that was held has new values.
+      size_t mergeOrdered(const std::vector<Point>& points, bool dropOldest, bool& replaced);
+      
+    private:
+      boost::circular_buffer<time_t> _times;
+      boost::circular_buffer<double> _values;
+      boost::circular_buffer<Point::Qual_t> _qualities;
+      boost::circular_buffer<double> _confidences;
+    };
+    
+    //! per-series lock and bookkeeping
+    class BufferGuard_t {
+    public:
+      BufferGuard_t() : lastAccess(0), excess(0), evictions(0) {};
+      boost::shared_mutex mutex;
+      boost::atomic<unsigned long> lastAccess;
+      size_t excess; // capacity held beyond the default window
+      boost::atomic<unsigned long> evictions;
+    };
+    
+    typedef std::pair<PointBuffer_t, boost::shared_ptr<BufferGuard_t> > BufferMutexPair_t;
     typedef std::map<std::string, BufferMutexPair_t> KeyedBufferMutexMap_t;
     
     size_t _defaultCapacity;
     
-  protected:
-    
   private:
     std::map<std::string, BufferMutexPair_t > _keyedBufferMutex;
-    //Point makePoint(PointBuffer_t::const_iterator iterator);
+    std::vector<BufferMutexPair_t*> _handleBuffers;
+    boost::shared_mutex _registryMutex; // guards the map/handle table (not the buffers themselves)
+    boost::atomic<unsigned long> _generation; // bumped when held points change or go, so stale per-thread caches are ignored
+    BufferMutexPair_t* bufferForName(const std::string& identifier);
+    BufferMutexPair_t* bufferForHandle(handle_t handle);
+    
+    // per-thread single-entry cache for repeated calls to point()
+    class CachedPoint_t {
+    public:
+      CachedPoint_t() : generation(0) {};
+      std::string id;
+      Point point;
+      unsigned long generation;
+    };
+    boost::thread_specific_ptr<CachedPoint_t> _threadCache;
+    CachedPoint_t& threadCache();
+    unsigned long generation();
+    void setThreadCache(const std::string& identifier, const Point& point, unsigned long generation); //! as of before the read
+    
+    // buffer operations shared by the named and handle-based methods
+    Point pointFromBuffer(BufferMutexPair_t& bufferMutex, time_t time);
+    Point pointBeforeFromBuffer(BufferMutexPair_t& bufferMutex, time_t time);
+    Point pointAfterFromBuffer(BufferMutexPair_t& bufferMutex, time_t time);
+    std::vector<Point> pointsInRangeFromBuffer(BufferMutexPair_t& bufferMutex, time_t startTime, time_t endTime);
+    void visitPointsInBuffer(BufferMutexPair_t& bufferMutex, time_t startTime, time_t endTime, PointVisitor& visitor);
+    void addPointToBuffer(BufferMutexPair_t& bufferMutex, const Point& point);
+    void addPointsToBuffer(BufferMutexPair_t& bufferMutex, const std::vector<Point>& batch);
+    void mergePointsIntoBuffer(BufferMutexPair_t& bufferMutex, const std::vector<Point>& batch);
+    bool insertIntoBuffer(PointBuffer_t& buffer, const Point& point, bool& replaced); // caller holds the write lock. true if a point was pushed out
+    evictionPolicy_t _evictionPolicy;
+    
+    // budget bookkeeping
+    void touch(BufferMutexPair_t& bufferMutex);
+    void setBufferCapacity(BufferMutexPair_t& bufferMutex, size_t capacity); // caller holds the write lock
+    bool growForInsert(BufferMutexPair_t& bufferMutex);              // caller holds the write lock
+    void enforceMemoryBudget(BufferMutexPair_t* keep);
+    size_t _memoryBudget;                   // in points
+    boost::atomic<size_t> _totalCapacity;   // in points
+    boost::atomic<size_t> _excessCapacity;  // in points, beyond the default windows
+    boost::atomic<unsigned long> _epoch;
   };
   
   std::ostream& operator<< (std::ostream &out, BufferPointRecord &pr);
@@ -40,6 +40,11 @@ bool Clock::isCompatibleWith(Clock::sharedPointer clock) {
     return true;
   }
   
+  // an irregular clock's times don't fall on mine (and it has no period to divide by)
+  if (!clock->isRegular() || clock->period() <= 0) {
+    return false;
+  }
+  
   // otherwise...
   time_t offsetDifference;
   int periodModulus;
@@ -119,18 +124,40 @@ time_t Clock::timeAfter(time_t time) {
   }
 }
 
+namespace {
+  // collects visited times into a vector
+  class TimeCollector : public TimeVisitor {
+  public:
+    TimeCollector(std::vector<time_t>& times) : _times(times) {};
+    virtual bool visit(time_t time) {
+      _times.push_back(time);
+      return true;
+    }
+  private:
+    std::vector<time_t>& _times;
+  };
+}
+
 std::vector< time_t > Clock::timeValuesInRange(time_t start, time_t end) {
   std::vector<time_t> timeList;
+  timeValuesInRange(start, end, timeList);
+  return timeList;
+}
+
+void Clock::timeValuesInRange(time_t start, time_t end, std::vector<time_t>& out) {
+  TimeCollector collector(out);
+  this->visitTimeValuesInRange(start, end, collector);
+}
+
+void Clock::visitTimeValuesInRange(time_t start, time_t end, TimeVisitor& visitor) {
   if (!isValid(start)) {
     start = timeAfter(start);
   }
   for (time_t thisTime = start; thisTime < end; thisTime = timeAfter(thisTime)) {
-    if (thisTime == 0) {
+    if (thisTime == 0 || !visitor.visit(thisTime)) {
       break;
     }
-    timeList.push_back(thisTime);
   }
-  return timeList;
 }
 
 
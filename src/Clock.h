@@ -73,11 +73,30 @@ namespace RTX {
    \param end A range end time.
    \return A vector of time_t values that are valid for this clock within the specified range.
    
+   \fn void Clock::timeValuesInRange(time_t start, time_t end, std::vector<time_t>& out)
+   \brief The same time values, appended to a vector the caller owns -- a Scratch::Vector, say.
+   \param start A range start time.
+   \param end A range end time.
+   \param out Where the time values go, after anything already there.
+   
+   \fn void Clock::visitTimeValuesInRange(time_t start, time_t end, TimeVisitor& visitor)
+   \brief Stream the valid time values within a range through a visitor, without building a vector.
+   \param start A range start time.
+   \param end A range end time.
+   \param visitor Called once per time value, in order; return false from TimeVisitor::visit to stop early.
+   
    */
   
   
   
   
+  //! Callback interface for streaming time values out of a Clock.
+  class TimeVisitor {
+  public:
+    virtual ~TimeVisitor() {};
+    virtual bool visit(time_t time) = 0;
+  };
+  
   class Clock {
     
   public:
@@ -95,6 +114,8 @@ namespace RTX {
     int period();
     time_t start();
     virtual std::vector< time_t > timeValuesInRange(time_t start, time_t end);
+    void timeValuesInRange(time_t start, time_t end, std::vector<time_t>& out);
+    virtual void visitTimeValuesInRange(time_t start, time_t end, TimeVisitor& visitor);
     virtual std::ostream& toStream(std::ostream &stream);
     
   private:
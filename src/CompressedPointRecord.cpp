@@ -0,0 +1,635 @@
+//
+//  CompressedPointRecord.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "CompressedPointRecord.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
+// sentinel for "no previous xor window", so the first non-zero xor always writes a fresh window
+static const int noWindow = 65;
+
+
+#pragma mark - Bit Packing
+
+static uint64_t bitsForDouble(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(double));
+  return bits;
+}
+
+static double doubleForBits(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(double));
+  return value;
+}
+
+namespace {
+  // sequential most-significant-bit-first reader over a Block's data
+  class BitReader {
+  public:
+    BitReader(const std::vector<uint8_t>& data) : _data(data), _position(0) {};
+    uint64_t read(int nBits) {
+      uint64_t value = 0;
+      while (nBits > 0) {
+        size_t byte = _position >> 3;
+        int offset = _position & 7;
+        int available = 8 - offset;
+        int take = (nBits < available) ? nBits : available;
+        uint8_t chunk = (_data[byte] >> (available - take)) & ((1 << take) - 1);
+        value = (value << take) | chunk;
+        _position += take;
+        nBits -= take;
+      }
+      return value;
+    }
+    bool readBit() {
+      bool bit = (_data[_position >> 3] >> (7 - (_position & 7))) & 1;
+      ++_position;
+      return bit;
+    }
+    uint64_t readXor(uint64_t& previous, int& leading, int& trailing) {
+      if (readBit()) {
+        if (readBit()) {
+          // new window
+          leading = (int)read(5);
+          int significant = (int)read(6) + 1;
+          trailing = 64 - leading - significant;
+        }
+        int significant = 64 - leading - trailing;
+        uint64_t x = read(significant) << trailing;
+        previous ^= x;
+      }
+      return previous;
+    }
+  private:
+    const std::vector<uint8_t>& _data;
+    size_t _position;
+  };
+}
+
+
+#pragma mark - Block
+
+CompressedPointRecord::Block::Block() : _bitCount(0), _count(0), _firstTime(0), _lastTime(0), _previousDelta(0), _previousValue(0), _previousConfidence(0), _valueLeading(noWindow), _valueTrailing(0), _confidenceLeading(noWindow), _confidenceTrailing(0), _previousQuality(0) {
+  
+}
+
+size_t CompressedPointRecord::Block::count() const {
+  return _count;
+}
+
+size_t CompressedPointRecord::Block::bytes() const {
+  return _data.capacity() + sizeof(Block);
+}
+
+time_t CompressedPointRecord::Block::firstTime() const {
+  return _firstTime;
+}
+
+time_t CompressedPointRecord::Block::lastTime() const {
+  return _lastTime;
+}
+
+void CompressedPointRecord::Block::writeBits(uint64_t value, int nBits) {
+  while (nBits > 0) {
+    int offset = _bitCount & 7;
+    if (offset == 0) {
+      _data.push_back(0);
+    }
+    int available = 8 - offset;
+    int take = (nBits < available) ? nBits : available;
+    uint8_t chunk = (uint8_t)((value >> (nBits - take)) & ((1 << take) - 1));
+    _data.back() |= (chunk << (available - take));
+    _bitCount += take;
+    nBits -= take;
+  }
+}
+
+void CompressedPointRecord::Block::writeXor(uint64_t bits, uint64_t& previous, int& leading, int& trailing) {
+  uint64_t x = bits ^ previous;
+  previous = bits;
+  if (x == 0) {
+    writeBits(0, 1);
+    return;
+  }
+  writeBits(1, 1);
+  int lead = __builtin_clzll(x);
+  int trail = __builtin_ctzll(x);
+  if (lead > 31) {
+    lead = 31; // has to fit in five bits
+  }
+  if (leading != noWindow && lead >= leading && trail >= trailing) {
+    // fits in the previous window
+    writeBits(0, 1);
+    writeBits(x >> trailing, 64 - leading - trailing);
+  }
+  else {
+    int significant = 64 - lead - trail;
+    writeBits(1, 1);
+    writeBits(lead, 5);
+    writeBits(significant - 1, 6);
+    writeBits(x >> trail, significant);
+    leading = lead;
+    trailing = trail;
+  }
+}
+
+void CompressedPointRecord::Block::append(const Point& point) {
+  uint64_t valueBits = bitsForDouble(point.value);
+  uint64_t confidenceBits = bitsForDouble(point.confidence);
+  int quality = (int)point.quality;
+  
+  if (_count == 0) {
+    // raw header point
+    writeBits((uint64_t)point.time, 64);
+    writeBits(valueBits, 64);
+    writeBits(confidenceBits, 64);
+    writeBits(quality, 3);
+    _firstTime = point.time;
+    _previousValue = valueBits;
+    _previousConfidence = confidenceBits;
+  }
+  else {
+    // time: delta of delta
+    int64_t delta = (int64_t)(point.time - _lastTime);
+    int64_t dod = delta - _previousDelta;
+    _previousDelta = delta;
+    if (dod == 0) {
+      writeBits(0, 1);
+    }
+    else if (-63 <= dod && dod <= 64) {
+      writeBits(2, 2);
+      writeBits(dod + 63, 7);
+    }
+    else if (-255 <= dod && dod <= 256) {
+      writeBits(6, 3);
+      writeBits(dod + 255, 9);
+    }
+    else if (-2047 <= dod && dod <= 2048) {
+      writeBits(14, 4);
+      writeBits(dod + 2047, 12);
+    }
+    else {
+      writeBits(15, 4);
+      writeBits((uint64_t)dod, 64);
+    }
+  
+    // values, confidence: xor with previous
+    writeXor(valueBits, _previousValue, _valueLeading, _valueTrailing);
+    writeXor(confidenceBits, _previousConfidence, _confidenceLeading, _confidenceTrailing);
+  
+    // quality rarely changes
+    if (quality == _previousQuality) {
+      writeBits(0, 1);
+    }
+    else {
+      writeBits(1, 1);
+      writeBits(quality, 3);
+    }
+  }
+  
+  _previousQuality = quality;
+  _lastTime = point.time;
+  ++_count;
+}
+
+void CompressedPointRecord::Block::seal() {
+  std::vector<uint8_t>(_data).swap(_data);
+}
+
+void CompressedPointRecord::Block::decodeRange(time_t startTime, time_t endTime, std::vector<Point>& buffer) const {
+  if (_count == 0 || endTime < _firstTime || _lastTime < startTime) {
+    return;
+  }
+  
+  BitReader reader(_data);
+  time_t time = (time_t)reader.read(64);
+  uint64_t value = reader.read(64);
+  uint64_t confidence = reader.read(64);
+  int quality = (int)reader.read(3);
+  int64_t delta = 0;
+  int valueLeading = noWindow, valueTrailing = 0, confidenceLeading = noWindow, confidenceTrailing = 0;
+  
+  for (size_t i = 0; i < _count; ++i) {
+    if (i > 0) {
+      int64_t dod;
+      if (!reader.readBit()) {
+        dod = 0;
+      }
+      else if (!reader.readBit()) {
+        dod = (int64_t)reader.read(7) - 63;
+      }
+      else if (!reader.readBit()) {
+        dod = (int64_t)reader.read(9) - 255;
+      }
+      else if (!reader.readBit()) {
+        dod = (int64_t)reader.read(12) - 2047;
+      }
+      else {
+        dod = (int64_t)reader.read(64);
+      }
+      delta += dod;
+      time += delta;
+      reader.readXor(value, valueLeading, valueTrailing);
+      reader.readXor(confidence, confidenceLeading, confidenceTrailing);
+      if (reader.readBit()) {
+        quality = (int)reader.read(3);
+      }
+    }
+  
+    if (time > endTime) {
+      break;
+    }
+    if (time >= startTime) {
+      buffer.push_back(Point(time, doubleForBits(value), (Point::Qual_t)quality, doubleForBits(confidence)));
+    }
+  }
+}
+
+void CompressedPointRecord::Block::decode(std::vector<Point>& buffer) const {
+  decodeRange(_firstTime, _lastTime, buffer);
+}
+
+void CompressedPointRecord::Block::write(std::ostream& stream) const {
+  uint64_t header[4] = {(uint64_t)_count, (uint64_t)_bitCount, (uint64_t)(int64_t)_firstTime, (uint64_t)(int64_t)_lastTime};
+  stream.write((const char*)header, sizeof(header));
+  if (!_data.empty()) {
+    stream.write((const char*)&_data[0], _data.size());
+  }
+}
+
+bool CompressedPointRecord::Block::read(std::istream& stream) {
+  uint64_t header[4];
+  if (stream.read((char*)header, sizeof(header)).fail()) {
+    return false;
+  }
+  // the first point takes 195 bits, and each after it between 4 and 226, so the counts have to agree
+  uint64_t count = header[0], bitCount = header[1];
+  if ((count == 0 && bitCount != 0) || (count > 0 && (bitCount < 195 + (count - 1) * 4 || bitCount > 195 + (count - 1) * 226))) {
+    return false;
+  }
+  _data.assign((size_t)((bitCount + 7) / 8), 0);
+  if (!_data.empty() && stream.read((char*)&_data[0], _data.size()).fail()) {
+    return false;
+  }
+  _count = (size_t)count;
+  _bitCount = (size_t)bitCount;
+  _firstTime = (time_t)(int64_t)header[2];
+  _lastTime = (time_t)(int64_t)header[3];
+  return true;
+}
+
+
+#pragma mark - Constructor
+
+CompressedPointRecord::CompressedPointRecord() {
+  _blockSize = 512;
+}
+
+std::ostream& RTX::operator<< (std::ostream &out, CompressedPointRecord &pr) {
+  return pr.toStream(out);
+}
+
+std::ostream& CompressedPointRecord::toStream(std::ostream &stream) {
+  stream << "Compressed Point Record (" << compressedSize() << " bytes)" << std::endl;
+  return stream;
+}
+
+void CompressedPointRecord::setBlockSize(size_t pointsPerBlock) {
+  _blockSize = (pointsPerBlock > 1) ? pointsPerBlock : 2;
+}
+
+size_t CompressedPointRecord::blockSize() {
+  return _blockSize;
+}
+
+
+#pragma mark - Registration
+
+std::string CompressedPointRecord::registerAndGetIdentifier(std::string recordName) {
+  writeLock_t registryLock(_registryMutex);
+  if (_series.find(recordName) == _series.end()) {
+    _series[recordName] = SeriesPointer( new Series() );
+  }
+  return recordName;
+}
+
+std::vector<std::string> CompressedPointRecord::identifiers() {
+  typedef std::map<std::string, SeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  vector<string> names;
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    names.push_back(entry.first);
+  }
+  return names;
+}
+
+CompressedPointRecord::SeriesPointer CompressedPointRecord::seriesForName(const std::string& identifier) {
+  readLock_t registryLock(_registryMutex);
+  std::map<std::string, SeriesPointer>::iterator it = _series.find(identifier);
+  if (it == _series.end()) {
+    return SeriesPointer();
+  }
+  return it->second;
+}
+
+// index of the first block whose last time is >= time (or blocks.size())
+size_t CompressedPointRecord::blockIndexForTime(const Series& series, time_t time) {
+  size_t lo = 0, hi = series.blocks.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (series.blocks[mid].lastTime() < time) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+#pragma mark - Retrieval
+
+void CompressedPointRecord::decodeRange(const std::string& identifier, time_t startTime, time_t endTime, std::vector<Point>& buffer) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return;
+  }
+  readLock_t seriesLock(series->mutex);
+  for (size_t i = blockIndexForTime(*series, startTime); i < series->blocks.size(); ++i) {
+    const Block& block = series->blocks[i];
+    if (block.firstTime() > endTime) {
+      break;
+    }
+    block.decodeRange(startTime, endTime, buffer);
+  }
+}
+
+void CompressedPointRecord::visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return;
+  }
+  // only one block's worth of points is ever decoded at a time.
+  std::vector<Point> decoded;
+  decoded.reserve(_blockSize);
+  readLock_t seriesLock(series->mutex);
+  for (size_t i = blockIndexForTime(*series, startTime); i < series->blocks.size(); ++i) {
+    const Block& block = series->blocks[i];
+    if (block.firstTime() > endTime) {
+      break;
+    }
+    decoded.clear();
+    block.decodeRange(startTime, endTime, decoded);
+    BOOST_FOREACH(const Point& point, decoded) {
+      if (!visitor.visit(point)) {
+        return;
+      }
+    }
+  }
+}
+
+std::vector<Point> CompressedPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
+  std::vector<Point> points;
+  decodeRange(identifier, startTime, endTime, points);
+  return points;
+}
+
+Point CompressedPointRecord::point(const string& identifier, time_t time) {
+  std::vector<Point> found;
+  decodeRange(identifier, time, time, found);
+  if (found.empty()) {
+    return Point();
+  }
+  return found.front();
+}
+
+Point CompressedPointRecord::pointBefore(const string& identifier, time_t time) {
+  Point foundPoint;
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return foundPoint;
+  }
+  readLock_t seriesLock(series->mutex);
+  size_t index = blockIndexForTime(*series, time);
+  // the point before is either in this block, or it's the last point of the block before.
+  std::vector<Point> decoded;
+  if (index < series->blocks.size() && series->blocks[index].firstTime() < time) {
+    series->blocks[index].decodeRange(series->blocks[index].firstTime(), time - 1, decoded);
+  }
+  else if (index > 0) {
+    const Block& previous = series->blocks[index - 1];
+    previous.decodeRange(previous.lastTime(), previous.lastTime(), decoded);
+  }
+  if (!decoded.empty()) {
+    foundPoint = decoded.back();
+  }
+  return foundPoint;
+}
+
+Point CompressedPointRecord::pointAfter(const string& identifier, time_t time) {
+  Point foundPoint;
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return foundPoint;
+  }
+  readLock_t seriesLock(series->mutex);
+  size_t index = blockIndexForTime(*series, time + 1);
+  if (index < series->blocks.size()) {
+    const Block& block = series->blocks[index];
+    std::vector<Point> decoded;
+    block.decodeRange(time + 1, block.lastTime(), decoded);
+    if (!decoded.empty()) {
+      foundPoint = decoded.front();
+    }
+  }
+  return foundPoint;
+}
+
+Point CompressedPointRecord::firstPoint(const string& id) {
+  Point foundPoint;
+  SeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (!series->blocks.empty()) {
+      std::vector<Point> decoded;
+      const Block& block = series->blocks.front();
+      block.decodeRange(block.firstTime(), block.firstTime(), decoded);
+      if (!decoded.empty()) {
+        foundPoint = decoded.front();
+      }
+    }
+  }
+  return foundPoint;
+}
+
+Point CompressedPointRecord::lastPoint(const string& id) {
+  Point foundPoint;
+  SeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (!series->blocks.empty()) {
+      std::vector<Point> decoded;
+      const Block& block = series->blocks.back();
+      block.decodeRange(block.lastTime(), block.lastTime(), decoded);
+      if (!decoded.empty()) {
+        foundPoint = decoded.back();
+      }
+    }
+  }
+  return foundPoint;
+}
+
+PointRecord::time_pair_t CompressedPointRecord::range(const string& id) {
+  time_pair_t range(0,0);
+  SeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (!series->blocks.empty()) {
+      range = make_pair(series->blocks.front().firstTime(), series->blocks.back().lastTime());
+    }
+  }
+  return range;
+}
+
+
+#pragma mark - Insertion
+
+void CompressedPointRecord::insertPoint(Series& series, const Point& point) {
+  std::vector<Block>& blocks = series.blocks;
+  
+  // fast path: appending to the open block
+  if (blocks.empty() || point.time > blocks.back().lastTime()) {
+    if (blocks.empty() || blocks.back().count() >= _blockSize) {
+      if (!blocks.empty()) {
+        blocks.back().seal();
+      }
+      blocks.push_back(Block());
+    }
+    blocks.back().append(point);
+    return;
+  }
+  
+  // slow path: out-of-order. re-encode the block it belongs in.
+  size_t index = blockIndexForTime(series, point.time);
+  if (index >= blocks.size()) {
+    index = blocks.size() - 1;
+  }
+  std::vector<Point> decoded;
+  decoded.reserve(blocks[index].count() + 1);
+  blocks[index].decode(decoded);
+  std::vector<Point>::iterator pos = std::lower_bound(decoded.begin(), decoded.end(), point, &Point::comparePointTime);
+  if (pos != decoded.end() && pos->time == point.time) {
+    // duplicate time -- a correction, so the newer point wins.
+    *pos = point;
+  }
+  else {
+    decoded.insert(pos, point);
+  }
+  
+  // re-pack, splitting if the block overflowed
+  std::vector<Block> rebuilt(1);
+  BOOST_FOREACH(const Point& p, decoded) {
+    if (rebuilt.back().count() >= _blockSize) {
+      rebuilt.back().seal();
+      rebuilt.push_back(Block());
+    }
+    rebuilt.back().append(p);
+  }
+  blocks.erase(blocks.begin() + index);
+  blocks.insert(blocks.begin() + index, rebuilt.begin(), rebuilt.end());
+}
+
+void CompressedPointRecord::addPoint(const string& identifier, Point point) {
+  SeriesPointer series = seriesForName(identifier);
+  if (series) {
+    writeLock_t seriesLock(series->mutex);
+    insertPoint(*series, point);
+  }
+}
+
+void CompressedPointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series || points.empty()) {
+    return;
+  }
+  std::vector<Point> scratch;
+  const std::vector<Point>& ordered = orderedPoints(points, scratch);
+  writeLock_t seriesLock(series->mutex);
+  BOOST_FOREACH(const Point& p, ordered) {
+    insertPoint(*series, p);
+  }
+}
+
+void CompressedPointRecord::reset() {
+  typedef std::map<std::string, SeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    writeLock_t seriesLock(entry.second->mutex);
+    entry.second->blocks.clear();
+  }
+}
+
+void CompressedPointRecord::reset(const string& identifier) {
+  SeriesPointer series = seriesForName(identifier);
+  if (series) {
+    writeLock_t seriesLock(series->mutex);
+    series->blocks.clear();
+  }
+}
+
+
+#pragma mark - Sizing
+
+size_t CompressedPointRecord::compressedSize(const std::string& identifier) {
+  size_t bytes = 0;
+  SeriesPointer series = seriesForName(identifier);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    BOOST_FOREACH(const Block& block, series->blocks) {
+      bytes += block.bytes();
+    }
+  }
+  return bytes;
+}
+
+size_t CompressedPointRecord::seriesMemoryFootprint(const std::string& identifier) {
+  return compressedSize(identifier);
+}
+
+size_t CompressedPointRecord::compressedSize() {
+  size_t bytes = 0;
+  BOOST_FOREACH(const std::string& name, identifiers()) {
+    bytes += compressedSize(name);
+  }
+  return bytes;
+}
+
+size_t CompressedPointRecord::pointCount(const std::string& identifier) {
+  size_t count = 0;
+  SeriesPointer series = seriesForName(identifier);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    BOOST_FOREACH(const Block& block, series->blocks) {
+      count += block.count();
+    }
+  }
+  return count;
+}
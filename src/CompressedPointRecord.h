@@ -0,0 +1,133 @@
+//
+//  CompressedPointRecord.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_CompressedPointRecord_h
+#define epanet_rtx_CompressedPointRecord_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <stdint.h>
+
+#include "Point.h"
+#include "rtxMacros.h"
+#include "PointRecord.h"
+
+#include <boost/thread/shared_mutex.hpp>
+
+namespace RTX {
+
+  /*!
+   \class CompressedPointRecord
+   \brief An in-memory PointRecord that keeps each series as a list of compressed blocks.
+
+   Timestamps are stored with delta-of-delta encoding and values/confidences with XOR (Gorilla-style) float
+   encoding, so a regularly-sampled series costs a couple of bytes per point rather than a full Point object.
+   New points are appended to the open block at the end of the series; full blocks are sealed and never touched
+   again unless an out-of-order point lands inside them.
+
+   Unlike BufferPointRecord, there is no fixed per-series capacity -- history is kept until reset.
+   */
+
+  /*!
+   \fn void CompressedPointRecord::decodeRange(const std::string& identifier, time_t startTime, time_t endTime, std::vector<Point>& buffer)
+   \brief Decompress the points in a time range into a caller-supplied vector.
+   \param identifier The name of the data source (tag name).
+   \param startTime The beginning of the requested time range.
+   \param endTime The end of the requested time range.
+   \param buffer Points are appended; pass the same vector in repeatedly to reuse its storage.
+   */
+
+  class CompressedPointRecord : public PointRecord {
+  public:
+    RTX_SHARED_POINTER(CompressedPointRecord);
+    CompressedPointRecord();
+    virtual ~CompressedPointRecord() {};
+
+    virtual std::string registerAndGetIdentifier(std::string recordName);
+    virtual std::vector<std::string> identifiers();
+
+    virtual Point point(const string& identifier, time_t time);
+    virtual Point pointBefore(const string& identifier, time_t time);
+    virtual Point pointAfter(const string& identifier, time_t time);
+    virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(const string& identifier, Point point);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
+    virtual void reset();
+    virtual void reset(const string& identifier);
+    virtual Point firstPoint(const string& id);
+    virtual Point lastPoint(const string& id);
+    virtual time_pair_t range(const string& id);
+
+    void decodeRange(const std::string& identifier, time_t startTime, time_t endTime, std::vector<Point>& buffer);
+
+    // sizing
+    void setBlockSize(size_t pointsPerBlock);
+    size_t blockSize();
+    size_t compressedSize();                              //! bytes held by all series
+    size_t compressedSize(const std::string& identifier);  //! bytes held by one series
+    virtual size_t seriesMemoryFootprint(const std::string& identifier); //! its compressedSize
+    size_t pointCount(const std::string& identifier);
+
+    virtual std::ostream& toStream(std::ostream &stream);
+
+    /*!
+     \class Block
+     \brief A run of up to blockSize() points, bit-packed.
+     */
+    class Block {
+    public:
+      Block();
+      void append(const Point& point);
+      void seal(); //! trim storage once the block is full
+      void decode(std::vector<Point>& buffer) const;
+      void decodeRange(time_t startTime, time_t endTime, std::vector<Point>& buffer) const;
+      size_t count() const;
+      size_t bytes() const;
+      time_t firstTime() const;
+      time_t lastTime() const;
+      void write(std::ostream& stream) const; //! its packed bits, to be read back for decoding (not appending)
+      bool read(std::istream& stream);        //! false if what's there isn't a whole block
+    private:
+      void writeBits(uint64_t value, int nBits);
+      void writeXor(uint64_t bits, uint64_t& previous, int& leading, int& trailing);
+      std::vector<uint8_t> _data;
+      size_t _bitCount;
+      size_t _count;
+      time_t _firstTime, _lastTime;
+      // encoder state, so we can keep appending
+      int64_t _previousDelta;
+      uint64_t _previousValue, _previousConfidence;
+      int _valueLeading, _valueTrailing, _confidenceLeading, _confidenceTrailing;
+      int _previousQuality;
+    };
+
+  private:
+    class Series {
+    public:
+      std::vector<Block> blocks;
+      boost::shared_mutex mutex;
+    };
+    typedef boost::shared_ptr<Series> SeriesPointer;
+
+    SeriesPointer seriesForName(const std::string& identifier);
+    void insertPoint(Series& series, const Point& point);
+    size_t blockIndexForTime(const Series& series, time_t time);
+
+    std::map<std::string, SeriesPointer> _series;
+    boost::shared_mutex _registryMutex;
+    size_t _blockSize;
+  };
+
+  std::ostream& operator<< (std::ostream &out, CompressedPointRecord &pr);
+
+}
+
+#endif
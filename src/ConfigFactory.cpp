@@ -7,41 +7,208 @@
 //  
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <set>
+#include <cstring>
 #include <boost/foreach.hpp>
 #include <boost/filesystem.hpp>
 
 #include "ConfigFactory.h"
 #include "AggregatorTimeSeries.h"
 #include "MovingAverage.h"
+#include "MovingStatistic.h"
 #include "Resampler.h"
+#include "ValidationFilter.h"
 #include "FirstDerivative.h"
 #include "PointRecord.h"
 #include "OdbcPointRecord.h"
 #include "MysqlPointRecord.h"
+#include "MmapPointRecord.h"
+#include "CompressedPointRecord.h"
+#include "VectorPointRecord.h"
 #include "Zone.h"
 #include "EpanetModel.h"
 #include "EpanetSyntheticModel.h"
+#include "Log.h"
 
 using namespace RTX;
 using namespace libconfig;
 using namespace std;
 
+namespace {
+  // a definition, written out so that alike ones compare equal: group members sorted, names left out, and each
+  // source by the name of the series it was merged into (if it was).
+  std::string settingSignature(const Setting& setting, const map<string, string>& mergedNames) {
+    std::stringstream signature;
+    switch (setting.getType()) {
+      case Setting::TypeGroup: {
+        map<string, string> members;
+        for (int iMember = 0; iMember < setting.getLength(); ++iMember) {
+          const Setting& member = setting[iMember];
+          string memberName = member.getName() ? member.getName() : "";
+          if (memberName != "name") {
+            members[memberName] = settingSignature(member, mergedNames);
+          }
+        }
+        signature << "{";
+        for (map<string, string>::const_iterator member = members.begin(); member != members.end(); ++member) {
+          signature << member->first << "=" << member->second << ";";
+        }
+        signature << "}";
+        break;
+      }
+      case Setting::TypeArray:
+      case Setting::TypeList:
+        signature << "(";
+        for (int iMember = 0; iMember < setting.getLength(); ++iMember) {
+          signature << settingSignature(setting[iMember], mergedNames) << ",";
+        }
+        signature << ")";
+        break;
+      case Setting::TypeString: {
+        string value = setting.c_str();
+        if (setting.getName() && RTX_STRINGS_ARE_EQUAL(string(setting.getName()), "source")) {
+          map<string, string>::const_iterator merged = mergedNames.find(value);
+          if (merged != mergedNames.end()) {
+            value = merged->second;
+          }
+        }
+        signature << '"' << value << '"';
+        break;
+      }
+      case Setting::TypeInt:
+        signature << (int)setting;
+        break;
+      case Setting::TypeInt64:
+        signature << (long long)setting;
+        break;
+      case Setting::TypeFloat:
+        signature << setprecision(17) << (double)setting;
+        break;
+      case Setting::TypeBoolean:
+        signature << ((bool)setting ? "true" : "false");
+        break;
+      default:
+        break;
+    }
+    return signature.str();
+  }
+  
+  // every definition, keyed by its kind and name, and the model, zone and simulation settings as a whole
+  map<string, string> definitionSignatures(const Config& configuration) {
+    map<string, string> signatures;
+    map<string, string> noMerges;
+    const char* named[] = {"records", "clocks", "timeseries"};
+    BOOST_FOREACH(const char* kind, named) {
+      string path = string("configuration.") + kind;
+      if (!configuration.exists(path)) {
+        continue;
+      }
+      const Setting& group = configuration.lookup(path);
+      for (int iDefinition = 0; iDefinition < group.getLength(); ++iDefinition) {
+        const Setting& definition = group[iDefinition];
+        string name = definition["name"];
+        signatures[string(kind) + ":" + name] = settingSignature(definition, noMerges);
+      }
+    }
+    const char* whole[] = {"model", "zones", "simulation"};
+    BOOST_FOREACH(const char* kind, whole) {
+      string path = string("configuration.") + kind;
+      signatures[kind] = configuration.exists(path) ? settingSignature(configuration.lookup(path), noMerges) : "";
+    }
+    return signatures;
+  }
+  
+  // the series a definition draws from: its source, or an aggregator's sources
+  vector<string> sourceNames(const Setting& series) {
+    vector<string> names;
+    string sourceName;
+    if (series.lookupValue("source", sourceName)) {
+      names.push_back(sourceName);
+    }
+    if (series.exists("sources")) {
+      const Setting& sources = series["sources"];
+      for (int iSource = 0; iSource < sources.getLength(); ++iSource) {
+        if (sources[iSource].lookupValue("source", sourceName)) {
+          names.push_back(sourceName);
+        }
+      }
+    }
+    return names;
+  }
+  
+  // what a warm-cache snapshot is only good for: the records, clocks, series and model defined just so (64-bit FNV-1a)
+  uint64_t configurationHash(const Config& configuration) {
+    uint64_t hash = 14695981039346656037ULL;
+    map<string, string> signatures = definitionSignatures(configuration);
+    for (map<string, string>::const_iterator it = signatures.begin(); it != signatures.end(); ++it) {
+      if (it->first == "zones" || it->first == "simulation") {
+        continue;
+      }
+      string text = it->first + "\n" + it->second + "\n";
+      BOOST_FOREACH(char c, text) {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+      }
+    }
+    return hash;
+  }
+  
+  // a named, length-prefixed section of a warm-cache snapshot, so that one nothing matches can be skipped
+  void writeCacheSection(std::ostream& stream, const string& name, BufferPointRecord::sharedPointer record) {
+    std::stringstream section;
+    record->writeSnapshot(section);
+    string bytes = section.str();
+    BufferPointRecord::writeString(stream, name);
+    BufferPointRecord::writeValue(stream, (uint64_t)bytes.size());
+    stream.write(bytes.data(), bytes.size());
+  }
+  
+  bool readCacheSection(std::istream& stream, uint64_t streamSize, string& name, string& bytes) {
+    uint64_t length = 0;
+    if (!BufferPointRecord::readString(stream, name) || !BufferPointRecord::readValue(stream, length) || length > streamSize) {
+      return false;
+    }
+    bytes.resize((size_t)length);
+    return (length == 0 || !stream.read(&bytes[0], (std::streamsize)length).fail());
+  }
+  
+  Setting& configSection(Setting& config, const char* name) {
+    if ( !config.exists(name) ) {
+      config.add(name, Setting::TypeList);
+    }
+    return config[name];
+  }
+}
+
+typedef boost::lock_guard<boost::recursive_mutex> stepLock_t;
+
+static const char cacheSnapshotMagic[8] = {'R','T','X','W','A','R','M','1'};
+static const uint32_t cacheSnapshotVersion = 1;
+
 #pragma mark Constructor/Destructor
 
 ConfigFactory::ConfigFactory() {
   // register point record and time series types to their proper creators
   _pointRecordPointerMap.insert(std::make_pair("SCADA", &ConfigFactory::createOdbcPointRecord));
   _pointRecordPointerMap.insert(std::make_pair("MySQL", &ConfigFactory::createMySqlPointRecord));
+  _pointRecordPointerMap.insert(std::make_pair("Mmap", &ConfigFactory::createMmapPointRecord));
+  _pointRecordPointerMap.insert(std::make_pair("Compressed", &ConfigFactory::createCompressedPointRecord));
+  _pointRecordPointerMap.insert(std::make_pair("Vector", &ConfigFactory::createVectorPointRecord));
   
   //_clockPointerMap.insert(std::make_pair("regular", &ConfigFactory::createRegularClock));
   
   _timeSeriesPointerMap.insert(std::make_pair("TimeSeries", &ConfigFactory::createTimeSeries));
   _timeSeriesPointerMap.insert(std::make_pair("MovingAverage", &ConfigFactory::createMovingAverage));
+  _timeSeriesPointerMap.insert(std::make_pair("MovingStatistic", &ConfigFactory::createMovingStatistic));
   _timeSeriesPointerMap.insert(std::make_pair("Aggregator", &ConfigFactory::createAggregator));
   _timeSeriesPointerMap.insert(std::make_pair("Resampler", &ConfigFactory::createResampler));
   _timeSeriesPointerMap.insert(std::make_pair("Derivative", &ConfigFactory::createDerivative));
   _timeSeriesPointerMap.insert(std::make_pair("Offset", &ConfigFactory::createOffset));
   _timeSeriesPointerMap.insert(std::make_pair("FirstDerivative", &ConfigFactory::createDerivative));
+  _timeSeriesPointerMap.insert(std::make_pair("Validation", &ConfigFactory::createValidation));
   
   // node-type configuration functions
   // Junctions
@@ -64,10 +231,19 @@ ConfigFactory::ConfigFactory() {
   _parameterSetter.insert(std::make_pair("setting", &ConfigFactory::configureValveSetting));
   
   _doesHaveStateRecord = false;
+  _elementSettingsIndexed = false;
+  _mergedTimeSeriesCount = 0;
   
 }
 
 ConfigFactory::~ConfigFactory() {
+  if (!_cacheSnapshotPath.empty() && !_configPath.empty()) {
+    try {
+      writeCacheSnapshot(_cacheSnapshotPath);
+    } catch (RtxException& e) {
+      RTX_LOG(warning, "ConfigFactory", "could not write the cache snapshot " << _cacheSnapshotPath << ": " << e.what());
+    }
+  }
   _pointRecordPointerMap.clear();
   _timeSeriesPointerMap.clear();
   _timeSeriesList.clear();
@@ -80,6 +256,7 @@ ConfigFactory::~ConfigFactory() {
 void ConfigFactory::loadConfigFile(const std::string& path) {
   
   _configPath = path;
+  _elementSettingsIndexed = false;
   boost::filesystem::path configPath(path);
   
   // use libconfig api to open config file
@@ -89,12 +266,12 @@ void ConfigFactory::loadConfigFile(const std::string& path) {
   }
   catch(const FileIOException &fioex)
   {
-    std::cerr << "I/O error while reading file." << std::endl;
+    RTX_LOG(error, "ConfigFactory", "I/O error while reading " << configPath);
     return;
   }
   catch(const ParseException &pex)
   {
-    std::cerr << "Parse error at " << pex.getFile() << ":" << pex.getLine() << " - " << pex.getError() << std::endl;
+    RTX_LOG(error, "ConfigFactory", "parse error at " << pex.getFile() << ":" << pex.getLine() << " - " << pex.getError());
     return;
   }
   
@@ -115,6 +292,12 @@ void ConfigFactory::loadConfigFile(const std::string& path) {
   }
   Setting& config = root["configuration"];
   
+  // the threads everything runs on, if the file says how many
+  _configuredRuntime.reset();
+  if ( config.exists("runtime") ) {
+    createRuntime(config["runtime"]);
+  }
+  
   
   if ( !config.exists("records") ) {
     config.add("records", Setting::TypeList);
@@ -169,6 +352,313 @@ void ConfigFactory::loadConfigFile(const std::string& path) {
   // set defaults
   createSimulationDefaults(simulationGroup);
   
+  // and pick up where the last run left off
+  if (!_cacheSnapshotPath.empty() && boost::filesystem::exists(_cacheSnapshotPath)) {
+    readCacheSnapshot(_cacheSnapshotPath);
+  }
+  
+}
+
+
+bool ConfigFactory::reloadConfigFile(const std::string& path) {
+  if (!_model) {
+    loadConfigFile(path);
+    return true;
+  }
+  
+  // read it to one side first, so that a bad file changes nothing
+  Config incoming;
+  try {
+    incoming.readFile(path.c_str());
+  }
+  catch(const FileIOException &fioex) {
+    RTX_LOG(error, "ConfigFactory", "I/O error while reading " << path);
+    return false;
+  }
+  catch(const ParseException &pex) {
+    RTX_LOG(error, "ConfigFactory", "parse error at " << pex.getFile() << ":" << pex.getLine() << " - " << pex.getError());
+    return false;
+  }
+  
+  // what was loaded before, to tell what's changed
+  map<string, string> previous = definitionSignatures(_configuration);
+  map<string, string> current = definitionSignatures(incoming);
+  bindings_t previousBindings = elementBindings();
+  map<string, PointRecord::sharedPointer> previousRecords = _pointRecordList;
+  map<string, TimeSeries::sharedPointer> previousSeries = _timeSeriesList;
+  
+  if (previous["model"] != current["model"]) {
+    RTX_LOG(warning, "ConfigFactory", "the model has changed -- loading the whole configuration again");
+    _timeSeriesList.clear();
+    _clockList.clear();
+    _pointRecordList.clear();
+    _timeSeriesSourceList.clear();
+    _timeSeriesAggregationSourceList.clear();
+    _model.reset();
+    loadConfigFile(path);
+    return true;
+  }
+  
+  try {
+    _configuration.readFile(path.c_str());
+  }
+  catch(...) {
+    RTX_LOG(warning, "ConfigFactory", "could not read " << path << " again");
+    return false;
+  }
+  _configPath = path;
+  _elementSettingsIndexed = false;
+  Setting& root = _configuration.getRoot();
+  if ( !root.exists("configuration") ) {
+    root.add("configuration", Setting::TypeGroup);
+  }
+  Setting& config = root["configuration"];
+  
+  // build what's changed, keeping the rest. nothing the model uses is touched yet.
+  findReusable(previous);
+  size_t keptSeries = _reusableSeries.size();
+  _pointRecordList.clear();
+  _clockList.clear();
+  _timeSeriesList.clear();
+  _timeSeriesSourceList.clear();
+  _timeSeriesAggregationSourceList.clear();
+  createPointRecords(configSection(config, "records"));
+  createClocks(configSection(config, "clocks"));
+  createTimeSeriesList(configSection(config, "timeseries"));
+  _reusableRecords.clear();
+  _reusableClocks.clear();
+  _reusableSeries.clear();
+  
+  // then swap it in, between steps
+  size_t reboundCount = 0;
+  {
+    stepLock_t stepLock(_model->stepMutex());
+    bindings_t bindings = elementBindings();
+    bool didChangeFlows = false;
+    BOOST_FOREACH(Element::sharedPointer element, _model->elements()) {
+      const vector<binding_t>& before = previousBindings[element->name()];
+      const vector<binding_t>& after = bindings[element->name()];
+      if (isSameBinding(before, after)) {
+        continue;
+      }
+      BOOST_FOREACH(const binding_t& binding, before) {
+        clearElementParameter(binding.parameter, element);
+        didChangeFlows |= RTX_STRINGS_ARE_EQUAL(binding.parameter, "flow");
+      }
+      BOOST_FOREACH(const binding_t& binding, after) {
+        didChangeFlows |= RTX_STRINGS_ARE_EQUAL(binding.parameter, "flow");
+      }
+      configureElement(element);
+      ++reboundCount;
+    }
+  
+    // zones are cut at the flow measures
+    if (didChangeFlows || previous["zones"] != current["zones"]) {
+      _model->clearZones();
+      createZones(configSection(config, "zones"));
+    }
+  
+    // and the simulation settings, if they or the state record changed
+    Setting& simulationGroup = configSection(config, "simulation");
+    string stateRecordName;
+    bool didChangeStateRecord = simulationGroup.lookupValue("staterecord", stateRecordName) && previousRecords[stateRecordName] != _pointRecordList[stateRecordName];
+    if (didChangeStateRecord || previous["simulation"] != current["simulation"]) {
+      createSimulationDefaults(simulationGroup);
+    }
+  
+    _model->boundaryConditionsChanged();
+  }
+  
+  RTX_LOG(info, "ConfigFactory", "reloaded " << path << ": kept " << keptSeries << " of " << _timeSeriesList.size() << " time series, rebound " << reboundCount << " elements");
+  return true;
+}
+
+// everything defined as it was before, and built only on what's kept as well, is kept.
+void ConfigFactory::findReusable(const map<string, string>& previous) {
+  map<string, string> current = definitionSignatures(_configuration);
+  _reusableRecords.clear();
+  _reusableClocks.clear();
+  _reusableSeries.clear();
+  Setting& config = _configuration.lookup("configuration");
+  Setting& records = configSection(config, "records");
+  Setting& clockGroup = configSection(config, "clocks");
+  Setting& timeSeriesGroup = configSection(config, "timeseries");
+  
+  // defined the same, before and now
+  for (int iRecord = 0; iRecord < records.getLength(); ++iRecord) {
+    string name = records[iRecord]["name"];
+    map<string, string>::const_iterator before = previous.find("records:" + name);
+    if (before != previous.end() && before->second == current["records:" + name] && _pointRecordList.find(name) != _pointRecordList.end()) {
+      _reusableRecords[name] = _pointRecordList[name];
+    }
+  }
+  for (int iClock = 0; iClock < clockGroup.getLength(); ++iClock) {
+    string name = clockGroup[iClock]["name"];
+    map<string, string>::const_iterator before = previous.find("clocks:" + name);
+    if (before != previous.end() && before->second == current["clocks:" + name] && _clockList.find(name) != _clockList.end()) {
+      _reusableClocks[name] = _clockList[name];
+    }
+  }
+  for (int iSeries = 0; iSeries < timeSeriesGroup.getLength(); ++iSeries) {
+    string name = timeSeriesGroup[iSeries]["name"];
+    map<string, string>::const_iterator before = previous.find("timeseries:" + name);
+    if (before != previous.end() && before->second == current["timeseries:" + name] && _timeSeriesList.find(name) != _timeSeriesList.end()) {
+      _reusableSeries[name] = _timeSeriesList[name];
+    }
+  }
+  
+  // and built on what's kept -- a pass for each link in the longest chain of changes
+  bool didDrop = true;
+  while (didDrop) {
+    didDrop = false;
+    for (int iRecord = 0; iRecord < records.getLength(); ++iRecord) {
+      Setting& record = records[iRecord];
+      string name = record["name"], storeName;
+      if (_reusableRecords.find(name) != _reusableRecords.end() && record.lookupValue("localStore", storeName) && _reusableRecords.find(storeName) == _reusableRecords.end()) {
+        _reusableRecords.erase(name);
+        didDrop = true;
+      }
+    }
+    for (int iSeries = 0; iSeries < timeSeriesGroup.getLength(); ++iSeries) {
+      Setting& series = timeSeriesGroup[iSeries];
+      string name = series["name"], clockName, recordName;
+      if (_reusableSeries.find(name) == _reusableSeries.end()) {
+        continue;
+      }
+      bool isKept = true;
+      if (series.lookupValue("clock", clockName) && _reusableClocks.find(clockName) == _reusableClocks.end()) {
+        isKept = false;
+      }
+      if (series.lookupValue("pointRecord", recordName) && _reusableRecords.find(recordName) == _reusableRecords.end()) {
+        isKept = false;
+      }
+      BOOST_FOREACH(const string& sourceName, sourceNames(series)) {
+        if (_reusableSeries.find(sourceName) == _reusableSeries.end()) {
+          isKept = false;
+        }
+      }
+      if (!isKept) {
+        _reusableSeries.erase(name);
+        didDrop = true;
+      }
+    }
+  }
+}
+
+
+#pragma mark - Warm Caches
+
+void ConfigFactory::setCacheSnapshotFile(const string& path) {
+  _cacheSnapshotPath = path;
+}
+
+const string& ConfigFactory::cacheSnapshotFile() {
+  return _cacheSnapshotPath;
+}
+
+// the in-memory caches: records that keep one, and each series' own (those not stored in a configured record)
+void ConfigFactory::writeCacheSnapshot(const string& path) throw(RtxException) {
+  std::set<PointRecord*> configuredRecords;
+  map<string, BufferPointRecord::sharedPointer> records, series;
+  typedef map<string, PointRecord::sharedPointer>::value_type recordEntry_t;
+  BOOST_FOREACH(const recordEntry_t& entry, _pointRecordList) {
+    configuredRecords.insert(entry.second.get());
+    BufferPointRecord::sharedPointer buffer = boost::dynamic_pointer_cast<BufferPointRecord>(entry.second);
+    if (buffer) {
+      records[entry.first] = buffer;
+    }
+  }
+  std::set<TimeSeries*> seen; // merged series are listed under each of their names
+  typedef map<string, TimeSeries::sharedPointer>::value_type seriesEntry_t;
+  BOOST_FOREACH(const seriesEntry_t& entry, _timeSeriesList) {
+    BufferPointRecord::sharedPointer buffer = boost::dynamic_pointer_cast<BufferPointRecord>(entry.second->record());
+    if (buffer && seen.insert(entry.second.get()).second && configuredRecords.find(buffer.get()) == configuredRecords.end()) {
+      series[entry.first] = buffer;
+    }
+  }
+  
+  // alongside, then renamed into place, so that a crash part way leaves the last one whole
+  string partialPath = path + ".partial";
+  {
+    std::ofstream file(partialPath.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file) {
+      throw RtxIoException();
+    }
+    file.write(cacheSnapshotMagic, sizeof(cacheSnapshotMagic));
+    BufferPointRecord::writeValue(file, cacheSnapshotVersion);
+    BufferPointRecord::writeValue(file, configurationHash(_configuration));
+    typedef map<string, BufferPointRecord::sharedPointer>::value_type bufferEntry_t;
+    BufferPointRecord::writeValue(file, (uint64_t)records.size());
+    BOOST_FOREACH(const bufferEntry_t& entry, records) {
+      writeCacheSection(file, entry.first, entry.second);
+    }
+    BufferPointRecord::writeValue(file, (uint64_t)series.size());
+    BOOST_FOREACH(const bufferEntry_t& entry, series) {
+      writeCacheSection(file, entry.first, entry.second);
+    }
+    file.flush();
+    if (!file) {
+      throw RtxIoException();
+    }
+  }
+  boost::system::error_code error;
+  boost::filesystem::rename(partialPath, path, error);
+  if (error) {
+    throw RtxIoException();
+  }
+  RTX_LOG(info, "ConfigFactory", "wrote the caches of " << records.size() << " records and " << series.size() << " time series to " << path);
+}
+
+bool ConfigFactory::readCacheSnapshot(const string& path) {
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  file.seekg(0, std::ios::end);
+  uint64_t fileSize = (uint64_t)file.tellg();
+  file.seekg(0, std::ios::beg);
+  
+  char magic[sizeof(cacheSnapshotMagic)];
+  uint32_t version = 0;
+  uint64_t hash = 0;
+  if (file.read(magic, sizeof(magic)).fail() || memcmp(magic, cacheSnapshotMagic, sizeof(magic)) != 0 || !BufferPointRecord::readValue(file, version) || version != cacheSnapshotVersion || !BufferPointRecord::readValue(file, hash)) {
+    RTX_LOG(warning, "ConfigFactory", path << " is not a cache snapshot");
+    return false;
+  }
+  if (hash != configurationHash(_configuration)) {
+    RTX_LOG(info, "ConfigFactory", "the configuration has changed since " << path << " was written -- starting with empty caches");
+    return false;
+  }
+  
+  size_t restored = 0;
+  for (int iKind = 0; iKind < 2; ++iKind) {
+    uint64_t sectionCount = 0;
+    if (!BufferPointRecord::readValue(file, sectionCount)) {
+      RTX_LOG(warning, "ConfigFactory", path << " is cut short");
+      return false;
+    }
+    for (uint64_t iSection = 0; iSection < sectionCount; ++iSection) {
+      string name, bytes;
+      if (!readCacheSection(file, fileSize, name, bytes)) {
+        RTX_LOG(warning, "ConfigFactory", path << " is cut short");
+        return false;
+      }
+      PointRecord::sharedPointer record;
+      if (iKind == 0 && _pointRecordList.find(name) != _pointRecordList.end()) {
+        record = _pointRecordList[name];
+      }
+      else if (iKind == 1 && _timeSeriesList.find(name) != _timeSeriesList.end()) {
+        record = _timeSeriesList[name]->record();
+      }
+      BufferPointRecord::sharedPointer buffer = boost::dynamic_pointer_cast<BufferPointRecord>(record);
+      std::stringstream section(bytes);
+      if (buffer && buffer->readSnapshot(section)) {
+        ++restored;
+      }
+    }
+  }
+  RTX_LOG(info, "ConfigFactory", "restored " << restored << " caches from " << path);
+  return true;
 }
 
 
@@ -188,6 +678,10 @@ std::map<std::string, Clock::sharedPointer> ConfigFactory::clocks() {
   return _clockList;
 }
 
+size_t ConfigFactory::mergedTimeSeriesCount() {
+  return _mergedTimeSeriesCount;
+}
+
 
 #pragma mark - PointRecord
 
@@ -199,17 +693,42 @@ void ConfigFactory::createPointRecords(Setting& records) {
   for (int iRecord = 0; iRecord < recordCount; ++iRecord) {
     Setting& record = records[iRecord];
     string recordName = record["name"];
-    PointRecord::sharedPointer pointRecord = createPointRecordOfType(record);
+    PointRecord::sharedPointer pointRecord;
+    map<string, PointRecord::sharedPointer>::const_iterator kept = _reusableRecords.find(recordName);
+    if (kept != _reusableRecords.end()) {
+      pointRecord = kept->second;
+    }
+    else {
+      pointRecord = createPointRecordOfType(record);
+    }
     if (pointRecord) {
       _pointRecordList[recordName] = pointRecord;
     }
     else {
-      std::cerr << "could not load point record\n";
+      RTX_LOG(error, "ConfigFactory", "could not load point record " << recordName);
     }
-    
+  
   }
-
   
+  // tiers: a database record can keep what it fetches in another (local) record, named by "localStore"
+  for (int iRecord = 0; iRecord < recordCount; ++iRecord) {
+    Setting& record = records[iRecord];
+    string recordName = record["name"];
+    if (!record.exists("localStore") || _reusableRecords.find(recordName) != _reusableRecords.end()) {
+      continue;
+    }
+    string storeName = record["localStore"];
+    if (_pointRecordList.find(recordName) == _pointRecordList.end() || _pointRecordList.find(storeName) == _pointRecordList.end()) {
+      RTX_LOG(warning, "ConfigFactory", "could not set local store " << storeName << " for point record " << recordName);
+      continue;
+    }
+    DbPointRecord::sharedPointer dbRecord = boost::dynamic_pointer_cast<DbPointRecord>(_pointRecordList[recordName]);
+    if (!dbRecord) {
+      RTX_LOG(warning, "ConfigFactory", "could not set local store " << storeName << " for point record " << recordName);
+      continue;
+    }
+    dbRecord->setLocalStore(_pointRecordList[storeName]);
+  }
   
   return;
 }
@@ -251,13 +770,19 @@ PointRecord::sharedPointer ConfigFactory::createOdbcPointRecord(libconfig::Setti
       r->setConnectorType(connT);
     }
     else {
-      cerr << "connector type " << type << " not set" << endl;
+      RTX_LOG(warning, "ConfigFactory", "connector type " << type << " not set");
     }
   }
   
   
+  if (setting.exists("connectionPool")) {
+    // concurrent readers, each on its own connection
+    int poolSize = setting["connectionPool"];
+    r->setConnectionPoolSize(poolSize);
+  }
+  
   r->setConnectionString(initString);
-  r->connect();
+  connectRecord(r, setting);
   
   return r;
 }
@@ -266,8 +791,72 @@ PointRecord::sharedPointer ConfigFactory::createMySqlPointRecord(libconfig::Sett
   string name = setting["name"];
   MysqlPointRecord::sharedPointer record( new MysqlPointRecord() );
   string initString = setting["connection"];  record->setConnectionString(initString);
-  record->connect();
+  if (setting.exists("writeBehind")) {
+    // queue size, in points
+    int queueSize = setting["writeBehind"];
+    record->setWriteBehind(true, queueSize);
+  }
+  if (setting.exists("connectionPool")) {
+    // concurrent readers, each on its own connection
+    int poolSize = setting["connectionPool"];
+    record->setConnectionPoolSize(poolSize);
+  }
+  connectRecord(record, setting);
+  
+  return record;
+}
+
+// database records connect in the background, all at once, while the rest of the file is read -- whatever uses one
+// first waits for its connection. with "connectOnFirstUse = true;" a record doesn't connect until it's used at all.
+void ConfigFactory::connectRecord(DbPointRecord::sharedPointer record, Setting& setting) {
+  record->setRuntime(runtime());
+  if (setting.exists("streamingThreshold")) {
+    // ranges at least this many seconds long are streamed past the cache, in chunks of "streamingChunk" points
+    int threshold = setting["streamingThreshold"];
+    record->setStreamingThreshold(threshold);
+    int chunkSize;
+    if (setting.lookupValue("streamingChunk", chunkSize)) {
+      record->setStreamingChunkSize(chunkSize);
+    }
+  }
+  bool onFirstUse = false;
+  setting.lookupValue("connectOnFirstUse", onFirstUse);
+  if (onFirstUse) {
+    record->connectOnFirstUse();
+  }
+  else {
+    record->connectInBackground();
+  }
+}
+
+PointRecord::sharedPointer ConfigFactory::createMmapPointRecord(libconfig::Setting &setting) {
+  MmapPointRecord::sharedPointer record( new MmapPointRecord() );
+  string dirName = setting["path"];
   
+  // relative paths are relative to the config file
+  boost::filesystem::path dirPath(dirName);
+  if (dirPath.is_relative()) {
+    dirPath = boost::filesystem::path(_configPath).parent_path() / dirPath;
+  }
+  if (!boost::filesystem::exists(dirPath)) {
+    boost::filesystem::create_directories(dirPath);
+  }
+  record->setPath(dirPath.string());
+  
+  return record;
+}
+
+PointRecord::sharedPointer ConfigFactory::createCompressedPointRecord(libconfig::Setting &setting) {
+  CompressedPointRecord::sharedPointer record( new CompressedPointRecord() );
+  if (setting.exists("blockSize")) {
+    int blockSize = setting["blockSize"];
+    record->setBlockSize(blockSize);
+  }
+  return record;
+}
+
+PointRecord::sharedPointer ConfigFactory::createVectorPointRecord(libconfig::Setting &setting) {
+  VectorPointRecord::sharedPointer record( new VectorPointRecord() );
   return record;
 }
 
@@ -283,6 +872,10 @@ void ConfigFactory::createClocks(Setting& clockGroup) {
   for (int iClock = 0; iClock < clockCount; ++iClock) {
     Setting& clock = clockGroup[iClock];
     string clockName = clock["name"];
+    if (_reusableClocks.find(clockName) != _reusableClocks.end()) {
+      _clockList[clockName] = _reusableClocks[clockName];
+      continue;
+    }
     int period = clock["period"];
     Clock::sharedPointer aClock( new Clock(period) );
     _clockList[clockName] = aClock;
@@ -301,37 +894,45 @@ void ConfigFactory::createTimeSeriesList(Setting& timeSeriesGroup) {
   for (int iSeries = 0; iSeries < tsCount; ++iSeries) {
     Setting& series = timeSeriesGroup[iSeries];
     string seriesName = series["name"];
+    map<string, TimeSeries::sharedPointer>::const_iterator kept = _reusableSeries.find(seriesName);
+    if (kept != _reusableSeries.end()) {
+      // already hooked up to its sources, which are kept too
+      _timeSeriesList[seriesName] = kept->second;
+      continue;
+    }
     TimeSeries::sharedPointer theTimeSeries = createTimeSeriesOfType(series);
     if (theTimeSeries != NULL) {
       _timeSeriesList[seriesName] = theTimeSeries;
     }
     else {
-      cerr << "could not create time series: " << seriesName << " -- check config." << endl;
+      RTX_LOG(error, "ConfigFactory", "could not create time series: " << seriesName << " -- check config.");
     }
   }
   
+  // before anything is connected, so the duplicates never are
+  mergeDuplicateTimeSeries(timeSeriesGroup);
+  
   // connect single sources (ModularTimeSeries subclasses)
   typedef std::map<string, string> stringMap_t;
   BOOST_FOREACH(const stringMap_t::value_type& stringPair, _timeSeriesSourceList) {
-    
+  
     string tsName = stringPair.first;
     string sourceName = stringPair.second;
-    
+  
     if (_timeSeriesList.find(tsName) == _timeSeriesList.end()) {
-      std::cerr << "cannot locate Timeseries " << tsName << std::endl;
+      RTX_LOG(error, "ConfigFactory", "cannot locate Timeseries " << tsName);
       continue;
     }
     if (_timeSeriesList.find(sourceName) == _timeSeriesList.end()) {
-      std::cerr << "cannot locate specified source Timeseries " << sourceName << std::endl;
-      std::cerr << "-- (specified by Timeseries " << tsName << ")" << std::endl;
+      RTX_LOG(error, "ConfigFactory", "cannot locate specified source Timeseries " << sourceName << " -- (specified by Timeseries " << tsName << ")");
       continue;
     }
-    
+  
     ModularTimeSeries::sharedPointer ts = boost::static_pointer_cast<ModularTimeSeries>(_timeSeriesList[tsName]);
     TimeSeries::sharedPointer source = _timeSeriesList[sourceName];
-    
+  
     ts->setSource(source);
-    
+  
   }
   
   typedef map<string, std::vector< std::pair<string, double> > > aggregatorMap_t;
@@ -339,30 +940,29 @@ void ConfigFactory::createTimeSeriesList(Setting& timeSeriesGroup) {
   
   // go through the list of aggregator time series
   BOOST_FOREACH(const aggregatorMap_t::value_type& aggregatorPair, _timeSeriesAggregationSourceList) {
-    
+  
     string tsName = aggregatorPair.first;
     stringDoublePair_t aggregationList = aggregatorPair.second;
-    
+  
     if (_timeSeriesList.find(tsName) == _timeSeriesList.end()) {
-      std::cerr << "cannot locate Timeseries " << tsName << std::endl;
+      RTX_LOG(error, "ConfigFactory", "cannot locate Timeseries " << tsName);
       continue;
     }
-    
+  
     AggregatorTimeSeries::sharedPointer ts = boost::static_pointer_cast<AggregatorTimeSeries>(_timeSeriesList[tsName]);
-    
+  
     // go through the list and connect sources w/ multipliers
     BOOST_FOREACH(const stringDoublePair_t::value_type& entry, aggregationList) {
       string sourceName = entry.first;
       double multiplier = entry.second;
-      
+  
       if (_timeSeriesList.find(sourceName) == _timeSeriesList.end()) {
-        std::cerr << "cannot locate specified source Timeseries " << sourceName << std::endl;
-        std::cerr << "-- (specified by Timeseries " << tsName << ")" << std::endl;
+        RTX_LOG(error, "ConfigFactory", "cannot locate specified source Timeseries " << sourceName << " -- (specified by Timeseries " << tsName << ")");
         continue;
       }
-      
+  
       TimeSeries::sharedPointer source = _timeSeriesList[sourceName];
-      
+  
       ts->addSource(source, multiplier);
     }
   }
@@ -370,11 +970,57 @@ void ConfigFactory::createTimeSeriesList(Setting& timeSeriesGroup) {
   return;
 }
 
+// derived series defined alike (the same type, source, clock, units and parameters) are collapsed into the first
+// of them. merging two series can make those derived from them alike in turn, so it goes until nothing more merges.
+void ConfigFactory::mergeDuplicateTimeSeries(Setting& timeSeriesGroup) {
+  map<string, string> mergedNames; // merged series -> the one it was merged into
+  int tsCount = timeSeriesGroup.getLength();
+  bool didMerge = true;
+  while (didMerge) {
+    didMerge = false;
+    map<string, string> firstWithSignature;
+    for (int iSeries = 0; iSeries < tsCount; ++iSeries) {
+      Setting& series = timeSeriesGroup[iSeries];
+      string seriesName = series["name"];
+      string type = series["type"];
+      // plain series are their own data, and series with records are stored under their own names
+      if (RTX_STRINGS_ARE_EQUAL(type, "TimeSeries") || series.exists("pointRecord") || mergedNames.find(seriesName) != mergedNames.end() || _timeSeriesList.find(seriesName) == _timeSeriesList.end()) {
+        continue;
+      }
+      string signature = settingSignature(series, mergedNames);
+      map<string, string>::const_iterator first = firstWithSignature.find(signature);
+      if (first == firstWithSignature.end()) {
+        firstWithSignature[signature] = seriesName;
+      }
+      else {
+        mergedNames[seriesName] = first->second;
+        didMerge = true;
+      }
+    }
+  }
+  
+  typedef map<string, string> stringMap_t;
+  BOOST_FOREACH(const stringMap_t::value_type& merged, mergedNames) {
+    // what it was merged into may have been merged itself, on a later pass
+    string kept = merged.second;
+    while (mergedNames.find(kept) != mergedNames.end()) {
+      kept = mergedNames[kept];
+    }
+    _timeSeriesList[merged.first] = _timeSeriesList[kept];
+    _timeSeriesSourceList.erase(merged.first);
+    _timeSeriesAggregationSourceList.erase(merged.first);
+  }
+  _mergedTimeSeriesCount = mergedNames.size();
+  if (_mergedTimeSeriesCount > 0) {
+    RTX_LOG(info, "ConfigFactory", "merged " << _mergedTimeSeriesCount << " duplicate time series definitions");
+  }
+}
+
 TimeSeries::sharedPointer ConfigFactory::createTimeSeriesOfType(libconfig::Setting &setting) {
   std::string type = setting["type"];
   if (_timeSeriesPointerMap.find(type) == _timeSeriesPointerMap.end()) {
     // not found
-    std::cerr << "time series type " << type << " not implemented or not recognized" << std::endl;
+    RTX_LOG(error, "ConfigFactory", "time series type " << type << " not implemented or not recognized");
     TimeSeries::sharedPointer empty;
     return empty;
   }
@@ -452,6 +1098,20 @@ TimeSeries::sharedPointer ConfigFactory::createAggregator(libconfig::Setting &se
   
   _timeSeriesAggregationSourceList[timeSeries->name()] = sourceList;
   
+  // optional alignment of irregular sources: "hold" or "linear". otherwise, exact times only.
+  string alignment;
+  if (setting.lookupValue("alignment", alignment)) {
+    if (RTX_STRINGS_ARE_EQUAL(alignment, "hold")) {
+      timeSeries->setAlignment(AggregatorTimeSeries::holdAlignment);
+    }
+    else if (RTX_STRINGS_ARE_EQUAL(alignment, "linear")) {
+      timeSeries->setAlignment(AggregatorTimeSeries::linearAlignment);
+    }
+    else {
+      RTX_LOG(warning, "ConfigFactory", "aggregator alignment " << alignment << " not recognized -- aligning exact times only");
+    }
+  }
+  
   return timeSeries;
 }
 
@@ -468,6 +1128,39 @@ TimeSeries::sharedPointer ConfigFactory::createMovingAverage(libconfig::Setting
   return returnTS;
 }
 
+TimeSeries::sharedPointer ConfigFactory::createMovingStatistic(libconfig::Setting &setting) {
+  MovingStatistic::sharedPointer timeSeries( new MovingStatistic() );
+  setGenericTimeSeriesProperties(timeSeries, setting);
+  
+  int window = setting["window"];
+  timeSeries->setWindowSize(window);
+  
+  // "min", "max", "stddev", or "quantile" (with an optional "quantile" fraction, default 0.5)
+  string statistic = setting["statistic"];
+  if ( RTX_STRINGS_ARE_EQUAL(statistic, "min") ) {
+    timeSeries->setStatistic(MovingStatistic::minimum);
+  }
+  else if ( RTX_STRINGS_ARE_EQUAL(statistic, "max") ) {
+    timeSeries->setStatistic(MovingStatistic::maximum);
+  }
+  else if ( RTX_STRINGS_ARE_EQUAL(statistic, "stddev") ) {
+    timeSeries->setStatistic(MovingStatistic::standardDeviation);
+  }
+  else if ( RTX_STRINGS_ARE_EQUAL(statistic, "quantile") ) {
+    timeSeries->setStatistic(MovingStatistic::quantile);
+    double fraction;
+    if ( setting.lookupValue("quantile", fraction) ) {
+      timeSeries->setQuantile(fraction);
+    }
+  }
+  else {
+    RTX_LOG(warning, "ConfigFactory", "moving statistic " << statistic << " not recognized -- using max");
+  }
+  
+  TimeSeries::sharedPointer returnTS = timeSeries;
+  return returnTS;
+}
+
 TimeSeries::sharedPointer ConfigFactory::createResampler(libconfig::Setting &setting) {
   Resampler::sharedPointer resampler( new Resampler() );
   setGenericTimeSeriesProperties(resampler, setting);
@@ -487,6 +1180,26 @@ TimeSeries::sharedPointer ConfigFactory::createOffset(Setting &setting) {
   return offset;
 }
 
+TimeSeries::sharedPointer ConfigFactory::createValidation(Setting &setting) {
+  ValidationFilter::sharedPointer validation( new ValidationFilter() );
+  setGenericTimeSeriesProperties(validation, setting);
+  
+  // every check is optional
+  double minimum, maximum, rate, deadband = 0;
+  int flatline;
+  if ( setting.lookupValue("minimum", minimum) && setting.lookupValue("maximum", maximum) ) {
+    validation->setRange(minimum, maximum);
+  }
+  if ( setting.lookupValue("maxRate", rate) ) {
+    validation->setMaximumRate(rate);
+  }
+  if ( setting.lookupValue("flatline", flatline) ) {
+    setting.lookupValue("deadband", deadband);
+    validation->setFlatline(flatline, deadband);
+  }
+  return validation;
+}
+
 
 #pragma mark - Model
 
@@ -498,8 +1211,19 @@ void ConfigFactory::createModel(Setting& setting) {
   boost::filesystem::path modelPath = configPath.parent_path();
   modelPath /= modelFileName;
   
+  // optionally, where to keep the solver's matrix ordering between runs (see EpanetModel::setSolverCacheFile)
+  string cacheFileName;
+  boost::filesystem::path cachePath;
+  if ( setting.lookupValue("solverCache", cacheFileName) ) {
+    cachePath = configPath.parent_path();
+    cachePath /= cacheFileName;
+  }
+  
   if ( RTX_STRINGS_ARE_EQUAL(modelType, "epanet") ){
-    _model.reset( new EpanetModel() );    
+    EpanetModel::sharedPointer epanetModel( new EpanetModel() );
+    epanetModel->setSolverCacheFile(cachePath.string());
+    epanetModel->setRuntime(runtime());
+    _model = epanetModel;
     // load the model
     _model->loadModelFromFile(modelPath.string());
     // hook up the model's elements to timeseries objects
@@ -508,18 +1232,62 @@ void ConfigFactory::createModel(Setting& setting) {
   }
   
   if ( RTX_STRINGS_ARE_EQUAL(modelType, "synthetic_epanet") ) {
-    _model.reset( new EpanetSyntheticModel() );
+    EpanetModel::sharedPointer syntheticModel( new EpanetSyntheticModel() );
+    syntheticModel->setSolverCacheFile(cachePath.string());
+    syntheticModel->setRuntime(runtime());
+    _model = syntheticModel;
     _model->loadModelFromFile(modelPath.string());
     configureElements(_model->elements());
   }
   
-
+  
 }
 
 Model::sharedPointer ConfigFactory::model() {
   return _model;
 }
 
+void ConfigFactory::setRuntime(RuntimeContext::sharedPointer runtime) {
+  _runtime = runtime;
+}
+
+RuntimeContext::sharedPointer ConfigFactory::runtime() {
+  if (_runtime) {
+    return _runtime;
+  }
+  return (_configuredRuntime) ? _configuredRuntime : RuntimeContext::defaultContext();
+}
+
+void ConfigFactory::createRuntime(Setting& setting) {
+  if (_runtime) {
+    return; // the one we were handed wins
+  }
+  Scheduler::Options options;
+  int count;
+  if (setting.lookupValue("cpuThreads", count) && count >= 0) {
+    options.cpuThreads = (size_t)count;
+  }
+  if (setting.lookupValue("ioThreads", count) && count > 0) {
+    options.ioThreads = (size_t)count;
+  }
+  if (setting.lookupValue("ioQueueCapacity", count) && count > 0) {
+    options.ioQueueCapacity = (size_t)count;
+  }
+  string placement;
+  if (setting.lookupValue("placement", placement)) {
+    if (RTX_STRINGS_ARE_EQUAL(placement, "compact")) {
+      options.placement = Scheduler::compactPlacement;
+    }
+    else if (RTX_STRINGS_ARE_EQUAL(placement, "spread")) {
+      options.placement = Scheduler::spreadPlacement;
+    }
+    else if (!RTX_STRINGS_ARE_EQUAL(placement, "any")) {
+      RTX_LOG(warning, "ConfigFactory", "unknown thread placement " << placement << " -- threads won't be pinned");
+    }
+  }
+  _configuredRuntime.reset( new RuntimeContext(options) );
+}
+
 #pragma mark - Simulation Settings
 
 void ConfigFactory::createSimulationDefaults(Setting& setting) {
@@ -527,18 +1295,62 @@ void ConfigFactory::createSimulationDefaults(Setting& setting) {
     _doesHaveStateRecord = true;
     std::string defaultRecordName = setting["staterecord"];
     if (_pointRecordList.find(defaultRecordName) == _pointRecordList.end()) {
-      std::cerr << "could not retrieve point record by name: " << defaultRecordName << std::endl;
+      RTX_LOG(error, "ConfigFactory", "could not retrieve point record by name: " << defaultRecordName);
     }
     _defaultRecord = _pointRecordList[defaultRecordName];
     // provide the model object with this record
     _model->setStorage(_defaultRecord);
   }
   else {
-    std::cout << "Warning: no state record specified. Model results will not be persisted!" << std::endl;
+    RTX_LOG(warning, "ConfigFactory", "no state record specified. Model results will not be persisted!");
+  }
+  
+  // specific storage items from config -- by model name. without a list, every element's states are stored.
+  if (setting.exists("states")) {
+    Setting& names = setting["states"];
+    std::vector<Element::sharedPointer> stored;
+    for (int iName = 0; iName < names.getLength(); ++iName) {
+      std::string name = names[iName];
+      Element::sharedPointer element = _model->nodeWithName(name);
+      if (!element) {
+        element = _model->linkWithName(name);
+      }
+      if (!element) {
+        RTX_LOG(warning, "ConfigFactory", "could not find element \"" << name << "\" to store.");
+        continue;
+      }
+      stored.push_back(element);
+    }
+    _model->setStoredElements(stored);
+  }
+  // and the kinds of state stored -- all of them, without a list.
+  if (setting.exists("quantities")) {
+    std::map<std::string, Model::stateKind_t> kinds;
+    kinds["junction_head"] = Model::junctionHeadState;
+    kinds["junction_quality"] = Model::junctionQualityState;
+    kinds["junction_demand"] = Model::junctionDemandState;
+    kinds["reservoir_head"] = Model::reservoirHeadState;
+    kinds["tank_head"] = Model::tankHeadState;
+    kinds["pipe_flow"] = Model::pipeFlowState;
+    kinds["valve_flow"] = Model::valveFlowState;
+    kinds["pump_flow"] = Model::pumpFlowState;
+    kinds["pump_energy"] = Model::pumpEnergyState;
+    std::map<std::string, Model::stateKind_t>::const_iterator kind;
+    for (kind = kinds.begin(); kind != kinds.end(); ++kind) {
+      _model->setStoresState(kind->second, false);
+    }
+    Setting& quantities = setting["quantities"];
+    for (int iQuantity = 0; iQuantity < quantities.getLength(); ++iQuantity) {
+      std::string quantity = quantities[iQuantity];
+      kind = kinds.find(quantity);
+      if (kind == kinds.end()) {
+        RTX_LOG(warning, "ConfigFactory", "could not find state quantity \"" << quantity << "\".");
+        continue;
+      }
+      _model->setStoresState(kind->second, true);
+    }
   }
   
-  // todo -- specific storage items from config
-
   // get other simulation settings
   Setting& timeSetting = setting["time"];
   const int hydStep = timeSetting["hydraulic"];
@@ -569,48 +1381,141 @@ void ConfigFactory::createZones(Setting& zoneGroup) {
 
 
 void ConfigFactory::configureElements(std::vector<Element::sharedPointer> elements) {
+  const map<string, vector<int> >& settings = elementSettings();
+  if (settings.empty()) {
+    return;
+  }
+  Setting& elementGroup = _configuration.lookup("configuration.elements");
   BOOST_FOREACH(Element::sharedPointer element, elements) {
-    //std::cout << "configuring " << element->name() << std::endl;
-    configureElement(element);
+    map<string, vector<int> >::const_iterator found = settings.find(element->name());
+    if (found == settings.end()) {
+      continue;
+    }
+    BOOST_FOREACH(int iElement, found->second) {
+      configureElement(element, elementGroup[iElement]);
+    }
   }
 }
 
 void ConfigFactory::configureElement(Element::sharedPointer element) {
-  // make sure that the element is specified in the config file.
-  std::string name = element->name();
+  std::vector<Element::sharedPointer> elements;
+  elements.push_back(element);
+  configureElements(elements);
+}
   
+// the elements list is read once, rather than searched through for every element in the model.
+const map<string, vector<int> >& ConfigFactory::elementSettings() {
+  if (_elementSettingsIndexed) {
+    return _elementSettings;
+  }
+  _elementSettings.clear();
+  _elementSettingsIndexed = true;
   // find the "elements" section in the configuration
   if (!_configuration.exists("configuration.elements")) {
-    return;
+    return _elementSettings;
   }
   Setting& elements = _configuration.lookup("configuration.elements");
-  
-  // see if the elements list includes this element
   const int elementCount = elements.getLength();
   for (int iElement = 0; iElement < elementCount; ++iElement) {
+    std::string modelID = elements[iElement]["model_id"];
+    _elementSettings[modelID].push_back(iElement);
+  }
+  return _elementSettings;
+}
+
+void ConfigFactory::configureElement(Element::sharedPointer element, Setting& elementSetting) {
+  // configure the element with the proper states/parameters.
+  // todo - check element type (link or node)... names may not be unique.
+  
+  // get the type of parameter
+  std::string parameterType = elementSetting["parameter"];
+  map<string, ParameterFunction>::const_iterator setter = _parameterSetter.find(parameterType);
+  if (setter == _parameterSetter.end()) {
+    // no such parameter type
+    RTX_LOG(warning, "ConfigFactory", "could not find parameter type: " << parameterType);
+    return;
+  }
+  const string tsName = elementSetting["timeseries"];
+  if (_timeSeriesList.find(tsName) == _timeSeriesList.end() || !_timeSeriesList[tsName]) {
+    RTX_LOG(warning, "ConfigFactory", "could not find time series \"" << tsName << "\".");
+    return;
+  }
+  (this->*(setter->second))(elementSetting, element);
+}
+
+ConfigFactory::bindings_t ConfigFactory::elementBindings() {
+  bindings_t bindings;
+  if (!_configuration.exists("configuration.elements")) {
+    return bindings;
+  }
+  map<string, string> noMerges;
+  Setting& elements = _configuration.lookup("configuration.elements");
+  for (int iElement = 0; iElement < elements.getLength(); ++iElement) {
     Setting& elementSetting = elements[iElement];
-    std::string modelID = elementSetting["model_id"];
-    if ( RTX_STRINGS_ARE_EQUAL(modelID, name) ) {
-      // great, a match.
-      // configure the element with the proper states/parameters.
-      // todo - check element type (link or node)... names may not be unique.
-      // todo - check if the type is in the pointer map
-      
-      // get the type of parameter
-      std::string parameterType = elementSetting["parameter"];
-      if (_parameterSetter.find(parameterType) == _parameterSetter.end()) {
-        // no such parameter type
-        std::cout << "could not find paramter type: " << parameterType << std::endl;
-        return;
-      }
-      ParameterFunction fp = _parameterSetter[parameterType];
-      const string tsName = elementSetting["timeseries"];
-      TimeSeries::sharedPointer series = _timeSeriesList[tsName];
-      if (!series) {
-        std::cerr << "could not find time series \"" << tsName << "\"." << std::endl;
-        return;
-      }
-      (this->*fp)(elementSetting, element);
+    string modelID = elementSetting["model_id"];
+    string parameter = elementSetting["parameter"];
+    string tsName = elementSetting["timeseries"];
+    binding_t binding;
+    binding.parameter = parameter;
+    binding.signature = settingSignature(elementSetting, noMerges);
+    map<string, TimeSeries::sharedPointer>::const_iterator series = _timeSeriesList.find(tsName);
+    if (series != _timeSeriesList.end()) {
+      binding.series = series->second;
+    }
+    bindings[modelID].push_back(binding);
+  }
+  return bindings;
+}
+
+bool ConfigFactory::isSameBinding(const vector<binding_t>& before, const vector<binding_t>& after) {
+  if (before.size() != after.size()) {
+    return false;
+  }
+  for (size_t iBinding = 0; iBinding < before.size(); ++iBinding) {
+    if (before[iBinding].signature != after[iBinding].signature || before[iBinding].series != after[iBinding].series) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// undo a parameter's binding, before the element is bound again
+void ConfigFactory::clearElementParameter(const string& parameter, Element::sharedPointer element) {
+  TimeSeries::sharedPointer none;
+  Junction::sharedPointer junction = boost::dynamic_pointer_cast<Junction>(element);
+  Pipe::sharedPointer pipe = boost::dynamic_pointer_cast<Pipe>(element);
+  if (junction) {
+    if (RTX_STRINGS_ARE_EQUAL(parameter, "qualitysource")) {
+      junction->setQualitySource(none);
+    }
+    else if (RTX_STRINGS_ARE_EQUAL(parameter, "quality")) {
+      junction->setQualityMeasure(none);
+    }
+    else if (RTX_STRINGS_ARE_EQUAL(parameter, "boundaryflow")) {
+      junction->setBoundaryFlow(none);
+    }
+    else if (RTX_STRINGS_ARE_EQUAL(parameter, "headmeasure") || RTX_STRINGS_ARE_EQUAL(parameter, "levelmeasure") || RTX_STRINGS_ARE_EQUAL(parameter, "boundaryhead")) {
+      // a tank's level and a reservoir's head are both its head measure
+      junction->setHeadMeasure(none);
+    }
+  }
+  if (pipe) {
+    Pump::sharedPointer pump = boost::dynamic_pointer_cast<Pump>(element);
+    Valve::sharedPointer valve = boost::dynamic_pointer_cast<Valve>(element);
+    if (RTX_STRINGS_ARE_EQUAL(parameter, "status")) {
+      pipe->setStatusParameter(none);
+    }
+    else if (RTX_STRINGS_ARE_EQUAL(parameter, "flow")) {
+      pipe->setFlowMeasure(none);
+    }
+    else if (pump && RTX_STRINGS_ARE_EQUAL(parameter, "curve")) {
+      pump->setCurveParameter(none);
+    }
+    else if (pump && RTX_STRINGS_ARE_EQUAL(parameter, "energy")) {
+      pump->setEnergyMeasure(none);
+    }
+    else if (valve && RTX_STRINGS_ARE_EQUAL(parameter, "setting")) {
+      valve->setSettingParameter(none);
     }
   }
 }
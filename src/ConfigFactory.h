@@ -24,6 +24,7 @@
 #include "Pump.h"
 #include "Valve.h"
 #include "Model.h"
+#include "DbPointRecord.h"
 
 namespace RTX {
   
@@ -53,6 +54,43 @@ namespace RTX {
    \brief Get a list of Clock pointers held by the configuration object.
    \return The list of pointers.
    
+   \fn bool ConfigFactory::reloadConfigFile(const std::string& path)
+   \brief Bring the loaded configuration up to date with the file, rebuilding only what's changed.
+   \param path The path to the libconfig text file.
+   \return false if the file couldn't be read, in which case everything is left as it was.
+   
+   Records, clocks and time series defined just as before -- and built only on others that are -- are kept, caches,
+   connections and all. The rest are built anew, off to the side. Then, between the model's steps (see
+   Model::stepMutex), the elements whose bindings changed, or whose series were rebuilt, are bound again, demand
+   zones are set up again if the flow measures or the zone settings changed, and so are the simulation settings if
+   theirs did. A different model file or type can't be reloaded like this; the whole file is loaded again instead.
+   
+   \fn size_t ConfigFactory::mergedTimeSeriesCount()
+   \brief How many time series definitions were merged into another when the file was loaded.
+   \return The number merged.
+   
+   Derived series that are defined alike -- the same type, source, clock, units and parameters, under different
+   names -- are made into one TimeSeries, so that they share a cache and fetch from their source once. Each of the
+   names still finds it in timeSeries(), and elements configured with any of them get it. Series with a pointRecord
+   of their own are never merged, since their points are stored under their own names.
+   
+   \fn void ConfigFactory::setCacheSnapshotFile(const std::string& path)
+   \brief Keep the in-memory caches in a file between runs.
+   \param path Where the snapshot is written, and read from.
+   
+   Each time a configuration is loaded, the caches are filled from the snapshot -- if it was written under the same
+   records, clocks, time series and model definitions; otherwise it's ignored. When the factory is destroyed, they're
+   written back. The caches are those of the records that keep one in memory (the database records, with what they've
+   fetched) and each time series' own. writeCacheSnapshot and readCacheSnapshot do either at any other time.
+   
+   \fn void ConfigFactory::setRuntime(RuntimeContext::sharedPointer runtime)
+   \brief Run the model and the database records on this context's threads (see RuntimeContext).
+   \param runtime The context, or an empty pointer for the one the file describes.
+   
+   Without one, a "runtime" group in the configuration makes one -- e.g. runtime = { cpuThreads = 16; ioThreads = 8;
+   ioQueueCapacity = 512; placement = "compact"; }; ("spread", or "any" for unpinned threads) -- and with neither, the
+   default context is used. Either way it's set up when the file is loaded, not when it's reloaded.
+   
    \fn void ConfigFactory::addTimeSeries(TimeSeries::sharedPointer timeSeries)
    \brief add a TimeSeries pointer to the configuration
    \param timeSeries A TimeSeries shared pointer
@@ -75,14 +113,24 @@ namespace RTX {
     ~ConfigFactory();
     
     void loadConfigFile(const string& path);
+    bool reloadConfigFile(const string& path);
     void saveConfigFile(const string& path);
     void clear();
     
     map<string, TimeSeries::sharedPointer> timeSeries();
     map<string, PointRecord::sharedPointer> pointRecords();
     map<string, Clock::sharedPointer> clocks();
+    size_t mergedTimeSeriesCount();
+    
+    // warm caches
+    void setCacheSnapshotFile(const string& path); //! read after each load, written when the factory goes away. empty for neither
+    const string& cacheSnapshotFile();
+    void writeCacheSnapshot(const string& path) throw(RtxException);
+    bool readCacheSnapshot(const string& path); //! false if there's none, or it's for another configuration
     PointRecord::sharedPointer defaultRecord();
     Model::sharedPointer model();
+    void setRuntime(RuntimeContext::sharedPointer runtime); //! before loading
+    RuntimeContext::sharedPointer runtime();
     
     vector<string> elementList();
     void configureElements(vector<Element::sharedPointer> elements);
@@ -94,15 +142,20 @@ namespace RTX {
     PointRecord::sharedPointer createPointRecordOfType(Setting& setting);
     PointRecord::sharedPointer createOdbcPointRecord(Setting& setting);
     PointRecord::sharedPointer createMySqlPointRecord(Setting& setting);
+    PointRecord::sharedPointer createMmapPointRecord(Setting& setting);
+    PointRecord::sharedPointer createCompressedPointRecord(Setting& setting);
+    PointRecord::sharedPointer createVectorPointRecord(Setting& setting);
     Clock::sharedPointer createRegularClock(Setting& setting);
     TimeSeries::sharedPointer createTimeSeriesOfType(Setting& setting);
     void setGenericTimeSeriesProperties(TimeSeries::sharedPointer timeSeries, Setting& setting);
     TimeSeries::sharedPointer createTimeSeries(Setting& setting);
     TimeSeries::sharedPointer createMovingAverage(Setting& setting);
+    TimeSeries::sharedPointer createMovingStatistic(Setting& setting);
     TimeSeries::sharedPointer createAggregator(Setting& setting);
     TimeSeries::sharedPointer createResampler(Setting &setting);
     TimeSeries::sharedPointer createDerivative(Setting &setting);
     TimeSeries::sharedPointer createOffset(Setting &setting);
+    TimeSeries::sharedPointer createValidation(Setting &setting);
     
     void configureQualitySource(Setting &setting, Element::sharedPointer junction);
     void configureBoundaryFlow(Setting &setting, Element::sharedPointer junction);
@@ -117,12 +170,33 @@ namespace RTX {
     void configureValveSetting(Setting &setting, Element::sharedPointer valve);
     
     void createModel(Setting& setting);
+    void createRuntime(Setting& setting);
     
   private:
     void createPointRecords(Setting& records);
     void createClocks(Setting& clockGroup);
     void createTimeSeriesList(Setting& timeSeriesGroup);
+    void mergeDuplicateTimeSeries(Setting& timeSeriesGroup);
     void createZones(Setting& zoneGroup);
+    void connectRecord(DbPointRecord::sharedPointer record, Setting& setting);
+    void configureElement(Element::sharedPointer element, Setting& elementSetting);
+    const map<string, vector<int> >& elementSettings(); // indices into configuration.elements, by model_id
+    
+    // reloading
+    class binding_t {
+    public:
+      // simple tuple class, so no getters/setters
+      string parameter, signature;
+      TimeSeries::sharedPointer series;
+    };
+    typedef map<string, vector<binding_t> > bindings_t;
+    bindings_t elementBindings(); // what configuration.elements binds each element to, by model_id
+    static bool isSameBinding(const vector<binding_t>& before, const vector<binding_t>& after);
+    void clearElementParameter(const string& parameter, Element::sharedPointer element);
+    void findReusable(const map<string, string>& previous);
+    map<string, PointRecord::sharedPointer> _reusableRecords; // kept from before, by the create methods
+    map<string, Clock::sharedPointer> _reusableClocks;
+    map<string, TimeSeries::sharedPointer> _reusableSeries;
     
     bool _doesHaveStateRecord;
     
@@ -136,9 +210,14 @@ namespace RTX {
     map<string, TimeSeries::sharedPointer> _timeSeriesList;
     map<string, PointRecord::sharedPointer> _pointRecordList;
     map<string, Clock::sharedPointer> _clockList;
+    map<string, vector<int> > _elementSettings;
+    bool _elementSettingsIndexed;
+    size_t _mergedTimeSeriesCount;
     PointRecord::sharedPointer _defaultRecord;
     Model::sharedPointer _model;
+    RuntimeContext::sharedPointer _runtime, _configuredRuntime; // handed to us, or from the file
     std::string _configPath;
+    std::string _cacheSnapshotPath;
     
     map<string, string> _timeSeriesSourceList;
     map<string, std::vector< std::pair<string, double> > > _timeSeriesAggregationSourceList;
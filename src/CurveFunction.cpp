@@ -6,11 +6,16 @@
 //  See README.md and license.txt for more information
 //  
 
+#include <algorithm>
+
 #include <boost/foreach.hpp>
+#include <boost/bind/bind.hpp>
 
 #include "CurveFunction.h"
+#include "Log.h"
 
 using namespace RTX;
+using namespace boost::placeholders;
 
 CurveFunction::CurveFunction() : _inputUnits(1) {
   
@@ -39,64 +44,72 @@ void CurveFunction::setInputUnits(Units inputUnits) {
 }
 
 void CurveFunction::addCurveCoordinate(double inputValue, double outputValue) {
+  // keep the curve sorted by input value, so it can be searched. a repeated input value replaces the old one.
   std::pair<double,double> newCoord(inputValue,outputValue);
-  _curve.push_back(newCoord);
+  std::vector< std::pair<double,double> >::iterator it = std::lower_bound(_curve.begin(), _curve.end(), newCoord, &CurveFunction::inputIsLess);
+  if (it != _curve.end() && it->first == inputValue) {
+    it->second = outputValue;
+  }
+  else {
+    _curve.insert(it, newCoord);
+  }
+  
+  // and the lookup table (per-segment slopes) that goes with it
+  _curveMap = ValueTransform::curve(_curve);
+}
+
+bool CurveFunction::valueTransform(ValueTransform& transform) {
+  if (_curve.empty()) {
+    return false;
+  }
+  transform = ValueTransform::affine(Units::convertValue(1., source()->units(), _inputUnits), 0.).then(_curveMap);
+  return true;
 }
 
 Point CurveFunction::point(time_t time) {
   
   // get the appropriate point from the source.
   // unfortunately, this is mostly copied from ModularTimeSeries:: -- but we have to modify it for the unit checking
-  Point sourcePoint;
   if (clock()->isRegular()) {
     time = clock()->validTime(time);
   }
-  Point p = TimeSeries::point(time);
-  if (p.isValid) {
-    return p;
-  }
-  else {
-    p = source()->point(time);
-    if (p.isValid) {
-      // create a new point object converted from source units
-      sourcePoint = Point::convertPoint(p, source()->units(), _inputUnits);
-    }
-    else {
-      std::cerr << "check point availability first\n";
-      // TODO -- throw something?
-    }
-  }
-  
-  // get the value from this point
-  double sourceValue = sourcePoint.value;
-  double sourceConf = sourcePoint.confidence;
-  
-  // get the interpolated point from the function curve
-  double  x1 = _curve.at(0).first,
-          y1 = _curve.at(0).second,
-          x2 = _curve.at(0).first,
-          y2 = _curve.at(0).second;
-  
-  typedef std::pair<double,double> doublePairType;
-  BOOST_FOREACH(doublePairType dpair, _curve) {
-    x2 = dpair.first;
-    y2 = dpair.second;
-    
-    if (x2 > sourceValue) {
-      // great, we have what we need.
-      break;
-    }
-    else {
-      x1 = x2;
-      y1 = y2;
-    }
+  return pointComputedOnce(time, boost::bind(&CurveFunction::computePoint, this, _1));
+}
+
+Point CurveFunction::computePoint(time_t time) {
+  countUpstreamCalls();
+  Point p = source()->point(time);
+  if (!p.isValid || _curve.empty()) {
+    RTX_LOG(debug, "CurveFunction", "check point availability first");
+    return Point();
   }
-  // TODO -- robustify this - edge conditions?
-  double newValue = y1 + ( (sourceValue - x1) * (y2 - y1) / (x2 - x1) );
   
-  Point newPoint(time, newValue, Point::good, sourceConf);
+  // create a new point object converted from source units, and map it through the curve
+  Point sourcePoint = Point::convertPoint(p, source()->units(), _inputUnits);
+  Point newPoint(time, valueFromCurve(sourcePoint.value), Point::good, sourcePoint.confidence);
   
-  this->insert(newPoint);
+  this->cachePoint(newPoint);
   return newPoint;
 }
 
+#pragma mark - Protected Methods
+
+void CurveFunction::evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
+  // no curve, no points. otherwise the base class applies (and fuses) the transform.
+  if (_curve.empty()) {
+    return;
+  }
+  ModularTimeSeries::evaluateRange(start, end, out);
+}
+
+
+#pragma mark - Private Methods
+
+bool CurveFunction::inputIsLess(const std::pair<double,double>& lhs, const std::pair<double,double>& rhs) {
+  return lhs.first < rhs.first;
+}
+
+double CurveFunction::valueFromCurve(double sourceValue) {
+  // off either end of the curve, hold the end value (no extrapolation -- same as EPANET's curve lookups).
+  return _curveMap(sourceValue);
+}
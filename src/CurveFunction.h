@@ -18,6 +18,7 @@ namespace RTX {
   /*!
    This time series class allows you to specify points on a curve for value transformation, for instance
    transforming a tank level time series into a volume time series. Generally, can be used for dimensional conversions.
+   Input values outside the curve's range map to the nearest end value.
    */
   
   class CurveFunction : public ModularTimeSeries {
@@ -29,13 +30,21 @@ namespace RTX {
     virtual void setSource(TimeSeries::sharedPointer source);
     virtual Point point(time_t time);
     virtual void setUnits(Units newUnits);
+    virtual bool valueTransform(ValueTransform& transform);
     
     // added functionality.
     void setInputUnits(Units inputUnits);
     void addCurveCoordinate(double inputValue, double outputValue);
     
+  protected:
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out);
+    
   private:
-    std::vector< std::pair<double,double> > _curve;  // list of points for interpolation (x,y)
+    Point computePoint(time_t time);
+    double valueFromCurve(double sourceValue);
+    static bool inputIsLess(const std::pair<double,double>& lhs, const std::pair<double,double>& rhs);
+    std::vector< std::pair<double,double> > _curve;  // list of points for interpolation (x,y), sorted by x
+    ValueTransform _curveMap;                        // lookup table for _curve
     Units _inputUnits;
   };
 }
@@ -6,96 +6,1808 @@
 //
 //
 
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+
 #include "DbPointRecord.h"
+#include "Log.h"
+#include "SteadyClock.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::lock_guard<boost::recursive_mutex> cacheLock_t;
+typedef boost::unique_lock<boost::mutex> poolLock_t;
+typedef boost::unique_lock<boost::mutex> queueLock_t;
+typedef boost::unique_lock<boost::mutex> flightLock_t;
+typedef boost::lock_guard<boost::mutex> queryStatsLock_t;
+typedef boost::unique_lock<boost::mutex> connectLock_t;
+
+#ifndef RTX_NO_INSTRUMENTATION
+namespace {
+  // a batch query's series, for its trace span
+  std::string batchName(const std::vector<std::string>& ids) {
+    if (ids.size() < 2) {
+      return ids.empty() ? "" : ids.front();
+    }
+    std::stringstream name;
+    name << ids.front() << " and " << (ids.size() - 1) << " more";
+    return name.str();
+  }
+}
+#endif
+
+
+#pragma mark - Coverage
+
+DbPointRecord::coverage_t::coverage_t() : evictions(0), _provisional(false), _provisionalFrom(0), _provisionalFetched(0) {
+  
+}
+
+void DbPointRecord::coverage_t::add(time_t start, time_t end) {
+  if (end < start) {
+    return;
+  }
+  // absorb anything that overlaps or touches [start,end]
+  std::map<time_t, time_t>::iterator it = _ranges.upper_bound(start);
+  if (it != _ranges.begin()) {
+    std::map<time_t, time_t>::iterator prev = it;
+    --prev;
+    if (prev->second >= start - 1) {
+      start = prev->first;
+      end = RTX_MAX(end, prev->second);
+      it = prev;
+    }
+  }
+  while (it != _ranges.end() && it->first <= end + 1) {
+    end = RTX_MAX(end, it->second);
+    _ranges.erase(it++);
+  }
+  _ranges[start] = end;
+}
+
+void DbPointRecord::coverage_t::clip(time_t start, time_t end) {
+  std::map<time_t, time_t> clipped;
+  typedef std::map<time_t, time_t>::value_type& rangeValue_t;
+  BOOST_FOREACH(rangeValue_t range, _ranges) {
+    time_t first = RTX_MAX(range.first, start);
+    time_t last = (range.second < end) ? range.second : end;
+    if (first <= last) {
+      clipped[first] = last;
+    }
+  }
+  _ranges.swap(clipped);
+}
+
+void DbPointRecord::coverage_t::clear() {
+  _ranges.clear();
+  _provisional = false;
+}
+
+vector<PointRecord::time_pair_t> DbPointRecord::coverage_t::ranges() const {
+  return vector<PointRecord::time_pair_t>(_ranges.begin(), _ranges.end());
+}
+
+void DbPointRecord::coverage_t::markProvisional(time_t from, time_t fetchedAt) {
+  if (!_provisional) {
+    _provisional = true;
+    _provisionalFrom = from;
+    _provisionalFetched = fetchedAt;
+    return;
+  }
+  // one tail, as old as its oldest part
+  _provisionalFrom = (from < _provisionalFrom) ? from : _provisionalFrom;
+  _provisionalFetched = (fetchedAt < _provisionalFetched) ? fetchedAt : _provisionalFetched;
+}
+
+void DbPointRecord::coverage_t::expire(time_t now, time_t ttl) {
+  if (!_provisional || now - _provisionalFetched < ttl) {
+    return;
+  }
+  // forget everything from the start of the tail on
+  std::map<time_t, time_t>::iterator it = _ranges.lower_bound(_provisionalFrom);
+  _ranges.erase(it, _ranges.end());
+  if (!_ranges.empty() && _ranges.rbegin()->second >= _provisionalFrom) {
+    _ranges.rbegin()->second = _provisionalFrom - 1;
+  }
+  _provisional = false;
+}
+
+bool DbPointRecord::coverage_t::extentContaining(time_t time, PointRecord::time_pair_t& extent) const {
+  std::map<time_t, time_t>::const_iterator it = _ranges.upper_bound(time);
+  if (it == _ranges.begin()) {
+    return false;
+  }
+  --it;
+  if (it->second < time) {
+    return false;
+  }
+  extent = *it;
+  return true;
+}
+
+bool DbPointRecord::coverage_t::contains(time_t time) const {
+  PointRecord::time_pair_t extent;
+  return extentContaining(time, extent);
+}
+
+bool DbPointRecord::coverage_t::covers(time_t start, time_t end) const {
+  if (end < start) {
+    return true;
+  }
+  PointRecord::time_pair_t extent;
+  return (extentContaining(start, extent) && end <= extent.second);
+}
+
+vector<PointRecord::time_pair_t> DbPointRecord::coverage_t::gaps(time_t start, time_t end) const {
+  vector<PointRecord::time_pair_t> gapList;
+  time_t cursor = start;
+  std::map<time_t, time_t>::const_iterator it = _ranges.upper_bound(start);
+  if (it != _ranges.begin()) {
+    --it;
+  }
+  for ( ; it != _ranges.end() && cursor <= end; ++it) {
+    if (it->second < cursor) {
+      continue;
+    }
+    if (it->first > end) {
+      break;
+    }
+    if (cursor < it->first) {
+      gapList.push_back(make_pair(cursor, it->first - 1));
+    }
+    cursor = it->second + 1;
+  }
+  if (cursor <= end) {
+    gapList.push_back(make_pair(cursor, end));
+  }
+  return gapList;
+}
+
+
+#pragma mark - Read-Ahead
+
+DbPointRecord::readAhead_t::readAhead_t() : _lastMiss(0), _lastSize(0), _direction(0), _streak(0) {
+  
+}
+
+PointRecord::time_pair_t DbPointRecord::readAhead_t::windowForMiss(time_t time, time_t minimum, time_t maximum) {
+  int direction = 0;
+  if (_streak > 0 || _lastSize > 0) {
+    time_t step = time - _lastMiss;
+    // a jump much bigger than the last window isn't a scan, it's somebody looking elsewhere.
+    if (0 < step && step <= 2 * _lastSize) {
+      direction = 1;
+    }
+    else if (step < 0 && -step <= 2 * _lastSize) {
+      direction = -1;
+    }
+  }
+  
+  if (direction != 0 && direction == _direction) {
+    ++_streak;
+  }
+  else {
+    _streak = (direction == 0) ? 0 : 1;
+  }
+  _direction = direction;
+  _lastMiss = time;
+  
+  // grow the window geometrically with the length of the scan
+  time_t size = minimum;
+  for (int i = 0; i < _streak && size < maximum; ++i) {
+    size *= 2;
+  }
+  size = (size < maximum) ? size : maximum;
+  _lastSize = size;
+  
+  // most of the window goes ahead of the scan, with a little behind it for interpolation.
+  time_t behind = size / 8;
+  switch (_direction) {
+    case 1:
+      return make_pair(time - behind, time + size);
+    case -1:
+      return make_pair(time - size, time + behind);
+    default:
+      return make_pair(time - size/2, time + size/2);
+  }
+}
+
+
+#pragma mark - Constructor
+
+DbPointRecord::DbPointRecord() {
+  _searchDistance = 60*60*24*7; // 1-week
+  _readAheadMinimum = 60*60;    // 1-hour
+  _readAheadMaximum = 60*60*24*7;
+  _liveWindow = 60*10;          // scada data can trickle in for a while
+  _liveTTL = 60;
+  _streamingThreshold = 0;
+  _streamingChunkSize = 10000;
+  _writeBehind = false;
+  _writeQueueCapacity = 0;
+  _queuedPoints = 0;
+  _stopWriting = false;
+  _poolSize = 1;
+  _idleTimeout = 60*5;
+  _pooledConnections = 0;
+  _poolGeneration = 0;
+  _queryStats.resize(insertRangesQuery + 1);
+  _slowQueryThreshold = 0;
+  _slowQueryLog = &cerr;
+  _connectState = noConnectPending;
+  _ioThreadCount = 0;
+  _runningFetchers = 0;
+  _stopFetching = false;
+}
+
+DbPointRecord::~DbPointRecord() {
+  // too late to write anything: the subclass (and its connection) is already gone.
+  // subclasses should turn write-behind off in their own destructors.
+  if (_writeThread) {
+    {
+      queueLock_t queueLock(_writeQueueMutex);
+      if (_queuedPoints > 0) {
+        RTX_LOG(warning, "DbPointRecord", "discarding " << _queuedPoints << " unwritten points");
+      }
+      _writeQueue.clear();
+      _stopWriting = true;
+    }
+    _writeQueueChanged.notify_all();
+    _writeThread->interrupt();
+    _writeThread->join();
+  }
+  if (_connectThread) {
+    _connectThread->join();
+  }
+  stopFetching(); // should have been done already, by the subclass
+}
+
+
+void DbPointRecord::setConnectionString(const std::string& connection) {
+  _connectionString = connection;
+}
+const std::string& DbPointRecord::connectionString() {
+  return _connectionString;
+}
+
+void DbPointRecord::setSearchDistance(time_t time) {
+  _searchDistance = time;
+}
+time_t DbPointRecord::searchDistance() {
+  return _searchDistance;
+}
+
+void DbPointRecord::setReadAheadWindow(time_t minimum, time_t maximum) {
+  _readAheadMinimum = (minimum > 1) ? minimum : 1;
+  _readAheadMaximum = (maximum > _readAheadMinimum) ? maximum : _readAheadMinimum;
+}
+PointRecord::time_pair_t DbPointRecord::readAheadWindow() {
+  return make_pair(_readAheadMinimum, _readAheadMaximum);
+}
+
+void DbPointRecord::setLiveEdge(time_t window, time_t ttl) {
+  cacheLock_t cacheLock(_cacheMutex);
+  _liveWindow = (window > 0) ? window : 0;
+  _liveTTL = (ttl > 0) ? ttl : 0;
+}
+PointRecord::time_pair_t DbPointRecord::liveEdge() {
+  return make_pair(_liveWindow, _liveTTL);
+}
+
+
+#pragma mark - Cache Bookkeeping
+
+// trying to unify some of the cache-checking code so it's not spread out over the subclasses.
+// we only want to hit the db if we absolutely need to.
+
+DbPointRecord::coverage_t& DbPointRecord::coverage(const std::string& id) {
+  coverage_t& c = _coverage[id];
+  unsigned long evictions = evictionCount(id);
+  if (evictions != c.evictions) {
+    // the cache only ever drops points off its ends, so whatever it still spans is intact.
+    PointRecord::time_pair_t range = DB_PR_SUPER::range(id);
+    if (DB_PR_SUPER::firstPoint(id).isValid) {
+      c.clip(range.first, range.second);
+    }
+    else {
+      c.clear();
+    }
+    c.evictions = evictions;
+  }
+  if (_liveWindow > 0) {
+    c.expire(time(NULL), _liveTTL);
+  }
+  return c;
+}
+
+// a fetch that reaches into the live window is only good for a while.
+void DbPointRecord::noteLiveEdge(coverage_t& c, time_t start, time_t end) {
+  if (_liveWindow <= 0) {
+    return;
+  }
+  time_t now = time(NULL);
+  time_t edge = now - _liveWindow;
+  if (end >= edge) {
+    c.markProvisional(RTX_MAX(start, edge), now);
+  }
+}
+
+// all the points in [startTime, endTime]: covered stretches come from the cache, and only the gaps go to the db.
+vector<Point> DbPointRecord::fetchRange(const std::string& id, time_t startTime, time_t endTime) {
+  vector<PointRecord::time_pair_t> gaps;
+  {
+    // a covered range is read while it's still known to be covered
+    cacheLock_t cacheLock(_cacheMutex);
+    gaps = coverage(id).gaps(startTime, endTime);
+    if (gaps.empty()) {
+      countLookup(true);
+      return DB_PR_SUPER::pointsInRange(id, startTime, endTime);
+    }
+  }
+  countLookup(false);
+  
+  vector<Point> fetched;
+  BOOST_FOREACH(const PointRecord::time_pair_t& gap, gaps) {
+    // db hit
+    vector<Point> gapPoints = selectCoalesced(id, gap.first, gap.second);
+    fetched.insert(fetched.end(), gapPoints.begin(), gapPoints.end());
+  }
+  
+  return cacheFetched(id, startTime, endTime, gaps, fetched);
+}
+
+// splice freshly-selected gap points in with what the cache already has, cache the lot, and mark the gaps covered.
+// fetched must be sorted, and only hold points that fall inside the gaps.
+vector<Point> DbPointRecord::cacheFetched(const std::string& id, time_t startTime, time_t endTime, const std::vector<PointRecord::time_pair_t>& gaps, const std::vector<Point>& fetched) {
+  // the stretches between the gaps were covered when the caller worked them out, but not necessarily now: the lock
+  // was let go for the selects, and another fetch may have pushed some of them out. those are selected as well.
+  vector<PointRecord::time_pair_t> allGaps(gaps);
+  vector<Point> allFetched(fetched);
+  while (true) {
+    vector<PointRecord::time_pair_t> lost;
+    {
+      cacheLock_t cacheLock(_cacheMutex);
+      coverage_t& c = coverage(id);
+      time_t cursor = startTime;
+      for (size_t iGap = 0; iGap <= allGaps.size(); ++iGap) {
+        time_t stretchEnd = (iGap < allGaps.size()) ? allGaps[iGap].first - 1 : endTime;
+        if (cursor <= stretchEnd) {
+          vector<PointRecord::time_pair_t> uncovered = c.gaps(cursor, stretchEnd);
+          lost.insert(lost.end(), uncovered.begin(), uncovered.end());
+        }
+        if (iGap < allGaps.size()) {
+          cursor = allGaps[iGap].second + 1;
+        }
+      }
+      if (lost.empty()) {
+        return cacheFetchedLocked(id, startTime, endTime, allGaps, allFetched);
+      }
+    }
+    
+    BOOST_FOREACH(const PointRecord::time_pair_t& gap, lost) {
+      // db hit
+      vector<Point> gapPoints = selectCoalesced(id, gap.first, gap.second);
+      allFetched.insert(allFetched.end(), gapPoints.begin(), gapPoints.end());
+      allGaps.push_back(gap);
+    }
+    std::sort(allGaps.begin(), allGaps.end());
+    std::stable_sort(allFetched.begin(), allFetched.end(), &Point::comparePointTime);
+  }
+}
+
+// cacheFetched, once every stretch outside the gaps is known to be cached. caller holds _cacheMutex.
+vector<Point> DbPointRecord::cacheFetchedLocked(const std::string& id, time_t startTime, time_t endTime, const std::vector<PointRecord::time_pair_t>& gaps, const std::vector<Point>& fetched) {
+  coverage_t& c = coverage(id);
+  
+  vector<Point> merged;
+  merged.reserve(fetched.size());
+  vector<Point>::const_iterator fetchedIt = fetched.begin();
+  time_t cursor = startTime;
+  BOOST_FOREACH(const PointRecord::time_pair_t& gap, gaps) {
+    if (cursor < gap.first) {
+      vector<Point> cached = DB_PR_SUPER::pointsInRange(id, cursor, gap.first - 1);
+      merged.insert(merged.end(), cached.begin(), cached.end());
+    }
+    while (fetchedIt != fetched.end() && fetchedIt->time <= gap.second) {
+      merged.push_back(*fetchedIt++);
+    }
+    cursor = gap.second + 1;
+  }
+  if (cursor <= endTime) {
+    vector<Point> cached = DB_PR_SUPER::pointsInRange(id, cursor, endTime);
+    merged.insert(merged.end(), cached.begin(), cached.end());
+  }
+  
+  // cache the result set. the cached neighbors go along too, so the buffer sees it as continuous with what it has.
+  vector<Point> toCache;
+  toCache.reserve(merged.size() + 2);
+  Point before = DB_PR_SUPER::pointBefore(id, startTime);
+  if (before.isValid && c.covers(before.time, startTime - 1)) {
+    toCache.push_back(before);
+  }
+  toCache.insert(toCache.end(), merged.begin(), merged.end());
+  Point after = DB_PR_SUPER::pointAfter(id, endTime);
+  if (after.isValid && c.covers(endTime + 1, after.time)) {
+    toCache.push_back(after);
+  }
+  DB_PR_SUPER::addPoints(id, toCache);
+  
+  BOOST_FOREACH(const PointRecord::time_pair_t& gap, gaps) {
+    c.add(gap.first, gap.second);
+    noteLiveEdge(c, gap.first, gap.second);
+  }
+  coverage(id); // reconcile, in case caching these pushed anything out
+  
+  return merged;
+}
+
+// cache a single point found by a next/previous search, and the empty stretch it was found across.
+void DbPointRecord::cachedFetch(const std::string& id, const Point& point, time_t coveredStart, time_t coveredEnd) {
+  cacheLock_t cacheLock(_cacheMutex);
+  coverage_t& c = coverage(id);
+  if (point.isValid) {
+    DB_PR_SUPER::addPoint(id, point);
+  }
+  c.add(coveredStart, coveredEnd);
+  noteLiveEdge(c, coveredStart, coveredEnd);
+  coverage(id);
+}
+
+
+#pragma mark - Snapshots
+
+void DbPointRecord::writeSnapshot(std::ostream& stream) {
+  flush(); // queued points are in the cache, but not yet in the db
+  cacheLock_t cacheLock(_cacheMutex);
+  DB_PR_SUPER::writeSnapshot(stream);
+  
+  vector<string> ids = DB_PR_SUPER::identifiers();
+  writeValue(stream, (uint64_t)ids.size());
+  BOOST_FOREACH(const string& id, ids) {
+    vector<PointRecord::time_pair_t> ranges = coverage(id).ranges();
+    writeString(stream, id);
+    writeValue(stream, (uint64_t)ranges.size());
+    BOOST_FOREACH(const PointRecord::time_pair_t& range, ranges) {
+      writeValue(stream, (int64_t)range.first);
+      writeValue(stream, (int64_t)range.second);
+    }
+  }
+}
+
+bool DbPointRecord::readSnapshot(std::istream& stream) {
+  cacheLock_t cacheLock(_cacheMutex);
+  map<string, unsigned long> evictionsBefore;
+  BOOST_FOREACH(const string& id, DB_PR_SUPER::identifiers()) {
+    evictionsBefore[id] = evictionCount(id);
+  }
+  if (!DB_PR_SUPER::readSnapshot(stream)) {
+    return false;
+  }
+  
+  uint64_t seriesCount = 0;
+  if (!readValue(stream, seriesCount)) {
+    return false;
+  }
+  for (uint64_t iSeries = 0; iSeries < seriesCount; ++iSeries) {
+    string id;
+    uint64_t rangeCount = 0;
+    if (!readString(stream, id) || !readValue(stream, rangeCount)) {
+      return false;
+    }
+    vector<PointRecord::time_pair_t> ranges;
+    for (uint64_t iRange = 0; iRange < rangeCount; ++iRange) {
+      int64_t start, end;
+      if (!readValue(stream, start) || !readValue(stream, end)) {
+        return false;
+      }
+      ranges.push_back(make_pair((time_t)start, (time_t)end));
+    }
+    if (evictionsBefore.find(id) == evictionsBefore.end()) {
+      continue;
+    }
+    coverage_t& c = coverage(id);
+    BOOST_FOREACH(const PointRecord::time_pair_t& range, ranges) {
+      c.add(range.first, range.second);
+    }
+    // so that whatever the restore itself pushed out of the cache is clipped away again
+    c.evictions = evictionsBefore[id];
+    if (_liveWindow > 0) {
+      c.markProvisional(time(NULL) - _liveWindow, 0);
+    }
+    coverage(id);
+  }
+  return true;
+}
+
+
+#pragma mark - Local Store
+
+void DbPointRecord::setLocalStore(PointRecord::sharedPointer store) {
+  cacheLock_t cacheLock(_cacheMutex);
+  _localStore = store;
+  _localCoverage.clear();
+}
+
+PointRecord::sharedPointer DbPointRecord::localStore() {
+  return _localStore;
+}
+
+std::string DbPointRecord::localCoverageId(const std::string& id) {
+  return id + "#coverage";
+}
+
+DbPointRecord::coverage_t& DbPointRecord::localCoverage(const std::string& id) {
+  std::map<std::string, coverage_t>::iterator found = _localCoverage.find(id);
+  if (found != _localCoverage.end()) {
+    return found->second;
+  }
+  coverage_t& c = _localCoverage[id];
+  if (!_localStore) {
+    return c;
+  }
+  
+  // each stored point is one fetched range: (start, end)
+  string coverageId = localCoverageId(id);
+  _localStore->registerAndGetIdentifier(id);
+  _localStore->registerAndGetIdentifier(coverageId);
+  Point first = _localStore->firstPoint(coverageId);
+  Point last = _localStore->lastPoint(coverageId);
+  if (first.isValid) {
+    vector<Point> stored = _localStore->pointsInRange(coverageId, first.time, last.time);
+    BOOST_FOREACH(const Point& p, stored) {
+      c.add(p.time, (time_t)p.value);
+    }
+    // the ranges merge as they're added, so write back the merged list if that saves a lot.
+    vector<PointRecord::time_pair_t> merged = c.ranges();
+    if (stored.size() > 2 * merged.size() + 16) {
+      vector<Point> compacted;
+      BOOST_FOREACH(const PointRecord::time_pair_t& range, merged) {
+        compacted.push_back(Point(range.first, (double)range.second));
+      }
+      _localStore->reset(coverageId);
+      _localStore->addPoints(coverageId, compacted);
+    }
+  }
+  return c;
+}
+
+// the part of [startTime, endTime] the local store can answer for -- everything outside of the gaps.
+vector<Point> DbPointRecord::localPoints(const std::string& id, time_t startTime, time_t endTime, const std::vector<PointRecord::time_pair_t>& gaps) {
+  vector<Point> points;
+  vector<Point> stored = _localStore->pointsInRange(id, startTime, endTime);
+  vector<PointRecord::time_pair_t>::const_iterator gapIt = gaps.begin();
+  BOOST_FOREACH(const Point& p, stored) {
+    while (gapIt != gaps.end() && gapIt->second < p.time) {
+      ++gapIt;
+    }
+    if (gapIt == gaps.end() || p.time < gapIt->first) {
+      points.push_back(p);
+    }
+  }
+  return points;
+}
+
+// write a range fetched from the db through to the local store, and remember that it's there.
+// anything at the live edge is stored, but not marked as fetched, since it may still change.
+void DbPointRecord::storeLocally(const std::string& id, time_t startTime, time_t endTime, const std::vector<Point>& points) {
+  cacheLock_t cacheLock(_cacheMutex);
+  if (!_localStore) {
+    return;
+  }
+  coverage_t& c = localCoverage(id);
+  if (!points.empty()) {
+    _localStore->addPoints(id, points);
+  }
+  if (_liveWindow > 0) {
+    time_t edge = time(NULL) - _liveWindow;
+    endTime = (endTime < edge) ? endTime : edge - 1;
+  }
+  if (startTime <= endTime) {
+    c.add(startTime, endTime);
+    _localStore->addPoint(localCoverageId(id), Point(startTime, (double)endTime));
+  }
+}
+
+// the db boundary: whatever the local store has already fetched comes from there, and only the rest is selected.
+// caller holds a connection lease.
+vector<Point> DbPointRecord::selectThroughLocal(const std::string& id, time_t startTime, time_t endTime) {
+  if (!_localStore) {
+    queryTrace_t query(*this, selectRangeQuery, id, startTime, endTime);
+    vector<Point> selected = this->selectRange(id, startTime, endTime);
+    query.rows(selected.size());
+    return selected;
+  }
+  
+  vector<PointRecord::time_pair_t> gaps;
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    gaps = localCoverage(id).gaps(startTime, endTime);
+  }
+  vector<Point> points = localPoints(id, startTime, endTime, gaps);
+  
+  BOOST_FOREACH(const PointRecord::time_pair_t& gap, gaps) {
+    vector<Point> selected;
+    {
+      queryTrace_t query(*this, selectRangeQuery, id, gap.first, gap.second);
+      selected = this->selectRange(id, gap.first, gap.second);
+      query.rows(selected.size());
+    }
+    vector<Point> inGap;
+    inGap.reserve(selected.size());
+    BOOST_FOREACH(const Point& p, selected) {
+      if (gap.first <= p.time && p.time <= gap.second) {
+        inGap.push_back(p);
+      }
+    }
+    storeLocally(id, gap.first, gap.second, inGap);
+    points.insert(points.end(), inGap.begin(), inGap.end());
+  }
+  
+  std::stable_sort(points.begin(), points.end(), &Point::comparePointTime);
+  return points;
+}
+
+
+#pragma mark - Request Coalescing
+
+// several time series are often built on the same raw tag, and miss on the same stretch of it at the same time.
+// rather than each of them asking the db, whoever gets there first selects it, and the rest wait for the answer.
+// select only the parts of [startTime, endTime] that nobody is already selecting, and share the rest.
+vector<Point> DbPointRecord::selectCoalesced(const std::string& id, time_t startTime, time_t endTime) {
+  vector<flightPointer_t> joined, own;
+  {
+    flightLock_t flightLock(_flightMutex);
+    typedef std::multimap<std::string, flightPointer_t>::iterator flightIterator_t;
+    std::pair<flightIterator_t, flightIterator_t> flights = _flights.equal_range(id);
+    for (flightIterator_t it = flights.first; it != flights.second; ++it) {
+      if (it->second->start <= endTime && startTime <= it->second->end) {
+        joined.push_back(it->second);
+      }
+    }
+    // in-flight ranges never overlap each other, so walking them in order leaves the uncovered gaps.
+    std::sort(joined.begin(), joined.end(), &flightStartsBefore);
+    time_t cursor = startTime;
+    BOOST_FOREACH(flightPointer_t flight, joined) {
+      if (cursor < flight->start) {
+        own.push_back(launchFlight(id, cursor, flight->start - 1));
+      }
+      cursor = RTX_MAX(cursor, flight->end + 1);
+    }
+    if (cursor <= endTime) {
+      own.push_back(launchFlight(id, cursor, endTime));
+    }
+  }
+  
+  vector<Point> points;
+  BOOST_FOREACH(flightPointer_t flight, own) {
+    vector<Point> selected;
+    try {
+      waitForWrites(id);
+      connectionLease_t lease(*this);
+      selected = selectThroughLocal(id, flight->start, flight->end);
+    } catch (...) {
+      landFlight(id, flight, selected, true);
+      // nobody gets left waiting on the rest
+      BOOST_FOREACH(flightPointer_t other, own) {
+        if (!other->landed) {
+          landFlight(id, other, vector<Point>(), true);
+        }
+      }
+      throw;
+    }
+    landFlight(id, flight, selected);
+    points.insert(points.end(), flight->points.begin(), flight->points.end());
+  }
+  
+  BOOST_FOREACH(flightPointer_t flight, joined) {
+    bool failed;
+    {
+      flightLock_t flightLock(_flightMutex);
+      while (!flight->landed) {
+        _flightLanded.wait(flightLock);
+      }
+      failed = flight->failed;
+    }
+    time_t start = RTX_MAX(startTime, flight->start);
+    time_t end = (endTime < flight->end) ? endTime : flight->end;
+    if (failed) {
+      // don't take an error for an empty range -- ask again ourselves.
+      waitForWrites(id);
+      connectionLease_t lease(*this);
+      vector<Point> selected = selectThroughLocal(id, start, end);
+      BOOST_FOREACH(const Point& p, selected) {
+        if (start <= p.time && p.time <= end) {
+          points.push_back(p);
+        }
+      }
+      continue;
+    }
+    // landed points are sorted, and never change once landed.
+    const vector<Point>& landed = flight->points;
+    vector<Point>::const_iterator first = lower_bound(landed.begin(), landed.end(), Point(start, 0), &Point::comparePointTime);
+    vector<Point>::const_iterator last = upper_bound(first, landed.end(), Point(end, 0), &Point::comparePointTime);
+    points.insert(points.end(), first, last);
+  }
+  
+  std::stable_sort(points.begin(), points.end(), &Point::comparePointTime);
+  return points;
+}
+
+bool DbPointRecord::flightStartsBefore(const flightPointer_t& left, const flightPointer_t& right) {
+  return left->start < right->start;
+}
+
+DbPointRecord::flightPointer_t DbPointRecord::launchFlight(const std::string& id, time_t start, time_t end) {
+  flightPointer_t flight( new flight_t(start, end) );
+  _flights.insert(make_pair(id, flight));
+  return flight;
+}
+
+// publish a select's result (trimmed to the flight's range, and sorted) to anybody waiting on it.
+void DbPointRecord::landFlight(const std::string& id, flightPointer_t flight, const std::vector<Point>& points, bool failed) {
+  vector<Point> trimmed;
+  trimmed.reserve(points.size());
+  BOOST_FOREACH(const Point& p, points) {
+    if (flight->start <= p.time && p.time <= flight->end) {
+      trimmed.push_back(p);
+    }
+  }
+  std::stable_sort(trimmed.begin(), trimmed.end(), &Point::comparePointTime);
+  {
+    flightLock_t flightLock(_flightMutex);
+    flight->points.swap(trimmed);
+    flight->failed = failed;
+    flight->landed = true;
+    typedef std::multimap<std::string, flightPointer_t>::iterator flightIterator_t;
+    std::pair<flightIterator_t, flightIterator_t> flights = _flights.equal_range(id);
+    for (flightIterator_t it = flights.first; it != flights.second; ++it) {
+      if (it->second == flight) {
+        _flights.erase(it);
+        break;
+      }
+    }
+  }
+  _flightLanded.notify_all();
+}
+
+
+#pragma mark - Deferred Connection
+
+// connecting can take seconds a record (schema checks, metadata queries), so a caller with several records can start
+// them all connecting at once, or leave the ones it may never use until they're used.
+
+void DbPointRecord::connectInBackground() {
+  connectLock_t lock(_connectMutex);
+  if (_connectState == connectRunning) {
+    return;
+  }
+  if (_connectThread) {
+    _connectThread->join(); // the last one has finished
+  }
+  _connectState = connectRunning;
+  _connectThread.reset( new boost::thread(&DbPointRecord::runConnect, this) );
+}
+
+void DbPointRecord::connectOnFirstUse() {
+  connectLock_t lock(_connectMutex);
+  if (_connectState == noConnectPending) {
+    _connectState = connectOnUse;
+  }
+}
+
+void DbPointRecord::runConnect() {
+  {
+    connectLock_t lock(_connectMutex);
+    _connectingThread = boost::this_thread::get_id();
+  }
+  try {
+    this->connect();
+  } catch (RtxException& e) {
+    RTX_LOG(error, "DbPointRecord", "could not connect: " << e.what());
+  }
+  connectLock_t lock(_connectMutex);
+  _connectingThread = boost::thread::id();
+  _connectState = noConnectPending;
+  _connectFinished.notify_all();
+}
+
+void DbPointRecord::ensureConnected() {
+  if (_connectState.load(boost::memory_order_acquire) == noConnectPending) {
+    return;
+  }
+  connectLock_t lock(_connectMutex);
+  if (_connectingThread == boost::this_thread::get_id()) {
+    return; // connect() itself is using the db
+  }
+  if (_connectState == connectOnUse) {
+    // this thread connects, and any others wait for it
+    _connectState = connectRunning;
+    lock.unlock();
+    runConnect();
+    return;
+  }
+  while (_connectState == connectRunning) {
+    _connectFinished.wait(lock);
+  }
+}
+
+void DbPointRecord::cancelConnect() {
+  connectLock_t lock(_connectMutex);
+  if (_connectState == connectOnUse) {
+    _connectState = noConnectPending;
+  }
+  while (_connectState == connectRunning) {
+    _connectFinished.wait(lock);
+  }
+  boost::shared_ptr<boost::thread> thread = _connectThread;
+  _connectThread.reset();
+  lock.unlock();
+  if (thread) {
+    thread->join();
+  }
+}
+
+
+#pragma mark - Connection Pool
+
+// with a pool size of 1 (the default), every caller takes turns on the subclass' own connection. a larger pool lets
+// that many threads talk to the db at once: the primary connection is used first, and the subclass is asked to
+// open more (each with its own statements and bound buffers) as they're needed, up to the pool size.
+
+void DbPointRecord::setConnectionPoolSize(size_t size) {
+  poolLock_t poolLock(_poolMutex);
+  _poolSize = (size > 0) ? size : 1;
+  // anything over the new limit is dropped as it comes back.
+  while (!_idleConnections.empty() && _pooledConnections + 1 > _poolSize) {
+    _idleConnections.pop_front();
+    --_pooledConnections;
+  }
+  _poolChanged.notify_all();
+}
+
+size_t DbPointRecord::connectionPoolSize() {
+  poolLock_t poolLock(_poolMutex);
+  return _poolSize;
+}
+
+void DbPointRecord::setConnectionIdleTimeout(time_t seconds) {
+  poolLock_t poolLock(_poolMutex);
+  _idleTimeout = seconds;
+}
+
+time_t DbPointRecord::connectionIdleTimeout() {
+  poolLock_t poolLock(_poolMutex);
+  return _idleTimeout;
+}
+
+DbPointRecord::connectionPointer_t DbPointRecord::openConnection() {
+  return connectionPointer_t();
+}
+
+DbPointRecord::connection_t* DbPointRecord::leasedConnection() {
+  leaseState_t* state = _lease.get();
+  return state ? state->connection.get() : NULL;
+}
+
+void DbPointRecord::closeConnections() {
+  poolLock_t poolLock(_poolMutex);
+  _pooledConnections -= _idleConnections.size();
+  _idleConnections.clear();
+  ++_poolGeneration; // connections leased right now are closed when they come back
+  _poolChanged.notify_all();
+}
+
+DbPointRecord::connectionLease_t::connectionLease_t(DbPointRecord& record) : _record(record) {
+  _record.checkOutConnection();
+}
+
+DbPointRecord::connectionLease_t::~connectionLease_t() {
+  _record.checkInConnection();
+}
+
+void DbPointRecord::checkOutConnection() {
+  leaseState_t* state = _lease.get();
+  if (!state) {
+    state = new leaseState_t();
+    _lease.reset(state);
+  }
+  if (state->depth == 0) {
+    ensureConnected(); // not while holding a connection, which a connect may be waiting for
+  }
+  if (state->depth++ > 0) {
+    // nested: this thread already has a connection
+    return;
+  }
+  
+  poolLock_t poolLock(_poolMutex);
+  while (_poolSize > 1) {
+    if (_connectionMutex.try_lock()) {
+      state->holdsPrimary = true;
+      return;
+    }
+  
+    // retire connections that have sat idle too long. the most recently returned are at the back.
+    time_t now = time(NULL);
+    while (!_idleConnections.empty() && _idleTimeout > 0 && now - _idleConnections.front().second > _idleTimeout) {
+      _idleConnections.pop_front();
+      --_pooledConnections;
+    }
+    if (!_idleConnections.empty()) {
+      state->connection = _idleConnections.back().first;
+      state->generation = _poolGeneration;
+      _idleConnections.pop_back();
+      return;
+    }
+  
+    if (_pooledConnections + 1 < _poolSize) {
+      ++_pooledConnections;
+      unsigned long generation = _poolGeneration;
+      poolLock.unlock();
+      connectionPointer_t connection;
+      try {
+        connection = this->openConnection();
+      } catch (...) {
+        connection.reset();
+      }
+      poolLock.lock();
+      if (connection) {
+        state->connection = connection;
+        state->generation = generation;
+        return;
+      }
+      // the subclass can't (or couldn't) open another one. wait for the primary instead.
+      --_pooledConnections;
+      break;
+    }
+  
+    // everything is checked out
+    _poolChanged.wait(poolLock);
+  }
+  poolLock.unlock();
+  
+  _connectionMutex.lock();
+  state->holdsPrimary = true;
+}
+
+void DbPointRecord::checkInConnection() {
+  leaseState_t* state = _lease.get();
+  if (!state || --state->depth > 0) {
+    return;
+  }
+  
+  poolLock_t poolLock(_poolMutex);
+  if (state->holdsPrimary) {
+    state->holdsPrimary = false;
+    _connectionMutex.unlock();
+  }
+  else if (state->connection) {
+    if (state->generation == _poolGeneration && _pooledConnections + 1 <= _poolSize) {
+      _idleConnections.push_back(make_pair(state->connection, time(NULL)));
+    }
+    else {
+      --_pooledConnections;
+    }
+    state->connection.reset();
+  }
+  _poolChanged.notify_all();
+}
+
+
+#pragma mark - Query Tracing
+
+DbPointRecord::queryTrace_t::queryTrace_t(DbPointRecord& record, queryKind_t kind, const std::string& id, time_t startTime, time_t endTime) : _record(record), _kind(kind), _startTime(startTime), _endTime(endTime), _started(0) {
+  _rows[id] = 0;
+  if (kind < insertSingleQuery) {
+    _timer.reset(new QueryTimer(record));
+  }
+  RTX_STATS(_started = steadySeconds());
+  RTX_STATS(if (Tracer::isTracing()) { _span.open(queryName(kind), "database", id, startTime, endTime); });
+}
+
+DbPointRecord::queryTrace_t::queryTrace_t(DbPointRecord& record, queryKind_t kind, const std::vector<std::string>& ids, time_t startTime, time_t endTime) : _record(record), _kind(kind), _startTime(startTime), _endTime(endTime), _started(0) {
+  BOOST_FOREACH(const string& id, ids) {
+    _rows[id] = 0;
+  }
+  if (kind < insertSingleQuery) {
+    _timer.reset(new QueryTimer(record));
+  }
+  RTX_STATS(_started = steadySeconds());
+  RTX_STATS(if (Tracer::isTracing()) { _span.open(queryName(kind), "database", batchName(ids), startTime, endTime); });
+}
+
+// a query that threw is traced too, with whatever rows it got to -- a timeout is as slow as they come.
+DbPointRecord::queryTrace_t::~queryTrace_t() {
+  RTX_STATS(_record.traceQuery(_kind, _rows, _startTime, _endTime, steadySeconds() - _started));
+}
+
+// for a single series
+void DbPointRecord::queryTrace_t::rows(size_t count) {
+  if (!_rows.empty()) {
+    _rows.begin()->second += count;
+  }
+  if (_timer) {
+    _timer->fetched(count);
+  }
+}
+
+void DbPointRecord::queryTrace_t::rows(const std::string& id, size_t count) {
+  _rows[id] += count;
+  if (_timer) {
+    _timer->fetched(count);
+  }
+}
+
+void DbPointRecord::traceQuery(queryKind_t kind, const std::map<std::string, size_t>& rows, time_t startTime, time_t endTime, double seconds) {
+  size_t rowSize = rowBytes(kind);
+  size_t totalRows = 0;
+  queryStatsLock_t lock(_queryStatsMutex);
+  typedef std::map<std::string, size_t>::value_type rowsValue_t;
+  BOOST_FOREACH(const rowsValue_t& entry, rows) {
+    queryStats_t& series = _seriesQueryStats[entry.first];
+    series.queries++;
+    series.rows += entry.second;
+    series.bytes += entry.second * rowSize;
+    series.seconds += seconds / rows.size();
+    series.maximumSeconds = RTX_MAX(series.maximumSeconds, seconds);
+    totalRows += entry.second;
+  }
+  queryStats_t& total = _queryStats[kind];
+  total.queries++;
+  total.rows += totalRows;
+  total.bytes += totalRows * rowSize;
+  total.seconds += seconds;
+  total.maximumSeconds = RTX_MAX(total.maximumSeconds, seconds);
+  
+  if (_metrics) {
+    _metrics->observe("rtx_db_query_seconds", seconds, Metrics::label("record", _metricsName, "kind", queryName(kind)));
+  }
+  
+  if (_slowQueryThreshold > 0 && seconds >= _slowQueryThreshold) {
+    stringstream line;
+    line << "DbPointRecord: slow " << queryName(kind) << ": " << seconds << " s, " << totalRows << " rows";
+    if (!rows.empty()) {
+      line << ", \"" << rows.begin()->first << "\"";
+      if (rows.size() > 1) {
+        line << " and " << (rows.size() - 1) << " more";
+      }
+    }
+    if (startTime != 0 || endTime != 0) {
+      line << ", " << startTime << " to " << endTime;
+    }
+    line << endl;
+    *_slowQueryLog << line.str() << std::flush;
+  }
+}
+
+size_t DbPointRecord::rowBytes(queryKind_t kind) {
+  return sizeof(time_t) + sizeof(double);
+}
+
+DbPointRecord::queryStats_t DbPointRecord::queryStats(queryKind_t kind) {
+  queryStatsLock_t lock(_queryStatsMutex);
+  return _queryStats.at(kind);
+}
+
+std::map<std::string, DbPointRecord::queryStats_t> DbPointRecord::queryStatsBySeries() {
+  queryStatsLock_t lock(_queryStatsMutex);
+  return _seriesQueryStats;
+}
+
+void DbPointRecord::resetQueryStats() {
+  queryStatsLock_t lock(_queryStatsMutex);
+  _queryStats.assign(_queryStats.size(), queryStats_t());
+  _seriesQueryStats.clear();
+}
+
+void DbPointRecord::setSlowQueryLog(double seconds, std::ostream& log) {
+  queryStatsLock_t lock(_queryStatsMutex);
+  _slowQueryThreshold = seconds;
+  _slowQueryLog = &log;
+}
+
+double DbPointRecord::slowQueryThreshold() {
+  return _slowQueryThreshold;
+}
+
+void DbPointRecord::setMetrics(Metrics::sharedPointer metrics, const std::string& name) {
+  queryStatsLock_t lock(_queryStatsMutex);
+  _metrics = metrics;
+  _metricsName = name;
+  if (_metrics) {
+    _metrics->describe("rtx_db_query_seconds", Metrics::histogramMetric, "Database query latency, by kind.");
+  }
+}
+
+std::string DbPointRecord::queryName(queryKind_t kind) {
+  switch (kind) {
+    case selectRangeQuery:
+      return "selectRange";
+    case selectNextQuery:
+      return "selectNext";
+    case selectPreviousQuery:
+      return "selectPrevious";
+    case selectRangesQuery:
+      return "selectRanges";
+    case selectAggregatedQuery:
+      return "selectAggregatedRange";
+    case insertSingleQuery:
+      return "insertSingle";
+    case insertRangeQuery:
+      return "insertRange";
+    case insertRangesQuery:
+      return "insertRanges";
+    default:
+      return "unknown";
+  }
+}
+
+namespace {
+  typedef std::pair<std::string, DbPointRecord::queryStats_t> seriesQueryStats_t;
+  bool busierSeries(const seriesQueryStats_t& left, const seriesQueryStats_t& right) {
+    return left.second.seconds > right.second.seconds;
+  }
+}
+
+// the ten series that have kept the db busiest, after the totals
+std::ostream& DbPointRecord::queryStatsToStream(std::ostream& stream) {
+  vector<queryStats_t> totals;
+  vector<seriesQueryStats_t> series;
+  {
+    queryStatsLock_t lock(_queryStatsMutex);
+    totals = _queryStats;
+    series.assign(_seriesQueryStats.begin(), _seriesQueryStats.end());
+  }
+  stream << "Queries (count, rows, bytes, seconds, slowest):" << endl;
+  for (size_t i = 0; i < totals.size(); ++i) {
+    const queryStats_t& t = totals[i];
+    if (t.queries > 0) {
+      stream << "    " << queryName((queryKind_t)i) << ": " << t.queries << ", " << t.rows << ", " << t.bytes << ", " << t.seconds << ", " << t.maximumSeconds << endl;
+    }
+  }
+  size_t shown = RTX_MIN(series.size(), (size_t)10);
+  partial_sort(series.begin(), series.begin() + shown, series.end(), busierSeries);
+  if (shown > 0) {
+    stream << "Busiest series:" << endl;
+  }
+  for (size_t i = 0; i < shown; ++i) {
+    const queryStats_t& t = series[i].second;
+    stream << "    " << series[i].first << ": " << t.queries << ", " << t.rows << ", " << t.bytes << ", " << t.seconds << ", " << t.maximumSeconds << endl;
+  }
+  return stream;
+}
+
+
+#pragma mark - Write-Behind
+
+// with write-behind on, inserts are queued and written in batches by a background thread, so whoever is producing
+// the points (typically the solver) isn't waiting on the database. the queue is bounded: a producer that gets too far
+// ahead blocks until the writer catches up.
+void DbPointRecord::setWriteBehind(bool enabled, size_t maxQueuedPoints) {
+  if (!enabled) {
+    flush();
+    if (_writeThread) {
+      {
+        queueLock_t queueLock(_writeQueueMutex);
+        _stopWriting = true;
+      }
+      _writeQueueChanged.notify_all();
+      _writeThread->join();
+      _writeThread.reset();
+    }
+    _writeBehind = false;
+    return;
+  }
+  
+  {
+    queueLock_t queueLock(_writeQueueMutex);
+    _writeQueueCapacity = (maxQueuedPoints > 0) ? maxQueuedPoints : 1;
+    _stopWriting = false;
+  }
+  _writeQueueChanged.notify_all();
+  if (!_writeThread) {
+    _writeThread.reset( new boost::thread(&DbPointRecord::writeQueuedPoints, this) );
+  }
+  _writeBehind = true;
+}
+
+bool DbPointRecord::writeBehind() {
+  return _writeBehind;
+}
+
+size_t DbPointRecord::queuedPoints() {
+  queueLock_t queueLock(_writeQueueMutex);
+  return _queuedPoints;
+}
 
-using namespace RTX;
-using namespace std;
+void DbPointRecord::flush() {
+  queueLock_t queueLock(_writeQueueMutex);
+  while (_queuedPoints > 0) {
+    _writeQueueChanged.wait(queueLock);
+  }
+}
+
+void DbPointRecord::queueWrite(const std::string& id, const std::vector<Point>& points) {
+  if (points.empty()) {
+    return;
+  }
+  {
+    queueLock_t queueLock(_writeQueueMutex);
+    // backpressure. an oversized batch is let through once the queue is empty, rather than blocking forever.
+    while (_queuedPoints > 0 && _queuedPoints + points.size() > _writeQueueCapacity) {
+      _writeQueueChanged.wait(queueLock);
+    }
+    vector<Point>& queued = _writeQueue[id];
+    queued.insert(queued.end(), points.begin(), points.end());
+    _pendingById[id] += points.size();
+    _queuedPoints += points.size();
+  }
+  _writeQueueChanged.notify_all();
+}
 
+// reads go to the database, so they must not overtake this series' queued writes.
+void DbPointRecord::waitForWrites(const std::string& id) {
+  if (!_writeThread) {
+    return;
+  }
+  queueLock_t queueLock(_writeQueueMutex);
+  while (_pendingById.find(id) != _pendingById.end()) {
+    _writeQueueChanged.wait(queueLock);
+  }
+}
 
-DbPointRecord::request_t::request_t(string id, time_t start, time_t end) : id(id), range(make_pair(start, end)) {
+// the background writer: take everything that's queued, and hand it to the db as one batch.
+void DbPointRecord::writeQueuedPoints() {
+  while (true) {
+    keyedPoints_t batch;
+    {
+      queueLock_t queueLock(_writeQueueMutex);
+      while (_writeQueue.empty() && !_stopWriting) {
+        _writeQueueChanged.wait(queueLock);
+      }
+      if (_writeQueue.empty()) {
+        return;
+      }
+      batch.swap(_writeQueue);
+    }
+  
+    try {
+      connectionLease_t lease(*this);
+      queryTrace_t query(*this, insertRangesQuery, vector<string>());
+      this->insertRanges(batch);
+      BOOST_FOREACH(const keyedPoints_t::value_type& entry, batch) {
+        query.rows(entry.first, entry.second.size());
+      }
+    } catch (boost::thread_interrupted&) {
+      return;
+    } catch (std::exception& e) {
+      RTX_LOG(error, "DbPointRecord", "write-behind batch failed: " << e.what());
+    }
   
+    {
+      queueLock_t queueLock(_writeQueueMutex);
+      typedef keyedPoints_t::value_type& keyedPointsValue_t;
+      BOOST_FOREACH(keyedPointsValue_t entry, batch) {
+        size_t& pending = _pendingById[entry.first];
+        pending -= entry.second.size();
+        if (pending == 0) {
+          _pendingById.erase(entry.first);
+        }
+        _queuedPoints -= entry.second.size();
+      }
+    }
+    _writeQueueChanged.notify_all();
+  }
 }
 
-bool DbPointRecord::request_t::contains(std::string id, time_t t) {
-  if (this->range.first <= t && t <= this->range.second && RTX_STRINGS_ARE_EQUAL(id, this->id)) {
-    return true;
+// default: one insertRange per series. backends that can write several series in one transaction should override this.
+void DbPointRecord::insertRanges(const keyedPoints_t& pointsById) {
+  typedef keyedPoints_t::value_type keyedPointsValue_t;
+  BOOST_FOREACH(const keyedPointsValue_t& entry, pointsById) {
+    this->insertRange(entry.first, entry.second);
   }
-  return false;
 }
 
 
+#pragma mark - Bulk Transfer
 
-DbPointRecord::DbPointRecord() : request("",0,0) {
-  _searchDistance = 60*60*24*7; // 1-week
+vector<Point> DbPointRecord::selectUncached(const std::string& id, time_t startTime, time_t endTime) {
+  waitForWrites(id);
+  connectionLease_t lease(*this);
+  queryTrace_t query(*this, selectRangeQuery, id, startTime, endTime);
+  vector<Point> selected = this->selectRange(id, startTime, endTime);
+  query.rows(selected.size());
+  return selected;
+}
+
+void DbPointRecord::insertBulk(const keyedPoints_t& pointsById) {
+  vector<string> ids;
+  BOOST_FOREACH(const keyedPoints_t::value_type& entry, pointsById) {
+    ids.push_back(entry.first);
+    waitForWrites(entry.first);
+  }
+  {
+    // ranges known to be empty may not be any more
+    cacheLock_t cacheLock(_cacheMutex);
+    BOOST_FOREACH(const string& id, ids) {
+      _coverage.erase(id);
+      DB_PR_SUPER::reset(id);
+    }
+  }
+  {
+    connectionLease_t lease(*this);
+    queryTrace_t query(*this, insertRangesQuery, ids);
+    this->insertRanges(pointsById);
+    BOOST_FOREACH(const keyedPoints_t::value_type& entry, pointsById) {
+      query.rows(entry.first, entry.second.size());
+    }
+  }
+  {
+    // and again: a reader may have selected these ranges while they were going in, and cached them as empty.
+    cacheLock_t cacheLock(_cacheMutex);
+    BOOST_FOREACH(const string& id, ids) {
+      _coverage.erase(id);
+      DB_PR_SUPER::reset(id);
+    }
+  }
 }
 
 
-void DbPointRecord::setConnectionString(const std::string& connection) {
-  _connectionString = connection;
+#pragma mark - Streaming
+
+void DbPointRecord::setStreamingThreshold(time_t seconds) {
+  _streamingThreshold = (seconds > 0) ? seconds : 0;
 }
-const std::string& DbPointRecord::connectionString() {
-  return _connectionString;
+time_t DbPointRecord::streamingThreshold() {
+  return _streamingThreshold;
 }
 
-void DbPointRecord::setSearchDistance(time_t time) {
-  _searchDistance = time;
+void DbPointRecord::setStreamingChunkSize(size_t points) {
+  _streamingChunkSize = (points > 1) ? points : 1;
 }
-time_t DbPointRecord::searchDistance() {
-  return _searchDistance;
+size_t DbPointRecord::streamingChunkSize() {
+  return _streamingChunkSize;
 }
 
-// trying to unify some of the cache-checking code so it's not spread out over the subclasses.
-// we only want to hit the db if we absolutely need to.
+// a chunk at a time, each one under a lease of its own, and visited once that's given back.
+void DbPointRecord::visitUncached(const std::string& id, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  waitForWrites(id);
+  time_t from = startTime;
+  vector<Point> chunk;
+  while (from <= endTime) {
+    chunk.clear();
+    time_t through;
+    {
+      connectionLease_t lease(*this);
+      queryTrace_t query(*this, selectRangeQuery, id, from, endTime);
+      through = this->selectChunk(id, from, endTime, _streamingChunkSize, chunk);
+      query.rows(chunk.size());
+    }
+    BOOST_FOREACH(const Point& p, chunk) {
+      // a backend whose times are rounded may hand back the edge of the last chunk again
+      if (p.time >= from && p.time <= through && !visitor.visit(p)) {
+        return;
+      }
+    }
+    if (through >= endTime || through < from) {
+      break;
+    }
+    from = through + 1;
+  }
+}
 
-/*
-bool DbPointRecord::isPointAvailable(const string& id, time_t time) {
-  if (DB_PR_SUPER::isPointAvailable(id, time)) {
-    return true;
+// default: no way to limit a select, so take slices of time until about half a chunk's worth has come back. each
+// slice is sized for what's still wanted at the density the last one found. an empty one skips ahead to the next
+// point, so a gap doesn't leave the slices long enough to swallow whatever follows it.
+time_t DbPointRecord::selectChunk(const std::string& id, time_t startTime, time_t endTime, size_t maxPoints, std::vector<Point>& chunk) {
+  size_t wanted = maxPoints / 2 + 1;
+  time_t slice = _readAheadMinimum;
+  time_t through = startTime - 1;
+  while (through < endTime && chunk.size() < wanted) {
+    time_t from = through + 1;
+    through = (endTime - from < slice) ? endTime : from + slice - 1;
+    vector<Point> selected = this->selectRange(id, from, through);
+    chunk.insert(chunk.end(), selected.begin(), selected.end());
+    if (selected.empty() && through < endTime) {
+      Point next = this->selectNext(id, through);
+      through = (next.isValid && next.time <= endTime) ? next.time - 1 : endTime;
+    }
+    else if (chunk.size() < wanted) {
+      double scaled = (double)slice * (double)(wanted - chunk.size()) / (double)selected.size();
+      scaled = (scaled < 2. * slice) ? scaled : 2. * slice; // sparse points may not last
+      slice = (scaled < 1.) ? 1 : (time_t)scaled;
+    }
   }
-  else if ( !(reqRange.first <= time && time <= reqRange.second) ) {
-    // force a fetch/cache operation
-    time_t margin = 60*60*12;
-    vector<Point> points = this->pointsInRange(id, time - margin, time + margin);
+  return through;
+}
+
+time_t DbPointRecord::completeChunk(std::vector<Point>& chunk, time_t endTime, size_t maxPoints) {
+  if (chunk.size() < maxPoints || chunk.empty()) {
+    return endTime; // that's all there is
+  }
+  // the limit may have fallen among several points at the last time, so leave that time for the next chunk
+  time_t last = chunk.back().time;
+  if (chunk.front().time == last) {
+    return last;
+  }
+  while (chunk.back().time == last) {
+    chunk.pop_back();
   }
-  return DB_PR_SUPER::isPointAvailable(id, time);
+  return last - 1;
 }
-*/
-Point DbPointRecord::point(const string& id, time_t time) {
+
+
+#pragma mark - Batched Retrieval
+
+// warm the cache for a whole group of series with one round trip, instead of one query per series.
+void DbPointRecord::prefetchRange(const std::vector<std::string>& ids, time_t startTime, time_t endTime) {
+  if (endTime < startTime) {
+    return;
+  }
   
-  Point p = DB_PR_SUPER::point(id, time);
+  // only the series that are missing something take part, and the query only has to span their gaps.
+  vector<string> missing;
+  map<string, vector<PointRecord::time_pair_t> > gapsById;
+  time_t queryStart = endTime, queryEnd = startTime;
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    BOOST_FOREACH(const string& id, ids) {
+      if (gapsById.find(id) != gapsById.end()) {
+        continue;
+      }
+      vector<PointRecord::time_pair_t> gaps = coverage(id).gaps(startTime, endTime);
+      if (gaps.empty()) {
+        continue;
+      }
+      missing.push_back(id);
+      gapsById[id] = gaps;
+      queryStart = (gaps.front().first < queryStart) ? gaps.front().first : queryStart;
+      queryEnd = (gaps.back().second > queryEnd) ? gaps.back().second : queryEnd;
+    }
+  }
+  // series the local store already has are served from there.
+  if (_localStore) {
+    vector<string> remote;
+    BOOST_FOREACH(const string& id, missing) {
+      bool local;
+      {
+        cacheLock_t cacheLock(_cacheMutex);
+        local = localCoverage(id).covers(gapsById[id].front().first, gapsById[id].back().second);
+      }
+      if (local) {
+        const vector<PointRecord::time_pair_t>& gaps = gapsById[id];
+        vector<Point> stored;
+        BOOST_FOREACH(const PointRecord::time_pair_t& gap, gaps) {
+          vector<Point> inGap = _localStore->pointsInRange(id, gap.first, gap.second);
+          stored.insert(stored.end(), inGap.begin(), inGap.end());
+        }
+        cacheFetched(id, startTime, endTime, gaps, stored);
+      }
+      else {
+        remote.push_back(id);
+      }
+    }
+    missing.swap(remote);
+  }
+  if (missing.empty()) {
+    return;
+  }
   
-  if (!p.isValid) {
-    
-    // see if we just asked the db for something in this range.
-    // if so, and Super couldn't find it, then it's just not here.
-    // todo -- check staleness
-    
-    if (request.contains(id, time)) {
-      return Point();
+  // let single-series misses on these gaps wait for the batch instead of asking on their own.
+  // (a series with a gap somebody else is already selecting is left out, so flights never overlap.)
+  map<string, vector<flightPointer_t> > flightsById;
+  {
+    flightLock_t flightLock(_flightMutex);
+    BOOST_FOREACH(const string& id, missing) {
+      typedef std::multimap<std::string, flightPointer_t>::iterator flightIterator_t;
+      std::pair<flightIterator_t, flightIterator_t> flights = _flights.equal_range(id);
+      bool overlaps = false;
+      for (flightIterator_t it = flights.first; it != flights.second && !overlaps; ++it) {
+        overlaps = (it->second->start <= gapsById[id].back().second && gapsById[id].front().first <= it->second->end);
+      }
+      if (!overlaps) {
+        BOOST_FOREACH(const PointRecord::time_pair_t& gap, gapsById[id]) {
+          flightsById[id].push_back(launchFlight(id, gap.first, gap.second));
+        }
+      }
     }
-    
-    time_t margin = 60*60*12;
-    time_t start = time - margin, end = time + margin;
-    
-    // do the request, and cache the request parameters.
-    request = request_t(id, start, end);
-    vector<Point> pVec = this->selectRange(id, start, end);
-    
-    vector<Point>::const_iterator pIt = pVec.begin();
-    while (pIt != pVec.end()) {
-      if (pIt->time == time) {
-        p = *pIt;
+  }
+  
+  // db hit
+  keyedPoints_t results;
+  try {
+    BOOST_FOREACH(const string& id, missing) {
+      waitForWrites(id);
+    }
+    connectionLease_t lease(*this);
+    queryTrace_t query(*this, selectRangesQuery, missing, queryStart, queryEnd);
+    results = this->selectRanges(missing, queryStart, queryEnd);
+    BOOST_FOREACH(const keyedPoints_t::value_type& result, results) {
+      query.rows(result.first, result.second.size());
+    }
+  } catch (...) {
+    typedef map<string, vector<flightPointer_t> >::value_type& flightsValue_t;
+    BOOST_FOREACH(flightsValue_t entry, flightsById) {
+      BOOST_FOREACH(flightPointer_t flight, entry.second) {
+        landFlight(entry.first, flight, vector<Point>(), true);
+      }
+    }
+    throw;
+  }
+  
+  BOOST_FOREACH(const string& id, missing) {
+    const vector<PointRecord::time_pair_t>& gaps = gapsById[id];
+    vector<Point>& selected = results[id];
+    std::stable_sort(selected.begin(), selected.end(), &Point::comparePointTime);
+    // keep what falls in this series' gaps -- the covered stretches in between are already cached.
+    vector<Point> fetched;
+    fetched.reserve(selected.size());
+    vector<PointRecord::time_pair_t>::const_iterator gapIt = gaps.begin();
+    BOOST_FOREACH(const Point& p, selected) {
+      while (gapIt != gaps.end() && gapIt->second < p.time) {
+        ++gapIt;
       }
-      else if (pIt->time > time) {
+      if (gapIt == gaps.end()) {
         break;
       }
-      ++pIt;
+      if (gapIt->first <= p.time && (fetched.empty() || fetched.back().time < p.time)) {
+        fetched.push_back(p);
+      }
+    }
+    cacheFetched(id, startTime, endTime, gaps, fetched);
+    if (_localStore) {
+      vector<Point>::const_iterator fIt = fetched.begin();
+      BOOST_FOREACH(const PointRecord::time_pair_t& gap, gaps) {
+        vector<Point> inGap;
+        while (fIt != fetched.end() && fIt->time <= gap.second) {
+          inGap.push_back(*fIt++);
+        }
+        storeLocally(id, gap.first, gap.second, inGap);
+      }
+    }
+    BOOST_FOREACH(flightPointer_t flight, flightsById[id]) {
+      landFlight(id, flight, fetched);
+    }
+  }
+}
+
+// the batched counterpart to a cache miss in point(): every series that would miss at this time is fetched together.
+void DbPointRecord::prefetch(const std::vector<std::string>& ids, time_t time) {
+  vector<string> missing;
+  PointRecord::time_pair_t window;
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    BOOST_FOREACH(const string& id, ids) {
+      if (!coverage(id).contains(time) && !DB_PR_SUPER::point(id, time).isValid) {
+        missing.push_back(id);
+      }
+    }
+    if (missing.empty()) {
+      return;
+    }
+    window = _batchReadAhead.windowForMiss(time, _readAheadMinimum, _readAheadMaximum);
+  }
+  prefetchRange(missing, window.first, window.second);
+}
+
+// default: no aggregation on the server.
+bool DbPointRecord::selectAggregatedRange(const std::string& id, time_t startTime, time_t endTime, time_t bucket, std::vector<PointSummary>& summaries) {
+  return false;
+}
+
+// default: one query per series. backends that can select several series at once should override this.
+DbPointRecord::keyedPoints_t DbPointRecord::selectRanges(const std::vector<std::string>& ids, time_t startTime, time_t endTime) {
+  keyedPoints_t results;
+  BOOST_FOREACH(const string& id, ids) {
+    results[id] = this->selectRange(id, startTime, endTime);
+  }
+  return results;
+}
+
+
+#pragma mark - Asynchronous Fetching
+
+DbPointRecord::fetchFuture_t::fetchFuture_t() : _state(new state_t()) {
+  _state->isDone = true;
+}
+
+bool DbPointRecord::fetchFuture_t::isReady() const {
+  boost::lock_guard<boost::mutex> lock(_state->mutex);
+  return _state->isDone;
+}
+
+void DbPointRecord::fetchFuture_t::wait() const {
+  boost::unique_lock<boost::mutex> lock(_state->mutex);
+  while (!_state->isDone) {
+    _state->finished.wait(lock);
+  }
+}
+
+const DbPointRecord::keyedPoints_t& DbPointRecord::fetchFuture_t::get() const throw(RtxException) {
+  wait();
+  if (_state->didFail) {
+    throw RtxException("fetch failed: " + _state->error);
+  }
+  return _state->points;
+}
+
+DbPointRecord::fetchFuture_t DbPointRecord::fetchRangeAsync(const std::vector<std::string>& ids, time_t startTime, time_t endTime) {
+  asyncFetch_t fetch;
+  fetch.ids = ids;
+  fetch.isRange = true;
+  fetch.keepsPoints = true;
+  fetch.startTime = startTime;
+  fetch.endTime = endTime;
+  return queueFetch(fetch);
+}
+
+DbPointRecord::fetchFuture_t DbPointRecord::prefetchRangeAsync(const std::vector<std::string>& ids, time_t startTime, time_t endTime) {
+  asyncFetch_t fetch;
+  fetch.ids = ids;
+  fetch.isRange = true;
+  fetch.keepsPoints = false;
+  fetch.startTime = startTime;
+  fetch.endTime = endTime;
+  return queueFetch(fetch);
+}
+
+DbPointRecord::fetchFuture_t DbPointRecord::prefetchAsync(const std::vector<std::string>& ids, time_t time) {
+  asyncFetch_t fetch;
+  fetch.ids = ids;
+  fetch.isRange = false;
+  fetch.keepsPoints = false;
+  fetch.startTime = time;
+  fetch.endTime = time;
+  return queueFetch(fetch);
+}
+
+void DbPointRecord::setIoThreadCount(size_t count) {
+  queueLock_t queueLock(_fetchQueueMutex);
+  _ioThreadCount = count;
+}
+
+size_t DbPointRecord::ioThreadCount() {
+  queueLock_t queueLock(_fetchQueueMutex);
+  return (_ioThreadCount > 0) ? _ioThreadCount : _poolSize;
+}
+
+void DbPointRecord::setRuntime(RuntimeContext::sharedPointer runtime) {
+  queueLock_t queueLock(_fetchQueueMutex);
+  _runtime = runtime;
+}
+
+RuntimeContext::sharedPointer DbPointRecord::runtime() {
+  queueLock_t queueLock(_fetchQueueMutex);
+  return (_runtime) ? _runtime : RuntimeContext::defaultContext();
+}
+
+// a fetcher is handed to the scheduler for each fetch queued, up to the thread count, and runs until the queue's empty.
+DbPointRecord::fetchFuture_t DbPointRecord::queueFetch(const asyncFetch_t& fetch) {
+  asyncFetch_t queued = fetch;
+  queued.future._state.reset(new fetchFuture_t::state_t());
+  size_t threadCount = ioThreadCount();
+  Scheduler::sharedPointer scheduler = runtime()->scheduler();
+  bool needsFetcher = false;
+  {
+    queueLock_t queueLock(_fetchQueueMutex);
+    _fetchQueue.push_back(queued);
+    if (_runningFetchers < threadCount) {
+      ++_runningFetchers;
+      needsFetcher = true;
+    }
+  }
+  if (needsFetcher) {
+    scheduler->submitIo(boost::bind(&DbPointRecord::runFetches, this));
+  }
+  return queued.future;
+}
+
+void DbPointRecord::runFetches() {
+  while (true) {
+    asyncFetch_t fetch;
+    {
+      queueLock_t queueLock(_fetchQueueMutex);
+      if (_fetchQueue.empty() || _stopFetching) {
+        --_runningFetchers;
+        _fetcherFinished.notify_all(); // for stopFetching
+        return;
+      }
+      fetch = _fetchQueue.front();
+      _fetchQueue.pop_front();
+    }
+  
+    fetchFuture_t::state_t& state = *fetch.future._state;
+    keyedPoints_t points;
+    bool didFail = false;
+    string error;
+    try {
+      if (fetch.isRange) {
+        prefetchRange(fetch.ids, fetch.startTime, fetch.endTime);
+        // cached now, so these are just reads
+        for (size_t i = 0; fetch.keepsPoints && i < fetch.ids.size(); ++i) {
+          points[fetch.ids[i]] = pointsInRange(fetch.ids[i], fetch.startTime, fetch.endTime);
+        }
+      }
+      else {
+        prefetch(fetch.ids, fetch.startTime);
+      }
+    } catch (std::exception& e) {
+      didFail = true;
+      error = e.what();
+    } catch (...) {
+      didFail = true;
+      error = "unknown error";
     }
-    // cache this latest result set
-    DB_PR_SUPER::addPoints(id, pVec);
+    {
+      boost::lock_guard<boost::mutex> lock(state.mutex);
+      state.points.swap(points);
+      state.didFail = didFail;
+      state.error = error;
+      state.isDone = true;
+    }
+    state.finished.notify_all();
+  }
+}
+
+// the fetches running finish first. the ones still queued fail, since there's nobody left to run them.
+void DbPointRecord::stopFetching() {
+  std::deque<asyncFetch_t> abandoned;
+  {
+    queueLock_t queueLock(_fetchQueueMutex);
+    _stopFetching = true;
+    abandoned.swap(_fetchQueue);
+    while (_runningFetchers > 0) {
+      _fetcherFinished.wait(queueLock);
+    }
+  }
+  BOOST_FOREACH(asyncFetch_t& fetch, abandoned) {
+    fetchFuture_t::state_t& state = *fetch.future._state;
+    {
+      boost::lock_guard<boost::mutex> lock(state.mutex);
+      state.didFail = true;
+      state.error = "the record stopped fetching";
+      state.isDone = true;
+    }
+    state.finished.notify_all();
+  }
+  queueLock_t queueLock(_fetchQueueMutex);
+  _stopFetching = false; // a later fetch hands out fetchers again
+}
+
+
+#pragma mark - Retrieval
+
+Point DbPointRecord::point(const string& id, time_t time) {
+  
+  Point p = DB_PR_SUPER::point(id, time);
+  
+  if (p.isValid) {
+    countLookup(true);
   }
+  else {
   
+    PointRecord::time_pair_t window;
+    {
+      cacheLock_t cacheLock(_cacheMutex);
+      // if we've already asked the db about this time, and Super couldn't find it, then it's just not here.
+      // (coverage() has already let go of anything stale at the live edge.)
+      if (coverage(id).contains(time)) {
+        countLookup(true);
+        return Point();
+      }
+      // size and point the fetch to match how this series is being read.
+      window = _readAhead[id].windowForMiss(time, _readAheadMinimum, _readAheadMaximum);
+    }
+    vector<Point> pVec = fetchRange(id, window.first, window.second);
   
+    vector<Point>::const_iterator pIt = lower_bound(pVec.begin(), pVec.end(), Point(time, 0), &Point::comparePointTime);
+    if (pIt != pVec.end() && pIt->time == time) {
+      p = *pIt;
+    }
+  }
   
   return p;
 }
@@ -104,24 +1816,57 @@ Point DbPointRecord::point(const string& id, time_t time) {
 Point DbPointRecord::pointBefore(const string& id, time_t time) {
   
   Point p = DB_PR_SUPER::pointBefore(id, time);
-  
   if (!p.isValid) {
-    if (request.contains(id, time)) {
-      return Point();
+    // the buffer has nothing before a time past its last point -- but its last point is before that time.
+    Point last = DB_PR_SUPER::lastPoint(id);
+    if (last.isValid && last.time < time) {
+      p = last;
     }
-    PointRecord::time_pair_t range = DB_PR_SUPER::range(id);
-    request = request_t(id, time, time);
-    p = this->selectPrevious(id, time);
-    if (range.first <= time && time <= range.second) {
-      // then we know this is continuous. add the point.
-      DB_PR_SUPER::addPoint(id, p);
+  }
+  
+  // the cached point is the answer if nothing between it and time could be missing.
+  time_t searchFrom = time;
+  PointRecord::time_pair_t extent;
+  bool covered;
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    covered = coverage(id).extentContaining(time - 1, extent);
+  }
+  if (covered) {
+    if (p.isValid && p.time >= extent.first) {
+      countLookup(true);
+      return p;
     }
-    else {
-      request = request_t("",0,0);
+    if (extent.first <= time - searchDistance()) {
+      // known-empty as far back as we'd look
+      countLookup(true);
+      return Point();
     }
+    searchFrom = extent.first;
   }
+  countLookup(false);
   
-  return p;
+  Point found;
+  {
+    waitForWrites(id);
+    connectionLease_t lease(*this);
+    queryTrace_t query(*this, selectPreviousQuery, id, searchFrom, searchFrom);
+    found = this->selectPrevious(id, searchFrom);
+    query.rows(found.isValid ? 1 : 0);
+  }
+  if (found.isValid && found.time < searchFrom) {
+    cachedFetch(id, found, found.time, searchFrom - 1);
+  }
+  else {
+    found = Point();
+    cachedFetch(id, found, searchFrom - searchDistance(), searchFrom - 1);
+  }
+  
+  // the cache may hold a point the db doesn't know about.
+  if (p.isValid && (!found.isValid || found.time < p.time)) {
+    return p;
+  }
+  return found;
 }
 
 
@@ -129,97 +1874,229 @@ Point DbPointRecord::pointAfter(const string& id, time_t time) {
   
   Point p = DB_PR_SUPER::pointAfter(id, time);
   
-  if (!p.isValid) {
-    if (request.contains(id, time)) {
-      return Point();
-    }
-    PointRecord::time_pair_t range = DB_PR_SUPER::range(id);
-    request = request_t(id, time, time);
-    p = this->selectNext(id, time);
-    if (range.first <= time && time <= range.second) {
-      // then we know this is continuous. add the point.
-      DB_PR_SUPER::addPoint(id, p);
+  time_t searchFrom = time;
+  PointRecord::time_pair_t extent;
+  bool covered;
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    covered = coverage(id).extentContaining(time + 1, extent);
+  }
+  if (covered) {
+    if (p.isValid && p.time <= extent.second) {
+      countLookup(true);
+      return p;
     }
-    else {
-      request = request_t("",0,0);
+    if (extent.second >= time + searchDistance()) {
+      countLookup(true);
+      return Point();
     }
+    searchFrom = extent.second;
   }
+  countLookup(false);
   
-  return p;
+  Point found;
+  {
+    waitForWrites(id);
+    connectionLease_t lease(*this);
+    queryTrace_t query(*this, selectNextQuery, id, searchFrom, searchFrom);
+    found = this->selectNext(id, searchFrom);
+    query.rows(found.isValid ? 1 : 0);
+  }
+  if (found.isValid && found.time > searchFrom) {
+    cachedFetch(id, found, searchFrom + 1, found.time);
+  }
+  else {
+    found = Point();
+    cachedFetch(id, found, searchFrom + 1, searchFrom + searchDistance());
+  }
+  
+  if (p.isValid && (!found.isValid || p.time < found.time)) {
+    return p;
+  }
+  return found;
 }
 
 
 std::vector<Point> DbPointRecord::pointsInRange(const string& id, time_t startTime, time_t endTime) {
-  
-  PointRecord::time_pair_t range = DB_PR_SUPER::range(id);
-  
-  // if the requested range is not in memcache, then fetch it.
-  if ( !(range.first <= startTime && endTime <= range.second) ) {
-    vector<Point> left;
-    vector<Point> right;
-    
-    time_t qstart, qend;
-    if (startTime < range.first && endTime < range.second  && endTime > range.first) {
-      // left-fill query
-      qstart = startTime;
-      qend = range.first;
-      right = DB_PR_SUPER::pointsInRange(id, range.first, endTime);
-    }
-    else if (range.first < startTime && range.second < endTime && startTime < range.second ) {
-      // right-fill query
-      qstart = range.second;
-      qend = endTime;
-      left = DB_PR_SUPER::pointsInRange(id, startTime, range.second);
+  if (endTime < startTime) {
+    return vector<Point>();
+  }
+  return fetchRange(id, startTime, endTime);
+}
+
+// a long range the cache doesn't cover is streamed past it, if that's been asked for. anything else is fetched and
+// cached, and visited from a copy -- so a visitor may use this record, as it may for a streamed range.
+void DbPointRecord::visitPointsInRange(const string& id, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  if (endTime < startTime) {
+    return;
+  }
+  if (_streamingThreshold > 0 && endTime - startTime >= _streamingThreshold) {
+    bool isCached;
+    {
+      cacheLock_t cacheLock(_cacheMutex);
+      isCached = coverage(id).covers(startTime, endTime);
     }
-    else {
-      // full overlap -- todo - generate two queries...
-      qstart = startTime;
-      qend = endTime;
+    if (!isCached) {
+      countLookup(false);
+      visitUncached(id, startTime, endTime, visitor);
+      return;
     }
-    // db hit
-    vector<Point> newPoints = this->selectRange(id, qstart, qend);
-    
-    vector<Point> merged;
-    merged.reserve(newPoints.size() + left.size() + right.size());
-    merged.insert(merged.end(), left.begin(), left.end());
-    merged.insert(merged.end(), newPoints.begin(), newPoints.end());
-    merged.insert(merged.end(), right.begin(), right.end());
-    
-    DB_PR_SUPER::addPoints(id, merged);
-    
-    return merged;
   }
+  PointRecord::visitPointsInRange(id, startTime, endTime, visitor);
+}
+
+
+std::vector<PointSummary> DbPointRecord::summaries(const std::string& id, time_t startTime, time_t endTime, time_t resolution) {
+  vector<PointSummary> summaries;
+  if (resolution < 1) {
+    resolution = 1;
+  }
+  if (endTime < startTime) {
+    return summaries;
+  }
+  // whole buckets
+  time_t first = startTime - (startTime % resolution);
+  time_t last = endTime - (endTime % resolution) + resolution - 1;
   
-  return DB_PR_SUPER::pointsInRange(id, startTime, endTime);
+  bool isCached;
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    isCached = coverage(id).covers(first, last);
+  }
+  if (!isCached) {
+    // let the db do the bucketing, if it can
+    waitForWrites(id);
+    bool isAggregated;
+    {
+      connectionLease_t lease(*this);
+      queryTrace_t query(*this, selectAggregatedQuery, id, first, last);
+      isAggregated = this->selectAggregatedRange(id, first, last, resolution, summaries);
+      query.rows(summaries.size());
+    }
+    if (isAggregated) {
+      countLookup(false);
+      return summaries;
+    }
+  }
   
+  return summarize(fetchRange(id, first, last), resolution);
 }
 
 
+#pragma mark - Insertion
+
 void DbPointRecord::addPoint(const string& id, Point point) {
   DB_PR_SUPER::addPoint(id, point);
+  if (_localStore) {
+    cacheLock_t cacheLock(_cacheMutex);
+    localCoverage(id); // registers it
+    _localStore->addPoint(id, point);
+  }
+  if (_writeBehind) {
+    queueWrite(id, vector<Point>(1, point));
+    return;
+  }
+  connectionLease_t lease(*this);
+  queryTrace_t query(*this, insertSingleQuery, id, point.time, point.time);
   this->insertSingle(id, point);
+  query.rows(1);
 }
 
 
-void DbPointRecord::addPoints(const string& id, std::vector<Point> points) {
-  DB_PR_SUPER::addPoints(id, points);
+void DbPointRecord::addPoints(const string& id, const std::vector<Point>& points) {
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    coverage_t& c = coverage(id);
+    DB_PR_SUPER::addPoints(id, points);
+    if (evictionCount(id) != c.evictions) {
+      // a discontinuous batch replaces the cache wholesale, so we can't say what's still covered.
+      c.clear();
+      c.evictions = evictionCount(id);
+    }
+    if (_localStore) {
+      localCoverage(id);
+      _localStore->addPoints(id, points);
+    }
+  }
+  if (_writeBehind) {
+    queueWrite(id, points);
+    return;
+  }
+  connectionLease_t lease(*this);
+  queryTrace_t query(*this, insertRangeQuery, id, points.empty() ? 0 : points.front().time, points.empty() ? 0 : points.back().time);
   this->insertRange(id, points);
+  query.rows(points.size());
 }
 
 
 void DbPointRecord::reset() {
-  DB_PR_SUPER::reset();
+  flush(); // nothing queued may land after the truncation
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    DB_PR_SUPER::reset();
+    _coverage.clear();
+    _readAhead.clear();
+    _batchReadAhead = readAhead_t();
+    if (_localStore) {
+      _localStore->reset();
+    }
+    _localCoverage.clear();
+  }
+  connectionLease_t lease(*this);
   this->truncate();
 }
 
 
 void DbPointRecord::reset(const string& id) {
-  DB_PR_SUPER::reset(id);
+  waitForWrites(id);
+  {
+    cacheLock_t cacheLock(_cacheMutex);
+    DB_PR_SUPER::reset(id);
+    _coverage.erase(id);
+    _readAhead.erase(id);
+    if (_localStore) {
+      localCoverage(id);
+      _localStore->reset(id);
+      _localStore->reset(localCoverageId(id));
+    }
+    _localCoverage.erase(id);
+  }
+  connectionLease_t lease(*this);
   this->removeRecord(id);
   // wiped out the record completely, so re-initialize it.
   this->registerAndGetIdentifier(id);
 }
 
+
+Point DbPointRecord::point(handle_t handle, time_t time) {
+  return this->point(identifierForHandle(handle), time);
+}
+
+Point DbPointRecord::pointBefore(handle_t handle, time_t time) {
+  return this->pointBefore(identifierForHandle(handle), time);
+}
+
+Point DbPointRecord::pointAfter(handle_t handle, time_t time) {
+  return this->pointAfter(identifierForHandle(handle), time);
+}
+
+std::vector<Point> DbPointRecord::pointsInRange(handle_t handle, time_t startTime, time_t endTime) {
+  return this->pointsInRange(identifierForHandle(handle), startTime, endTime);
+}
+
+void DbPointRecord::visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  this->visitPointsInRange(identifierForHandle(handle), startTime, endTime, visitor);
+}
+
+void DbPointRecord::addPoint(handle_t handle, Point point) {
+  this->addPoint(identifierForHandle(handle), point);
+}
+
+void DbPointRecord::addPoints(handle_t handle, const std::vector<Point>& points) {
+  this->addPoints(identifierForHandle(handle), points);
+}
+
+
 /*
 Point DbPointRecord::firstPoint(const string& id) {
   
@@ -277,7 +2154,7 @@ void DbPointRecord::fetchPrevious(const std::string& id, time_t time) {
 void DbPointRecord::preFetchRange(const string& id, time_t start, time_t end) {
   // TODO -- performance optimization - caching -- see OdbcPointRecord.cpp for code snippets.
   // get out if we've already hinted this.
-
+  
   time_t first = DB_PR_SUPER::firstPoint(id).time;
   time_t last = DB_PR_SUPER::lastPoint(id).time;
   if (first <= start && end <= last) {
@@ -290,10 +2167,10 @@ void DbPointRecord::preFetchRange(const string& id, time_t start, time_t end) {
   // re-populate base class with new hinted range
   time_t margin = 60*60;
   
-  cout << "RTX-DB-FETCH: " << id << " :: " << start << " - " << end << endl;
+  RTX_LOG(debug, "DbPointRecord", "fetching " << id << " :: " << start << " - " << end);
   
   vector<Point> newPoints = selectRange(id, start - margin, end + margin);
-
+  
   //cout << "RTX-DB-FETCH: " << id << " :: DONE" << endl;
   
   DB_PR_SUPER::addPoints(id, newPoints);
@@ -14,54 +14,238 @@
 #include "MapPointRecord.h"
 #include "BufferPointRecord.h"
 #include "rtxExceptions.h"
+#include "Tracer.h"
+#include "Metrics.h"
+#include "RuntimeContext.h"
+
+#include <iostream>
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 
 namespace RTX {
   
   /*! \class DbPointRecord
    \brief A persistence layer for databases
-   
+  
    Base class for database-connected PointRecord classes.
-   
+  
+   Points read from the database are cached in the base-class buffer, and DbPointRecord keeps a per-series index of
+   the time ranges it has fetched (including ranges that turned out to be empty). Reads are answered from the cache
+   wherever the index says it's complete, and only the uncovered sub-ranges go to the database.
+  
+   Near the live edge that isn't safe forever: new data may still be arriving for the last few minutes. Anything
+   fetched within the live window of the current (wall-clock) time is only trusted for the live TTL, then asked for
+   again. Historical ranges, empty or not, are never re-queried.
+  
+   Only one query is ever in flight for any stretch of a series: a thread that misses on a range another thread is
+   already selecting waits for that query and shares its result, and only selects whatever is left over itself.
+  
+   An optional local store (typically an MmapPointRecord) sits between the in-memory cache and the database: every
+   range fetched from the database is written through to it, along with the fact that the range was fetched, so
+   what's been pulled once can be served again -- even after a restart -- without going back to the server. Reads
+   go cache, then local store, then database, and fill each tier on the way back up.
+  
+   summaries() over a range the cache doesn't already cover is pushed down to the database where the subclass supports
+   it (selectAggregatedRange), so only one row per bucket comes back over the wire. Those buckets aren't cached.
+  
+   prefetchRange() and prefetch() fill the cache for many series at once. Subclasses that can select several series
+   in a single query override selectRanges(); the results are fanned out into each series' buffer.
+  
+   prefetchRangeAsync() and prefetchAsync() do the same on the i/o threads of the record's Scheduler (see
+   RuntimeContext), and return at once with a fetchFuture_t to wait on; fetchRangeAsync() also has the future hold the
+   points. Several fetches can be in flight together -- up to ioThreadCount(), each on its own pooled connection
+   -- and a point() or pointsInRange() that misses on a range being fetched waits for that fetch rather than asking
+   again. Subclasses must call stopFetching() in their destructors, as they do setWriteBehind(false).
+  
+   With write-behind on, inserts go into a bounded queue and a background thread writes them in batches through
+   insertRanges(). Reads of a series wait for its queued writes, and flush() waits for all of them. Subclasses must
+   call setWriteBehind(false) in their destructors, so the queue is drained while the connection still exists.
+  
+   selectUncached() and insertBulk() go around the cache, for history moved in or out wholesale (see
+   HistorianImport): what they select isn't cached, and what they insert goes to the db in one insertRanges.
+  
+   A range too long to hold can be streamed instead: visitUncached() selects it a chunk of streamingChunkSize()
+   points at a time, each chunk starting after the last one's final time, and visits each before selecting the
+   next, so memory stays bounded however long the range is. No connection is leased while the visitor runs, so it
+   may read the db itself. Where the subclass can't limit a select (selectChunk), each chunk is a run of time
+   slices, each sized from the density of the last, until about half a chunk has come back. With a streaming threshold set,
+   visitPointsInRange() streams any range at least that long that the cache doesn't already cover -- which is how a
+   long evaluation reads a series through a visitor without the whole of it landing in the cache.
+  
+   Every call into the backend is traced: its latency, the rows it returned or wrote, and roughly how many bytes
+   those were (at the subclass' rowBytes() a row), summed by kind of query and by series -- queryStats() and
+   queryStatsBySeries(). A batched query's time is shared out evenly among its series. Queries slower than the
+   setSlowQueryLog() threshold are also written out, one line apiece, with the series and range they asked for.
+   Given a Metrics registry, each query's latency also goes into its rtx_db_query_seconds histogram.
+  
+   Connecting can be put off: connectInBackground() starts connect() on its own thread, so that several records can
+   connect at once while the caller gets on with something else, and connectOnFirstUse() leaves it until the db is
+   first needed. Either way, anything that uses the db first waits for that connection. Subclasses must call
+   cancelConnect() in their destructors, as they do setWriteBehind(false), and call ensureConnected() wherever they
+   use the db outside a connectionLease_t or check their connection (isConnected).
+  
+   A snapshot of the cache (writeSnapshot) carries its coverage too, so once restored the cached ranges are answered
+   without asking the db again. Whatever was in the live window is re-queried at first use, however long ago that was.
+  
    */
   
   class DbPointRecord : public DB_PR_SUPER {
   public:
-    
+  
     RTX_SHARED_POINTER(DbPointRecord);
     DbPointRecord();
-    virtual ~DbPointRecord() {};
-    
-    
-    
+    virtual ~DbPointRecord();
+  
+  
+  
     // end of the road for these guys
     Point point(const string& id, time_t time);
     Point pointBefore(const string& id, time_t time);
     Point pointAfter(const string& id, time_t time);
     std::vector<Point> pointsInRange(const string& id, time_t startTime, time_t endTime);
+    void visitPointsInRange(const string& id, time_t startTime, time_t endTime, PointVisitor& visitor);
     void addPoint(const string& id, Point point);
-    void addPoints(const string& id, std::vector<Point> points);
+    void addPoints(const string& id, const std::vector<Point>& points);
+    std::vector<PointSummary> summaries(const std::string& id, time_t startTime, time_t endTime, time_t resolution);
     void reset();
     void reset(const string& id);
+    void writeSnapshot(std::ostream& stream); //! flushes queued writes first, and adds what's been fetched of each series
+    bool readSnapshot(std::istream& stream);
     //Point firstPoint(const string& id);
     //Point lastPoint(const string& id);
-    
-    
-    
+  
+    // handles go back through the named methods, so that the db gets a chance at them
+    Point point(handle_t handle, time_t time);
+    Point pointBefore(handle_t handle, time_t time);
+    Point pointAfter(handle_t handle, time_t time);
+    std::vector<Point> pointsInRange(handle_t handle, time_t startTime, time_t endTime);
+    void visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor);
+    void addPoint(handle_t handle, Point point);
+    void addPoints(handle_t handle, const std::vector<Point>& points);
+  
+  
+  
     // pointRecord methods to override
     virtual std::string registerAndGetIdentifier(std::string recordName)=0;
     virtual std::vector<std::string> identifiers()=0;
-    
+  
     // db connection
     void setConnectionString(const std::string& connection);
     const std::string& connectionString();
     virtual void connect() throw(RtxException){};
     virtual bool isConnected(){return true;};
-    
+    void connectInBackground(); //! connect() on a thread of its own. the first use of the db waits for it to finish
+    void connectOnFirstUse();   //! connect() when the db is first used, and not before
+  
     // db searching prefs
     void setSearchDistance(time_t time);
     time_t searchDistance();
-        
-    
+    void setReadAheadWindow(time_t minimum, time_t maximum); //! bounds on how much point() fetches per cache miss
+    PointRecord::time_pair_t readAheadWindow();
+    void setLiveEdge(time_t window, time_t ttl); //! fetches within window seconds of now are re-queried after ttl seconds. a window of 0 trusts everything
+    PointRecord::time_pair_t liveEdge();
+  
+    // batched fetching
+    typedef std::map<std::string, std::vector<Point> > keyedPoints_t;
+    void prefetchRange(const std::vector<std::string>& ids, time_t startTime, time_t endTime);
+    void prefetch(const std::vector<std::string>& ids, time_t time);
+  
+    /*!
+     \class fetchFuture_t
+     \brief The result of an asynchronous fetch, once it comes.
+  
+     Copies share the one result. wait() blocks until the fetch has run, and get() then has the points it was asked
+     for, by series -- or throws an RtxException saying what went wrong. A default-constructed future is ready,
+     with nothing in it.
+     */
+    class fetchFuture_t {
+    public:
+      fetchFuture_t();
+      bool isReady() const;
+      void wait() const;
+      const keyedPoints_t& get() const throw(RtxException);
+    private:
+      friend class DbPointRecord;
+      class state_t {
+      public:
+        state_t() : isDone(false), didFail(false) {};
+        // simple tuple class, so no getters/setters
+        boost::mutex mutex;
+        boost::condition_variable finished;
+        bool isDone, didFail;
+        std::string error;
+        keyedPoints_t points;
+      };
+      boost::shared_ptr<state_t> _state;
+    };
+  
+    // asynchronous fetching, on the i/o threads
+    fetchFuture_t fetchRangeAsync(const std::vector<std::string>& ids, time_t startTime, time_t endTime); //! prefetchRange, and then each series' points in the range
+    fetchFuture_t prefetchRangeAsync(const std::vector<std::string>& ids, time_t startTime, time_t endTime); //! prefetchRange. there's nothing to get, just the wait
+    fetchFuture_t prefetchAsync(const std::vector<std::string>& ids, time_t time); //! prefetch. nothing to get, either
+    void setIoThreadCount(size_t count); //! how many fetches run at once. 0 (the default) is one per pooled connection
+    size_t ioThreadCount();
+    void setRuntime(RuntimeContext::sharedPointer runtime); //! whose i/o threads run the fetches. the default context, otherwise
+    RuntimeContext::sharedPointer runtime();
+  
+    // bulk transfer, around the cache: history going in or coming out wholesale, not to be read back through here
+    std::vector<Point> selectUncached(const std::string& id, time_t startTime, time_t endTime); //! straight from the db, and not cached
+    void insertBulk(const std::map<std::string, std::vector<Point> >& pointsById); //! straight to the db, as one insertRanges. what's cached of these series is forgotten
+  
+    // streaming, for ranges too long to hold at once
+    void visitUncached(const std::string& id, time_t startTime, time_t endTime, PointVisitor& visitor); //! straight from the db a chunk at a time, and not cached
+    void setStreamingThreshold(time_t seconds); //! visitPointsInRange streams uncached ranges at least this long. 0 (the default) caches them all
+    time_t streamingThreshold();
+    void setStreamingChunkSize(size_t points); //! the most points a streamed range holds at once
+    size_t streamingChunkSize();
+  
+    // write-behind
+    void setWriteBehind(bool enabled, size_t maxQueuedPoints = 100000);
+    bool writeBehind();
+    void flush(); //! blocks until everything queued has been written
+    size_t queuedPoints(); //! queued, and not yet written
+  
+    // tiers
+    void setLocalStore(PointRecord::sharedPointer store); //! a persistent tier between the cache and the db. NULL removes it
+    PointRecord::sharedPointer localStore();
+  
+    // connection pool, for concurrent readers
+    void setConnectionPoolSize(size_t size); //! how many threads may use the db at once. 1 (the default) shares one connection
+    size_t connectionPoolSize();
+    void setConnectionIdleTimeout(time_t seconds); //! pooled connections unused this long are closed. 0 keeps them open
+    time_t connectionIdleTimeout();
+  
+    // query tracing
+    typedef enum {
+      selectRangeQuery,
+      selectNextQuery,
+      selectPreviousQuery,
+      selectRangesQuery,
+      selectAggregatedQuery,
+      insertSingleQuery,
+      insertRangeQuery,
+      insertRangesQuery
+    } queryKind_t;
+    class queryStats_t {
+    public:
+      queryStats_t() : queries(0), rows(0), bytes(0), seconds(0), maximumSeconds(0) {};
+      // simple tuple class, so no getters/setters
+      unsigned long queries;
+      unsigned long rows;     // returned or written
+      unsigned long bytes;    // estimated from the rows
+      double seconds;         // wall time, in all
+      double maximumSeconds;  // and for the slowest one
+    };
+    queryStats_t queryStats(queryKind_t kind);
+    std::map<std::string, queryStats_t> queryStatsBySeries();
+    void resetQueryStats();
+    void setSlowQueryLog(double seconds, std::ostream& log = std::cerr); //! queries slower than this are logged. 0 (the default) logs none
+    double slowQueryThreshold();
+    std::ostream& queryStatsToStream(std::ostream& stream); //! a line per kind of query, then the busiest series
+    static std::string queryName(queryKind_t kind);
+    void setMetrics(Metrics::sharedPointer metrics, const std::string& name); //! labels the latencies observed with record=name
+  
+  
     //exceptions specific to this class family
     class RtxDbConnectException : public RtxException {
     public:
@@ -72,42 +256,258 @@ namespace RTX {
       virtual const char* what() const throw()
       { return "Could not retrieve data.\n"; }
     };
-    
+  
   protected:
     // fetch means cache the results
     // these have obvious default implementations, but you can override them also.
     //virtual void fetchRange(const std::string& id, time_t startTime, time_t endTime);
     //virtual void fetchNext(const std::string& id, time_t time);
     //virtual void fetchPrevious(const std::string& id, time_t time);
-    
+  
     // select just returns the results
     virtual std::vector<Point> selectRange(const std::string& id, time_t startTime, time_t endTime)=0;
     virtual Point selectNext(const std::string& id, time_t time)=0;
     virtual Point selectPrevious(const std::string& id, time_t time)=0;
-    
+  
+    // several series over one window. the default just loops over selectRange.
+    virtual keyedPoints_t selectRanges(const std::vector<std::string>& ids, time_t startTime, time_t endTime);
+  
+    // the first points of a range in time order, and the time they're complete through: every point the range has
+    // up to then is in the chunk. a backend that can limit a select takes at most maxPoints; the default can't, so it
+    // walks the range in time slices through selectRange.
+    virtual time_t selectChunk(const std::string& id, time_t startTime, time_t endTime, size_t maxPoints, std::vector<Point>& chunk);
+    static time_t completeChunk(std::vector<Point>& chunk, time_t endTime, size_t maxPoints); //! for selectChunk: trims a limited select back to whole times, and says how far it got
+  
+    // buckets summarized by the db itself. return false if the backend can't, and the raw points are summarized here instead.
+    virtual bool selectAggregatedRange(const std::string& id, time_t startTime, time_t endTime, time_t bucket, std::vector<PointSummary>& summaries);
+  
     // insertions or alterations may choose to ignore / deny
     virtual void insertSingle(const std::string& id, Point point)=0;
-    virtual void insertRange(const std::string& id, std::vector<Point> points)=0;
+    virtual void insertRange(const std::string& id, const std::vector<Point>& points)=0;
+    virtual void insertRanges(const std::map<std::string, std::vector<Point> >& pointsById); //! a write-behind batch. the default loops over insertRange.
     virtual void removeRecord(const std::string& id)=0;
     virtual void truncate()=0;
-    
-    class request_t {
+    virtual size_t rowBytes(queryKind_t kind); //! about how big one row of this kind of query is on the wire. a timestamp and a value by default
+  
+    //! times one call into the backend and counts its rows, for queryStats() and the slow-query log (and stats(), if
+    //! it's a select). hold one around each select and insert.
+    class queryTrace_t : boost::noncopyable {
+    public:
+      queryTrace_t(DbPointRecord& record, queryKind_t kind, const std::string& id, time_t startTime = 0, time_t endTime = 0);
+      queryTrace_t(DbPointRecord& record, queryKind_t kind, const std::vector<std::string>& ids, time_t startTime = 0, time_t endTime = 0);
+      ~queryTrace_t();
+      void rows(size_t count); //! how many rows the query returned or wrote
+      void rows(const std::string& id, size_t count); //! and, for a batch, how many of them were this series'
+    private:
+      DbPointRecord& _record;
+      queryKind_t _kind;
+      std::map<std::string, size_t> _rows; // by series
+      time_t _startTime, _endTime;
+      double _started;
+      boost::scoped_ptr<QueryTimer> _timer;
+      Tracer::Span _span;
+    };
+  
+    /*!
+     \class coverage_t
+     \brief The set of time ranges that have already been fetched from the database for one series.
+  
+     Ranges are closed intervals, kept sorted and merged. A covered time with no point in the cache is known to have
+     no point in the database either, so it won't be asked for again -- unless it's in the provisional tail, which
+     expire() forgets once it's older than the ttl.
+     */
+    class coverage_t {
+    public:
+      coverage_t();
+      void add(time_t start, time_t end);
+      void clip(time_t start, time_t end); //! forget anything outside [start,end]
+      void clear();
+      bool contains(time_t time) const;
+      bool covers(time_t start, time_t end) const;
+      bool extentContaining(time_t time, PointRecord::time_pair_t& extent) const;
+      std::vector<PointRecord::time_pair_t> gaps(time_t start, time_t end) const;
+      std::vector<PointRecord::time_pair_t> ranges() const;
+      void markProvisional(time_t from, time_t fetchedAt); //! coverage from here on may still change
+      void expire(time_t now, time_t ttl);
+      unsigned long evictions; //! the cache's eviction count when this was last reconciled
+    private:
+      std::map<time_t, time_t> _ranges; // start -> end
+      bool _provisional;
+      time_t _provisionalFrom, _provisionalFetched;
+    };
+  
+    /*!
+     \class readAhead_t
+     \brief Per-series access-pattern tracking, for sizing the fetch window on a cache miss.
+  
+     Consecutive misses that keep moving the same way (an extended-period run, or stepping back through history)
+     double the window each time, and point it in the direction of travel. A miss that jumps elsewhere is treated as
+     random access, and only fetches a small window around the requested time.
+     */
+    class readAhead_t {
+    public:
+      readAhead_t();
+      PointRecord::time_pair_t windowForMiss(time_t time, time_t minimum, time_t maximum);
+    private:
+      time_t _lastMiss;
+      time_t _lastSize;
+      int _direction; // +1 forward, -1 backward, 0 random
+      int _streak;
+    };
+  
+    coverage_t& coverage(const std::string& id); //! reconciled with whatever the cache has dropped. caller holds _cacheMutex
+    std::vector<Point> fetchRange(const std::string& id, time_t startTime, time_t endTime);
+    std::vector<Point> selectCoalesced(const std::string& id, time_t startTime, time_t endTime); //! selectRange, sharing any overlapping query in flight
+    void waitForWrites(const std::string& id); //! until this series has nothing queued for writing
+  
+    /*!
+     \class connection_t
+     \brief One pooled database connection, with its own prepared statements and bound buffers.
+  
+     Subclasses derive from this to hold whatever one connection to their backend needs, and return new ones from
+     openConnection(). Every select/insert call is made under a connectionLease_t: inside it, leasedConnection() is
+     the connection this thread checked out, or NULL if it's using the subclass' own (primary) connection.
+     */
+    class connection_t {
+    public:
+      virtual ~connection_t() {};
+    };
+    typedef boost::shared_ptr<connection_t> connectionPointer_t;
+    virtual connectionPointer_t openConnection(); //! the default opens nothing, so all callers share the primary
+    connection_t* leasedConnection();
+    void closeConnections(); //! drop pooled connections, e.g. after reconnecting the primary
+  
+    //! scoped check-out of a connection for the calling thread. nests.
+    class connectionLease_t {
     public:
-      PointRecord::time_pair_t range;
-      std::string id;
-      request_t(std::string id, time_t start, time_t end);
-      bool contains(std::string id, time_t t);
+      connectionLease_t(DbPointRecord& record);
+      ~connectionLease_t();
+    private:
+      DbPointRecord& _record;
     };
-    request_t request;
-    
-    
+  
+    void ensureConnected(); //! runs a connect put off until first use, or waits for one in the background. leases call it
+    void stopFetching();    //! for subclass destructors: waits for the async fetches running, and fails those still queued
+    void cancelConnect();   //! for subclass destructors: forgets a connect put off, and waits for one running
+  
+    boost::recursive_mutex _connectionMutex; //! guards the primary connection
+    boost::recursive_mutex _cacheMutex;      //! guards the coverage and read-ahead bookkeeping
+    void noteLiveEdge(coverage_t& c, time_t start, time_t end); //! caller holds _cacheMutex
+    std::vector<Point> cacheFetched(const std::string& id, time_t startTime, time_t endTime, const std::vector<PointRecord::time_pair_t>& gaps, const std::vector<Point>& fetched);
+    std::vector<Point> cacheFetchedLocked(const std::string& id, time_t startTime, time_t endTime, const std::vector<PointRecord::time_pair_t>& gaps, const std::vector<Point>& fetched); //! caller holds _cacheMutex
+    void cachedFetch(const std::string& id, const Point& point, time_t coveredStart, time_t coveredEnd);
+  
+  
   private:
     std::string _connectionString;
     time_t _searchDistance;
-    
-    
+    std::map<std::string, coverage_t> _coverage;
+    std::map<std::string, readAhead_t> _readAhead;
+    readAhead_t _batchReadAhead; // prefetch() walks all of its series together
+  
+    // local store tier. its coverage is kept in a companion series in the store itself, one point per range.
+    PointRecord::sharedPointer _localStore;
+    std::map<std::string, coverage_t> _localCoverage;
+    coverage_t& localCoverage(const std::string& id); // caller holds _cacheMutex. loaded from the store the first time
+    std::vector<Point> selectThroughLocal(const std::string& id, time_t startTime, time_t endTime);
+    std::vector<Point> localPoints(const std::string& id, time_t startTime, time_t endTime, const std::vector<PointRecord::time_pair_t>& gaps);
+    void storeLocally(const std::string& id, time_t startTime, time_t endTime, const std::vector<Point>& points);
+    static std::string localCoverageId(const std::string& id);
+  
+    // in-flight selects, for coalescing
+    class flight_t {
+    public:
+      flight_t(time_t s, time_t e) : start(s), end(e), landed(false), failed(false) {};
+      time_t start, end;
+      bool landed, failed;
+      std::vector<Point> points;
+    };
+    typedef boost::shared_ptr<flight_t> flightPointer_t;
+    static bool flightStartsBefore(const flightPointer_t& left, const flightPointer_t& right);
+    flightPointer_t launchFlight(const std::string& id, time_t start, time_t end); // caller holds _flightMutex
+    void landFlight(const std::string& id, flightPointer_t flight, const std::vector<Point>& points, bool failed = false);
+    std::multimap<std::string, flightPointer_t> _flights;
+    boost::mutex _flightMutex;
+    boost::condition_variable _flightLanded;
+  
+    // write-behind queue
+    void queueWrite(const std::string& id, const std::vector<Point>& points);
+    void writeQueuedPoints(); // the writer thread
+    bool _writeBehind, _stopWriting;
+    size_t _writeQueueCapacity, _queuedPoints; // in points
+    std::map<std::string, std::vector<Point> > _writeQueue;
+    std::map<std::string, size_t> _pendingById; // queued or being written
+    boost::mutex _writeQueueMutex;
+    boost::condition_variable _writeQueueChanged;
+    boost::shared_ptr<boost::thread> _writeThread;
+  
+    // async fetches
+    class asyncFetch_t {
+    public:
+      // simple tuple class, so no getters/setters
+      std::vector<std::string> ids;
+      bool isRange, keepsPoints; // prefetchRange (and the points, or not), or else prefetch
+      time_t startTime, endTime; // the range, or prefetch's time as both
+      fetchFuture_t future;
+    };
+    fetchFuture_t queueFetch(const asyncFetch_t& fetch);
+    void runFetches(); // on an i/o thread, until the queue's empty
+    std::deque<asyncFetch_t> _fetchQueue;
+    RuntimeContext::sharedPointer _runtime;
+    size_t _ioThreadCount, _runningFetchers; // fetchers handed to the scheduler, and not yet finished
+    bool _stopFetching;
+    boost::mutex _fetchQueueMutex;
+    boost::condition_variable _fetcherFinished;
+  
+    // deferred connection
+    typedef enum {
+      noConnectPending,
+      connectOnUse,
+      connectRunning
+    } connectState_t;
+    boost::atomic<int> _connectState; // a connectState_t. read without the lock, for the leases' fast path
+    boost::thread::id _connectingThread;
+    boost::shared_ptr<boost::thread> _connectThread;
+    boost::mutex _connectMutex;
+    boost::condition_variable _connectFinished;
+    void runConnect(); // the background thread
+  
+    // connection pool
+    class leaseState_t {
+    public:
+      leaseState_t() : depth(0), holdsPrimary(false), generation(0) {};
+      int depth;
+      bool holdsPrimary;
+      connectionPointer_t connection;
+      unsigned long generation;
+    };
+    boost::thread_specific_ptr<leaseState_t> _lease;
+    void checkOutConnection();
+    void checkInConnection();
+    size_t _poolSize, _pooledConnections; // the primary isn't counted in _pooledConnections
+    time_t _idleTimeout;
+    unsigned long _poolGeneration;
+    std::deque<std::pair<connectionPointer_t, time_t> > _idleConnections; // with the time each was checked in
+    boost::mutex _poolMutex;
+    boost::condition_variable _poolChanged;
+    time_t _readAheadMinimum, _readAheadMaximum;
+    time_t _liveWindow, _liveTTL;
+    time_t _streamingThreshold;
+    size_t _streamingChunkSize;
+  
+    // query tracing
+    std::vector<queryStats_t> _queryStats; // by queryKind_t
+    std::map<std::string, queryStats_t> _seriesQueryStats;
+    double _slowQueryThreshold;
+    std::ostream* _slowQueryLog;
+    Metrics::sharedPointer _metrics;
+    std::string _metricsName;
+    boost::mutex _queryStatsMutex;
+    void traceQuery(queryKind_t kind, const std::map<std::string, size_t>& rows, time_t startTime, time_t endTime, double seconds);
+  
+  
   };
-
+  
   
 }
 
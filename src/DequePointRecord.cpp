@@ -9,12 +9,17 @@
 #include <iostream>
 
 #include "DequePointRecord.h"
+#include "Log.h"
 #include <boost/foreach.hpp>
 #include <boost/range/adaptors.hpp>
+#include <boost/thread/locks.hpp>
 
 using namespace RTX;
 using namespace std;
 
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
 
 DequePointRecord::DequePointRecord() {
 }
@@ -28,8 +33,18 @@ std::ostream& DequePointRecord::toStream(std::ostream &stream) {
   return stream;
 }
 
+size_t DequePointRecord::seriesMemoryFootprint(const std::string& identifier) {
+  readLock_t lock(_mutex);
+  keyedPointVector_t::const_iterator it = _points.find(identifier);
+  if (it == _points.end()) {
+    return 0;
+  }
+  return it->second.size() * sizeof(Point); // give or take the last, part-filled chunk
+}
+
 
 std::string DequePointRecord::registerAndGetIdentifier(std::string recordName) {
+  writeLock_t lock(_mutex);
   
   // check to see if it's there first
   if (_points.find(recordName) == _points.end()) {
@@ -42,6 +57,7 @@ std::string DequePointRecord::registerAndGetIdentifier(std::string recordName) {
 
 std::vector<std::string> DequePointRecord::identifiers() {
   
+  readLock_t lock(_mutex);
   vector<string> names;
   BOOST_FOREACH(string name, _points | boost::adaptors::map_keys) {
     names.push_back(name);
@@ -51,10 +67,7 @@ std::vector<std::string> DequePointRecord::identifiers() {
 
 
 Point DequePointRecord::point(const string& identifier, time_t time) {
-  if (_cachedPoint.time == time && RTX_STRINGS_ARE_EQUAL_CS(_cachedPointId, identifier) ) {
-    return _cachedPoint;
-  }
-  
+  readLock_t lock(_mutex);
   const pointQ_t& q = pointQueueWithKeyName(identifier);
   
   // find the point in time
@@ -66,17 +79,13 @@ Point DequePointRecord::point(const string& identifier, time_t time) {
     return Point();
   }
   
-  // found point, cache it.
-  _cachedPoint = (*qIt);
-  _cachedPointId = identifier;
-  
   // times don't match, so NO
   if (qIt->time != time ) {
     return Point();
     //return pointBefore(identifier, time);
   }
   else {
-    return _cachedPoint;
+    return (*qIt);
   }
   
 }
@@ -95,7 +104,7 @@ Point DequePointRecord::point(const string& identifier, time_t time) {
 */
 
 Point DequePointRecord::pointBefore(const string& identifier, time_t time) {
-  
+  readLock_t lock(_mutex);
   pointQ_t& q = pointQueueWithKeyName(identifier);
   
   Point finder(time,0);
@@ -109,7 +118,7 @@ Point DequePointRecord::pointBefore(const string& identifier, time_t time) {
     Point p = (*qIt);
     
     if (p.time < 0) {
-      cerr << "whoops" << endl;
+      RTX_LOG(warning, "DequePointRecord", "whoops");
     }
     
     return p;
@@ -122,6 +131,7 @@ Point DequePointRecord::pointBefore(const string& identifier, time_t time) {
 
 
 Point DequePointRecord::pointAfter(const string& identifier, time_t time) {
+  readLock_t lock(_mutex);
   const pointQ_t& q = pointQueueWithKeyName(identifier);
   
   Point finder(time,0);
@@ -138,6 +148,7 @@ Point DequePointRecord::pointAfter(const string& identifier, time_t time) {
 
 std::vector<Point> DequePointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
   std::vector<Point> pointVector;
+  readLock_t lock(_mutex);
   
   const pointQ_t& q = pointQueueWithKeyName(identifier);
   
@@ -155,6 +166,7 @@ std::vector<Point> DequePointRecord::pointsInRange(const string& identifier, tim
 
 Point DequePointRecord::firstPoint(const string &id) {
   Point p;
+  readLock_t lock(_mutex);
   const pointQ_t& q = pointQueueWithKeyName(id);
   
   if (q.empty()) {
@@ -168,6 +180,7 @@ Point DequePointRecord::firstPoint(const string &id) {
 
 Point DequePointRecord::lastPoint(const string &id) {
   Point p;
+  readLock_t lock(_mutex);
   const pointQ_t& q = pointQueueWithKeyName(id);
   
   if (q.empty()) {
@@ -181,6 +194,7 @@ Point DequePointRecord::lastPoint(const string &id) {
 
 
 void DequePointRecord::addPoint(const string& identifier, Point point) {
+  writeLock_t lock(_mutex);
   pointQ_t &q = pointQueueWithKeyName(identifier);
   
   q.push_back(point);
@@ -190,29 +204,30 @@ void DequePointRecord::addPoint(const string& identifier, Point point) {
 }
 
 
-void DequePointRecord::addPoints(const string& identifier, std::vector<Point> points) {
+void DequePointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
   
   if (points.size() == 0) {
     return;
   }
+  writeLock_t lock(_mutex);
   // adding new range. clear old cache.
-  DequePointRecord::reset(identifier);
-  
-  BOOST_FOREACH(Point thePoint, points) {
-    DequePointRecord::addPoint(identifier, thePoint);
-  }
+  pointQ_t &q = pointQueueWithKeyName(identifier);
+  q.assign(points.begin(), points.end());
+  std::stable_sort(q.begin(), q.end(), &Point::comparePointTime);
 }
 
 
 void DequePointRecord::reset() {
-  cout << "warning: resetting entire point record" << endl;
+  RTX_LOG(info, "DequePointRecord", "resetting entire point record");
   typedef keyedPointVector_t::value_type& keyedPointVecValue;
+  writeLock_t lock(_mutex);
   BOOST_FOREACH(keyedPointVecValue pointMapValue, _points) {
     pointMapValue.second.clear();
   }
 }
 
 void DequePointRecord::reset(const string& identifier) {
+  writeLock_t lock(_mutex);
   pointQ_t &q = pointQueueWithKeyName(identifier);
   q.clear();
 }
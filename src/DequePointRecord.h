@@ -20,6 +20,8 @@
 #include "rtxExceptions.h"
 #include "PointRecord.h"
 
+#include <boost/thread/shared_mutex.hpp>
+
 using std::string;
 
 namespace RTX {
@@ -40,11 +42,12 @@ namespace RTX {
     virtual Point pointAfter(const string& identifier, time_t time);
     virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
     virtual void addPoint(const string& identifier, Point point);
-    virtual void addPoints(const string& identifier, std::vector<Point> points);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
     virtual void reset();
     virtual void reset(const string& identifier);
     virtual Point firstPoint(const string& id);
     virtual Point lastPoint(const string& id);
+    virtual size_t seriesMemoryFootprint(const std::string& identifier);
     
     virtual std::ostream& toStream(std::ostream &stream);
 
@@ -54,6 +57,7 @@ namespace RTX {
     
   private:
     keyedPointVector_t _points;
+    boost::shared_mutex _mutex; // readers share it, writers get it alone
     // private methods
     pointQ_t& pointQueueWithKeyName(const std::string& name);
     
@@ -7,17 +7,18 @@
 //  
 
 #include "Element.h"
+#include "Log.h"
 
 using namespace RTX;
 
-Element::Element(const std::string& name) {
+Element::Element(const std::string& name) : _index(0) {
   setName(name);
 }
 Element::~Element() {
   
 }
 
-std::string Element::name() {
+const std::string& Element::name() {
   return _name;
 }
 
@@ -25,6 +26,14 @@ void Element::setName(const std::string& name) {
   _name = name;
 }
 
+void Element::setIndex(int index) {
+  _index = index;
+}
+
+int Element::index() const {
+  return _index;
+}
+
 Element::element_t Element::type() {
   return _type;
 }
@@ -34,5 +43,5 @@ void Element::setType(element_t type) {
 }
 
 void Element::setRecord(PointRecord::sharedPointer record) {
-  std::cerr << "base class called! error!" << std::endl;
+  RTX_LOG(error, "Element", "base class called! error!");
 }
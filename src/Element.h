@@ -31,7 +31,9 @@ namespace RTX {
     RTX_SHARED_POINTER(Element);
     element_t type();
     void setName(const std::string& newName);
-    std::string name();
+    const std::string& name();
+    void setIndex(int index);   //! where the simulation engine keeps this element; the model sets it when it loads
+    int index() const;          //! 0 until a model has bound it
     virtual void setRecord(PointRecord::sharedPointer record);
   
   protected:
@@ -42,6 +44,7 @@ namespace RTX {
   private:
     std::string _name;
     element_t _type;
+    int _index;
   };
 }
 
@@ -0,0 +1,267 @@
+//
+//  EnergyAccounting.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include "EnergyAccounting.h"
+#include "Junction.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+// as the engine's getenergy: kw = head (ft) * flow (cfs) * specific gravity / 8.814 / efficiency * kw per hp
+#define RTX_KW_PER_CFS_FOOT (0.7457 / 8.814)
+
+namespace {
+  // efficiency (%) on a curve, without extrapolating past its ends -- as the engine's interp
+  double interpolate(const Pump::curve_t& curve, double flow) {
+    if (flow <= curve.front().first) {
+      return curve.front().second;
+    }
+    for (size_t k = 1; k < curve.size(); ++k) {
+      if (curve[k].first >= flow) {
+        double dx = curve[k].first - curve[k-1].first;
+        if (fabs(dx) < 1.e-6) {
+          return curve[k].second;
+        }
+        return curve[k].second - (curve[k].first - flow) * (curve[k].second - curve[k-1].second) / dx;
+      }
+    }
+    return curve.back().second;
+  }
+
+  // the latest point at or before a time, walking forward through them (index carries on from call to call)
+  double heldValue(const vector<Point>& points, size_t& index, time_t time, double held) {
+    while (index < points.size() && points[index].time <= time) {
+      held = points[index].value;
+      ++index;
+    }
+    return held;
+  }
+}
+
+
+EnergyAccounting::EnergyAccounting(Model::sharedPointer model, size_t threadCount) : _model(model), _patternOrigin(0) {
+  _threadCount = (threadCount > 0) ? threadCount : RTX_MAX(boost::thread::hardware_concurrency(), 1u);
+  _options = model->energyOptions();
+}
+
+Model::sharedPointer EnergyAccounting::model() {
+  return _model;
+}
+
+size_t EnergyAccounting::threadCount() {
+  return _threadCount;
+}
+
+void EnergyAccounting::setPatternOrigin(time_t origin) {
+  _patternOrigin = origin;
+}
+
+time_t EnergyAccounting::patternOrigin() {
+  return _patternOrigin;
+}
+
+void EnergyAccounting::reset() {
+  boost::mutex::scoped_lock lock(_accountsMutex);
+  _accounts.clear();
+  _options = _model->energyOptions();
+}
+
+
+#pragma mark - Totals
+
+EnergyAccounting::Totals EnergyAccounting::totals(const Pump::sharedPointer& pump, time_t start, time_t end) {
+  vector<Pump::sharedPointer> pumps(1, pump);
+  vector<window_t> windows(1, window_t(start, end));
+  return totals(pumps, windows).front().front();
+}
+
+vector<vector<EnergyAccounting::Totals> > EnergyAccounting::totals(const vector<window_t>& windows) {
+  return totals(_model->pumps(), windows);
+}
+
+// the pumps are shared out between threads, each accounting for its own and filling in their rows
+vector<vector<EnergyAccounting::Totals> > EnergyAccounting::totals(const vector<Pump::sharedPointer>& pumps, const vector<window_t>& windows) {
+  vector<vector<Totals> > results(pumps.size(), vector<Totals>(windows.size()));
+  if (pumps.empty() || windows.empty()) {
+    return results;
+  }
+  size_t chunks = RTX_MIN(_threadCount, pumps.size());
+  vector<Scheduler::task_t> tasks;
+  for (size_t i = 0; i < chunks; ++i) {
+    tasks.push_back(boost::bind(&EnergyAccounting::accountPumps, this, &pumps, &windows, i * pumps.size() / chunks, (i + 1) * pumps.size() / chunks, &results));
+  }
+  _model->runtime()->scheduler()->run(tasks, _model->runPriority()); // the calling thread takes a share too
+  return results;
+}
+
+void EnergyAccounting::accountPumps(const vector<Pump::sharedPointer>* pumps, const vector<window_t>* windows, size_t begin, size_t end, vector<vector<Totals> >* results) {
+  time_t start = windows->front().first, until = windows->front().second;
+  BOOST_FOREACH(const window_t& window, *windows) {
+    start = RTX_MIN(start, window.first);
+    until = RTX_MAX(until, window.second);
+  }
+  for (size_t iPump = begin; iPump < end; ++iPump) {
+    const Pump::sharedPointer& pump = (*pumps)[iPump];
+    Account& pumpAccount = account(pump);
+    try {
+      extend(pump, pumpAccount, start, until);
+    } catch (std::exception& e) {
+      RTX_LOG(error, "EnergyAccounting", "could not account for " << pump->name() << ": " << e.what());
+      continue;
+    }
+    for (size_t iWindow = 0; iWindow < windows->size(); ++iWindow) {
+      (*results)[iPump][iWindow] = windowTotals(pumpAccount, (*windows)[iWindow].first, (*windows)[iWindow].second);
+    }
+  }
+}
+
+EnergyAccounting::Account& EnergyAccounting::account(const Pump::sharedPointer& pump) {
+  boost::mutex::scoped_lock lock(_accountsMutex);
+  return _accounts[pump.get()];
+}
+
+EnergyAccounting::Totals EnergyAccounting::windowTotals(const Account& account, time_t start, time_t end) {
+  Totals totals;
+  if (account.times.empty()) {
+    return totals;
+  }
+  start = RTX_MAX(start, account.times.front());
+  end = RTX_MIN(end, account.times.back());
+  if (start >= end) {
+    return totals;
+  }
+
+  // energy, cost and hours from the running totals either end, and the rates since them
+  double kwh[2], cost[2], hours[2];
+  time_t at[2] = {start, end};
+  size_t index[2];
+  for (int k = 0; k < 2; ++k) {
+    size_t i = index[k] = upper_bound(account.times.begin(), account.times.end(), at[k]) - account.times.begin() - 1;
+    double within = (double)(at[k] - account.times[i]) / 3600.;
+    kwh[k] = account.kwh[i] + account.kw[i] * within;
+    cost[k] = account.cost[i] + account.kw[i] * account.price[i] * within;
+    hours[k] = account.hours[i] + (account.isRunning[i] ? within : 0.);
+  }
+  totals.kwh = kwh[1] - kwh[0];
+  totals.cost = cost[1] - cost[0];
+  totals.hours = hours[1] - hours[0];
+
+  // the peak is the only thing that looks at each interval in the window
+  size_t last = (account.times[index[1]] < end) ? index[1] + 1 : index[1];
+  for (size_t i = index[0]; i < last; ++i) {
+    if (account.kw[i] > totals.peakKw) {
+      totals.peakKw = account.kw[i];
+      totals.peakTime = RTX_MAX(account.times[i], start);
+    }
+  }
+  totals.demandCost = totals.peakKw * _options.demandCharge;
+  return totals;
+}
+
+
+#pragma mark - Accounts
+
+// the pump's price at a time: its own (or the network's), times its pattern's multiplier for the period it's in
+double EnergyAccounting::priceAt(const Pump::sharedPointer& pump, time_t time) {
+  const vector<double> multipliers = pump->energyPricePattern();
+  double price = pump->energyPrice();
+  if (multipliers.empty() || _options.patternStep <= 0) {
+    return price;
+  }
+  long length = (long)multipliers.size();
+  long period = (long)floor((double)(time - _patternOrigin + _options.patternStart) / (double)_options.patternStep);
+  long m = period % length;
+  return price * multipliers[(m < 0) ? m + length : m];
+}
+
+// takes the account from start (or where it had got to) up to a result at or past end. a start before the account's
+// own means it's read again from there.
+void EnergyAccounting::extend(const Pump::sharedPointer& pump, Account& account, time_t start, time_t end) {
+  if (!account.times.empty() && start < account.since) {
+    account = Account();
+  }
+  if (!account.isValid || (!account.times.empty() && account.times.back() >= end)) {
+    return;
+  }
+  Junction::sharedPointer from = boost::dynamic_pointer_cast<Junction>(pump->from());
+  Junction::sharedPointer to = boost::dynamic_pointer_cast<Junction>(pump->to());
+  if (!from || !to) {
+    account.isValid = false;
+    return;
+  }
+
+  TimeSeries::sharedPointer flow = pump->flow();
+  time_t since = account.times.empty() ? start : account.times.back();
+  vector<Point> flows;
+  if (account.times.empty()) {
+    account.since = start;
+    // the result the window starts within
+    Point before = flow->point(start);
+    if (before.isValid && before.time < start) {
+      flows.push_back(before);
+      since = before.time;
+    }
+  }
+  vector<Point> more = flow->points(since, end);
+  flows.insert(flows.end(), more.begin(), more.end());
+  if (flows.empty()) {
+    return;
+  }
+  // and the heads either side from there on, each held from its last result
+  vector<Point> fromHeads = from->head()->points(flows.front().time, end);
+  vector<Point> toHeads = to->head()->points(flows.front().time, end);
+  double fromHead = from->head()->point(flows.front().time).value, toHead = to->head()->point(flows.front().time).value;
+  size_t iFrom = 0, iTo = 0;
+
+  UnitConverter toCfs(flow->units(), RTX_CUBIC_FOOT_PER_SECOND);
+  UnitConverter fromHeadToFeet(from->head()->units(), RTX_FOOT), toHeadToFeet(to->head()->units(), RTX_FOOT);
+  const Pump::curve_t curve = pump->efficiencyCurve();
+  const double fixedEfficiency = pump->efficiency();
+  const double specificGravity = _options.specificGravity;
+
+  BOOST_FOREACH(const Point& p, flows) {
+    if (!account.times.empty() && p.time <= account.times.back()) {
+      continue;
+    }
+    fromHead = heldValue(fromHeads, iFrom, p.time, fromHead);
+    toHead = heldValue(toHeads, iTo, p.time, toHead);
+    double q = fabs(p.value);
+    double kw = 0;
+    if (q > 0) {
+      double efficiency = curve.empty() ? fixedEfficiency : interpolate(curve, q);
+      efficiency = std::max(std::min(efficiency, 100.), 1.) / 100.;
+      double head = fabs(toHeadToFeet.convert(toHead) - fromHeadToFeet.convert(fromHead));
+      kw = head * toCfs.convert(q) * specificGravity * RTX_KW_PER_CFS_FOOT / efficiency;
+    }
+
+    if (account.times.empty()) {
+      account.kwh.push_back(0);
+      account.cost.push_back(0);
+      account.hours.push_back(0);
+    }
+    else {
+      size_t i = account.times.size() - 1;
+      double hours = (double)(p.time - account.times[i]) / 3600.;
+      account.kwh.push_back(account.kwh[i] + account.kw[i] * hours);
+      account.cost.push_back(account.cost[i] + account.kw[i] * account.price[i] * hours);
+      account.hours.push_back(account.hours[i] + (account.isRunning[i] ? hours : 0.));
+    }
+    account.times.push_back(p.time);
+    account.kw.push_back(kw);
+    account.price.push_back(priceAt(pump, p.time));
+    account.isRunning.push_back(q > 0 ? 1 : 0);
+  }
+}
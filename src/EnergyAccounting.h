@@ -0,0 +1,105 @@
+//
+//  EnergyAccounting.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_EnergyAccounting_h
+#define epanet_rtx_EnergyAccounting_h
+
+#include <vector>
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+
+#include "rtxMacros.h"
+#include "Model.h"
+#include "Pump.h"
+
+namespace RTX {
+
+  /*!
+   \class EnergyAccounting
+   \brief Pump energy, peak demand and time-of-use cost over any windows, from stored results.
+
+   Works from each pump's stored flow and its end nodes' stored heads, with the pump's efficiency curve and pricing
+   (see Pump) and the network's specific gravity and demand charge (see Model::energyOptions), just as the engine's
+   own energy report does: a pump's power holds from each result to the next, at its efficiency (1-100%) at that
+   flow, and its price is the pump's (or the network's) times its price pattern's multiplier at that time.
+
+   Each pump's account is a run of intervals with running totals, filled in from the stored results the first time a
+   window needs them and carried on from there as later windows reach further -- so a window's energy and cost are
+   two lookups, and only its peak looks at the intervals in it. Pumps are accounted several at once, on the model's
+   Scheduler.
+
+   Price patterns are anchored at the pattern origin (0, the epoch, by default -- so a day-long pattern follows UTC
+   days) plus the network's pattern start. Results should be re-accounted (see reset) if they're simulated again.
+   */
+
+  /*!
+   \fn std::vector<std::vector<EnergyAccounting::Totals> > EnergyAccounting::totals(const std::vector<Pump::sharedPointer>& pumps, const std::vector<window_t>& windows)
+   \brief Each pump's totals over each window, as [pump][window]. A window is [start, end).
+   */
+
+  class EnergyAccounting {
+  public:
+    RTX_SHARED_POINTER(EnergyAccounting);
+
+    class Totals {
+    public:
+      Totals() : kwh(0), peakKw(0), peakTime(0), cost(0), demandCost(0), hours(0) {};
+      // simple tuple class, so no getters/setters
+      double kwh;
+      double peakKw;
+      time_t peakTime;    // when the peak started
+      double cost;        // energy, at the time-of-use price
+      double demandCost;  // the peak, at the demand charge
+      double hours;       // running
+    };
+    typedef std::pair<time_t, time_t> window_t;
+
+    EnergyAccounting(Model::sharedPointer model, size_t threadCount = 0); //! 0 means one thread per hardware core
+    virtual ~EnergyAccounting() {};
+
+    Model::sharedPointer model();
+    size_t threadCount();
+    void setPatternOrigin(time_t origin);
+    time_t patternOrigin();
+
+    Totals totals(const Pump::sharedPointer& pump, time_t start, time_t end);
+    std::vector<std::vector<Totals> > totals(const std::vector<Pump::sharedPointer>& pumps, const std::vector<window_t>& windows);
+    std::vector<std::vector<Totals> > totals(const std::vector<window_t>& windows); //! every pump in the model
+    void reset(); //! forget the accounts, so they're read again from the stored results
+
+  private:
+    // one pump's intervals: the ith runs from times[i] to times[i+1], with running totals at each time.
+    // the last time is the latest result, whose interval isn't known yet.
+    class Account {
+    public:
+      Account() : since(0), isValid(true) {};
+      time_t since;                         // where it was read from
+      std::vector<time_t> times;
+      std::vector<double> kw, price;        // by interval
+      std::vector<unsigned char> isRunning;
+      std::vector<double> kwh, cost, hours; // running, at each time
+      bool isValid;                         // false if the pump's heads can't be found
+    };
+    Account& account(const Pump::sharedPointer& pump);
+    void extend(const Pump::sharedPointer& pump, Account& account, time_t start, time_t end);
+    void accountPumps(const std::vector<Pump::sharedPointer>* pumps, const std::vector<window_t>* windows, size_t begin, size_t end, std::vector<std::vector<Totals> >* results);
+    Totals windowTotals(const Account& account, time_t start, time_t end);
+    double priceAt(const Pump::sharedPointer& pump, time_t time);
+
+    Model::sharedPointer _model;
+    size_t _threadCount;
+    time_t _patternOrigin;
+    Model::EnergyOptions _options;
+    std::map<Pump*, Account> _accounts;
+    boost::mutex _accountsMutex; // just the map -- each account is only filled in by one thread
+  };
+
+}
+
+#endif
@@ -7,9 +7,13 @@
 //  
 
 #include <iostream>
+#include <climits>
+#include <boost/thread/thread.hpp>
 #include "EpanetModel.h"
+#include "Log.h"
 #include "rtxMacros.h"
 #include "CurveFunction.h"
+#include "Tracer.h"
 
 #include "epanet/src/types.h"
 
@@ -17,17 +21,34 @@ using namespace RTX;
 using namespace std;
 
 EpanetModel::EpanetModel() : Model() {
-  // nothing to do, right?
   _modelFile = "";
+  _isBatchingParameters = false;
+  _hasFetchedStates = false;
+  _hydraulicStart = warmStart;
+  _qualityThreads = 1;
+  _hydraulicThreads = 1;
+  _fastHeadloss = false;
+  _isQualityOpen = false;
+  _hasQualityHydraulics = false;
+  _solvedTime = 0;
+  _previousSolvedTime = 0;
+  _project = NULL;
+  ENcheck(ENcreateproject(&_project), "ENcreateproject");
 }
 EpanetModel::~EpanetModel() {
-  
+  if (_isQualityOpen) {
+    ProjectScope project(*this);
+    ENcloseQ();
+  }
+  // closes the network too, if one was loaded
+  ENdeleteproject(_project);
 }
 
 #pragma mark - Loading
 
 void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exception) {
   Units volumeUnits(0);
+  ProjectScope project(*this);
   // base class invocation
   Model::loadModelFromFile(filename);
   
@@ -36,6 +57,8 @@ void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exce
   long enTimeStep;
   
   _modelFile = filename;
+  _solvedFlow.clear();
+  _previousSolvedFlow.clear();
   
   // pointers (which will be reset in the creation loop)
   Pipe::sharedPointer newPipe;
@@ -44,9 +67,14 @@ void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exce
   
   try {
     ENcheck( ENopen((char*)filename.c_str(), (char*)"", (char*)""), "ENopen" );
+    if (!_solverCacheFile.empty()) {
+      ENcheck( ENusesparsefile((char*)_solverCacheFile.c_str()), "ENusesparsefile" );
+    }
     ENcheck( ENgetcount(EN_NODECOUNT, &nodeCount), "ENgetcount EN_NODECOUNT" );
     ENcheck( ENgetcount(EN_TANKCOUNT, &tankCount), "ENgetcount EN_TANKCOUNT" );
     ENcheck( ENgetcount(EN_LINKCOUNT, &linkCount), "ENgetcount EN_LINKCOUNT" );
+    // the nodes by toolkit index, so that links find their end nodes without a name lookup
+    std::vector<Node::sharedPointer> nodesByIndex(nodeCount + 1);
     
     // get units from epanet
     int flowUnitType = 0;
@@ -197,13 +225,14 @@ void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exce
       newJunction->setBaseDemand(demand);
       
       // and keep track of the epanet-toolkit index of this element
-      _nodeIndex[nodeName] = iNode;
+      newJunction->setIndex(iNode);
+      nodesByIndex[iNode] = newJunction;
       
     } // for iNode
     
     // create links
     for (int iLink = 1; iLink <= linkCount; iLink++) {
-      char enLinkName[RTX_MAX_CHAR_STRING], enFromName[RTX_MAX_CHAR_STRING], enToName[RTX_MAX_CHAR_STRING];
+      char enLinkName[RTX_MAX_CHAR_STRING];
       int linkType, enFrom, enTo;
       double length, diameter;
       string linkName;
@@ -216,19 +245,17 @@ void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exce
       ENcheck(ENgetlinkid(iLink, enLinkName), "ENgetlinkid");
       ENcheck(ENgetlinktype(iLink, &linkType), "ENgetlinktype");
       ENcheck(ENgetlinknodes(iLink, &enFrom, &enTo), "ENgetlinknodes");
-      ENcheck(ENgetnodeid(enFrom, enFromName), "ENgetnodeid - enFromName");
-      ENcheck(ENgetnodeid(enTo, enToName), "ENgetnodeid - enToName");
       ENcheck(ENgetlinkvalue(iLink, EN_DIAMETER, &diameter), "ENgetlinkvalue EN_DIAMETER");
       ENcheck(ENgetlinkvalue(iLink, EN_LENGTH, &length), "ENgetlinkvalue EN_LENGTH");
       
       linkName = string(enLinkName);
 
       // get node pointers
-      startNode = nodeWithName(string(enFromName));
-      endNode = nodeWithName(string(enToName));
+      startNode = nodesByIndex[enFrom];
+      endNode = nodesByIndex[enTo];
       
       if (! (startNode && endNode) ) {
-        std::cerr << "could not find nodes for link " << linkName << std::endl;
+        RTX_LOG(error, "EpanetModel", "could not find nodes for link " << linkName);
         throw "nodes not found";
       }
       
@@ -257,7 +284,7 @@ void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exce
           addValve(newValve);
           break;
         default:
-          std::cerr << "could not find pipe type" << std::endl;
+          RTX_LOG(warning, "EpanetModel", "could not find pipe type");
           break;
       } // switch linkType
 
@@ -269,7 +296,11 @@ void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exce
       newPipe->flow()->setUnits(flowUnits());
       
       // keep track of this element index
-      _linkIndex[linkName] = iLink;
+      newPipe->setIndex(iLink);
+      
+      if (newPump) {
+        loadPumpEnergy(newPump, iLink);
+      }
       
     } // for iLink
     
@@ -278,20 +309,71 @@ void EpanetModel::loadModelFromFile(const std::string& filename) throw(std::exce
     ENcheck(ENgettimeparam(EN_HYDSTEP, &enTimeStep), "ENgettimeparam EN_HYDSTEP");
     
     this->setHydraulicTimeStep((int)enTimeStep);
+    ENcheck(ENgettimeparam(EN_QUALSTEP, &enTimeStep), "ENgettimeparam EN_QUALSTEP");
+    this->setQualityTimeStep((int)enTimeStep);
     
+    EnergyOptions energy;
+    ENcheck(ENgetoption(EN_SPECGRAVITY, &energy.specificGravity), "ENgetoption EN_SPECGRAVITY");
+    ENcheck(ENgetoption(EN_DEMANDCHARGE, &energy.demandCharge), "ENgetoption EN_DEMANDCHARGE");
+    ENcheck(ENgettimeparam(EN_PATTERNSTEP, &enTimeStep), "ENgettimeparam EN_PATTERNSTEP");
+    energy.patternStep = (time_t)enTimeStep;
+    ENcheck(ENgettimeparam(EN_PATTERNSTART, &enTimeStep), "ENgettimeparam EN_PATTERNSTART");
+    energy.patternStart = (time_t)enTimeStep;
+    setEnergyOptions(energy);
+    
+    ENcheck(ENsethydassembly((int)_hydraulicThreads, _fastHeadloss ? 1 : 0), "ENsethydassembly");
     ENcheck(ENopenH(), "ENopenH");
     
     ENcheck(ENinitH(10), "ENinitH");
     
   }
   catch(string error) {
-    std::cerr << "ERROR: " << error;
+    RTX_LOG(error, "EpanetModel", "ERROR: " << error);
     throw RtxException(error);
   }
   
 }
 
+// a pump without a curve of its own, or a price pattern, has the network's
+void EpanetModel::loadPumpEnergy(const Pump::sharedPointer& pump, int index) {
+  double curveIndex, price, patternIndex, efficiency;
+  ENcheck(ENgetlinkvalue(index, EN_PUMP_ECURVE, &curveIndex), "ENgetlinkvalue EN_PUMP_ECURVE");
+  ENcheck(ENgetlinkvalue(index, EN_PUMP_ECOST, &price), "ENgetlinkvalue EN_PUMP_ECOST");
+  ENcheck(ENgetlinkvalue(index, EN_PUMP_EPAT, &patternIndex), "ENgetlinkvalue EN_PUMP_EPAT");
+  ENcheck(ENgetoption(EN_GLOBALEFFIC, &efficiency), "ENgetoption EN_GLOBALEFFIC");
+  if (patternIndex <= 0) {
+    ENcheck(ENgetoption(EN_GLOBALPATTERN, &patternIndex), "ENgetoption EN_GLOBALPATTERN");
+  }
+  
+  Pump::curve_t curve;
+  if (curveIndex > 0) {
+    int length;
+    ENcheck(ENgetcurvelen((int)curveIndex, &length), "ENgetcurvelen");
+    for (int iPoint = 1; iPoint <= length; ++iPoint) {
+      double flow, percent;
+      ENcheck(ENgetcurvevalue((int)curveIndex, iPoint, &flow, &percent), "ENgetcurvevalue");
+      curve.push_back(make_pair(flow, percent));
+    }
+  }
+  vector<double> multipliers;
+  if (patternIndex > 0) {
+    int length;
+    ENcheck(ENgetpatternlen((int)patternIndex, &length), "ENgetpatternlen");
+    for (int iPeriod = 1; iPeriod <= length; ++iPeriod) {
+      double multiplier;
+      ENcheck(ENgetpatternvalue((int)patternIndex, iPeriod, &multiplier), "ENgetpatternvalue");
+      multipliers.push_back(multiplier);
+    }
+  }
+  
+  pump->setEfficiencyCurve(curve);
+  pump->setEfficiency(efficiency);
+  pump->setEnergyPrice(price);
+  pump->setEnergyPricePattern(multipliers);
+}
+
 void EpanetModel::overrideControls() throw(RTX::RtxException) {
+  ProjectScope project(*this);
   // set up counting variables for creating model elements.
   int nodeCount, tankCount;
   
@@ -327,13 +409,81 @@ void EpanetModel::overrideControls() throw(RTX::RtxException) {
     }
   }
   catch(string error) {
-    std::cerr << "ERROR: " << error;
+    RTX_LOG(error, "EpanetModel", "ERROR: " << error);
     throw RtxException();
   }
   // base class implementation
   Model::overrideControls();
 }
 
+#pragma mark - Hydraulic Start
+
+void EpanetModel::setHydraulicStart(hydraulicStart_t start) {
+  _hydraulicStart = start;
+  // a prediction only extrapolates solutions that were warm-started in turn
+  _solvedFlow.clear();
+  _previousSolvedFlow.clear();
+}
+
+EpanetModel::hydraulicStart_t EpanetModel::hydraulicStart() {
+  return _hydraulicStart;
+}
+
+#pragma mark - Solver Cache
+
+void EpanetModel::setSolverCacheFile(const std::string& path) {
+  _solverCacheFile = path;
+}
+
+std::string EpanetModel::solverCacheFile() {
+  return _solverCacheFile;
+}
+
+#pragma mark - Quality Threads
+
+void EpanetModel::setQualityThreads(size_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = boost::thread::hardware_concurrency();
+  }
+  _qualityThreads = RTX_MAX(threadCount, (size_t)1);
+}
+
+size_t EpanetModel::qualityThreads() {
+  return _qualityThreads;
+}
+
+#pragma mark - Hydraulic Assembly
+
+void EpanetModel::setHydraulicThreads(size_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = boost::thread::hardware_concurrency();
+  }
+  _hydraulicThreads = RTX_MAX(threadCount, (size_t)1);
+  setHydraulicAssembly();
+}
+
+size_t EpanetModel::hydraulicThreads() {
+  return _hydraulicThreads;
+}
+
+void EpanetModel::setFastHeadloss(bool fast) {
+  _fastHeadloss = fast;
+  setHydraulicAssembly();
+}
+
+bool EpanetModel::fastHeadloss() {
+  return _fastHeadloss;
+}
+
+// the toolkit takes these up from its next hydraulic solution, so a loaded network is told straight away
+void EpanetModel::setHydraulicAssembly() {
+  if (_modelFile.empty()) {
+    return;
+  }
+  ProjectScope project(*this);
+  ENsethydassembly((int)_hydraulicThreads, _fastHeadloss ? 1 : 0);
+}
+
 #pragma mark - Protected Methods:
 
 std::ostream& EpanetModel::toStream(std::ostream &stream) {
@@ -343,65 +493,152 @@ std::ostream& EpanetModel::toStream(std::ostream &stream) {
   return stream;
 }
 
+Model::sharedPointer EpanetModel::newInstance() {
+  EpanetModel::sharedPointer model(new EpanetModel());
+  // so a clone reads the ordering its original kept
+  model->setSolverCacheFile(_solverCacheFile);
+  model->setQualityThreads(_qualityThreads);
+  model->setHydraulicThreads(_hydraulicThreads);
+  model->setFastHeadloss(_fastHeadloss);
+  return model;
+}
+
 #pragma mark Setters
 
 /* setting simulation parameters */
 
-void EpanetModel::setReservoirHead(const string& reservoir, double level) {
-  setNodeValue(EN_TANKLEVEL, reservoir, level);
+void EpanetModel::setReservoirHead(const Reservoir::sharedPointer& reservoir, double level) {
+  setNodeValue(EN_TANKLEVEL, reservoir->index(), level);
 }
 
-void EpanetModel::setTankLevel(const string& tank, double level) {
-  // just refer to the reservoir method, since in epanet they are the same thing.
-  setReservoirHead(tank, level);
+void EpanetModel::setTankLevel(const Tank::sharedPointer& tank, double level) {
+  // same as the reservoir method, since in epanet they are the same thing.
+  setNodeValue(EN_TANKLEVEL, tank->index(), level);
 }
 
-void EpanetModel::setJunctionDemand(const string& junction, double demand) {
-  setNodeValue(EN_BASEDEMAND, junction, demand);
+void EpanetModel::setJunctionDemand(const Junction::sharedPointer& junction, double demand) {
+  setNodeValue(EN_BASEDEMAND, junction->index(), demand);
 }
 
-void EpanetModel::setPipeStatus(const string& pipe, Pipe::status_t status) {
-  setLinkValue(EN_STATUS, pipe, status);
+void EpanetModel::setPipeStatus(const Pipe::sharedPointer& pipe, Pipe::status_t status) {
+  setLinkValue(EN_STATUS, pipe->index(), status);
 }
 
-void EpanetModel::setPumpStatus(const string& pump, Pipe::status_t status) {
-  // call the setPipeStatus method, since they are the same in epanet.
-  setPipeStatus(pump, status);
+void EpanetModel::setPumpStatus(const Pump::sharedPointer& pump, Pipe::status_t status) {
+  // same as the setPipeStatus method, since they are the same in epanet.
+  setLinkValue(EN_STATUS, pump->index(), status);
 }
 
-void EpanetModel::setValveSetting(const string& valve, double setting) {
-  setLinkValue(EN_SETTING, valve, setting);
+void EpanetModel::setValveSetting(const Valve::sharedPointer& valve, double setting) {
+  setLinkValue(EN_SETTING, valve->index(), setting);
 }
 
 #pragma mark Getters
 
-double EpanetModel::junctionDemand(const string &junction) {
-  return getNodeValue(EN_DEMAND, junction);
+double EpanetModel::junctionDemand(const Junction::sharedPointer& junction) {
+  return getNodeValue(EN_DEMAND, junction->index());
 }
 
-double EpanetModel::junctionHead(const string &junction) {
-  return getNodeValue(EN_HEAD, junction);
+double EpanetModel::junctionHead(const Junction::sharedPointer& junction) {
+  return getNodeValue(EN_HEAD, junction->index());
 }
 
-double EpanetModel::junctionQuality(const string &junction) {
-  return getNodeValue(EN_QUALITY, junction);
+double EpanetModel::junctionQuality(const Junction::sharedPointer& junction) {
+  return getNodeValue(EN_QUALITY, junction->index());
 }
 
-double EpanetModel::reservoirLevel(const string &reservoir) {
-  return getNodeValue(EN_TANKLEVEL, reservoir);
+double EpanetModel::reservoirLevel(const Reservoir::sharedPointer& reservoir) {
+  return getNodeValue(EN_TANKLEVEL, reservoir->index());
 }
 
-double EpanetModel::tankLevel(const string &tank) {
+double EpanetModel::tankLevel(const Tank::sharedPointer& tank) {
   // no difference in epanet
-  return reservoirLevel(tank);
+  return getNodeValue(EN_TANKLEVEL, tank->index());
+}
+
+double EpanetModel::pipeFlow(const Pipe::sharedPointer& pipe) {
+  return getLinkValue(EN_FLOW, pipe->index());
+}
+
+double EpanetModel::pumpEnergy(const Pump::sharedPointer& pump) {
+  return getLinkValue(EN_ENERGY, pump->index());
+}
+
+
+#pragma mark Whole-Network Transfers
+
+void EpanetModel::setSimulationParameters(time_t time) {
+  ProjectScope project(*this);
+  // the element setters queue their values, which then go to the toolkit a quantity at a time.
+  _isBatchingParameters = true;
+  try {
+    Model::setSimulationParameters(time);
+  } catch (...) {
+    _isBatchingParameters = false;
+    _pendingNodeValues.clear();
+    _pendingLinkValues.clear();
+    throw;
+  }
+  _isBatchingParameters = false;
+  flushPendingValues();
+}
+
+void EpanetModel::saveHydraulicStates(time_t time) {
+  ProjectScope project(*this);
+  // read each result for the whole network at once; the element getters then just index into these.
+  int nodeCount = 0, linkCount = 0;
+  ENcheck(ENgetcount(EN_NODECOUNT, &nodeCount), "ENgetcount EN_NODECOUNT");
+  ENcheck(ENgetcount(EN_LINKCOUNT, &linkCount), "ENgetcount EN_LINKCOUNT");
+  _nodeHead.resize(nodeCount);
+  _nodeDemand.resize(nodeCount);
+  _linkFlow.resize(linkCount);
+  if (nodeCount > 0) {
+    ENcheck(ENgetnodevalues(EN_HEAD, nodeCount, NULL, &_nodeHead[0]), "ENgetnodevalues EN_HEAD");
+    ENcheck(ENgetnodevalues(EN_DEMAND, nodeCount, NULL, &_nodeDemand[0]), "ENgetnodevalues EN_DEMAND");
+  }
+  if (linkCount > 0) {
+    ENcheck(ENgetlinkvalues(EN_FLOW, linkCount, NULL, &_linkFlow[0]), "ENgetlinkvalues EN_FLOW");
+  }
+  
+  _hasFetchedStates = true;
+  try {
+    Model::saveHydraulicStates(time);
+  } catch (...) {
+    _hasFetchedStates = false;
+    throw;
+  }
+  _hasFetchedStates = false;
 }
 
-double EpanetModel::pipeFlow(const string &pipe) {
-  return getLinkValue(EN_FLOW, pipe);
+// the arrays saveHydraulicStates just read, while Model::saveHydraulicStates is gathering from them
+bool EpanetModel::networkStates(NetworkStates& states) {
+  if (!_hasFetchedStates) {
+    return false;
+  }
+  states.nodeCount = (int)_nodeHead.size();
+  states.linkCount = (int)_linkFlow.size();
+  states.head = _nodeHead.empty() ? NULL : &_nodeHead[0];
+  states.demand = _nodeDemand.empty() ? NULL : &_nodeDemand[0];
+  states.flow = _linkFlow.empty() ? NULL : &_linkFlow[0];
+  return true;
 }
 
-double EpanetModel::pumpEnergy(const string &pump) {
-  return getLinkValue(EN_ENERGY, pump);
+void EpanetModel::flushPendingValues() {
+  ProjectScope project(*this);
+  // taken out first, so a failed write doesn't leave them queued for the next step.
+  pendingByCode_t nodeValues, linkValues;
+  nodeValues.swap(_pendingNodeValues);
+  linkValues.swap(_pendingLinkValues);
+  
+  BOOST_FOREACH(pendingByCode_t::value_type& entry, nodeValues) {
+    PendingValues& pending = entry.second;
+    ENcheck(ENsetnodevalues(entry.first, (int)pending.indexes.size(), &pending.indexes[0], &pending.values[0]), "ENsetnodevalues");
+  }
+  // in code order, which puts EN_STATUS ahead of EN_SETTING -- the order Model sets a valve's.
+  BOOST_FOREACH(pendingByCode_t::value_type& entry, linkValues) {
+    PendingValues& pending = entry.second;
+    ENcheck(ENsetlinkvalues(entry.first, (int)pending.indexes.size(), &pending.indexes[0], &pending.values[0]), "ENsetlinkvalues");
+  }
 }
 
 
@@ -415,17 +652,28 @@ void EpanetModel::solveSimulation(time_t time) {
    
    */
   long timestep;
+  ProjectScope project(*this);
   // set the current epanet-time to zero, since we override epanet-time.
   setCurrentSimulationTime( time );
   ENcheck(ENsettimeparam(EN_HTIME, 0), "ENsettimeparam(EN_HTIME)");
+  ENcheck(ENsetoption(EN_STARTMODE, (_hydraulicStart == coldStart) ? EN_COLDSTART : EN_WARMSTART), "ENsetoption(EN_STARTMODE)");
+  if (_hydraulicStart == predictedStart) {
+    predictFlows(time);
+  }
   // solve the hydraulics
-  ENcheck(ENrunH(&timestep), "ENrunH");
+  {
+    RTX_TRACE_SPAN(span, ("ENrunH", "engine", "", time, time));
+    ENcheck(ENrunH(&timestep), "ENrunH");
+  }
+  if (_hydraulicStart == predictedStart) {
+    keepSolvedFlows(time);
+  }
 }
 
 time_t EpanetModel::nextHydraulicStep(time_t time) {
   if ( time != currentSimulationTime() ) {
     // todo - throw something?
-    cerr << "time not synchronized!" << endl;
+    RTX_LOG(warning, "EpanetModel", "time not synchronized!");
   }
   // get the time of the next hydraulic event (according to the simulation)
   long stepLength = 0;
@@ -433,6 +681,7 @@ time_t EpanetModel::nextHydraulicStep(time_t time) {
   // re-set the epanet engine's hydstep parameter to the original value,
   // so that the step length figurer-outerer works.
   int actualTimeStep = hydraulicTimeStep();
+  ProjectScope project(*this);
   ENcheck( ENsettimeparam(EN_REPORTSTEP, (long)actualTimeStep), "ENsettimeparam(EN_REPORTSTEP)");
   ENcheck( ENsettimeparam(EN_HYDSTEP, (long)actualTimeStep), "ENsettimeparam(EN_HYDSTEP)");
   ENcheck( ENgettimeparam(EN_NEXTEVENT, &stepLength), "ENgettimeparam(EN_NEXTEVENT)" );
@@ -451,6 +700,7 @@ void EpanetModel::stepSimulation(time_t time) {
   
   //std::cout << "set step to: " << step << std::endl;
   
+  ProjectScope project(*this);
   ENcheck( ENsettimeparam(EN_HYDSTEP, step), "ENsettimeparam(EN_HYDSTEP)" );
   ENcheck( ENnextH(&step), "ENnexH()" );
   long supposedStep = time - currentSimulationTime();
@@ -463,18 +713,45 @@ void EpanetModel::stepSimulation(time_t time) {
 
 int EpanetModel::iterations(time_t time) {
   int iterations;
+  ProjectScope project(*this);
   ENcheck( ENgetstatistic(EN_ITERATIONS, &iterations), "ENgetstatistic(EN_ITERATIONS)");
   return iterations;
 }
 
 int EpanetModel::relativeError(time_t time) {
   int relativeError;
+  ProjectScope project(*this);
   ENcheck( ENgetstatistic(EN_RELATIVEERROR, &relativeError), "ENgetstatistic(EN_RELATIVEERROR)");
   return relativeError;
 }
 
+double EpanetModel::linearSolveTime(time_t time) {
+  int microseconds;
+  ProjectScope project(*this);
+  ENcheck( ENgetstatistic(EN_LINSOLVETIME, &microseconds), "ENgetstatistic(EN_LINSOLVETIME)");
+  return (double)microseconds / 1.e6;
+}
+
+// the quality segment pools, and the sparse matrix the hydraulics are solved with
+size_t EpanetModel::engineMemory() {
+  int pools, matrix;
+  ProjectScope project(*this);
+  ENcheck( ENgetstatistic(EN_POOLBYTES, &pools), "ENgetstatistic(EN_POOLBYTES)");
+  ENcheck( ENgetstatistic(EN_MATRIXBYTES, &matrix), "ENgetstatistic(EN_MATRIXBYTES)");
+  return (size_t)pools + (size_t)matrix;
+}
+
+size_t EpanetModel::peakEngineMemory() {
+  int pools, matrix;
+  ProjectScope project(*this);
+  ENcheck( ENgetstatistic(EN_PEAKPOOLBYTES, &pools), "ENgetstatistic(EN_PEAKPOOLBYTES)");
+  ENcheck( ENgetstatistic(EN_MATRIXBYTES, &matrix), "ENgetstatistic(EN_MATRIXBYTES)");
+  return (size_t)pools + (size_t)matrix;
+}
+
 
 void EpanetModel::setHydraulicTimeStep(int seconds) {
+  ProjectScope project(*this);
   ENcheck( ENsettimeparam(EN_REPORTSTEP, (long)seconds), "ENsettimeparam(EN_REPORTSTEP)");
   ENcheck( ENsettimeparam(EN_HYDSTEP, (long)seconds), "ENsettimeparam(EN_HYDSTEP)");
   // base class method
@@ -482,43 +759,262 @@ void EpanetModel::setHydraulicTimeStep(int seconds) {
 }
 
 void EpanetModel::setQualityTimeStep(int seconds) {
+  ProjectScope project(*this);
   ENcheck( ENsettimeparam(EN_QUALSTEP, (long)seconds), "ENsettimeparam(EN_QUALSTEP)");
   // call base class
   Model::setQualityTimeStep(seconds);
 }
 
+// the toolkit's hydraulic state: tank levels, link flows, statuses and settings (see ENsavehydstate)
+bool EpanetModel::saveEngineState(std::vector<char>& state) {
+  ProjectScope project(*this);
+  int size = 0;
+  ENcheck( ENgethydstatesize(&size), "ENgethydstatesize");
+  state.resize(size);
+  ENcheck( ENsavehydstate(&state[0]), "ENsavehydstate");
+  return true;
+}
+
+void EpanetModel::restoreEngineState(const std::vector<char>& state) {
+  ProjectScope project(*this);
+  ENcheck( ENloadhydstate((char*)&state[0]), "ENloadhydstate");
+  // a prediction would extrapolate from solutions on the far side of the jump
+  _solvedFlow.clear();
+  _previousSolvedFlow.clear();
+}
+
+
+#pragma mark Demand Changes
+
+// all of the sets' first-order responses come from one factorization of the current solution's equations
+bool EpanetModel::demandResponse(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, int setCount, std::vector<double>& head, std::vector<double>& flow) {
+  ProjectScope project(*this);
+  int nodeCount = 0, linkCount = 0;
+  ENcheck(ENgetcount(EN_NODECOUNT, &nodeCount), "ENgetcount EN_NODECOUNT");
+  ENcheck(ENgetcount(EN_LINKCOUNT, &linkCount), "ENgetcount EN_LINKCOUNT");
+  head.assign((size_t)setCount * nodeCount, 0.);
+  flow.assign((size_t)setCount * linkCount, 0.);
+  if (setCount == 0 || nodeCount == 0) {
+    return true;
+  }
+  vector<int> nodes(junctions.size());
+  for (size_t i = 0; i < junctions.size(); ++i) {
+    nodes[i] = junctions[i]->index();
+  }
+  int count = (int)(junctions.size() / setCount);
+  ENcheck(ENgetdemandresponse(setCount, count, nodes.empty() ? NULL : &nodes[0], (double*)(changes.empty() ? NULL : &changes[0]), &head[0], flow.empty() ? NULL : &flow[0]), "ENgetdemandresponse");
+  return true;
+}
+
+// the re-solve starts from, and then puts back, the solution the simulation has at the current time
+bool EpanetModel::solveDemandChange(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, const double* startFlowChange, std::vector<double>& head, std::vector<double>& flow, int& iterations) {
+  ProjectScope project(*this);
+  int nodeCount = 0, linkCount = 0;
+  ENcheck(ENgetcount(EN_NODECOUNT, &nodeCount), "ENgetcount EN_NODECOUNT");
+  ENcheck(ENgetcount(EN_LINKCOUNT, &linkCount), "ENgetcount EN_LINKCOUNT");
+  head.assign(nodeCount, 0.);
+  flow.assign(linkCount, 0.);
+  iterations = 0;
+  if (nodeCount == 0) {
+    return true;
+  }
+  vector<int> nodes(junctions.size());
+  for (size_t i = 0; i < junctions.size(); ++i) {
+    nodes[i] = junctions[i]->index();
+  }
+  ENcheck(ENsolvedemandchange((int)nodes.size(), nodes.empty() ? NULL : &nodes[0], (double*)(changes.empty() ? NULL : &changes[0]), (double*)startFlowChange, &head[0], flow.empty() ? NULL : &flow[0], &iterations), "ENsolvedemandchange");
+  return true;
+}
+
+
+#pragma mark - Water Quality
+
+// hydraulic solutions go to the quality solver in memory, a step at a time. restarting it restarts the hydraulics'
+// saving too, which empties that buffer -- so the first solution it reads is this time's.
+bool EpanetModel::startQuality(time_t time) {
+  ProjectScope project(*this);
+  if (!_isQualityOpen) {
+    ENcheck( ENsethydbuffer(1), "ENsethydbuffer" );
+  }
+  restartHydraulics(EN_INITFLOW + EN_SAVE);
+  if (!_isQualityOpen) {
+    // quality time runs on from one period to the next, while each period's hydraulics start again at 0 -- so
+    // the duration mustn't cut it short
+    ENcheck( ENsettimeparam(EN_DURATION, (long)INT_MAX), "ENsettimeparam(EN_DURATION)" );
+    ENcheck( ENsetqualthreads((int)_qualityThreads), "ENsetqualthreads" );
+    ENcheck( ENopenQ(), "ENopenQ" );
+    _isQualityOpen = true;
+  }
+  ENcheck( ENinitQ(EN_NOSAVE), "ENinitQ" );
+  _hasQualityHydraulics = false;
+  return true;
+}
+
+time_t EpanetModel::stepQuality(time_t time, time_t until) {
+  ProjectScope project(*this);
+  long t = 0, qualityStep = 0;
+  if (!_hasQualityHydraulics) {
+    // pick up the solution for this hydraulic step. stepping the hydraulics shortened the toolkit's quality step to at
+    // most the hydraulic one, so it's set again first.
+    ENcheck( ENsettimeparam(EN_QUALSTEP, (long)qualityTimeStep()), "ENsettimeparam(EN_QUALSTEP)" );
+    ENcheck( ENrunQ(&t), "ENrunQ" );
+    _hasQualityHydraulics = true;
+  }
+  ENcheck( ENgettimeparam(EN_QUALSTEP, &qualityStep), "ENgettimeparam(EN_QUALSTEP)" );
+  if (time + qualityStep < until) {
+    ENcheck( ENstepQ(&t), "ENstepQ" );
+    return time + qualityStep;
+  }
+  // the rest of the hydraulic step
+  ENcheck( ENnextQ(&t), "ENnextQ" );
+  _hasQualityHydraulics = false;
+  return until;
+}
+
+void EpanetModel::nodeQualities(std::vector<double>& qualities) {
+  ProjectScope project(*this);
+  int nodeCount = 0;
+  ENcheck( ENgetcount(EN_NODECOUNT, &nodeCount), "ENgetcount EN_NODECOUNT" );
+  qualities.resize(nodeCount);
+  if (nodeCount > 0) {
+    ENcheck( ENgetnodevalues(EN_QUALITY, nodeCount, NULL, &qualities[0]), "ENgetnodevalues EN_QUALITY" );
+  }
+}
+
+void EpanetModel::stopQuality() {
+  if (!_isQualityOpen) {
+    return;
+  }
+  ProjectScope project(*this);
+  ENcheck( ENcloseQ(), "ENcloseQ" );
+  restartHydraulics(EN_INITFLOW + EN_NOSAVE);
+  ENcheck( ENsethydbuffer(0), "ENsethydbuffer" );
+  _isQualityOpen = false;
+}
+
+// ENinitH, to start or stop the hydraulics saving their solutions -- which also re-initializes them, so their state
+// (and their clock, which a synthetic model keeps running) is put back afterwards.
+void EpanetModel::restartHydraulics(int flag) {
+  ProjectScope project(*this);
+  vector<char> state;
+  long hydraulicTime = 0;
+  saveEngineState(state);
+  ENcheck( ENgettimeparam(EN_HTIME, &hydraulicTime), "ENgettimeparam(EN_HTIME)" );
+  ENcheck( ENinitH(flag), "ENinitH" );
+  restoreEngineState(state);
+  ENcheck( ENsettimeparam(EN_HTIME, hydraulicTime), "ENsettimeparam(EN_HTIME)" );
+}
+
 
 #pragma mark -
 #pragma mark Internal Private Methods
 
-double EpanetModel::getNodeValue(int epanetCode, const string& node) {
-  int nodeIndex = _nodeIndex[node];
+// an element that was never bound has index 0, which the toolkit rejects -- so a stray element fails loudly.
+double EpanetModel::getNodeValue(int epanetCode, int nodeIndex) {
+  if (_hasFetchedStates && nodeIndex > 0 && (size_t)nodeIndex <= _nodeHead.size()) {
+    if (epanetCode == EN_HEAD) {
+      return _nodeHead[nodeIndex - 1];
+    }
+    if (epanetCode == EN_DEMAND) {
+      return _nodeDemand[nodeIndex - 1];
+    }
+  }
   double value;
+  ProjectScope project(*this);
   ENcheck(ENgetnodevalue(nodeIndex, epanetCode, &value), "ENgetnodevalue");
   return value;
 }
-void EpanetModel::setNodeValue(int epanetCode, const string& node, double value) {
-  int nodeIndex = _nodeIndex[node];
+void EpanetModel::setNodeValue(int epanetCode, int nodeIndex, double value) {
+  if (_isBatchingParameters) {
+    PendingValues& pending = _pendingNodeValues[epanetCode];
+    pending.indexes.push_back(nodeIndex);
+    pending.values.push_back(value);
+    return;
+  }
+  ProjectScope project(*this);
   ENcheck(ENsetnodevalue(nodeIndex, epanetCode, value), "ENsetnodevalue");
 }
 
-double EpanetModel::getLinkValue(int epanetCode, const string& link) {
-  int linkIndex = _linkIndex[link];
+double EpanetModel::getLinkValue(int epanetCode, int linkIndex) {
+  if (_hasFetchedStates && epanetCode == EN_FLOW && linkIndex > 0 && (size_t)linkIndex <= _linkFlow.size()) {
+    return _linkFlow[linkIndex - 1];
+  }
   double value;
+  ProjectScope project(*this);
   ENcheck(ENgetlinkvalue(linkIndex, epanetCode, &value), "ENgetlinkvalue");
   return value;
 }
-void EpanetModel::setLinkValue(int epanetCode, const string& link, double value) {
-  int linkIndex = _linkIndex[link];
+void EpanetModel::setLinkValue(int epanetCode, int linkIndex, double value) {
+  if (_isBatchingParameters) {
+    PendingValues& pending = _pendingLinkValues[epanetCode];
+    pending.indexes.push_back(linkIndex);
+    pending.values.push_back(value);
+    return;
+  }
+  ProjectScope project(*this);
   ENcheck(ENsetlinkvalue(linkIndex, epanetCode, value), "ENsetlinkvalue");
 }
 
-void EpanetModel::ENcheck(int errorCode, string externalFunction) throw(string) {
+// seed the solver with the last solution's flows, carried on along the change from the one before. the extrapolation
+// goes no further ahead than the two solutions were apart, and never takes a flow through zero -- a pump or check
+// valve started backwards is a worse guess than the last solution.
+void EpanetModel::predictFlows(time_t time) {
+  if (_previousSolvedFlow.empty() || _solvedFlow.size() != _previousSolvedFlow.size()) {
+    return;
+  }
+  if (time <= _solvedTime || _solvedTime <= _previousSolvedTime) {
+    // going back, or solving the same time again -- start from the last solution
+    return;
+  }
+  double ratio = (double)(time - _solvedTime) / (double)(_solvedTime - _previousSolvedTime);
+  ratio = RTX_MIN(ratio, 1.);
+  vector<double> guess(_solvedFlow.size());
+  for (size_t i = 0; i < guess.size(); ++i) {
+    double q = _solvedFlow[i] + ratio * (_solvedFlow[i] - _previousSolvedFlow[i]);
+    guess[i] = (q * _solvedFlow[i] > 0.) ? q : _solvedFlow[i];
+  }
+  ENcheck(ENsetlinkvalues(EN_FLOW, (int)guess.size(), NULL, &guess[0]), "ENsetlinkvalues EN_FLOW");
+}
+
+void EpanetModel::keepSolvedFlows(time_t time) {
+  int linkCount = 0;
+  ENcheck(ENgetcount(EN_LINKCOUNT, &linkCount), "ENgetcount EN_LINKCOUNT");
+  if (linkCount == 0) {
+    return;
+  }
+  if (time != _solvedTime || _solvedFlow.empty()) {
+    // a period solved again replaces its last solution, rather than becoming the one before it
+    _previousSolvedFlow.swap(_solvedFlow);
+    _previousSolvedTime = _solvedTime;
+  }
+  _solvedFlow.resize(linkCount);
+  ENcheck(ENgetlinkvalues(EN_FLOW, linkCount, NULL, &_solvedFlow[0]), "ENgetlinkvalues EN_FLOW");
+  _solvedTime = time;
+}
+
+void EpanetModel::ENcheck(int errorCode, const char* externalFunction) throw(string) {
   if (errorCode > 10) {
     char errorMsg[256];
     ENgeterror(errorCode, errorMsg, 255);
-    throw externalFunction + "::" + std::string(errorMsg);
+    throw std::string(externalFunction) + "::" + std::string(errorMsg);
+  }
+}
+
+
+#pragma mark Project Scope
+
+EpanetModel::ProjectScope::ProjectScope(EpanetModel& model) : _model(model) {
+  _model._projectMutex.lock();
+  int errorCode = ENattachproject(_model._project);
+  if (errorCode != 0) {
+    _model._projectMutex.unlock();
+    _model.ENcheck(errorCode, "ENattachproject");
   }
 }
 
+EpanetModel::ProjectScope::~ProjectScope() {
+  ENdetachproject(_model._project);
+  _model._projectMutex.unlock();
+}
+
 
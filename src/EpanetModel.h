@@ -9,6 +9,8 @@
 #ifndef epanet_rtx_EpanetModel_h
 #define epanet_rtx_EpanetModel_h
 
+#include <boost/thread/recursive_mutex.hpp>
+
 #include "Model.h"
 #include "rtxMacros.h"
 
@@ -24,6 +26,26 @@ namespace RTX {
    
    Provides a means of loading WDS models from *.inp files, and wraps the EPANET hydraulic engine (via a modified C toolkit embedded in this library)
    
+   Each model has its own toolkit project (see ENcreateproject), so any number of them can be loaded at once, and run on
+   separate threads. A model itself is driven by one thread at a time -- its toolkit calls are serialized.
+   
+   Each period's hydraulic solution starts from the flows of the one before it (warmStart), since consecutive periods
+   are usually close. predictedStart goes further and extrapolates the last two solutions' flows to the new time; the
+   iterations each period took are in iterations(), for comparing. coldStart solves every period from the toolkit's
+   initial flow estimates, so a period's result doesn't depend on what was solved before it.
+   
+   Most of the time it takes to load a large network goes to ordering its hydraulic matrix for the solver, which
+   grows quickly with the number of junctions. With a solver cache file set before loading, the ordering is kept in
+   that file, and later loads of a network with the same links (after a restart, or a clone) read it back instead of
+   working it out again. A file that doesn't match the network is just rewritten.
+   
+   Water quality (see Model::setShouldRunWaterQuality) runs the toolkit's quality solver alongside the hydraulic one,
+   with each hydraulic solution handed over in memory (ENsethydbuffer) rather than through a scratch file.
+   
+   Demand changes (see Model::demandSensitivities) are worked out by the toolkit against its current solution: the
+   first-order responses from one factorization of that solution's equations, with many right hand sides, and each
+   re-solve starting from the solution's flows moved by its first-order response -- usually only a few iterations.
+   
    */
     
   class EpanetModel : public Model {
@@ -35,25 +57,69 @@ namespace RTX {
     void loadModelFromFile(const std::string& filename) throw(std::exception);
     virtual void overrideControls() throw(RtxException);
     virtual std::ostream& toStream(std::ostream &stream);
+    
+    //! where each period's hydraulic solution starts from
+    typedef enum {
+      coldStart,      //!< the toolkit's initial flow estimates
+      warmStart,      //!< the last solution's flows (the default)
+      predictedStart  //!< the last solution's flows, extrapolated along their change since the one before
+    } hydraulicStart_t;
+    void setHydraulicStart(hydraulicStart_t start);
+    hydraulicStart_t hydraulicStart();
+    
+    //! where to keep the solver's matrix ordering between loads (see above); empty, the default, to not keep it
+    void setSolverCacheFile(const std::string& path);
+    std::string solverCacheFile();
+    
+    //! threads to share water quality transport with, on a large network (see ENsetqualthreads) -- 0 means one per
+    //! hardware core, and the default is 1. results are the same with any number. takes effect when quality next starts.
+    void setQualityThreads(size_t threadCount);
+    size_t qualityThreads();
+    
+    //! threads to assemble each hydraulic trial's equations with, on a large network (see ENsethydassembly) -- 0 means
+    //! one per hardware core, and the default is 1. results are the same with any number.
+    void setHydraulicThreads(size_t threadCount);
+    size_t hydraulicThreads();
+    //! raise pipe and emitter flows to their head loss exponents with the toolkit's fast power function: within 1e-13
+    //! of pow(), and several times faster where it's compiled for wide vectors (AVX2 or better). off by default.
+    void setFastHeadloss(bool fast);
+    bool fastHeadloss();
 
   protected:
+    virtual Model::sharedPointer newInstance();
+    
     // overridden accessors
     // node elements
-    double reservoirLevel(const std::string& reservoir);
-    double tankLevel(const std::string& tank);
-    double junctionDemand(const std::string& junction);
-    double junctionHead(const std::string& junction);
-    double junctionQuality(const std::string& junction);
+    double reservoirLevel(const Reservoir::sharedPointer& reservoir);
+    double tankLevel(const Tank::sharedPointer& tank);
+    double junctionDemand(const Junction::sharedPointer& junction);
+    double junctionHead(const Junction::sharedPointer& junction);
+    double junctionQuality(const Junction::sharedPointer& junction);
     // link elements
-    double pipeFlow(const std::string& pipe);
-    double pumpEnergy(const std::string& pump);
+    double pipeFlow(const Pipe::sharedPointer& pipe);
+    double pumpEnergy(const Pump::sharedPointer& pump);
+    
+    void setReservoirHead(const Reservoir::sharedPointer& reservoir, double level);
+    void setTankLevel(const Tank::sharedPointer& tank, double level);
+    void setJunctionDemand(const Junction::sharedPointer& junction, double demand);
+    void setPipeStatus(const Pipe::sharedPointer& pipe, Pipe::status_t status);
+    void setPumpStatus(const Pump::sharedPointer& pump, Pipe::status_t status);
+    void setValveSetting(const Valve::sharedPointer& valve, double setting);
     
-    void setReservoirHead(const std::string& reservoir, double level);
-    void setTankLevel(const std::string& tank, double level);
-    void setJunctionDemand(const std::string& junction, double demand);
-    void setPipeStatus(const std::string& pipe, Pipe::status_t status);
-    void setPumpStatus(const std::string& pump, Pipe::status_t status);
-    void setValveSetting(const std::string& valve, double setting);
+    // whole-network transfers: states are read, and parameters written, in one toolkit call per quantity
+    virtual void setSimulationParameters(time_t time);
+    virtual void saveHydraulicStates(time_t time);
+    virtual bool networkStates(NetworkStates& states);
+    
+    // water quality
+    virtual bool startQuality(time_t time);
+    virtual time_t stepQuality(time_t time, time_t until);
+    virtual void nodeQualities(std::vector<double>& qualities);
+    virtual void stopQuality();
+    
+    // demand changes (see ENgetdemandresponse and ENsolvedemandchange)
+    virtual bool demandResponse(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, int setCount, std::vector<double>& head, std::vector<double>& flow);
+    virtual bool solveDemandChange(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, const double* startFlowChange, std::vector<double>& head, std::vector<double>& flow, int& iterations);
     
     // simulation methods
     virtual void solveSimulation(time_t time);
@@ -61,19 +127,62 @@ namespace RTX {
     virtual void stepSimulation(time_t time);
     virtual int iterations(time_t time);
     virtual int relativeError(time_t time);
+    virtual double linearSolveTime(time_t time);
+    virtual size_t engineMemory();
+    virtual size_t peakEngineMemory();
     virtual void setHydraulicTimeStep(int seconds);
     virtual void setQualityTimeStep(int seconds);
-    void ENcheck(int errorCode, std::string externalFunction) throw(std::string);
+    virtual bool saveEngineState(std::vector<char>& state);
+    virtual void restoreEngineState(const std::vector<char>& state);
+    void ENcheck(int errorCode, const char* externalFunction) throw(std::string);
     
-    // protected accessors
-    double getNodeValue(int epanetCode, const std::string& node);
-    void setNodeValue(int epanetCode, const std::string& node, double value);
-    double getLinkValue(int epanetCode, const std::string& link);
-    void setLinkValue(int epanetCode, const std::string& link, double value);
+    // protected accessors, by the toolkit index each element was bound to in loadModelFromFile
+    double getNodeValue(int epanetCode, int nodeIndex);
+    void setNodeValue(int epanetCode, int nodeIndex, double value);
+    double getLinkValue(int epanetCode, int linkIndex);
+    void setLinkValue(int epanetCode, int linkIndex, double value);
+    
+    //! attaches this model's project to the calling thread while it's in scope; wrap any toolkit calls in one.
+    //! scopes nest, so a method can open one whether or not its caller has.
+    class ProjectScope {
+    public:
+      ProjectScope(EpanetModel& model);
+      ~ProjectScope();
+  private:
+      EpanetModel& _model;
+    };
     
   private:
-    std::tr1::unordered_map<std::string, int> _nodeIndex;
-    std::tr1::unordered_map<std::string, int> _linkIndex;
+    ENproject* _project;
+    boost::recursive_mutex _projectMutex;
+    //! values waiting to be written with one ENsetnodevalues / ENsetlinkvalues call
+    class PendingValues {
+    public:
+      std::vector<int> indexes;
+      std::vector<double> values;
+    };
+    typedef std::map<int, PendingValues> pendingByCode_t; // keyed by toolkit parameter code
+    void flushPendingValues();
+    bool _isBatchingParameters;
+    pendingByCode_t _pendingNodeValues, _pendingLinkValues;
+    // whole-network results, read once per step while saving states. indexed by toolkit index - 1.
+    bool _hasFetchedStates;
+    std::vector<double> _nodeHead, _nodeDemand, _linkFlow;
+    // the flows of the last two solutions, for predictedStart
+    void predictFlows(time_t time);
+    void keepSolvedFlows(time_t time);
+    hydraulicStart_t _hydraulicStart;
+    std::vector<double> _solvedFlow, _previousSolvedFlow;
+    time_t _solvedTime, _previousSolvedTime;
+    size_t _qualityThreads;
+    size_t _hydraulicThreads;
+    bool _fastHeadloss;
+    void setHydraulicAssembly();
+    bool _isQualityOpen;          // the toolkit's quality solver, with hydraulics saved for it
+    bool _hasQualityHydraulics;   // whether it has read the hydraulic step it's in
+    void restartHydraulics(int flag);
+    void loadPumpEnergy(const Pump::sharedPointer& pump, int index); //! its efficiency curve and pricing, as pumpenergy() uses them
+    std::string _solverCacheFile;
     // TODO - use boost filesystem instead of std::string path
     std::string _modelFile;
   };
@@ -9,6 +9,7 @@
 #include <iostream>
 
 #include "EpanetSyntheticModel.h"
+#include "Log.h"
 
 using namespace RTX;
 
@@ -26,11 +27,16 @@ std::ostream& EpanetSyntheticModel::toStream(std::ostream &stream) {
 
 void EpanetSyntheticModel::overrideControls() throw(RtxException) {
   // make sure we do nothing.
-  std::cerr << "ignoring control override" << std::endl;
+  RTX_LOG(warning, "EpanetSyntheticModel", "ignoring control override");
 }
 
 
 
+Model::sharedPointer EpanetSyntheticModel::newInstance() {
+  return Model::sharedPointer(new EpanetSyntheticModel());
+}
+
+
 // mostly copied from the epanetmodel class, but altered epanet clock-setting
 // so that the simulation evolves with its builtin controlls and patterns.
 
@@ -46,6 +52,7 @@ void EpanetSyntheticModel::solveSimulation(time_t time) {
    so we know what simulation periods have been solved - as in a master simulation clock?
    */
   long timestep;
+  ProjectScope project(*this);
   
   setCurrentSimulationTime( time );
   
@@ -57,14 +64,28 @@ void EpanetSyntheticModel::solveSimulation(time_t time) {
 
 }
 
-// adjust duration of epanet toolkit simulation if necessary.
+// the toolkit only simulates up to its duration, so it's set to take in the whole run up front.
+void EpanetSyntheticModel::prepareSimulation(time_t start, time_t end) {
+  if (_startTime == 0) {
+    _startTime = start;
+  }
+  long duration = 0;
+  ProjectScope project(*this);
+  ENcheck(ENgettimeparam(EN_DURATION, &duration), "ENgettimeparam(EN_DURATION)");
+  if (duration < (end - _startTime)) {
+    ENcheck(ENsettimeparam(EN_DURATION, (long)(end - _startTime)), "ENsettimeparam(EN_DURATION)");
+  }
+}
+
+// adjust duration of epanet toolkit simulation if necessary (a run should have set it already).
 time_t EpanetSyntheticModel::nextHydraulicStep(time_t time) {
   
   long duration = 0;
+  ProjectScope project(*this);
   ENcheck(ENgettimeparam(EN_DURATION, &duration), "ENgettimeparam(EN_DURATION)");
   
   if (duration <= (time - _startTime) ) {
-    std::cerr << "had to adjust the sim duration to accomodate the requested step" << std::endl;
+    RTX_LOG(warning, "EpanetSyntheticModel", "had to adjust the sim duration to accomodate the requested step");
     ENcheck(ENsettimeparam(EN_DURATION, (duration + hydraulicTimeStep()) ), "ENsettimeparam(EN_DURATION)");
   }
   
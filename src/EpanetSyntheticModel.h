@@ -19,6 +19,10 @@ namespace RTX {
    
    Provides an epanet-based simulation engine and methods to perform a forward simulation without overriding rules and controls.
    
+   The toolkit's duration is stretched to the end of each run as it starts, so a long run (months of synthetic data,
+   say) goes straight through. For generating data in bulk, store just the elements that are wanted (see
+   Model::setStoredElements) and give the state record a write-behind queue.
+   
    */
   
   class EpanetSyntheticModel : public EpanetModel {
@@ -29,6 +33,8 @@ namespace RTX {
     virtual std::ostream& toStream(std::ostream &stream);
     
   protected:
+    virtual Model::sharedPointer newInstance();
+    virtual void prepareSimulation(time_t start, time_t end);
     virtual void solveSimulation(time_t time);
     virtual time_t nextHydraulicStep(time_t time);
   private:
@@ -6,10 +6,14 @@
 //  See README.md and license.txt for more information
 //  
 
+#include <boost/bind/bind.hpp>
+
 #include "FirstDerivative.h"
+#include "Log.h"
 
 using namespace std;
 using namespace RTX;
+using namespace boost::placeholders;
 
 FirstDerivative::FirstDerivative() : ModularTimeSeries::ModularTimeSeries() {
   
@@ -38,129 +42,109 @@ void FirstDerivative::setUnits(Units newUnits) {
     TimeSeries::setUnits(newUnits);
   }
   else if (!units().isDimensionless()) {
-    std::cerr << "units are not dimensionally consistent" << std::endl;
+    RTX_LOG(warning, "FirstDerivative", "units are not dimensionally consistent");
   }
 }
 
 Point FirstDerivative::point(time_t time) {
-  
-  // return obj
-  Point p;
+  return pointComputedOnce(time, boost::bind(&FirstDerivative::computePoint, this, _1));
+}
 
-  /* check the requested time for validity...
-  if ( !(clock()->isValid(time)) ) {
-    // if the time is not valid, rewind until a valid time is reached.
-    time = clock()->timeBefore(time);
-  }
-  */
-  p = TimeSeries::point(time);
-  if (p.isValid) {
-    return p;
-  }
-  else {
-    std::pair<Point,Point> adjacent = source()->adjacentPoints(time);
-    //Point secondPoint = source()->point(time);
-    //if (!secondPoint.isValid) {
-    Point secondPoint = adjacent.second;
-    //}
-    Point firstPoint = adjacent.first;
-    if (!firstPoint.isValid) {
-      firstPoint = Point();
-    }
-    Point p = deriv(firstPoint, secondPoint, time);
-    insert(p);
+Point FirstDerivative::computePoint(time_t time) {
+  // a range of one, through the same kernel as points()
+  std::vector<Point> derived;
+  this->evaluateRange(time, time, derived);
+  if (derived.empty() || derived.front().time != time) {
+    return Point();
   }
-  return p;
+  cachePoint(derived.front());
+  return derived.front();
 }
 
-std::vector<Point> FirstDerivative::points(time_t start, time_t end) {
-  
-  Units sourceU = source()->units();
-  Units myU = units();
-  
-  // make sure the times are aligned with the clock.
-  time_t newStart = (clock()->isValid(start)) ? start : clock()->timeAfter(start);
-  time_t newEnd = (clock()->isValid(end)) ? end : clock()->timeBefore(end);
+void FirstDerivative::evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
   
   time_t sourceStart, sourceEnd;
   {
-    time_t s = source()->pointBefore(newStart).time;
-    time_t e = source()->pointAfter(newEnd).time;
-    sourceStart = (s>0)? s : newStart;
-    sourceEnd = (e>0)? e : newEnd;
+    countUpstreamCalls(2);
+    time_t s = source()->pointBefore(start).time;
+    time_t e = source()->pointAfter(end).time;
+    sourceStart = (s>0)? s : start;
+    sourceEnd = (e>0)? e : end;
   }
   // get the source points
+  countUpstreamCalls();
   std::vector<Point> sourcePoints = source()->points(sourceStart, sourceEnd);
   if (sourcePoints.size() < 2) {
-    vector<Point> empty;
-    return empty;
+    return;
   }
   
-  // create a place for the new points
-  std::vector<Point> fd;
-  {
-    std::vector<Point>::size_type s = (newEnd - newStart) / period();
-    fd.reserve(s);
+  // the output times: nothing is extrapolated past either end of the source data.
+  std::vector<time_t> times;
+  if (period() > 0) {
+    times.reserve((end - start) / period() + 1);
   }
-  
-  
-  // scrub through the source Points and take derivative as we go.
-  time_t now = newStart;
-  vector<Point>::const_iterator sourceIt = sourcePoints.begin();
-  Point left, right;
-  left = *sourceIt;
-  ++sourceIt;
-  right = *sourceIt;
-  
-  // fast forward now to meet our first available source point.
-  while (left.time > now) {
+  time_t now = start;
+  while (now != 0 && now < sourcePoints.front().time && now <= end) {
     now = clock()->timeAfter(now);
   }
+  while (now != 0 && now <= end && now <= sourcePoints.back().time) {
+    times.push_back(now);
+    now = clock()->timeAfter(now);
+  }
+  size_t count = times.size();
+  if (count == 0) {
+    return;
+  }
   
-  while (sourceIt != sourcePoints.end() && now <= newEnd) {
-    
-    while (right.time < now) {
-      // increment our source point iterator
-      // if we've gone past our neighbor points.
-      left = right;
-      ++sourceIt;
-      if (sourceIt == sourcePoints.end()) {
-        break;
-      }
-      right = *sourceIt;
-    }
-    
-    if (left.time == right.time) {
-      break;
+  // merge-walk the output times against the source, gathering each output's neighbors into flat columns:
+  // the pair with left.time < now <= right.time (or the first pair, right at the start of the data).
+  // a pair that touches a missing point is masked out.
+  std::vector<double> t0(count), t1(count), v0(count), v1(count), slopes(count);
+  std::vector<unsigned char> keep(count);
+  size_t lastLeft = sourcePoints.size() - 2;
+  size_t left = 0;
+  for (size_t k = 0; k < count; ++k) {
+    while (left < lastLeft && sourcePoints[left + 1].time < times[k]) {
+      ++left;
     }
-    // we have two neighboring points. let's do it.
-    Point p = deriv(left, right, now); // returns in my units
-    fd.push_back(p);
-    
-    // and it is not now anymore
-    now = clock()->timeAfter(now);
-    
+    const Point& p0 = sourcePoints[left];
+    const Point& p1 = sourcePoints[left + 1];
+    t0[k] = (double)p0.time;
+    t1[k] = (double)p1.time;
+    v0[k] = p0.value;
+    v1[k] = p1.value;
+    keep[k] = (p0.time < p1.time && p0.quality != Point::missing && p1.quality != Point::missing);
   }
   
-  // finally, add the points to myself.
-  this->insertPoints(fd);
+  double rateScale = Units::convertValue(1., source()->units() / RTX_SECOND, this->units());
+  differenceColumns(count, &t0[0], &t1[0], &v0[0], &v1[0], rateScale, &slopes[0]);
   
-  return fd;
+  out.reserve(out.size() + count);
+  for (size_t k = 0; k < count; ++k) {
+    if (keep[k]) {
+      out.push_back(Point(times[k], slopes[k]));
+    }
+  }
   
 }
 
-
-Point FirstDerivative::deriv(RTX::Point p1, RTX::Point p2, time_t t) {
-  if (!(p1.isValid && p2.isValid)) {
-    return Point();
+void FirstDerivative::differenceColumns(size_t count, const double* t0, const double* t1, const double* v0, const double* v1, double scale, double* out) {
+  // branch-free and alias-free, so the compiler can vectorize it. masked-out pairs may divide by zero; that's fine.
+  for (size_t k = 0; k < count; ++k) {
+    out[k] = scale * (v1[k] - v0[k]) / (t1[k] - t0[k]);
   }
-  time_t dt = p2.time - p1.time;
-  double dv = p2.value - p1.value;
-  double dvdt = Units::convertValue(dv / double(dt), source()->units() / RTX_SECOND, this->units());
-  return Point(t, dvdt);
 }
 
 
+bool FirstDerivative::valueTransform(ValueTransform& transform) {
+  return false; // differences need neighbors, so this isn't a per-value map
+}
+
+PointRecord::time_pair_t FirstDerivative::affectedRange(time_t start, time_t end) {
+  // a changed source point is one end of the differences on either side of it
+  return sourceNeighborRange(start, end);
+}
+
 std::ostream& FirstDerivative::toStream(std::ostream &stream) {
   TimeSeries::toStream(stream);
   stream << "First Derivative Of: " << *source() << "\n";
@@ -20,12 +20,17 @@ namespace RTX {
     virtual ~FirstDerivative();
     
     virtual Point point(time_t time);
-    virtual std::vector<Point> points(time_t start, time_t end);
+    virtual bool valueTransform(ValueTransform& transform);
+    virtual PointRecord::time_pair_t affectedRange(time_t start, time_t end);
     virtual void setSource(TimeSeries::sharedPointer source);
     virtual void setUnits(Units newUnits);
     virtual std::ostream& toStream(std::ostream &stream);
+  protected:
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out);
   private:
-    Point deriv(Point p1, Point p2, time_t t);
+    Point computePoint(time_t time);
+    //! batch kernel: out[k] = scale * (v1[k] - v0[k]) / (t1[k] - t0[k]), over flat arrays
+    static void differenceColumns(size_t count, const double* t0, const double* t1, const double* v0, const double* v1, double scale, double* out);
   };
   
 }// namespace
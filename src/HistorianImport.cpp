@@ -0,0 +1,370 @@
+//
+//  HistorianImport.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "HistorianImport.h"
+#include "DbPointRecord.h"
+#include "Log.h"
+#include "RuntimeContext.h"
+#include "SteadyClock.h"
+
+// a CSV file is cut into chunks of about this many bytes, each ending with a whole line
+#define RTX_IMPORT_CSV_CHUNK (4 << 20)
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+namespace {
+  bool pointIsEarlier(const Point& left, const Point& right) {
+    return left.time < right.time;
+  }
+  bool pointTimesAreEqual(const Point& left, const Point& right) {
+    return left.time == right.time;
+  }
+
+  // tag,time,value[,quality[,confidence]]
+  bool parseCsvLine(const std::string& line, std::string& tag, Point& point) {
+    size_t comma = line.find(',');
+    if (comma == string::npos || comma == 0) {
+      return false;
+    }
+    tag = line.substr(0, comma);
+    const char* cursor = line.c_str() + comma + 1;
+    char* end;
+    long long time = strtoll(cursor, &end, 10);
+    if (end == cursor || *end != ',') {
+      return false;
+    }
+    cursor = end + 1;
+    double value = strtod(cursor, &end);
+    if (end == cursor) {
+      return false;
+    }
+    long quality = Point::good;
+    double confidence = 0;
+    if (*end == ',') {
+      cursor = end + 1;
+      quality = strtol(cursor, &end, 10);
+      if (end == cursor || quality < Point::good || quality > Point::constant) {
+        return false;
+      }
+      if (*end == ',') {
+        cursor = end + 1;
+        confidence = strtod(cursor, &end);
+      }
+    }
+    while (*end == ' ' || *end == '\r') {
+      ++end;
+    }
+    if (*end != '\0') {
+      return false;
+    }
+    point = Point((time_t)time, value, (Point::Qual_t)quality, confidence);
+    return true;
+  }
+}
+
+
+#pragma mark - Constructor
+
+HistorianImport::HistorianImport(PointRecord::sharedPointer destination) : _destination(destination), _start(0), _end(0), _partitionLength(60*60*24), _threadCount(0), _doesConvert(false), _nextPartition(0), _isCancelled(false) {
+
+}
+
+void HistorianImport::setSource(PointRecord::sharedPointer source, const std::vector<std::string>& tags) {
+  _source = source;
+  _tags = tags;
+  _csvPath.clear();
+}
+
+void HistorianImport::setCsvSource(const std::string& path) {
+  _csvPath = path;
+  _source.reset();
+  _tags.clear();
+}
+
+void HistorianImport::setTimeRange(time_t start, time_t end) {
+  _start = start;
+  _end = end;
+}
+
+void HistorianImport::setUnitConversion(const Units& sourceUnits, const Units& destinationUnits) {
+  _converter = UnitConverter(sourceUnits, destinationUnits);
+  _doesConvert = true;
+}
+
+void HistorianImport::setPartitionLength(time_t seconds) {
+  _partitionLength = (seconds > 0) ? seconds : 1;
+}
+
+time_t HistorianImport::partitionLength() {
+  return _partitionLength;
+}
+
+void HistorianImport::setThreadCount(size_t count) {
+  _threadCount = count;
+}
+
+void HistorianImport::setCheckpointFile(const std::string& path) {
+  _checkpointPath = path;
+}
+
+HistorianImport::progress_t HistorianImport::progress() {
+  scopedLock_t lock(_mutex);
+  return _progress;
+}
+
+void HistorianImport::cancel() {
+  _isCancelled = true;
+}
+
+
+#pragma mark - Running
+
+void HistorianImport::run() throw(RtxException) {
+  if (!_destination || (!_source && _csvPath.empty())) {
+    throw RtxException("nothing to import from, or to");
+  }
+  if (_doesConvert && !_converter.isValid()) {
+    throw RtxException("the source and destination units aren't of the same dimension");
+  }
+  _isCancelled = false;
+  _progress = progress_t();
+  _registered.clear();
+  makePartitions();
+
+  // what an earlier run finished
+  std::set<std::string> done;
+  if (!_checkpointPath.empty()) {
+    ifstream previous(_checkpointPath.c_str());
+    string line;
+    while (getline(previous, line)) {
+      done.insert(line);
+    }
+    _checkpointFile.open(_checkpointPath.c_str(), ios::app);
+    if (!_checkpointFile) {
+      throw RtxIoException();
+    }
+  }
+  vector<partition_t> remaining;
+  BOOST_FOREACH(const partition_t& partition, _partitions) {
+    if (done.find(partition.key()) == done.end()) {
+      remaining.push_back(partition);
+    }
+  }
+  _progress.partitions = _partitions.size();
+  _progress.skipped = _partitions.size() - remaining.size();
+  _partitions.swap(remaining);
+  _nextPartition = 0;
+
+  size_t threadCount = (_threadCount > 0) ? _threadCount : boost::thread::hardware_concurrency();
+  if (threadCount > _partitions.size()) {
+    threadCount = _partitions.size();
+  }
+  threadCount = RTX_MAX(threadCount, 1);
+  RTX_LOG(info, "HistorianImport", "importing " << _partitions.size() << " partitions (" << _progress.skipped << " already done) on " << threadCount << " threads");
+
+  double started = steadySeconds();
+  // a backfill: on the i/o threads, at background priority, so a live model's fetches always find one free
+  vector<Scheduler::task_t> tasks(threadCount, boost::bind(&HistorianImport::workerLoop, this));
+  RuntimeContext::defaultContext()->scheduler()->runIo(tasks, Scheduler::backgroundPriority); // the calling thread works too
+
+  if (_checkpointFile.is_open()) {
+    _checkpointFile.close();
+  }
+  double seconds = steadySeconds() - started;
+  RTX_LOG(info, "HistorianImport", "imported " << _progress.points << " points in " << _progress.finished << " partitions (" << seconds << " s). " << _progress.failed << " failed");
+}
+
+void HistorianImport::workerLoop() {
+  while (!_isCancelled) {
+    partition_t partition;
+    {
+      scopedLock_t lock(_mutex);
+      if (_nextPartition >= _partitions.size()) {
+        return;
+      }
+      partition = _partitions[_nextPartition++];
+    }
+
+    try {
+      keyedPoints_t pointsByTag;
+      size_t rejected = fetch(partition, pointsByTag);
+      convert(pointsByTag);
+      write(pointsByTag);
+      checkpoint(partition);
+      uint64_t count = 0;
+      BOOST_FOREACH(const keyedPoints_t::value_type& entry, pointsByTag) {
+        count += entry.second.size();
+      }
+      scopedLock_t lock(_mutex);
+      ++_progress.finished;
+      _progress.points += count;
+      _progress.rejectedLines += rejected;
+    } catch (std::exception& e) {
+      RTX_LOG(error, "HistorianImport", "partition " << partition.key() << " failed: " << e.what());
+      scopedLock_t lock(_mutex);
+      ++_progress.failed;
+    }
+  }
+}
+
+
+#pragma mark - Partitions
+
+std::string HistorianImport::partition_t::key() const {
+  stringstream key;
+  if (tag.empty()) {
+    key << "csv\t" << offset << "\t" << length;
+  }
+  else {
+    key << tag << "\t" << start << "\t" << end;
+  }
+  return key.str();
+}
+
+// the same cuts every time, so that a checkpoint from one run means something to the next
+void HistorianImport::makePartitions() {
+  _partitions.clear();
+  partition_t partition;
+  partition.start = partition.end = 0;
+  partition.offset = partition.length = 0;
+
+  if (_source) {
+    if (_end < _start || (_start == 0 && _end == 0)) {
+      throw RtxException("a record source needs a time range");
+    }
+    vector<string> tags = _tags.empty() ? _source->identifiers() : _tags;
+    BOOST_FOREACH(const string& tag, tags) {
+      partition.tag = tag;
+      for (time_t start = _start; start <= _end; start += _partitionLength) {
+        partition.start = start;
+        partition.end = RTX_MIN(start + _partitionLength - 1, _end);
+        _partitions.push_back(partition);
+      }
+    }
+    return;
+  }
+
+  ifstream file(_csvPath.c_str(), ios::binary);
+  if (!file) {
+    throw RtxIoException();
+  }
+  file.seekg(0, ios::end);
+  uint64_t size = (uint64_t)file.tellg();
+  uint64_t offset = 0;
+  string rest;
+  while (offset < size) {
+    uint64_t next = offset + RTX_IMPORT_CSV_CHUNK;
+    if (next < size) {
+      // to the end of the line it lands in
+      file.clear();
+      file.seekg((streamoff)next, ios::beg);
+      getline(file, rest);
+      next = file.eof() ? size : (uint64_t)file.tellg();
+    }
+    else {
+      next = size;
+    }
+    partition.offset = offset;
+    partition.length = next - offset;
+    _partitions.push_back(partition);
+    offset = next;
+  }
+}
+
+
+#pragma mark - Stages
+
+size_t HistorianImport::fetch(const partition_t& partition, keyedPoints_t& pointsByTag) {
+  if (_source) {
+    DbPointRecord::sharedPointer db = boost::dynamic_pointer_cast<DbPointRecord>(_source);
+    pointsByTag[partition.tag] = db ? db->selectUncached(partition.tag, partition.start, partition.end) : _source->pointsInRange(partition.tag, partition.start, partition.end);
+    return 0;
+  }
+
+  // each chunk is read on its own, so the file is read in parallel too
+  ifstream file(_csvPath.c_str(), ios::binary);
+  string chunk((size_t)partition.length, '\0');
+  file.seekg((streamoff)partition.offset, ios::beg);
+  if (!file || (partition.length > 0 && file.read(&chunk[0], chunk.size()).fail())) {
+    throw RtxIoException();
+  }
+  size_t rejected = 0;
+  bool isFiltered = (_start != 0 || _end != 0);
+  stringstream lines(chunk);
+  string line, tag;
+  Point point;
+  while (getline(lines, line)) {
+    if (line.empty() || line[0] == '#' || line == "\r") {
+      continue;
+    }
+    if (!parseCsvLine(line, tag, point)) {
+      ++rejected;
+      continue;
+    }
+    if (isFiltered && (point.time < _start || _end < point.time)) {
+      continue;
+    }
+    pointsByTag[tag].push_back(point);
+  }
+  return rejected;
+}
+
+void HistorianImport::convert(keyedPoints_t& pointsByTag) {
+  typedef keyedPoints_t::value_type& keyedPointsValue_t;
+  BOOST_FOREACH(keyedPointsValue_t entry, pointsByTag) {
+    vector<Point>& points = entry.second;
+    // sorted, a time's first point kept
+    stable_sort(points.begin(), points.end(), &pointIsEarlier);
+    points.erase(unique(points.begin(), points.end(), &pointTimesAreEqual), points.end());
+    if (_doesConvert) {
+      BOOST_FOREACH(Point& p, points) {
+        p = Point::convertPoint(p, _converter);
+      }
+    }
+  }
+}
+
+void HistorianImport::write(keyedPoints_t& pointsByTag) {
+  // the destination learns each name once
+  BOOST_FOREACH(const keyedPoints_t::value_type& entry, pointsByTag) {
+    scopedLock_t lock(_mutex);
+    if (_registered.find(entry.first) == _registered.end()) {
+      _destination->registerAndGetIdentifier(entry.first);
+      _registered.insert(entry.first);
+    }
+  }
+
+  DbPointRecord::sharedPointer db = boost::dynamic_pointer_cast<DbPointRecord>(_destination);
+  if (db) {
+    db->insertBulk(pointsByTag);
+    return;
+  }
+  BOOST_FOREACH(const keyedPoints_t::value_type& entry, pointsByTag) {
+    if (!entry.second.empty()) {
+      _destination->addPoints(entry.first, entry.second);
+    }
+  }
+}
+
+void HistorianImport::checkpoint(const partition_t& partition) {
+  scopedLock_t lock(_mutex);
+  if (_checkpointFile.is_open()) {
+    _checkpointFile << partition.key() << endl;
+  }
+}
@@ -0,0 +1,126 @@
+//
+//  HistorianImport.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_HistorianImport_h
+#define epanet_rtx_HistorianImport_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <stdint.h>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "Point.h"
+#include "PointRecord.h"
+#include "Units.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
+
+namespace RTX {
+
+  /*!
+   \class HistorianImport
+   \brief Copies years of history into a record, on several threads at once, and can pick up where it was stopped.
+
+   The source is either a record (typically an OdbcPointRecord on the historian) and a list of its tags, or a CSV
+   file of tag,time,value[,quality[,confidence]] lines. The work is split into partitions: each tag's time range cut
+   into pieces of partitionLength seconds, or the file cut into chunks of whole lines. Each worker thread takes the
+   next partition, fetches it, converts it -- sorted, duplicate times dropped, and units converted if asked -- and
+   writes it, so that at any moment some threads are waiting on the source while others are writing.
+
+   A database source is read with DbPointRecord::selectUncached, and a database destination written with
+   DbPointRecord::insertBulk, so neither cache is filled with what's passing through. Any other record has its
+   pointsInRange and addPoints called instead.
+
+   With a checkpoint file, each partition is noted there once it's written, and a later run() of the same import skips
+   what the file lists. A partition that fails is logged and left out, so running again retries just those.
+   */
+
+  /*!
+   \fn void HistorianImport::setSource(PointRecord::sharedPointer source, const std::vector<std::string>& tags)
+   \brief Import from a record.
+   \param source The record to read from.
+   \param tags Which of its series to import, under the same names. Empty means all of its identifiers.
+   */
+
+  class HistorianImport {
+  public:
+    RTX_SHARED_POINTER(HistorianImport);
+    HistorianImport(PointRecord::sharedPointer destination);
+    virtual ~HistorianImport() {};
+
+    // what to import
+    void setSource(PointRecord::sharedPointer source, const std::vector<std::string>& tags = std::vector<std::string>());
+    void setCsvSource(const std::string& path);
+    void setTimeRange(time_t start, time_t end); //! required for a record source. a CSV file's points outside it are skipped, if it's set
+    void setUnitConversion(const Units& sourceUnits, const Units& destinationUnits);
+
+    // how
+    void setPartitionLength(time_t seconds); //! of each tag's range, per partition. a day by default
+    time_t partitionLength();
+    void setThreadCount(size_t count);       //! 0 (the default) means one thread per hardware core
+    void setCheckpointFile(const std::string& path);
+
+    class progress_t {
+    public:
+      progress_t() : partitions(0), finished(0), skipped(0), failed(0), points(0), rejectedLines(0) {};
+      // simple tuple class, so no getters/setters
+      size_t partitions;    // in all
+      size_t finished;      // written this run
+      size_t skipped;       // already checkpointed
+      size_t failed;
+      uint64_t points;      // written this run
+      uint64_t rejectedLines; // of a CSV file, that couldn't be read
+    };
+
+    void run() throw(RtxException); //! blocks until every partition is done, or cancel() is called
+    void cancel();                  //! partitions underway are finished; the rest wait for the next run
+    progress_t progress();
+
+  private:
+    class partition_t {
+    public:
+      // simple tuple class, so no getters/setters
+      std::string tag;
+      time_t start, end;
+      uint64_t offset, length; // a CSV chunk's bytes
+      std::string key() const; // as it's checkpointed
+    };
+    typedef std::map<std::string, std::vector<Point> > keyedPoints_t;
+
+    void makePartitions();
+    void workerLoop();
+    size_t fetch(const partition_t& partition, keyedPoints_t& pointsByTag); // returns the CSV lines rejected
+    void convert(keyedPoints_t& pointsByTag);
+    void write(keyedPoints_t& pointsByTag);
+    void checkpoint(const partition_t& partition);
+
+    PointRecord::sharedPointer _destination, _source;
+    std::vector<std::string> _tags;
+    std::string _csvPath, _checkpointPath;
+    time_t _start, _end, _partitionLength;
+    size_t _threadCount;
+    bool _doesConvert;
+    UnitConverter _converter;
+
+    std::vector<partition_t> _partitions;
+    size_t _nextPartition;
+    std::set<std::string> _registered; // destination identifiers
+    std::ofstream _checkpointFile;
+    progress_t _progress;
+    boost::mutex _mutex; // guards all the run state above
+    boost::atomic<bool> _isCancelled;
+  };
+
+}
+
+#endif
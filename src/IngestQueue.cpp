@@ -0,0 +1,176 @@
+//
+//  IngestQueue.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+
+#include "IngestQueue.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+// positions only ever grow; a slot's sequence says whose turn it is. push claims a position by moving _pushPosition
+// on, then writes its slot and publishes it by setting the sequence one past the position. the drain reads published
+// slots in order and hands each back a lap on. (a bounded multi-producer queue after Dmitry Vyukov's, with one consumer.)
+
+IngestQueue::IngestQueue(PointRecord::sharedPointer record, size_t capacity) : _record(record), _pushPosition(0), _overflows(0) {
+  _capacity = 2;
+  while (_capacity < capacity) {
+    _capacity <<= 1;
+  }
+  _mask = _capacity - 1;
+  _slots.reset(new Slot[_capacity]);
+  for (size_t iSlot = 0; iSlot < _capacity; ++iSlot) {
+    _slots[iSlot].sequence.store(iSlot, boost::memory_order_relaxed);
+    _slots[iSlot].handle = 0;
+  }
+  _drainPosition = 0;
+  _isMergeStopping = false;
+}
+
+IngestQueue::~IngestQueue() {
+  stopMerging();
+  try {
+    drain();
+  } catch (std::exception& e) {
+    RTX_LOG(error, "IngestQueue", "drain failed: " << e.what());
+  }
+}
+
+PointRecord::sharedPointer IngestQueue::record() {
+  return _record;
+}
+
+size_t IngestQueue::capacity() {
+  return _capacity;
+}
+
+unsigned long IngestQueue::overflowCount() {
+  return _overflows.load();
+}
+
+
+#pragma mark - Producers
+
+void IngestQueue::push(PointRecord::handle_t handle, const Point& point) {
+  size_t position = _pushPosition.load(boost::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &_slots[position & _mask];
+    size_t sequence = slot->sequence.load(boost::memory_order_acquire);
+    if (sequence == position) {
+      if (_pushPosition.compare_exchange_weak(position, position + 1, boost::memory_order_relaxed)) {
+        break; // it's ours
+      }
+      // someone else got it -- position has been reloaded
+    }
+    else if (sequence < position) {
+      // still holding a sample from a lap ago, which the drain hasn't got to: the queue is full
+      ++_overflows;
+      _record->addPoint(handle, point);
+      _record->notifyObservers(_record->identifierForHandle(handle), std::vector<Point>(1, point));
+      return;
+    }
+    else {
+      position = _pushPosition.load(boost::memory_order_relaxed);
+    }
+  }
+  slot->handle = handle;
+  slot->point = point;
+  slot->sequence.store(position + 1, boost::memory_order_release);
+}
+
+size_t IngestQueue::backlog() {
+  size_t pushed = _pushPosition.load(boost::memory_order_relaxed);
+  boost::lock_guard<boost::mutex> lock(_drainMutex);
+  return (pushed > _drainPosition) ? (pushed - _drainPosition) : 0;
+}
+
+
+#pragma mark - Consumer
+
+size_t IngestQueue::drain() {
+  boost::lock_guard<boost::mutex> lock(_drainMutex);
+
+  // only what was pushed before the drain began, so that a busy feed can't keep it going. a slot claimed but not
+  // yet written waits for the next drain, with everything after it.
+  size_t end = _pushPosition.load(boost::memory_order_acquire);
+  while (_drainPosition != end) {
+    Slot& slot = _slots[_drainPosition & _mask];
+    if (slot.sequence.load(boost::memory_order_acquire) != _drainPosition + 1) {
+      break;
+    }
+    PointRecord::handle_t handle = slot.handle;
+    if (handle >= _batches.size()) {
+      _batches.resize(handle + 1);
+    }
+    if (_batches[handle].empty()) {
+      _pending.push_back(handle);
+    }
+    _batches[handle].push_back(slot.point);
+    slot.sequence.store(_drainPosition + _capacity, boost::memory_order_release);
+    ++_drainPosition;
+  }
+
+  size_t count = 0;
+  BOOST_FOREACH(PointRecord::handle_t handle, _pending) {
+    std::vector<Point>& batch = _batches[handle];
+    _record->mergePoints(handle, batch);
+    _record->notifyObservers(_record->identifierForHandle(handle), batch);
+    count += batch.size();
+    batch.clear();
+  }
+  _pending.clear();
+  return count;
+}
+
+
+#pragma mark - Merge Thread
+
+void IngestQueue::startMerging(unsigned int milliseconds) {
+  if (_mergeThread) {
+    return;
+  }
+  _isMergeStopping = false;
+  _mergeThread.reset(new boost::thread(boost::bind(&IngestQueue::mergeLoop, this, RTX_MAX(milliseconds, 1u))));
+}
+
+void IngestQueue::stopMerging() {
+  if (!_mergeThread) {
+    return;
+  }
+  {
+    boost::lock_guard<boost::mutex> lock(_mergeMutex);
+    _isMergeStopping = true;
+  }
+  _mergeWake.notify_all();
+  _mergeThread->join();
+  _mergeThread.reset();
+}
+
+bool IngestQueue::isMerging() {
+  return (bool)_mergeThread;
+}
+
+void IngestQueue::mergeLoop(unsigned int milliseconds) {
+  boost::unique_lock<boost::mutex> lock(_mergeMutex);
+  while (!_isMergeStopping) {
+    _mergeWake.timed_wait(lock, boost::posix_time::milliseconds(milliseconds));
+    if (_isMergeStopping) {
+      break;
+    }
+    lock.unlock();
+    try {
+      drain();
+    } catch (std::exception& e) {
+      RTX_LOG(error, "IngestQueue", "drain failed: " << e.what());
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,96 @@
+//
+//  IngestQueue.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_IngestQueue_h
+#define epanet_rtx_IngestQueue_h
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "rtxMacros.h"
+#include "Point.h"
+#include "PointRecord.h"
+
+namespace RTX {
+
+  /*!
+   \class IngestQueue
+   \brief A lock-free hand-off from SCADA pollers to a PointRecord, drained in batches.
+
+   A poller that writes each sample straight into a record (TimeSeries::insert, PointRecord::addPoint) takes the
+   series' lock for it, and a late sample is put in its place there and then -- so a busy feed contends with the model
+   reading the same series at every step. Pollers push into an IngestQueue instead: any number of threads at once,
+   each sample a slot claimed in a fixed ring with one atomic operation, and no lock.
+
+   Nothing reaches the record until the queue is drained. A drain takes what's been pushed and hands each series its
+   samples as one batch (PointRecord::mergePoints) -- a lock, a sort and a merge per series per drain, rather than
+   per sample -- and then tells the series' observers, as a feed does (see PointRecord::notifyObservers). Drain where
+   the readers can wait for it: a model drains the queues it's given at the start of every live period (see
+   Model::addIngestQueue), or a merge thread drains every so often (startMerging). One drain runs at a time.
+
+   A full queue doesn't lose a sample: the push writes it straight to the record, the slow way, and counts it (see
+   overflowCount) -- a sign the queue wants to be bigger, or drained more often. Samples go to the record as they are;
+   a series' write deadband (see TimeSeries::setWriteDeadband) isn't applied.
+   */
+
+  class IngestQueue {
+  public:
+    RTX_SHARED_POINTER(IngestQueue);
+    IngestQueue(PointRecord::sharedPointer record, size_t capacity = 65536); //! capacity is rounded up to a power of two
+    virtual ~IngestQueue(); //! stops merging, and drains what's left
+
+    PointRecord::sharedPointer record();
+    size_t capacity();
+
+    void push(PointRecord::handle_t handle, const Point& point); //! from any thread. see PointRecord::registerAndGetHandle
+    size_t drain();        //! hands what's been pushed to the record. returns how many points
+    size_t backlog();      //! about how many are waiting
+    unsigned long overflowCount(); //! pushes that found the queue full
+
+    // a thread of its own, draining every so often
+    void startMerging(unsigned int milliseconds = 250);
+    void stopMerging();
+    bool isMerging();
+
+  private:
+    class Slot {
+    public:
+      boost::atomic<size_t> sequence; // its position when free to push into, one past that once pushed
+      PointRecord::handle_t handle;
+      Point point;
+    };
+    void mergeLoop(unsigned int milliseconds);
+
+    PointRecord::sharedPointer _record;
+    size_t _capacity, _mask;
+    boost::scoped_array<Slot> _slots;
+    char _padBefore[64];
+    boost::atomic<size_t> _pushPosition;  // the pollers' claims, a cache line away from the drain's
+    char _padAfter[64];
+    size_t _drainPosition;                // only touched under the drain mutex
+    boost::atomic<unsigned long> _overflows;
+
+    boost::mutex _drainMutex;
+    std::vector< std::vector<Point> > _batches; // by handle, kept between drains for their capacity
+    std::vector<PointRecord::handle_t> _pending; // handles with a batch this drain
+
+    boost::shared_ptr<boost::thread> _mergeThread;
+    bool _isMergeStopping;
+    boost::mutex _mergeMutex;
+    boost::condition_variable _mergeWake;
+  };
+
+}
+
+#endif
@@ -7,18 +7,23 @@
 //  
 
 #include <iostream>
+#include <algorithm>
 #include "IrregularClock.h"
+#include "Log.h"
 #include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
 
 using namespace RTX;
 using namespace std;
 
-IrregularClock::IrregularClock(PointRecord::sharedPointer pointRecord, std::string name) : Clock(0,0), _name(name) {
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+IrregularClock::IrregularClock(PointRecord::sharedPointer pointRecord, std::string name) : Clock(0,0), _name(name), _coveredStart(0), _coveredEnd(0), _hasCoverage(false), _cursor(0), _evictions(0) {
   if (pointRecord) {
     _pointRecord = pointRecord;
   }
   else {
-    std::cerr << "could not construct IrregularClock object: no Point Record provided\n";
+    RTX_LOG(error, "IrregularClock", "could not construct IrregularClock object: no Point Record provided");
   }
   
 }
@@ -35,6 +40,13 @@ bool IrregularClock::isCompatibleWith(Clock::sharedPointer clock) {
 }
 
 bool IrregularClock::isValid(time_t time) {
+  {
+    scopedLock_t lock(_indexMutex);
+    if (isCovered(time, time)) {
+      size_t index = lowerBound(time);
+      return (index < _times.size() && _times[index] == time);
+    }
+  }
   if (_pointRecord->point(_name, time).isValid) {
     return true;
   }
@@ -45,6 +57,20 @@ bool IrregularClock::isValid(time_t time) {
 
 
 time_t IrregularClock::timeAfter(time_t time) {
+  {
+    // answerable here if the index runs from before the time up to some later point
+    scopedLock_t lock(_indexMutex);
+    if (_hasCoverage && _coveredStart <= time) {
+      size_t index = lowerBound(time);
+      if (index < _times.size() && _times[index] == time) {
+        ++index;
+        _cursor = index;
+      }
+      if (index < _times.size()) {
+        return _times[index];
+      }
+    }
+  }
   Point aPoint;
   aPoint = _pointRecord->pointAfter(_name, time);
   if (aPoint.isValid) {
@@ -58,6 +84,17 @@ time_t IrregularClock::timeAfter(time_t time) {
 }
 
 time_t IrregularClock::timeBefore(time_t time) {
+  {
+    // answerable here if the index runs from some earlier point right up to the time
+    scopedLock_t lock(_indexMutex);
+    if (_hasCoverage && time - 1 <= _coveredEnd) {
+      size_t index = lowerBound(time);
+      if (index > 0) {
+        _cursor = index - 1;
+        return _times[index - 1];
+      }
+    }
+  }
   Point aPoint;
   aPoint = _pointRecord->pointBefore(_name, time);
   if (aPoint.isValid) {
@@ -69,22 +106,148 @@ time_t IrregularClock::timeBefore(time_t time) {
   }
 }
 
-vector<time_t> IrregularClock::timeValuesInRange(time_t start, time_t end) {
-  vector<Point> points = _pointRecord->pointsInRange(_name, start, end);
-  vector<time_t> times;
+namespace {
+  // collects visited times into a vector
+  class TimeCollector : public TimeVisitor {
+  public:
+    TimeCollector(std::vector<time_t>& times) : _times(times) {};
+    virtual bool visit(time_t time) {
+      _times.push_back(time);
+      return true;
+    }
+  private:
+    std::vector<time_t>& _times;
+  };
   
-  BOOST_FOREACH(Point p, points) {
-    
-    time_t t = p.time;
-    
-    if (start <= t && t <= end) {
-      times.push_back(t);
+  // passes the times of a record's points on to a TimeVisitor
+  class PointTimeVisitor : public PointVisitor {
+  public:
+    PointTimeVisitor(TimeVisitor& timeVisitor) : _timeVisitor(timeVisitor) {};
+    virtual bool visit(const Point& point) {
+      return _timeVisitor.visit(point.time);
+    }
+  private:
+    TimeVisitor& _timeVisitor;
+  };
+}
+
+void IrregularClock::visitTimeValuesInRange(time_t start, time_t end, TimeVisitor& visitor) {
+  std::vector<time_t> times;
+  bool covered = false;
+  {
+    scopedLock_t lock(_indexMutex);
+    covered = isCovered(start, end);
+    if (covered) {
+      // copied out, so the visitor is free to call back into the clock.
+      std::vector<time_t>::iterator first = std::lower_bound(_times.begin(), _times.end(), start);
+      std::vector<time_t>::iterator last = std::upper_bound(first, _times.end(), end);
+      times.assign(first, last);
     }
-    
   }
   
-  return times;
+  if (!covered) {
+    // read the times off the record once, and keep them.
+    unsigned long evictions = _pointRecord->evictionCount(_name);
+    TimeCollector collector(times);
+    PointTimeVisitor pointVisitor(collector);
+    _pointRecord->visitPointsInRange(_name, start, end, pointVisitor);
+  
+    scopedLock_t lock(_indexMutex);
+    if (!_hasCoverage || evictions != _evictions || end < _coveredStart - 1 || _coveredEnd + 1 < start) {
+      // nothing (current) to join up with: this span is the index now
+      _times = times;
+      _coveredStart = start;
+      _coveredEnd = end;
+      _evictions = evictions;
+    }
+    else {
+      // overlapping or touching: splice the fresh times in over their span
+      std::vector<time_t> merged;
+      merged.reserve(_times.size() + times.size());
+      std::vector<time_t>::iterator before = std::lower_bound(_times.begin(), _times.end(), start);
+      std::vector<time_t>::iterator after = std::upper_bound(_times.begin(), _times.end(), end);
+      merged.insert(merged.end(), _times.begin(), before);
+      merged.insert(merged.end(), times.begin(), times.end());
+      merged.insert(merged.end(), after, _times.end());
+      _times.swap(merged);
+      _coveredStart = RTX_MIN(_coveredStart, start);
+      _coveredEnd = RTX_MAX(_coveredEnd, end);
+    }
+    _hasCoverage = true;
+    _cursor = 0;
+  }
   
+  BOOST_FOREACH(time_t time, times) {
+    if (!visitor.visit(time)) {
+      break;
+    }
+  }
+}
+
+void IrregularClock::didAddPoints(PointRecord* record, const std::string& name, const std::vector<Point>& points) {
+  if (record != _pointRecord.get() || name != _name) {
+    return;
+  }
+  scopedLock_t lock(_indexMutex);
+  if (!_hasCoverage) {
+    return;
+  }
+  if (_pointRecord->evictionCount(_name) != _evictions) {
+    // the record let something go; no telling what, so start over.
+    _times.clear();
+    _hasCoverage = false;
+    _cursor = 0;
+    return;
+  }
+  // new times inside the covered span go into the index; outside it they're the record's business.
+  std::vector<time_t> added;
+  BOOST_FOREACH(const Point& p, points) {
+    if (_coveredStart <= p.time && p.time <= _coveredEnd) {
+      added.push_back(p.time);
+    }
+  }
+  if (added.empty()) {
+    return;
+  }
+  std::sort(added.begin(), added.end());
+  if (_times.empty() || added.front() > _times.back()) {
+    _times.insert(_times.end(), added.begin(), added.end());
+  }
+  else {
+    std::vector<time_t> merged;
+    merged.reserve(_times.size() + added.size());
+    std::merge(_times.begin(), _times.end(), added.begin(), added.end(), std::back_inserter(merged));
+    _times.swap(merged);
+  }
+  _times.erase(std::unique(_times.begin(), _times.end()), _times.end());
+  _cursor = 0;
+}
+
+void IrregularClock::resetIndex() {
+  scopedLock_t lock(_indexMutex);
+  _times.clear();
+  _hasCoverage = false;
+  _cursor = 0;
+}
+
+
+#pragma mark - Private Methods
+
+bool IrregularClock::isCovered(time_t start, time_t end) {
+  return (_hasCoverage && _coveredStart <= start && end <= _coveredEnd);
+}
+
+size_t IrregularClock::lowerBound(time_t time) {
+  // walking forward through the times is the common case, so try where the last lookup left off.
+  size_t size = _times.size();
+  if (_cursor < size && _times[_cursor] >= time && (_cursor == 0 || _times[_cursor - 1] < time)) {
+    return _cursor;
+  }
+  if (_cursor + 1 < size && _times[_cursor + 1] >= time && _times[_cursor] < time) {
+    return ++_cursor;
+  }
+  _cursor = std::lower_bound(_times.begin(), _times.end(), time) - _times.begin();
+  return _cursor;
 }
 
 
@@ -9,11 +9,29 @@
 #ifndef epanet_rtx_IrregularClock_h
 #define epanet_rtx_IrregularClock_h
 
+#include <vector>
+
 #include "Clock.h"
 #include "PointRecord.h"
 
+#include <boost/thread/mutex.hpp>
+
 namespace RTX {
   
+  /*!
+   \class IrregularClock
+   \brief A clock whose times are the times of the points stored for one series in a PointRecord.
+   
+   The clock keeps its own sorted index of those times, so that isValid, timeAfter and timeBefore are a binary
+   search (or a step from the last answer) instead of a trip to the record. The index covers whatever span has been
+   read through visitTimeValuesInRange, and is exact within it. Queries outside that span go to the record.
+   
+   The owning TimeSeries keeps the index current: it reports each write with didAddPoints, and calls resetIndex when
+   its cache is cleared. If the record drops points by itself (see PointRecord::evictionCount), the index is thrown
+   away and rebuilt on the next range read. Points written behind the series' back, without notifyObservers, won't
+   be seen until resetIndex is called.
+   */
+  
   class IrregularClock : public Clock {
   public:
     RTX_SHARED_POINTER(IrregularClock);
@@ -24,12 +42,24 @@ namespace RTX {
     virtual bool isValid(time_t time);
     virtual time_t timeAfter(time_t time);
     virtual time_t timeBefore(time_t time);
-    virtual std::vector< time_t > timeValuesInRange(time_t start, time_t end);
+    virtual void visitTimeValuesInRange(time_t start, time_t end, TimeVisitor& visitor);
     virtual std::ostream& toStream(std::ostream &stream);
     
+    // index upkeep
+    void didAddPoints(PointRecord* record, const std::string& name, const std::vector<Point>& points); //! ignored unless it's my record and name
+    void resetIndex();
+    
   private:
+    bool isCovered(time_t start, time_t end); //! caller holds the lock
+    size_t lowerBound(time_t time);           //! caller holds the lock; checks the cursor first
     PointRecord::sharedPointer _pointRecord;
     std::string _name;
+    std::vector<time_t> _times;               // sorted: every record time in [_coveredStart, _coveredEnd]
+    time_t _coveredStart, _coveredEnd;
+    bool _hasCoverage;
+    size_t _cursor;                           // where the last lookup landed
+    unsigned long _evictions;                 // the record's count when the index was built
+    boost::mutex _indexMutex;
   };
   
 }
@@ -0,0 +1,197 @@
+//
+//  Log.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <map>
+#include <deque>
+#include <cstdlib>
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "Log.h"
+
+// beyond this many waiting to be written, messages are dropped (and counted) rather than held
+#define RTX_LOG_QUEUE_LIMIT 100000
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
+boost::atomic<int> Log::_lowestLevel(Log::warningLevel);
+
+namespace {
+  // everything behind the static interface. it's never destroyed, so whatever logs during static destruction is safe.
+  class LogState {
+  public:
+    LogState() : globalLevel(Log::warningLevel), hasOverrides(false), isWriting(false), droppedCount(0), sink(new Log::StreamSink()) {};
+    // levels
+    boost::atomic<int> globalLevel;
+    boost::atomic<bool> hasOverrides;
+    std::map<std::string, Log::level_t> levels;
+    boost::shared_mutex levelsMutex;
+    // the queue, and its writer
+    std::deque<Log::entry_t> queue;
+    bool isWriting;
+    size_t droppedCount;
+    Log::Sink::sharedPointer sink;
+    boost::mutex queueMutex;
+    boost::condition_variable queueChanged;
+    boost::shared_ptr<boost::thread> writer;
+  };
+
+  LogState& state() {
+    static LogState* theState = new LogState();
+    return *theState;
+  }
+
+  void flushAtExit() {
+    Log::flush();
+  }
+
+  // the global level and every subsystem's, for Log::isEnabled's first check. caller holds levelsMutex
+  void updateLowestLevel(LogState& log, boost::atomic<int>& lowest) {
+    int level = log.globalLevel.load();
+    typedef std::map<std::string, Log::level_t>::value_type levelEntry_t;
+    BOOST_FOREACH(const levelEntry_t& entry, log.levels) {
+      level = RTX_MIN(level, (int)entry.second);
+    }
+    lowest = level;
+    log.hasOverrides = !log.levels.empty();
+  }
+
+  void writeEntries() {
+    LogState& log = state();
+    scopedLock_t lock(log.queueMutex);
+    while (true) {
+      while (log.queue.empty()) {
+        log.queueChanged.wait(lock);
+      }
+      std::deque<Log::entry_t> entries;
+      entries.swap(log.queue);
+      Log::Sink::sharedPointer sink = log.sink;
+      log.isWriting = true;
+      lock.unlock();
+      if (sink) {
+        BOOST_FOREACH(const Log::entry_t& entry, entries) {
+          sink->write(entry);
+        }
+      }
+      lock.lock();
+      log.isWriting = false;
+      log.queueChanged.notify_all();
+    }
+  }
+}
+
+
+#pragma mark - Levels
+
+void Log::setLevel(level_t level) {
+  LogState& log = state();
+  writeLock_t lock(log.levelsMutex);
+  log.globalLevel = level;
+  updateLowestLevel(log, _lowestLevel);
+}
+
+Log::level_t Log::level() {
+  return (level_t)state().globalLevel.load();
+}
+
+void Log::setLevel(const std::string& subsystem, level_t level) {
+  LogState& log = state();
+  writeLock_t lock(log.levelsMutex);
+  log.levels[subsystem] = level;
+  updateLowestLevel(log, _lowestLevel);
+}
+
+void Log::clearLevel(const std::string& subsystem) {
+  LogState& log = state();
+  writeLock_t lock(log.levelsMutex);
+  log.levels.erase(subsystem);
+  updateLowestLevel(log, _lowestLevel);
+}
+
+bool Log::isKept(level_t level, const char* subsystem) {
+  LogState& log = state();
+  if (!log.hasOverrides.load(boost::memory_order_relaxed)) {
+    return level >= log.globalLevel.load(boost::memory_order_relaxed);
+  }
+  readLock_t lock(log.levelsMutex);
+  std::map<std::string, level_t>::const_iterator found = log.levels.find(subsystem);
+  return level >= ((found != log.levels.end()) ? (int)found->second : log.globalLevel.load());
+}
+
+std::string Log::levelName(level_t level) {
+  switch (level) {
+    case debugLevel:
+      return "debug";
+    case infoLevel:
+      return "info";
+    case warningLevel:
+      return "warning";
+    case errorLevel:
+      return "error";
+    default:
+      return "off";
+  }
+}
+
+
+#pragma mark - Writing
+
+void Log::write(level_t level, const char* subsystem, const std::string& message) {
+  entry_t entry;
+  entry.level = level;
+  entry.subsystem = subsystem;
+  entry.message = message;
+  entry.time = ::time(NULL);
+
+  LogState& log = state();
+  scopedLock_t lock(log.queueMutex);
+  if (log.queue.size() >= RTX_LOG_QUEUE_LIMIT) {
+    ++log.droppedCount;
+    return;
+  }
+  if (!log.writer) {
+    log.writer.reset(new boost::thread(&writeEntries));
+    atexit(&flushAtExit);
+  }
+  log.queue.push_back(entry);
+  log.queueChanged.notify_all();
+}
+
+void Log::setSink(Sink::sharedPointer sink) {
+  LogState& log = state();
+  scopedLock_t lock(log.queueMutex);
+  log.sink = sink;
+}
+
+void Log::flush() {
+  LogState& log = state();
+  scopedLock_t lock(log.queueMutex);
+  while (!log.queue.empty() || log.isWriting) {
+    log.queueChanged.wait(lock);
+  }
+}
+
+size_t Log::dropped() {
+  LogState& log = state();
+  scopedLock_t lock(log.queueMutex);
+  return log.droppedCount;
+}
+
+void Log::StreamSink::write(const entry_t& entry) {
+  _stream << entry.subsystem << ": " << entry.message << endl;
+}
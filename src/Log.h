@@ -0,0 +1,110 @@
+//
+//  Log.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_Log_h
+#define epanet_rtx_Log_h
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <time.h>
+
+#include "rtxMacros.h"
+
+#include <boost/atomic.hpp>
+
+namespace RTX {
+
+  /*!
+   \class Log
+   \brief Leveled, filtered diagnostics, handed to a sink on a background thread.
+
+   Each message has a level and a subsystem (the class it comes from -- "Model", "Zone", "DbPointRecord"). A message
+   is kept if its level is at least its subsystem's level, or the global level if its subsystem has none set; the
+   global level is warning by default. Kept messages are queued, and a background thread writes them to the sink in
+   order, so the thread logging never waits on the console. The default sink writes each as "subsystem: message" to
+   stderr. flush() waits until everything queued has been written, as does the end of the program.
+
+   Log with RTX_LOG(level, subsystem, stream expression) -- e.g. RTX_LOG(warning, "Zone", "no junctions in " << name).
+   A message below the levels set costs a relaxed load and a comparison, and its stream expression is never
+   evaluated. Below RTX_LOG_MINIMUM_LEVEL, set when building (0 = debug, the default, up to 3 = error), it isn't
+   compiled in at all.
+   */
+
+  class Log {
+  public:
+    typedef enum {
+      debugLevel,
+      infoLevel,
+      warningLevel,
+      errorLevel,
+      offLevel
+    } level_t;
+
+    class entry_t {
+    public:
+      // simple tuple class, so no getters/setters
+      level_t level;
+      std::string subsystem;
+      std::string message;
+      time_t time; // wall clock, when it was logged
+    };
+
+    class Sink {
+    public:
+      RTX_SHARED_POINTER(Sink);
+      virtual ~Sink() {};
+      virtual void write(const entry_t& entry) = 0; //! on the logging thread, one entry at a time
+    };
+
+    //! writes "subsystem: message" lines to a stream
+    class StreamSink : public Sink {
+    public:
+      RTX_SHARED_POINTER(StreamSink);
+      StreamSink(std::ostream& stream = std::cerr) : _stream(stream) {};
+      virtual void write(const entry_t& entry);
+    private:
+      std::ostream& _stream;
+    };
+
+    static void setLevel(level_t level);
+    static level_t level();
+    static void setLevel(const std::string& subsystem, level_t level); //! overrides the global level for a subsystem
+    static void clearLevel(const std::string& subsystem);              //! and goes back to it
+    static void setSink(Sink::sharedPointer sink); //! NULL discards everything
+    static void flush();
+    static size_t dropped(); //! messages not kept because the queue was full
+
+    static bool isEnabled(level_t level, const char* subsystem) {
+      return (level >= _lowestLevel.load(boost::memory_order_relaxed)) && isKept(level, subsystem);
+    };
+    static void write(level_t level, const char* subsystem, const std::string& message);
+    static std::string levelName(level_t level);
+
+  private:
+    static boost::atomic<int> _lowestLevel; // of the global and every subsystem level, for the cheap first check
+    static bool isKept(level_t level, const char* subsystem);
+  };
+
+}
+
+#ifndef RTX_LOG_MINIMUM_LEVEL
+#define RTX_LOG_MINIMUM_LEVEL 0
+#endif
+
+// level is debug, info, warning or error; message is anything that can follow a << into a stringstream
+#define RTX_LOG(level, subsystem, message) \
+  do { \
+    if (RTX::Log::level##Level >= RTX_LOG_MINIMUM_LEVEL && RTX::Log::isEnabled(RTX::Log::level##Level, subsystem)) { \
+      std::stringstream rtxLogMessage; \
+      rtxLogMessage << message; \
+      RTX::Log::write(RTX::Log::level##Level, subsystem, rtxLogMessage.str()); \
+    } \
+  } while (0)
+
+#endif
@@ -9,11 +9,16 @@
 #include <iostream>
 
 #include "MapPointRecord.h"
+#include "Log.h"
 #include "boost/foreach.hpp"
+#include <boost/thread/locks.hpp>
 
 using namespace RTX;
 using namespace std;
 
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
 MapPointRecord::MapPointRecord() {
   _nextKey = 0;
   _connectionString = "";
@@ -28,9 +33,24 @@ std::ostream& MapPointRecord::toStream(std::ostream &stream) {
   return stream;
 }
 
+// a tree node apiece: the time and point, plus the node's links and color
+size_t MapPointRecord::seriesMemoryFootprint(const std::string& identifier) {
+  readLock_t lock(_mutex);
+  std::map<std::string, int>::const_iterator key = _keys.find(identifier);
+  if (key == _keys.end()) {
+    return 0;
+  }
+  keyedPointMap_t::const_iterator it = _points.find(key->second);
+  if (it == _points.end()) {
+    return 0;
+  }
+  return it->second.size() * (sizeof(pointMap_t::value_type) + 4 * sizeof(void*));
+}
+
 
 std::string MapPointRecord::registerAndGetIdentifier(std::string recordName) {
   // register the recordName internally and generate a unique key identifier
+  writeLock_t lock(_mutex);
   
   // check to see if it's there first
   if (_keys.find(recordName) == _keys.end()) {
@@ -45,21 +65,24 @@ std::string MapPointRecord::registerAndGetIdentifier(std::string recordName) {
 }
 
 int MapPointRecord::identifierForName(std::string recordName) {
-  if (_keys.find(recordName) != _keys.end()) {
-    return _keys[recordName];
+  std::map<std::string, int>::const_iterator it = _keys.find(recordName);
+  if (it != _keys.end()) {
+    return it->second;
   }
   else return -1;
 }
 
 string MapPointRecord::nameForIdentifier(int identifier) {
-  if (_names.find(identifier) != _names.end()) {
-    return _names[identifier];
+  std::map<int, std::string>::const_iterator it = _names.find(identifier);
+  if (it != _names.end()) {
+    return it->second;
   }
   else return string("");
 }
 
 std::vector<std::string> MapPointRecord::identifiers() {
   typedef std::map< int, std::string >::value_type& nameMapValue_t;
+  readLock_t lock(_mutex);
   vector<string> names;
   BOOST_FOREACH(nameMapValue_t name, _names) {
     names.push_back(name.second);
@@ -94,10 +117,7 @@ bool MapPointRecord::isPointAvailable(const string& identifier, time_t time) {
 
 Point MapPointRecord::point(const string& identifier, time_t time) {
   Point p;
-  
-  if (_cachedPoint.time == time && RTX_STRINGS_ARE_EQUAL_CS(_cachedPointId, identifier) ) {
-    return _cachedPoint;
-  }
+  readLock_t lock(_mutex);
   
   keyedPointMap_t::iterator it = _points.find(identifierForName(identifier));
   if (it == _points.end()) {
@@ -110,9 +130,7 @@ Point MapPointRecord::point(const string& identifier, time_t time) {
       return Point();
     }
     else {
-      _cachedPointId = identifier;
-      _cachedPoint = (*pointIt).second;
-      return _cachedPoint;
+      return (*pointIt).second;
     }
   }
   
@@ -124,11 +142,12 @@ Point MapPointRecord::point(const string& identifier, time_t time) {
 
 
 Point MapPointRecord::pointBefore(const string& identifier, time_t time) {
+  readLock_t lock(_mutex);
   keyedPointMap_t::iterator it = _points.find(identifierForName(identifier));
   if (it == _points.end()) {
     return Point();
   }
-  pointMap_t pointMap = (*it).second;
+  pointMap_t& pointMap = (*it).second;
   pointMap_t::iterator pointIt = pointMap.lower_bound(time);
   if (pointIt == pointMap.end()) {
     return Point();
@@ -146,12 +165,13 @@ Point MapPointRecord::pointBefore(const string& identifier, time_t time) {
 
 
 Point MapPointRecord::pointAfter(const string& identifier, time_t time) {
+  readLock_t lock(_mutex);
   int id = identifierForName(identifier);
   keyedPointMap_t::iterator it = _points.find(id);
   if (it == _points.end()) {
     return Point();
   }
-  pointMap_t pointMap = (*it).second;
+  pointMap_t& pointMap = (*it).second;
   pointMap_t::iterator pointIt = pointMap.upper_bound(time);
   if (pointIt == pointMap.end()) {
     return Point();
@@ -164,11 +184,12 @@ Point MapPointRecord::pointAfter(const string& identifier, time_t time) {
 
 std::vector<Point> MapPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
   std::vector<Point> pointVector;
+  readLock_t lock(_mutex);
   keyedPointMap_t::iterator it = _points.find(identifierForName(identifier));
   if (it == _points.end()) {
     return pointVector;
   }
-  pointMap_t pointMap = (*it).second;
+  pointMap_t& pointMap = (*it).second;
   pointMap_t::iterator pointIt = pointMap.lower_bound(startTime);
   while (pointIt != pointMap.end() && (*pointIt).second.time <= endTime) {
     pointVector.push_back((*pointIt).second);
@@ -179,12 +200,13 @@ std::vector<Point> MapPointRecord::pointsInRange(const string& identifier, time_
 
 Point MapPointRecord::firstPoint(const string &id) {
   Point p;
+  readLock_t lock(_mutex);
   keyedPointMap_t::iterator it = _points.find(identifierForName(id));
   if (it == _points.end()) {
     return p;
   }
   
-  pointMap_t pm = (*it).second;
+  pointMap_t& pm = (*it).second;
   pointMap_t::iterator rIt = pm.begin();
   if (rIt != pm.end()) {
     p = (*rIt).second;
@@ -197,12 +219,13 @@ Point MapPointRecord::firstPoint(const string &id) {
 
 Point MapPointRecord::lastPoint(const string &id) {
   Point p;
+  readLock_t lock(_mutex);
   keyedPointMap_t::iterator it = _points.find(identifierForName(id));
   if (it == _points.end()) {
     return p;
   }
   
-  pointMap_t pm = (*it).second;
+  pointMap_t& pm = (*it).second;
   pointMap_t::reverse_iterator rIt = pm.rbegin();
   if (rIt != pm.rend()) {
     p = (*rIt).second;
@@ -215,13 +238,14 @@ Point MapPointRecord::lastPoint(const string &id) {
 
 
 void MapPointRecord::addPoint(const string& identifier, Point point) {
+  writeLock_t lock(_mutex);
   keyedPointMap_t::iterator it = _points.find(identifierForName(identifier));
   if (it == _points.end()) {
     return;
   }
   /* todo -- compile-time logging info
   if (it->second.find(point.time) != it->second.end()) {
-    cerr <<  "overwriting point in " << identifier << " :: " << point << endl;
+    RTX_LOG(debug, "MapPointRecord", "overwriting point in " << identifier << " :: " << point);
   }
    */
   it->second[point.time] = point;
@@ -229,21 +253,28 @@ void MapPointRecord::addPoint(const string& identifier, Point point) {
 }
 
 
-void MapPointRecord::addPoints(const string& identifier, std::vector<Point> points) {
-  BOOST_FOREACH(Point thePoint, points) {
-    MapPointRecord::addPoint(identifier, thePoint);
+void MapPointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
+  writeLock_t lock(_mutex);
+  keyedPointMap_t::iterator it = _points.find(identifierForName(identifier));
+  if (it == _points.end()) {
+    return;
+  }
+  BOOST_FOREACH(const Point& thePoint, points) {
+    it->second[thePoint.time] = thePoint;
   }
 }
 
 
 void MapPointRecord::reset() {
   typedef keyedPointMap_t::value_type& keyedPointMapValue;
+  writeLock_t lock(_mutex);
   BOOST_FOREACH(keyedPointMapValue pointMapValue, _points) {
     pointMapValue.second.clear();
   }
 }
 
 void MapPointRecord::reset(const string& identifier) {
+  writeLock_t lock(_mutex);
   keyedPointMap_t::iterator it = _points.find(identifierForName(identifier));
   if (it == _points.end()) {
     return;
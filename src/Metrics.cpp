@@ -0,0 +1,412 @@
+//
+//  Metrics.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "Metrics.h"
+#include "Log.h"
+#include "Model.h"
+#include "DbPointRecord.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+namespace {
+  // as Prometheus' own client libraries have them: seconds, from 5 ms to 10 s
+  const double defaultBounds[] = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+  void labelValue(std::ostream& stream, const std::string& text) {
+    BOOST_FOREACH(char c, text) {
+      switch (c) {
+        case '\\':
+          stream << "\\\\";
+          break;
+        case '"':
+          stream << "\\\"";
+          break;
+        case '\n':
+          stream << "\\n";
+          break;
+        default:
+          stream << c;
+          break;
+      }
+    }
+  }
+
+  // name{key="value",...}, with le (if given) last
+  void sampleName(std::ostream& stream, const std::string& name, const Metrics::labels_t& labels, const std::string& le = "") {
+    stream << name;
+    if (labels.empty() && le.empty()) {
+      return;
+    }
+    stream << "{";
+    bool isFirst = true;
+    BOOST_FOREACH(const Metrics::labels_t::value_type& label, labels) {
+      stream << (isFirst ? "" : ",") << label.first << "=\"";
+      labelValue(stream, label.second);
+      stream << "\"";
+      isFirst = false;
+    }
+    if (!le.empty()) {
+      stream << (isFirst ? "" : ",") << "le=\"" << le << "\"";
+    }
+    stream << "}";
+  }
+
+  void sampleValue(std::ostream& stream, double value) {
+    if (std::isnan(value)) {
+      stream << "NaN";
+    }
+    else if (std::isinf(value)) {
+      stream << ((value > 0) ? "+Inf" : "-Inf");
+    }
+    else {
+      stream << value;
+    }
+  }
+
+  const char* kindName(Metrics::kind_t kind) {
+    switch (kind) {
+      case Metrics::counterMetric:
+        return "counter";
+      case Metrics::histogramMetric:
+        return "histogram";
+      default:
+        return "gauge";
+    }
+  }
+
+  // a watched source's reading, gathered before the registry is locked
+  class reading_t {
+  public:
+    reading_t(const std::string& n, Metrics::kind_t k, double v, const Metrics::labels_t& l) : name(n), kind(k), value(v), labels(l) {};
+    // simple tuple class, so no getters/setters
+    std::string name;
+    Metrics::kind_t kind;
+    double value;
+    Metrics::labels_t labels;
+  };
+}
+
+
+Metrics::Metrics() {
+  describe("rtx_model_memory_bytes", gaugeMetric, "Bytes a model holds, by part (see Model::memoryFootprint).");
+  describe("rtx_series_cache_hits_total", counterMetric, "Points a series served from its record.");
+  describe("rtx_series_cache_misses_total", counterMetric, "Spans a series claimed and computed.");
+  describe("rtx_series_cache_hit_ratio", gaugeMetric, "Cache hits over hits and misses, since the series' stats were reset.");
+  describe("rtx_series_compute_seconds_total", counterMetric, "Wall time a series spent computing, its sources included.");
+  describe("rtx_record_memory_bytes", gaugeMetric, "Bytes a point record holds in memory.");
+  describe("rtx_record_cache_hits_total", counterMetric, "Reads a point record answered from memory.");
+  describe("rtx_record_cache_misses_total", counterMetric, "Reads that went to a point record's backing store.");
+  describe("rtx_record_queries_total", counterMetric, "Round trips to a point record's backing store.");
+  describe("rtx_record_query_seconds_total", counterMetric, "Wall time spent in those round trips.");
+  describe("rtx_db_queries_total", counterMetric, "Database queries, by kind.");
+  describe("rtx_db_rows_total", counterMetric, "Rows database queries returned or wrote, by kind.");
+  describe("rtx_db_write_queue_points", gaugeMetric, "Points queued for write-behind and not yet written.");
+}
+
+
+#pragma mark - Recording
+
+Metrics::metric_t& Metrics::metric(const std::string& name, kind_t kind) {
+  std::map<std::string, metric_t>::iterator found = _metrics.find(name);
+  if (found == _metrics.end()) {
+    metric_t& added = _metrics[name];
+    added.family.name = name;
+    added.family.kind = kind;
+    if (kind == histogramMetric) {
+      added.family.bounds.assign(defaultBounds, defaultBounds + sizeof(defaultBounds) / sizeof(double));
+    }
+    return added;
+  }
+  return found->second;
+}
+
+void Metrics::describe(const std::string& name, kind_t kind, const std::string& help, const std::vector<double>& bounds) {
+  scopedLock_t lock(_mutex);
+  metric_t& m = metric(name, kind);
+  m.family.kind = kind;
+  m.family.help = help;
+  if (kind == histogramMetric && !bounds.empty() && m.byLabels.empty()) {
+    m.family.bounds = bounds;
+  }
+}
+
+void Metrics::increment(const std::string& name, double amount, const labels_t& labels) {
+  scopedLock_t lock(_mutex);
+  metric(name, counterMetric).byLabels[labels].value += amount;
+}
+
+void Metrics::setGauge(const std::string& name, double value, const labels_t& labels) {
+  scopedLock_t lock(_mutex);
+  metric(name, gaugeMetric).byLabels[labels].value = value;
+}
+
+void Metrics::observe(const std::string& name, double value, const labels_t& labels) {
+  scopedLock_t lock(_mutex);
+  metric_t& m = metric(name, histogramMetric);
+  series_t& series = m.byLabels[labels];
+  if (series.buckets.empty()) {
+    series.buckets.assign(m.family.bounds.size() + 1, 0);
+  }
+  size_t bucket = lower_bound(m.family.bounds.begin(), m.family.bounds.end(), value) - m.family.bounds.begin();
+  series.buckets[bucket]++;
+  series.count++;
+  series.sum += value;
+}
+
+Metrics::labels_t Metrics::label(const std::string& key, const std::string& value) {
+  labels_t labels;
+  labels[key] = value;
+  return labels;
+}
+
+Metrics::labels_t Metrics::label(const std::string& key, const std::string& value, const std::string& key2, const std::string& value2) {
+  labels_t labels = label(key, value);
+  labels[key2] = value2;
+  return labels;
+}
+
+std::vector<double> Metrics::exponentialBounds(double first, double factor, size_t count) {
+  vector<double> bounds;
+  double bound = first;
+  for (size_t i = 0; i < count; ++i) {
+    bounds.push_back(bound);
+    bound *= factor;
+  }
+  return bounds;
+}
+
+
+#pragma mark - Reading
+
+double Metrics::value(const std::string& name, const labels_t& labels) {
+  scopedLock_t lock(_mutex);
+  std::map<std::string, metric_t>::const_iterator m = _metrics.find(name);
+  if (m == _metrics.end()) {
+    return 0;
+  }
+  std::map<labels_t, series_t>::const_iterator series = m->second.byLabels.find(labels);
+  if (series == m->second.byLabels.end()) {
+    return 0;
+  }
+  return (m->second.family.kind == histogramMetric) ? (double)series->second.count : series->second.value;
+}
+
+std::vector<Metrics::family_t> Metrics::snapshot() {
+  scopedLock_t lock(_mutex);
+  vector<family_t> families;
+  typedef std::map<std::string, metric_t>::value_type metricEntry_t;
+  BOOST_FOREACH(const metricEntry_t& entry, _metrics) {
+    if (entry.second.byLabels.empty()) {
+      continue; // described, but nothing to say yet
+    }
+    family_t family = entry.second.family;
+    typedef std::map<labels_t, series_t>::value_type seriesEntry_t;
+    BOOST_FOREACH(const seriesEntry_t& series, entry.second.byLabels) {
+      family.series.push_back(series.second);
+      family.series.back().labels = series.first;
+    }
+    families.push_back(family);
+  }
+  return families;
+}
+
+void Metrics::reset() {
+  scopedLock_t lock(_mutex);
+  typedef std::map<std::string, metric_t>::value_type metricEntry_t;
+  BOOST_FOREACH(metricEntry_t& entry, _metrics) {
+    entry.second.byLabels.clear();
+  }
+}
+
+
+#pragma mark - Collection
+
+void Metrics::watchModel(boost::shared_ptr<Model> model, const std::string& name) {
+  scopedLock_t lock(_mutex);
+  _models.push_back(make_pair(model, name));
+}
+
+void Metrics::watchSeries(TimeSeries::sharedPointer series) {
+  scopedLock_t lock(_mutex);
+  _series.push_back(series);
+}
+
+void Metrics::watchRecord(PointRecord::sharedPointer record, const std::string& name) {
+  scopedLock_t lock(_mutex);
+  _records.push_back(make_pair(record, name));
+}
+
+// the sources are read without the lock -- a record's may take a while to answer, and models push to us meanwhile.
+void Metrics::collect() {
+  vector<pair<Model::sharedPointer, string> > models;
+  vector<TimeSeries::sharedPointer> series;
+  vector<pair<PointRecord::sharedPointer, string> > records;
+  {
+    scopedLock_t lock(_mutex);
+    models = _models;
+    series = _series;
+    records = _records;
+  }
+
+  vector<reading_t> readings;
+  typedef pair<Model::sharedPointer, string> modelEntry_t;
+  BOOST_FOREACH(const modelEntry_t& model, models) {
+    Model::memoryFootprint_t footprint = model.first->memoryFootprint();
+    string name = "rtx_model_memory_bytes";
+    readings.push_back(reading_t(name, gaugeMetric, footprint.elements, label("model", model.second, "part", "elements")));
+    readings.push_back(reading_t(name, gaugeMetric, footprint.records, label("model", model.second, "part", "records")));
+    readings.push_back(reading_t(name, gaugeMetric, footprint.checkpoints, label("model", model.second, "part", "checkpoints")));
+    readings.push_back(reading_t(name, gaugeMetric, footprint.engine, label("model", model.second, "part", "engine")));
+  }
+
+  BOOST_FOREACH(const TimeSeries::sharedPointer& ts, series) {
+    TimeSeries::stats_t stats = ts->stats();
+    labels_t labels = label("series", ts->name());
+    unsigned long reads = stats.cacheHits + stats.cacheMisses;
+    readings.push_back(reading_t("rtx_series_cache_hits_total", counterMetric, stats.cacheHits, labels));
+    readings.push_back(reading_t("rtx_series_cache_misses_total", counterMetric, stats.cacheMisses, labels));
+    readings.push_back(reading_t("rtx_series_cache_hit_ratio", gaugeMetric, reads ? (double)stats.cacheHits / reads : 0, labels));
+    readings.push_back(reading_t("rtx_series_compute_seconds_total", counterMetric, stats.computeSeconds, labels));
+  }
+
+  typedef pair<PointRecord::sharedPointer, string> recordEntry_t;
+  BOOST_FOREACH(const recordEntry_t& record, records) {
+    labels_t labels = label("record", record.second);
+    PointRecord::stats_t stats = record.first->stats();
+    readings.push_back(reading_t("rtx_record_memory_bytes", gaugeMetric, record.first->memoryFootprint(), labels));
+    readings.push_back(reading_t("rtx_record_cache_hits_total", counterMetric, stats.cacheHits, labels));
+    readings.push_back(reading_t("rtx_record_cache_misses_total", counterMetric, stats.cacheMisses, labels));
+    readings.push_back(reading_t("rtx_record_queries_total", counterMetric, stats.queries, labels));
+    readings.push_back(reading_t("rtx_record_query_seconds_total", counterMetric, stats.querySeconds, labels));
+    DbPointRecord::sharedPointer db = boost::dynamic_pointer_cast<DbPointRecord>(record.first);
+    if (!db) {
+      continue;
+    }
+    readings.push_back(reading_t("rtx_db_write_queue_points", gaugeMetric, db->queuedPoints(), labels));
+    for (int kind = DbPointRecord::selectRangeQuery; kind <= DbPointRecord::insertRangesQuery; ++kind) {
+      DbPointRecord::queryStats_t query = db->queryStats((DbPointRecord::queryKind_t)kind);
+      labels_t kindLabels = label("record", record.second, "kind", DbPointRecord::queryName((DbPointRecord::queryKind_t)kind));
+      readings.push_back(reading_t("rtx_db_queries_total", counterMetric, query.queries, kindLabels));
+      readings.push_back(reading_t("rtx_db_rows_total", counterMetric, query.rows, kindLabels));
+    }
+  }
+
+  // the counters read here are the sources' own running totals, so they're set, not added to
+  scopedLock_t lock(_mutex);
+  BOOST_FOREACH(const reading_t& reading, readings) {
+    metric(reading.name, reading.kind).byLabels[reading.labels].value = reading.value;
+  }
+}
+
+
+#pragma mark - Sinks
+
+void Metrics::addSink(Sink::sharedPointer sink) {
+  scopedLock_t lock(_mutex);
+  _sinks.push_back(sink);
+}
+
+void Metrics::publish() {
+  collect();
+  vector<Sink::sharedPointer> sinks;
+  {
+    scopedLock_t lock(_mutex);
+    sinks = _sinks;
+  }
+  vector<family_t> families = snapshot();
+  BOOST_FOREACH(const Sink::sharedPointer& sink, sinks) {
+    sink->write(families);
+  }
+}
+
+std::ostream& Metrics::toStream(std::ostream& stream) {
+  return PrometheusSink::format(stream, snapshot());
+}
+
+
+#pragma mark - Prometheus Sink
+
+PrometheusSink::PrometheusSink(std::ostream& stream) : _stream(&stream) {
+
+}
+
+PrometheusSink::PrometheusSink(const std::string& path) : _stream(NULL), _path(path) {
+
+}
+
+void PrometheusSink::write(const std::vector<Metrics::family_t>& families) {
+  if (_stream) {
+    format(*_stream, families) << flush;
+    return;
+  }
+  string writing = _path + ".tmp";
+  {
+    ofstream file(writing.c_str());
+    format(file, families);
+    if (!file) {
+      RTX_LOG(error, "PrometheusSink", "could not write " << writing);
+      return;
+    }
+  }
+  if (rename(writing.c_str(), _path.c_str()) != 0) {
+    RTX_LOG(error, "PrometheusSink", "could not replace " << _path);
+  }
+}
+
+std::ostream& PrometheusSink::format(std::ostream& stream, const std::vector<Metrics::family_t>& families) {
+  streamsize precision = stream.precision(12);
+  BOOST_FOREACH(const Metrics::family_t& family, families) {
+    if (!family.help.empty()) {
+      stream << "# HELP " << family.name << " " << family.help << "\n";
+    }
+    stream << "# TYPE " << family.name << " " << kindName(family.kind) << "\n";
+    BOOST_FOREACH(const Metrics::series_t& series, family.series) {
+      if (family.kind != Metrics::histogramMetric) {
+        sampleName(stream, family.name, series.labels);
+        stream << " ";
+        sampleValue(stream, series.value);
+        stream << "\n";
+        continue;
+      }
+      // buckets are cumulative in the exposition format
+      unsigned long cumulative = 0;
+      for (size_t i = 0; i < series.buckets.size(); ++i) {
+        cumulative += series.buckets[i];
+        stringstream le;
+        le.precision(12);
+        if (i < family.bounds.size()) {
+          le << family.bounds[i];
+        }
+        else {
+          le << "+Inf";
+        }
+        sampleName(stream, family.name + "_bucket", series.labels, le.str());
+        stream << " " << cumulative << "\n";
+      }
+      sampleName(stream, family.name + "_sum", series.labels);
+      stream << " ";
+      sampleValue(stream, series.sum);
+      stream << "\n";
+      sampleName(stream, family.name + "_count", series.labels);
+      stream << " " << series.count << "\n";
+    }
+  }
+  stream.precision(precision);
+  return stream;
+}
@@ -0,0 +1,157 @@
+//
+//  Metrics.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_Metrics_h
+#define epanet_rtx_Metrics_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "TimeSeries.h"
+#include "PointRecord.h"
+
+#include <boost/thread/mutex.hpp>
+
+namespace RTX {
+
+  class Model;
+
+  /*!
+   \class Metrics
+   \brief A registry of counters, gauges and histograms, for a long-running RTX service to graph and alert on.
+
+   Metrics are named, and each one can be kept apart by a set of labels (the series, the record, the query kind). A
+   counter only goes up, a gauge is set to whatever it is now, and a histogram counts its observations into buckets
+   -- the default ones, or those given to describe() before its first observation.
+
+   Models and database records push what they time into the registry as it happens (see Model::setMetrics and
+   DbPointRecord::setMetrics): each step's latency and solver iterations, each query's latency. What's watched is
+   read when the registry collects: each model's memory, each series' cache hits and misses, and each record's
+   memory, cache hits, query totals and write-behind queue depth.
+
+   Read the values in-process with value() or snapshot(), or publish() them to the sinks, to be written out as
+   Prometheus text (PrometheusSink does that, to a stream or to a file for a textfile collector).
+   */
+
+  /*!
+   \fn void Metrics::describe(const std::string& name, kind_t kind, const std::string& help, const std::vector<double>& bounds)
+   \brief Declare a metric's kind and help text ahead of its first use.
+   \param name The metric's name (Prometheus conventions apply: a counter's ends in _total, a duration's in _seconds).
+   \param kind Counter, gauge or histogram.
+   \param help What it measures.
+   \param bounds For a histogram, its buckets' upper bounds in increasing order. empty means the defaults.
+   */
+
+  class Metrics {
+  public:
+    RTX_SHARED_POINTER(Metrics);
+    Metrics();
+    virtual ~Metrics() {};
+
+    typedef enum {
+      counterMetric,
+      gaugeMetric,
+      histogramMetric
+    } kind_t;
+    typedef std::map<std::string, std::string> labels_t;
+
+    // one metric's values, by labels
+    class series_t {
+    public:
+      series_t() : value(0), count(0), sum(0) {};
+      // simple tuple class, so no getters/setters
+      labels_t labels;
+      double value;                        // a counter's or gauge's
+      std::vector<unsigned long> buckets;  // a histogram's, not cumulative; one more than its bounds, for +Inf
+      unsigned long count;
+      double sum;
+    };
+    class family_t {
+    public:
+      family_t() : kind(gaugeMetric) {};
+      // simple tuple class, so no getters/setters
+      std::string name, help;
+      kind_t kind;
+      std::vector<double> bounds;
+      std::vector<series_t> series;
+    };
+
+    // recording
+    void describe(const std::string& name, kind_t kind, const std::string& help, const std::vector<double>& bounds = std::vector<double>());
+    void increment(const std::string& name, double amount = 1, const labels_t& labels = labels_t());
+    void setGauge(const std::string& name, double value, const labels_t& labels = labels_t());
+    void observe(const std::string& name, double value, const labels_t& labels = labels_t());
+    static labels_t label(const std::string& key, const std::string& value); //! a set of one label
+    static labels_t label(const std::string& key, const std::string& value, const std::string& key2, const std::string& value2);
+    static std::vector<double> exponentialBounds(double first, double factor, size_t count);
+
+    // reading
+    double value(const std::string& name, const labels_t& labels = labels_t()); //! a counter's or gauge's, a histogram's count. 0 if unknown
+    std::vector<family_t> snapshot();
+    void reset(); //! forgets every value -- not what describe() declared, nor what's watched
+
+    // sources read on collect, under these labels
+    void watchModel(boost::shared_ptr<Model> model, const std::string& name);
+    void watchSeries(TimeSeries::sharedPointer series);
+    void watchRecord(PointRecord::sharedPointer record, const std::string& name);
+    void collect();
+
+    // sinks
+    class Sink {
+    public:
+      RTX_SHARED_POINTER(Sink);
+      virtual ~Sink() {};
+      virtual void write(const std::vector<family_t>& families) = 0;
+    };
+    void addSink(Sink::sharedPointer sink);
+    void publish(); //! collect, then hand a snapshot to each sink
+
+    std::ostream& toStream(std::ostream& stream); //! as Prometheus text
+
+  private:
+    class metric_t {
+    public:
+      family_t family;
+      std::map<labels_t, series_t> byLabels;
+    };
+    metric_t& metric(const std::string& name, kind_t kind); // caller holds _mutex
+    std::map<std::string, metric_t> _metrics;
+    std::vector<std::pair<boost::shared_ptr<Model>, std::string> > _models;
+    std::vector<TimeSeries::sharedPointer> _series;
+    std::vector<std::pair<PointRecord::sharedPointer, std::string> > _records;
+    std::vector<Sink::sharedPointer> _sinks;
+    boost::mutex _mutex;
+  };
+
+  /*!
+   \class PrometheusSink
+   \brief Writes metrics snapshots in the Prometheus text exposition format.
+
+   To a stream, each snapshot after the last; or to a file, replaced whole each time (written alongside and renamed
+   into place, so a scraper never reads half of one).
+   */
+
+  class PrometheusSink : public Metrics::Sink {
+  public:
+    RTX_SHARED_POINTER(PrometheusSink);
+    PrometheusSink(std::ostream& stream);
+    PrometheusSink(const std::string& path);
+    virtual void write(const std::vector<Metrics::family_t>& families);
+    static std::ostream& format(std::ostream& stream, const std::vector<Metrics::family_t>& families);
+  private:
+    std::ostream* _stream;
+    std::string _path;
+  };
+
+}
+
+#endif
@@ -0,0 +1,467 @@
+//
+//  MmapPointRecord.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "MmapPointRecord.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
+static const char mmapMagic[8] = {'R','T','X','M','M','A','P','1'};
+static const uint32_t mmapVersion = 2; // 2: records are PackedPoints
+static const uint64_t mmapMinimumCapacity = 1024;
+
+
+#pragma mark - Mapped Series
+
+MmapPointRecord::MappedSeries::MappedSeries() : _fd(-1), _base(NULL), _mappedBytes(0) {
+  
+}
+
+MmapPointRecord::MappedSeries::~MappedSeries() {
+  close();
+}
+
+bool MmapPointRecord::MappedSeries::open(const std::string& filePath) {
+  _fd = ::open(filePath.c_str(), O_RDWR | O_CREAT, 0644);
+  if (_fd < 0) {
+    RTX_LOG(error, "MmapPointRecord", "could not open " << filePath);
+    return false;
+  }
+  
+  struct stat fileInfo;
+  if (fstat(_fd, &fileInfo) != 0) {
+    RTX_LOG(error, "MmapPointRecord", "could not stat " << filePath);
+    close();
+    return false;
+  }
+  
+  if (fileInfo.st_size == 0) {
+    // brand new file -- lay down a header and some room to grow.
+    FileHeader_t newHeader;
+    memset(&newHeader, 0, sizeof(FileHeader_t));
+    memcpy(newHeader.magic, mmapMagic, sizeof(mmapMagic));
+    newHeader.version = mmapVersion;
+    newHeader.recordSize = sizeof(FileRecord_t);
+    if (pwrite(_fd, &newHeader, sizeof(FileHeader_t), 0) != (ssize_t)sizeof(FileHeader_t)) {
+      RTX_LOG(error, "MmapPointRecord", "could not initialize " << filePath);
+      close();
+      return false;
+    }
+    fileInfo.st_size = sizeof(FileHeader_t);
+  }
+  
+  if (fileInfo.st_size < (off_t)sizeof(FileHeader_t) || !map(fileInfo.st_size)) {
+    RTX_LOG(error, "MmapPointRecord", "could not map " << filePath);
+    close();
+    return false;
+  }
+  
+  FileHeader_t* h = header();
+  if (memcmp(h->magic, mmapMagic, sizeof(mmapMagic)) != 0 || h->version != mmapVersion || h->recordSize != sizeof(FileRecord_t)) {
+    RTX_LOG(error, "MmapPointRecord", filePath << " is not a compatible series file");
+    close();
+    return false;
+  }
+  
+  // trust the file size over the header, in case we were interrupted mid-growth.
+  uint64_t fileCapacity = (fileInfo.st_size - sizeof(FileHeader_t)) / sizeof(FileRecord_t);
+  h->capacity = fileCapacity;
+  if (h->count > fileCapacity) {
+    h->count = fileCapacity;
+  }
+  
+  return reserve(mmapMinimumCapacity);
+}
+
+void MmapPointRecord::MappedSeries::close() {
+  if (_base) {
+    munmap(_base, _mappedBytes);
+    _base = NULL;
+    _mappedBytes = 0;
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+bool MmapPointRecord::MappedSeries::map(size_t bytes) {
+  if (_base) {
+    munmap(_base, _mappedBytes);
+    _base = NULL;
+    _mappedBytes = 0;
+  }
+  void* base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  _base = base;
+  _mappedBytes = bytes;
+  return true;
+}
+
+bool MmapPointRecord::MappedSeries::reserve(uint64_t capacity) {
+  if (!_base) {
+    return false;
+  }
+  if (capacity <= header()->capacity) {
+    return true;
+  }
+  size_t bytes = sizeof(FileHeader_t) + capacity * sizeof(FileRecord_t);
+  if (ftruncate(_fd, bytes) != 0 || !map(bytes)) {
+    RTX_LOG(error, "MmapPointRecord", "could not grow series file");
+    return false;
+  }
+  header()->capacity = capacity;
+  return true;
+}
+
+MmapPointRecord::FileHeader_t* MmapPointRecord::MappedSeries::header() const {
+  return (FileHeader_t*)_base;
+}
+
+MmapPointRecord::FileRecord_t* MmapPointRecord::MappedSeries::records() const {
+  return (FileRecord_t*)((char*)_base + sizeof(FileHeader_t));
+}
+
+uint64_t MmapPointRecord::MappedSeries::count() const {
+  return (_base ? header()->count : 0);
+}
+
+Point MmapPointRecord::MappedSeries::pointAt(uint64_t index) const {
+  return records()[index].unpack();
+}
+
+static bool compareRecordTime(const MmapPointRecord::FileRecord_t& record, int64_t time) {
+  return record.time() < time;
+}
+
+static bool compareTimeRecord(int64_t time, const MmapPointRecord::FileRecord_t& record) {
+  return time < record.time();
+}
+
+uint64_t MmapPointRecord::MappedSeries::lowerBound(time_t time) const {
+  FileRecord_t* first = records();
+  FileRecord_t* last = first + count();
+  return std::lower_bound(first, last, (int64_t)time, &compareRecordTime) - first;
+}
+
+uint64_t MmapPointRecord::MappedSeries::upperBound(time_t time) const {
+  FileRecord_t* first = records();
+  FileRecord_t* last = first + count();
+  return std::upper_bound(first, last, (int64_t)time, &compareTimeRecord) - first;
+}
+
+void MmapPointRecord::MappedSeries::append(const Point& point) {
+  FileHeader_t* h = header();
+  if (h->count == h->capacity) {
+    if (!reserve(std::max(h->capacity * 2, mmapMinimumCapacity))) {
+      return;
+    }
+    h = header();
+  }
+  records()[h->count] = PackedPoint::pack(point);
+  if (h->count == 0) {
+    h->firstTime = point.time;
+  }
+  h->lastTime = point.time;
+  ++(h->count);
+}
+
+void MmapPointRecord::MappedSeries::insertOrdered(const Point& point) {
+  uint64_t n = count();
+  if (n == 0 || point.time > header()->lastTime) {
+    append(point);
+    return;
+  }
+  uint64_t index = lowerBound(point.time);
+  if (index < n && records()[index].time() == point.time) {
+    // already have it -- a correction, so the newer point wins.
+    records()[index] = PackedPoint::pack(point);
+    return;
+  }
+  // rare: open up a slot by shifting the tail. append() takes care of growing the file.
+  append(pointAt(n - 1));
+  FileRecord_t* r = records();
+  memmove(r + index + 1, r + index, (n - 1 - index) * sizeof(FileRecord_t));
+  r[index] = PackedPoint::pack(point);
+  header()->firstTime = r[0].time();
+}
+
+void MmapPointRecord::MappedSeries::clear() {
+  if (_base) {
+    header()->count = 0;
+    header()->firstTime = 0;
+    header()->lastTime = 0;
+  }
+}
+
+void MmapPointRecord::MappedSeries::sync() {
+  if (_base) {
+    msync(_base, _mappedBytes, MS_ASYNC);
+  }
+}
+
+
+#pragma mark - Constructor/Destructor
+
+MmapPointRecord::MmapPointRecord() {
+  _path = ".";
+}
+
+MmapPointRecord::~MmapPointRecord() {
+  sync();
+}
+
+std::ostream& RTX::operator<< (std::ostream &out, MmapPointRecord &pr) {
+  return pr.toStream(out);
+}
+
+std::ostream& MmapPointRecord::toStream(std::ostream &stream) {
+  stream << "Memory-Mapped Point Record: " << _path << std::endl;
+  return stream;
+}
+
+
+#pragma mark - Setup
+
+void MmapPointRecord::setPath(const std::string& path) {
+  _path = path;
+}
+
+const std::string& MmapPointRecord::path() {
+  return _path;
+}
+
+void MmapPointRecord::sync() {
+  typedef std::map<std::string, MappedSeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    readLock_t seriesLock(entry.second->mutex);
+    entry.second->sync();
+  }
+}
+
+std::string MmapPointRecord::filePathForName(const std::string& identifier) {
+  // escape anything that isn't safe in a file name, so that distinct names get distinct files.
+  std::stringstream filePath;
+  filePath << _path << "/";
+  for (size_t i = 0; i < identifier.size(); ++i) {
+    unsigned char c = identifier[i];
+    if (isalnum(c) || c == '-' || c == '_' || c == '.') {
+      filePath << c;
+    }
+    else {
+      static const char hex[] = "0123456789ABCDEF";
+      filePath << '%' << hex[c >> 4] << hex[c & 0xF];
+    }
+  }
+  filePath << ".rtxmap";
+  return filePath.str();
+}
+
+std::string MmapPointRecord::registerAndGetIdentifier(std::string recordName) {
+  writeLock_t registryLock(_registryMutex);
+  if (_series.find(recordName) == _series.end()) {
+    MappedSeriesPointer series( new MappedSeries() );
+    if (series->open(filePathForName(recordName))) {
+      _series[recordName] = series;
+    }
+  }
+  return recordName;
+}
+
+std::vector<std::string> MmapPointRecord::identifiers() {
+  typedef std::map<std::string, MappedSeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  vector<string> names;
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    names.push_back(entry.first);
+  }
+  return names;
+}
+
+MmapPointRecord::MappedSeriesPointer MmapPointRecord::seriesForName(const std::string& identifier) {
+  readLock_t registryLock(_registryMutex);
+  std::map<std::string, MappedSeriesPointer>::iterator it = _series.find(identifier);
+  if (it == _series.end()) {
+    return MappedSeriesPointer();
+  }
+  return it->second;
+}
+
+
+#pragma mark - Retrieval
+
+Point MmapPointRecord::point(const string& identifier, time_t time) {
+  Point foundPoint;
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    uint64_t index = series->lowerBound(time);
+    if (index < series->count() && series->records()[index].time() == time) {
+      foundPoint = series->pointAt(index);
+    }
+  }
+  return foundPoint;
+}
+
+Point MmapPointRecord::pointBefore(const string& identifier, time_t time) {
+  Point foundPoint;
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    uint64_t index = series->lowerBound(time);
+    if (index > 0) {
+      foundPoint = series->pointAt(index - 1);
+    }
+  }
+  return foundPoint;
+}
+
+Point MmapPointRecord::pointAfter(const string& identifier, time_t time) {
+  Point foundPoint;
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    uint64_t index = series->upperBound(time);
+    if (index < series->count()) {
+      foundPoint = series->pointAt(index);
+    }
+  }
+  return foundPoint;
+}
+
+std::vector<Point> MmapPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
+  std::vector<Point> points;
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    uint64_t first = series->lowerBound(startTime);
+    uint64_t last = series->upperBound(endTime);
+    if (first < last) {
+      points.reserve(last - first);
+      for (uint64_t i = first; i < last; ++i) {
+        points.push_back(series->pointAt(i));
+      }
+    }
+  }
+  return points;
+}
+
+void MmapPointRecord::visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    uint64_t last = series->upperBound(endTime);
+    for (uint64_t i = series->lowerBound(startTime); i < last; ++i) {
+      if (!visitor.visit(series->pointAt(i))) {
+        break;
+      }
+    }
+  }
+}
+
+Point MmapPointRecord::firstPoint(const string& id) {
+  Point foundPoint;
+  MappedSeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (series->count() > 0) {
+      foundPoint = series->pointAt(0);
+    }
+  }
+  return foundPoint;
+}
+
+Point MmapPointRecord::lastPoint(const string& id) {
+  Point foundPoint;
+  MappedSeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (series->count() > 0) {
+      foundPoint = series->pointAt(series->count() - 1);
+    }
+  }
+  return foundPoint;
+}
+
+PointRecord::time_pair_t MmapPointRecord::range(const string& id) {
+  // straight out of the header.
+  time_pair_t range(0,0);
+  MappedSeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (series->count() > 0) {
+      range = make_pair((time_t)series->header()->firstTime, (time_t)series->header()->lastTime);
+    }
+  }
+  return range;
+}
+
+
+#pragma mark - Insertion
+
+void MmapPointRecord::addPoint(const string& identifier, Point point) {
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (series) {
+    writeLock_t seriesLock(series->mutex);
+    series->insertOrdered(point);
+  }
+}
+
+void MmapPointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (!series || points.empty()) {
+    return;
+  }
+  
+  std::vector<Point> scratch;
+  const std::vector<Point>& ordered = orderedPoints(points, scratch);
+  
+  writeLock_t seriesLock(series->mutex);
+  // grow once up front, rather than doubling our way there.
+  series->reserve(series->count() + ordered.size());
+  BOOST_FOREACH(const Point& p, ordered) {
+    series->insertOrdered(p);
+  }
+}
+
+void MmapPointRecord::reset() {
+  typedef std::map<std::string, MappedSeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    writeLock_t seriesLock(entry.second->mutex);
+    entry.second->clear();
+  }
+}
+
+void MmapPointRecord::reset(const string& identifier) {
+  MappedSeriesPointer series = seriesForName(identifier);
+  if (series) {
+    writeLock_t seriesLock(series->mutex);
+    series->clear();
+  }
+}
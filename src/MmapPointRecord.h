@@ -0,0 +1,128 @@
+//
+//  MmapPointRecord.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_MmapPointRecord_h
+#define epanet_rtx_MmapPointRecord_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+#include "Point.h"
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "PointRecord.h"
+
+#include <boost/thread/shared_mutex.hpp>
+
+namespace RTX {
+  
+  /*!
+   \class MmapPointRecord
+   \brief A persistent PointRecord that keeps each series in a memory-mapped file.
+  
+   Each registered series gets its own file in the record's directory. The file starts with a small header
+   (record count, first/last time) followed by a dense, time-ordered array of PackedPoint records. Reads are a
+   binary search over the mapped array -- no parsing and no database round-trip -- so the history survives a
+   restart and is warm as soon as the file is mapped.
+  
+   Points are normally appended; out-of-order points are inserted in place, and a point at a time already held
+   replaces it (a correction -- the newer point wins).
+   */
+  
+  /*!
+   \fn void MmapPointRecord::setPath(const std::string& path)
+   \brief Set the directory that holds the series files.
+   \param path An existing, writable directory.
+  
+   Must be called before any series are registered.
+   */
+  
+  class MmapPointRecord : public PointRecord {
+  public:
+    RTX_SHARED_POINTER(MmapPointRecord);
+    MmapPointRecord();
+    virtual ~MmapPointRecord();
+  
+    void setPath(const std::string& path);
+    const std::string& path();
+    void sync();
+  
+    virtual std::string registerAndGetIdentifier(std::string recordName);
+    virtual std::vector<std::string> identifiers();
+  
+    virtual Point point(const string& identifier, time_t time);
+    virtual Point pointBefore(const string& identifier, time_t time);
+    virtual Point pointAfter(const string& identifier, time_t time);
+    virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(const string& identifier, Point point);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
+    virtual void reset();
+    virtual void reset(const string& identifier);
+    virtual Point firstPoint(const string& id);
+    virtual Point lastPoint(const string& id);
+    virtual time_pair_t range(const string& id);
+  
+    virtual std::ostream& toStream(std::ostream &stream);
+  
+    // on-disk layout
+    typedef struct {
+      char magic[8];
+      uint32_t version;
+      uint32_t recordSize;
+      uint64_t count;
+      uint64_t capacity;
+      int64_t firstTime;
+      int64_t lastTime;
+      char reserved[16];
+    } FileHeader_t;
+  
+    typedef PackedPoint FileRecord_t;
+  
+  private:
+    class MappedSeries {
+    public:
+      MappedSeries();
+      ~MappedSeries();
+      bool open(const std::string& filePath);
+      void close();
+      bool reserve(uint64_t capacity);
+      FileHeader_t* header() const;
+      FileRecord_t* records() const;
+      uint64_t count() const;
+      Point pointAt(uint64_t index) const;
+      uint64_t lowerBound(time_t time) const;
+      uint64_t upperBound(time_t time) const;
+      void append(const Point& point);
+      void insertOrdered(const Point& point);
+      void clear();
+      void sync();
+      boost::shared_mutex mutex;
+    private:
+      bool map(size_t bytes);
+      int _fd;
+      void* _base;
+      size_t _mappedBytes;
+    };
+    typedef boost::shared_ptr<MappedSeries> MappedSeriesPointer;
+  
+    MappedSeriesPointer seriesForName(const std::string& identifier);
+    std::string filePathForName(const std::string& identifier);
+  
+    std::string _path;
+    std::map<std::string, MappedSeriesPointer> _series;
+    boost::shared_mutex _registryMutex;
+  };
+  
+  std::ostream& operator<< (std::ostream &out, MmapPointRecord &pr);
+  
+}
+
+#endif
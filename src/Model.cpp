@@ -8,14 +8,84 @@
 
 #include <iostream>
 #include <set>
+#include <algorithm>
+#include <cmath>
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include "Model.h"
+#include "Log.h"
 #include "Units.h"
+#include "ModularTimeSeries.h"
+#include "AggregatorTimeSeries.h"
+#include "DbPointRecord.h"
+#include "Tracer.h"
+#include "Scratch.h"
+#include "SteadyClock.h"
+
+// below this many states a thread, saveHydraulicStates doesn't split them up -- starting a thread costs more
+#define RTX_MIN_STATES_PER_THREAD 4096
 
 using namespace RTX;
 using namespace std;
 
+typedef boost::lock_guard<boost::recursive_mutex> stepLock_t;
+
+namespace {
+  typedef map<DbPointRecord::sharedPointer, vector<string> > namesByRecord_t;
+  
+  // walk each series back to wherever its data is stored, and batch the database-backed ones by record,
+  // so each record can fill all of its series with one query instead of one query per series.
+  void pushSources(const TimeSeries::sharedPointer& ts, vector<TimeSeries::sharedPointer>& toVisit) {
+    ModularTimeSeries::sharedPointer modular = boost::dynamic_pointer_cast<ModularTimeSeries>(ts);
+    if (modular && modular->doesHaveSource()) {
+      toVisit.push_back(modular->source());
+    }
+    AggregatorTimeSeries::sharedPointer aggregator = boost::dynamic_pointer_cast<AggregatorTimeSeries>(ts);
+    if (aggregator) {
+      typedef std::pair<TimeSeries::sharedPointer, double> sourcePair_t;
+      BOOST_FOREACH(const sourcePair_t& source, aggregator->sources()) {
+        toVisit.push_back(source.first);
+      }
+    }
+  }
+  
+  namesByRecord_t databaseSeries(const vector<TimeSeries::sharedPointer>& series) {
+    namesByRecord_t namesByRecord;
+    set<TimeSeries*> visited;
+    vector<TimeSeries::sharedPointer> toVisit = series;
+    
+    while (!toVisit.empty()) {
+      TimeSeries::sharedPointer ts = toVisit.back();
+      toVisit.pop_back();
+      if (!ts || visited.count(ts.get()) > 0) {
+        continue;
+      }
+      visited.insert(ts.get());
+      
+      DbPointRecord::sharedPointer dbRecord = boost::dynamic_pointer_cast<DbPointRecord>(ts->record());
+      if (dbRecord) {
+        // stored results -- no need to look any further upstream.
+        namesByRecord[dbRecord].push_back(ts->name());
+        continue;
+      }
+      pushSources(ts, toVisit);
+    }
+    return namesByRecord;
+  }
+  
+  // largest first, for memoryToStream
+  typedef pair<size_t, string> seriesBytes_t;
+  bool isLarger(const seriesBytes_t& a, const seriesBytes_t& b) {
+    return a.first > b.first;
+  }
+  
+  // in phase_t order
+  const char* phaseNames[] = {"ingest", "boundary fetch", "zone allocation", "junction boundaries", "reservoir boundaries",
+    "tank boundaries", "link boundaries", "solve", "linear solve", "save", "step", "quality"};
+}
+
 
 Model::Model() : _flowUnits(1), _headUnits(1) {
   // default reset clock is 24 hours, default reporting clock is 1 hour.
@@ -24,9 +94,43 @@ Model::Model() : _flowUnits(1), _headUnits(1) {
   _boundaryResetClock = Clock::sharedPointer( new Clock(24 * 3600) );
   _relativeError.reset( new TimeSeries() );
   _iterations.reset( new TimeSeries() );
+  _qualityTimeStep = 0; // until it's set -- the engine keeps its own
+  _currentSimulationTime = 0;
+  _checkpointLimit = 48;
+  _isBoundaryScheduled = false;
+  _hasStateColumns = false;
+  _stateThreads = 1;
+  _runPriority = Scheduler::normalPriority;
+  _shouldRunWaterQuality = false;
+  _isQualityStarted = false;
+  _qualityDecimation = 1;
+  _qualityStepCount = 0;
+  _qualityTime = 0;
+  _demandDeadband = 0;
+  _headDeadband = 0;
+  _settingDeadband = 0;
+  _prefetchWindow = 0;
+  _prefetchDepth = 1;
+  _replayTime = 0;
+  _prefetchedTime = 0;
+  _prefetchWakeTime = 0;
+  _isPrefetching = false;
+  _isPrefetchStopping = false;
+  _didEnableWriteBehind = false;
+  _catchUpLag = 0;
+  _liveTime = 0;
+  _isRunningLive = false;
+  _isStoringAllStates = false;
+  _isProfilingSteps = false;
+  _profileWindow = 1000;
   
   _relativeError->setName("Relative Error");
   _iterations->setName("Iterations");
+  _phaseProfiles.resize(qualityPhase + 1);
+  for (size_t i = 0; i < _phaseProfiles.size(); ++i) {
+    _phaseProfiles[i].series.reset( new TimeSeries() );
+    _phaseProfiles[i].series->setName(string("Step Time: ") + phaseNames[i]);
+  }
   _doesOverrideDemands = false;
   
   // defaults
@@ -34,7 +138,12 @@ Model::Model() : _flowUnits(1), _headUnits(1) {
   setHeadUnits(RTX_METER);
 }
 Model::~Model() {
-  
+  if (_forkReserve) {
+    // a fill still going stops at the next copy
+    boost::lock_guard<boost::mutex> lock(_forkReserve->mutex);
+    _forkReserve->isClosed = true;
+    _forkReserve->spares.clear();
+  }
 }
 std::ostream& RTX::operator<< (std::ostream &out, Model &model) {
   return model.toStream(out);
@@ -42,6 +151,7 @@ std::ostream& RTX::operator<< (std::ostream &out, Model &model) {
 
 void Model::loadModelFromFile(const std::string& filename) throw(std::exception) {
   _modelFile = filename;
+  _checkpoints.clear();
 }
 
 std::string Model::modelFile() {
@@ -51,14 +161,15 @@ std::string Model::modelFile() {
 #pragma mark - Units
 Units Model::flowUnits()    { return _flowUnits; }
 Units Model::headUnits()    { return _headUnits; }
-void Model::setFlowUnits(Units units)   { _flowUnits = units; }
-void Model::setHeadUnits(Units units)   { _headUnits = units; }
+// the boundary conditions and state columns have conversions to and from these worked out, so they're rebuilt
+void Model::setFlowUnits(Units units)   { _flowUnits = units; _isBoundaryScheduled = false; _hasStateColumns = false; }
+void Model::setHeadUnits(Units units)   { _headUnits = units; _isBoundaryScheduled = false; _hasStateColumns = false; }
 
 
 #pragma mark - Storage
 void Model::setStorage(PointRecord::sharedPointer record) {
   _record = record;
-
+  
   std::vector< Element::sharedPointer > elements = this->elements();
   BOOST_FOREACH(Element::sharedPointer element, elements) {
     //std::cout << "setting storage for: " << element->name() << std::endl;
@@ -75,7 +186,7 @@ void Model::setStorage(PointRecord::sharedPointer record) {
 }
 
 void Model::setParameterSource(PointRecord::sharedPointer record) {
-
+  
   BOOST_FOREACH(Junction::sharedPointer junction, this->junctions()) {
     if (junction->doesHaveBoundaryFlow()) {
       junction->boundaryFlow()->setRecord(record);
@@ -84,13 +195,13 @@ void Model::setParameterSource(PointRecord::sharedPointer record) {
       junction->headMeasure()->setRecord(record);
     }
   }
-
+  
   BOOST_FOREACH(Reservoir::sharedPointer reservoir, this->reservoirs()) {
     if (reservoir->doesHaveBoundaryHead()) {
       reservoir->boundaryHead()->setRecord(record);
     }
   }
-
+  
   BOOST_FOREACH(Valve::sharedPointer valve, this->valves()) {
     if (valve->doesHaveStatusParameter()) {
       valve->statusParameter()->setRecord(record);
@@ -108,67 +219,324 @@ void Model::setParameterSource(PointRecord::sharedPointer record) {
 }
 
 
-#pragma mark - Demand Zones
+#pragma mark - Copies
 
-void Model::initDemandZones() {
-  
-  // load up the node set
-  std::set<Junction::sharedPointer> nodeSet;
-  BOOST_FOREACH(Junction::sharedPointer junction, _junctions) {
-    nodeSet.insert(junction);
+Model::sharedPointer Model::newInstance() {
+  return Model::sharedPointer();
+}
+
+Model::sharedPointer Model::clone() {
+  Model::sharedPointer copy = newInstance();
+  if (!copy) {
+    throw RtxMethodNotValid();
+  }
+  loadCopy(copy, copySettings());
+  shareBoundaries(copy);
+  return copy;
+}
+
+Model::copySettings_t Model::copySettings() {
+  copySettings_t settings;
+  settings.modelFile = _modelFile;
+  settings.overridesControls = _doesOverrideDemands;
+  settings.runsWaterQuality = _shouldRunWaterQuality;
+  settings.hydraulicStep = hydraulicTimeStep();
+  settings.qualityStep = _qualityTimeStep;
+  settings.qualityDecimation = _qualityDecimation;
+  settings.runtime = _runtime;
+  settings.runPriority = _runPriority;
+  return settings;
+}
+
+void Model::loadCopy(Model::sharedPointer copy, const copySettings_t& settings) {
+  copy->loadModelFromFile(settings.modelFile);
+  if (settings.overridesControls) {
+    copy->overrideControls();
+  }
+  copy->setHydraulicTimeStep(settings.hydraulicStep);
+  if (settings.qualityStep > 0) {
+    copy->setQualityTimeStep(settings.qualityStep);
+  }
+  copy->setShouldRunWaterQuality(settings.runsWaterQuality);
+  copy->setQualityDecimation(settings.qualityDecimation);
+  copy->setRuntime(settings.runtime);
+  copy->setRunPriority(settings.runPriority);
+}
+
+// the same boundary series -- the elements are matched up by name
+void Model::shareBoundaries(Model::sharedPointer copy) {
+  BOOST_FOREACH(const Junction::sharedPointer& junction, _junctions) {
+    Junction::sharedPointer theirs = boost::dynamic_pointer_cast<Junction>(copy->nodeWithName(junction->name()));
+    if (!theirs) {
+      continue;
+    }
+    if (junction->doesHaveBoundaryFlow()) {
+      theirs->setBoundaryFlow(junction->boundaryFlow());
+    }
+    if (junction->doesHaveHeadMeasure()) {
+      theirs->setHeadMeasure(junction->headMeasure());
+    }
+  }
+  BOOST_FOREACH(const Reservoir::sharedPointer& reservoir, _reservoirs) {
+    Reservoir::sharedPointer theirs = boost::dynamic_pointer_cast<Reservoir>(copy->nodeWithName(reservoir->name()));
+    if (theirs && reservoir->doesHaveBoundaryHead()) {
+      theirs->setBoundaryHead(reservoir->boundaryHead());
+    }
+  }
+  BOOST_FOREACH(const Tank::sharedPointer& tank, _tanks) {
+    Tank::sharedPointer theirs = boost::dynamic_pointer_cast<Tank>(copy->nodeWithName(tank->name()));
+    if (!theirs) {
+      continue;
+    }
+    if (tank->doesHaveHeadMeasure()) {
+      theirs->setHeadMeasure(tank->headMeasure());
+    }
+    theirs->setLevelResetClock(tank->levelResetClock());
   }
-  BOOST_FOREACH(Tank::sharedPointer tank, _tanks) {
-    nodeSet.insert(tank);
+  std::vector<Pipe::sharedPointer> links = _pipes;
+  links.insert(links.end(), _pumps.begin(), _pumps.end());
+  links.insert(links.end(), _valves.begin(), _valves.end());
+  BOOST_FOREACH(const Pipe::sharedPointer& pipe, links) {
+    Pipe::sharedPointer theirs = boost::dynamic_pointer_cast<Pipe>(copy->linkWithName(pipe->name()));
+    if (!theirs) {
+      continue;
+    }
+    if (pipe->doesHaveStatusParameter()) {
+      theirs->setStatusParameter(pipe->statusParameter());
+    }
+    if (pipe->doesHaveFlowMeasure()) {
+      theirs->setFlowMeasure(pipe->flowMeasure());
+    }
   }
-  BOOST_FOREACH(Junction::sharedPointer reservoir, _reservoirs) {
-    nodeSet.insert(reservoir);
+  BOOST_FOREACH(const Valve::sharedPointer& valve, _valves) {
+    Valve::sharedPointer theirs = boost::dynamic_pointer_cast<Valve>(copy->linkWithName(valve->name()));
+    if (theirs && valve->doesHaveSettingParameter()) {
+      theirs->setSettingParameter(valve->settingParameter());
+    }
   }
-  int iZone = 0;
   
-  // TODO -- fix the bug where recursion causes a huge memory suck.
-  // flatten this out with an explicit call stack, rather than an execution call stack.
+  // zones follow from the flow measures, so they come out the same
+  if (!_zones.empty()) {
+    copy->initDemandZones();
+  }
+}
+
+
+#pragma mark - Forks
+
+// the engine state and the bindings are taken between steps, so they match each other and the simulation time
+Model::sharedPointer Model::fork(PointRecord::sharedPointer scratch) throw(RtxException) {
+  Model::sharedPointer copy;
+  if (_forkReserve) {
+    boost::lock_guard<boost::mutex> lock(_forkReserve->mutex);
+    if (!_forkReserve->spares.empty()) {
+      copy = _forkReserve->spares.front();
+      _forkReserve->spares.pop_front();
+    }
+  }
+  if (!copy) {
+    copy = newInstance();
+    if (!copy) {
+      throw RtxMethodNotValid();
+    }
+    loadCopy(copy, copySettings());
+  }
+  fillForkReserve();
   
-  // if the set is not empty, then there's work to be done:
-  while (!nodeSet.empty()) {
-    iZone++;
-    
-    // pick a random node, and build out that zone.
-    set<Junction::sharedPointer>::iterator nodeIt;
-    nodeIt = nodeSet.begin();
-    Junction::sharedPointer rootNode = *nodeIt;
-    
-    string zoneName = boost::lexical_cast<string>(iZone);
-    Zone::sharedPointer newZone(new Zone(zoneName));
-    
-    // specifiy the root node and populate the tree.
-    newZone->enumerateJunctionsWithRootNode(rootNode);
-    
-    // get the list of junctions that were just added.
-    vector<Junction::sharedPointer> addedJunctions = newZone->junctions();
-    
-    if (addedJunctions.size() < 1) {
-      cerr << "Could not add any junctions to zone " << iZone << endl;
-      continue;
+  vector<char> state;
+  time_t time;
+  {
+    stepLock_t stepLock(_stepMutex);
+    time = currentSimulationTime();
+    if (!saveEngineState(state)) {
+      throw RtxException("this engine can't save its state, so the model can't be forked");
     }
-    
-    // remove the added junctions from the nodeSet.
-    BOOST_FOREACH(Junction::sharedPointer addedJunction, addedJunctions) {
-      size_t changed = nodeSet.erase(addedJunction);
-      if (changed != 1) {
-        // whoops, something is wrong
-        cerr << "Could not find junction in set: " << addedJunction->name() << endl;
+    shareBoundaries(copy);
+  }
+  copy->restoreEngineState(state);
+  copy->setCurrentSimulationTime(time);
+  if (copy->_checkpointLimit > 0) {
+    copy->_checkpoints[time].swap(state); // for its runSinglePeriods
+  }
+  if (scratch) {
+    copy->setStorage(scratch);
+  }
+  return copy;
+}
+
+void Model::setForkReserve(size_t count) {
+  if (!_forkReserve) {
+    _forkReserve.reset(new ForkReserve());
+  }
+  {
+    boost::lock_guard<boost::mutex> lock(_forkReserve->mutex);
+    _forkReserve->target = count;
+    while (_forkReserve->spares.size() > count) {
+      _forkReserve->spares.pop_back();
+    }
+  }
+  fillForkReserve();
+}
+
+size_t Model::forkReserve() {
+  if (!_forkReserve) {
+    return 0;
+  }
+  boost::lock_guard<boost::mutex> lock(_forkReserve->mutex);
+  return _forkReserve->target;
+}
+
+// the blank copies are made here, since making one asks the model what kind it is -- the loading needn't.
+void Model::fillForkReserve() {
+  if (!_forkReserve) {
+    return;
+  }
+  size_t needed;
+  {
+    boost::lock_guard<boost::mutex> lock(_forkReserve->mutex);
+    if (_forkReserve->isFilling || _forkReserve->spares.size() >= _forkReserve->target) {
+      return;
+    }
+    _forkReserve->isFilling = true;
+    needed = _forkReserve->target - _forkReserve->spares.size();
+  }
+  vector<Model::sharedPointer> blanks;
+  for (size_t i = 0; i < needed; ++i) {
+    Model::sharedPointer blank = newInstance();
+    if (blank) {
+      blanks.push_back(blank);
+    }
+  }
+  runtime()->scheduler()->submit(boost::bind(&Model::loadSpares, _forkReserve, blanks, copySettings()), Scheduler::backgroundPriority);
+}
+
+void Model::loadSpares(forkReservePointer_t reserve, std::vector<Model::sharedPointer> blanks, copySettings_t settings) {
+  BOOST_FOREACH(Model::sharedPointer spare, blanks) {
+    {
+      boost::lock_guard<boost::mutex> lock(reserve->mutex);
+      if (reserve->isClosed || reserve->spares.size() >= reserve->target) {
+        break;
       }
     }
-    
-    this->addZone(newZone);
+    try {
+      loadCopy(spare, settings);
+    } catch (std::exception& e) {
+      RTX_LOG(error, "Model", "could not load a copy for forking: " << e.what());
+      break;
+    }
+    boost::lock_guard<boost::mutex> lock(reserve->mutex);
+    reserve->spares.push_back(spare);
+  }
+  boost::lock_guard<boost::mutex> lock(reserve->mutex);
+  reserve->isFilling = false;
+}
+
+void Model::tagStates(const std::string& tag) {
+  std::vector<TimeSeries::sharedPointer> states;
+  std::vector<Junction::sharedPointer> nodes = _junctions;
+  nodes.insert(nodes.end(), _tanks.begin(), _tanks.end());
+  nodes.insert(nodes.end(), _reservoirs.begin(), _reservoirs.end());
+  BOOST_FOREACH(const Junction::sharedPointer& junction, nodes) {
+    states.push_back(junction->head());
+    states.push_back(junction->quality());
+    states.push_back(junction->demand());
+  }
+  std::vector<Pipe::sharedPointer> links = _pipes;
+  links.insert(links.end(), _pumps.begin(), _pumps.end());
+  links.insert(links.end(), _valves.begin(), _valves.end());
+  BOOST_FOREACH(const Pipe::sharedPointer& pipe, links) {
+    states.push_back(pipe->flow());
+  }
+  BOOST_FOREACH(const Pump::sharedPointer& pump, _pumps) {
+    states.push_back(pump->energy());
+  }
+  BOOST_FOREACH(const Zone::sharedPointer& zone, _zones) {
+    states.push_back(zone->demand());
+  }
+  states.push_back(_relativeError);
+  states.push_back(_iterations);
+  BOOST_FOREACH(const PhaseProfile& profile, _phaseProfiles) {
+    states.push_back(profile.series);
   }
   
+  BOOST_FOREACH(const TimeSeries::sharedPointer& state, states) {
+    state->setName(tag + state->name());
+  }
+}
+
+
+#pragma mark - Demand Zones
+
+void Model::initDemandZones() {
+  // the zones are the pieces of the network between flow measures: its components, cut at every measured link.
+  Topology::sharedPointer network = topology();
+  vector<bool> isMeasured(network->linkCount(), false);
+  for (int iLink = 0; iLink < network->linkCount(); ++iLink) {
+    isMeasured[iLink] = boost::static_pointer_cast<Pipe>(network->link(iLink))->doesHaveFlowMeasure();
+  }
+  vector<int> component;
+  int zoneCount = network->components(isMeasured, component);
   
+  vector<Zone::sharedPointer> zones;
+  for (int iZone = 0; iZone < zoneCount; ++iZone) {
+    string zoneName = boost::lexical_cast<string>(iZone + 1);
+    zones.push_back(Zone::sharedPointer(new Zone(zoneName)));
+  }
   
+  // each node goes in its zone, and any flow across the zone's edge goes into its demand
+  for (int iNode = 0; iNode < network->nodeCount(); ++iNode) {
+    Zone::sharedPointer zone = zones[component[iNode]];
+    Junction::sharedPointer junction = boost::static_pointer_cast<Junction>(network->node(iNode));
+    zone->addJunction(junction);
+    AggregatorTimeSeries::sharedPointer zoneDemand = boost::dynamic_pointer_cast<AggregatorTimeSeries>(zone->demand());
+    
+    // flow is positive into a tank (out of the zone), so its sign for demand aggregation purposes should be negative.
+    if (junction->type() == Element::TANK) {
+      zoneDemand->addSource(boost::static_pointer_cast<Tank>(junction)->flowMeasure(), -1.);
+    }
+    // measured links: into the zone is positive.
+    for (int k = network->firstIncidence(iNode); k < network->firstIncidence(iNode + 1); ++k) {
+      int iLink = network->incidentLink(k);
+      if (isMeasured[iLink]) {
+        Pipe::sharedPointer pipe = boost::static_pointer_cast<Pipe>(network->link(iLink));
+        zoneDemand->addSource(pipe->flowMeasure(), network->isOutgoing(k) ? -1. : 1.);
+      }
+    }
+  }
   
-  
+  BOOST_FOREACH(const Zone::sharedPointer& zone, zones) {
+    this->addZone(zone);
+  }
+}
+
+void Model::clearZones() {
+  _zones.clear();
+  _isBoundaryScheduled = false;
+}
+
+boost::recursive_mutex& Model::stepMutex() {
+  return _stepMutex;
+}
+
+void Model::boundaryConditionsChanged() {
+  _isBoundaryScheduled = false;
 }
 
+// built on first use, after the elements are all in
+Topology::sharedPointer Model::topology() {
+  if (!_topology) {
+    vector<Node::sharedPointer> nodes;
+    nodes.insert(nodes.end(), _junctions.begin(), _junctions.end());
+    nodes.insert(nodes.end(), _tanks.begin(), _tanks.end());
+    nodes.insert(nodes.end(), _reservoirs.begin(), _reservoirs.end());
+    vector<Link::sharedPointer> links;
+    links.insert(links.end(), _pipes.begin(), _pipes.end());
+    links.insert(links.end(), _pumps.begin(), _pumps.end());
+    links.insert(links.end(), _valves.begin(), _valves.end());
+    _topology.reset(new Topology(nodes, links));
+  }
+  return _topology;
+}
 
 #pragma mark - Controls
 
@@ -180,7 +548,7 @@ void Model::overrideControls() throw(RtxException) {
 
 void Model::addJunction(Junction::sharedPointer newJunction) {
   if (!newJunction) {
-    std::cerr << "junction not specified" << std::endl;
+    RTX_LOG(warning, "Model", "junction not specified");
     return;
   }
   _junctions.push_back(newJunction);
@@ -188,7 +556,7 @@ void Model::addJunction(Junction::sharedPointer newJunction) {
 }
 void Model::addTank(Tank::sharedPointer newTank) {
   if (!newTank) {
-    std::cerr << "tank not specified" << std::endl;
+    RTX_LOG(warning, "Model", "tank not specified");
     return;
   }
   _tanks.push_back(newTank);
@@ -196,7 +564,7 @@ void Model::addTank(Tank::sharedPointer newTank) {
 }
 void Model::addReservoir(Reservoir::sharedPointer newReservoir) {
   if (!newReservoir) {
-    std::cerr << "reservoir not specified" << std::endl;
+    RTX_LOG(warning, "Model", "reservoir not specified");
     return;
   }
   _reservoirs.push_back(newReservoir);
@@ -204,7 +572,7 @@ void Model::addReservoir(Reservoir::sharedPointer newReservoir) {
 }
 void Model::addPipe(Pipe::sharedPointer newPipe) {
   if (!newPipe) {
-    std::cerr << "pipe not specified" << std::endl;
+    RTX_LOG(warning, "Model", "pipe not specified");
     return;
   }
   _pipes.push_back(newPipe);
@@ -212,7 +580,7 @@ void Model::addPipe(Pipe::sharedPointer newPipe) {
 }
 void Model::addPump(Pump::sharedPointer newPump) {
   if (!newPump) {
-    std::cerr << "pump not specified" << std::endl;
+    RTX_LOG(warning, "Model", "pump not specified");
     return;
   }
   _pumps.push_back(newPump);
@@ -220,7 +588,7 @@ void Model::addPump(Pump::sharedPointer newPump) {
 }
 void Model::addValve(Valve::sharedPointer newValve) {
   if (!newValve) {
-    std::cerr << "valve not specified" << std::endl;
+    RTX_LOG(warning, "Model", "valve not specified");
     return;
   }
   _valves.push_back(newValve);
@@ -234,10 +602,14 @@ void Model::addZone(Zone::sharedPointer zone) {
 
 // add to master lists
 void Model::add(Junction::sharedPointer newJunction) {
+  _topology.reset();
+  _hasStateColumns = false;
   _nodes[newJunction->name()] = newJunction;
   _elements.push_back(newJunction);
 }
 void Model::add(Pipe::sharedPointer newPipe) {
+  _topology.reset();
+  _hasStateColumns = false;
   // manually add the pipe to the nodes' lists.
   newPipe->from()->addLink(newPipe);
   newPipe->to()->addLink(newPipe);
@@ -265,29 +637,29 @@ Node::sharedPointer Model::nodeWithName(const string& name) {
   }
 }
 
-std::vector<Element::sharedPointer> Model::elements() {
+const std::vector<Element::sharedPointer>& Model::elements() {
   return _elements;
 }
 
-std::vector<Zone::sharedPointer> Model::zones() {
+const std::vector<Zone::sharedPointer>& Model::zones() {
   return _zones;
 }
-std::vector<Junction::sharedPointer> Model::junctions() {
+const std::vector<Junction::sharedPointer>& Model::junctions() {
   return _junctions;
 }
-std::vector<Tank::sharedPointer> Model::tanks() {
+const std::vector<Tank::sharedPointer>& Model::tanks() {
   return _tanks;
 }
-std::vector<Reservoir::sharedPointer> Model::reservoirs() {
+const std::vector<Reservoir::sharedPointer>& Model::reservoirs() {
   return _reservoirs;
 }
-std::vector<Pipe::sharedPointer> Model::pipes() {
+const std::vector<Pipe::sharedPointer>& Model::pipes() {
   return _pipes;
 }
-std::vector<Pump::sharedPointer> Model::pumps() {
+const std::vector<Pump::sharedPointer>& Model::pumps() {
   return _pumps;
 }
-std::vector<Valve::sharedPointer> Model::valves() {
+const std::vector<Valve::sharedPointer>& Model::valves() {
   return _valves;
 }
 
@@ -296,18 +668,11 @@ std::vector<Valve::sharedPointer> Model::valves() {
 #pragma mark - Publicly Accessible Simulation Methods
 
 void Model::runSinglePeriod(time_t time) {
-  cerr << "whoops, not implemented" << endl;
+  // run the simulation to the requested time...
+  runExtendedPeriod(resumeBefore(time), time);
   
-  time_t lastSimulationPeriod, boundaryReset, start;
-  // to run a single period, we need boundary conditions.
-  // so back up to either the most recent set of results, or the most recent boundary-reset event
-  // (whichever is nearer) and simulate through the requested time.
-  //lastSimulationPeriod = _masterClock->validTime(time);
-  boundaryReset = _boundaryResetClock->validTime(time);
-  start = RTX_MAX(lastSimulationPeriod, boundaryReset);
-  
-  // run the simulation to the requested time.
-  runExtendedPeriod(start, time);
+  // ...and then the period itself.
+  solvePeriod(time);
 }
 
 void Model::runExtendedPeriod(time_t start, time_t end) {
@@ -315,24 +680,128 @@ void Model::runExtendedPeriod(time_t start, time_t end) {
   time_t nextClockTime = start;
   time_t nextSimulationTime = start;
   time_t stepToTime = start;
-  while (simulationTime < end) {
-    // get parameters from the RTX elements, and pull them into the simulation
-    setSimulationParameters(simulationTime);
-    // simulate this period, find the next timestep boundary.
-    solveSimulation(simulationTime);
-    // tell each element to update its derived states (simulation-computed values)
-    saveHydraulicStates(simulationTime);
-    // get time to next simulation period
-    nextSimulationTime = nextHydraulicStep(simulationTime);
-    nextClockTime = _regularMasterClock->timeAfter(simulationTime);
-    stepToTime = RTX_MIN(nextClockTime, nextSimulationTime);
-    
-    // and step the simulation to that time.
-    stepSimulation(stepToTime);
-    simulationTime = currentSimulationTime();
-    }
+  // the engine may hold anything from before, so every boundary condition goes in at the first step
+  _isBoundaryScheduled = false;
+  prepareSimulation(start, end);
+  startPrefetching(start, end);
+  try {
+    while (simulationTime < end) {
+      RTX_TRACE_SPAN(stepSpan, ("step", "model", "", simulationTime, simulationTime));
+      stepLock_t stepLock(_stepMutex);
+      double periodStarted = _metrics ? steadySeconds() : 0;
+      awaitPrefetch(simulationTime);
+      // keep the state the simulation carries into each master clock time, for runSinglePeriod to pick up from
+      if (_checkpointLimit > 0 && _regularMasterClock->isValid(simulationTime)) {
+        saveCheckpoint(simulationTime);
+      }
+      // water quality carries on from where it got to, or else starts over here
+      if (_shouldRunWaterQuality && !(_isQualityStarted && _qualityTime == simulationTime)) {
+        if (startQuality(simulationTime)) {
+          _isQualityStarted = true;
+          _qualityStepCount = 0;
+          _qualityBatch.clear();
+          gatherQualityStates(simulationTime);
+        }
+        else {
+          RTX_LOG(warning, "Model", "this engine doesn't simulate water quality");
+          _shouldRunWaterQuality = false;
+        }
+      }
+      // get parameters from the RTX elements, and pull them into the simulation
+      setSimulationParameters(simulationTime);
+      // simulate this period, find the next timestep boundary.
+      double started = profileTime();
+      solveSimulation(simulationTime);
+      started = profilePhase(solvePhase, started);
+      // tell each element to update its derived states (simulation-computed values)
+      saveHydraulicStates(simulationTime);
+      started = profilePhase(savePhase, started);
+      // get time to next simulation period
+      nextSimulationTime = nextHydraulicStep(simulationTime);
+      nextClockTime = _regularMasterClock->timeAfter(simulationTime);
+      stepToTime = RTX_MIN(nextClockTime, nextSimulationTime);
+      // stopping at the end, so that a run picking up from there finds the simulation where it left off
+      stepToTime = RTX_MIN(stepToTime, end);
   
+      // and step the simulation to that time.
+      stepSimulation(stepToTime);
+      started = profilePhase(stepPhase, started);
+      if (_shouldRunWaterQuality) {
+        simulateQuality(simulationTime, currentSimulationTime());
+        profilePhase(qualityPhase, started);
+      }
+      profilePeriod(simulationTime);
+      observePeriod(simulationTime, periodStarted);
+      // whatever this period's range queries grew their buffers to, only so much is kept for the next one
+      Scratch::endStep();
+      simulationTime = currentSimulationTime();
+    }
+  } catch (...) {
+    stopPrefetching();
+    throw;
+  }
   
+  stopPrefetching();
+  flushStorage();
+}
+
+void Model::setCheckpointLimit(size_t count) {
+  _checkpointLimit = count;
+  while (_checkpoints.size() > _checkpointLimit) {
+    _checkpoints.erase(_checkpoints.begin());
+  }
+}
+
+size_t Model::checkpointLimit() {
+  return _checkpointLimit;
+}
+
+void Model::clearCheckpoints() {
+  _checkpoints.clear();
+}
+
+void Model::setDemandDeadband(double flow) {
+  _demandDeadband = flow;
+}
+
+double Model::demandDeadband() {
+  return _demandDeadband;
+}
+
+void Model::setHeadDeadband(double head) {
+  _headDeadband = head;
+}
+
+double Model::headDeadband() {
+  return _headDeadband;
+}
+
+void Model::setSettingDeadband(double setting) {
+  _settingDeadband = setting;
+}
+
+double Model::settingDeadband() {
+  return _settingDeadband;
+}
+
+void Model::setShouldRunWaterQuality(bool run) {
+  if (!run && _isQualityStarted) {
+    stopQuality();
+    _isQualityStarted = false;
+  }
+  _shouldRunWaterQuality = run;
+}
+
+bool Model::shouldRunWaterQuality() {
+  return _shouldRunWaterQuality;
+}
+
+void Model::setQualityDecimation(int steps) {
+  _qualityDecimation = RTX_MAX(steps, 1);
+}
+
+int Model::qualityDecimation() {
+  return _qualityDecimation;
 }
 
 
@@ -358,7 +827,7 @@ int Model::qualityTimeStep() {
 std::ostream& Model::toStream(std::ostream &stream) {
   // output shall be as follows:
   /*
-   
+  
    Model Properties:
       ## nodes (## tanks, ## reservoirs) in ## zones
       ## links (## pumps, ## valves)
@@ -366,7 +835,7 @@ std::ostream& Model::toStream(std::ostream &stream) {
       ##s (hydraulic), ##s (quality)
    State storage:
    [point record properties]
-   
+  
    */
   
   stream << "Model Properties" << endl;
@@ -381,150 +850,1254 @@ std::ostream& Model::toStream(std::ostream &stream) {
   return stream;
 }
 
+double Model::linearSolveTime(time_t time) {
+  return 0; // unless the engine can say
+}
+
+size_t Model::engineMemory() {
+  return 0;
+}
+
+size_t Model::peakEngineMemory() {
+  return 0;
+}
+
+void Model::prepareSimulation(time_t start, time_t end) {
+  // nothing to do by default
+}
+
 void Model::setSimulationParameters(time_t time) {
-  // set all element parameters
+  RTX_TRACE_SPAN(span, ("boundaries", "model", "", time, time));
+  double started = profileTime();
+  if (!_isBoundaryScheduled) {
+    scheduleBoundaryConditions();
+  }
+  vector<size_t> due = dueBoundaryConditions(time);
+  
+  // get the boundary data in as few database round trips as we can
+  Scratch::Vector<TimeSeries::sharedPointer> seriesBuffer;
+  vector<TimeSeries::sharedPointer>& series = *seriesBuffer;
+  if (_doesOverrideDemands) {
+    BOOST_FOREACH(const Zone::sharedPointer& zone, this->zones()) {
+      series.push_back(zone->demand());
+    }
+  }
+  BOOST_FOREACH(size_t i, due) {
+    series.push_back(_boundaryConditions[i].series);
+  }
+  prefetchBoundaryData(series, time);
+  started = profilePhase(boundaryFetchPhase, started);
   
-  // allocate junction demands based on zones, and set the junction demand values in the model.
+  // allocate junction demands based on zones; the junctions' demand conditions then set them in the model.
   if (_doesOverrideDemands) {
-    BOOST_FOREACH(Zone::sharedPointer zone, this->zones()) {
+    BOOST_FOREACH(const Zone::sharedPointer& zone, this->zones()) {
+      RTX_TRACE_SPAN(zoneSpan, ("zone allocation", "model", zone->name(), time, time));
       zone->allocateDemandToJunctions(time);
     }
-    // hydraulic junctions - set demand values.
-    BOOST_FOREACH(Junction::sharedPointer junction, this->junctions()) {
-      if (junction->doesHaveBoundaryFlow()) {
-        // junction is separate from the allocation scheme
-        double demandValue = Units::convertValue(junction->boundaryFlow()->point(time).value, junction->boundaryFlow()->units(), flowUnits());
-        setJunctionDemand(junction->name(), demandValue);
-      }
-      else {
-        double demandValue = Units::convertValue(junction->demand()->point(time).value, junction->demand()->units(), flowUnits());
-        setJunctionDemand(junction->name(), demandValue);
-      }
+  }
+  started = profilePhase(zoneAllocationPhase, started);
+  
+  // set the element parameters that are due. they're in the order they were scheduled in, so each element type's
+  // conditions come together, and take one reading of the clock between them.
+  phase_t phase = junctionBoundaryPhase;
+  BOOST_FOREACH(size_t i, due) {
+    if (_isProfilingSteps && boundaryPhase(_boundaryConditions[i].kind) != phase) {
+      started = profilePhase(phase, started);
+      phase = boundaryPhase(_boundaryConditions[i].kind);
     }
+    applyBoundaryCondition(_boundaryConditions[i], time);
   }
-  // for reservoirs, set the boundary head condition
-  BOOST_FOREACH(Reservoir::sharedPointer reservoir, this->reservoirs()) {
+  profilePhase(phase, started);
+}
+
+
+// list the boundary conditions, in the order they're set in, and make them all due now.
+void Model::scheduleBoundaryConditions() {
+  _boundaryConditions.clear();
+  _boundaryEvents = std::priority_queue<boundaryEvent_t, vector<boundaryEvent_t>, std::greater<boundaryEvent_t> >();
+  BoundaryCondition condition;
+  condition.isApplied = false;
+  condition.appliedValue = 0;
+  
+  if (_doesOverrideDemands) {
+    BOOST_FOREACH(const Junction::sharedPointer& junction, this->junctions()) {
+      condition.kind = BoundaryCondition::junctionDemand;
+      condition.element = junction;
+      // a junction is separate from the allocation scheme if it has its own boundary flow
+      condition.series = junction->doesHaveBoundaryFlow() ? junction->boundaryFlow() : junction->demand();
+      // an allocated demand changes whenever its zone's inputs do
+      condition.clock = (junction->doesHaveBoundaryFlow() || this->zones().empty()) ? condition.series->clock() : Clock::sharedPointer();
+      _boundaryConditions.push_back(condition);
+    }
+  }
+  BOOST_FOREACH(const Reservoir::sharedPointer& reservoir, this->reservoirs()) {
     if (reservoir->doesHaveBoundaryHead()) {
-      // get the head measurement parameter, and pass it through as a state.
-      double headValue = Units::convertValue(reservoir->boundaryHead()->point(time).value, reservoir->boundaryHead()->units(), headUnits());
-      setReservoirHead( reservoir->name(), headValue );
+      condition.kind = BoundaryCondition::reservoirHead;
+      condition.element = reservoir;
+      condition.series = reservoir->boundaryHead();
+      condition.clock = condition.series->clock();
+      _boundaryConditions.push_back(condition);
     }
   }
-  // for tanks, set the boundary head, but only if the tank reset clock has fired.
-  BOOST_FOREACH(Tank::sharedPointer tank, this->tanks()) {
-    if (tank->doesResetLevel() && tank->levelResetClock()->isValid(time) && tank->doesHaveHeadMeasure()) {
-      double levelValue = Units::convertValue(tank->level()->point(time).value, tank->level()->units(), headUnits());
-      setTankLevel(tank->name(), levelValue);
+  // tanks are only set when their reset clocks fire
+  BOOST_FOREACH(const Tank::sharedPointer& tank, this->tanks()) {
+    if (tank->doesResetLevel() && tank->doesHaveHeadMeasure()) {
+      condition.kind = BoundaryCondition::tankLevel;
+      condition.element = tank;
+      condition.series = tank->level();
+      condition.clock = tank->levelResetClock();
+      _boundaryConditions.push_back(condition);
     }
   }
-  
-  // for valves, set status and setting
-  BOOST_FOREACH(Valve::sharedPointer valve, this->valves()) {
+  BOOST_FOREACH(const Pipe::sharedPointer& pipe, this->pipes()) {
+    if (pipe->doesHaveStatusParameter()) {
+      condition.kind = BoundaryCondition::pipeStatus;
+      condition.element = pipe;
+      condition.series = pipe->statusParameter();
+      condition.clock = condition.series->clock();
+      _boundaryConditions.push_back(condition);
+    }
+  }
+  BOOST_FOREACH(const Valve::sharedPointer& valve, this->valves()) {
     if (valve->doesHaveStatusParameter()) {
-      setPipeStatus( valve->name(), Pipe::status_t(valve->statusParameter()->point(time).value) );
+      condition.kind = BoundaryCondition::valveStatus;
+      condition.element = valve;
+      condition.series = valve->statusParameter();
+      condition.clock = condition.series->clock();
+      _boundaryConditions.push_back(condition);
     }
     if (valve->doesHaveSettingParameter()) {
-      setValveSetting( valve->name(), valve->settingParameter()->point(time).value );
+      condition.kind = BoundaryCondition::valveSetting;
+      condition.element = valve;
+      condition.series = valve->settingParameter();
+      condition.clock = condition.series->clock();
+      _boundaryConditions.push_back(condition);
     }
   }
-  
-  // for pumps, set status
-  BOOST_FOREACH(Pump::sharedPointer pump, this->pumps()) {
+  BOOST_FOREACH(const Pump::sharedPointer& pump, this->pumps()) {
     if (pump->doesHaveStatusParameter()) {
-      setPumpStatus( pump->name(), Pipe::status_t(pump->statusParameter()->point(time).value) );
+      condition.kind = BoundaryCondition::pumpStatus;
+      condition.element = pump;
+      condition.series = pump->statusParameter();
+      condition.clock = condition.series->clock();
+      _boundaryConditions.push_back(condition);
+    }
+  }
+  
+  const Units flow = flowUnits(), head = headUnits();
+  for (size_t i = 0; i < _boundaryConditions.size(); ++i) {
+    BoundaryCondition& scheduled = _boundaryConditions[i];
+    switch (scheduled.kind) {
+      case BoundaryCondition::junctionDemand:
+        scheduled.converter = UnitConverter(scheduled.series->units(), flow);
+        break;
+      case BoundaryCondition::reservoirHead:
+      case BoundaryCondition::tankLevel:
+        scheduled.converter = UnitConverter(scheduled.series->units(), head);
+        break;
+      default:
+        break;
+    }
+    if (!scheduled.converter.isValid()) {
+      RTX_LOG(warning, "Model", "Units are not dimensionally consistent for " << scheduled.element->name());
+    }
+    _boundaryEvents.push(boundaryEvent_t(0, i));
+  }
+  _isBoundaryScheduled = true;
+}
+
+
+// take the conditions due by this time off the queue, and put each back for its next sample.
+// a condition without a regular clock is due again at the very next step (see Clock::timeAfter).
+vector<size_t> Model::dueBoundaryConditions(time_t time) {
+  vector<size_t> due;
+  while (!_boundaryEvents.empty() && _boundaryEvents.top().first <= time) {
+    due.push_back(_boundaryEvents.top().second);
+    _boundaryEvents.pop();
+  }
+  // back into the order they're set in -- a valve's status before its setting
+  sort(due.begin(), due.end());
+  
+  BOOST_FOREACH(size_t i, due) {
+    const Clock::sharedPointer& clock = _boundaryConditions[i].clock;
+    time_t next = clock ? clock->timeAfter(time) : time + 1;
+    _boundaryEvents.push(boundaryEvent_t(next, i));
+  }
+  
+  vector<size_t> toApply;
+  BOOST_FOREACH(size_t i, due) {
+    const BoundaryCondition& condition = _boundaryConditions[i];
+    // a tank is only reset at its clock's times -- not if a step passes over one
+    if (condition.kind != BoundaryCondition::tankLevel || condition.clock->isValid(time)) {
+      toApply.push_back(i);
     }
   }
+  return toApply;
+}
+
+
+void Model::applyBoundaryCondition(BoundaryCondition& condition, time_t time) {
+  const TimeSeries::sharedPointer& series = condition.series;
+  double value = series->point(time).value;
+  double deadband = 0;
+  switch (condition.kind) {
+    case BoundaryCondition::junctionDemand:
+      value = condition.converter.convert(value);
+      deadband = _demandDeadband;
+      break;
+    case BoundaryCondition::reservoirHead:
+    case BoundaryCondition::tankLevel:
+      value = condition.converter.convert(value);
+      deadband = _headDeadband;
+      break;
+    case BoundaryCondition::valveSetting:
+      deadband = _settingDeadband;
+      break;
+    default:
+      break;
+  }
   
+  // the engine keeps what it was given, so leave it be if that's close enough.
+  // a tank is the exception -- its level has moved on since it was last reset.
+  if (condition.kind != BoundaryCondition::tankLevel && condition.isApplied && fabs(value - condition.appliedValue) <= deadband) {
+    return;
+  }
+  condition.isApplied = true;
+  condition.appliedValue = value;
   
+  switch (condition.kind) {
+    case BoundaryCondition::junctionDemand:
+      setJunctionDemand(boost::static_pointer_cast<Junction>(condition.element), value);
+      break;
+    case BoundaryCondition::reservoirHead:
+      setReservoirHead(boost::static_pointer_cast<Reservoir>(condition.element), value);
+      break;
+    case BoundaryCondition::tankLevel:
+      setTankLevel(boost::static_pointer_cast<Tank>(condition.element), value);
+      break;
+    case BoundaryCondition::pipeStatus:
+    case BoundaryCondition::valveStatus:
+      setPipeStatus(boost::static_pointer_cast<Pipe>(condition.element), Pipe::status_t(value));
+      break;
+    case BoundaryCondition::valveSetting:
+      setValveSetting(boost::static_pointer_cast<Valve>(condition.element), value);
+      break;
+    case BoundaryCondition::pumpStatus:
+      setPumpStatus(boost::static_pointer_cast<Pump>(condition.element), Pipe::status_t(value));
+      break;
+    default:
+      break;
+  }
+}
+
+// the due series' database-backed data, fetched in one batch per record (a window ahead, if the record reads ahead).
+// the records' batches all go out at once, and the step waits for them together.
+void Model::prefetchBoundaryData(const vector<TimeSeries::sharedPointer>& series, time_t time) {
+  namesByRecord_t namesByRecord = databaseSeries(series);
+  vector<DbPointRecord::fetchFuture_t> fetches;
+  BOOST_FOREACH(namesByRecord_t::value_type& entry, namesByRecord) {
+    fetches.push_back(entry.first->prefetchAsync(entry.second, time));
+  }
+  BOOST_FOREACH(const DbPointRecord::fetchFuture_t& fetch, fetches) {
+    fetch.get();
+  }
 }
 
 
 
 void Model::saveHydraulicStates(time_t time) {
+  RTX_TRACE_SPAN(span, ("save states", "model", "", time, time));
   
   // retrieve results from the hydraulic sim 
   // then insert the state values into elements' time series.
+  // each state is gathered into a column first -- from the engine's arrays if it has them, or else an element at a time.
+  // the engine is only asked on this thread; converting and inserting the columns can then be shared out.
+  if (!_hasStateColumns) {
+    buildStateColumns();
+  }
+  NetworkStates network;
+  bool isGathering = networkStates(network);
+  Scratch::Vector<StateColumn*> columnBuffer;
+  vector<StateColumn*>& columns = *columnBuffer;
   
   // junctions, tanks, reservoirs
-  BOOST_FOREACH(Junction::sharedPointer junction, junctions()) {
-    double head;
-    head = Units::convertValue(junctionHead(junction->name()), headUnits(), junction->head()->units());
-    Point headPoint(time, head, Point::good);
-    junction->head()->insert(headPoint);
-    
-    // todo - more fine-grained quality data? at wq step resolution...
-    double quality;
-    quality = 0; // Units::convertValue(junctionQuality(junction->name()), RTX_MILLIGRAMS_PER_LITER, junction->quality()->units());
-    Point qualityPoint(time, quality, Point::good);
-    junction->quality()->insert(qualityPoint);
+  for (size_t i = 0; i < _junctionHeads.series.size(); ++i) {
+    int index = _junctionHeads.indexes[i];
+    _junctionHeads.values[i] = (isGathering && index > 0 && index <= network.nodeCount) ? network.head[index - 1] : junctionHead(_junctions[_junctionHeads.positions[i]]);
+  }
+  columns.push_back(&_junctionHeads);
+  
+  // with water quality running, qualities are stored by quality step instead (see simulateQuality)
+  if (!_shouldRunWaterQuality) {
+    columns.push_back(&_junctionQualities);
   }
   
   // only save demand states if 
   if (!_doesOverrideDemands) {
-    BOOST_FOREACH(Junction::sharedPointer junction, junctions()) {
-      double demand;
-      demand = Units::convertValue(junctionDemand(junction->name()), flowUnits(), junction->demand()->units());
-      Point demandPoint(time, demand, Point::good);
-      junction->demand()->insert(demandPoint);
+    for (size_t i = 0; i < _junctionDemands.series.size(); ++i) {
+      int index = _junctionDemands.indexes[i];
+      _junctionDemands.values[i] = (isGathering && index > 0 && index <= network.nodeCount) ? network.demand[index - 1] : junctionDemand(_junctions[_junctionDemands.positions[i]]);
     }
+    columns.push_back(&_junctionDemands);
   }
   
-  BOOST_FOREACH(Reservoir::sharedPointer reservoir, reservoirs()) {
-    double head;
-    head = Units::convertValue(junctionHead(reservoir->name()), headUnits(), reservoir->head()->units());
-    Point headPoint(time, head, Point::good);
-    reservoir->head()->insert(headPoint);
+  for (size_t i = 0; i < _reservoirHeads.series.size(); ++i) {
+    int index = _reservoirHeads.indexes[i];
+    _reservoirHeads.values[i] = (isGathering && index > 0 && index <= network.nodeCount) ? network.head[index - 1] : junctionHead(_reservoirs[_reservoirHeads.positions[i]]);
   }
+  columns.push_back(&_reservoirHeads);
   
-  BOOST_FOREACH(Tank::sharedPointer tank, tanks()) {
-    double head;
-    head = Units::convertValue(junctionHead(tank->name()), headUnits(), tank->head()->units());
-    Point headPoint(time, head, Point::good);
-    tank->head()->insert(headPoint);
+  for (size_t i = 0; i < _tankHeads.series.size(); ++i) {
+    int index = _tankHeads.indexes[i];
+    _tankHeads.values[i] = (isGathering && index > 0 && index <= network.nodeCount) ? network.head[index - 1] : junctionHead(_tanks[_tankHeads.positions[i]]);
   }
+  columns.push_back(&_tankHeads);
   
   // pipe elements
-  BOOST_FOREACH(Pipe::sharedPointer pipe, pipes()) {
-    double flow;
-    flow = Units::convertValue(pipeFlow(pipe->name()), flowUnits(), pipe->flow()->units());
-    Point aPoint(time, flow, Point::good);
-    pipe->flow()->insert(aPoint);
-  }
-  
-  BOOST_FOREACH(Valve::sharedPointer valve, valves()) {
-    double flow;
-    flow = Units::convertValue(pipeFlow(valve->name()), flowUnits(), valve->flow()->units());
-    Point aPoint(time, flow, Point::good);
-    valve->flow()->insert(aPoint);
-  }
-  
-  // pump energy
-  BOOST_FOREACH(Pump::sharedPointer pump, pumps()) {
-    double flow;
-    flow = Units::convertValue(pipeFlow(pump->name()), flowUnits(), pump->flow()->units());
-    Point flowPoint(time, flow, Point::good);
-    pump->flow()->insert(flowPoint);
-    
-    double energy;
-    energy = pumpEnergy(pump->name());
-    Point energyPoint(time, energy, Point::good);
-    pump->energy()->insert(energyPoint);
+  for (size_t i = 0; i < _pipeFlows.series.size(); ++i) {
+    int index = _pipeFlows.indexes[i];
+    _pipeFlows.values[i] = (isGathering && index > 0 && index <= network.linkCount) ? network.flow[index - 1] : pipeFlow(_pipes[_pipeFlows.positions[i]]);
+  }
+  columns.push_back(&_pipeFlows);
+  
+  for (size_t i = 0; i < _valveFlows.series.size(); ++i) {
+    int index = _valveFlows.indexes[i];
+    _valveFlows.values[i] = (isGathering && index > 0 && index <= network.linkCount) ? network.flow[index - 1] : pipeFlow(_valves[_valveFlows.positions[i]]);
+  }
+  columns.push_back(&_valveFlows);
+  
+  // pump flow and energy
+  for (size_t i = 0; i < _pumpFlows.series.size(); ++i) {
+    int index = _pumpFlows.indexes[i];
+    _pumpFlows.values[i] = (isGathering && index > 0 && index <= network.linkCount) ? network.flow[index - 1] : pipeFlow(_pumps[_pumpFlows.positions[i]]);
+  }
+  for (size_t i = 0; i < _pumpEnergies.series.size(); ++i) {
+    _pumpEnergies.values[i] = pumpEnergy(_pumps[_pumpEnergies.positions[i]]);
+  }
+  columns.push_back(&_pumpFlows);
+  columns.push_back(&_pumpEnergies);
+  
+  // then convert and insert, splitting the columns' elements between threads if there are enough of them.
+  size_t total = 0;
+  BOOST_FOREACH(StateColumn* column, columns) {
+    total += column->series.size();
   }
+  size_t chunks = std::min(_stateThreads, std::max(total / RTX_MIN_STATES_PER_THREAD, (size_t)1));
+  std::vector<Scheduler::task_t> tasks;
+  for (size_t i = 0; i < chunks; ++i) {
+    tasks.push_back(boost::bind(&Model::insertStates, this, boost::cref(columns), i * total / chunks, (i + 1) * total / chunks, time));
+  }
+  runtime()->scheduler()->run(tasks, _isRunningLive ? Scheduler::realtimePriority : _runPriority);
   
   // save the timestep information
   Point error(time, relativeError(time));
   _relativeError->insert(error);
   Point iterationCount(time, iterations(time));
   _iterations->insert(iterationCount);
+  
+}
+
+void Model::setStateThreads(size_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = boost::thread::hardware_concurrency();
+  }
+  _stateThreads = RTX_MAX(threadCount, (size_t)1);
+}
 
+size_t Model::stateThreads() {
+  return _stateThreads;
 }
 
-void Model::setCurrentSimulationTime(time_t time) {
-  _currentSimulationTime = time;
+void Model::setRuntime(RuntimeContext::sharedPointer runtime) {
+  _runtime = runtime;
 }
-time_t Model::currentSimulationTime() {
-  return _currentSimulationTime;
+
+RuntimeContext::sharedPointer Model::runtime() {
+  return (_runtime) ? _runtime : RuntimeContext::defaultContext();
+}
+
+void Model::setRunPriority(Scheduler::priority_t priority) {
+  _runPriority = priority;
+}
+
+Scheduler::priority_t Model::runPriority() {
+  return _runPriority;
+}
+
+Model::EnergyOptions Model::energyOptions() {
+  return _energyOptions;
 }
 
+void Model::setEnergyOptions(const EnergyOptions& options) {
+  _energyOptions = options;
+}
 
+void Model::setStoresState(stateKind_t state, bool stores) {
+  if (stores) {
+    _unstoredStates.erase(state);
+  }
+  else {
+    _unstoredStates.insert(state);
+  }
+  _hasStateColumns = false;
+  _qualityBatch.clear();
+}
+
+bool Model::storesState(stateKind_t state) {
+  return _unstoredStates.count(state) == 0;
+}
+
+void Model::setStoredElements(const std::vector<Element::sharedPointer>& elements) {
+  _storedElements = elements;
+  _hasStateColumns = false;
+  _qualityBatch.clear();
+}
+
+std::vector<Element::sharedPointer> Model::storedElements() {
+  return _storedElements;
+}
+
+void Model::setStateDeadband(stateKind_t state, double absolute, double relative, time_t heartbeat) {
+  vector<TimeSeries::sharedPointer> series;
+  switch (state) {
+    case junctionHeadState:
+    case junctionQualityState:
+    case junctionDemandState:
+      BOOST_FOREACH(const Junction::sharedPointer& junction, _junctions) {
+        series.push_back(state == junctionHeadState ? junction->head() : (state == junctionQualityState ? junction->quality() : junction->demand()));
+      }
+      break;
+    case reservoirHeadState:
+      BOOST_FOREACH(const Reservoir::sharedPointer& reservoir, _reservoirs) {
+        series.push_back(reservoir->head());
+      }
+      break;
+    case tankHeadState:
+      BOOST_FOREACH(const Tank::sharedPointer& tank, _tanks) {
+        series.push_back(tank->head());
+      }
+      break;
+    case pipeFlowState:
+      BOOST_FOREACH(const Pipe::sharedPointer& pipe, _pipes) {
+        series.push_back(pipe->flow());
+      }
+      break;
+    case valveFlowState:
+      BOOST_FOREACH(const Valve::sharedPointer& valve, _valves) {
+        series.push_back(valve->flow());
+      }
+      break;
+    case pumpFlowState:
+    case pumpEnergyState:
+      BOOST_FOREACH(const Pump::sharedPointer& pump, _pumps) {
+        series.push_back(state == pumpFlowState ? pump->flow() : pump->energy());
+      }
+      break;
+  }
+  BOOST_FOREACH(const TimeSeries::sharedPointer& ts, series) {
+    ts->setWriteDeadband(absolute, relative, heartbeat);
+  }
+}
+
+// the run up to the period stores what it's subscribed to, as always; only the period itself gets everything.
+void Model::storeAllStates(time_t time) {
+  runExtendedPeriod(resumeBefore(time), time);
+  _isStoringAllStates = true;
+  _hasStateColumns = false;
+  try {
+    solvePeriod(time);
+  } catch (...) {
+    _isStoringAllStates = false;
+    _hasStateColumns = false;
+    throw;
+  }
+  _isStoringAllStates = false;
+  _hasStateColumns = false;
+}
+
+#pragma mark - Replay Pipeline
+
+void Model::setPrefetchWindow(time_t seconds, size_t depth) {
+  _prefetchWindow = RTX_MAX(seconds, (time_t)0);
+  _prefetchDepth = RTX_MAX(depth, (size_t)1);
+}
+
+time_t Model::prefetchWindow() {
+  return _prefetchWindow;
+}
+
+size_t Model::prefetchDepth() {
+  return _prefetchDepth;
+}
+
+// the series every boundary condition is drawn from (whether or not it'll be due), and the zones' demands.
+void Model::startPrefetching(time_t start, time_t end) {
+  if (_prefetchWindow <= 0 || end <= start) {
+    return;
+  }
+  if (!_isBoundaryScheduled) {
+    scheduleBoundaryConditions();
+  }
+  vector<TimeSeries::sharedPointer> series;
+  if (_doesOverrideDemands) {
+    BOOST_FOREACH(const Zone::sharedPointer& zone, this->zones()) {
+      series.push_back(zone->demand());
+    }
+  }
+  BOOST_FOREACH(const BoundaryCondition& condition, _boundaryConditions) {
+    series.push_back(condition.series);
+  }
+  
+  // results go out through the write-behind queue while the run goes on -- put back as it was at the end
+  DbPointRecord::sharedPointer dbRecord = boost::dynamic_pointer_cast<DbPointRecord>(_record);
+  if (dbRecord && !dbRecord->writeBehind()) {
+    dbRecord->setWriteBehind(true);
+    _didEnableWriteBehind = true;
+  }
+  
+  {
+    boost::lock_guard<boost::mutex> lock(_prefetchMutex);
+    _replayTime = start;
+    _prefetchedTime = start;
+    _prefetchWakeTime = start;
+    _isPrefetching = true;
+    _isPrefetchStopping = false;
+  }
+  _prefetchThread.reset(new boost::thread(boost::bind(&Model::prefetchWindows, this, series, start, end)));
+}
+
+void Model::stopPrefetching() {
+  if (_prefetchThread) {
+    {
+      boost::lock_guard<boost::mutex> lock(_prefetchMutex);
+      _isPrefetchStopping = true;
+    }
+    _prefetchChanged.notify_all();
+    _prefetchThread->join();
+    _prefetchThread.reset();
+  }
+  if (_didEnableWriteBehind) {
+    // drains the queue on the way
+    DbPointRecord::sharedPointer dbRecord = boost::dynamic_pointer_cast<DbPointRecord>(_record);
+    if (dbRecord) {
+      dbRecord->setWriteBehind(false);
+    }
+    _didEnableWriteBehind = false;
+  }
+}
+
+// the simulation waits for its window to be fetched, much as a cache miss would wait for the query -- but without
+// asking the database again for what's already on its way.
+void Model::awaitPrefetch(time_t time) {
+  if (!_prefetchThread) {
+    return;
+  }
+  boost::unique_lock<boost::mutex> lock(_prefetchMutex);
+  _replayTime = time;
+  if (_isPrefetching && time >= _prefetchWakeTime) {
+    _prefetchChanged.notify_all();
+  }
+  while (_isPrefetching && _prefetchedTime <= time) {
+    _prefetchChanged.wait(lock);
+  }
+}
+
+// the prefetch thread. window k covers start + k * _prefetchWindow up to the next one, and is fetched once the
+// simulation is within _prefetchDepth windows of its start -- so the first few go straight away.
+// whatever the stored series are derived through is computed here too, and kept in their caches for the simulation.
+// a failure here just leaves the simulation to fetch its own data.
+void Model::prefetchWindows(const vector<TimeSeries::sharedPointer>& series, time_t start, time_t end) {
+  try {
+    namesByRecord_t namesByRecord = databaseSeries(series);
+    vector<TimeSeries::sharedPointer> derived;
+    BOOST_FOREACH(const TimeSeries::sharedPointer& ts, series) {
+      if (boost::dynamic_pointer_cast<ModularTimeSeries>(ts) || boost::dynamic_pointer_cast<AggregatorTimeSeries>(ts)) {
+        derived.push_back(ts);
+      }
+    }
+    
+    for (time_t windowStart = start; windowStart < end; windowStart += _prefetchWindow) {
+      {
+        boost::unique_lock<boost::mutex> lock(_prefetchMutex);
+        _prefetchWakeTime = windowStart - (time_t)_prefetchDepth * _prefetchWindow;
+        while (!_isPrefetchStopping && _replayTime < _prefetchWakeTime) {
+          _prefetchChanged.wait(lock);
+        }
+        if (_isPrefetchStopping) {
+          break;
+        }
+      }
+      time_t windowEnd = RTX_MIN(windowStart + _prefetchWindow, end);
+      vector<DbPointRecord::fetchFuture_t> fetches;
+      BOOST_FOREACH(namesByRecord_t::value_type& entry, namesByRecord) {
+        fetches.push_back(entry.first->prefetchRangeAsync(entry.second, windowStart, windowEnd));
+      }
+      BOOST_FOREACH(const DbPointRecord::fetchFuture_t& fetch, fetches) {
+        fetch.get();
+      }
+      BOOST_FOREACH(const TimeSeries::sharedPointer& ts, derived) {
+        ts->points(windowStart, windowEnd);
+      }
+      {
+        boost::lock_guard<boost::mutex> lock(_prefetchMutex);
+        _prefetchedTime = windowEnd;
+      }
+      _prefetchChanged.notify_all();
+    }
+  } catch (std::exception& e) {
+    RTX_LOG(error, "Model", "boundary prefetching stopped: " << e.what());
+  }
+  
+  {
+    boost::lock_guard<boost::mutex> lock(_prefetchMutex);
+    _isPrefetching = false;
+  }
+  _prefetchChanged.notify_all();
+}
+
+#pragma mark - Live Operation
+
+void Model::runLivePeriod(time_t time) {
+  time_t lag = ::time(NULL) - _liveTime;
+  Scheduler::RealtimeSection realtime(runtime()->scheduler()); // background work waits for the step
+  _isRunningLive = true;
+  try {
+    drainIngestQueues();
+    // a catch-up carries on from where the last live period left the simulation, so nothing else can have run since
+    if (_catchUpLag > 0 && _liveTime > 0 && _liveTime < time && lag > _catchUpLag && currentSimulationTime() == _liveTime) {
+      RTX_LOG(warning, "Model", lag << " s behind the wall clock -- catching up");
+      catchUp(time);
+    }
+    else {
+      runSinglePeriod(time);
+    }
+  } catch (...) {
+    _isRunningLive = false;
+    throw;
+  }
+  _isRunningLive = false;
+  _liveTime = time;
+}
+
+void Model::setCatchUpLag(time_t seconds) {
+  _catchUpLag = RTX_MAX(seconds, (time_t)0);
+}
+
+time_t Model::catchUpLag() {
+  return _catchUpLag;
+}
+
+time_t Model::liveTime() {
+  return _liveTime;
+}
+
+void Model::addIngestQueue(IngestQueue::sharedPointer queue) {
+  if (!queue) {
+    RTX_LOG(warning, "Model", "ingest queue not specified");
+    return;
+  }
+  _ingestQueues.push_back(queue);
+}
+
+std::vector<IngestQueue::sharedPointer> Model::ingestQueues() {
+  return _ingestQueues;
+}
+
+// the period's profile counts this with its own phases, as its first
+void Model::drainIngestQueues() {
+  double started = profileTime();
+  BOOST_FOREACH(const IngestQueue::sharedPointer& queue, _ingestQueues) {
+    queue->drain();
+  }
+  profilePhase(ingestPhase, started);
+}
+
+// the backlog as one replay window: its boundary data in one batch per record, its results through the write-behind
+// queue, and then the live period as usual.
+void Model::catchUp(time_t time) {
+  time_t window = _prefetchWindow;
+  size_t depth = _prefetchDepth;
+  _prefetchWindow = time - _liveTime;
+  _prefetchDepth = 1;
+  try {
+    runExtendedPeriod(_liveTime, time);
+  } catch (...) {
+    _prefetchWindow = window;
+    _prefetchDepth = depth;
+    throw;
+  }
+  _prefetchWindow = window;
+  _prefetchDepth = depth;
+  solvePeriod(time);
+}
+
+#pragma mark - Step Profiling
+
+void Model::setProfilesSteps(bool profile) {
+  _isProfilingSteps = profile;
+}
+
+bool Model::profilesSteps() {
+  return _isProfilingSteps;
+}
+
+void Model::setProfileWindow(size_t periods) {
+  _profileWindow = RTX_MAX(periods, (size_t)1);
+  BOOST_FOREACH(PhaseProfile& profile, _phaseProfiles) {
+    profile.recent.clear();
+    profile.next = 0;
+  }
+}
+
+size_t Model::profileWindow() {
+  return _profileWindow;
+}
+
+TimeSeries::sharedPointer Model::phaseTime(phase_t phase) {
+  return _phaseProfiles.at(phase).series;
+}
+
+Model::phaseSummary_t Model::phaseSummary(phase_t phase) {
+  const PhaseProfile& profile = _phaseProfiles.at(phase);
+  phaseSummary_t summary;
+  summary.steps = profile.steps;
+  summary.totalSeconds = profile.totalSeconds;
+  if (profile.recent.empty()) {
+    return summary;
+  }
+  vector<double> sorted = profile.recent;
+  sort(sorted.begin(), sorted.end());
+  size_t last = sorted.size() - 1;
+  summary.median = sorted[last / 2];
+  summary.percentile99 = sorted[(size_t)(0.99 * last + 0.5)];
+  summary.maximum = sorted[last];
+  return summary;
+}
+
+void Model::resetProfile() {
+  BOOST_FOREACH(PhaseProfile& profile, _phaseProfiles) {
+    profile.seconds = 0;
+    profile.steps = 0;
+    profile.totalSeconds = 0;
+    profile.recent.clear();
+    profile.next = 0;
+  }
+}
+
+std::ostream& Model::profileToStream(std::ostream& stream) {
+  // microseconds show whatever format the caller left the stream in, so set one -- and put theirs back after.
+  std::ios_base::fmtflags flags = stream.flags();
+  std::streamsize precision = stream.precision();
+  stream.setf(std::ios_base::fixed, std::ios_base::floatfield);
+  stream.precision(6);
+  stream << "Step Profile (seconds; median, p99 and max over the last " << _profileWindow << " periods):" << endl;
+  for (size_t i = 0; i < _phaseProfiles.size(); ++i) {
+    phaseSummary_t summary = phaseSummary((phase_t)i);
+    stream << "    " << phaseNames[i] << ": " << summary.steps << " periods, " << summary.totalSeconds << " total; "
+           << summary.median << ", " << summary.percentile99 << ", " << summary.maximum << endl;
+  }
+  stream.flags(flags);
+  stream.precision(precision);
+  return stream;
+}
+
+#pragma mark - Memory
+
+Model::memoryFootprint_t Model::memoryFootprint() {
+  memoryFootprint_t footprint;
+  
+  // the elements themselves, and the lists and maps that find them
+  BOOST_FOREACH(const Junction::sharedPointer& junction, _junctions) {
+    footprint.elements += sizeof(Junction) + junction->name().capacity();
+  }
+  BOOST_FOREACH(const Tank::sharedPointer& tank, _tanks) {
+    footprint.elements += sizeof(Tank) + tank->name().capacity();
+  }
+  BOOST_FOREACH(const Reservoir::sharedPointer& reservoir, _reservoirs) {
+    footprint.elements += sizeof(Reservoir) + reservoir->name().capacity();
+  }
+  BOOST_FOREACH(const Pipe::sharedPointer& pipe, _pipes) {
+    footprint.elements += sizeof(Pipe) + pipe->name().capacity();
+  }
+  BOOST_FOREACH(const Pump::sharedPointer& pump, _pumps) {
+    footprint.elements += sizeof(Pump) + pump->name().capacity();
+  }
+  BOOST_FOREACH(const Valve::sharedPointer& valve, _valves) {
+    footprint.elements += sizeof(Valve) + valve->name().capacity();
+  }
+  size_t listed = _elements.capacity() + _storedElements.capacity() + _junctions.capacity() + _tanks.capacity()
+                  + _reservoirs.capacity() + _pipes.capacity() + _pumps.capacity() + _valves.capacity();
+  footprint.elements += listed * sizeof(Element::sharedPointer);
+  // a map entry is its key and value, with a link to the next in its bucket; each bucket is a pointer
+  size_t entryBytes = sizeof(std::string) + sizeof(Element::sharedPointer) + sizeof(void*);
+  footprint.elements += (_nodes.size() + _links.size()) * entryBytes;
+  footprint.elements += (_nodes.bucket_count() + _links.bucket_count()) * sizeof(void*);
+  
+  // each record once, however many series share it
+  set<PointRecord*> counted;
+  BOOST_FOREACH(const TimeSeries::sharedPointer& ts, memorySeries()) {
+    PointRecord::sharedPointer record = ts->record();
+    if (record && counted.insert(record.get()).second) {
+      footprint.records += record->memoryFootprint();
+      footprint.peakRecords += record->peakMemoryFootprint();
+    }
+  }
+  
+  BOOST_FOREACH(const checkpointMap_t::value_type& checkpoint, _checkpoints) {
+    footprint.checkpoints += checkpoint.second.capacity();
+  }
+  
+  footprint.engine = engineMemory();
+  footprint.peakEngine = peakEngineMemory();
+  return footprint;
+}
+
+std::ostream& Model::memoryToStream(std::ostream& stream) {
+  memoryFootprint_t footprint = memoryFootprint();
+  stream << "Memory (bytes): " << footprint.total() << " total" << endl;
+  stream << "    elements: " << footprint.elements << endl;
+  stream << "    records: " << footprint.records << " (peak " << footprint.peakRecords << ")" << endl;
+  stream << "    checkpoints: " << footprint.checkpoints << " (" << _checkpoints.size() << ")" << endl;
+  stream << "    engine: " << footprint.engine << " (peak " << footprint.peakEngine << ")" << endl;
+  
+  vector<seriesBytes_t> bySeries;
+  BOOST_FOREACH(const TimeSeries::sharedPointer& ts, memorySeries()) {
+    size_t bytes = ts->memoryFootprint();
+    if (bytes > 0) {
+      bySeries.push_back(seriesBytes_t(bytes, ts->name()));
+    }
+  }
+  size_t shown = RTX_MIN(bySeries.size(), (size_t)10);
+  partial_sort(bySeries.begin(), bySeries.begin() + shown, bySeries.end(), isLarger);
+  if (shown > 0) {
+    stream << "  largest series:" << endl;
+  }
+  for (size_t i = 0; i < shown; ++i) {
+    stream << "    " << bySeries[i].second << ": " << bySeries[i].first << endl;
+  }
+  return stream;
+}
+
+#pragma mark - Metrics
+
+void Model::setMetrics(Metrics::sharedPointer metrics, const std::string& name) {
+  _metrics = metrics;
+  _metricsName = name;
+  if (!_metrics) {
+    return;
+  }
+  _metrics->describe("rtx_model_periods_total", Metrics::counterMetric, "Periods simulated.");
+  _metrics->describe("rtx_model_period_seconds", Metrics::histogramMetric, "Wall time a period took, boundaries to stored results.");
+  _metrics->describe("rtx_model_solver_iterations", Metrics::histogramMetric, "Hydraulic solver iterations a period.", Metrics::exponentialBounds(1, 2, 8));
+}
+
+Metrics::sharedPointer Model::metrics() {
+  return _metrics;
+}
+
+void Model::observePeriod(time_t time, double started) {
+  if (!_metrics) {
+    return;
+  }
+  Metrics::labels_t labels = Metrics::label("model", _metricsName);
+  _metrics->increment("rtx_model_periods_total", 1, labels);
+  _metrics->observe("rtx_model_period_seconds", steadySeconds() - started, labels);
+  _metrics->observe("rtx_model_solver_iterations", iterations(time), labels);
+}
+
+#pragma mark - Demand Changes
+
+bool Model::demandSensitivities(const std::vector<Junction::sharedPointer>& junctions, std::vector<double>& head, std::vector<double>& flow) {
+  head.clear();
+  flow.clear();
+  if (junctions.empty()) {
+    return true;
+  }
+  // a set of one unit change per junction
+  vector<double> unitChanges(junctions.size(), 1.);
+  return demandResponse(junctions, unitChanges, (int)junctions.size(), head, flow);
+}
+
+bool Model::solveDemandChanges(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, std::vector<double>& head, std::vector<double>& flow, std::vector<int>& iterations) {
+  head.clear();
+  flow.clear();
+  iterations.clear();
+  if (junctions.empty() || changes.empty()) {
+    return true;
+  }
+  if (changes.size() % junctions.size() != 0) {
+    throw RtxException("solveDemandChanges: changes don't make whole sets of " + boost::lexical_cast<string>(junctions.size()));
+  }
+  int setCount = (int)(changes.size() / junctions.size());
+  
+  // every set's first-order response at once, for each solution to start from
+  vector<Junction::sharedPointer> setJunctions;
+  setJunctions.reserve(changes.size());
+  for (int set = 0; set < setCount; ++set) {
+    setJunctions.insert(setJunctions.end(), junctions.begin(), junctions.end());
+  }
+  vector<double> headChange, flowChange;
+  if (!demandResponse(setJunctions, changes, setCount, headChange, flowChange)) {
+    return false;
+  }
+  size_t linkCount = flowChange.size() / setCount;
+  
+  vector<double> setChanges, setHead, setFlow;
+  for (int set = 0; set < setCount; ++set) {
+    setChanges.assign(changes.begin() + set * junctions.size(), changes.begin() + (set + 1) * junctions.size());
+    int setIterations = 0;
+    const double* startFlowChange = (linkCount > 0) ? &flowChange[set * linkCount] : NULL;
+    if (!solveDemandChange(junctions, setChanges, startFlowChange, setHead, setFlow, setIterations)) {
+      head.clear();
+      flow.clear();
+      iterations.clear();
+      return false;
+    }
+    head.insert(head.end(), setHead.begin(), setHead.end());
+    flow.insert(flow.end(), setFlow.begin(), setFlow.end());
+    iterations.push_back(setIterations);
+  }
+  return true;
+}
+
+bool Model::demandResponse(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, int setCount, std::vector<double>& head, std::vector<double>& flow) {
+  return false;
+}
+
+bool Model::solveDemandChange(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, const double* startFlowChange, std::vector<double>& head, std::vector<double>& flow, int& iterations) {
+  return false;
+}
+
+#pragma mark - Water Quality
+
+// a hydraulic step can be of no length (once a simulation halts, they all are), but it still has a solution to take in
+void Model::simulateQuality(time_t time, time_t until) {
+  do {
+    time_t next = stepQuality(time, until);
+    if (next > time && ++_qualityStepCount >= _qualityDecimation) {
+      gatherQualityStates(next);
+      _qualityStepCount = 0;
+    }
+    time = next;
+  } while (time < until);
+  insertQualityStates();
+  _qualityTime = until;
+}
+
+// every quality step's junction qualities would be too many inserts to make one at a time, so they're held until the
+// hydraulic step is done, and each series then gets its share at once. each share starts with the last one's final
+// point: a record takes a batch that doesn't overlap what it has as a gap, and starts over from it.
+void Model::gatherQualityStates(time_t time) {
+  if (!_hasStateColumns) {
+    buildStateColumns();
+  }
+  nodeQualities(_nodeQualities);
+  _qualityBatch.resize(_junctionQualities.series.size());
+  for (size_t i = 0; i < _qualityBatch.size(); ++i) {
+    int index = _junctionQualities.indexes[i];
+    if (index > 0 && (size_t)index <= _nodeQualities.size()) {
+      _qualityBatch[i].push_back( Point(time, _nodeQualities[index - 1], Point::good) );
+    }
+  }
+}
+
+void Model::insertQualityStates() {
+  for (size_t i = 0; i < _qualityBatch.size() && i < _junctionQualities.series.size(); ++i) {
+    vector<Point>& batch = _qualityBatch[i];
+    if (batch.size() > 1) {
+      _junctionQualities.series[i]->insertPoints(batch);
+      batch.erase(batch.begin(), batch.end() - 1);
+    }
+  }
+}
+
+bool Model::startQuality(time_t time) {
+  return false;
+}
+
+time_t Model::stepQuality(time_t time, time_t until) {
+  return until;
+}
+
+void Model::nodeQualities(std::vector<double>& qualities) {
+  qualities.clear();
+}
+
+void Model::stopQuality() {
+  
+}
+
+bool Model::networkStates(NetworkStates& states) {
+  return false;
+}
+
+// the columns follow the element lists, so column position i is element i of its type.
+// the state series are made with their elements, and never replaced, so plain pointers to them are safe.
+void Model::buildStateColumns() {
+  StateColumn* columns[] = {&_junctionHeads, &_junctionQualities, &_junctionDemands, &_reservoirHeads, &_tankHeads, &_pipeFlows, &_valveFlows, &_pumpFlows, &_pumpEnergies};
+  BOOST_FOREACH(StateColumn* column, columns) {
+    column->positions.clear();
+    column->indexes.clear();
+    column->series.clear();
+    column->isConverted = true;
+  }
+  // what's subscribed to -- or everything, for storeAllStates
+  set<Element*> stored;
+  if (!_isStoringAllStates) {
+    BOOST_FOREACH(const Element::sharedPointer& element, _storedElements) {
+      stored.insert(element.get());
+    }
+  }
+  bool junctionHeads = _isStoringAllStates || storesState(junctionHeadState);
+  bool junctionQualities = _isStoringAllStates || storesState(junctionQualityState);
+  bool junctionDemands = _isStoringAllStates || storesState(junctionDemandState);
+  bool pumpFlows = _isStoringAllStates || storesState(pumpFlowState);
+  bool pumpEnergies = _isStoringAllStates || storesState(pumpEnergyState);
+  
+  for (size_t i = 0; i < _junctions.size(); ++i) {
+    const Junction::sharedPointer& junction = _junctions[i];
+    if (!stored.empty() && stored.find(junction.get()) == stored.end()) {
+      continue;
+    }
+    if (junctionHeads) {
+      _junctionHeads.add(i, junction->index(), junction->head().get());
+    }
+    if (junctionQualities) {
+      _junctionQualities.add(i, junction->index(), junction->quality().get());
+    }
+    if (junctionDemands) {
+      _junctionDemands.add(i, junction->index(), junction->demand().get());
+    }
+  }
+  for (size_t i = 0; i < _reservoirs.size() && (_isStoringAllStates || storesState(reservoirHeadState)); ++i) {
+    const Reservoir::sharedPointer& reservoir = _reservoirs[i];
+    if (stored.empty() || stored.find(reservoir.get()) != stored.end()) {
+      _reservoirHeads.add(i, reservoir->index(), reservoir->head().get());
+    }
+  }
+  for (size_t i = 0; i < _tanks.size() && (_isStoringAllStates || storesState(tankHeadState)); ++i) {
+    const Tank::sharedPointer& tank = _tanks[i];
+    if (stored.empty() || stored.find(tank.get()) != stored.end()) {
+      _tankHeads.add(i, tank->index(), tank->head().get());
+    }
+  }
+  for (size_t i = 0; i < _pipes.size() && (_isStoringAllStates || storesState(pipeFlowState)); ++i) {
+    const Pipe::sharedPointer& pipe = _pipes[i];
+    if (stored.empty() || stored.find(pipe.get()) != stored.end()) {
+      _pipeFlows.add(i, pipe->index(), pipe->flow().get());
+    }
+  }
+  for (size_t i = 0; i < _valves.size() && (_isStoringAllStates || storesState(valveFlowState)); ++i) {
+    const Valve::sharedPointer& valve = _valves[i];
+    if (stored.empty() || stored.find(valve.get()) != stored.end()) {
+      _valveFlows.add(i, valve->index(), valve->flow().get());
+    }
+  }
+  for (size_t i = 0; i < _pumps.size(); ++i) {
+    const Pump::sharedPointer& pump = _pumps[i];
+    if (!stored.empty() && stored.find(pump.get()) == stored.end()) {
+      continue;
+    }
+    if (pumpFlows) {
+      _pumpFlows.add(i, pump->index(), pump->flow().get());
+    }
+    if (pumpEnergies) {
+      _pumpEnergies.add(i, pump->index(), pump->energy().get());
+    }
+  }
+  // no quality yet, so zeros; and energy goes in as the engine has it.
+  _junctionQualities.isConverted = false;
+  _pumpEnergies.isConverted = false;
+  _junctionHeads.units = _reservoirHeads.units = _tankHeads.units = headUnits();
+  _junctionDemands.units = _pipeFlows.units = _valveFlows.units = _pumpFlows.units = flowUnits();
+  BOOST_FOREACH(StateColumn* column, columns) {
+    column->values.assign(column->series.size(), 0.);
+    column->converters.clear();
+    if (column->isConverted) {
+      BOOST_FOREACH(TimeSeries* series, column->series) {
+        column->converters.push_back(UnitConverter(column->units, series->units()));
+      }
+    }
+  }
+  _hasStateColumns = true;
+}
+
+// convert and insert a share of this step's states: elements [begin, end) of the columns, counted through them in turn.
+// a column without units has its values inserted as they are.
+void Model::insertStates(const std::vector<StateColumn*>& columns, size_t begin, size_t end, time_t time) {
+  size_t offset = 0;
+  BOOST_FOREACH(StateColumn* column, columns) {
+    size_t count = column->series.size();
+    size_t first = RTX_MAX(begin, offset), last = RTX_MIN(end, offset + count);
+    for (size_t n = first; n < last; ++n) {
+      size_t i = n - offset;
+      TimeSeries* series = column->series[i];
+      double value = column->isConverted ? column->converters[i].convert(column->values[i]) : column->values[i];
+      series->insert( Point(time, value, Point::good) );
+    }
+    offset += count;
+  }
+}
+
+void Model::setCurrentSimulationTime(time_t time) {
+  _currentSimulationTime = time;
+}
+
+bool Model::saveEngineState(std::vector<char>& state) {
+  return false;
+}
+
+void Model::restoreEngineState(const std::vector<char>& state) {
+  // nothing to restore
+}
+
+time_t Model::currentSimulationTime() {
+  return _currentSimulationTime;
+}
+
+
+#pragma mark - Private Methods
+
+std::vector<TimeSeries::sharedPointer> Model::memorySeries() {
+  vector<TimeSeries::sharedPointer> toVisit;
+  BOOST_FOREACH(const Element::sharedPointer& element, _elements) {
+    Junction::sharedPointer junction = boost::dynamic_pointer_cast<Junction>(element);
+    if (junction) {
+      toVisit.push_back(junction->head());
+      toVisit.push_back(junction->quality());
+      toVisit.push_back(junction->demand());
+    }
+    Pipe::sharedPointer pipe = boost::dynamic_pointer_cast<Pipe>(element);
+    if (pipe) {
+      toVisit.push_back(pipe->flow());
+    }
+    Pump::sharedPointer pump = boost::dynamic_pointer_cast<Pump>(element);
+    if (pump) {
+      toVisit.push_back(pump->energy());
+    }
+  }
+  BOOST_FOREACH(const Zone::sharedPointer& zone, _zones) {
+    toVisit.push_back(zone->demand());
+  }
+  BOOST_FOREACH(const BoundaryCondition& condition, _boundaryConditions) {
+    toVisit.push_back(condition.series);
+  }
+  toVisit.push_back(_relativeError);
+  toVisit.push_back(_iterations);
+  BOOST_FOREACH(const PhaseProfile& profile, _phaseProfiles) {
+    toVisit.push_back(profile.series);
+  }
+  
+  vector<TimeSeries::sharedPointer> series;
+  set<TimeSeries*> visited;
+  while (!toVisit.empty()) {
+    TimeSeries::sharedPointer ts = toVisit.back();
+    toVisit.pop_back();
+    if (!ts || !visited.insert(ts.get()).second) {
+      continue;
+    }
+    series.push_back(ts);
+    pushSources(ts, toVisit);
+  }
+  return series;
+}
+
+// to run a single period, we need the state the simulation would be in by then.
+// so back up to either the latest checkpoint, or the most recent boundary-reset event
+// (whichever is nearer), and the simulation goes on from there.
+time_t Model::resumeBefore(time_t time) {
+  time_t start = _boundaryResetClock->validTime(time);
+  checkpointMap_t::iterator checkpoint = _checkpoints.upper_bound(time);
+  if (checkpoint != _checkpoints.begin() && (--checkpoint)->first >= start) {
+    start = checkpoint->first;
+    restoreEngineState(checkpoint->second);
+    setCurrentSimulationTime(start);
+  }
+  return start;
+}
+
+// the period a run stops at, which runExtendedPeriod doesn't solve
+void Model::solvePeriod(time_t time) {
+  stepLock_t stepLock(_stepMutex);
+  if (_checkpointLimit > 0 && _regularMasterClock->isValid(time)) {
+    saveCheckpoint(time);
+  }
+  RTX_TRACE_SPAN(span, ("period", "model", "", time, time));
+  double periodStarted = _metrics ? steadySeconds() : 0;
+  setSimulationParameters(time);
+  double started = profileTime();
+  solveSimulation(time);
+  started = profilePhase(solvePhase, started);
+  saveHydraulicStates(time);
+  profilePhase(savePhase, started);
+  profilePeriod(time);
+  observePeriod(time, periodStarted);
+  flushStorage();
+}
+
+double Model::profileTime() {
+  return _isProfilingSteps ? steadySeconds() : 0;
+}
+
+double Model::profilePhase(phase_t phase, double since) {
+  if (!_isProfilingSteps) {
+    return 0;
+  }
+  double now = steadySeconds();
+  _phaseProfiles[phase].seconds += now - since;
+  return now;
+}
+
+// called once the period's phases are done: each goes into its series at the period's time, and into the summaries
+void Model::profilePeriod(time_t time) {
+  if (!_isProfilingSteps) {
+    return;
+  }
+  _phaseProfiles[linearSolvePhase].seconds = linearSolveTime(time);
+  BOOST_FOREACH(PhaseProfile& profile, _phaseProfiles) {
+    profile.series->insert(Point(time, profile.seconds));
+    profile.steps++;
+    profile.totalSeconds += profile.seconds;
+    if (profile.recent.size() < _profileWindow) {
+      profile.recent.push_back(profile.seconds);
+    }
+    else {
+      profile.recent[profile.next] = profile.seconds;
+    }
+    profile.next = (profile.next + 1) % _profileWindow;
+    profile.seconds = 0;
+  }
+}
+
+Model::phase_t Model::boundaryPhase(BoundaryCondition::kind_t kind) {
+  switch (kind) {
+    case BoundaryCondition::junctionDemand:
+      return junctionBoundaryPhase;
+    case BoundaryCondition::reservoirHead:
+      return reservoirBoundaryPhase;
+    case BoundaryCondition::tankLevel:
+      return tankBoundaryPhase;
+    default:
+      return linkBoundaryPhase;
+  }
+}
+
+void Model::saveCheckpoint(time_t time) {
+  vector<char> state;
+  if (!saveEngineState(state)) {
+    return;
+  }
+  _checkpoints[time].swap(state);
+  while (_checkpoints.size() > _checkpointLimit) {
+    _checkpoints.erase(_checkpoints.begin());
+  }
+}
+
+void Model::flushStorage() {
+  // the results may still be on their way to the db
+  DbPointRecord::sharedPointer dbRecord = boost::dynamic_pointer_cast<DbPointRecord>(_record);
+  if (dbRecord) {
+    dbRecord->flush();
+  }
+}
 
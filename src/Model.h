@@ -11,9 +11,14 @@
 
 #include <string.h>
 #include <map>
+#include <set>
+#include <queue>
+#include <deque>
+#include <functional>
 #include <tr1/unordered_map>
 #include <time.h>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include "rtxExceptions.h"
 #include "Element.h"
 #include "Node.h"
@@ -23,9 +28,13 @@
 #include "Pipe.h"
 #include "Pump.h"
 #include "Valve.h"
+#include "IngestQueue.h"
 #include "Zone.h"
+#include "Topology.h"
+#include "Metrics.h"
 #include "PointRecord.h"
 #include "Units.h"
+#include "RuntimeContext.h"
 #include "rtxMacros.h"
 
 
@@ -37,9 +46,77 @@ namespace RTX {
    
    Provides methods for simulation and storing/retrieving states and parameters, and accessing infrastructure elements
    
+   As a simulation passes each time on the master (hydraulic time step) clock, the state it carries into that
+   period -- tank levels, link statuses and settings, and the last solution -- is kept as a checkpoint, if the
+   engine can provide it. runSinglePeriod picks up from the latest checkpoint at or before the time asked for, so it
+   only simulates what lies between. Checkpoints are kept in memory, up to a limit, after which the oldest are dropped.
+   
+   A boundary condition drawn from a series on a regular clock is only written into the engine when that series has
+   a new sample, and holds its value in between; the engine keeps it meanwhile. Tank levels are written when their
+   reset clocks fire. Anything else -- a series with an irregular clock, or demands allocated by zones -- is written
+   at every step. The schedule is set up anew at the start of each run. A due value that hasn't changed (or hasn't
+   moved past its deadband) since it was last written is left alone, except for tank resets.
+   
+   With water quality on, the engine's quality is carried along between hydraulic steps at the quality time step,
+   using each step's hydraulic solution. Node qualities are read for the whole network at once, every few quality
+   steps (see setQualityDecimation), and each junction's go into its quality series a hydraulic step at a time. Quality
+   carries on across consecutive runs; a run that starts anywhere else (or a runSinglePeriod that went back to a
+   checkpoint) starts it over from the network's initial qualities.
+   
+   A long historical replay spends most of its time waiting on the database for boundary data. With a prefetch window
+   set, a run is cut into windows of that length, and the boundary data of the next windows (up to the prefetch
+   depth) is fetched on a thread of its own -- one batched query per database record, the records' all in flight
+   at once, and then the derived series computed from it -- while the current window is simulated. Results written to a database record go through its
+   write-behind queue meanwhile, so the last window's are still being written as the current one is solved.
+   
+   A real-time loop that stalls has a backlog to clear once it's back, and stepping through it period by period, as
+   live, costs a query and a flush a period. Run with runLivePeriod and a catch-up lag, a backlog longer than the lag
+   is simulated straight through from the last live period instead: its boundary data prefetched in one window, its
+   results written behind the simulation and flushed once at the end. Live stepping resumes with the next period.
+   
+   Every state of every element is stored at every step, unless the model is told otherwise. On a large network most
+   of them are never looked at, so the states stored can be narrowed, by kind (setStoresState) and by element
+   (setStoredElements). The others aren't even read from the engine. Should one be wanted later, storeAllStates
+   simulates its period again from the nearest checkpoint, and stores everything for that period.
+   
+   A fork is a what-if against a running model: a copy that starts out where the model is now -- its current
+   simulation time and hydraulic state, taken as a checkpoint is -- and then runs on by itself, with whatever
+   overrides it's given, storing its results apart (in a scratch record, or its own series). It takes the same
+   boundary series as the model, caches and all, so nothing is fetched again; only its engine and elements are its
+   own. Loading those from the model file is the slow part, so a model with a fork reserve keeps that many copies
+   loaded ahead of time -- at background priority, on its runtime's scheduler -- and a fork takes one of them, which
+   only costs the checkpoint and binding the boundary series. Without one, a fork loads its own first.
+   
+   With step profiling on, each simulated period's wall time is split into phases: fetching and applying boundary
+   conditions (by element type, and zone allocation apart), the solution (and the part of it the engine spends in
+   its linear solver, where it says), reading out and storing results, stepping the engine on, and water quality.
+   Each phase's time goes into a series of its own at the period's time, and its median and 99th percentile over
+   the last thousand or so periods are kept up to date -- so a real-time loop that misses its deadline can tell which
+   phase blew the budget.
+   
+   Each step of a run (and each runSinglePeriod's period) holds the step mutex throughout. Something changing the
+   elements' boundary series from another thread -- a configuration reload -- holds it too, and so lands between
+   steps; it then calls boundaryConditionsChanged, so that the schedule is set up again at the next step.
+   The conversions from the boundary series' units are worked out with the schedule, so changing their units needs
+   the same call.
+   
    \sa Element, Junction, Pipe
    
    */
+
+  /*!
+   \fn void Model::runSinglePeriod(time_t time)
+   \brief Simulate the network at one time, and store its states.
+   
+   The simulation starts from the latest checkpoint at or before the time, or else backs up to the most recent
+   boundary-reset time; whichever is nearer. It then runs through to the requested time, which needn't be on the
+   master clock.
+   */
+  
+  /*!
+   \fn void Model::clearCheckpoints()
+   \brief Forget the checkpoints, e.g. after changing boundary conditions they were simulated with.
+   */
   
   class Model {
   public:
@@ -50,11 +127,173 @@ namespace RTX {
     virtual void overrideControls() throw(RtxException);
     void runSinglePeriod(time_t time);
     void runExtendedPeriod(time_t start, time_t end);
+    void setCheckpointLimit(size_t count); //! how many checkpoints to keep -- 0 keeps none
+    size_t checkpointLimit();
+    void clearCheckpoints();
+    // a boundary value within its deadband of the last one written to the engine isn't written again. in the model's
+    // units; 0, the default, writes any change. statuses are written whenever they change.
+    void setDemandDeadband(double flow);
+    double demandDeadband();
+    void setHeadDeadband(double head);
+    double headDeadband();
+    void setSettingDeadband(double setting);
+    double settingDeadband();
+    // water quality -- off by default, in which case junction quality series get zeros. a junction's quality is stored
+    // every qualityDecimation quality steps (1, the default, stores every one), in the engine's units.
+    void setShouldRunWaterQuality(bool run);
+    bool shouldRunWaterQuality();
+    void setQualityDecimation(int steps);
+    int qualityDecimation();
     void setStorage(PointRecord::sharedPointer record);
     void setParameterSource(PointRecord::sharedPointer record);
     
+    // copies, for running variations of one network side by side.
+    // a clone loads the same model file, and its elements take their boundary conditions from the very same series as
+    // this model's (so their caches are shared, not refilled), but it has its own engine and its own results.
+    Model::sharedPointer clone();
+    // what-ifs: a copy in the state this one is in now (see above), results stored in the scratch record if there is one
+    Model::sharedPointer fork(PointRecord::sharedPointer scratch = PointRecord::sharedPointer()) throw(RtxException);
+    void setForkReserve(size_t count); //! copies kept loaded for forks. 0, the default, keeps none
+    size_t forkReserve();
+    // prefix the names of the series that results are stored under (see setStorage), so several models can share a record
+    void tagStates(const std::string& tag);
+    
     // demand zones -- identified by boundary link sets (doesHaveFlowMeasure)
     void initDemandZones();
+    void clearZones(); //! e.g. to init them again once the flow measures change
+    
+    // changing boundary series between steps (see above)
+    boost::recursive_mutex& stepMutex();
+    void boundaryConditionsChanged();
+    
+    // threads to convert and insert each step's states with, on a large network -- 0 means one per hardware core, and
+    // the default is 1. the engine itself is only called from the thread running the simulation.
+    void setStateThreads(size_t threadCount);
+    size_t stateThreads();
+    // what that work runs on (see RuntimeContext -- the default context, unless one's set), and at what priority.
+    // runLivePeriod's steps are always real-time; the rest run at the run priority -- normal by default.
+    void setRuntime(RuntimeContext::sharedPointer runtime);
+    RuntimeContext::sharedPointer runtime();
+    void setRunPriority(Scheduler::priority_t priority);
+    Scheduler::priority_t runPriority();
+    // network-wide energy data, from the engine as it's loaded (see EnergyAccounting, and Pump for each pump's own)
+    class EnergyOptions {
+    public:
+      EnergyOptions() : specificGravity(1), demandCharge(0), patternStep(3600), patternStart(0) {};
+      // simple tuple class, so no getters/setters
+      double specificGravity;
+      double demandCharge;              // per maximum kw
+      time_t patternStep, patternStart; // of the pumps' price patterns
+    };
+    EnergyOptions energyOptions();
+    void setEnergyOptions(const EnergyOptions& options);
+    // result subscriptions (see above): the states that are stored, by kind and by element. a state that isn't
+    // stored isn't read from the engine at all. both are everything by default; an empty element list stores every
+    // element's. storeAllStates stores everything for one period, simulated again from the nearest checkpoint.
+    typedef enum {
+      junctionHeadState,
+      junctionQualityState,
+      junctionDemandState,
+      reservoirHeadState,
+      tankHeadState,
+      pipeFlowState,
+      valveFlowState,
+      pumpFlowState,
+      pumpEnergyState
+    } stateKind_t;
+    void setStoresState(stateKind_t state, bool stores);
+    bool storesState(stateKind_t state);
+    void setStoredElements(const std::vector<Element::sharedPointer>& elements);
+    std::vector<Element::sharedPointer> storedElements();
+    void storeAllStates(time_t time);
+    // change-only storage for every series of one kind of state, in the series' units (see TimeSeries::setWriteDeadband)
+    void setStateDeadband(stateKind_t state, double absolute, double relative = 0., time_t heartbeat = 0);
+    
+    // replay pipelining (see above): boundary data is fetched up to depth windows of this many seconds ahead of the
+    // simulation. 0, the default, fetches each step's data when it's due.
+    void setPrefetchWindow(time_t seconds, size_t depth = 1);
+    time_t prefetchWindow();
+    size_t prefetchDepth();
+    
+    // live operation: runLivePeriod runs each live time as runSinglePeriod does, carrying on from the last one. once
+    // the last one is further behind the wall clock than the catch-up lag -- after a historian outage, say -- the whole
+    // backlog up to the new time is run in one go instead (see above). 0, the default, never catches up.
+    void runLivePeriod(time_t time);
+    void setCatchUpLag(time_t seconds);
+    time_t catchUpLag();
+    time_t liveTime(); //! the last live period run, or 0 if there hasn't been one
+    // feeds' queues (see IngestQueue), drained at the start of every live period -- so that what has come in by then
+    // is in the boundary series, and the pollers don't contend with the period for their locks
+    void addIngestQueue(IngestQueue::sharedPointer queue);
+    std::vector<IngestQueue::sharedPointer> ingestQueues();
+    
+    // step profiling (see above) -- off by default. the phase series hold seconds, in their own buffers (setStorage
+    // leaves them be -- give one a record to keep it all). the summaries' percentiles cover the last profileWindow
+    // periods (1000 by default), their steps and totals everything since resetProfile.
+    typedef enum {
+      ingestPhase,            // the ingest queues drained, at the start of a live period
+      boundaryFetchPhase,     // batched database fetches for the due boundary series
+      zoneAllocationPhase,    // zone demands shared out to their junctions
+      junctionBoundaryPhase,  // junction demands read and written to the engine
+      reservoirBoundaryPhase,
+      tankBoundaryPhase,
+      linkBoundaryPhase,      // pipe, pump and valve statuses and settings
+      solvePhase,             // the hydraulic solution,
+      linearSolvePhase,       // the linear solves within it
+      savePhase,              // results read out and stored
+      stepPhase,              // the engine stepped on to the next time
+      qualityPhase            // water quality across the step
+    } phase_t;
+    class phaseSummary_t {
+    public:
+      phaseSummary_t() : steps(0), totalSeconds(0), median(0), percentile99(0), maximum(0) {};
+      // simple tuple class, so no getters/setters
+      unsigned long steps;   // periods profiled since the last reset
+      double totalSeconds;   // and their time in this phase
+      double median, percentile99, maximum; // seconds a period, over the window
+    };
+    void setProfilesSteps(bool profile);
+    bool profilesSteps();
+    void setProfileWindow(size_t periods);
+    size_t profileWindow();
+    TimeSeries::sharedPointer phaseTime(phase_t phase);
+    phaseSummary_t phaseSummary(phase_t phase);
+    void resetProfile(); //! forgets the summaries -- not what's in the series
+    std::ostream& profileToStream(std::ostream& stream); //! a line per phase
+    
+    // memory, in bytes: the elements and their lookups (estimated from their sizes), the points held by the records
+    // behind the element states and boundary series (and everything upstream of them), the checkpoints, and the
+    // engine's own allocations. the peaks are since each record, or the engine's run, began.
+    class memoryFootprint_t {
+    public:
+      memoryFootprint_t() : elements(0), records(0), checkpoints(0), engine(0), peakRecords(0), peakEngine(0) {};
+      // simple tuple class, so no getters/setters
+      size_t elements, records, checkpoints, engine;
+      size_t peakRecords, peakEngine;
+      size_t total() { return elements + records + checkpoints + engine; };
+    };
+    memoryFootprint_t memoryFootprint();
+    std::ostream& memoryToStream(std::ostream& stream); //! the footprint, and the series holding the most
+    
+    // metrics (see Metrics): every period's latency, solver iterations and count go to the registry as they're run,
+    // labelled model=name. none by default.
+    void setMetrics(Metrics::sharedPointer metrics, const std::string& name = "model");
+    Metrics::sharedPointer metrics();
+    
+    // demand changes against the hydraulic solution at the current simulation time (where runSinglePeriod or
+    // runExtendedPeriod left it), for calibration and sensitivity studies. the solution, and what's simulated after it,
+    // are left as they were. heads and flows are in the model's units, indexed by element index() - 1, a whole network's
+    // worth for each junction (or set of changes) in turn.
+    // demandSensitivities gives each junction's first-order head and flow response to a unit increase in its demand,
+    // all from one factorization of the solution's equations. solveDemandChanges re-solves the period with each set of
+    // changes -- changes holds junctions.size() a set, one set after another -- starting each from its first-order
+    // response, and gives the iterations each took. both return false if the engine can't.
+    bool demandSensitivities(const std::vector<Junction::sharedPointer>& junctions, std::vector<double>& head, std::vector<double>& flow);
+    bool solveDemandChanges(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, std::vector<double>& head, std::vector<double>& flow, std::vector<int>& iterations);
+    
+    // the network's connectivity, with nodes numbered junctions, tanks, then reservoirs, and links pipes, pumps, then
+    // valves -- each in the order they were added. built on first use.
+    Topology::sharedPointer topology();
     
     // element accessors
     void addJunction(Junction::sharedPointer newJunction);
@@ -66,14 +305,14 @@ namespace RTX {
     void addZone(Zone::sharedPointer zone);
     Link::sharedPointer linkWithName(const std::string& name);
     Node::sharedPointer nodeWithName(const std::string& name);
-    std::vector<Element::sharedPointer> elements();
-    std::vector<Zone::sharedPointer> zones();
-    std::vector<Junction::sharedPointer> junctions();
-    std::vector<Tank::sharedPointer> tanks();
-    std::vector<Reservoir::sharedPointer> reservoirs();
-    std::vector<Pipe::sharedPointer> pipes();
-    std::vector<Pump::sharedPointer> pumps();
-    std::vector<Valve::sharedPointer> valves();
+    const std::vector<Element::sharedPointer>& elements();
+    const std::vector<Zone::sharedPointer>& zones();
+    const std::vector<Junction::sharedPointer>& junctions();
+    const std::vector<Tank::sharedPointer>& tanks();
+    const std::vector<Reservoir::sharedPointer>& reservoirs();
+    const std::vector<Pipe::sharedPointer>& pipes();
+    const std::vector<Pump::sharedPointer>& pumps();
+    const std::vector<Valve::sharedPointer>& valves();
     
     // simulation properties
     virtual void setHydraulicTimeStep(int seconds);
@@ -90,8 +329,40 @@ namespace RTX {
     Model();
     virtual ~Model();
     
-    void setSimulationParameters(time_t time);
-    void saveHydraulicStates(time_t time);
+    virtual Model::sharedPointer newInstance(); //! an empty model of the same kind, for clone -- none by default
+    
+    virtual void prepareSimulation(time_t start, time_t end); //! at the start of each run, with the span it's to cover
+    virtual void setSimulationParameters(time_t time);
+    virtual void saveHydraulicStates(time_t time);
+    
+    //! whole-network results for saveHydraulicStates to gather from, in the model's units, indexed by element index() - 1
+    class NetworkStates {
+    public:
+      NetworkStates() : head(NULL), demand(NULL), flow(NULL), nodeCount(0), linkCount(0) {};
+      const double *head, *demand, *flow;
+      int nodeCount, linkCount;
+    };
+    // an engine that has this step's results in arrays hands them out here; the default has none, and saveHydraulicStates
+    // then asks for each element's state one at a time.
+    virtual bool networkStates(NetworkStates& states);
+    
+    // water quality, for an engine that simulates it. startQuality sets out from the initial qualities at a time --
+    // before that time's hydraulics are solved -- and returns false if the engine can't (the default). stepQuality
+    // then carries it on by one quality step at most, within the hydraulic step just taken (which ends at until, and is
+    // stepped through at least once even if it has no length), and returns the time it got to. nodeQualities fills in
+    // every node's quality there, indexed by element index() - 1.
+    // stopQuality is for when water quality is turned off again.
+    virtual bool startQuality(time_t time);
+    virtual time_t stepQuality(time_t time, time_t until);
+    virtual void nodeQualities(std::vector<double>& qualities);
+    virtual void stopQuality();
+    
+    // demand changes, for demandSensitivities and solveDemandChanges. demandResponse finds the current solution's
+    // first-order response to setCount sets of changes, where set s is entries s*k up to (s+1)*k of both junctions and
+    // changes, for k a set. solveDemandChange re-solves with one set, from the current flows moved by startFlowChange
+    // (if not NULL), and leaves the engine's solution as it was. an engine that can't do these returns false (the default).
+    virtual bool demandResponse(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, int setCount, std::vector<double>& head, std::vector<double>& flow);
+    virtual bool solveDemandChange(const std::vector<Junction::sharedPointer>& junctions, const std::vector<double>& changes, const double* startFlowChange, std::vector<double>& head, std::vector<double>& flow, int& iterations);
     
     // units
     Units flowUnits();
@@ -102,35 +373,165 @@ namespace RTX {
     
     // model parameter setting
     // recreating or wrapping basic api functionality here.
-    virtual double reservoirLevel(const std::string& reservoirName) = 0;
-    virtual double tankLevel(const std::string& tankName) = 0;
-    virtual double junctionHead(const std::string& junction) = 0;
-    virtual double junctionDemand(const std::string& junctionName) = 0;
-    virtual double junctionQuality(const std::string& junctionName) = 0;
+    // these run for every element at every step, so they take the element itself (and its bound index) rather than a name to look up.
+    virtual double reservoirLevel(const Reservoir::sharedPointer& reservoir) = 0;
+    virtual double tankLevel(const Tank::sharedPointer& tank) = 0;
+    virtual double junctionHead(const Junction::sharedPointer& junction) = 0;
+    virtual double junctionDemand(const Junction::sharedPointer& junction) = 0;
+    virtual double junctionQuality(const Junction::sharedPointer& junction) = 0;
     // link elements
-    virtual double pipeFlow(const std::string& pipe) = 0;
-    virtual double pumpEnergy(const std::string& pump) = 0;
+    virtual double pipeFlow(const Pipe::sharedPointer& pipe) = 0;
+    virtual double pumpEnergy(const Pump::sharedPointer& pump) = 0;
     
-    virtual void setReservoirHead(const std::string& reservoir, double level) = 0;
-    virtual void setTankLevel(const std::string& tank, double level) = 0;
-    virtual void setJunctionDemand(const std::string& junction, double demand) = 0;
+    virtual void setReservoirHead(const Reservoir::sharedPointer& reservoir, double level) = 0;
+    virtual void setTankLevel(const Tank::sharedPointer& tank, double level) = 0;
+    virtual void setJunctionDemand(const Junction::sharedPointer& junction, double demand) = 0;
     
-    virtual void setPipeStatus(const std::string& pipe, Pipe::status_t status) = 0;
-    virtual void setPumpStatus(const std::string& pump, Pipe::status_t status) = 0;
-    virtual void setValveSetting(const std::string& valve, double setting) = 0;
+    virtual void setPipeStatus(const Pipe::sharedPointer& pipe, Pipe::status_t status) = 0;
+    virtual void setPumpStatus(const Pump::sharedPointer& pump, Pipe::status_t status) = 0;
+    virtual void setValveSetting(const Valve::sharedPointer& valve, double setting) = 0;
     
     virtual void solveSimulation(time_t time) = 0;
     virtual time_t nextHydraulicStep(time_t time) = 0;
     virtual void stepSimulation(time_t time) = 0;
     virtual int iterations(time_t time) = 0;
     virtual int relativeError(time_t time) = 0;
+    virtual double linearSolveTime(time_t time); //! seconds in the linear solver, for the last solution. 0 by default
+    virtual size_t engineMemory();      //! bytes the engine has allocated for its solution. 0 by default
+    virtual size_t peakEngineMemory();  //! and the most it has had at once
     
     virtual void setCurrentSimulationTime(time_t time);
     
-    
+    // the engine's state at the current simulation time, as an opaque buffer for a checkpoint. an engine that doesn't
+    // provide one returns false, and its model keeps no checkpoints.
+    virtual bool saveEngineState(std::vector<char>& state);
+    virtual void restoreEngineState(const std::vector<char>& state);
     
   private:
     std::string _modelFile;
+    void prefetchBoundaryData(const std::vector<TimeSeries::sharedPointer>& series, time_t time);
+    // the replay pipeline's prefetch thread, which keeps within _prefetchDepth windows of _replayTime
+    void startPrefetching(time_t start, time_t end);
+    void stopPrefetching();
+    void awaitPrefetch(time_t time);
+    void prefetchWindows(const std::vector<TimeSeries::sharedPointer>& series, time_t start, time_t end);
+    time_t _prefetchWindow;
+    size_t _prefetchDepth;
+    time_t _replayTime, _prefetchedTime;  // where the simulation, and the prefetching, have got to
+    time_t _prefetchWakeTime;             // and where the simulation has to get to for the next window's fetch
+    bool _isPrefetching, _isPrefetchStopping, _didEnableWriteBehind;
+    boost::mutex _prefetchMutex;
+    boost::recursive_mutex _stepMutex;
+    boost::condition_variable _prefetchChanged;
+    boost::shared_ptr<boost::thread> _prefetchThread;
+    time_t _catchUpLag, _liveTime;
+    bool _isRunningLive;
+    std::vector<IngestQueue::sharedPointer> _ingestQueues;
+    void drainIngestQueues();
+    void catchUp(time_t time);
+    void solvePeriod(time_t time);
+    time_t resumeBefore(time_t time);
+    void saveCheckpoint(time_t time);
+    void flushStorage();
+    
+    // copies: loaded from the model file with this one's settings (which can happen anywhere), and then bound to its
+    // boundary series (which can't be while it steps)
+    class copySettings_t {
+    public:
+      // simple tuple class, so no getters/setters
+      std::string modelFile;
+      bool overridesControls, runsWaterQuality;
+      int hydraulicStep, qualityStep, qualityDecimation;
+      RuntimeContext::sharedPointer runtime;
+      Scheduler::priority_t runPriority;
+    };
+    copySettings_t copySettings();
+    static void loadCopy(Model::sharedPointer copy, const copySettings_t& settings);
+    void shareBoundaries(Model::sharedPointer copy);
+    // loaded copies waiting for forks, filled up in the background. it outlives the model if it has to.
+    class ForkReserve {
+    public:
+      ForkReserve() : target(0), isFilling(false), isClosed(false) {};
+      std::deque<Model::sharedPointer> spares;
+      size_t target;
+      bool isFilling, isClosed; // a fill is scheduled or running; the model's gone
+      boost::mutex mutex;
+    };
+    typedef boost::shared_ptr<ForkReserve> forkReservePointer_t;
+    void fillForkReserve();
+    static void loadSpares(forkReservePointer_t reserve, std::vector<Model::sharedPointer> blanks, copySettings_t settings);
+    forkReservePointer_t _forkReserve;
+    
+    // one boundary condition that setSimulationParameters writes into the engine
+    class BoundaryCondition {
+    public:
+      typedef enum {
+        junctionDemand,
+        reservoirHead,
+        tankLevel,
+        pipeStatus,
+        valveStatus,
+        valveSetting,
+        pumpStatus
+      } kind_t;
+      kind_t kind;
+      Element::sharedPointer element;
+      TimeSeries::sharedPointer series;
+      Clock::sharedPointer clock; // when it's next due -- its series' samples, or a tank's resets. NULL for every step.
+      UnitConverter converter;  // the series' units to the model's, worked out when scheduled
+      bool isApplied;
+      double appliedValue; // the last value written, in model units
+    };
+    typedef std::pair<time_t, size_t> boundaryEvent_t; // due time, and index into _boundaryConditions
+    void scheduleBoundaryConditions();
+    std::vector<size_t> dueBoundaryConditions(time_t time);
+    void applyBoundaryCondition(BoundaryCondition& condition, time_t time);
+    
+    // one phase's share of each profiled period
+    class PhaseProfile {
+    public:
+      PhaseProfile() : seconds(0), steps(0), totalSeconds(0), next(0) {};
+      TimeSeries::sharedPointer series;
+      double seconds;               // this period's, so far
+      unsigned long steps;
+      double totalSeconds;
+      std::vector<double> recent;   // the last periods', round and round from next
+      size_t next;
+    };
+    std::vector<PhaseProfile> _phaseProfiles; // by phase_t
+    bool _isProfilingSteps;
+    size_t _profileWindow;
+    double profileTime();                               //! now, if profiling -- otherwise 0
+    double profilePhase(phase_t phase, double since);   //! adds the time since to the phase, and returns now
+    void profilePeriod(time_t time);                    //! this period's phases, into their series and summaries
+    static phase_t boundaryPhase(BoundaryCondition::kind_t kind);
+    
+    // saveHydraulicStates' per-step fields, side by side: one column per state and element type, in the order of that
+    // type's element list (just the stored ones, if they're chosen). built on first use, like the topology.
+    class StateColumn {
+    public:
+      StateColumn() : units(1), isConverted(true) {};
+      void add(size_t position, int index, TimeSeries* state) {
+        positions.push_back(position);
+        indexes.push_back(index);
+        series.push_back(state);
+      };
+      std::vector<size_t> positions;    // each element's place in its type's list,
+      std::vector<int> indexes;         // its index()
+      std::vector<TimeSeries*> series;  // and the series its state goes in
+      std::vector<double> values;       // this step's states,
+      Units units;                      // in these units
+      std::vector<UnitConverter> converters; // to each series' units, worked out when built
+      bool isConverted;                 // false to insert the values as they are
+    };
+    void buildStateColumns();
+    void insertStates(const std::vector<StateColumn*>& columns, size_t begin, size_t end, time_t time);
+    // water quality across one hydraulic step, with the junction qualities it's to store batched up until its end
+    void simulateQuality(time_t time, time_t until);
+    void gatherQualityStates(time_t time);
+    void insertQualityStates();
+    std::vector<TimeSeries::sharedPointer> memorySeries(); //! states, boundaries and all they draw on
+    void observePeriod(time_t time, double started); //! into the metrics, if there are any
     // master list access
     void add(Junction::sharedPointer newJunction);
     void add(Pipe::sharedPointer newPipe);
@@ -141,6 +542,9 @@ namespace RTX {
     std::tr1::unordered_map<std::string, Link::sharedPointer> _links;
     // convenience lists for iterations
     std::vector<Element::sharedPointer> _elements;
+    std::vector<Element::sharedPointer> _storedElements;
+    std::set<stateKind_t> _unstoredStates;
+    bool _isStoringAllStates;
     std::vector<Junction::sharedPointer> _junctions;
     std::vector<Tank::sharedPointer> _tanks;
     std::vector<Reservoir::sharedPointer> _reservoirs;
@@ -148,6 +552,19 @@ namespace RTX {
     std::vector<Pump::sharedPointer> _pumps;
     std::vector<Valve::sharedPointer> _valves;
     std::vector<Zone::sharedPointer> _zones;
+    Topology::sharedPointer _topology;
+    bool _hasStateColumns;
+    StateColumn _junctionHeads, _junctionQualities, _junctionDemands, _reservoirHeads, _tankHeads;
+    StateColumn _pipeFlows, _valveFlows, _pumpFlows, _pumpEnergies;
+    size_t _stateThreads;
+    RuntimeContext::sharedPointer _runtime;
+    Scheduler::priority_t _runPriority;
+    EnergyOptions _energyOptions;
+    bool _shouldRunWaterQuality, _isQualityStarted;
+    int _qualityDecimation, _qualityStepCount;
+    time_t _qualityTime;  // where the quality simulation has got to
+    std::vector<double> _nodeQualities;
+    std::vector<std::vector<Point> > _qualityBatch;  // by junction, as for _junctionQualities
     
     PointRecord::sharedPointer _record;         // default record for results
     Clock::sharedPointer _regularMasterClock;   // normal hydraulic timestep
@@ -159,8 +576,20 @@ namespace RTX {
     
     time_t _currentSimulationTime;
     
+    typedef std::map<time_t, std::vector<char> > checkpointMap_t;
+    checkpointMap_t _checkpoints;
+    size_t _checkpointLimit;
+    
+    std::vector<BoundaryCondition> _boundaryConditions;
+    std::priority_queue<boundaryEvent_t, std::vector<boundaryEvent_t>, std::greater<boundaryEvent_t> > _boundaryEvents;
+    bool _isBoundaryScheduled;
+    double _demandDeadband, _headDeadband, _settingDeadband;
+    
     Units _flowUnits, _headUnits;
 
+    Metrics::sharedPointer _metrics;
+    std::string _metricsName;
+
     
   };
   
@@ -7,30 +7,55 @@
 //  
 
 #include <iostream>
+#include <cmath>
+
+#include <boost/foreach.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
 
 #include "ModularTimeSeries.h"
+#include "Log.h"
+#include "Tracer.h"
+#include "RuntimeContext.h"
 
 using namespace RTX;
 using namespace std;
+using namespace boost::placeholders;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
 
-ModularTimeSeries::ModularTimeSeries() : TimeSeries::TimeSeries() {
+// below this many points a chunk, starting a thread costs more than it saves
+static const size_t minimumChunkPoints = 10000;
+
+ModularTimeSeries::ModularTimeSeries() : TimeSeries::TimeSeries(), _evaluationThreads(1) {
   _doesHaveSource = false;
 }
 
 ModularTimeSeries::~ModularTimeSeries() {
-  
+  if (_source) {
+    _source->removeDependent(this);
+  }
 }
 
 ostream& ModularTimeSeries::toStream(ostream &stream) {
   TimeSeries::toStream(stream);
-  stream << "Connected to: " << *_source << "\n";
+  stream << "Connected to: " << *source() << "\n";
   return stream;
 }
 
 void ModularTimeSeries::setSource(TimeSeries::sharedPointer sourceTimeSeries) {
   if( isCompatibleWith(sourceTimeSeries) ) {
+    TimeSeries::sharedPointer previous = source();
+    if (previous) {
+      previous->removeDependent(this);
+    }
+    {
+      scopedLock_t lock(_sourceMutex);
     _source = sourceTimeSeries;
     _doesHaveSource = true;
+    }
+    sourceTimeSeries->addDependent(this);
     //resetCache();
     // if this is an irregular time series, then set this clock to the same as that guy's clock.
     if (!clock()->isRegular()) {
@@ -38,30 +63,59 @@ void ModularTimeSeries::setSource(TimeSeries::sharedPointer sourceTimeSeries) {
     }
     // and if i don't have units, just borrow from the source.
     if (units().isDimensionless()) {
-      setUnits(_source->units()); // as a copy, in case it changes.
+      setUnits(sourceTimeSeries->units()); // as a copy, in case it changes.
     }
+    updateSourceConverter();
   }
   else {
-    cerr << "Incompatible. Could not set source for:\n";
-    cerr << *this;
+    RTX_LOG(warning, "ModularTimeSeries", "Incompatible. Could not set source for:\n" << *this);
     // TODO -- throw something?
   }
 }
 
 TimeSeries::sharedPointer ModularTimeSeries::source() {
+  scopedLock_t lock(_sourceMutex);
   return _source;
 }
 
 bool ModularTimeSeries::doesHaveSource() {
+  scopedLock_t lock(_sourceMutex);
   return _doesHaveSource;
 }
 
+vector<TimeSeries::sharedPointer> ModularTimeSeries::upstreamSeries() {
+  vector<TimeSeries::sharedPointer> upstream;
+  TimeSeries::sharedPointer mySource = source();
+  if (mySource) {
+    upstream.push_back(mySource);
+  }
+  return upstream;
+}
+
+void ModularTimeSeries::setEvaluationThreads(size_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = boost::thread::hardware_concurrency();
+  }
+  _evaluationThreads = RTX_MAX(threadCount, (size_t)1);
+}
+
+size_t ModularTimeSeries::evaluationThreads() {
+  return _evaluationThreads;
+}
+
 void ModularTimeSeries::setUnits(Units newUnits) {
   if (!doesHaveSource() || (doesHaveSource() && newUnits.isSameDimensionAs(source()->units()))) {
     TimeSeries::setUnits(newUnits);
+    updateSourceConverter();
   }
   else {
-    cerr << "could not set units for time series " << name() << endl;
+    RTX_LOG(warning, "ModularTimeSeries", "could not set units for time series " << name());
+  }
+}
+
+void ModularTimeSeries::sourceUnitsDidChange(TimeSeries* source) {
+  if (source == this->source().get()) {
+    updateSourceConverter();
   }
 }
 /*
@@ -89,7 +143,7 @@ Point ModularTimeSeries::point(time_t time) {
   // check the requested time for validity
   // if the time is not valid, rewind until a valid time is reached.
   time_t newTime = clock()->validTime(time);
-
+  
   // if my clock can't find it, maybe my source's clock can?
   if (newTime == 0) {
     time = source()->clock()->validTime(time);
@@ -97,26 +151,24 @@ Point ModularTimeSeries::point(time_t time) {
     time = newTime;
   }
   
-  Point p = TimeSeries::point(time);
-  if (p.isValid) {
-    return p;
+  return pointComputedOnce(time, boost::bind(&ModularTimeSeries::computePoint, this, _1));
+}
+
+Point ModularTimeSeries::computePoint(time_t time) {
+  countUpstreamCalls();
+  Point sourcePoint = source()->point(time);
+  
+  if (sourcePoint.isValid) {
+    // create a new point object and convert from source units
+    Point aPoint = Point::convertPoint(sourcePoint, sourceConverter());
+    cachePoint(aPoint);
+    return aPoint;
   }
   else {
-    
-    Point sourcePoint = source()->point(time);
-
-    if (sourcePoint.isValid) {
-      // create a new point object and convert from source units
-      Point aPoint = Point::convertPoint(sourcePoint, source()->units(), units());
-      insert(aPoint);
-      return aPoint;
-    }
-    else {
-      cerr << "ModularTimeSeries: check point availability first\n";
-      // TODO -- throw something? reminder to check point availability first...
-      Point point;
-      return point;
-    }
+    RTX_LOG(debug, "ModularTimeSeries", "check point availability first");
+    // TODO -- throw something? reminder to check point availability first...
+    Point point;
+    return point;
   }
 }
 
@@ -137,11 +189,261 @@ Point ModularTimeSeries::pointAfter(time_t time) {
 }
 
 vector< Point > ModularTimeSeries::points(time_t start, time_t end) {
-  // call the source points method to get it to cache points...
-  cout << "calling source cache (" << source()->name() << ")" << endl;
-  time_t margin = 60*60;
-  _source->points(start - margin, end + margin);
+  if (!doesHaveSource()) {
+    return TimeSeries::points(start, end);
+  }
+  RTX_TRACE_SPAN(span, ("points", "series", name(), start, end));
+  
+  vector<Point> thePoints;
+  
+  // an irregular clock is the source's, so there's no way to know what's missing without asking the source anyway.
+  Clock::sharedPointer clock = this->clock();
+  if (!clock->isRegular()) {
+    ComputeLock computing(*this, start, end); // not skipped, but not overlapping another thread's write either
+    evaluateRange(start, end, thePoints);
+    this->cachePoints(thePoints);
+    return thePoints;
+  }
   
-  // then call the base class method.
-  return TimeSeries::points(start, end);
+  // make sure the times are aligned with the clock.
+  time_t newStart = (clock->isValid(start)) ? start : clock->timeAfter(start);
+  time_t newEnd = (clock->isValid(end)) ? end : clock->timeBefore(end);
+  if (newStart == 0 || newEnd < newStart) {
+    return thePoints;
+  }
+  
+  // fill what the record can't answer for in one pass, with one write. claim it, then look again: another
+  // thread may have filled (or still be filling) some of it.
+  vector<Point> cached, fresh;
+  time_t firstMissing, lastMissing;
+  while (missingSpan(clock, newStart, newEnd, cached, firstMissing, lastMissing)) {
+    time_t claimedFirst = firstMissing, claimedLast = lastMissing;
+    ComputeLock computing(*this, claimedFirst, claimedLast);
+    if (!missingSpan(clock, newStart, newEnd, cached, firstMissing, lastMissing)) {
+      break;
+    }
+    if (firstMissing < claimedFirst || claimedLast < lastMissing) {
+      continue; // more went stale in the meantime
+    }
+    evaluateInChunks(firstMissing, lastMissing, fresh);
+    this->cachePoints(fresh);
+    break;
+  }
+  
+  // stitch the new points in with the cached ones, on the clock.
+  thePoints.reserve((newEnd - newStart) / period() + 1);
+  size_t hits = 0;
+  vector<Point>::const_iterator cacheIt = cached.begin();
+  vector<Point>::const_iterator freshIt = fresh.begin();
+  for (time_t now = newStart; now != 0 && now <= newEnd; now = clock->timeAfter(now)) {
+    while (freshIt != fresh.end() && freshIt->time < now) {
+      ++freshIt;
+    }
+    while (cacheIt != cached.end() && cacheIt->time < now) {
+      ++cacheIt;
+    }
+    if (freshIt != fresh.end() && freshIt->time == now) {
+      thePoints.push_back(*freshIt);
+    }
+    else if (cacheIt != cached.end() && cacheIt->time == now && cacheIt->isValid && !isDirty(now)) {
+      thePoints.push_back(*cacheIt);
+      ++hits;
+    }
+  }
+  countCacheHits(hits);
+  
+  return thePoints;
+}
+
+void ModularTimeSeries::visitPoints(time_t start, time_t end, PointVisitor& visitor) {
+  // the range is produced in one pass, so there's nothing to stream -- just hand the result over.
+  vector<Point> thePoints = this->points(start, end);
+  BOOST_FOREACH(const Point& p, thePoints) {
+    if (!visitor.visit(p)) {
+      break;
+    }
+  }
+}
+
+
+#pragma mark - Protected Methods
+
+void ModularTimeSeries::evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
+  ValueTransform transform;
+  if (!valueTransform(transform)) {
+    return;
+  }
+  
+  // fold in the stateless stages directly upstream, so they don't each evaluate (and cache) the range.
+  TimeSeries::sharedPointer upstream = source();
+  ModularTimeSeries::sharedPointer stage = boost::dynamic_pointer_cast<ModularTimeSeries>(upstream);
+  ValueTransform stageTransform;
+  while (stage && stage->doesHaveSource() && canFuse(stage) && stage->valueTransform(stageTransform)) {
+    transform = stageTransform.then(transform);
+    upstream = stage->source();
+    stage = boost::dynamic_pointer_cast<ModularTimeSeries>(upstream);
+  }
+  
+  // then one pass over the first stateful ancestor's points
+  vector<Point> sourcePoints = sourcePointsInRange(upstream, start, end);
+  size_t count = sourcePoints.size();
+  if (count == 0) {
+    return;
+  }
+  vector<double> values(count);
+  for (size_t k = 0; k < count; ++k) {
+    values[k] = sourcePoints[k].value;
+  }
+  transform.apply(count, &values[0]);
+  
+  // the points are new values, so they're good -- as they are from point(), one at a time through convertPoint.
+  double confidenceScale = (transform.isAffine()) ? std::abs(transform.scale()) : 1.;
+  out.reserve(out.size() + count);
+  for (size_t k = 0; k < count; ++k) {
+    const Point& p = sourcePoints[k];
+    out.push_back(Point(p.time, values[k], Point::good, p.confidence * confidenceScale));
+  }
+}
+
+vector<Point> ModularTimeSeries::sourcePointsInRange(time_t start, time_t end) {
+  return sourcePointsInRange(source(), start, end);
+}
+
+vector<Point> ModularTimeSeries::sourcePointsInRange(TimeSeries::sharedPointer upstream, time_t start, time_t end) {
+  countUpstreamCalls();
+  vector<Point> sourcePoints = upstream->points(start, end);
+  // the source's range may stop short of an aligned end time, so ask for that one directly.
+  if (sourcePoints.empty() || sourcePoints.back().time < end) {
+    countUpstreamCalls();
+    Point last = upstream->point(end);
+    if (last.isValid && last.time == end) {
+      sourcePoints.push_back(last);
+    }
+  }
+  
+  // keep the valid points that land on my clock
+  bool regular = clock()->isRegular();
+  vector<Point> onClock;
+  onClock.reserve(sourcePoints.size());
+  BOOST_FOREACH(const Point& p, sourcePoints) {
+    if (!p.isValid || p.time < start || end < p.time || (regular && !clock()->isValid(p.time))) {
+      continue;
+    }
+    onClock.push_back(p);
+  }
+  return onClock;
+}
+
+PointRecord::time_pair_t ModularTimeSeries::sourceNeighborRange(time_t start, time_t end) {
+  // out to the source times on either side, wherever there are any.
+  time_t before = source()->clock()->timeBefore(start);
+  time_t after = source()->clock()->timeAfter(end);
+  return make_pair((before > 0) ? before : start, (after > 0) ? after : end);
+}
+
+UnitConverter ModularTimeSeries::sourceConverter() {
+  scopedLock_t lock(_sourceMutex);
+  return _sourceConverter;
+}
+
+bool ModularTimeSeries::valueTransform(ValueTransform& transform) {
+  // a pass-through is just a unit conversion
+  transform = ValueTransform::affine(sourceConverter().scale(), 0.);
+  return true;
+}
+
+
+#pragma mark - Private Methods
+
+bool ModularTimeSeries::canFuse(ModularTimeSeries::sharedPointer stage) {
+  // skipping a stage also skips its clock, which is only safe if it would keep every time that mine does.
+  Clock::sharedPointer stageClock = stage->clock();
+  if (!stageClock->isRegular()) {
+    return true;
+  }
+  return (clock()->isRegular() && clock()->isCompatibleWith(stageClock));
+}
+
+bool ModularTimeSeries::missingSpan(Clock::sharedPointer clock, time_t start, time_t end, vector<Point>& cached, time_t& first, time_t& last) {
+  // the span of clock times that the record can't answer for (or only has stale answers for)
+  cached = record()->pointsInRange(name(), start, end);
+  vector<Point>::const_iterator cacheIt = cached.begin();
+  first = 0;
+  last = 0;
+  for (time_t now = start; now != 0 && now <= end; now = clock->timeAfter(now)) {
+    while (cacheIt != cached.end() && cacheIt->time < now) {
+      ++cacheIt;
+    }
+    if (cacheIt == cached.end() || cacheIt->time != now || !cacheIt->isValid || isDirty(now)) {
+      if (first == 0) {
+        first = now;
+      }
+      last = now;
+    }
+  }
+  return (first != 0);
+}
+
+void ModularTimeSeries::evaluateInChunks(time_t start, time_t end, std::vector<Point>& out) {
+  size_t threads = _evaluationThreads;
+  Clock::sharedPointer clock = this->clock();
+  time_t step = clock->period();
+  size_t count = (clock->isRegular() && step > 0) ? (size_t)((end - start) / step) + 1 : 0;
+  size_t chunks = RTX_MIN(threads, count / minimumChunkPoints);
+  if (chunks < 2) {
+    evaluateRange(start, end, out);
+    return;
+  }
+  
+  // a stage with a halo reads its sources past each chunk; have them cover the span before the chunks overlap there.
+  ValueTransform transform;
+  if (!valueTransform(transform)) {
+    BOOST_FOREACH(TimeSeries::sharedPointer upstream, upstreamSeries()) {
+      if (boost::dynamic_pointer_cast<ModularTimeSeries>(upstream)) {
+        countUpstreamCalls();
+        upstream->points(start, end);
+      }
+    }
+  }
+  
+  // split on clock times, so each chunk starts and ends on the clock.
+  std::vector<time_t> chunkStart(chunks), chunkEnd(chunks);
+  for (size_t i = 0; i < chunks; ++i) {
+    chunkStart[i] = start + (time_t)(i * count / chunks) * step;
+    chunkEnd[i] = start + (time_t)((i + 1) * count / chunks - 1) * step;
+  }
+  std::vector< std::vector<Point> > results(chunks);
+  std::vector<Scheduler::task_t> tasks;
+  for (size_t i = 0; i < chunks; ++i) {
+    tasks.push_back(boost::bind(&ModularTimeSeries::evaluateChunk, this, chunkStart[i], chunkEnd[i], &results[i]));
+  }
+  RuntimeContext::defaultContext()->scheduler()->run(tasks); // the calling thread takes a chunk too
+  
+  size_t total = 0;
+  BOOST_FOREACH(const std::vector<Point>& chunk, results) {
+    total += chunk.size();
+  }
+  out.reserve(out.size() + total);
+  BOOST_FOREACH(const std::vector<Point>& chunk, results) {
+    out.insert(out.end(), chunk.begin(), chunk.end());
+  }
+}
+
+void ModularTimeSeries::evaluateChunk(time_t start, time_t end, std::vector<Point>* out) {
+  try {
+    evaluateRange(start, end, *out);
+  } catch (std::exception& e) {
+    RTX_LOG(error, "ModularTimeSeries", "could not evaluate " << name() << " over a chunk: " << e.what());
+    out->clear();
+  } catch (...) {
+    RTX_LOG(error, "ModularTimeSeries", "could not evaluate " << name() << " over a chunk");
+    out->clear();
+  }
+}
+
+void ModularTimeSeries::updateSourceConverter() {
+  TimeSeries::sharedPointer mySource = source();
+  UnitConverter converter = (mySource) ? UnitConverter(mySource->units(), units()) : UnitConverter();
+  scopedLock_t lock(_sourceMutex);
+  _sourceConverter = converter;
 }
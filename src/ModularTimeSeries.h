@@ -10,15 +10,16 @@
 #define epanet_rtx_ModularTimeSeries_h
 
 #include "TimeSeries.h"
+#include "ValueTransform.h"
 
 namespace RTX {
   
   /*! 
    \class ModularTimeSeries
    \brief A Time Series class that allows a single upstream TimeSeries.
-   
+  
    This class generalizes some basic functionality for the "modular" design. This implementation serves as a "pass-through", performing no analysis or modification of the data, but caching requested Points in this object's PointRecord.
-   
+  
    */
   /*! 
    \fn TimeSeries::sharedPointer ModularTimeSeries::source() 
@@ -36,33 +37,79 @@ namespace RTX {
    \brief Does this Modular time series have an upstream source?
    \return true / false
    */
-
+  /*!
+   \fn void ModularTimeSeries::evaluateRange(time_t start, time_t end, std::vector<Point>& out)
+   \brief Compute this series' points over a whole range in one pass.
+   \param start The first clock-aligned time to produce.
+   \param end The last clock-aligned time to produce (inclusive).
+   \param out Receives the new points, in time order.
+  
+   This is the batch counterpart to point(). points() works out which clock times are missing (or dirty) in the record,
+   calls this once for the span that covers them, and stores the result with a single cachePoints call -- so
+   implementations should pull what they need from the source in bulk and must not insert anything themselves.
+   The default is a unit-converting pass-through of the source's points.
+   */
+  /*!
+   \fn bool ModularTimeSeries::valueTransform(ValueTransform& transform)
+   \brief Describe this stage as a stateless per-value map, if it is one.
+   \param transform Receives the map from source values (in source units) to this series' values.
+   \return true if every output point depends only on the source point at the same time.
+  
+   Stateless stages are fused: when one evaluates a range, it folds in any stateless stages directly upstream
+   (as long as their clocks don't drop times that this one keeps) and applies the combined transform to the first
+   stateful ancestor's points, so the intermediate stages are skipped and cache nothing. Fused points are new
+   values, so they're good whatever the ancestor's quality -- as they are from point(). Stages that look at more than one source point (resampling, filtering, differencing)
+   must return false.
+   */
+  
   
   class ModularTimeSeries : public TimeSeries {
-    
+  
   public:
     RTX_SHARED_POINTER(ModularTimeSeries);
     ModularTimeSeries();
     virtual ~ModularTimeSeries();
-    
+  
     // class-specific methods
     TimeSeries::sharedPointer source();
     virtual void setSource(TimeSeries::sharedPointer source);
     bool doesHaveSource();
-    
+    virtual std::vector<TimeSeries::sharedPointer> upstreamSeries();
+    void setEvaluationThreads(size_t threadCount); //! how many chunks a long range is split into, on the default RuntimeContext's scheduler
+    size_t evaluationThreads();
+  
     // overridden methods from parent class
     //virtual bool isPointAvailable(time_t time);
     virtual Point point(time_t time);
     virtual Point pointBefore(time_t time);
     virtual Point pointAfter(time_t time);
     virtual std::vector< Point > points(time_t start, time_t end);
+    virtual void visitPoints(time_t start, time_t end, PointVisitor& visitor);
     virtual void setUnits(Units newUnits);
-    
+    virtual bool valueTransform(ValueTransform& transform);
+    virtual void sourceUnitsDidChange(TimeSeries* source);
+  
     virtual std::ostream& toStream(std::ostream &stream);
-    
+  
+  protected:
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out);
+    std::vector<Point> sourcePointsInRange(time_t start, time_t end); //! valid source points on this clock, in [start, end]
+    std::vector<Point> sourcePointsInRange(TimeSeries::sharedPointer upstream, time_t start, time_t end);
+    PointRecord::time_pair_t sourceNeighborRange(time_t start, time_t end); //! [start, end], out to the neighboring source times
+    UnitConverter sourceConverter(); //! from the source's units to mine, worked out when either changes
+  
   private:
+    Point computePoint(time_t time);
+    bool canFuse(ModularTimeSeries::sharedPointer stage);
+    void updateSourceConverter();
+    bool missingSpan(Clock::sharedPointer clock, time_t start, time_t end, std::vector<Point>& cached, time_t& first, time_t& last);
+    void evaluateInChunks(time_t start, time_t end, std::vector<Point>& out);
+    void evaluateChunk(time_t start, time_t end, std::vector<Point>* out); //! one thread's share; reports rather than throws
     TimeSeries::sharedPointer _source;
+    UnitConverter _sourceConverter;
     bool _doesHaveSource;
+    boost::mutex _sourceMutex; // guards the source and the converter from it
+    boost::atomic<size_t> _evaluationThreads;
   };
   
 }
@@ -7,17 +7,16 @@
 //  
 
 #include "MovingAverage.h"
+#include "Scratch.h"
 #include <boost/foreach.hpp>
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics/stats.hpp>
-#include <boost/accumulators/statistics/mean.hpp>
-#include <math.h>
+#include <boost/bind/bind.hpp>
 
 #include <iostream>
+#include <algorithm>
 
 using namespace RTX;
 using namespace std;
-using namespace boost::accumulators;
+using namespace boost::placeholders;
 
 
 MovingAverage::MovingAverage() : ModularTimeSeries::ModularTimeSeries() {
@@ -25,7 +24,7 @@ MovingAverage::MovingAverage() : ModularTimeSeries::ModularTimeSeries() {
 }
 
 MovingAverage::~MovingAverage() {
-    
+  
 }
 
 #pragma mark - Added Methods
@@ -50,35 +49,43 @@ Point MovingAverage::point(time_t time) {
   }
   
   // a point is requested. see if it is available in my cache (via base class methods)
-  Point p = TimeSeries::point(time);
-  if (p.isValid) {
-    return p;
+  return pointComputedOnce(time, boost::bind(&MovingAverage::computePoint, this, _1));
+}
+
+Point MovingAverage::computePoint(time_t time) {
+  // not cached: construct it (a range of one) and store it locally.
+  std::vector<Point> filtered;
+  this->evaluateRange(time, time, filtered);
+  if (filtered.empty()) {
+    return Point();
   }
   
-  // if not, we need to construct it and store it locally.
-  Point aFilteredPoint = Point::convertPoint(this->movingAverageAt(time), source()->units(), units());
-  
   // add the point to the local cache, and return it.
-  this->insert(aFilteredPoint);
+  this->cachePoint(filtered.front());
   
-  return aFilteredPoint;
+  return filtered.front();
 }
 
-std::vector< Point > MovingAverage::points(time_t start, time_t end) {
-  // todo - better logic here...
-  time_t period = this->period();
-  
-  // encourage the appropriate cache.
-  if (!source()) {
-    std::vector< Point > empty;
-    return empty;
+bool MovingAverage::valueTransform(ValueTransform& transform) {
+  return false; // a window, not a per-value map
+}
+
+PointRecord::time_pair_t MovingAverage::affectedRange(time_t start, time_t end) {
+  // every window that reaches the changed points: half a window either side, in the same terms as evaluateRange.
+  size_t halfWindow = _windowSize / 2;
+  time_t sourcePeriod = source()->period();
+  if (sourcePeriod > 0) {
+    time_t halfSpan = sourcePeriod * halfWindow;
+    return make_pair(start - halfSpan, end + halfSpan);
   }
-  cout << "calling source cache (" << source()->name() << ")" << endl;
-  source()->points( start - (period * windowSize()), end + (period * windowSize()) );
-  
-  // now return just the results we care about.
-  return ModularTimeSeries::points(start, end);
-  
+  Clock::sharedPointer sourceClock = source()->clock();
+  for (size_t i = 0; i < halfWindow; ++i) {
+    time_t before = sourceClock->timeBefore(start);
+    time_t after = sourceClock->timeAfter(end);
+    start = (before > 0) ? before : start;
+    end = (after > 0) ? after : end;
+  }
+  return make_pair(start, end);
 }
 
 bool MovingAverage::isCompatibleWith(TimeSeries::sharedPointer withTimeSeries) {
@@ -86,59 +93,126 @@ bool MovingAverage::isCompatibleWith(TimeSeries::sharedPointer withTimeSeries) {
   return true;
 }
 
+namespace {
+  class SumWindow : public MovingAverage::Window {
+  public:
+    SumWindow() : _sum(0) {};
+    virtual void enter(size_t index, double value) { _sum += value; };
+    virtual void leave(size_t index, double value) { _sum -= value; };
+    virtual double value(size_t count) { return _sum / count; };
+    virtual void clear() { _sum = 0; };
+  private:
+    double _sum;
+  };
+}
+
+time_t MovingAverage::reseedBlock(time_t time, time_t span) {
+  // rounded down, for times before the epoch too
+  return (time >= 0) ? time / span : -((span - 1 - time) / span);
+}
 
-#pragma mark - Private Methods
+void MovingAverage::evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
+  SumWindow window;
+  evaluateWindows(start, end, window, out);
+}
 
-Point MovingAverage::movingAverageAt(time_t time) {
+void MovingAverage::evaluateWindows(time_t start, time_t end, Window& window, std::vector<Point>& out) {
+  // on a regular clock the running state is started afresh every windowSize outputs, at times fixed by the clock
+  // rather than by where a range begins. the walk starts at the last of those at or before the range (and only emits
+  // from the range on), so each output comes from the same arithmetic however the span around it was split up --
+  // into chunks, or single points -- and the cache holds the same value whichever of them computed it.
+  time_t first = (clock()->isValid(start)) ? start : clock()->timeAfter(start);
+  time_t reseedSpan = (period() > 0) ? period() * std::max(windowSize(), 1) : 0;
+  time_t walkStart = first;
+  if (reseedSpan > 0 && first != 0) {
+    time_t anchor = reseedBlock(first, reseedSpan) * reseedSpan;
+    walkStart = (clock()->isValid(anchor)) ? anchor : clock()->timeAfter(anchor);
+  }
   
-  // get a collection of points around "time" from the source() timeseries, and send them to the calculator.
+  // one pull of the source, wide enough for every window in the walk.
+  time_t sourcePeriod = source()->period();
+  time_t margin = (RTX_MAX(period(), sourcePeriod)) * windowSize();
+  time_t pullStart = std::min(start, walkStart) - margin, pullEnd = end + margin;
+  if (sourcePeriod == 0) {
+    // an irregular source's windows are counted in its points, so reach half a window of them past either end
+    PointRecord::time_pair_t reach = affectedRange(std::min(start, walkStart), end);
+    pullStart = std::min(pullStart, reach.first);
+    pullEnd = std::max(pullEnd, reach.second);
+  }
+  countUpstreamCalls();
+  std::vector<Point> sourcePoints = source()->points(pullStart, pullEnd);
+  
+  // the window only counts points that are actually there. those are copied into the thread's scratch buffers,
+  // which are reused from one range to the next.
+  Scratch::Vector<time_t> timeBuffer;
+  Scratch::Vector<double> valueBuffer;
+  std::vector<time_t>& times = *timeBuffer;
+  std::vector<double>& values = *valueBuffer;
+  times.reserve(sourcePoints.size());
+  values.reserve(sourcePoints.size());
+  BOOST_FOREACH(const Point& p, sourcePoints) {
+    if (p.isValid && p.quality != Point::missing) {
+      times.push_back(p.time);
+      values.push_back(p.value);
+    }
+  }
+  size_t nSource = times.size();
+  size_t halfWindow = _windowSize / 2;
   
-  std::vector< Point > somePoints;
-  int halfWindow = floor(_windowSize / 2);
+  if (period() > 0) {
+    out.reserve(out.size() + (end - start) / period() + 1);
+  }
   
-  // push in the point at the current time
-  somePoints.push_back( source()->point(time) );
+  // each window is the source point at "now" plus half a window of points on either side. for a regular source
+  // that's half a window of its clock periods, and any points missing from that span just count against the
+  // window; an irregular source contributes its nearest points instead.
+  // both edges only ever move forward, so the window's state is updated as points enter and leave.
+  time_t halfSpan = sourcePeriod * halfWindow;
+  UnitConverter converter = sourceConverter();
+  size_t windowBegin = 0, windowEnd = 0; // [begin, end) of source indexes in the window
+  size_t here = 0;                       // first source index at or after "now"
+  time_t block = 0;
+  bool isSeeded = false;
+  for (time_t now = walkStart; now != 0 && now <= end; now = clock()->timeAfter(now)) {
+    size_t newBegin, newEnd;
+    if (sourcePeriod > 0) {
+      newBegin = windowBegin;
+      while (newBegin < nSource && times[newBegin] < now - halfSpan) {
+        ++newBegin;
+      }
+      newEnd = RTX_MAX(newBegin, windowEnd);
+      while (newEnd < nSource && times[newEnd] <= now + halfSpan) {
+        ++newEnd;
+      }
+    }
+    else {
+      while (here < nSource && times[here] < now) {
+        ++here;
+      }
+      size_t pastHere = (here < nSource && times[here] == now) ? here + 1 : here;
+      newBegin = (here > halfWindow) ? here - halfWindow : 0;
+      newEnd = RTX_MIN(nSource, pastHere + halfWindow);
+    }
   
-  // push in a half-window's worth of points (to the left) from the source time series into the vector.
-  time_t rewindTime = time;
-  Point pointToPush;
-  for (int i = 0; i < halfWindow; ++i) {
-    pointToPush = source()->pointBefore(rewindTime);
-    if (!pointToPush.isValid) {
-      continue;
+    if (reseedSpan > 0 && (!isSeeded || reseedBlock(now, reseedSpan) != block)) {
+      window.clear();
+      windowBegin = windowEnd = newBegin;
+      block = reseedBlock(now, reseedSpan);
+      isSeeded = true;
+    }
+    while (windowEnd < newEnd) {
+      window.enter(windowEnd, values[windowEnd]);
+      ++windowEnd;
+    }
+    while (windowBegin < newBegin) {
+      window.leave(windowBegin, values[windowBegin]);
+      ++windowBegin;
     }
-    somePoints.push_back( pointToPush );
-    rewindTime = pointToPush.time;
-  }
   
-  // and now push a half-window's worth of points from the right.
-  time_t forwardTime = time;
-  for (int i = 0; i < halfWindow; ++i) {
-    pointToPush = source()->pointAfter(forwardTime);
-    if (!pointToPush.isValid) {
+    size_t count = windowEnd - windowBegin;
+    if (count == 0 || now < first) {
       continue;
     }
-    somePoints.push_back( pointToPush );
-    forwardTime = pointToPush.time;
+    out.push_back(Point(now, converter.convert(window.value(count)), Point::good));
   }
-  
-  
-  double movingAverageValue = calculateAverage(somePoints);
-    
-  return Point(time, movingAverageValue, Point::good);
-  
 }
-
-// average the points
-double MovingAverage::calculateAverage(vector< Point > somePoints) {
-  
-  accumulator_set<double, stats<tag::mean> > meanAccumulator;
-  BOOST_FOREACH(Point point, somePoints) {
-    double pointValue = point.value;
-    meanAccumulator(pointValue);
-  }
-  
-  double meanValue = mean(meanAccumulator);
-  return meanValue;
-
-}
\ No newline at end of file
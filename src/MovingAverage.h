@@ -38,15 +38,29 @@ namespace RTX {
     
     // overridden methods (from derived classes)
     virtual Point point(time_t time);
-    virtual std::vector< Point > points(time_t start, time_t end);
+    virtual bool valueTransform(ValueTransform& transform);
+    virtual PointRecord::time_pair_t affectedRange(time_t start, time_t end);
+    
+    //! running state over the window: source points enter at the leading edge and leave from the trailing one, in order
+    class Window {
+    public:
+      virtual ~Window() {};
+      virtual void enter(size_t index, double value) = 0;
+      virtual void leave(size_t index, double value) = 0;
+      virtual double value(size_t count) = 0;  //! the window's result (in source units), given how many points it holds
+      virtual void clear() = 0;                //! empties it, to start the running state afresh
+    };
     
   protected:
     virtual bool isCompatibleWith(TimeSeries::sharedPointer withTimeSeries);
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out);
+    //! walks the window across the clock times in [start, end], appending window.value() for each non-empty one.
+    //! on a regular clock, the same output times give the same values whatever range they're asked for in.
+    void evaluateWindows(time_t start, time_t end, Window& window, std::vector<Point>& out);
     
   private:
-    // methods
-    Point movingAverageAt(time_t time);
-    double calculateAverage(vector< Point > points);
+    Point computePoint(time_t time);
+    static time_t reseedBlock(time_t time, time_t span); //! which of the span-long blocks of time it falls in
     // attributes
     int N;
     //array to store moving average
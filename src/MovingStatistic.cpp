@@ -0,0 +1,240 @@
+//
+//  MovingStatistic.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include <deque>
+#include <map>
+#include <cmath>
+
+#include "MovingStatistic.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+
+MovingStatistic::MovingStatistic() : MovingAverage::MovingAverage() {
+  _statistic = maximum;
+  _quantile = 0.5;
+}
+
+MovingStatistic::~MovingStatistic() {
+
+}
+
+#pragma mark - Added Methods
+
+void MovingStatistic::setStatistic(Statistic_t statistic) {
+  resetCache();
+  _statistic = statistic;
+}
+
+MovingStatistic::Statistic_t MovingStatistic::statistic() {
+  return _statistic;
+}
+
+void MovingStatistic::setQuantile(double fraction) {
+  if (fraction < 0 || fraction > 1) {
+    RTX_LOG(warning, "MovingStatistic", "quantile " << fraction << " is outside [0,1] -- ignoring");
+    return;
+  }
+  resetCache();
+  _quantile = fraction;
+}
+
+double MovingStatistic::quantileFraction() {
+  return _quantile;
+}
+
+#pragma mark - Public Overridden Methods
+
+std::ostream& MovingStatistic::toStream(std::ostream &stream) {
+  ModularTimeSeries::toStream(stream);
+  stream << "Moving ";
+  switch (_statistic) {
+    case minimum:
+      stream << "minimum";
+      break;
+    case maximum:
+      stream << "maximum";
+      break;
+    case standardDeviation:
+      stream << "standard deviation";
+      break;
+    case quantile:
+      stream << "quantile (" << _quantile << ")";
+      break;
+  }
+  stream << " over " << windowSize() << " points" << endl;
+  return stream;
+}
+
+#pragma mark - Protected Methods
+
+namespace {
+
+  // the deque holds the points that could still become the extreme once everything before them has left, so the
+  // front is always the current one. a point that is beaten by a newer one never can, and is dropped as it's beaten.
+  class ExtremeWindow : public MovingAverage::Window {
+  public:
+    ExtremeWindow(bool isMaximum) : _isMaximum(isMaximum) {};
+    virtual void enter(size_t index, double value) {
+      while (!_candidates.empty() && beats(value, _candidates.back().second)) {
+        _candidates.pop_back();
+      }
+      _candidates.push_back(make_pair(index, value));
+    };
+    virtual void leave(size_t index, double value) {
+      if (!_candidates.empty() && _candidates.front().first == index) {
+        _candidates.pop_front();
+      }
+    };
+    virtual double value(size_t count) {
+      return _candidates.front().second;
+    };
+    virtual void clear() {
+      _candidates.clear();
+    };
+  private:
+    bool beats(double a, double b) {
+      return _isMaximum ? (a >= b) : (a <= b);
+    };
+    bool _isMaximum;
+    std::deque< std::pair<size_t, double> > _candidates;
+  };
+
+
+  // Welford's running mean and sum of squared deviations, with the update run backwards for points leaving.
+  class DeviationWindow : public MovingAverage::Window {
+  public:
+    DeviationWindow() : _n(0), _mean(0), _m2(0) {};
+    virtual void enter(size_t index, double value) {
+      ++_n;
+      double delta = value - _mean;
+      _mean += delta / _n;
+      _m2 += delta * (value - _mean);
+    };
+    virtual void leave(size_t index, double value) {
+      if (--_n == 0) {
+        _mean = 0;
+        _m2 = 0;
+        return;
+      }
+      double delta = value - _mean;
+      _mean -= delta / _n;
+      _m2 -= delta * (value - _mean);
+      _m2 = RTX_MAX(_m2, 0.);  // rounding can take it just under
+    };
+    virtual double value(size_t count) {
+      return (_n > 1) ? sqrt(_m2 / (_n - 1)) : 0.;
+    };
+    virtual void clear() {
+      _n = 0;
+      _mean = 0;
+      _m2 = 0;
+    };
+  private:
+    size_t _n;
+    double _mean, _m2;
+  };
+
+
+  // counts per logarithmic bucket, with bucket i covering (gamma^(i-1), gamma^i] in magnitude. every value in a
+  // bucket is within 1% of the bucket's representative value, so that's as close as the quantile gets.
+  class QuantileWindow : public MovingAverage::Window {
+  public:
+    QuantileWindow(double fraction) : _fraction(fraction), _count(0), _zeros(0) {
+      _gamma = (1. + accuracy) / (1. - accuracy);
+      _logGamma = log(_gamma);
+    };
+    virtual void enter(size_t index, double value) {
+      ++_count;
+      if (fabs(value) < zero) {
+        ++_zeros;
+      }
+      else {
+        ++(value > 0 ? _positive : _negative)[bucket(value)];
+      }
+    };
+    virtual void leave(size_t index, double value) {
+      --_count;
+      if (fabs(value) < zero) {
+        --_zeros;
+        return;
+      }
+      std::map<int, size_t>& buckets = (value > 0) ? _positive : _negative;
+      std::map<int, size_t>::iterator it = buckets.find(bucket(value));
+      if (it != buckets.end() && --(it->second) == 0) {
+        buckets.erase(it);
+      }
+    };
+    virtual double value(size_t count) {
+      // walk up from the most negative value to the one with the requested rank.
+      size_t rank = (size_t)(_fraction * (_count - 1));
+      size_t seen = 0;
+      for (std::map<int, size_t>::reverse_iterator it = _negative.rbegin(); it != _negative.rend(); ++it) {
+        seen += it->second;
+        if (seen > rank) {
+          return -representative(it->first);
+        }
+      }
+      seen += _zeros;
+      if (seen > rank) {
+        return 0.;
+      }
+      for (std::map<int, size_t>::iterator it = _positive.begin(); it != _positive.end(); ++it) {
+        seen += it->second;
+        if (seen > rank) {
+          return representative(it->first);
+        }
+      }
+      return _positive.empty() ? 0. : representative(_positive.rbegin()->first);
+    };
+    virtual void clear() {
+      _count = 0;
+      _zeros = 0;
+      _positive.clear();
+      _negative.clear();
+    };
+  private:
+    static const double accuracy, zero;
+    int bucket(double value) {
+      return (int)ceil(log(fabs(value)) / _logGamma);
+    };
+    double representative(int bucket) {
+      return 2. * pow(_gamma, bucket) / (_gamma + 1.);
+    };
+    double _fraction, _gamma, _logGamma;
+    size_t _count, _zeros;
+    std::map<int, size_t> _positive, _negative;
+  };
+  const double QuantileWindow::accuracy = 0.01;
+  const double QuantileWindow::zero = 1e-9;
+
+}
+
+void MovingStatistic::evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
+  switch (_statistic) {
+    case minimum:
+    case maximum: {
+      ExtremeWindow window(_statistic == maximum);
+      evaluateWindows(start, end, window, out);
+      break;
+    }
+    case standardDeviation: {
+      DeviationWindow window;
+      evaluateWindows(start, end, window, out);
+      break;
+    }
+    case quantile: {
+      QuantileWindow window(_quantile);
+      evaluateWindows(start, end, window, out);
+      break;
+    }
+  }
+}
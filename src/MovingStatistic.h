@@ -0,0 +1,68 @@
+//
+//  MovingStatistic.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_MovingStatistic_h
+#define epanet_rtx_MovingStatistic_h
+
+#include "MovingAverage.h"
+
+namespace RTX {
+
+  /*!
+   \class MovingStatistic
+   \brief A rolling minimum, maximum, standard deviation or quantile of the source, over a window of points.
+
+   The window is MovingAverage's: the source point at each clock time plus half a window of points on either side
+   (for a regular source, half a window of its clock periods). Missing and invalid source points count against the
+   window rather than being filled in.
+
+   Ranges are computed in a single pass over the source, with the window's state updated as points enter and
+   leave it, so the cost per output point doesn't grow with the window:
+   - minimum and maximum keep a monotonic deque of the candidates that could still be the extreme
+   - standardDeviation keeps a Welford running mean and sum of squared deviations (the sample deviation, n-1)
+   - quantile keeps a log-bucketed sketch whose answer is within 1% of a value actually in the window
+   */
+
+  /*!
+   \fn void MovingStatistic::setQuantile(double fraction)
+   \brief Which quantile the quantile statistic reports.
+   \param fraction Between 0 and 1 -- 0.5 is the median, 0.95 the 95th percentile.
+   */
+
+  class MovingStatistic : public MovingAverage {
+  public:
+    RTX_SHARED_POINTER(MovingStatistic);
+    typedef enum {
+      minimum,
+      maximum,
+      standardDeviation,
+      quantile
+    } Statistic_t;
+
+    MovingStatistic();
+    virtual ~MovingStatistic();
+
+    // added functionality
+    void setStatistic(Statistic_t statistic);
+    Statistic_t statistic();
+    void setQuantile(double fraction);
+    double quantileFraction();
+
+    virtual std::ostream& toStream(std::ostream &stream);
+
+  protected:
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out);
+
+  private:
+    Statistic_t _statistic;
+    double _quantile;
+  };
+
+}
+
+#endif
@@ -7,6 +7,7 @@
 //  
 
 #include <iostream>
+#include <algorithm>
 
 #include <boost/foreach.hpp>
 #include <boost/regex.hpp>
@@ -22,16 +23,24 @@
 #include <cppconn/statement.h>
 
 #include "MysqlPointRecord.h"
+#include "Log.h"
 
 using namespace RTX;
 using namespace std;
 
+typedef boost::lock_guard<boost::recursive_mutex> connectionLock_t;
+typedef boost::lock_guard<boost::mutex> seriesInfoLock_t;
+
+static bool pointTimesAreEqual(const Point& left, const Point& right) {
+  return left.time == right.time;
+}
+
 #define RTX_CREATE_POINT_TABLE_STRING "\
     CREATE TABLE IF NOT EXISTS `points` (\
     `time` int(11) unsigned NOT NULL,\
     `series_id` int(11) NOT NULL,\
     `value` double NOT NULL,\
-    KEY `id` (`series_id`),\
+    UNIQUE KEY `series_time` (`series_id`,`time`),\
     KEY `time` (`time`)\
     ) ENGINE=InnoDB DEFAULT CHARSET=latin1;"
 
@@ -46,12 +55,19 @@ using namespace std;
     UNIQUE KEY `name` (`name`)\
     ) ENGINE=InnoDB DEFAULT CHARSET=latin1 AUTO_INCREMENT=1;"
 
+#define RTX_MYSQL_BULK_INSERT_ROWS 1000 // rows per multi-row insert statement
+
 
 MysqlPointRecord::MysqlPointRecord() {
   _connectionOk = false;
+  _driver = NULL;
+  _hasUniqueTimes = false;
 }
 
 MysqlPointRecord::~MysqlPointRecord() {
+  cancelConnect();
+  stopFetching();
+  setWriteBehind(false);
   if (_driver) {
     _driver->threadEnd();
   }
@@ -77,7 +93,7 @@ void MysqlPointRecord::connect() throw(RtxException) {
     for ( ; it != end; ++it) {
       kvPairs[(*it)[1]] = (*it)[2];
     }
-    
+  
     // if any of the keys are missing, just return.
     if (kvPairs.find("HOST") == kvPairs.end() ||
         kvPairs.find("UID") == kvPairs.end() ||
@@ -92,17 +108,27 @@ void MysqlPointRecord::connect() throw(RtxException) {
   const std::string& password = kvPairs["PWD"];
   const std::string& database = kvPairs["DB"];
   
+  // existing pooled connections were made with the old settings
+  closeConnections();
+  connectionLock_t connectionLock(_connectionMutex);
+  forgetSeries();
+  _host = host;
+  _user = user;
+  _password = password;
+  
   bool databaseDoesExist = false;
   try {
     _driver = get_driver_instance();
     _driver->threadInit();
-    _connection.reset( _driver->connect(host, user, password) );
-    _connection->setAutoCommit(false);
-    
+    _primary.reset( new MysqlConnection() );
+    _primary->connection.reset( _driver->connect(host, user, password) );
+    _primary->connection->setAutoCommit(false);
+    boost::shared_ptr<sql::Connection> connection = _primary->connection;
+  
     // test for database exists
-    
-    boost::shared_ptr<sql::Statement> st( _connection->createStatement() );
-    sql::DatabaseMetaData *meta =  _connection->getMetaData();
+  
+    boost::shared_ptr<sql::Statement> st( connection->createStatement() );
+    sql::DatabaseMetaData *meta =  connection->getMetaData();
     boost::shared_ptr<sql::ResultSet> results( meta->getSchemas() );
     while (results->next()) {
       std::string resultString(results->getString("TABLE_SCHEM"));
@@ -112,48 +138,31 @@ void MysqlPointRecord::connect() throw(RtxException) {
       }
     }
     results->close();
-    
-    
+  
+  
     if (!databaseDoesExist) {
       string updateString;
-      
+  
       // create database
       updateString = "CREATE DATABASE ";
       updateString += database;
       st->executeUpdate(updateString);
-      _connection->commit();
-      _connection->setSchema(database);
+      connection->commit();
+      connection->setSchema(database);
       // create tables
       st->executeUpdate(RTX_CREATE_POINT_TABLE_STRING);
       st->executeUpdate(RTX_CREATE_TSKEY_TABLE_STRING);
-      _connection->commit();
-      cout << "Created new Database: " << database << endl;
+      connection->commit();
+      RTX_LOG(info, "MysqlPointRecord", "created new database: " << database);
     }
-    
-    _connection->setSchema(database);
-    
-    
-    // build the queries, since preparedStatements can't specify table names.
-    //string rangeSelect = "SELECT time, value FROM " + tableName + " WHERE series_id = ? AND time > ? AND time <= ?";
-    string preamble = "SELECT time, value FROM points INNER JOIN timeseries_meta USING (series_id) WHERE name = ? AND ";
-    string singleSelect = preamble + "time = ? order by time asc";
-    string rangeSelect = preamble + "time >= ? AND time <= ? order by time asc";
-    string nextSelect = preamble + "time > ? order by time asc LIMIT 1";
-    string prevSelect = preamble + "time < ? order by time desc LIMIT 1";
-    string singleInsert = "INSERT INTO points (time, series_id, value) SELECT ?,series_id,? FROM timeseries_meta WHERE name = ?";
-    
-    string firstSelectStr = "SELECT time, value FROM points INNER JOIN timeseries_meta USING (series_id) WHERE name = ? order by time asc limit 1";
-    string lastSelectStr = "SELECT time, value FROM points INNER JOIN timeseries_meta USING (series_id) WHERE name = ? order by time desc limit 1";
-    
-    _rangeSelect.reset( _connection->prepareStatement(rangeSelect) );
-    _singleSelect.reset( _connection->prepareStatement(singleSelect) );
-    _nextSelect.reset( _connection->prepareStatement(nextSelect) );
-    _previousSelect.reset( _connection->prepareStatement(prevSelect) );
-    _singleInsert.reset( _connection->prepareStatement(singleInsert) );
-    
-    _firstSelect.reset( _connection->prepareStatement(firstSelectStr) );
-    _lastSelect.reset( _connection->prepareStatement(lastSelectStr) );
-    
+  
+    connection->setSchema(database);
+    prepareStatements(*_primary);
+  
+    // tables created before the (series_id,time) key was added can't de-duplicate on the server.
+    boost::shared_ptr<sql::ResultSet> keyResult( st->executeQuery("SHOW INDEX FROM points WHERE Key_name = 'series_time'") );
+    _hasUniqueTimes = keyResult->next();
+  
     // if we made it this far...
     _connectionOk = true;
     _name = database;
@@ -163,15 +172,81 @@ void MysqlPointRecord::connect() throw(RtxException) {
   }
 }
 
+// build the queries, since preparedStatements can't specify table names.
+void MysqlPointRecord::prepareStatements(MysqlConnection& db) {
+  // points are keyed by series_id, which we resolve once per series -- so no joins on the name.
+  string preamble = "SELECT time, value FROM points WHERE series_id = ? AND ";
+  string singleSelect = preamble + "time = ? order by time asc";
+  string rangeSelect = preamble + "time >= ? AND time <= ? order by time asc";
+  string chunkSelect = rangeSelect + " LIMIT ?";
+  string nextSelect = preamble + "time > ? order by time asc LIMIT 1";
+  string prevSelect = preamble + "time < ? order by time desc LIMIT 1";
+  string singleInsert = "INSERT INTO points (time, series_id, value) VALUES (?,?,?)";
+  
+  // both ends in one pass over the (series_id,time) index
+  string extentSelect = "SELECT COUNT(*) AS count, MIN(time) AS first, MAX(time) AS last FROM points WHERE series_id = ?";
+  
+  // one row per bucket, so a long range at low resolution doesn't send every point over the wire
+  string aggregateSelect = "SELECT FLOOR(time / ?) * ? AS bucket, MIN(value) AS minimum, MAX(value) AS maximum, SUM(value) AS total, COUNT(*) AS count FROM points WHERE series_id = ? AND time >= ? AND time <= ? GROUP BY bucket order by bucket asc";
+  
+  db.rangeSelect.reset( db.connection->prepareStatement(rangeSelect) );
+  db.chunkSelect.reset( db.connection->prepareStatement(chunkSelect) );
+  db.singleSelect.reset( db.connection->prepareStatement(singleSelect) );
+  db.nextSelect.reset( db.connection->prepareStatement(nextSelect) );
+  db.previousSelect.reset( db.connection->prepareStatement(prevSelect) );
+  db.singleInsert.reset( db.connection->prepareStatement(singleInsert) );
+  db.extentSelect.reset( db.connection->prepareStatement(extentSelect) );
+  db.aggregateSelect.reset( db.connection->prepareStatement(aggregateSelect) );
+  
+  db.seriesIdSelect.reset( db.connection->prepareStatement("SELECT series_id FROM timeseries_meta WHERE name = ?") );
+  db.timesSelect.reset( db.connection->prepareStatement("SELECT time FROM points WHERE series_id = ? AND time >= ? AND time <= ? order by time asc") );
+  db.bulkInsert.reset( db.connection->prepareStatement(bulkInsertStatement(RTX_MYSQL_BULK_INSERT_ROWS)) );
+}
+
+// another connection for the pool, with its own statements.
+DbPointRecord::connectionPointer_t MysqlPointRecord::openConnection() {
+  boost::shared_ptr<MysqlConnection> db;
+  if (!_connectionOk || !_driver) {
+    return db;
+  }
+  try {
+    db.reset( new MysqlConnection() );
+    db->connection.reset( _driver->connect(_host, _user, _password) );
+    db->connection->setAutoCommit(false);
+    db->connection->setSchema(_name);
+    prepareStatements(*db);
+  }
+  catch (sql::SQLException &e) {
+    RTX_LOG(error, "MysqlPointRecord", "could not open pooled connection: " << e.what());
+    db.reset();
+  }
+  return db;
+}
+
+// the connection checked out by this thread, or the primary.
+MysqlPointRecord::MysqlConnection& MysqlPointRecord::mysqlConnection() {
+  connection_t* leased = leasedConnection();
+  if (leased) {
+    return *static_cast<MysqlConnection*>(leased);
+  }
+  return *_primary;
+}
+
 bool MysqlPointRecord::isConnected() {
-  if (!_connection || !_connectionOk) {
+  ensureConnected();
+  if (!_connectionOk) {
+    return false;
+  }
+  connectionLease_t lease(*this);
+  MysqlConnection& db = mysqlConnection();
+  if (!db.connection) {
     return false;
   }
   boost::shared_ptr<sql::Statement> stmt;
   boost::shared_ptr<sql::ResultSet> rs;
   bool connected = false;
   try {
-    stmt.reset(_connection->createStatement());
+    stmt.reset(db.connection->createStatement());
     rs.reset( stmt->executeQuery("SELECT 1") );
     if (rs->next()) {
       connected = true; // connection is valid
@@ -188,10 +263,13 @@ bool MysqlPointRecord::isConnected() {
 std::string MysqlPointRecord::registerAndGetIdentifier(std::string recordName) {
   // insert the identifier, or make sure it's in the db.
   try {
-    boost::shared_ptr<sql::PreparedStatement> seriesNameStatement( _connection->prepareStatement("INSERT IGNORE INTO timeseries_meta (name) VALUES (?)") );
+    connectionLease_t lease(*this);
+    MysqlConnection& db = mysqlConnection();
+    boost::shared_ptr<sql::PreparedStatement> seriesNameStatement( db.connection->prepareStatement("INSERT IGNORE INTO timeseries_meta (name) VALUES (?)") );
     seriesNameStatement->setString(1,recordName);
     seriesNameStatement->executeUpdate();
-    _connection->commit();
+    db.connection->commit();
+    seriesIdForName(recordName); // cache the id now, while we're here
   } catch (sql::SQLException &e) {
     handleException(e);
 	}
@@ -203,29 +281,36 @@ std::string MysqlPointRecord::registerAndGetIdentifier(std::string recordName) {
 
 
 PointRecord::time_pair_t MysqlPointRecord::range(const string& id) {
-  
-  
-  Point first;
-  _firstSelect->setString(1, id);
-  boost::shared_ptr<sql::ResultSet> fResult( _firstSelect->executeQuery() );
-  if( fResult && fResult->next() ) {
-    time_t rowTime = fResult->getInt("time");
-    double rowValue = fResult->getDouble("value");
-    first = Point(rowTime, rowValue);
+  waitForWrites(id);
+  {
+    seriesInfoLock_t infoLock(_seriesInfoMutex);
+    std::map<std::string, seriesInfo_t>::const_iterator found = _seriesInfo.find(id);
+    if (found != _seriesInfo.end() && found->second.rangeKnown) {
+      return found->second.range;
+    }
   }
   
+  time_pair_t range(0,0);
+  connectionLease_t lease(*this);
+  MysqlConnection& db = mysqlConnection();
+  int seriesId = seriesIdForName(id);
+  if (seriesId < 0) {
+    return range;
+  }
   
-  
-  Point last;
-  _lastSelect->setString(1, id);
-  boost::shared_ptr<sql::ResultSet> lResult( _lastSelect->executeQuery() );
-  if( lResult && lResult->next() ) {
-    time_t rowTime = lResult->getInt("time");
-    double rowValue = lResult->getDouble("value");
-    last = Point(rowTime, rowValue);
+  db.extentSelect->setInt(1, seriesId);
+  boost::shared_ptr<sql::ResultSet> result( db.extentSelect->executeQuery() );
+  if (result && result->next() && result->getInt("count") > 0) {
+    range = make_pair((time_t)result->getInt("first"), (time_t)result->getInt("last"));
   }
   
-  return make_pair(first.time, last.time);
+  // from here on, inserts keep it current
+  seriesInfoLock_t infoLock(_seriesInfoMutex);
+  seriesInfo_t& info = _seriesInfo[id];
+  info.range = range;
+  info.rangeKnown = true;
+  
+  return range;
 }
 
 
@@ -237,7 +322,9 @@ std::vector<std::string> MysqlPointRecord::identifiers() {
   if (!isConnected()) {
     return ids;
   }
-  boost::shared_ptr<sql::Statement> selectNamesStatement( _connection->createStatement() );
+  connectionLease_t lease(*this);
+  MysqlConnection& db = mysqlConnection();
+  boost::shared_ptr<sql::Statement> selectNamesStatement( db.connection->createStatement() );
   boost::shared_ptr<sql::ResultSet> results( selectNamesStatement->executeQuery("SELECT name FROM timeseries_meta WHERE 1") );
   while (results->next()) {
     // add the name to the list.
@@ -266,13 +353,18 @@ void MysqlPointRecord::fetchPrevious(const std::string& id, time_t time) {
 
 // select just returns the results (no caching)
 std::vector<Point> MysqlPointRecord::selectRange(const std::string& id, time_t start, time_t end) {
+  MysqlConnection& db = mysqlConnection();
   //cout << "mysql range: " << start << " - " << end << endl;
   
   std::vector<Point> points;
-  _rangeSelect->setString(1, id);
-  _rangeSelect->setInt(2, (int)start);
-  _rangeSelect->setInt(3, (int)end);
-  boost::shared_ptr<sql::ResultSet> result( _rangeSelect->executeQuery() );
+  int seriesId = seriesIdForName(id);
+  if (seriesId < 0) {
+    return points;
+  }
+  db.rangeSelect->setInt(1, seriesId);
+  db.rangeSelect->setInt(2, (int)start);
+  db.rangeSelect->setInt(3, (int)end);
+  boost::shared_ptr<sql::ResultSet> result( db.rangeSelect->executeQuery() );
   while (result->next()) {
     time_t time = result->getInt("time");
     double value = result->getDouble("value");
@@ -284,110 +376,357 @@ std::vector<Point> MysqlPointRecord::selectRange(const std::string& id, time_t s
 }
 
 
+// a streamed range, a LIMIT at a time. each chunk picks up along the (series_id,time) index where the last one left
+// off, so none costs more than the rows it returns -- and the connector only ever buffers one chunk.
+time_t MysqlPointRecord::selectChunk(const std::string& id, time_t start, time_t end, size_t maxPoints, std::vector<Point>& chunk) {
+  MysqlConnection& db = mysqlConnection();
+  int seriesId = seriesIdForName(id);
+  if (seriesId < 0) {
+    return end;
+  }
+  db.chunkSelect->setInt(1, seriesId);
+  db.chunkSelect->setInt(2, (int)start);
+  db.chunkSelect->setInt(3, (int)end);
+  db.chunkSelect->setInt(4, (int)maxPoints);
+  boost::shared_ptr<sql::ResultSet> result( db.chunkSelect->executeQuery() );
+  chunk.reserve(maxPoints);
+  while (result->next()) {
+    chunk.push_back(Point(result->getInt("time"), result->getDouble("value")));
+  }
+  return completeChunk(chunk, end, maxPoints);
+}
+
+
+// one query for many series. the IN list can't be a bound parameter, so the statement is built per batch of ids.
+DbPointRecord::keyedPoints_t MysqlPointRecord::selectRanges(const std::vector<std::string>& ids, time_t start, time_t end) {
+  MysqlConnection& db = mysqlConnection();
+  keyedPoints_t results;
+  const size_t batchSize = 500; // keep the statement a sane length
+  
+  // every requested series gets an entry, even if it comes back empty. unknown names have nothing to select.
+  map<int, std::vector<Point>*> pointsBySeriesId;
+  vector<int> seriesIds;
+  BOOST_FOREACH(const string& id, ids) {
+    std::vector<Point>* points = &(results[id]);
+    int seriesId = seriesIdForName(id);
+    if (seriesId >= 0 && pointsBySeriesId.find(seriesId) == pointsBySeriesId.end()) {
+      pointsBySeriesId[seriesId] = points;
+      seriesIds.push_back(seriesId);
+    }
+  }
+  
+  for (size_t batchStart = 0; batchStart < seriesIds.size(); batchStart += batchSize) {
+    size_t batchEnd = (batchStart + batchSize < seriesIds.size()) ? batchStart + batchSize : seriesIds.size();
+  
+    string placeholders;
+    for (size_t i = batchStart; i < batchEnd; ++i) {
+      placeholders += (i == batchStart) ? "?" : ",?";
+    }
+    string rangesSelect = "SELECT series_id, time, value FROM points WHERE series_id IN (" + placeholders + ") AND time >= ? AND time <= ? order by time asc";
+  
+    boost::shared_ptr<sql::PreparedStatement> statement( db.connection->prepareStatement(rangesSelect) );
+    int parameterIndex = 1;
+    for (size_t i = batchStart; i < batchEnd; ++i) {
+      statement->setInt(parameterIndex++, seriesIds.at(i));
+    }
+    statement->setInt(parameterIndex++, (int)start);
+    statement->setInt(parameterIndex++, (int)end);
+  
+    boost::shared_ptr<sql::ResultSet> result( statement->executeQuery() );
+    while (result->next()) {
+      int seriesId = result->getInt("series_id");
+      time_t time = result->getInt("time");
+      double value = result->getDouble("value");
+      pointsBySeriesId[seriesId]->push_back(Point(time, value));
+    }
+  }
+  
+  return results;
+}
+
+
+bool MysqlPointRecord::selectAggregatedRange(const std::string& id, time_t start, time_t end, time_t bucket, std::vector<PointSummary>& summaries) {
+  MysqlConnection& db = mysqlConnection();
+  if (!db.aggregateSelect) {
+    return false;
+  }
+  int seriesId = seriesIdForName(id);
+  if (seriesId < 0) {
+    return true; // nothing stored, so nothing to summarize
+  }
+  db.aggregateSelect->setInt(1, (int)bucket);
+  db.aggregateSelect->setInt(2, (int)bucket);
+  db.aggregateSelect->setInt(3, seriesId);
+  db.aggregateSelect->setInt(4, (int)start);
+  db.aggregateSelect->setInt(5, (int)end);
+  boost::shared_ptr<sql::ResultSet> result( db.aggregateSelect->executeQuery() );
+  while (result->next()) {
+    PointSummary summary((time_t)result->getInt("bucket"), bucket);
+    summary.min = result->getDouble("minimum");
+    summary.max = result->getDouble("maximum");
+    summary.sum = result->getDouble("total");
+    summary.count = (size_t)result->getInt("count");
+    summaries.push_back(summary);
+  }
+  return true;
+}
+
+
 Point MysqlPointRecord::selectNext(const std::string& id, time_t time) {
-  return selectSingle(id, time, _nextSelect);
+  MysqlConnection& db = mysqlConnection();
+  return selectSingle(seriesIdForName(id), time, db.nextSelect);
 }
 
 
 Point MysqlPointRecord::selectPrevious(const std::string& id, time_t time) {
-  return selectSingle(id, time, _previousSelect);
+  MysqlConnection& db = mysqlConnection();
+  return selectSingle(seriesIdForName(id), time, db.previousSelect);
 }
 
 
 
 // insertions or alterations may choose to ignore / deny
 void MysqlPointRecord::insertSingle(const std::string& id, Point point) {
+  MysqlConnection& db = mysqlConnection();
   
   insertSingleNoCommit(id, point);
-  _connection->commit();
+  db.connection->commit();
 }
 
 
-void MysqlPointRecord::insertRange(const std::string& id, std::vector<Point> points) {
-  
-  // first get a list of times already stored here, so that we don't have any overlaps.
-  vector<Point> existing;
-  if (points.size() > 1) {
-    existing = this->selectRange(id, points.front().time, points.back().time);
+void MysqlPointRecord::insertRange(const std::string& id, const std::vector<Point>& points) {
+  MysqlConnection& db = mysqlConnection();
+  insertRangeNoCommit(id, points);
+  db.connection->commit();
+}
+
+// a whole write-behind batch goes in as one transaction.
+void MysqlPointRecord::insertRanges(const keyedPoints_t& pointsById) {
+  MysqlConnection& db = mysqlConnection();
+  typedef keyedPoints_t::value_type keyedPointsValue_t;
+  BOOST_FOREACH(const keyedPointsValue_t& entry, pointsById) {
+    insertRangeNoCommit(entry.first, entry.second);
+  }
+  db.connection->commit();
+}
+
+void MysqlPointRecord::insertRangeNoCommit(const std::string& id, const std::vector<Point>& points) {
+  MysqlConnection& db = mysqlConnection();
+  if (points.empty()) {
+    return;
   }
   
-  vector<time_t> timeList;
-  timeList.reserve(existing.size());
-  BOOST_FOREACH(Point p, existing) {
-    timeList.push_back(p.time);
+  // sorted and unique (first one wins, same as the server would do)
+  vector<Point> scratch;
+  const vector<Point>* batch = &orderedPoints(points, scratch);
+  if (batch == &scratch) {
+    scratch.erase(std::unique(scratch.begin(), scratch.end(), &pointTimesAreEqual), scratch.end());
   }
   
-  // premature optimization is the root of all evil
-  bool existingRange = (timeList.size() > 0)? true : false;
+  try {
+    // resolve the name once, rather than joining on it for every row.
+    int seriesId = seriesIdForName(id);
+    if (seriesId < 0) {
+      RTX_LOG(warning, "MysqlPointRecord", "could not find series: " << id);
+      return;
+    }
   
-  BOOST_FOREACH(Point p, points) {
+    if (!_hasUniqueTimes) {
+      // old schema: the server would happily store duplicates, so weed out the times already stored here.
+      vector<time_t> existing = selectTimes(seriesId, batch->front().time, batch->back().time);
+      if (!existing.empty()) {
+        vector<Point> newPoints;
+        newPoints.reserve(batch->size());
+        vector<time_t>::const_iterator existingIt = existing.begin();
+        BOOST_FOREACH(const Point& p, *batch) {
+          while (existingIt != existing.end() && *existingIt < p.time) {
+            ++existingIt;
+          }
+          if (existingIt == existing.end() || *existingIt != p.time) {
+            newPoints.push_back(p);
+          }
+        }
+        scratch.swap(newPoints);
+        batch = &scratch;
+      }
+    }
   
-    if (existingRange && find(timeList.begin(), timeList.end(), p.time) != timeList.end()) {
-      // have it already
-      continue;
+    // multi-row inserts, full batches through the prepared statement and the remainder through a one-off.
+    vector<Point>::const_iterator pIt = batch->begin();
+    while (pIt != batch->end()) {
+      size_t remaining = batch->end() - pIt;
+      size_t rowCount = (remaining < RTX_MYSQL_BULK_INSERT_ROWS) ? remaining : RTX_MYSQL_BULK_INSERT_ROWS;
+      boost::shared_ptr<sql::PreparedStatement> statement = db.bulkInsert;
+      if (rowCount < RTX_MYSQL_BULK_INSERT_ROWS) {
+        statement.reset( db.connection->prepareStatement(bulkInsertStatement(rowCount)) );
+      }
+      int parameterIndex = 1;
+      for (size_t i = 0; i < rowCount; ++i, ++pIt) {
+        statement->setInt(parameterIndex++, (int)pIt->time);
+        statement->setInt(parameterIndex++, seriesId);
+        statement->setDouble(parameterIndex++, pIt->value);
+      }
+      statement->executeUpdate();
     }
-    else {
-      insertSingleNoCommit(id, p);
+  
+    if (!batch->empty()) {
+      extendRange(id, batch->front().time, batch->back().time);
     }
-    
   }
-  _connection->commit();
+  catch (sql::SQLException &e) {
+    handleException(e);
+  }
 }
 
 void MysqlPointRecord::insertSingleNoCommit(const std::string& id, Point point) {
-  _singleInsert->setInt(1, (int)point.time);
-  // todo -- check this: _singleInsert->setUInt64(1, (uint64_t)time);
-  _singleInsert->setDouble(2, point.value);
-  _singleInsert->setString(3, id);
-  int affected = _singleInsert->executeUpdate();
+  MysqlConnection& db = mysqlConnection();
+  int seriesId = seriesIdForName(id);
+  if (seriesId < 0) {
+    RTX_LOG(warning, "MysqlPointRecord", "could not find series: " << id);
+    return;
+  }
+  db.singleInsert->setInt(1, (int)point.time);
+  // todo -- check this: db.singleInsert->setUInt64(1, (uint64_t)time);
+  db.singleInsert->setInt(2, seriesId);
+  db.singleInsert->setDouble(3, point.value);
+  int affected = db.singleInsert->executeUpdate();
   if (affected == 0) {
     // throw something?
-    cerr << "zero rows inserted" << endl;
+    RTX_LOG(warning, "MysqlPointRecord", "zero rows inserted for " << id << " at " << point.time);
+  }
+  else {
+    extendRange(id, point.time, point.time);
   }
 }
 
+int MysqlPointRecord::seriesIdForName(const std::string& name) {
+  {
+    seriesInfoLock_t infoLock(_seriesInfoMutex);
+    std::map<std::string, seriesInfo_t>::const_iterator found = _seriesInfo.find(name);
+    if (found != _seriesInfo.end() && found->second.id >= 0) {
+      return found->second.id;
+    }
+  }
+  
+  MysqlConnection& db = mysqlConnection();
+  db.seriesIdSelect->setString(1, name);
+  boost::shared_ptr<sql::ResultSet> result( db.seriesIdSelect->executeQuery() );
+  if (!result->next()) {
+    return -1; // not registered. don't remember that, it may be soon.
+  }
+  int seriesId = result->getInt("series_id");
+  seriesInfoLock_t infoLock(_seriesInfoMutex);
+  _seriesInfo[name].id = seriesId;
+  return seriesId;
+}
+
+void MysqlPointRecord::extendRange(const std::string& name, time_t first, time_t last) {
+  seriesInfoLock_t infoLock(_seriesInfoMutex);
+  std::map<std::string, seriesInfo_t>::iterator found = _seriesInfo.find(name);
+  if (found == _seriesInfo.end() || !found->second.rangeKnown) {
+    return; // nobody has asked yet; the first range() call will go to the db.
+  }
+  time_pair_t& range = found->second.range;
+  if (range.first == 0 && range.second == 0) {
+    range = make_pair(first, last);
+  }
+  else {
+    range.first = std::min(range.first, first);
+    range.second = std::max(range.second, last);
+  }
+}
+
+void MysqlPointRecord::forgetSeries() {
+  seriesInfoLock_t infoLock(_seriesInfoMutex);
+  _seriesInfo.clear();
+}
+
+std::vector<time_t> MysqlPointRecord::selectTimes(int seriesId, time_t start, time_t end) {
+  MysqlConnection& db = mysqlConnection();
+  vector<time_t> times;
+  db.timesSelect->setInt(1, seriesId);
+  db.timesSelect->setInt(2, (int)start);
+  db.timesSelect->setInt(3, (int)end);
+  boost::shared_ptr<sql::ResultSet> result( db.timesSelect->executeQuery() );
+  while (result->next()) {
+    times.push_back(result->getInt("time"));
+  }
+  return times;
+}
+
+std::string MysqlPointRecord::bulkInsertStatement(size_t rowCount) {
+  string statement = "INSERT IGNORE INTO points (time, series_id, value) VALUES ";
+  for (size_t i = 0; i < rowCount; ++i) {
+    statement += (i == 0) ? "(?,?,?)" : ",(?,?,?)";
+  }
+  return statement;
+}
+
 void MysqlPointRecord::removeRecord(const string& id) {
+  MysqlConnection& db = mysqlConnection();
   DB_PR_SUPER::reset(id);
   string removePoints = "delete p, m from points p inner join timeseries_meta m on p.series_id=m.series_id where m.name = \"" + id + "\"";
   boost::shared_ptr<sql::Statement> removePointsStmt;
   try {
-    removePointsStmt.reset( _connection->createStatement() );
+    removePointsStmt.reset( db.connection->createStatement() );
     removePointsStmt->executeUpdate(removePoints);
-    _connection->commit();
+    db.connection->commit();
+    seriesInfoLock_t infoLock(_seriesInfoMutex);
+    _seriesInfo.erase(id);
   } catch (sql::SQLException &e) {
     handleException(e);
   }
 }
 
 void MysqlPointRecord::truncate() {
+  MysqlConnection& db = mysqlConnection();
   try {
     string truncatePoints = "TRUNCATE TABLE points";
     string truncateKeys = "TRUNCATE TABLE timeseries_meta";
-    
+  
     boost::shared_ptr<sql::Statement> truncatePointsStmt, truncateKeysStmt;
-    
-    truncatePointsStmt.reset( _connection->createStatement() );
-    truncateKeysStmt.reset( _connection->createStatement() );
-    
+  
+    truncatePointsStmt.reset( db.connection->createStatement() );
+    truncateKeysStmt.reset( db.connection->createStatement() );
+  
     truncatePointsStmt->executeUpdate(truncatePoints);
     truncateKeysStmt->executeUpdate(truncateKeys);
-    
-    _connection->commit();
+  
+    db.connection->commit();
+    forgetSeries();
   }
   catch (sql::SQLException &e) {
     handleException(e);
   }
 }
 
+// as the statements bind them: time and value as int and double, plus the series id where it comes along
+size_t MysqlPointRecord::rowBytes(queryKind_t kind) {
+  switch (kind) {
+    case selectRangesQuery:
+    case insertSingleQuery:
+    case insertRangeQuery:
+    case insertRangesQuery:
+      return 2 * sizeof(int) + sizeof(double);
+    case selectAggregatedQuery:
+      return 2 * sizeof(long long) + 3 * sizeof(double); // bucket, min, max, total and count
+    default:
+      return sizeof(int) + sizeof(double);
+  }
+}
+
 
 
 
 #pragma mark - Private
 
-Point MysqlPointRecord::selectSingle(const string& id, time_t time, boost::shared_ptr<sql::PreparedStatement> statement) {
+Point MysqlPointRecord::selectSingle(int seriesId, time_t time, boost::shared_ptr<sql::PreparedStatement> statement) {
   //cout << "hit MySql: " << time << endl;
   Point point;
-  statement->setString(1, id);
+  if (seriesId < 0) {
+    return point;
+  }
+  statement->setInt(1, seriesId);
   statement->setInt(2, (int)time);
   boost::shared_ptr<sql::ResultSet> result( statement->executeQuery() );
   if( result->next() ) {
@@ -403,24 +742,22 @@ Point MysqlPointRecord::selectSingle(const string& id, time_t time, boost::share
 void MysqlPointRecord::handleException(sql::SQLException &e) {
   /*
    The MySQL Connector/C++ throws three different exceptions:
-   
+  
    - sql::MethodNotImplementedException (derived from sql::SQLException)
    - sql::InvalidArgumentException (derived from sql::SQLException)
    - sql::SQLException (derived from std::runtime_error)
    */
   
-  cerr << endl << "# ERR: DbcException in " << __FILE__ << "(" << __FUNCTION__ << ") on line " << __LINE__ << endl;
   /* Use what(), getErrorCode() and getSQLState() */
-  cerr << "# ERR: " << e.what() << " (MySQL error code: " << e.getErrorCode() << ", SQLState: " << e.getSQLState() << " )" << endl;
+  RTX_LOG(error, "MysqlPointRecord", e.what() << " (MySQL error code: " << e.getErrorCode() << ", SQLState: " << e.getSQLState() << ")");
   
   if (e.getErrorCode() == 1047) {
     /*
      Error: 1047 SQLSTATE: 08S01 (ER_UNKNOWN_COM_ERROR)
      Message: Unknown command
      */
-    cerr << "# ERR: Your server seems not to support PS at all because its MYSQL <4.1" << endl;
+    RTX_LOG(error, "MysqlPointRecord", "your server seems not to support prepared statements at all because its MySQL < 4.1");
   }
-  cerr << "not ok" << endl;
   _connectionOk = false;
 }
 
@@ -435,13 +772,14 @@ void MysqlPointRecord::handleException(sql::SQLException &e) {
 std::ostream& MysqlPointRecord::toStream(std::ostream &stream) {
   stream << "Mysql Point Record (" << _name << ")" << endl;
   
-  
-  if (_connection -> isClosed()) {
+  connectionLease_t lease(*this);
+  if (!_primary || !_primary->connection || _primary->connection->isClosed()) {
     stream << "no connection" << endl;
     return stream;
   }
-    
-  sql::DatabaseMetaData *meta = _connection->getMetaData();
+  
+  MysqlConnection& db = mysqlConnection();
+  sql::DatabaseMetaData *meta = db.connection->getMetaData();
   
 	stream << "\t" << meta->getDatabaseProductName() << " " << meta->getDatabaseProductVersion() << endl;
 	stream << "\tUser: " << meta->getUserName() << endl;
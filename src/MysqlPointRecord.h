@@ -19,18 +19,18 @@ namespace RTX {
   
   /*! \class MysqlPointRecord
    \brief A persistence layer for MySQL databases
-   
+  
    Uses the MySQL C++ library for point storage and retrieval. 
    Primarily used for persistent caching of TimeSeries streams after intensive filtering that you only want to do once in a lifetime
    such as for saving simulation results or cleaned SCADA data.
-   
+  
    */
   
   /*!
-   
+  
    The MySQL connector is based on the JDBC-API, so use the format "tcp://ipaddress.or.name.of.server" or "unix://path/to/unix_socket_file".
    If the Database name passed in does not exist, then it is created for you.
-   
+  
    */
   
   class MysqlPointRecord : public DbPointRecord {
@@ -38,52 +38,87 @@ namespace RTX {
     RTX_SHARED_POINTER(MysqlPointRecord);
     MysqlPointRecord();
     virtual ~MysqlPointRecord();
-    
+  
     virtual void connect() throw(RtxException);
     virtual bool isConnected();
     virtual std::string registerAndGetIdentifier(std::string recordName);
     virtual std::vector<std::string> identifiers();
     virtual time_pair_t range(const string& id);
     virtual std::ostream& toStream(std::ostream &stream);
-    
-    
+  
+  
   protected:
     // fetch means cache the results
     //virtual void fetchRange(const std::string& id, time_t startTime, time_t endTime);
     //virtual void fetchNext(const std::string& id, time_t time);
     //virtual void fetchPrevious(const std::string& id, time_t time);
-    
+  
     // select just returns the results (no caching)
     virtual std::vector<Point> selectRange(const std::string& id, time_t startTime, time_t endTime);
+    virtual time_t selectChunk(const std::string& id, time_t startTime, time_t endTime, size_t maxPoints, std::vector<Point>& chunk);
     virtual Point selectNext(const std::string& id, time_t time);
     virtual Point selectPrevious(const std::string& id, time_t time);
-    
+    virtual keyedPoints_t selectRanges(const std::vector<std::string>& ids, time_t startTime, time_t endTime);
+    virtual bool selectAggregatedRange(const std::string& id, time_t startTime, time_t endTime, time_t bucket, std::vector<PointSummary>& summaries);
+  
     // insertions or alterations may choose to ignore / deny
     virtual void insertSingle(const std::string& id, Point point);
-    virtual void insertRange(const std::string& id, std::vector<Point> points);
+    virtual void insertRange(const std::string& id, const std::vector<Point>& points);
+    virtual void insertRanges(const keyedPoints_t& pointsById);
     virtual void removeRecord(const std::string& id);
     virtual void truncate();
-    
+    virtual size_t rowBytes(queryKind_t kind);
+  
   private:
     void insertSingleNoCommit(const std::string& id, Point point);
+    void insertRangeNoCommit(const std::string& id, const std::vector<Point>& points);
     bool _connectionOk;
     void insertSingle(const string& id, time_t time, double value);
-    Point selectSingle(const string& id, time_t time, boost::shared_ptr<sql::PreparedStatement> statement);
+    Point selectSingle(int seriesId, time_t time, boost::shared_ptr<sql::PreparedStatement> statement);
     void handleException(sql::SQLException &e);
-    string _name;
+    // series metadata, resolved once and kept in memory
+    class seriesInfo_t {
+    public:
+      seriesInfo_t() : id(-1), rangeKnown(false), range(0,0) {};
+      int id;
+      bool rangeKnown;
+      time_pair_t range; // first and last stored times, updated as we insert. writes by other clients aren't seen until reconnect.
+    };
+    std::map<std::string, seriesInfo_t> _seriesInfo;
+    boost::mutex _seriesInfoMutex;
+    int seriesIdForName(const std::string& name);
+    void extendRange(const std::string& name, time_t first, time_t last);
+    void forgetSeries(); //! drop the metadata cache, e.g., after a reconnect or truncate
+    // bulk insertion
+    std::vector<time_t> selectTimes(int seriesId, time_t start, time_t end);
+    static std::string bulkInsertStatement(size_t rowCount);
+    bool _hasUniqueTimes; // the points table has a (series_id,time) unique key, so the server can skip duplicates
+    string _name, _host, _user, _password;
     sql::Driver* _driver;
-    boost::shared_ptr<sql::Connection> _connection;
-    // prepared statements for selecting, inserting
-    boost::shared_ptr<sql::PreparedStatement>  _rangeSelect,
-                                               _singleSelect,
-                                               _nextSelect,
-                                               _previousSelect,
-                                               _singleInsert,
-                                               _firstSelect,
-                                               _lastSelect;
-    
+  
+    //! one connection and its prepared statements for selecting, inserting
+    class MysqlConnection : public connection_t {
+    public:
+      boost::shared_ptr<sql::Connection> connection;
+      boost::shared_ptr<sql::PreparedStatement>  rangeSelect,
+                                                 chunkSelect,
+                                                 singleSelect,
+                                                 nextSelect,
+                                                 previousSelect,
+                                                 singleInsert,
+                                                 extentSelect,
+                                                 seriesIdSelect,
+                                                 timesSelect,
+                                                 aggregateSelect,
+                                                 bulkInsert;
+    };
+    boost::shared_ptr<MysqlConnection> _primary;
+    void prepareStatements(MysqlConnection& db);
+    virtual connectionPointer_t openConnection();
+    MysqlConnection& mysqlConnection(); //! for the calling thread
+  
   };
-
+  
   
 }
 
@@ -8,16 +8,22 @@
 
 
 #include "OdbcPointRecord.h"
+#include "Log.h"
 #include <boost/foreach.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/date_time.hpp>
+#include <boost/lexical_cast.hpp>
 
 using namespace RTX;
 using namespace std;
 
+typedef boost::lock_guard<boost::recursive_mutex> connectionLock_t;
+
 OdbcPointRecord::OdbcPointRecord() : _timeFormat(UTC){
   _connectionOk = false;
+  _nextOffsetSegment = 0;
+  _SCADAenv = SQL_NULL_HENV;
   
   _tableName = "#TABLENAME#";
   _dateCol = "#DATECOL";
@@ -28,7 +34,15 @@ OdbcPointRecord::OdbcPointRecord() : _timeFormat(UTC){
 
 
 OdbcPointRecord::~OdbcPointRecord() {
-  
+  cancelConnect();
+  stopFetching();
+  setWriteBehind(false);
+  // connection handles go before the environment they were allocated from
+  closeConnections();
+  _primary.reset();
+  if (_SCADAenv != SQL_NULL_HENV) {
+    SQLFreeHandle(SQL_HANDLE_ENV, _SCADAenv);
+  }
 }
 
 
@@ -44,6 +58,8 @@ map<OdbcPointRecord::Sql_Connector_t, OdbcPointRecord::odbc_query_t> OdbcPointRe
   wwQueries.lowerBound = "";
   wwQueries.upperBound = "";
   wwQueries.timeQuery = "SELECT CONVERT(datetime, GETDATE()) AS DT";
+  // the historian's own cyclic summaries: one row per wwResolution cycle, starting on the requested start time.
+  wwQueries.summarySelect = "SELECT StartDateTime, Minimum, Maximum, Average, ValueCount FROM AnalogSummaryHistory WHERE (StartDateTime >= ?) AND (EndDateTime <= ?) AND TagName = ? AND wwRetrievalMode = 'Cyclic' AND wwResolution = #RESOLUTION# AND wwTimeZone = 'UTC'";
   
   
   odbc_query_t oraQueries;
@@ -53,6 +69,7 @@ map<OdbcPointRecord::Sql_Connector_t, OdbcPointRecord::odbc_query_t> OdbcPointRe
   oraQueries.lowerBound = "";
   oraQueries.upperBound = "";
   oraQueries.timeQuery = "select sysdate from dual";
+  oraQueries.summarySelect = "";
   
   
   list[wonderware_mssql] = wwQueries;
@@ -70,8 +87,8 @@ OdbcPointRecord::Sql_Connector_t OdbcPointRecord::typeForName(const string& conn
       return connType;
     }
   }
-
-  cerr << "could not resolve connector type: " << connector << endl;
+  
+  RTX_LOG(warning, "OdbcPointRecord", "could not resolve connector type: " << connector);
   return NO_CONNECTOR;
 }
 
@@ -92,7 +109,7 @@ void OdbcPointRecord::setConnectorType(Sql_Connector_t connectorType) {
   
   map<OdbcPointRecord::Sql_Connector_t, OdbcPointRecord::odbc_query_t> qTypes = queryTypes();
   if (qTypes.find(connectorType) == qTypes.end()) {
-    cerr << "could not find the specified connector type" << endl;
+    RTX_LOG(warning, "OdbcPointRecord", "could not find the specified connector type");
     return;
   }
   
@@ -106,7 +123,8 @@ void OdbcPointRecord::setConnectorType(Sql_Connector_t connectorType) {
     querystrings.push_back(&queries.rangeSelect);
     querystrings.push_back(&queries.upperBound);
     querystrings.push_back(&queries.lowerBound);
-    
+    querystrings.push_back(&queries.summarySelect);
+  
     BOOST_FOREACH(string* str, querystrings) {
       boost::replace_all(*str, "#TABLENAME#", _tableName);
       boost::replace_all(*str, "#DATECOL#", _dateCol);
@@ -121,9 +139,8 @@ void OdbcPointRecord::setConnectorType(Sql_Connector_t connectorType) {
   setUpperBoundSelectQuery(queries.upperBound);  // todo
   setLowerBoundSelectQuery(queries.lowerBound);  // todo
   setTimeQuery(queries.timeQuery);
+  setSummarySelectQuery(queries.summarySelect);
   
-  _query.tagNameInd = SQL_NTS;
-
 }
 
 
@@ -134,78 +151,136 @@ void OdbcPointRecord::connect() throw(RtxException) {
   }
   
   
-  SQLRETURN sqlRet;
+  // existing pooled connections were made with the old settings
+  closeConnections();
+  connectionLock_t connectionLock(_connectionMutex);
+  _primary.reset();
   
   try {
-    /* Allocate an environment handle */
-    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &_SCADAenv), "SQLAllocHandle", _SCADAenv, SQL_HANDLE_ENV);
-    /* We want ODBC 3 support */
-    SQL_CHECK(SQLSetEnvAttr(_SCADAenv, SQL_ATTR_ODBC_VERSION, (void *) SQL_OV_ODBC3, 0), "SQLSetEnvAttr", _SCADAenv, SQL_HANDLE_ENV);
-    /* Allocate a connection handle */
-    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_DBC, _SCADAenv, &_SCADAdbc), "SQLAllocHandle", _SCADAenv, SQL_HANDLE_ENV);
-    /* Connect to the DSN, checking for connectivity */
-    //"Attempting to Connect to SCADA..."
-    
-    SQLSMALLINT returnLen;
-    //SQL_CHECK(SQLDriverConnect(_SCADAdbc, NULL, (SQLCHAR*)(this->connectionString()).c_str(), SQL_NTS, NULL, 0, &returnLen, SQL_DRIVER_COMPLETE), "SQLDriverConnect", _SCADAdbc, SQL_HANDLE_DBC);
-    sqlRet = SQLDriverConnect(_SCADAdbc, NULL, (SQLCHAR*)(this->connectionString()).c_str(), SQL_NTS, NULL, 0, &returnLen, SQL_DRIVER_COMPLETE);
-
-    SQL_CHECK(sqlRet, "SQLDriverConnect", _SCADAdbc, SQL_HANDLE_DBC);
-    
-    /* allocate the statement handles for data aquisition */
-    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, _SCADAdbc, &_SCADAstmt), "SQLAllocHandle", _SCADAstmt, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, _SCADAdbc, &_rangeStatement), "SQLAllocHandle", _rangeStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, _SCADAdbc, &_lowerBoundStatement), "SQLAllocHandle", _lowerBoundStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, _SCADAdbc, &_upperBoundStatement), "SQLAllocHandle", _upperBoundStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, _SCADAdbc, &_SCADAtimestmt), "SQLAllocHandle", _SCADAtimestmt, SQL_HANDLE_STMT);
-    
-    // bindings for single point statement
-    /* bind tempRecord members to SQL return columns */
-    bindOutputColumns(_SCADAstmt, &_tempRecord);
-    // bind input parameters, so we can easily change them when we want to make requests.
-    sqlRet = SQLBindParameter(_SCADAstmt, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &_query.start, sizeof(SQL_TIMESTAMP_STRUCT), &_query.startInd);
-    sqlRet = SQLBindParameter(_SCADAstmt, 2, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, MAX_SCADA_TAG, 0, _query.tagName, 0, &_query.tagNameInd);
-    
-    // bindings for the range statement
-    bindOutputColumns(_rangeStatement, &_tempRecord);
-    SQL_CHECK(SQLBindParameter(_rangeStatement, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &_query.start, sizeof(SQL_TIMESTAMP_STRUCT), &_query.startInd), "SQLBindParameter", _rangeStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLBindParameter(_rangeStatement, 2, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &_query.end, sizeof(SQL_TIMESTAMP_STRUCT), &_query.endInd), "SQLBindParameter", _rangeStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLBindParameter(_rangeStatement, 3, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, MAX_SCADA_TAG, 0, _query.tagName, 0, &_query.tagNameInd), "SQLBindParameter", _rangeStatement, SQL_HANDLE_STMT);
-    
-    // bindings for lower bound statement
-    bindOutputColumns(_lowerBoundStatement, &_tempRecord);
-    SQL_CHECK(SQLBindParameter(_lowerBoundStatement, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &_query.start, sizeof(SQL_TIMESTAMP_STRUCT), &_query.startInd), "SQLBindParameter", _lowerBoundStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLBindParameter(_lowerBoundStatement, 2, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &_query.end, sizeof(SQL_TIMESTAMP_STRUCT), &_query.endInd), "SQLBindParameter", _lowerBoundStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLBindParameter(_lowerBoundStatement, 3, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, MAX_SCADA_TAG, 0, _query.tagName, 0, &_query.tagNameInd), "SQLBindParameter", _lowerBoundStatement, SQL_HANDLE_STMT);
-    
-    // bindings for upper bound statement
-    bindOutputColumns(_upperBoundStatement, &_tempRecord);
-    SQL_CHECK(SQLBindParameter(_upperBoundStatement, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &_query.start, sizeof(SQL_TIMESTAMP_STRUCT), &_query.startInd), "SQLBindParameter", _upperBoundStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLBindParameter(_upperBoundStatement, 2, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &_query.end, sizeof(SQL_TIMESTAMP_STRUCT), &_query.endInd), "SQLBindParameter", _upperBoundStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLBindParameter(_upperBoundStatement, 3, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, MAX_SCADA_TAG, 0, _query.tagName, 0, &_query.tagNameInd), "SQLBindParameter", _upperBoundStatement, SQL_HANDLE_STMT);
-    
-    
-    // prepare the statements
-    SQL_CHECK(SQLPrepare(_SCADAstmt, (SQLCHAR*)singleSelectQuery().c_str(), SQL_NTS), "SQLPrepare", _SCADAstmt, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLPrepare(_rangeStatement, (SQLCHAR*)rangeSelectQuery().c_str(), SQL_NTS), "SQLPrepare", _rangeStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLPrepare(_SCADAtimestmt, (SQLCHAR*)timeQuery().c_str(), SQL_NTS), "SQLPrepare", _SCADAtimestmt, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLPrepare(_lowerBoundStatement, (SQLCHAR*)loweBoundSelectQuery().c_str(), SQL_NTS), "SQLPrepare", _lowerBoundStatement, SQL_HANDLE_STMT);
-    SQL_CHECK(SQLPrepare(_upperBoundStatement, (SQLCHAR*)upperBoundSelectQuery().c_str(), SQL_NTS), "SQLPrepare", _upperBoundStatement, SQL_HANDLE_STMT);
-    
+    if (_SCADAenv == SQL_NULL_HENV) {
+      /* Allocate an environment handle */
+      SQL_CHECK(SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &_SCADAenv), "SQLAllocHandle", _SCADAenv, SQL_HANDLE_ENV);
+      /* We want ODBC 3 support */
+      SQL_CHECK(SQLSetEnvAttr(_SCADAenv, SQL_ATTR_ODBC_VERSION, (void *) SQL_OV_ODBC3, 0), "SQLSetEnvAttr", _SCADAenv, SQL_HANDLE_ENV);
+    }
+  
+    boost::shared_ptr<OdbcConnection> db( new OdbcConnection() );
+    openHandles(*db);
+    _primary = db;
+  
     // if we made it this far...
     _connectionOk = true;
-    
+  
   } catch (string errorMessage) {
-    cerr << "Initialize failed: " << errorMessage << "\n";
+    RTX_LOG(error, "OdbcPointRecord", "initialize failed: " << errorMessage);
     _connectionOk = false;
     //throw DbPointRecord::RtxDbConnectException();
   }
   
   // todo -- check time offset (dst?)
+  
+}
 
+
+#pragma mark - Connections
+
+OdbcPointRecord::OdbcConnection::OdbcConnection() {
+  dbc = SQL_NULL_HDBC;
+  singleStatement = rangeStatement = lowerBoundStatement = upperBoundStatement = timeStatement = SQL_NULL_HSTMT;
+  rangeBlock.reset( new ScadaRecordBlock() );
+  query.tagNameInd = SQL_NTS;
 }
 
+OdbcPointRecord::OdbcConnection::~OdbcConnection() {
+  SQLHSTMT statements[] = {singleStatement, rangeStatement, lowerBoundStatement, upperBoundStatement, timeStatement};
+  BOOST_FOREACH(SQLHSTMT statement, statements) {
+    if (statement != SQL_NULL_HSTMT) {
+      SQLFreeHandle(SQL_HANDLE_STMT, statement);
+    }
+  }
+  if (dbc != SQL_NULL_HDBC) {
+    SQLDisconnect(dbc);
+    SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+  }
+}
+
+// connect a new handle and set up its statements. the statement bindings point into db's own buffers.
+void OdbcPointRecord::openHandles(OdbcConnection& db) throw(string) {
+  SQLRETURN sqlRet;
+  
+  /* Allocate a connection handle */
+  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_DBC, _SCADAenv, &db.dbc), "SQLAllocHandle", _SCADAenv, SQL_HANDLE_ENV);
+  /* Connect to the DSN, checking for connectivity */
+  //"Attempting to Connect to SCADA..."
+  
+  SQLSMALLINT returnLen;
+  //SQL_CHECK(SQLDriverConnect(db.dbc, NULL, (SQLCHAR*)(this->connectionString()).c_str(), SQL_NTS, NULL, 0, &returnLen, SQL_DRIVER_COMPLETE), "SQLDriverConnect", db.dbc, SQL_HANDLE_DBC);
+  sqlRet = SQLDriverConnect(db.dbc, NULL, (SQLCHAR*)(this->connectionString()).c_str(), SQL_NTS, NULL, 0, &returnLen, SQL_DRIVER_COMPLETE);
+  
+  SQL_CHECK(sqlRet, "SQLDriverConnect", db.dbc, SQL_HANDLE_DBC);
+  
+  /* allocate the statement handles for data aquisition */
+  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, db.dbc, &db.singleStatement), "SQLAllocHandle", db.singleStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, db.dbc, &db.rangeStatement), "SQLAllocHandle", db.rangeStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, db.dbc, &db.lowerBoundStatement), "SQLAllocHandle", db.lowerBoundStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, db.dbc, &db.upperBoundStatement), "SQLAllocHandle", db.upperBoundStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, db.dbc, &db.timeStatement), "SQLAllocHandle", db.timeStatement, SQL_HANDLE_STMT);
+  
+  // bindings for single point statement
+  /* bind tempRecord members to SQL return columns */
+  bindOutputColumns(db.singleStatement, &db.tempRecord);
+  // bind input parameters, so we can easily change them when we want to make requests.
+  sqlRet = SQLBindParameter(db.singleStatement, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &db.query.start, sizeof(SQL_TIMESTAMP_STRUCT), &db.query.startInd);
+  sqlRet = SQLBindParameter(db.singleStatement, 2, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, MAX_SCADA_TAG, 0, db.query.tagName, 0, &db.query.tagNameInd);
+  
+  // the range-type statements fetch a block of rows at a time
+  SQLHSTMT rangeStatements[] = {db.rangeStatement, db.lowerBoundStatement, db.upperBoundStatement};
+  BOOST_FOREACH(SQLHSTMT statement, rangeStatements) {
+    bindOutputBlock(statement, db.rangeBlock.get());
+    SQL_CHECK(SQLBindParameter(statement, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &db.query.start, sizeof(SQL_TIMESTAMP_STRUCT), &db.query.startInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindParameter(statement, 2, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &db.query.end, sizeof(SQL_TIMESTAMP_STRUCT), &db.query.endInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindParameter(statement, 3, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, MAX_SCADA_TAG, 0, db.query.tagName, 0, &db.query.tagNameInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+  }
+  
+  // prepare the statements
+  SQL_CHECK(SQLPrepare(db.singleStatement, (SQLCHAR*)singleSelectQuery().c_str(), SQL_NTS), "SQLPrepare", db.singleStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLPrepare(db.rangeStatement, (SQLCHAR*)rangeSelectQuery().c_str(), SQL_NTS), "SQLPrepare", db.rangeStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLPrepare(db.timeStatement, (SQLCHAR*)timeQuery().c_str(), SQL_NTS), "SQLPrepare", db.timeStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLPrepare(db.lowerBoundStatement, (SQLCHAR*)loweBoundSelectQuery().c_str(), SQL_NTS), "SQLPrepare", db.lowerBoundStatement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLPrepare(db.upperBoundStatement, (SQLCHAR*)upperBoundSelectQuery().c_str(), SQL_NTS), "SQLPrepare", db.upperBoundStatement, SQL_HANDLE_STMT);
+}
+
+// another connection for the pool
+DbPointRecord::connectionPointer_t OdbcPointRecord::openConnection() {
+  boost::shared_ptr<OdbcConnection> db;
+  if (!_connectionOk) {
+    return db;
+  }
+  try {
+    db.reset( new OdbcConnection() );
+    openHandles(*db);
+  }
+  catch (string errorMessage) {
+    RTX_LOG(error, "OdbcPointRecord", "could not open pooled connection: " << errorMessage);
+    db.reset();
+  }
+  return db;
+}
+
+// the connection checked out by this thread, or the primary.
+OdbcPointRecord::OdbcConnection& OdbcPointRecord::odbcConnection() {
+  connection_t* leased = leasedConnection();
+  if (leased) {
+    return *static_cast<OdbcConnection*>(leased);
+  }
+  return *_primary;
+}
+
+
+#pragma mark -
+
 bool OdbcPointRecord::isConnected() {
+  ensureConnected();
   return _connectionOk;
 }
 
@@ -226,8 +301,10 @@ vector<string> OdbcPointRecord::identifiers() {
   SQLRETURN retCode;
   SQLLEN tagLengthInd;
   
-  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, _SCADAdbc, &tagStmt), "SQLAllocHandle", _SCADAstmt, SQL_HANDLE_STMT);
-  SQL_CHECK(SQLPrepare(tagStmt, (SQLCHAR*)tagQuery.c_str(), SQL_NTS), "identifiers", _SCADAdbc, SQL_HANDLE_DBC);
+  connectionLease_t lease(*this);
+  OdbcConnection& db = odbcConnection();
+  SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, db.dbc, &tagStmt), "SQLAllocHandle", db.dbc, SQL_HANDLE_DBC);
+  SQL_CHECK(SQLPrepare(tagStmt, (SQLCHAR*)tagQuery.c_str(), SQL_NTS), "identifiers", db.dbc, SQL_HANDLE_DBC);
   SQL_CHECK(SQLExecute(tagStmt), "SQLExecute", tagStmt, SQL_HANDLE_STMT);
   
   while (true) {
@@ -274,21 +351,176 @@ void OdbcPointRecord::fetchPrevious(const string& id, time_t time) {
 
 // select just returns the results (no caching)
 vector<Point> OdbcPointRecord::selectRange(const string& id, time_t startTime, time_t endTime) {
-  return pointsWithStatement(id, _rangeStatement, startTime, endTime);
+  return pointsWithStatement(id, &OdbcConnection::rangeStatement, startTime, endTime);
+}
+
+
+// a streamed range: the range query on its forward-only cursor, read as far as a chunk and then closed, so the
+// driver is never asked for (or made to buffer) the rest of it.
+time_t OdbcPointRecord::selectChunk(const string& id, time_t startTime, time_t endTime, size_t maxPoints, vector<Point>& chunk) {
+  chunk = pointsWithStatement(id, &OdbcConnection::rangeStatement, startTime, endTime, maxPoints);
+  if (chunk.size() > maxPoints) {
+    chunk.resize(maxPoints);
+  }
+  return completeChunk(chunk, endTime, maxPoints);
+}
+
+
+// one multi-tag query for many series. the range query's tag parameter is swapped for an IN list of quoted names.
+DbPointRecord::keyedPoints_t OdbcPointRecord::selectRanges(const vector<string>& ids, time_t startTime, time_t endTime) {
+  string tagClause = _tagCol + " = ?";
+  if (!_connectionOk || rangeSelectQuery().find(tagClause) == string::npos || startTime == 0 || endTime == 0) {
+    // not a query we know how to widen
+    return DbPointRecord::selectRanges(ids, startTime, endTime);
+  }
+  
+  keyedPoints_t results;
+  const size_t batchSize = 100; // keep the statement a sane length
+  
+  for (size_t batchStart = 0; batchStart < ids.size(); batchStart += batchSize) {
+    size_t batchEnd = (batchStart + batchSize < ids.size()) ? batchStart + batchSize : ids.size();
+  
+    string tagList;
+    for (size_t i = batchStart; i < batchEnd; ++i) {
+      string quoted = ids.at(i);
+      boost::replace_all(quoted, "'", "''");
+      tagList += ((i == batchStart) ? "'" : ",'") + quoted + "'";
+      results[ids.at(i)]; // every requested series gets an entry, even if it comes back empty.
+    }
+    string rangesQuery = rangeSelectQuery();
+    boost::replace_first(rangesQuery, tagClause, _tagCol + " IN (" + tagList + ")");
+  
+    SQLHSTMT statement = SQL_NULL_HSTMT;
+    boost::shared_ptr<ScadaRecordBlock> block( new ScadaRecordBlock() );
+    ScadaQuery query;
+    query.start = sqlTime(startTime-1);
+    query.end = sqlTime(endTime+1); // add one second to get fractional times included
+    query.startInd = 0;
+    query.endInd = 0;
+  
+    try {
+      SQLHDBC dbc = odbcConnection().dbc;
+      SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &statement), "SQLAllocHandle", dbc, SQL_HANDLE_DBC);
+      bindOutputBlock(statement, block.get());
+      SQL_CHECK(SQLBindParameter(statement, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &query.start, sizeof(SQL_TIMESTAMP_STRUCT), &query.startInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+      SQL_CHECK(SQLBindParameter(statement, 2, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &query.end, sizeof(SQL_TIMESTAMP_STRUCT), &query.endInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+      SQL_CHECK(SQLExecDirect(statement, (SQLCHAR*)rangesQuery.c_str(), SQL_NTS), "SQLExecDirect", statement, SQL_HANDLE_STMT);
+  
+      // a rowset at a time. consecutive rows are nearly always the same tag, so remember the last lookup.
+      keyedPoints_t::iterator found = results.end();
+      while (SQL_SUCCEEDED(SQLFetch(statement))) {
+        for (SQLULEN row = 0; row < block->rowsFetched; ++row) {
+          if (!blockRowIsValid(*block, row) || block->tagNameInd[row] <= 0) {
+            continue;
+          }
+          string tagName((char*)block->tagName[row]);
+          boost::trim_right(tagName);
+          if (found == results.end() || found->first != tagName) {
+            found = results.find(tagName);
+          }
+          if (found == results.end()) {
+            // not one of ours -- the server may have changed the case
+            found = results.begin();
+            while (found != results.end() && !boost::iequals(found->first, tagName)) {
+              ++found;
+            }
+            if (found == results.end()) {
+              continue;
+            }
+          }
+          found->second.push_back(Point(sql_to_tm(block->time[row]), block->value[row], Point::Qual_t::good));
+        }
+      }
+      SQLFreeHandle(SQL_HANDLE_STMT, statement);
+    }
+    catch(string errorMessage) {
+      if (statement != SQL_NULL_HSTMT) {
+        SQLFreeHandle(SQL_HANDLE_STMT, statement);
+      }
+      RTX_LOG(error, "OdbcPointRecord", errorMessage << " -- could not get data from db connection; attempting to reconnect");
+      this->connect();
+      RTX_LOG(info, "OdbcPointRecord", "connection returned " << this->isConnected());
+      break;
+    }
+  }
+  
+  return results;
+}
+
+
+// summaries from the historian, where the connector has a query for them. wonderware's average is time-weighted, so
+// the bucket sums are the average times the sample count rather than a literal sum.
+bool OdbcPointRecord::selectAggregatedRange(const string& id, time_t startTime, time_t endTime, time_t bucket, vector<PointSummary>& summaries) {
+  if (!_connectionOk || summarySelectQuery().empty() || startTime == 0 || endTime == 0) {
+    return false;
+  }
+  string summaryQuery = summarySelectQuery();
+  boost::replace_all(summaryQuery, "#RESOLUTION#", boost::lexical_cast<string>((long long)bucket * 1000));
+  
+  SQLHSTMT statement = SQL_NULL_HSTMT;
+  ScadaQuery query;
+  query.start = sqlTime(startTime);
+  query.end = sqlTime(endTime + 1); // the last bucket ends on the next boundary
+  strncpy(query.tagName, id.c_str(), MAX_SCADA_TAG - 1);
+  query.tagName[MAX_SCADA_TAG - 1] = '\0';
+  query.startInd = 0;
+  query.endInd = 0;
+  query.tagNameInd = SQL_NTS;
+  
+  SQL_TIMESTAMP_STRUCT bucketStart;
+  double minimum, maximum, average;
+  SQLINTEGER valueCount;
+  SQLLEN bucketStartInd, minimumInd, maximumInd, averageInd, valueCountInd;
+  
+  try {
+    SQLHDBC dbc = odbcConnection().dbc;
+    SQL_CHECK(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &statement), "SQLAllocHandle", dbc, SQL_HANDLE_DBC);
+    SQL_CHECK(SQLBindParameter(statement, 1, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &query.start, sizeof(SQL_TIMESTAMP_STRUCT), &query.startInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindParameter(statement, 2, SQL_PARAM_INPUT, SQL_C_TYPE_TIMESTAMP, SQL_TYPE_TIMESTAMP, 0, 0, &query.end, sizeof(SQL_TIMESTAMP_STRUCT), &query.endInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindParameter(statement, 3, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, MAX_SCADA_TAG, 0, query.tagName, 0, &query.tagNameInd), "SQLBindParameter", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindCol(statement, 1, SQL_C_TYPE_TIMESTAMP, &bucketStart, 0, &bucketStartInd), "SQLBindCol", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindCol(statement, 2, SQL_C_DOUBLE, &minimum, 0, &minimumInd), "SQLBindCol", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindCol(statement, 3, SQL_C_DOUBLE, &maximum, 0, &maximumInd), "SQLBindCol", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindCol(statement, 4, SQL_C_DOUBLE, &average, 0, &averageInd), "SQLBindCol", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLBindCol(statement, 5, SQL_C_SLONG, &valueCount, 0, &valueCountInd), "SQLBindCol", statement, SQL_HANDLE_STMT);
+    SQL_CHECK(SQLExecDirect(statement, (SQLCHAR*)summaryQuery.c_str(), SQL_NTS), "SQLExecDirect", statement, SQL_HANDLE_STMT);
+  
+    while (SQL_SUCCEEDED(SQLFetch(statement))) {
+      if (bucketStartInd <= 0 || valueCountInd <= 0 || valueCount <= 0 || minimumInd <= 0 || maximumInd <= 0 || averageInd <= 0) {
+        continue; // an empty cycle
+      }
+      PointSummary summary(sql_to_tm(bucketStart), bucket);
+      summary.min = minimum;
+      summary.max = maximum;
+      summary.count = (size_t)valueCount;
+      summary.sum = average * valueCount;
+      summaries.push_back(summary);
+    }
+    SQLFreeHandle(SQL_HANDLE_STMT, statement);
+  }
+  catch(string errorMessage) {
+    if (statement != SQL_NULL_HSTMT) {
+      SQLFreeHandle(SQL_HANDLE_STMT, statement);
+    }
+    RTX_LOG(warning, "OdbcPointRecord", errorMessage << " -- could not get summaries from db connection; falling back to raw points");
+    summaries.clear();
+    return false;
+  }
+  return true;
 }
 
 
 Point OdbcPointRecord::selectNext(const string& id, time_t time) {
   Point p;
   time_t margin = 60*60*12;
-  vector<Point> points = pointsWithStatement(id, _rangeStatement, time-1, time + margin);
+  vector<Point> points = pointsWithStatement(id, &OdbcConnection::rangeStatement, time-1, time + margin);
   
   time_t max_margin = this->searchDistance();
   time_t lookahead = time;
   while (points.size() == 0 && lookahead < time + max_margin) {
     //cout << "scada lookahead" << endl;
     lookahead += margin;
-    points = pointsWithStatement(id, _rangeStatement, time-1, lookahead+margin);
+    points = pointsWithStatement(id, &OdbcConnection::rangeStatement, time-1, lookahead+margin);
   }
   
   if (points.size() > 0) {
@@ -300,7 +532,7 @@ Point OdbcPointRecord::selectNext(const string& id, time_t time) {
     }
   }
   if (points.empty()) {
-    cerr << "no points found for " << id << " :: range " << time - 1 << " - " << lookahead + margin << endl;
+    RTX_LOG(debug, "OdbcPointRecord", "no points found for " << id << " :: range " << time - 1 << " - " << lookahead + margin);
   }
   return p;
 }
@@ -309,17 +541,17 @@ Point OdbcPointRecord::selectNext(const string& id, time_t time) {
 Point OdbcPointRecord::selectPrevious(const string& id, time_t time) {
   Point p;
   time_t margin = 60*60*12;
-  vector<Point> points = pointsWithStatement(id, _rangeStatement, time - margin, time+1);
+  vector<Point> points = pointsWithStatement(id, &OdbcConnection::rangeStatement, time - margin, time+1);
   
   time_t max_margin = this->searchDistance();
   time_t lookbehind = time;
   while (points.size() == 0 && lookbehind > time - max_margin) {
     //cout << "scada lookbehind" << endl;
     lookbehind -= margin;
-    points = pointsWithStatement(id, _rangeStatement, lookbehind-margin, time+1);
+    points = pointsWithStatement(id, &OdbcConnection::rangeStatement, lookbehind-margin, time+1);
   }
-  // sanity
-  while (!points.empty() && points.back().time > time) {
+  // sanity -- strictly before
+  while (!points.empty() && points.back().time >= time) {
     points.pop_back();
   }
   
@@ -327,7 +559,7 @@ Point OdbcPointRecord::selectPrevious(const string& id, time_t time) {
     p = points.back();
   }
   if (points.empty()) {
-    cerr << "no points found for " << id << " :: range " << lookbehind-margin << " - " << time+1 << endl;
+    RTX_LOG(debug, "OdbcPointRecord", "no points found for " << id << " :: range " << lookbehind-margin << " - " << time+1);
   }
   return p;
 }
@@ -340,7 +572,7 @@ void OdbcPointRecord::insertSingle(const string& id, Point point) {
 }
 
 
-void OdbcPointRecord::insertRange(const string& id, vector<Point> points) {
+void OdbcPointRecord::insertRange(const string& id, const vector<Point>& points) {
   
 }
 
@@ -354,6 +586,20 @@ void OdbcPointRecord::truncate() {
   
 }
 
+// a row as it's bound: the tag name buffer, a timestamp struct, the value and quality. nothing is ever written.
+size_t OdbcPointRecord::rowBytes(queryKind_t kind) {
+  switch (kind) {
+    case selectAggregatedQuery:
+      return sizeof(SQL_TIMESTAMP_STRUCT) + 3 * sizeof(double) + sizeof(SQLINTEGER);
+    case insertSingleQuery:
+    case insertRangeQuery:
+    case insertRangesQuery:
+      return 0;
+    default:
+      return MAX_SCADA_TAG + sizeof(SQL_TIMESTAMP_STRUCT) + sizeof(double) + sizeof(int);
+  }
+}
+
 
 
 
@@ -371,54 +617,47 @@ ostream& OdbcPointRecord::toStream(ostream &stream) {
 #pragma mark - Internal (private) methods
 
 
-vector<Point> OdbcPointRecord::pointsWithStatement(const string& id, SQLHSTMT statement, time_t startTime, time_t endTime) {
+vector<Point> OdbcPointRecord::pointsWithStatement(const string& id, SQLHSTMT OdbcConnection::*whichStatement, time_t startTime, time_t endTime, size_t maxPoints) {
   vector< Point > points;
   points.clear();
   
   
-  if (startTime == 0 || endTime == 0) {
+  if (startTime == 0 || endTime == 0 || !_connectionOk) {
     // something smells
     return points;
   }
   
-  // make sure the request paramter cache is current. (super uses this)
-  request = request_t(id,startTime, endTime);
-  
-  // set up query-bound variables
-  _query.start = sqlTime(startTime-1);
-  _query.end = sqlTime(endTime+1); // add one second to get fractional times included
-  strcpy(_query.tagName, id.c_str());
+  // set up query-bound variables. the statement belongs to this thread's connection, and is bound to its buffers.
+  OdbcConnection& db = odbcConnection();
+  SQLHSTMT statement = db.*whichStatement;
+  db.query.start = sqlTime(startTime-1);
+  db.query.end = sqlTime(endTime+1); // add one second to get fractional times included
+  strcpy(db.query.tagName, id.c_str());
   
   try {
     //cout << "scada: " << id << " : " << startTime << " - " << endTime << endl;
     SQL_CHECK(SQLExecute(statement), "SQLExecute", statement, SQL_HANDLE_STMT);
-    while (SQL_SUCCEEDED(SQLFetch(statement))) {
-      Point p;
-      //time_t t = unixTime(_tempRecord.time);
-      time_t t = sql_to_tm(_tempRecord.time);
-      double v = _tempRecord.value;
-      int qu = _tempRecord.quality;
-      Point::Qual_t q = Point::Qual_t::good; // todo -- map to rtx quality types
-      
-      if (_tempRecord.valueInd > 0 && qu == 0) {
-        // ok
-        p = Point(t, v, q);
-        points.push_back(p);
-      }
-      else {
-        // nothing
-        //cout << "skipped invalid point. quality = " << _tempRecord.quality << endl;
+    // each fetch fills a whole rowset in the bound block.
+    const ScadaRecordBlock& block = *db.rangeBlock;
+    while ((maxPoints == 0 || points.size() < maxPoints) && SQL_SUCCEEDED(SQLFetch(statement))) {
+      points.reserve(points.size() + block.rowsFetched);
+      for (SQLULEN row = 0; row < block.rowsFetched; ++row) {
+        Point::Qual_t q = Point::Qual_t::good; // todo -- map to rtx quality types
+        if (blockRowIsValid(block, row)) {
+          points.push_back(Point(sql_to_tm(block.time[row]), block.value[row], q));
+        }
+        else {
+          // nothing
+          //cout << "skipped invalid point. quality = " << block.quality[row] << endl;
+        }
       }
-      
     }
     SQL_CHECK(SQLFreeStmt(statement, SQL_CLOSE), "SQLCancel", statement, SQL_HANDLE_STMT);
   }
   catch(string errorMessage) {
-    cerr << errorMessage << endl;
-    cerr << "Could not get data from db connection\n";
-    cerr << "Attempting to reconnect..." << endl;
+    RTX_LOG(error, "OdbcPointRecord", errorMessage << " -- could not get data from db connection; attempting to reconnect");
     this->connect();
-    cerr << "Connection returned " << this->isConnected() << endl;
+    RTX_LOG(info, "OdbcPointRecord", "connection returned " << this->isConnected());
   }
   
   if (points.size() == 0) {
@@ -439,152 +678,166 @@ void OdbcPointRecord::bindOutputColumns(SQLHSTMT statement, ScadaRecord* record)
 
 
 
-
-SQL_TIMESTAMP_STRUCT OdbcPointRecord::sqlTime(time_t unixTime) {
-  SQL_TIMESTAMP_STRUCT sqlTimestamp;
-  struct tm myTMstruct;
-  struct tm* pTMstruct = &myTMstruct;
+// column-wise row-array binding: each SQLFetch fills up to RTX_ODBC_ROWSET_SIZE rows. a driver that can't do
+// arrays will knock the size down, and rowsFetched still says how many rows came back.
+void OdbcPointRecord::bindOutputBlock(SQLHSTMT statement, ScadaRecordBlock* block) {
+  SQL_CHECK(SQLSetStmtAttr(statement, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0), "SQLSetStmtAttr", statement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLSetStmtAttr(statement, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)RTX_ODBC_ROWSET_SIZE, 0), "SQLSetStmtAttr", statement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLSetStmtAttr(statement, SQL_ATTR_ROW_STATUS_PTR, block->rowStatus, 0), "SQLSetStmtAttr", statement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLSetStmtAttr(statement, SQL_ATTR_ROWS_FETCHED_PTR, &(block->rowsFetched), 0), "SQLSetStmtAttr", statement, SQL_HANDLE_STMT);
+  block->rowsFetched = 0;
   
-  // time format (local/utc)
-  if (timeFormat() == UTC) {
-    pTMstruct = gmtime(&unixTime);
-  }
-  else if (timeFormat() == LOCAL) {
-    pTMstruct = localtime(&unixTime);
-  }
-  /*
-	if (pTMstruct->tm_isdst == 1) {
-    pTMstruct->tm_hour -= 1;
+  SQL_CHECK(SQLBindCol(statement, 1, SQL_C_TYPE_TIMESTAMP, block->time, sizeof(SQL_TIMESTAMP_STRUCT), block->timeInd ), "SQLBindCol", statement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLBindCol(statement, 2, SQL_C_CHAR, block->tagName, MAX_SCADA_TAG, block->tagNameInd ), "SQLBindCol", statement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLBindCol(statement, 3, SQL_C_DOUBLE, block->value, 0, block->valueInd ), "SQLBindCol", statement, SQL_HANDLE_STMT);
+  SQL_CHECK(SQLBindCol(statement, 4, SQL_C_ULONG, block->quality, 0, block->qualityInd ), "SQLBindCol", statement, SQL_HANDLE_STMT);
+}
+
+bool OdbcPointRecord::blockRowIsValid(const ScadaRecordBlock& block, SQLULEN row) {
+  SQLUSMALLINT status = block.rowStatus[row];
+  if (status != SQL_ROW_SUCCESS && status != SQL_ROW_SUCCESS_WITH_INFO) {
+    return false;
   }
-  */
-  // fix any negative hour field
-  // not needed.
-  //mktime(pTMstruct);
-	
-	sqlTimestamp.year = pTMstruct->tm_year + 1900;
-	sqlTimestamp.month = pTMstruct->tm_mon + 1;
-	sqlTimestamp.day = pTMstruct->tm_mday;
-	sqlTimestamp.hour = pTMstruct->tm_hour;
-  sqlTimestamp.minute = pTMstruct->tm_min;
-	sqlTimestamp.second = pTMstruct->tm_sec;
-	sqlTimestamp.fraction = (SQLUINTEGER)0;
-  
-  
-  
-  return sqlTimestamp;
+  return (block.valueInd[row] > 0 && block.quality[row] == 0);
 }
 
-time_t OdbcPointRecord::unixTime(SQL_TIMESTAMP_STRUCT sqlTime) {
-  time_t myUnixTime;
-  struct tm tmTimestamp;
-  tmTimestamp.tm_isdst = 0;
-  struct tm* pTimestamp = &tmTimestamp;
-  const time_t timestamp = time(NULL);
-  pTimestamp = localtime(&timestamp);
-  
-  tmTimestamp.tm_year = sqlTime.year - 1900;
-  tmTimestamp.tm_mon = sqlTime.month -1;
-  tmTimestamp.tm_mday = sqlTime.day;
-  tmTimestamp.tm_hour = sqlTime.hour;
-  tmTimestamp.tm_min = sqlTime.minute;
-  tmTimestamp.tm_sec = sqlTime.second;
-  
-  
-  myUnixTime = mktime(&tmTimestamp);
-  // mktime sets to local time zone, but the passed-in structure should be UTC
-  if (timeFormat() == UTC) {
-    myUnixTime += pTimestamp->tm_gmtoff;
+
+
+#pragma mark - Time Conversion
+
+// every bound parameter and every fetched row goes through here, so the calendar math is done directly instead of
+// through gmtime/timegm/localtime (which are slow, and take a lock for the local zone). days-from-civil is the
+// usual proleptic-gregorian era arithmetic, good for any year.
+
+time_t OdbcPointRecord::epochFromCivil(long year, long month, long day, long hour, long minute, long second) {
+  year -= (month <= 2) ? 1 : 0;
+  long era = ((year >= 0) ? year : year - 399) / 400;
+  long yearOfEra = year - era * 400;                                         // [0, 399]
+  long dayOfYear = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1; // [0, 365], from march 1
+  long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  long days = era * 146097 + dayOfEra - 719468;                              // from 1970-01-01
+  return (time_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+void OdbcPointRecord::civilFromEpoch(time_t epoch, SQL_TIMESTAMP_STRUCT& civil) {
+  long days = (long)(epoch / 86400);
+  long seconds = (long)(epoch % 86400);
+  if (seconds < 0) {
+    seconds += 86400;
+    --days;
   }
-  if (tmTimestamp.tm_isdst == 1) {
-    myUnixTime -= 3600;
+  days += 719468;
+  long era = ((days >= 0) ? days : days - 146096) / 146097;
+  long dayOfEra = days - era * 146097;
+  long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  long monthPrime = (5 * dayOfYear + 2) / 153;
+  long month = (monthPrime < 10) ? monthPrime + 3 : monthPrime - 9;
+  
+  civil.year = (SQLSMALLINT)(yearOfEra + era * 400 + ((month <= 2) ? 1 : 0));
+  civil.month = (SQLUSMALLINT)month;
+  civil.day = (SQLUSMALLINT)(dayOfYear - (153 * monthPrime + 2) / 5 + 1);
+  civil.hour = (SQLUSMALLINT)(seconds / 3600);
+  civil.minute = (SQLUSMALLINT)((seconds / 60) % 60);
+  civil.second = (SQLUSMALLINT)(seconds % 60);
+  civil.fraction = (SQLUINTEGER)0;
+}
+
+static long utcOffsetAt(time_t time) {
+  struct tm localTm;
+  localtime_r(&time, &localTm);
+  return localTm.tm_gmtoff;
+}
+
+// seconds east of UTC at this instant. the offset only changes at DST transitions, so the stretch around the asked-for
+// time is searched out once (weekly steps, then bisection to the second), and anything else inside it is a lookup.
+long OdbcPointRecord::localOffset(time_t time) {
+  boost::lock_guard<boost::mutex> offsetLock(_offsetMutex);
+  for (int i = 0; i < RTX_ODBC_OFFSET_SEGMENTS; ++i) {
+    const offsetSegment_t& segment = _offsetSegments[i];
+    if (segment.start <= time && time < segment.end) {
+      return segment.offset;
+    }
   }
   
-  // todo -- we can speed up mktime, but this private method is borked so fix it.
-  //myUnixTime = time_to_epoch(&tmTimestamp, 0);
-  
-  
+  const time_t step = 60*60*24*7;
+  const int maxSteps = 60; // a bit over a year either way
+  long offset = utcOffsetAt(time);
+  
+  time_t start = time;
+  for (int i = 0; i < maxSteps; ++i) {
+    time_t probe = start - step;
+    if (utcOffsetAt(probe) != offset) {
+      // transition in (probe, start]
+      while (start - probe > 1) {
+        time_t mid = probe + (start - probe) / 2;
+        if (utcOffsetAt(mid) == offset) {
+          start = mid;
+        }
+        else {
+          probe = mid;
+        }
+      }
+      break;
+    }
+    start = probe;
+  }
   
+  time_t end = time + 1;
+  for (int i = 0; i < maxSteps; ++i) {
+    time_t probe = end + step;
+    if (utcOffsetAt(probe) != offset) {
+      // transition in (end, probe]
+      while (probe - end > 1) {
+        time_t mid = end + (probe - end) / 2;
+        if (utcOffsetAt(mid) == offset) {
+          end = mid;
+        }
+        else {
+          probe = mid;
+        }
+      }
+      end = probe;
+      break;
+    }
+    end = probe;
+  }
   
-  return myUnixTime;
+  offsetSegment_t& segment = _offsetSegments[_nextOffsetSegment];
+  _nextOffsetSegment = (_nextOffsetSegment + 1) % RTX_ODBC_OFFSET_SEGMENTS;
+  segment.start = start;
+  segment.end = end;
+  segment.offset = offset;
+  return offset;
 }
 
-time_t OdbcPointRecord::sql_to_tm( const SQL_TIMESTAMP_STRUCT& sqlTime ) {
-  
-  /*
-  const int mon_days [] =
-  {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-  long tyears, tdays, leaps, utc_hrs, utc_mins, utc_secs;
-  int i;
+SQL_TIMESTAMP_STRUCT OdbcPointRecord::sqlTime(time_t unixTime) {
+  SQL_TIMESTAMP_STRUCT sqlTimestamp;
   
-  tyears = sqlTime.year - 1970; // = ltm->tm_year - 70; // tm->tm_year is from 1900.
-  leaps = (tyears + 2) / 4; // no of next two lines until year 2100.
-  //i = (ltm->tm_year – 100) / 100;
-  //leaps -= ( (i/4)*3 + i%4 );
-  tdays = 0;
-  for (i=0; i < sqlTime.month-1; i++) {
-    tdays += mon_days[i];
+  // time format (local/utc)
+  if (timeFormat() == LOCAL) {
+    unixTime += localOffset(unixTime);
   }
+  civilFromEpoch(unixTime, sqlTimestamp);
   
-  tdays += sqlTime.day - 1; // days of month passed.
-  tdays = tdays + (tyears * 365) + leaps;
-  
-  utc_hrs = sqlTime.hour;
-  utc_mins = sqlTime.minute;
-  utc_secs = sqlTime.second;
-  time_t uTime = (tdays * 86400) + (utc_hrs * 3600) + (utc_mins * 60) + utc_secs;
-  */
-  
-  time_t uTime;
-  struct tm tmTime;
-  
-  tmTime.tm_year = sqlTime.year - 1900;
-  tmTime.tm_mon = sqlTime.month -1;
-  tmTime.tm_mday = sqlTime.day;
-  tmTime.tm_hour = sqlTime.hour;
-  tmTime.tm_min = sqlTime.minute;
-  tmTime.tm_sec = sqlTime.second;
-  
-  // Portability note: mktime is essentially universally available. timegm is rather rare. For the most portable conversion from a UTC broken-down time to a simple time, set the TZ environment variable to UTC, call mktime, then set TZ back.
+  return sqlTimestamp;
+}
+
+time_t OdbcPointRecord::unixTime(SQL_TIMESTAMP_STRUCT sqlTime) {
+  time_t myUnixTime = epochFromCivil(sqlTime.year, sqlTime.month, sqlTime.day, sqlTime.hour, sqlTime.minute, sqlTime.second);
   
-  uTime = timegm(&tmTime);
-  /*
-  // back convert for a check
-  SQL_TIMESTAMP_STRUCT sqlTimeCheck = this->sqlTime(uTime);
-  if ( sqlTimeCheck.year == sqlTime.year &&
-       sqlTimeCheck.month == sqlTime.month &&
-       sqlTimeCheck.day == sqlTime.day &&
-       sqlTimeCheck.hour == sqlTime.hour &&
-       sqlTimeCheck.minute == sqlTime.minute &&
-       sqlTimeCheck.second == sqlTime.second) {
-    
+  if (timeFormat() == LOCAL) {
+    // the offset depends on the instant we're solving for; one refinement settles it except inside a transition.
+    time_t guess = myUnixTime - localOffset(myUnixTime);
+    myUnixTime -= localOffset(guess);
   }
-  else {
-    cerr << "time not formed correctly" << endl;
-  }
-   */
   
-  return uTime;
+  return myUnixTime;
 }
 
-
-time_t OdbcPointRecord::time_to_epoch ( const struct tm *ltm, int utcdiff ) {
-  const int mon_days [] =
-  {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-  long tyears, tdays, leaps, utc_hrs;
-  int i;
-  
-  tyears = ltm->tm_year - 70; // tm->tm_year is from 1900.
-  leaps = (tyears + 2) / 4; // no of next two lines until year 2100.
-                            //i = (ltm->tm_year – 100) / 100;
-                            //leaps -= ( (i/4)*3 + i%4 );
-  tdays = 0;
-  for (i=0; i < ltm->tm_mon; i++) tdays += mon_days[i];
-  
-  tdays += ltm->tm_mday-1; // days of month passed.
-  tdays = tdays + (tyears * 365) + leaps;
-  
-  utc_hrs = ltm->tm_hour + utcdiff; // for your time zone.
-  return (tdays * 86400) + (utc_hrs * 3600) + (ltm->tm_min * 60) + ltm->tm_sec;
+time_t OdbcPointRecord::sql_to_tm( const SQL_TIMESTAMP_STRUCT& sqlTime ) {
+  // same time format as the bound parameters
+  return unixTime(sqlTime);
 }
 
 
@@ -621,7 +874,7 @@ string OdbcPointRecord::extract_error(string function, SQLHANDLE handle, SQLSMAL
       msg += "::";
       msg += (char*)text;
     }
-    
+  
     // check if it's a connection issue
     if (strncmp((char*)state, "SCADA_CONNECTION_ISSSUE", 2) == 0) {
       msg += "::Connection Issue::";
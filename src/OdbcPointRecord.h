@@ -10,6 +10,8 @@
 #define epanet_rtx_OdbcPointRecord_h
 
 #define MAX_SCADA_TAG 50
+#define RTX_ODBC_ROWSET_SIZE 1024
+#define RTX_ODBC_OFFSET_SEGMENTS 4
 
 #include "DbPointRecord.h"
 
@@ -22,36 +24,36 @@ namespace RTX {
   
   /*! \class OdbcPointRecord
    \brief A persistence class for SCADA databases
-   
+  
    Primarily to be used for data acquisition. Polls an ODBC-based SCADA connection for data and creates Points from that data.
-   
+  
    */
   
   class OdbcPointRecord : public DbPointRecord {
   public:
     // types
     typedef enum { LOCAL, UTC } time_format_t;
-    
+  
     typedef enum {
       NO_CONNECTOR,
       wonderware_mssql,
       oracle,
       mssql
     } Sql_Connector_t;
-    
+  
     class odbc_query_t {
     public:
-      std::string connectorName, singleSelect, rangeSelect, upperBound, lowerBound, timeQuery;
+      std::string connectorName, singleSelect, rangeSelect, upperBound, lowerBound, timeQuery, summarySelect;
     };
-    
+  
     static std::map<Sql_Connector_t, odbc_query_t> queryTypes();
     static Sql_Connector_t typeForName(const std::string& connector);
-    
+  
     // shared pointer and ctor/dtor
     RTX_SHARED_POINTER(OdbcPointRecord);
     OdbcPointRecord();
     virtual ~OdbcPointRecord();
-    
+  
     // public methods
     void setTableColumnNames(const std::string& table, const std::string& dateCol, const std::string& tagCol, const std::string& valueCol, const std::string& qualityCol);
     void setConnectorType(Sql_Connector_t connectorType);
@@ -60,42 +62,47 @@ namespace RTX {
     virtual std::string registerAndGetIdentifier(std::string recordName);
     virtual std::vector<std::string> identifiers();
     virtual std::ostream& toStream(std::ostream &stream);
-    
+  
     void setSingleSelectQuery(const std::string& query) {_singleSelect = query;};
     void setRangeSelectQuery(const std::string& query) {_rangeSelect = query;};
     void setLowerBoundSelectQuery(const std::string& query) {_lowerBoundSelect = query;};
     void setUpperBoundSelectQuery(const std::string& query) {_upperBoundSelect = query;};
     void setTimeQuery(const std::string& query) {_timeQuery = query;};
-    
+    void setSummarySelectQuery(const std::string& query) {_summarySelect = query;}; //! #RESOLUTION# is replaced with the bucket width in milliseconds
+  
     void setTimeFormat(time_format_t timeFormat) { _timeFormat = timeFormat;};
     time_format_t timeFormat() { return _timeFormat; };
-    
+  
     std::string singleSelectQuery() {return _singleSelect;};
     std::string rangeSelectQuery() {return _rangeSelect;};
     std::string loweBoundSelectQuery() {return _lowerBoundSelect;};
     std::string upperBoundSelectQuery() {return _upperBoundSelect;};
     std::string timeQuery() {return _timeQuery;};
-    
+    std::string summarySelectQuery() {return _summarySelect;};
+  
   protected:
     // fetch means cache the results
     //virtual void fetchRange(const std::string& id, time_t startTime, time_t endTime);
     //virtual void fetchNext(const std::string& id, time_t time);
     //virtual void fetchPrevious(const std::string& id, time_t time);
-    
+  
     // select just returns the results (no caching)
     virtual std::vector<Point> selectRange(const std::string& id, time_t startTime, time_t endTime);
+    virtual time_t selectChunk(const std::string& id, time_t startTime, time_t endTime, size_t maxPoints, std::vector<Point>& chunk);
     virtual Point selectNext(const std::string& id, time_t time);
     virtual Point selectPrevious(const std::string& id, time_t time);
-    
+    virtual keyedPoints_t selectRanges(const std::vector<std::string>& ids, time_t startTime, time_t endTime);
+    virtual bool selectAggregatedRange(const std::string& id, time_t startTime, time_t endTime, time_t bucket, std::vector<PointSummary>& summaries);
+  
     // insertions or alterations may choose to ignore / deny
     virtual void insertSingle(const std::string& id, Point point);
-    virtual void insertRange(const std::string& id, std::vector<Point> points);
+    virtual void insertRange(const std::string& id, const std::vector<Point>& points);
     virtual void removeRecord(const std::string& id);
     virtual void truncate();
-    
+    virtual size_t rowBytes(queryKind_t kind);
+  
   private:
     bool _connectionOk;
-    std::vector<Point> pointsWithStatement(const string& id, SQLHSTMT statement, time_t startTime, time_t endTime = 0);
     typedef struct {
       SQLCHAR tagName[MAX_SCADA_TAG];
       SQL_TIMESTAMP_STRUCT time;
@@ -103,33 +110,70 @@ namespace RTX {
       int quality;
       SQLLEN tagNameInd, timeInd, valueInd, qualityInd;
     } ScadaRecord;
+    // column-wise arrays, for fetching a block of rows per driver call
+    typedef struct {
+      SQLCHAR tagName[RTX_ODBC_ROWSET_SIZE][MAX_SCADA_TAG];
+      SQL_TIMESTAMP_STRUCT time[RTX_ODBC_ROWSET_SIZE];
+      double value[RTX_ODBC_ROWSET_SIZE];
+      int quality[RTX_ODBC_ROWSET_SIZE];
+      SQLLEN tagNameInd[RTX_ODBC_ROWSET_SIZE], timeInd[RTX_ODBC_ROWSET_SIZE], valueInd[RTX_ODBC_ROWSET_SIZE], qualityInd[RTX_ODBC_ROWSET_SIZE];
+      SQLUSMALLINT rowStatus[RTX_ODBC_ROWSET_SIZE];
+      SQLULEN rowsFetched;
+    } ScadaRecordBlock;
     typedef struct {
       SQL_TIMESTAMP_STRUCT start;
       SQL_TIMESTAMP_STRUCT end;
       char tagName[MAX_SCADA_TAG];
       SQLLEN startInd, endInd, tagNameInd;
     } ScadaQuery;
-    
+  
+  
+    //! one connection handle, with its own statements and the buffers they are bound to
+    class OdbcConnection : public connection_t {
+    public:
+      OdbcConnection();
+      virtual ~OdbcConnection();
+      SQLHDBC dbc;
+      SQLHSTMT singleStatement, rangeStatement, lowerBoundStatement, upperBoundStatement, timeStatement;
+      ScadaRecord tempRecord;
+      boost::shared_ptr<ScadaRecordBlock> rangeBlock;
+      ScadaQuery query;
+    };
+  
     std::string _tableName, _dateCol, _tagCol, _valueCol, _qualityCol;
-    std::string _singleSelect, _rangeSelect, _upperBoundSelect, _lowerBoundSelect, _timeQuery;
+    std::string _singleSelect, _rangeSelect, _upperBoundSelect, _lowerBoundSelect, _timeQuery, _summarySelect;
     time_format_t _timeFormat;
     SQLHENV _SCADAenv;
-    SQLHDBC _SCADAdbc;
-    SQLHSTMT _SCADAstmt, _rangeStatement, _lowerBoundStatement, _upperBoundStatement, _SCADAtimestmt;
+    boost::shared_ptr<OdbcConnection> _primary;
     std::string _dsn;
-    ScadaRecord _tempRecord;
-    ScadaQuery _query;
-    
-    
+  
+    void openHandles(OdbcConnection& db) throw(std::string);
+    virtual connectionPointer_t openConnection();
+    OdbcConnection& odbcConnection(); //! for the calling thread
+    std::vector<Point> pointsWithStatement(const string& id, SQLHSTMT OdbcConnection::*whichStatement, time_t startTime, time_t endTime = 0, size_t maxPoints = 0); //! maxPoints of 0 fetches them all
+  
     void bindOutputColumns(SQLHSTMT statement, ScadaRecord* record);
+    void bindOutputBlock(SQLHSTMT statement, ScadaRecordBlock* block);
+    static bool blockRowIsValid(const ScadaRecordBlock& block, SQLULEN row);
     SQL_TIMESTAMP_STRUCT sqlTime(time_t unixTime);
     time_t unixTime(SQL_TIMESTAMP_STRUCT sqlTime);
+    static time_t epochFromCivil(long year, long month, long day, long hour, long minute, long second);
+    static void civilFromEpoch(time_t epoch, SQL_TIMESTAMP_STRUCT& civil);
+    long localOffset(time_t time); //! seconds east of UTC, cached per DST segment
+    class offsetSegment_t {
+    public:
+      offsetSegment_t() : start(0), end(0), offset(0) {};
+      time_t start, end; // [start, end)
+      long offset;
+    };
+    offsetSegment_t _offsetSegments[RTX_ODBC_OFFSET_SEGMENTS];
+    int _nextOffsetSegment;
+    boost::mutex _offsetMutex;
     SQLRETURN SQL_CHECK(SQLRETURN retVal, std::string function, SQLHANDLE handle, SQLSMALLINT type) throw(std::string);
     std::string extract_error(std::string function, SQLHANDLE handle, SQLSMALLINT type);
     time_t sql_to_tm ( const SQL_TIMESTAMP_STRUCT& sqlTime );
-    time_t time_to_epoch ( const struct tm *ltm, int utcdiff );
   };
-
+  
   
 }
 
@@ -9,6 +9,7 @@
 #include <boost/foreach.hpp>
 
 #include "OffsetTimeSeries.h"
+#include "Tracer.h"
 
 using namespace std;
 using namespace RTX;
@@ -20,26 +21,41 @@ OffsetTimeSeries::OffsetTimeSeries() {
 Point OffsetTimeSeries::point(time_t time){
   
   Point sourcePoint = source()->point(time);
-  Point newPoint = this->convertWithOffset(sourcePoint, source()->units());
+  Point newPoint = this->convertWithOffset(sourcePoint);
   return newPoint;
   
 }
 
 vector<Point> OffsetTimeSeries::points(time_t start, time_t end) {
-  vector<Point> sourcePoints = source()->points(start, end);
-  Units sourceU = source()->units();
-  
+  RTX_TRACE_SPAN(span, ("points", "series", name(), start, end));
+  // offsets are cheap enough that nothing is cached here -- the source does the caching.
   vector<Point> offsetPoints;
-  offsetPoints.reserve(sourcePoints.size());
-  
-  BOOST_FOREACH(Point p, sourcePoints) {
-    Point newP = this->convertWithOffset(p, sourceU);
-    offsetPoints.push_back(newP);
-  }
-  
+  evaluateRange(start, end, offsetPoints);
   return offsetPoints;
 }
 
+bool OffsetTimeSeries::valueTransform(ValueTransform& transform) {
+  transform = ValueTransform::affine(sourceConverter().scale(), offset());
+  return true;
+}
+
+// applies the offset on the way through, so source points go straight to the caller's visitor
+class OffsetTimeSeries::OffsetVisitor : public PointVisitor {
+public:
+  OffsetVisitor(OffsetTimeSeries& series, PointVisitor& visitor) : _series(series), _visitor(visitor) {};
+  virtual bool visit(const Point& point) {
+    return _visitor.visit(_series.convertWithOffset(point));
+  }
+private:
+  OffsetTimeSeries& _series;
+  PointVisitor& _visitor;
+};
+
+void OffsetTimeSeries::visitPoints(time_t start, time_t end, PointVisitor& visitor) {
+  OffsetVisitor offsetVisitor(*this, visitor);
+  source()->visitPoints(start, end, offsetVisitor);
+}
+
 void OffsetTimeSeries::setOffset(double offset) {
   _offset = offset;
 }
@@ -48,8 +64,8 @@ double OffsetTimeSeries::offset() {
   return _offset;
 }
 
-Point OffsetTimeSeries::convertWithOffset(Point p, Units sourceU) {
-  Point convertedSourcePoint = Point::convertPoint(p, sourceU, units());
+Point OffsetTimeSeries::convertWithOffset(const Point& p) {
+  Point convertedSourcePoint = Point::convertPoint(p, sourceConverter());
   double pointValue = convertedSourcePoint.value;
   pointValue += offset();
   Point newPoint(convertedSourcePoint.time, pointValue, convertedSourcePoint.quality, convertedSourcePoint.confidence);
@@ -20,10 +20,13 @@ namespace RTX {
     OffsetTimeSeries();
     virtual Point point(time_t time);
     virtual std::vector<Point> points(time_t start, time_t end);
+    virtual void visitPoints(time_t start, time_t end, PointVisitor& visitor);
+    virtual bool valueTransform(ValueTransform& transform);
     void setOffset(double offset);
     double offset();
   private:
-    Point convertWithOffset(Point p, Units sourceU);
+    class OffsetVisitor;
+    Point convertWithOffset(const Point& p);
     double _offset;
   
   };
@@ -0,0 +1,253 @@
+//
+//  ParallelEvaluator.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include <map>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "ParallelEvaluator.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+
+ParallelEvaluator::ParallelEvaluator(size_t threadCount) {
+  _threadCount = threadCount;
+  if (_threadCount == 0) {
+    _threadCount = boost::thread::hardware_concurrency();
+  }
+  if (_threadCount == 0) {
+    _threadCount = 1;
+  }
+  _priority = Scheduler::normalPriority;
+  _start = 0;
+  _end = 0;
+  _remaining = 0;
+}
+
+size_t ParallelEvaluator::threadCount() {
+  return _threadCount;
+}
+
+void ParallelEvaluator::setRuntime(RuntimeContext::sharedPointer runtime) {
+  _runtime = runtime;
+}
+
+RuntimeContext::sharedPointer ParallelEvaluator::runtime() {
+  return (_runtime) ? _runtime : RuntimeContext::defaultContext();
+}
+
+void ParallelEvaluator::setPriority(Scheduler::priority_t priority) {
+  _priority = priority;
+}
+
+Scheduler::priority_t ParallelEvaluator::priority() {
+  return _priority;
+}
+
+
+#pragma mark - Public Methods
+
+void ParallelEvaluator::evaluate(const std::vector<TimeSeries::sharedPointer>& outputs, time_t start, time_t end) throw(RtxException) {
+  buildGraph(outputs);
+  if (_nodes.empty()) {
+    return;
+  }
+  _start = start;
+  _end = end;
+  _remaining = _nodes.size();
+  fetchStored();
+  
+  // deal the initially-ready series out to the workers
+  size_t workers = RTX_MIN(_threadCount, _nodes.size());
+  _queues.clear();
+  for (size_t i = 0; i < workers; ++i) {
+    _queues.push_back(WorkQueuePointer(new WorkQueue()));
+  }
+  size_t nextQueue = 0;
+  for (size_t i = 0; i < _nodes.size(); ++i) {
+    if (_nodes[i].pendingUpstream == 0) {
+      _queues[nextQueue]->ready.push_back(i);
+      nextQueue = (nextQueue + 1) % workers;
+    }
+  }
+  
+  vector<Scheduler::task_t> tasks;
+  for (size_t i = 0; i < workers; ++i) {
+    tasks.push_back(boost::bind(&ParallelEvaluator::workerLoop, this, i));
+  }
+  runtime()->scheduler()->run(tasks, _priority); // the calling thread works too
+  
+  _queues.clear();
+  _nodes.clear();
+  _fetches.clear();
+}
+
+
+#pragma mark - Private Methods
+
+void ParallelEvaluator::buildGraph(const std::vector<TimeSeries::sharedPointer>& outputs) throw(RtxException) {
+  _nodes.clear();
+  map<TimeSeries*, size_t> indexes;
+  map<TimeSeries*, bool> onPath; // true while a series' upstream is still being walked
+  
+  // depth-first from each output. a series is numbered after everything upstream of it.
+  vector< pair<TimeSeries::sharedPointer, bool> > stack; // (series, upstream already pushed)
+  BOOST_FOREACH(TimeSeries::sharedPointer output, outputs) {
+    if (output) {
+      stack.push_back(make_pair(output, false));
+    }
+  }
+  while (!stack.empty()) {
+    TimeSeries::sharedPointer series = stack.back().first;
+    bool expanded = stack.back().second;
+    TimeSeries* key = series.get();
+  
+    if (indexes.count(key)) {
+      stack.pop_back();
+      continue;
+    }
+    if (!expanded) {
+      if (onPath[key]) {
+        throw RtxException("TimeSeries graph has a cycle through " + series->name());
+      }
+      onPath[key] = true;
+      stack.back().second = true;
+      BOOST_FOREACH(TimeSeries::sharedPointer upstream, series->upstreamSeries()) {
+        if (upstream && !indexes.count(upstream.get())) {
+          if (onPath[upstream.get()]) {
+            throw RtxException("TimeSeries graph has a cycle through " + upstream->name());
+          }
+          stack.push_back(make_pair(upstream, false));
+        }
+      }
+      continue;
+    }
+  
+    // everything upstream is numbered, so this one can be.
+    stack.pop_back();
+    onPath[key] = false;
+    Node node;
+    node.series = series;
+    node.pendingUpstream = 0;
+    node.fetch = -1;
+    size_t index = _nodes.size();
+    indexes[key] = index;
+    _nodes.push_back(node);
+  
+    // link it to its upstream series, once per distinct source
+    map<TimeSeries*, bool> linked;
+    BOOST_FOREACH(TimeSeries::sharedPointer upstream, series->upstreamSeries()) {
+      if (upstream && !linked[upstream.get()]) {
+        linked[upstream.get()] = true;
+        _nodes[indexes[upstream.get()]].downstream.push_back(index);
+        ++_nodes[index].pendingUpstream;
+      }
+    }
+  }
+}
+
+void ParallelEvaluator::workerLoop(size_t worker) {
+  size_t nodeIndex;
+  while (takeWork(worker, nodeIndex)) {
+    TimeSeries::sharedPointer series = _nodes[nodeIndex].series;
+    if (_nodes[nodeIndex].fetch >= 0) {
+      _fetches[_nodes[nodeIndex].fetch].wait(); // if it failed, the series asks for itself
+    }
+    try {
+      series->points(_start, _end);
+    } catch (std::exception& e) {
+      RTX_LOG(error, "ParallelEvaluator", "could not evaluate " << series->name() << ": " << e.what());
+    } catch (...) {
+      RTX_LOG(error, "ParallelEvaluator", "could not evaluate " << series->name());
+    }
+    finished(worker, nodeIndex);
+  }
+}
+
+void ParallelEvaluator::fetchStored() {
+  _fetches.clear();
+  map<DbPointRecord*, int> batches;
+  map<DbPointRecord*, DbPointRecord::sharedPointer> records;
+  map<DbPointRecord*, vector<string> > names;
+  BOOST_FOREACH(Node& node, _nodes) {
+    DbPointRecord::sharedPointer record = boost::dynamic_pointer_cast<DbPointRecord>(node.series->record());
+    if (!record) {
+      continue;
+    }
+    if (batches.find(record.get()) == batches.end()) {
+      int batch = (int)batches.size();
+      batches[record.get()] = batch;
+      records[record.get()] = record;
+    }
+    node.fetch = batches[record.get()];
+    names[record.get()].push_back(node.series->name());
+  }
+  _fetches.resize(batches.size());
+  typedef map<DbPointRecord*, int>::value_type batch_t;
+  BOOST_FOREACH(const batch_t& batch, batches) {
+    _fetches[batch.second] = records[batch.first]->prefetchRangeAsync(names[batch.first], _start, _end);
+  }
+}
+
+bool ParallelEvaluator::takeWork(size_t worker, size_t& nodeIndex) {
+  while (true) {
+    // my own queue first, newest first -- that's most likely what I just made ready, with its sources still warm.
+    {
+      scopedLock_t lock(_queues[worker]->mutex);
+      if (!_queues[worker]->ready.empty()) {
+        nodeIndex = _queues[worker]->ready.back();
+        _queues[worker]->ready.pop_back();
+        return true;
+      }
+    }
+    // otherwise steal the oldest work from someone else
+    for (size_t i = 1; i < _queues.size(); ++i) {
+      WorkQueue& victim = *_queues[(worker + i) % _queues.size()];
+      scopedLock_t lock(victim.mutex);
+      if (!victim.ready.empty()) {
+        nodeIndex = victim.ready.front();
+        victim.ready.pop_front();
+        return true;
+      }
+    }
+  
+    // nothing anywhere: wait for a finishing series to free up more, or for the end.
+    scopedLock_t graphLock(_graphMutex);
+    if (_remaining == 0) {
+      return false;
+    }
+    bool anyReady = false;
+    BOOST_FOREACH(WorkQueuePointer queue, _queues) {
+      scopedLock_t lock(queue->mutex);
+      anyReady = anyReady || !queue->ready.empty();
+    }
+    if (!anyReady) {
+      _workAvailable.wait(graphLock);
+    }
+  }
+}
+
+void ParallelEvaluator::finished(size_t worker, size_t nodeIndex) {
+  scopedLock_t graphLock(_graphMutex);
+  BOOST_FOREACH(size_t downstream, _nodes[nodeIndex].downstream) {
+    if (--_nodes[downstream].pendingUpstream == 0) {
+      scopedLock_t lock(_queues[worker]->mutex);
+      _queues[worker]->ready.push_back(downstream);
+    }
+  }
+  --_remaining;
+  _workAvailable.notify_all();
+}
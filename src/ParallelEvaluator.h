@@ -0,0 +1,103 @@
+//
+//  ParallelEvaluator.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_ParallelEvaluator_h
+#define epanet_rtx_ParallelEvaluator_h
+
+#include <vector>
+#include <deque>
+#include <string>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "TimeSeries.h"
+#include "DbPointRecord.h"
+#include "RuntimeContext.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace RTX {
+
+  /*!
+   \class ParallelEvaluator
+   \brief Evaluates a set of TimeSeries over a window, running independent branches of their graph concurrently.
+
+   The graph is discovered through TimeSeries::upstreamSeries. Shared upstream series are evaluated once, and each
+   series is evaluated only after everything it depends on, so by the time a series pulls from its sources their
+   points are already cached. Independent series run at the same time on a small work-stealing pool: each worker
+   keeps its own queue of ready series (newly-ready dependents go to the worker that freed them), and an idle worker
+   takes from the others. The workers are tasks on the runtime's Scheduler (the default context's, unless one's set),
+   so they share its threads with everything else.
+
+   Series stored in a database record are fetched up front, in one asynchronous batch per record
+   (DbPointRecord::prefetchRangeAsync), while the workers get started on everything else. A worker that comes to one of
+   them waits for its batch to land, rather than querying for that series alone.
+
+   The results land in each series' PointRecord; call points() on the outputs afterwards to read them. A series
+   whose evaluation throws is logged as an error (see Log) and its dependents still run (they will pull what they can).
+   */
+
+  /*!
+   \fn void ParallelEvaluator::evaluate(const std::vector<TimeSeries::sharedPointer>& outputs, time_t start, time_t end)
+   \brief Evaluate the outputs, and everything upstream of them, over [start, end].
+   \param outputs The series that are needed.
+   \param start The beginning of the window.
+   \param end The end of the window.
+   \throw RtxException if the graph has a cycle.
+   */
+
+  class ParallelEvaluator {
+  public:
+    RTX_SHARED_POINTER(ParallelEvaluator);
+    ParallelEvaluator(size_t threadCount = 0); //! 0 means one thread per hardware core
+    virtual ~ParallelEvaluator() {};
+
+    void evaluate(const std::vector<TimeSeries::sharedPointer>& outputs, time_t start, time_t end) throw(RtxException);
+    size_t threadCount();
+    void setRuntime(RuntimeContext::sharedPointer runtime);
+    RuntimeContext::sharedPointer runtime();
+    void setPriority(Scheduler::priority_t priority); //! normal by default
+    Scheduler::priority_t priority();
+
+  private:
+    class Node {
+    public:
+      TimeSeries::sharedPointer series;
+      std::vector<size_t> downstream;
+      size_t pendingUpstream;
+      int fetch; // its record's batch in _fetches, or -1
+    };
+    class WorkQueue {
+    public:
+      boost::mutex mutex;
+      std::deque<size_t> ready;
+    };
+    typedef boost::shared_ptr<WorkQueue> WorkQueuePointer;
+
+    void buildGraph(const std::vector<TimeSeries::sharedPointer>& outputs) throw(RtxException);
+    void workerLoop(size_t worker);
+    bool takeWork(size_t worker, size_t& nodeIndex);
+    void finished(size_t worker, size_t nodeIndex);
+    void fetchStored(); //! the batches, one per database record
+
+    size_t _threadCount;
+    RuntimeContext::sharedPointer _runtime;
+    Scheduler::priority_t _priority;
+    time_t _start, _end;
+    std::vector<Node> _nodes;
+    std::vector<WorkQueuePointer> _queues;
+    std::vector<DbPointRecord::fetchFuture_t> _fetches;
+    size_t _remaining;                    // nodes not yet finished
+    boost::mutex _graphMutex;             // guards pendingUpstream and _remaining
+    boost::condition_variable _workAvailable;
+  };
+
+}
+
+#endif
@@ -0,0 +1,402 @@
+//
+//  Pipeline.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_Pipeline_h
+#define epanet_rtx_Pipeline_h
+
+#include <vector>
+#include <cmath>
+
+#include "ModularTimeSeries.h"
+#include "Clock.h"
+#include "Point.h"
+#include "Scratch.h"
+
+#include <boost/utility.hpp>
+
+namespace RTX {
+
+  /*!
+   \class Pipeline
+   \brief A chain of stages fixed at compile time, evaluated as one TimeSeries.
+
+   Built in code with makePipeline, for a chain that's known when the program is written:
+
+     TimeSeries::sharedPointer smoothed = makePipeline(source, Stage::Resample<30>(), Stage::MovingAverage<7>(), Stage::Offset(x));
+
+   The stages are types rather than series, so there are no virtual calls or shared pointers between them, nothing
+   is cached part way along, and the compiler sees the whole chain at once. A range is evaluated by pulling the
+   source's points once, laying them out as flat columns, and running each stage's kernel over the columns in
+   turn; only the last stage's output is made into Points and cached. The units are converted once, at the end,
+   so the stages all work in the source's units -- an Offset is in source units too.
+
+   The stages behave like the series they're named for: Resample interpolates linearly onto a regular clock of
+   its period, masking out anything bracketed by a missing point; MovingAverage averages the points that are
+   there within half a window either side (half a window of its input's periods, or of its nearest points if its
+   input is irregular); Offset and Scale are per-value. A pipeline with a Resample in it is on that clock, and
+   otherwise it's on its source's.
+
+   A stage is any class with these methods, all const (see the ones below):
+     Stage::reach_t reach(time_t inputPeriod) -- how far past an output time its inputs have to go
+     time_t period(time_t inputPeriod)        -- the period of what it produces (0, irregular)
+     void run(Stage::Columns& in, time_t inputPeriod, Stage::Columns& out) -- in may be consumed
+   */
+
+  namespace Stage {
+
+    //! how far either side of an output a stage reads its input: seconds of a regular input, points of an irregular one
+    class reach_t {
+    public:
+      reach_t(time_t seconds = 0, size_t points = 0) : seconds(seconds), points(points) {};
+      // simple tuple class, so no getters/setters
+      time_t seconds;
+      size_t points;
+    };
+
+    //! points in time order, as parallel columns. the storage is leased from the evaluating thread's Scratch.
+    class Columns : boost::noncopyable {
+      Scratch::Vector<time_t> _times;
+      Scratch::Vector<double> _values, _confidences;
+      Scratch::Vector<unsigned char> _qualities;
+    public:
+      Columns() : time(*_times), value(*_values), confidence(*_confidences), quality(*_qualities) {};
+      size_t size() const { return time.size(); };
+      void reserve(size_t count) {
+        time.reserve(count);
+        value.reserve(count);
+        confidence.reserve(count);
+        quality.reserve(count);
+      };
+      void push_back(time_t t, double v, Point::Qual_t q, double c) {
+        time.push_back(t);
+        value.push_back(v);
+        confidence.push_back(c);
+        quality.push_back((unsigned char)q);
+      };
+      void swap(Columns& other) {
+        time.swap(other.time);
+        value.swap(other.value);
+        confidence.swap(other.confidence);
+        quality.swap(other.quality);
+      };
+      // simple tuple class, so no getters/setters
+      std::vector<time_t>& time;
+      std::vector<double>& value;
+      std::vector<double>& confidence;
+      std::vector<unsigned char>& quality; //! Point::Qual_t
+    };
+
+    //! one stage, then another
+    template<class First, class Second> class Then {
+    public:
+      Then(const First& first = First(), const Second& second = Second()) : _first(first), _second(second) {};
+      reach_t reach(time_t inputPeriod) const {
+        reach_t a = _first.reach(inputPeriod);
+        reach_t b = _second.reach(_first.period(inputPeriod));
+        return reach_t(a.seconds + b.seconds, a.points + b.points);
+      };
+      time_t period(time_t inputPeriod) const {
+        return _second.period(_first.period(inputPeriod));
+      };
+      void run(Columns& in, time_t inputPeriod, Columns& out) const {
+        Columns between;
+        _first.run(in, inputPeriod, between);
+        _second.run(between, _first.period(inputPeriod), out);
+      };
+    private:
+      First _first;
+      Second _second;
+    };
+
+    //! linear interpolation onto a regular clock of Period seconds
+    template<int Period> class Resample {
+    public:
+      reach_t reach(time_t inputPeriod) const {
+        // the neighbor on either side, to interpolate the ends from
+        return (inputPeriod > 0) ? reach_t(inputPeriod, 0) : reach_t(0, 1);
+      };
+      time_t period(time_t inputPeriod) const {
+        return Period;
+      };
+      void run(Columns& in, time_t inputPeriod, Columns& out) const {
+        size_t nIn = in.size();
+        if (nIn < 2) {
+          return;
+        }
+        time_t first = in.time.front(), last = in.time.back();
+        time_t now = (first % Period == 0) ? first : first - (first % Period) + Period;
+        out.reserve((last - now) / Period + 1);
+        size_t left = 0;
+        for (; now <= last; now += Period) {
+          while (left + 2 < nIn && in.time[left + 1] <= now) {
+            ++left;
+          }
+          size_t right = left + 1;
+          if (in.time[left] == now || in.time[right] == now) {
+            size_t exact = (in.time[left] == now) ? left : right;
+            if (in.quality[exact] != Point::missing) {
+              out.push_back(now, in.value[exact], (Point::Qual_t)in.quality[exact], in.confidence[exact]);
+            }
+            continue;
+          }
+          if (in.quality[left] == Point::missing || in.quality[right] == Point::missing) {
+            continue;
+          }
+          double f = (double)(now - in.time[left]) / (double)(in.time[right] - in.time[left]);
+          double v = (1. - f) * in.value[left] + f * in.value[right];
+          out.push_back(now, v, Point::interpolated, (in.confidence[left] + in.confidence[right]) / 2);
+        }
+      };
+    };
+
+    //! the mean of the input points that are there, within half a window of Window points either side
+    template<int Window> class MovingAverage {
+    public:
+      reach_t reach(time_t inputPeriod) const {
+        size_t half = Window / 2;
+        return (inputPeriod > 0) ? reach_t(inputPeriod * half, 0) : reach_t(0, half);
+      };
+      time_t period(time_t inputPeriod) const {
+        return inputPeriod;
+      };
+      void run(Columns& in, time_t inputPeriod, Columns& out) const {
+        // the window only counts points that are actually there
+        Scratch::Vector<time_t> timeBuffer;
+        Scratch::Vector<double> valueBuffer;
+        std::vector<time_t>& times = *timeBuffer;
+        std::vector<double>& values = *valueBuffer;
+        for (size_t k = 0; k < in.size(); ++k) {
+          if (in.quality[k] != Point::missing) {
+            times.push_back(in.time[k]);
+            values.push_back(in.value[k]);
+          }
+        }
+        size_t nSource = times.size();
+        size_t half = Window / 2;
+        time_t halfSpan = inputPeriod * half;
+        out.reserve(in.size());
+        // both edges only ever move forward, so the sum is kept as points enter and leave
+        double sum = 0;
+        size_t windowBegin = 0, windowEnd = 0, here = 0;
+        for (size_t k = 0; k < in.size(); ++k) {
+          time_t now = in.time[k];
+          size_t newBegin, newEnd;
+          if (inputPeriod > 0) {
+            newBegin = windowBegin;
+            while (newBegin < nSource && times[newBegin] < now - halfSpan) {
+              ++newBegin;
+            }
+            newEnd = (newBegin > windowEnd) ? newBegin : windowEnd;
+            while (newEnd < nSource && times[newEnd] <= now + halfSpan) {
+              ++newEnd;
+            }
+          }
+          else {
+            while (here < nSource && times[here] < now) {
+              ++here;
+            }
+            size_t pastHere = (here < nSource && times[here] == now) ? here + 1 : here;
+            newBegin = (here > half) ? here - half : 0;
+            newEnd = (pastHere + half < nSource) ? pastHere + half : nSource;
+          }
+          while (windowEnd < newEnd) {
+            sum += values[windowEnd++];
+          }
+          while (windowBegin < newBegin) {
+            sum -= values[windowBegin++];
+          }
+          size_t count = windowEnd - windowBegin;
+          if (count > 0) {
+            out.push_back(now, sum / count, Point::good, 0.);
+          }
+        }
+      };
+    };
+
+    //! value + offset, in the source's units
+    class Offset {
+    public:
+      Offset(double offset = 0) : _offset(offset) {};
+      reach_t reach(time_t inputPeriod) const { return reach_t(); };
+      time_t period(time_t inputPeriod) const { return inputPeriod; };
+      void run(Columns& in, time_t inputPeriod, Columns& out) const {
+        out.swap(in);
+        double* v = out.value.empty() ? NULL : &out.value[0];
+        for (size_t k = 0; k < out.size(); ++k) {
+          v[k] += _offset;
+        }
+      };
+    private:
+      double _offset;
+    };
+
+    //! value * scale (and the confidence with it)
+    class Scale {
+    public:
+      Scale(double scale = 1) : _scale(scale) {};
+      reach_t reach(time_t inputPeriod) const { return reach_t(); };
+      time_t period(time_t inputPeriod) const { return inputPeriod; };
+      void run(Columns& in, time_t inputPeriod, Columns& out) const {
+        out.swap(in);
+        double* v = out.value.empty() ? NULL : &out.value[0];
+        double* c = out.confidence.empty() ? NULL : &out.confidence[0];
+        double confidenceScale = std::fabs(_scale);
+        for (size_t k = 0; k < out.size(); ++k) {
+          v[k] *= _scale;
+          c[k] *= confidenceScale;
+        }
+      };
+    private:
+      double _scale;
+    };
+
+  }
+
+
+  template<class Stages> class Pipeline : public ModularTimeSeries {
+  public:
+    RTX_SHARED_POINTER(Pipeline);
+    Pipeline(const Stages& stages = Stages()) : ModularTimeSeries(), _stages(stages) {
+      time_t period = _stages.period(0);
+      if (period > 0) {
+        setClock(Clock::sharedPointer(new Clock((int)period)));
+      }
+    };
+    virtual ~Pipeline() {};
+
+    const Stages& stages() { return _stages; };
+
+    virtual Point point(time_t time) {
+      if (!clock()->isValid(time)) {
+        time = clock()->timeBefore(time);
+      }
+      return this->pointComputedOnce(time, PointComputer(*this));
+    };
+
+    virtual bool valueTransform(ValueTransform& transform) {
+      return false; // the stages look at neighboring points
+    };
+
+    virtual PointRecord::time_pair_t affectedRange(time_t start, time_t end) {
+      return sourceRange(start, end);
+    };
+
+  protected:
+    virtual bool isCompatibleWith(TimeSeries::sharedPointer withTimeSeries) {
+      // a pipeline resamples (or takes its source's clock), so only the units have to agree
+      return (units().isDimensionless() || units().isSameDimensionAs(withTimeSeries->units()));
+    };
+
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
+      TimeSeries::sharedPointer upstream = source();
+      if (!upstream) {
+        return;
+      }
+      // a range of a plain series stops short of its end time, so ask for a second past it
+      PointRecord::time_pair_t range = sourceRange(start, end);
+      countUpstreamCalls();
+      std::vector<Point> sourcePoints = upstream->points(range.first, range.second + 1);
+
+      Stage::Columns in, result;
+      in.reserve(sourcePoints.size());
+      for (size_t k = 0; k < sourcePoints.size(); ++k) {
+        const Point& p = sourcePoints[k];
+        if (p.isValid) {
+          in.push_back(p.time, p.value, p.quality, p.confidence);
+        }
+      }
+      _stages.run(in, upstream->period(), result);
+
+      // back into points, in my units, at my clock's times in the range
+      UnitConverter converter = sourceConverter();
+      double confidenceScale = std::fabs(converter.scale());
+      Clock::sharedPointer clock = this->clock();
+      bool regular = clock->isRegular();
+      out.reserve(out.size() + result.size());
+      for (size_t k = 0; k < result.size(); ++k) {
+        time_t t = result.time[k];
+        if (t < start || end < t || (regular && !clock->isValid(t))) {
+          continue;
+        }
+        out.push_back(Point(t, converter.convert(result.value[k]), (Point::Qual_t)result.quality[k], result.confidence[k] * confidenceScale));
+      }
+    };
+
+  private:
+    //! computePoint as a function of time, for pointComputedOnce
+    class PointComputer {
+    public:
+      PointComputer(Pipeline& pipeline) : _pipeline(pipeline) {};
+      Point operator()(time_t time) { return _pipeline.computePoint(time); };
+    private:
+      Pipeline& _pipeline;
+    };
+
+    Point computePoint(time_t time) {
+      std::vector<Point> evaluated;
+      this->evaluateRange(time, time, evaluated);
+      if (evaluated.empty()) {
+        return Point();
+      }
+      this->cachePoint(evaluated.front());
+      return evaluated.front();
+    };
+
+    //! [start, end], out as far as the stages reach into the source
+    PointRecord::time_pair_t sourceRange(time_t start, time_t end) {
+      TimeSeries::sharedPointer upstream = source();
+      if (!upstream) {
+        return std::make_pair(start, end);
+      }
+      Stage::reach_t reach = _stages.reach(upstream->period());
+      start -= reach.seconds;
+      end += reach.seconds;
+      Clock::sharedPointer sourceClock = upstream->clock();
+      for (size_t i = 0; i < reach.points; ++i) {
+        time_t before = sourceClock->timeBefore(start);
+        time_t after = sourceClock->timeAfter(end);
+        start = (before > 0) ? before : start;
+        end = (after > 0) ? after : end;
+      }
+      return std::make_pair(start, end);
+    };
+
+    Stages _stages;
+  };
+
+
+  /*!
+   \fn typename Pipeline<A>::sharedPointer makePipeline(TimeSeries::sharedPointer source, const A& a)
+   \brief A Pipeline of up to four stages, in the order given, drawing on a source.
+   */
+
+  template<class A>
+  typename Pipeline<A>::sharedPointer makePipeline(TimeSeries::sharedPointer source, const A& a) {
+    typename Pipeline<A>::sharedPointer pipeline(new Pipeline<A>(a));
+    pipeline->setSource(source);
+    return pipeline;
+  }
+
+  template<class A, class B>
+  typename Pipeline< Stage::Then<A,B> >::sharedPointer makePipeline(TimeSeries::sharedPointer source, const A& a, const B& b) {
+    return makePipeline(source, Stage::Then<A,B>(a, b));
+  }
+
+  template<class A, class B, class C>
+  typename Pipeline< Stage::Then<A, Stage::Then<B,C> > >::sharedPointer makePipeline(TimeSeries::sharedPointer source, const A& a, const B& b, const C& c) {
+    return makePipeline(source, a, Stage::Then<B,C>(b, c));
+  }
+
+  template<class A, class B, class C, class D>
+  typename Pipeline< Stage::Then<A, Stage::Then<B, Stage::Then<C,D> > > >::sharedPointer makePipeline(TimeSeries::sharedPointer source, const A& a, const B& b, const C& c, const D& d) {
+    return makePipeline(source, a, b, Stage::Then<C,D>(c, d));
+  }
+
+}
+
+#endif
@@ -7,25 +7,23 @@
 //  
 
 #include "Point.h"
+#include "Log.h"
 #include <math.h>
 
 using namespace std;
 using namespace RTX;
 
-Point::Point() : time(0),value(0),quality(Point::missing),isValid(false),confidence(0) {
+Point::Point() : time(0),value(0),confidence(0),quality(Point::missing),isValid(false) {
   
 }
 
 
-Point::Point(time_t t, double v, Qual_t q, double c) : time(t),value(v),quality(q),isValid((q == missing)||(isnan(v)) ? false : true),confidence(c) {
+Point::Point(time_t t, double v, Qual_t q, double c) : time(t),value(v),confidence(c),quality(q),isValid((q == missing)||(isnan(v)) ? false : true) {
   if (isnan(v)) {
-    cout << "nan" << endl;
+    RTX_LOG(debug, "Point", "nan");
   }
 }
 
-Point::~Point() {
-}
-
 
 #pragma mark - Operators
 
@@ -37,7 +35,7 @@ Point Point::operator+(const Point& point) const {
 
 Point& Point::operator+=(const Point& point) {
   if (point.time != this->time) {
-    std::cerr << "point times do not match: " << (point.time - this->time) << "s gap." << std::endl;
+    RTX_LOG(warning, "Point", "point times do not match: " << (point.time - this->time) << "s gap.");
   }
   double value = this->value + point.value;
   double confidence = (this->confidence + point.confidence) / 2.;
@@ -97,5 +95,33 @@ Point Point::convertPoint(const Point& point, const Units& fromUnits, const Unit
   return Point(point.time, value, Point::good, confidence);
 }
 
+Point Point::convertPoint(const Point& point, const UnitConverter& converter) {
+  return Point(point.time, converter.convert(point.value), Point::good, converter.convert(point.confidence));
+}
+
+
 
+#pragma mark - PackedPoint
 
+PackedPoint PackedPoint::pack(const Point& point) {
+  PackedPoint packed;
+  packed.stamp = (int64_t)((uint64_t)point.time << 8) | (int64_t)(((unsigned)point.quality & 0x7f) << 1) | (point.isValid ? 1 : 0);
+  packed.value = point.value;
+  packed.confidence = point.confidence;
+  return packed;
+}
+
+Point PackedPoint::unpack() const {
+  // field by field, so nothing is re-derived (or complained about) on the way out
+  Point point;
+  point.time = this->time();
+  point.value = value;
+  point.confidence = confidence;
+  point.quality = (Point::Qual_t)((stamp >> 1) & 0x7f);
+  point.isValid = (stamp & 1) != 0;
+  return point;
+}
+
+time_t PackedPoint::time() const {
+  return (time_t)(stamp >> 8);
+}
@@ -10,48 +10,81 @@
 #define epanet_rtx_point_h
 
 #include <time.h>
+#include <stdint.h>
 #include <map>
 #include "rtxMacros.h"
 #include "Units.h"
 
 namespace RTX {
-    
+  
 //!   A Point Class to store data tuples (date, value, quality, confidence)
 /*!
       The point class keeps track of a piece of measurement data; time, value, and quality.
+      It has no virtual methods and no destructor, so it is trivially copyable: vectors of points copy as one block.
+      PackedPoint is the smaller form for writing points to disk or the wire.
 */
   class Point {    
   public:
     //! quality flag
     enum Qual_t { good, missing, estimated, forecasted, interpolated, constant };
-    
+  
     //! Empty Constructor, equivalent to Point(0,0,Point::missing,0)
     Point();
     //! Full Constructor, for explicitly setting all internal data within the point object.
     Point(time_t time, double value, Qual_t qual = good, double confidence = 0.);
-    // dtor
-    ~Point();
     Point operator+(const Point& point) const;
     Point& operator+=(const Point& point);
     Point operator*(const double factor) const;
     Point operator/(const double factor) const;
-    virtual std::ostream& toStream(std::ostream& stream);
-
-    // simple tuple class, so no getters/setters
+    std::ostream& toStream(std::ostream& stream);
+  
+    // simple tuple class, so no getters/setters. (ordered widest first, so there's no padding between members)
     time_t time;
     double value;
-    Qual_t quality;
     double confidence;
+    Qual_t quality;
     bool isValid;
-    
+  
     // static class methods
     static Point convertPoint(const Point& point, const Units& fromUnits, const Units& toUnits);
+    static Point convertPoint(const Point& point, const UnitConverter& converter);
     static bool comparePointTime(const Point& left, const Point& right);
-    
+  
   };
-
+  
   std::ostream& operator<< (std::ostream &out, Point &point);
-
+  
+  
+//!   A 24-byte, plain-old-data form of a Point, for storing or sending points as raw bytes.
+/*!
+      Quality and validity are packed into the low byte of the time stamp, so the time keeps 56 bits. Packing and
+      unpacking are lossless. Arrays of these can be written, mapped or memcpy'd as they are.
+*/
+  class PackedPoint {
+  public:
+    static PackedPoint pack(const Point& point);
+    Point unpack() const;
+    time_t time() const;
+  
+    // no constructors, so it stays a POD
+    int64_t stamp;  //! time << 8 | quality << 1 | isValid
+    double value;
+    double confidence;
+  };
+  
+  
+//!   Callback interface for streaming Points out of a PointRecord or TimeSeries without copying them into a vector.
+/*!
+      Implement visit() and pass the visitor to one of the visitPoints methods. Points are handed over in time order,
+      and the visitor can end the scan early by returning false. The Point reference is only good for the duration
+      of the call.
+*/
+  class PointVisitor {
+  public:
+    virtual ~PointVisitor() {};
+    virtual bool visit(const Point& point) = 0;
+  };
+  
 }
 
 #endif
\ No newline at end of file
@@ -7,15 +7,18 @@
 //  
 
 #include <iostream>
+#include <algorithm>
 
 #include "PointRecord.h"
 #include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+#include "SteadyClock.h"
 
 using namespace RTX;
 using namespace std;
 
 
-PointRecord::PointRecord() {
+PointRecord::PointRecord() : _cacheHits(0), _cacheMisses(0), _queries(0), _pointsFetched(0), _queryMicroseconds(0), _peakFootprint(0) {
 }
 
 std::ostream& RTX::operator<< (std::ostream &out, PointRecord &pr) {
@@ -67,6 +70,15 @@ std::vector<Point> PointRecord::pointsInRange(const string& identifier, time_t s
   return pointVector;
 }
 
+void PointRecord::visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  std::vector<Point> points = this->pointsInRange(identifier, startTime, endTime);
+  BOOST_FOREACH(const Point& point, points) {
+    if (!visitor.visit(point)) {
+      break;
+    }
+  }
+}
+
 Point PointRecord::firstPoint(const string &id) {
   return Point();
 }
@@ -85,11 +97,251 @@ void PointRecord::addPoint(const string& identifier, Point point) {
 }
 
 
-void PointRecord::addPoints(const string& identifier, std::vector<Point> points) {
+void PointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
+  
+}
+
+
+void PointRecord::mergePoints(const string& identifier, const std::vector<Point>& points) {
+  BOOST_FOREACH(const Point& point, points) {
+    this->addPoint(identifier, point);
+  }
+}
+
+
+unsigned long PointRecord::evictionCount(const std::string& identifier) {
+  // the base record never drops anything by itself.
+  return 0;
+}
+
+namespace {
+  // buckets points as they go by; the points arrive in time order, so only the last bucket is ever open.
+  class SummaryVisitor : public PointVisitor {
+  public:
+    SummaryVisitor(std::vector<PointSummary>& summaries, time_t period) : _summaries(summaries), _period(period) {};
+    virtual bool visit(const Point& point) {
+      if (!point.isValid || point.quality == Point::missing) {
+        return true;
+      }
+      time_t bucketStart = point.time - (point.time % _period);
+      if (_summaries.empty() || _summaries.back().time != bucketStart) {
+        _summaries.push_back(PointSummary(bucketStart, _period));
+      }
+      _summaries.back().add(point.value);
+      return true;
+    }
+  private:
+    std::vector<PointSummary>& _summaries;
+    time_t _period;
+  };
+}
+
+std::vector<PointSummary> PointRecord::summaries(const std::string& identifier, time_t startTime, time_t endTime, time_t resolution) {
+  std::vector<PointSummary> summaries;
+  if (resolution < 1) {
+    resolution = 1;
+  }
+  if (endTime < startTime) {
+    return summaries;
+  }
+  // from the start of the first bucket to the end of the last one
+  time_t first = startTime - (startTime % resolution);
+  time_t last = endTime - (endTime % resolution) + resolution - 1;
+  SummaryVisitor visitor(summaries, resolution);
+  this->visitPointsInRange(identifier, first, last, visitor);
+  return summaries;
+}
+
+std::vector<PointSummary> PointRecord::summarize(const std::vector<Point>& points, time_t resolution) {
+  std::vector<PointSummary> summaries;
+  SummaryVisitor visitor(summaries, (resolution < 1) ? 1 : resolution);
+  BOOST_FOREACH(const Point& point, points) {
+    visitor.visit(point);
+  }
+  return summaries;
+}
+
+const std::vector<Point>& PointRecord::orderedPoints(const std::vector<Point>& points, std::vector<Point>& scratch) {
+  // batches nearly always arrive in order already, so only pay for a copy when they don't.
+  for (size_t i = 1; i < points.size(); ++i) {
+    if (points[i].time <= points[i-1].time) {
+      scratch = points;
+      std::stable_sort(scratch.begin(), scratch.end(), &Point::comparePointTime);
+      return scratch;
+    }
+  }
+  return points;
+}
+
+
+#pragma mark - Handles
+
+PointRecord::handle_t PointRecord::registerAndGetHandle(const std::string& recordName) {
+  // let the derived class do whatever it needs to register the name
+  std::string identifier = this->registerAndGetIdentifier(recordName);
+  
+  boost::unique_lock<boost::shared_mutex> lock(_handleMutex);
+  std::map<std::string, handle_t>::const_iterator it = _handles.find(identifier);
+  if (it != _handles.end()) {
+    return it->second;
+  }
   
+  handle_t handle = _handleNames.size();
+  _handleNames.push_back(identifier);
+  _handles.insert(make_pair(identifier, handle));
+  return handle;
+}
+
+const std::string& PointRecord::identifierForHandle(handle_t handle) {
+  static const std::string unknown("");
+  boost::shared_lock<boost::shared_mutex> lock(_handleMutex);
+  if (handle < _handleNames.size()) {
+    return _handleNames[handle];
+  }
+  return unknown;
+}
+
+// default implementations go through the named methods, so subclasses get correct behavior without doing a thing.
+Point PointRecord::point(handle_t handle, time_t time) {
+  return this->point(identifierForHandle(handle), time);
+}
+
+Point PointRecord::pointBefore(handle_t handle, time_t time) {
+  return this->pointBefore(identifierForHandle(handle), time);
+}
+
+Point PointRecord::pointAfter(handle_t handle, time_t time) {
+  return this->pointAfter(identifierForHandle(handle), time);
+}
+
+std::vector<Point> PointRecord::pointsInRange(handle_t handle, time_t startTime, time_t endTime) {
+  return this->pointsInRange(identifierForHandle(handle), startTime, endTime);
+}
+
+void PointRecord::visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  this->visitPointsInRange(identifierForHandle(handle), startTime, endTime, visitor);
+}
+
+void PointRecord::addPoint(handle_t handle, Point point) {
+  this->addPoint(identifierForHandle(handle), point);
+}
+
+void PointRecord::addPoints(handle_t handle, const std::vector<Point>& points) {
+  this->addPoints(identifierForHandle(handle), points);
+}
+
+void PointRecord::mergePoints(handle_t handle, const std::vector<Point>& points) {
+  this->mergePoints(identifierForHandle(handle), points);
 }
 
 
+#pragma mark - Observers
+
+void PointRecord::addObserver(const std::string& identifier, PointRecordObserver* observer) {
+  boost::unique_lock<boost::mutex> lock(_observerMutex);
+  _observers[identifier].push_back(observer);
+}
+
+void PointRecord::removeObserver(const std::string& identifier, PointRecordObserver* observer) {
+  boost::unique_lock<boost::mutex> lock(_observerMutex);
+  map<string, vector<PointRecordObserver*> >::iterator found = _observers.find(identifier);
+  if (found == _observers.end()) {
+    return;
+  }
+  vector<PointRecordObserver*>& observers = found->second;
+  vector<PointRecordObserver*>::iterator it = std::find(observers.begin(), observers.end(), observer);
+  if (it != observers.end()) {
+    observers.erase(it);
+  }
+  if (observers.empty()) {
+    _observers.erase(found);
+  }
+}
+
+void PointRecord::notifyObservers(const std::string& identifier, const std::vector<Point>& points) {
+  if (points.empty()) {
+    return;
+  }
+  // copied out, so an observer can (un)register from inside the callback
+  vector<PointRecordObserver*> observers;
+  {
+    boost::unique_lock<boost::mutex> lock(_observerMutex);
+    map<string, vector<PointRecordObserver*> >::iterator found = _observers.find(identifier);
+    if (found == _observers.end()) {
+      return;
+    }
+    observers = found->second;
+  }
+  BOOST_FOREACH(PointRecordObserver* observer, observers) {
+    observer->recordDidAddPoints(this, identifier, points);
+  }
+}
+
+
+#pragma mark - Instrumentation
+
+PointRecord::stats_t PointRecord::stats() {
+  stats_t stats;
+  stats.cacheHits = _cacheHits;
+  stats.cacheMisses = _cacheMisses;
+  stats.queries = _queries;
+  stats.pointsFetched = _pointsFetched;
+  stats.querySeconds = (double)_queryMicroseconds / 1.e6;
+  return stats;
+}
+
+void PointRecord::resetStats() {
+  _cacheHits = 0;
+  _cacheMisses = 0;
+  _queries = 0;
+  _pointsFetched = 0;
+  _queryMicroseconds = 0;
+}
+
+PointRecord::QueryTimer::QueryTimer(PointRecord& record) : _record(record), _started(0) {
+  RTX_STATS(_started = steadyMicroseconds());
+}
+
+PointRecord::QueryTimer::~QueryTimer() {
+  RTX_STATS(_record._queries.fetch_add(1, boost::memory_order_relaxed));
+  RTX_STATS(_record._queryMicroseconds.fetch_add(steadyMicroseconds() - _started, boost::memory_order_relaxed));
+}
+
+void PointRecord::QueryTimer::fetched(size_t points) {
+  RTX_STATS(_record._pointsFetched.fetch_add((unsigned long)points, boost::memory_order_relaxed));
+}
+
+
+#pragma mark - Memory
+
+size_t PointRecord::memoryFootprint() {
+  size_t bytes = 0;
+  BOOST_FOREACH(const string& id, identifiers()) {
+    bytes += seriesMemoryFootprint(id);
+  }
+  notePeakFootprint(bytes);
+  return bytes;
+}
+
+size_t PointRecord::seriesMemoryFootprint(const std::string& identifier) {
+  return 0;
+}
+
+size_t PointRecord::peakMemoryFootprint() {
+  notePeakFootprint(memoryFootprint());
+  return _peakFootprint.load();
+}
+
+void PointRecord::notePeakFootprint(size_t bytes) {
+  size_t peak = _peakFootprint.load(boost::memory_order_relaxed);
+  while (bytes > peak && !_peakFootprint.compare_exchange_weak(peak, bytes, boost::memory_order_relaxed)) {
+    // peak is reloaded by the failed exchange
+  }
+}
+
+
+#pragma mark - Reset
+
 void PointRecord::reset() {
   
 }
@@ -99,3 +351,46 @@ void PointRecord::reset(const string& identifier) {
 }
 
 
+#pragma mark - PointSummary
+
+PointSummary::PointSummary(time_t time, time_t period) {
+  this->time = time;
+  this->period = period;
+  min = 0;
+  max = 0;
+  sum = 0;
+  count = 0;
+}
+
+void PointSummary::add(double value) {
+  if (count == 0) {
+    min = value;
+    max = value;
+  }
+  else {
+    min = RTX_MIN(min, value);
+    max = RTX_MAX(max, value);
+  }
+  sum += value;
+  ++count;
+}
+
+void PointSummary::add(const PointSummary& summary) {
+  if (summary.count == 0) {
+    return;
+  }
+  if (count == 0) {
+    min = summary.min;
+    max = summary.max;
+  }
+  else {
+    min = RTX_MIN(min, summary.min);
+    max = RTX_MAX(max, summary.max);
+  }
+  sum += summary.sum;
+  count += summary.count;
+}
+
+double PointSummary::mean() const {
+  return (count > 0) ? (sum / count) : 0.;
+}
@@ -14,19 +14,59 @@
 #include <vector>
 #include <deque>
 #include <fstream>
+#include <map>
 
 #include "Point.h"
 #include "rtxMacros.h"
 #include "rtxExceptions.h"
 
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/atomic.hpp>
+
 using std::string;
 
 namespace RTX {
   
+  class PointRecord;
+  
+//!   Callback interface for hearing about points that are pushed into a PointRecord from outside.
+/*!
+      Register with PointRecord::addObserver for one identifier. Points arrive in whatever batches the feed delivers
+      them, already stored in the record. TimeSeries implements this to pick up new data in its own record.
+*/
+  class PointRecordObserver {
+  public:
+    virtual ~PointRecordObserver() {};
+    virtual void recordDidAddPoints(PointRecord* record, const std::string& identifier, const std::vector<Point>& points) = 0;
+  };
+  
+//!   Min, max, mean and count of the points in one time bucket.
+/*!
+      Buckets start on a multiple of their period (counted from the epoch) and run for period seconds.
+      Only valid points that aren't missing are counted.
+*/
+  class PointSummary {
+  public:
+    PointSummary(time_t time = 0, time_t period = 0);
+    void add(double value);
+    void add(const PointSummary& summary);
+    double mean() const;
+  
+    // simple tuple class, so no getters/setters
+    time_t time;
+    time_t period;
+    double min;
+    double max;
+    double sum;
+    size_t count;
+  };
+  
   /*! 
    \class PointRecord
    \brief A Point Record Class for storing and retrieving Points.
-   
+  
    The base PointRecord class just keeps short-term records. Derive to add specific persistence implementations
    */
   
@@ -47,43 +87,185 @@ namespace RTX {
    \return The requested Points (as a vector of shared pointers)
    \sa Point
    */
+  /*!
+   \fn void PointRecord::visitPointsInRange(const std::string &name, time_t startTime, time_t endTime, PointVisitor& visitor)
+   \brief Stream the Points within a time range through a visitor, without building a vector.
+   \param name The name of the data source (tag name).
+   \param startTime The beginning of the requested time range.
+   \param endTime The end of the requested time range.
+   \param visitor Called once per Point, in time order; return false from PointVisitor::visit to stop early.
+  
+   Records that keep their points in memory visit their storage in place, holding a read lock for the duration of
+   the scan -- so the visitor must not write back into the same record. The base implementation just walks the
+   result of pointsInRange().
+   \sa PointVisitor
+   */
+  /*!
+   \fn std::vector<PointSummary> PointRecord::summaries(const std::string& identifier, time_t startTime, time_t endTime, time_t resolution)
+   \brief Summarize a time range in buckets, for displaying long ranges at low resolution.
+   \param identifier The name of the data source (tag name).
+   \param startTime The beginning of the requested time range.
+   \param endTime The end of the requested time range.
+   \param resolution The widest bucket the caller can use, in seconds.
+   \return The non-empty buckets that overlap the range, in time order. Each one's period is at most the resolution.
+  
+   The base implementation visits every point in the range and buckets them at the requested resolution, so it costs
+   as much as reading the raw data. RollupPointRecord keeps precomputed buckets and answers from those instead.
+   Buckets are whole, so the first and last may count points just outside the range.
+   \sa RollupPointRecord
+   */
+  /*!
+   \fn PointRecord::handle_t PointRecord::registerAndGetHandle(const std::string& recordName)
+   \brief Register a record name and get a compact integer handle for it.
+   \param recordName The name of the data source (tag name).
+   \return A handle that can be passed to the handle-based accessors in place of the name.
+  
+   Handles are assigned sequentially and stay valid for the lifetime of the PointRecord. The handle-based accessors
+   avoid string comparisons and lookups on the hot path; by default they just forward to the named versions, so
+   derived classes only need to override them where there is a faster route to the data.
+   */
+  /*!
+   \fn void PointRecord::mergePoints(const std::string& identifier, const std::vector<Point>& points)
+   \brief Add points to what's held, in any order, without giving up any of it for them.
+   \param identifier The name of the data source (tag name).
+   \param points The points to add. A point at a time already held replaces it.
+  
+   addPoints() takes a batch to be a fetched range, and a record may drop what it held around it (BufferPointRecord
+   does, if they don't meet). A batch of samples off a feed isn't one -- it's so many addPoint calls, and that's what
+   the base implementation makes of it. BufferPointRecord sorts and merges the batch under one lock.
+   \sa IngestQueue
+   */
+  /*!
+   \fn void PointRecord::notifyObservers(const std::string& identifier, const std::vector<Point>& points)
+   \brief Tell whoever is watching an identifier that new points have been stored for it.
+   \param identifier The name of the data source (tag name).
+   \param points The points that were just added.
+  
+   addPoint() and addPoints() don't call this -- they are also how TimeSeries caches what it computes. It's for
+   whatever feeds the record from outside (a historian poller, a SCADA listener) to call after each write, so that
+   the series reading from the record can push the new data downstream instead of waiting to be asked.
+   */
+  /*!
+   \fn PointRecord::stats_t PointRecord::stats()
+   \brief How the record's reads have been answered, since it was made or since resetStats().
+  
+   Only records with something behind their in-memory cache (DbPointRecord) count anything: a read answered from
+   memory is a hit, one that had to go to the backing store is a miss, and each round trip it took is a query.
+   A slow run that shows many queries for few points fetched is reading a little at a time. All zero in an
+   RTX_NO_INSTRUMENTATION build.
+   \sa TimeSeries::stats
+   */
+  /*!
+   \fn size_t PointRecord::seriesMemoryFootprint(const std::string& identifier)
+   \brief Bytes the record holds in memory for one series' points -- what's reserved, not just what's used.
+  
+   Zero for records that can't say, or that keep nothing in memory. memoryFootprint() is the whole record's, by
+   default the sum over its identifiers. peakMemoryFootprint() is the most that has been seen:
+   records whose storage only grows in steps they can see (BufferPointRecord) note it as it happens, and any record
+   notes it whenever its footprint is asked for.
+   \sa TimeSeries::memoryFootprint, Model::memoryFootprint
+   */
+  
   
-    
   class PointRecord {
-    
+  
   public:
     RTX_SHARED_POINTER(PointRecord);
     typedef std::pair<time_t, time_t> time_pair_t;
-    
+    typedef size_t handle_t;
+  
     PointRecord();
     virtual ~PointRecord() {};
-    
+  
     virtual std::string registerAndGetIdentifier(std::string recordName);    // registering record names.
     virtual std::vector<std::string> identifiers();
-    
+  
     //virtual bool isPointAvailable(const string& identifier, time_t time);
     virtual Point point(const string& identifier, time_t time);
     virtual Point pointBefore(const string& identifier, time_t time);
     virtual Point pointAfter(const string& identifier, time_t time);
     virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor);
     virtual void addPoint(const string& identifier, Point point);
-    virtual void addPoints(const string& identifier, std::vector<Point> points);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
+    virtual void mergePoints(const string& identifier, const std::vector<Point>& points);
     virtual void reset();
     virtual void reset(const string& identifier);
     virtual Point firstPoint(const string& id);
     virtual Point lastPoint(const string& id);
     virtual time_pair_t range(const string& id);
-    
+    virtual unsigned long evictionCount(const std::string& identifier); //! times points were dropped on the record's own account (0 if never)
+    virtual std::vector<PointSummary> summaries(const std::string& identifier, time_t startTime, time_t endTime, time_t resolution);
+  
+    // handle-based access
+    handle_t registerAndGetHandle(const std::string& recordName);
+    const std::string& identifierForHandle(handle_t handle);
+    virtual Point point(handle_t handle, time_t time);
+    virtual Point pointBefore(handle_t handle, time_t time);
+    virtual Point pointAfter(handle_t handle, time_t time);
+    virtual std::vector<Point> pointsInRange(handle_t handle, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(handle_t handle, Point point);
+    virtual void addPoints(handle_t handle, const std::vector<Point>& points);
+    virtual void mergePoints(handle_t handle, const std::vector<Point>& points);
+  
+    // push notification
+    void addObserver(const std::string& identifier, PointRecordObserver* observer);
+    void removeObserver(const std::string& identifier, PointRecordObserver* observer);
+    void notifyObservers(const std::string& identifier, const std::vector<Point>& points);
+  
+    // instrumentation
+    class stats_t {
+    public:
+      stats_t() : cacheHits(0), cacheMisses(0), queries(0), pointsFetched(0), querySeconds(0) {};
+      // simple tuple class, so no getters/setters
+      unsigned long cacheHits;      // reads answered from memory
+      unsigned long cacheMisses;    // reads that went to the backing store
+      unsigned long queries;        // round trips to the backing store
+      unsigned long pointsFetched;  // points those brought back
+      double querySeconds;          // wall time spent in them
+    };
+    stats_t stats();
+    void resetStats();
+  
+    // memory accounting
+    virtual size_t memoryFootprint();
+    virtual size_t seriesMemoryFootprint(const std::string& identifier);
+    size_t peakMemoryFootprint();
+  
     virtual std::ostream& toStream(std::ostream &stream);
-
+  
   protected:
-    std::string _cachedPointId;
-    Point _cachedPoint;
+    static std::vector<PointSummary> summarize(const std::vector<Point>& points, time_t resolution); //! bucket points that are already in hand
+    //! the batch itself if its times are strictly increasing, otherwise a stably sorted copy of it left in scratch
+    static const std::vector<Point>& orderedPoints(const std::vector<Point>& points, std::vector<Point>& scratch);
+  
+    void notePeakFootprint(size_t bytes); //! for records that see their footprint grow
+    void countLookup(bool hit) { RTX_STATS((hit ? _cacheHits : _cacheMisses).fetch_add(1, boost::memory_order_relaxed)); }
+    //! counts and times one round trip to the backing store, for stats(). hold one around each select.
+    class QueryTimer : boost::noncopyable {
+    public:
+      QueryTimer(PointRecord& record);
+      ~QueryTimer();
+      void fetched(size_t points); //! how many points the query brought back
+    private:
+      PointRecord& _record;
+      unsigned long _started; // microseconds
+    };
+  
+  private:
+    boost::atomic<unsigned long> _cacheHits, _cacheMisses, _queries, _pointsFetched, _queryMicroseconds;
+    boost::atomic<size_t> _peakFootprint;
+    std::deque<std::string> _handleNames; // deque, so references handed out stay valid as it grows
+    std::map<std::string, handle_t> _handles;
+    boost::shared_mutex _handleMutex;
+    std::map<std::string, std::vector<PointRecordObserver*> > _observers;
+    boost::mutex _observerMutex;
   
   };
   
   std::ostream& operator<< (std::ostream &out, PointRecord &pr);
-
+  
 }
 
 #endif
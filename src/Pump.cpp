@@ -16,6 +16,8 @@ Pump::Pump(const std::string& name, Node::sharedPointer startNode, Node::sharedP
   setType(PUMP);
   _doesHaveCurveParameter = false;
   _doesHaveEnergyParameter = false;
+  _efficiency = 75;
+  _energyPrice = 0;
   _energyState.reset( new TimeSeries() );
   _energyState->setName("L " + name + " energy");
 }
@@ -58,3 +60,35 @@ void Pump::setEnergyMeasure(TimeSeries::sharedPointer energy) {
   _doesHaveEnergyParameter = (energy ? true : false);
   _energyMeasure = energy;
 }
+
+Pump::curve_t Pump::efficiencyCurve() {
+  return _efficiencyCurve;
+}
+
+void Pump::setEfficiencyCurve(const curve_t& curve) {
+  _efficiencyCurve = curve;
+}
+
+double Pump::efficiency() {
+  return _efficiency;
+}
+
+void Pump::setEfficiency(double percent) {
+  _efficiency = percent;
+}
+
+double Pump::energyPrice() {
+  return _energyPrice;
+}
+
+void Pump::setEnergyPrice(double price) {
+  _energyPrice = price;
+}
+
+std::vector<double> Pump::energyPricePattern() {
+  return _energyPricePattern;
+}
+
+void Pump::setEnergyPricePattern(const std::vector<double>& multipliers) {
+  _energyPricePattern = multipliers;
+}
@@ -9,6 +9,7 @@
 #ifndef epanet_rtx_Pump_h
 #define epanet_rtx_Pump_h
 
+#include <vector>
 #include "Pipe.h"
 
 namespace RTX {
@@ -32,12 +33,26 @@ namespace RTX {
     TimeSeries::sharedPointer energyMeasure();
     void setEnergyMeasure(TimeSeries::sharedPointer energy);
     
+    // energy data, from the network (see EnergyAccounting)
+    typedef std::vector<std::pair<double, double> > curve_t;
+    curve_t efficiencyCurve();   // flow, in flow()'s units, to efficiency (%) -- empty to use efficiency()
+    void setEfficiencyCurve(const curve_t& curve);
+    double efficiency();         // %, without a curve
+    void setEfficiency(double percent);
+    double energyPrice();        // per kwh
+    void setEnergyPrice(double price);
+    std::vector<double> energyPricePattern(); // multipliers by pattern period, empty for none
+    void setEnergyPricePattern(const std::vector<double>& multipliers);
+    
   private:
     TimeSeries::sharedPointer _energyState;        // state
     TimeSeries::sharedPointer _energyMeasure; // parameter
     TimeSeries::sharedPointer _curve;
     bool _doesHaveCurveParameter;
     bool _doesHaveEnergyParameter;
+    curve_t _efficiencyCurve;
+    double _efficiency, _energyPrice;
+    std::vector<double> _energyPricePattern;
   };
 
 }
@@ -0,0 +1,450 @@
+//
+//  RegularPointRecord.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "RegularPointRecord.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
+// rounds toward negative infinity, so times before the clock start still land on the right step
+static long floorDivide(time_t numerator, time_t denominator) {
+  long quotient = (long)(numerator / denominator);
+  if ((numerator % denominator != 0) && ((numerator < 0) != (denominator < 0))) {
+    --quotient;
+  }
+  return quotient;
+}
+
+namespace {
+  // collects visited points into a vector
+  class PointCollector : public PointVisitor {
+  public:
+    PointCollector(std::vector<Point>& points) : _points(points) {};
+    virtual bool visit(const Point& point) {
+      _points.push_back(point);
+      return true;
+    }
+  private:
+    std::vector<Point>& _points;
+  };
+}
+
+
+#pragma mark - Series
+
+RegularPointRecord::Series::Series(size_t capacity) : values(capacity), confidences(capacity), qualities(capacity), valid(capacity, false), evictions(0) {
+  clear();
+}
+
+size_t RegularPointRecord::Series::slot(long step) const {
+  return (head + (size_t)(step - firstStep)) % valid.size();
+}
+
+void RegularPointRecord::Series::clear() {
+  firstStep = 0;
+  count = 0;
+  head = 0;
+  valid.assign(valid.size(), false);
+}
+
+
+#pragma mark - Constructor
+
+RegularPointRecord::RegularPointRecord(time_t period, time_t start, size_t capacity) {
+  _period = (period > 0) ? period : 1;
+  _start = start;
+  _capacity = (capacity > 0) ? capacity : 1;
+}
+
+std::ostream& RTX::operator<< (std::ostream &out, RegularPointRecord &pr) {
+  return pr.toStream(out);
+}
+
+std::ostream& RegularPointRecord::toStream(std::ostream &stream) {
+  stream << "Regular Point Record (period " << _period << ", " << _capacity << " steps per series)" << std::endl;
+  return stream;
+}
+
+time_t RegularPointRecord::period() {
+  return _period;
+}
+
+time_t RegularPointRecord::start() {
+  return _start;
+}
+
+size_t RegularPointRecord::capacity() {
+  return _capacity;
+}
+
+size_t RegularPointRecord::seriesMemoryFootprint(const std::string& identifier) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return 0;
+  }
+  return _capacity * (2 * sizeof(double) + sizeof(Point::Qual_t)) + (_capacity + 7) / 8;
+}
+
+
+#pragma mark - Registration
+
+std::string RegularPointRecord::registerAndGetIdentifier(std::string recordName) {
+  writeLock_t registryLock(_registryMutex);
+  if (_series.find(recordName) == _series.end()) {
+    _series[recordName] = SeriesPointer( new Series(_capacity) );
+  }
+  return recordName;
+}
+
+std::vector<std::string> RegularPointRecord::identifiers() {
+  typedef std::map<std::string, SeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  vector<string> names;
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    names.push_back(entry.first);
+  }
+  return names;
+}
+
+RegularPointRecord::SeriesPointer RegularPointRecord::seriesForName(const std::string& identifier) {
+  readLock_t registryLock(_registryMutex);
+  std::map<std::string, SeriesPointer>::iterator it = _series.find(identifier);
+  if (it == _series.end()) {
+    return SeriesPointer();
+  }
+  return it->second;
+}
+
+RegularPointRecord::SeriesPointer RegularPointRecord::seriesForHandle(handle_t handle) {
+  // flat lookup table, filled in lazily.
+  {
+    readLock_t registryLock(_registryMutex);
+    if (handle < _handleSeries.size() && _handleSeries[handle]) {
+      return _handleSeries[handle];
+    }
+  }
+  
+  const std::string& identifier = identifierForHandle(handle);
+  writeLock_t registryLock(_registryMutex);
+  std::map<std::string, SeriesPointer>::iterator it = _series.find(identifier);
+  if (it == _series.end()) {
+    return SeriesPointer();
+  }
+  if (handle >= _handleSeries.size()) {
+    _handleSeries.resize(handle + 1);
+  }
+  _handleSeries[handle] = it->second;
+  return it->second;
+}
+
+
+#pragma mark - Named Access
+
+Point RegularPointRecord::point(const string& identifier, time_t time) {
+  return pointFromSeries(seriesForName(identifier), time);
+}
+
+Point RegularPointRecord::pointBefore(const string& identifier, time_t time) {
+  return pointBeforeFromSeries(seriesForName(identifier), time);
+}
+
+Point RegularPointRecord::pointAfter(const string& identifier, time_t time) {
+  return pointAfterFromSeries(seriesForName(identifier), time);
+}
+
+std::vector<Point> RegularPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
+  std::vector<Point> points;
+  PointCollector collector(points);
+  visitSeries(seriesForName(identifier), startTime, endTime, collector);
+  return points;
+}
+
+void RegularPointRecord::visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  visitSeries(seriesForName(identifier), startTime, endTime, visitor);
+}
+
+void RegularPointRecord::addPoint(const string& identifier, Point point) {
+  addToSeries(seriesForName(identifier), std::vector<Point>(1, point));
+}
+
+void RegularPointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
+  addToSeries(seriesForName(identifier), points);
+}
+
+void RegularPointRecord::reset() {
+  typedef std::map<std::string, SeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    writeLock_t seriesLock(entry.second->mutex);
+    entry.second->clear();
+  }
+}
+
+void RegularPointRecord::reset(const string& identifier) {
+  SeriesPointer series = seriesForName(identifier);
+  if (series) {
+    writeLock_t seriesLock(series->mutex);
+    series->clear();
+  }
+}
+
+Point RegularPointRecord::firstPoint(const string& id) {
+  SeriesPointer series = seriesForName(id);
+  if (!series) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  for (long step = series->firstStep; step < series->firstStep + (long)series->count; ++step) {
+    if (series->valid[series->slot(step)]) {
+      return pointAt(*series, step);
+    }
+  }
+  return Point();
+}
+
+Point RegularPointRecord::lastPoint(const string& id) {
+  SeriesPointer series = seriesForName(id);
+  if (!series) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  for (long step = series->firstStep + (long)series->count - 1; step >= series->firstStep; --step) {
+    if (series->valid[series->slot(step)]) {
+      return pointAt(*series, step);
+    }
+  }
+  return Point();
+}
+
+PointRecord::time_pair_t RegularPointRecord::range(const string& id) {
+  return make_pair(firstPoint(id).time, lastPoint(id).time);
+}
+
+unsigned long RegularPointRecord::evictionCount(const std::string& identifier) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return 0;
+  }
+  readLock_t seriesLock(series->mutex);
+  return series->evictions;
+}
+
+
+#pragma mark - Handle Access
+
+Point RegularPointRecord::point(handle_t handle, time_t time) {
+  return pointFromSeries(seriesForHandle(handle), time);
+}
+
+Point RegularPointRecord::pointBefore(handle_t handle, time_t time) {
+  return pointBeforeFromSeries(seriesForHandle(handle), time);
+}
+
+Point RegularPointRecord::pointAfter(handle_t handle, time_t time) {
+  return pointAfterFromSeries(seriesForHandle(handle), time);
+}
+
+std::vector<Point> RegularPointRecord::pointsInRange(handle_t handle, time_t startTime, time_t endTime) {
+  std::vector<Point> points;
+  PointCollector collector(points);
+  visitSeries(seriesForHandle(handle), startTime, endTime, collector);
+  return points;
+}
+
+void RegularPointRecord::visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  visitSeries(seriesForHandle(handle), startTime, endTime, visitor);
+}
+
+void RegularPointRecord::addPoint(handle_t handle, Point point) {
+  addToSeries(seriesForHandle(handle), std::vector<Point>(1, point));
+}
+
+void RegularPointRecord::addPoints(handle_t handle, const std::vector<Point>& points) {
+  addToSeries(seriesForHandle(handle), points);
+}
+
+
+#pragma mark - Step Arithmetic
+
+bool RegularPointRecord::stepForTime(time_t time, long& step) {
+  time_t offset = time - _start;
+  if (offset % _period != 0) {
+    return false;
+  }
+  step = floorDivide(offset, _period);
+  return true;
+}
+
+time_t RegularPointRecord::timeForStep(long step) {
+  return _start + (time_t)step * _period;
+}
+
+Point RegularPointRecord::pointAt(Series& series, long step) {
+  if (step < series.firstStep || step >= series.firstStep + (long)series.count) {
+    return Point();
+  }
+  size_t slot = series.slot(step);
+  if (!series.valid[slot]) {
+    return Point();
+  }
+  return Point(timeForStep(step), series.values[slot], series.qualities[slot], series.confidences[slot]);
+}
+
+void RegularPointRecord::store(Series& series, const Point& point) {
+  long step;
+  if (!stepForTime(point.time, step)) {
+    return;
+  }
+  long capacity = (long)_capacity;
+  
+  if (series.count == 0) {
+    series.firstStep = step;
+    series.head = 0;
+    series.count = 1;
+  }
+  else if (step >= series.firstStep + (long)series.count) {
+    // past the end: drop whatever falls off the front, then open up empty steps up to this one.
+    long overflow = step - series.firstStep - capacity + 1;
+    if (overflow > 0) {
+      ++series.evictions;
+    }
+    if (overflow >= (long)series.count) {
+      series.clear();
+      series.firstStep = step;
+      series.count = 1;
+    }
+    else {
+      if (overflow > 0) {
+        for (long dropped = 0; dropped < overflow; ++dropped) {
+          series.valid[series.head] = false;
+          series.head = (series.head + 1) % _capacity;
+        }
+        series.firstStep += overflow;
+        series.count -= overflow;
+      }
+      for (long empty = series.firstStep + (long)series.count; empty < step; ++empty) {
+        series.valid[series.slot(empty)] = false;
+      }
+      series.count = (size_t)(step - series.firstStep + 1);
+    }
+  }
+  else if (step < series.firstStep) {
+    // before the start: grow backward if it still fits, otherwise start over here.
+    long lastStep = series.firstStep + (long)series.count - 1;
+    if (lastStep - step < capacity) {
+      long grow = series.firstStep - step;
+      series.head = (series.head + _capacity - (size_t)grow) % _capacity;
+      series.firstStep = step;
+      series.count += (size_t)grow;
+      for (long empty = step + 1; empty < step + grow; ++empty) {
+        series.valid[series.slot(empty)] = false;
+      }
+    }
+    else {
+      ++series.evictions;
+      series.clear();
+      series.firstStep = step;
+      series.count = 1;
+    }
+  }
+  
+  size_t slot = series.slot(step);
+  series.values[slot] = point.value;
+  series.confidences[slot] = point.confidence;
+  series.qualities[slot] = point.quality;
+  series.valid[slot] = true;
+}
+
+
+#pragma mark - Series Operations
+
+Point RegularPointRecord::pointFromSeries(SeriesPointer series, time_t time) {
+  long step;
+  if (!series || !stepForTime(time, step)) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  return pointAt(*series, step);
+}
+
+Point RegularPointRecord::pointBeforeFromSeries(SeriesPointer series, time_t time) {
+  if (!series) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  if (series->count == 0) {
+    return Point();
+  }
+  // the last step strictly before the time, walked back over any empty ones
+  long step = RTX_MIN(floorDivide(time - 1 - _start, _period), series->firstStep + (long)series->count - 1);
+  for (; step >= series->firstStep; --step) {
+    if (series->valid[series->slot(step)]) {
+      return pointAt(*series, step);
+    }
+  }
+  return Point();
+}
+
+Point RegularPointRecord::pointAfterFromSeries(SeriesPointer series, time_t time) {
+  if (!series) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  if (series->count == 0) {
+    return Point();
+  }
+  // the first step strictly after the time, walked forward over any empty ones
+  long step = RTX_MAX(floorDivide(time - _start, _period) + 1, series->firstStep);
+  for (; step < series->firstStep + (long)series->count; ++step) {
+    if (series->valid[series->slot(step)]) {
+      return pointAt(*series, step);
+    }
+  }
+  return Point();
+}
+
+void RegularPointRecord::visitSeries(SeriesPointer series, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  if (!series || endTime < startTime) {
+    return;
+  }
+  readLock_t seriesLock(series->mutex);
+  if (series->count == 0) {
+    return;
+  }
+  // the steps covering [startTime, endTime], clipped to the window
+  long first = RTX_MAX(-floorDivide(_start - startTime, _period), series->firstStep);
+  long last = RTX_MIN(floorDivide(endTime - _start, _period), series->firstStep + (long)series->count - 1);
+  for (long step = first; step <= last; ++step) {
+    size_t slot = series->slot(step);
+    if (!series->valid[slot]) {
+      continue;
+    }
+    Point p(timeForStep(step), series->values[slot], series->qualities[slot], series->confidences[slot]);
+    if (!visitor.visit(p)) {
+      break;
+    }
+  }
+}
+
+void RegularPointRecord::addToSeries(SeriesPointer series, const std::vector<Point>& points) {
+  if (!series) {
+    return;
+  }
+  writeLock_t seriesLock(series->mutex);
+  BOOST_FOREACH(const Point& p, points) {
+    store(*series, p);
+  }
+}
@@ -0,0 +1,127 @@
+//
+//  RegularPointRecord.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_RegularPointRecord_h
+#define epanet_rtx_RegularPointRecord_h
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Point.h"
+#include "rtxMacros.h"
+#include "PointRecord.h"
+
+#include <boost/thread/shared_mutex.hpp>
+
+namespace RTX {
+
+  /*!
+   \class RegularPointRecord
+   \brief An in-memory PointRecord for series on a regular clock, indexed by step number instead of by time.
+
+   Every series in the record shares one clock (period and start). A point's slot is just (time - start) / period,
+   so nothing needs to search and no timestamps are stored. Each series is a ring of the most recent capacity steps,
+   with a validity bitmap for steps that have no point. That suits modeled outputs (junction heads, pipe flows, ...)
+   which are all written on the hydraulic step.
+
+   Points that aren't on the clock are ignored. Writing past the end of the ring drops the oldest steps. A write too
+   far before the ring start to fit starts the series over from that point, like a discontinuous write to a
+   BufferPointRecord. Points at a time that is already stored replace it.
+   */
+
+  /*!
+   \fn RegularPointRecord::RegularPointRecord(time_t period, time_t start, size_t capacity)
+   \brief Create a record for series on a regular clock.
+   \param period Seconds between steps.
+   \param start Any time that falls on the clock.
+   \param capacity How many steps each series keeps.
+   */
+
+  class RegularPointRecord : public PointRecord {
+  public:
+    RTX_SHARED_POINTER(RegularPointRecord);
+    RegularPointRecord(time_t period, time_t start = 0, size_t capacity = 10000);
+    virtual ~RegularPointRecord() {};
+
+    virtual std::string registerAndGetIdentifier(std::string recordName);
+    virtual std::vector<std::string> identifiers();
+
+    virtual Point point(const string& identifier, time_t time);
+    virtual Point pointBefore(const string& identifier, time_t time);
+    virtual Point pointAfter(const string& identifier, time_t time);
+    virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(const string& identifier, Point point);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
+    virtual void reset();
+    virtual void reset(const string& identifier);
+    virtual Point firstPoint(const string& id);
+    virtual Point lastPoint(const string& id);
+    virtual time_pair_t range(const string& id);
+    virtual unsigned long evictionCount(const std::string& identifier);
+    virtual size_t seriesMemoryFootprint(const std::string& identifier); //! its whole window, full or not
+
+    virtual Point point(handle_t handle, time_t time);
+    virtual Point pointBefore(handle_t handle, time_t time);
+    virtual Point pointAfter(handle_t handle, time_t time);
+    virtual std::vector<Point> pointsInRange(handle_t handle, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(handle_t handle, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(handle_t handle, Point point);
+    virtual void addPoints(handle_t handle, const std::vector<Point>& points);
+
+    time_t period();
+    time_t start();
+    size_t capacity();
+
+    virtual std::ostream& toStream(std::ostream &stream);
+
+  private:
+    //! one series: a ring over steps [firstStep, firstStep + count), starting at ring slot "head"
+    class Series {
+    public:
+      Series(size_t capacity);
+      size_t slot(long step) const;                 //! ring slot of a step inside the window
+      void clear();
+      long firstStep;
+      size_t count;
+      size_t head;
+      std::vector<double> values;
+      std::vector<double> confidences;
+      std::vector<Point::Qual_t> qualities;
+      std::vector<bool> valid;
+      unsigned long evictions;
+      boost::shared_mutex mutex;
+    };
+    typedef boost::shared_ptr<Series> SeriesPointer;
+
+    SeriesPointer seriesForName(const std::string& identifier);
+    SeriesPointer seriesForHandle(handle_t handle);
+    bool stepForTime(time_t time, long& step);      //! false if the time isn't on the clock
+    time_t timeForStep(long step);
+    Point pointAt(Series& series, long step);       //! caller holds the lock; invalid if the step is empty
+    void store(Series& series, const Point& point); //! caller holds the write lock
+
+    Point pointFromSeries(SeriesPointer series, time_t time);
+    Point pointBeforeFromSeries(SeriesPointer series, time_t time);
+    Point pointAfterFromSeries(SeriesPointer series, time_t time);
+    void visitSeries(SeriesPointer series, time_t startTime, time_t endTime, PointVisitor& visitor);
+    void addToSeries(SeriesPointer series, const std::vector<Point>& points);
+
+    time_t _period, _start;
+    size_t _capacity;
+    std::map<std::string, SeriesPointer> _series;
+    std::vector<SeriesPointer> _handleSeries;
+    boost::shared_mutex _registryMutex;
+  };
+
+  std::ostream& operator<< (std::ostream &out, RegularPointRecord &pr);
+
+}
+
+#endif
@@ -9,10 +9,14 @@
 #include <iostream>
 
 #include "Resampler.h"
+#include "Log.h"
+#include "Scratch.h"
 #include <boost/foreach.hpp>
+#include <boost/bind/bind.hpp>
 
 using namespace RTX;
 using namespace std;
+using namespace boost::placeholders;
 
 Resampler::Resampler() : ModularTimeSeries::ModularTimeSeries() {
   
@@ -27,144 +31,53 @@ Resampler::~Resampler() {
 Point Resampler::point(time_t time) {
   // check the base-class availability. if it's cached or stored here locally, then send it on.
   // otherwise, check the upstream availability. if it can be produced, store it locally and pass it on.
-  Point p = TimeSeries::point(time);
-  if (p.isValid) {
-    return p;
-  }
-  else {
-    // check the requested time for validity...
-    if ( !(clock()->isValid(time)) ) {
-      // if the time is not valid, get out.
-      return Point();
-      //time = clock()->timeBefore(time);
-    }
-    // now that that's settled, get some source points and interpolate.
-    Point p0, p1, interpolatedPoint;
-    
-    Point sp = source()->point(time);
-    if (sp.isValid && sp.time == time) {
-      // if the source has the point, then no interpolation is needed.
-      interpolatedPoint = Point::convertPoint(sp, source()->units(), units());
-    }
-    else {
-      std::pair< Point, Point > sourcePoints = source()->adjacentPoints(time);
-      p0 = sourcePoints.first;
-      p1 = sourcePoints.second;
-      
-      if (!p0.isValid || !p1.isValid || p0.quality==Point::missing || p1.quality==Point::missing) {
-        // get out while the gettin's good
-        interpolatedPoint = Point(time, 0, Point::missing);
-        return interpolatedPoint;
-      }
-      
-      interpolatedPoint = interpolated(p0, p1, time, source()->units());
-    }
-    
-    insert(interpolatedPoint);
-    return interpolatedPoint;
-  }
+  return pointComputedOnce(time, boost::bind(&Resampler::computePoint, this, _1));
 }
 
-vector<Point> Resampler::points(time_t start, time_t end) {
-  Units sourceU = source()->units();
-  
-  // make sure the times are aligned with the clock.
-  time_t newStart = (clock()->isValid(start)) ? start : clock()->timeAfter(start);
-  time_t newEnd = (clock()->isValid(end)) ? end : clock()->timeBefore(end);
-  
-  PointRecord::time_pair_t prRange = record()->range(name());
-  if (prRange.first <= newStart && newEnd <= prRange.second) {
-    // the record's range covers it, but
-    // the record may not be continuous -- so check it.
-    time_t now = newStart;
-    time_t period = this->period();
-    vector<Point> rpVec = record()->pointsInRange(name(), newStart, newEnd);
-    if (rpVec.size() == 0) {
-      // fully internal
-      // like this:
-      // ppppp---[--- req ---]---ppppp
-      
-      rpVec.push_back(record()->pointBefore(name(), newStart));
-      rpVec.push_back(record()->pointAfter(name(), newEnd));
-      
-    }
-    
-    
-    vector<Point> stitchedPoints;
-    vector<Point>::const_iterator it = rpVec.begin();
-    while (it != rpVec.end()) {
-      Point recordPoint = *it;
-      // cout << "P: " << recordPoint << endl;
-      
-      if (recordPoint.time == now) {
-        stitchedPoints.push_back(recordPoint);
-        now += period;
-      }
-      else if (recordPoint.time < now) {
-        ++it;
-        continue;
-      }
-      else {
-        // aha, a gap.
-        // determine the size of the gap
-        time_t gapStart, gapEnd;
-        
-        gapStart = now;
-        gapEnd = recordPoint.time;
-        
-        
-        Point gapSourceStart = source()->pointBefore(gapStart);
-        Point gapSourceEnd = source()->pointAfter(gapEnd);
-        
-        vector<Point> gapSourcePoints = source()->points(gapSourceStart.time, gapSourceEnd.time);
-        vector<Point> gapPoints = interpolatedGivenSourcePoints(gapStart, gapEnd, gapSourcePoints);
-        if (gapPoints.size() > 0) {
-          this->insertPoints(gapPoints);
-          now = gapPoints.back().time;
-          BOOST_FOREACH(Point p, gapPoints) {
-            stitchedPoints.push_back(p);
-          }
-        }
-        else {
-          // skipping the gap.
-          now = recordPoint.time;
-          continue; // skip the ++it
-        }
-        
-      }
-      
-      ++it;
+Point Resampler::computePoint(time_t time) {
+  // check the requested time for validity...
+  if ( !(clock()->isValid(time)) ) {
+    // if the time is not valid, get out.
+    return Point();
+    //time = clock()->timeBefore(time);
+  }
+  // the same kernel and unit conversion as points(), so it's the same point either way -- on the source point if
+  // there is one at this very time, or else on the source points either side of it.
+  double unitScale = sourceConverter().scale();
+  countUpstreamCalls();
+  Point sp = source()->point(time);
+  if (sp.isValid && sp.time == time) {
+    if (sp.quality == Point::missing) {
+      return Point();
     }
-    
-    return stitchedPoints;
+    Point exact(time, unitScale * sp.value, sp.quality, sp.confidence * unitScale);
+    cachePoint(exact);
+    return exact;
   }
-  
-  // otherwise, construct new points.
-  // get the times for the source query
-  Point sourceStart, sourceEnd;
-  {
-    Point s = source()->pointBefore(newStart);
-    Point e = source()->pointAfter(newEnd);
-    sourceStart = (s.time>0)? s : Point(newStart,0); //newStart;
-    sourceEnd = (e.time>0)? e : Point(newEnd,0); //newEnd;
+  countUpstreamCalls();
+  std::pair<Point, Point> adjacent = source()->adjacentPoints(time);
+  if (!adjacent.first.isValid || !adjacent.second.isValid) {
+    return Point();
   }
-   
-  // get the source points
-  std::vector<Point> sourcePoints = source()->points(sourceStart.time, sourceEnd.time);
-  if (sourcePoints.size() < 2) {
-    vector<Point> empty;
-    return empty;
+  std::vector<Point> bracket, resampled;
+  bracket.push_back(adjacent.first);
+  bracket.push_back(adjacent.second);
+  interpolatedGivenSourcePoints(time, time, bracket, resampled);
+  if (resampled.empty() || resampled.front().time != time) {
+    return Point();
   }
-  
-  // create a place for the new points
-  std::vector<Point> resampled;
-  
-  resampled = interpolatedGivenSourcePoints(newStart, newEnd, sourcePoints);
-  
-  // finally, add the points to myself.
-  this->insertPoints(resampled);
-  
-  return resampled;
+  cachePoint(resampled.front());
+  return resampled.front();
+}
+
+bool Resampler::valueTransform(ValueTransform& transform) {
+  // interpolation needs neighbors, so this isn't a per-value map.
+  return false;
+}
+
+PointRecord::time_pair_t Resampler::affectedRange(time_t start, time_t end) {
+  // anything interpolated across the changed source points
+  return sourceNeighborRange(start, end);
 }
 
 
@@ -175,102 +88,140 @@ bool Resampler::isCompatibleWith(TimeSeries::sharedPointer withTimeSeries) {
   return (units().isDimensionless() || units().isSameDimensionAs(withTimeSeries->units()));
 }
 
+void Resampler::evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
+  // get the times for the source query -- bracket the range so the ends can be interpolated
+  Point sourceStart, sourceEnd;
+  {
+    countUpstreamCalls(2);
+    Point s = source()->pointBefore(start);
+    Point e = source()->pointAfter(end);
+    sourceStart = (s.time>0)? s : Point(start,0);
+    sourceEnd = (e.time>0)? e : Point(end,0);
+  }
+  
+  // get the source points
+  countUpstreamCalls();
+  std::vector<Point> sourcePoints = source()->points(sourceStart.time, sourceEnd.time);
+  if (sourcePoints.size() < 2) {
+    return;
+  }
+  
+  interpolatedGivenSourcePoints(start, end, sourcePoints, out);
+}
+
 
 
-vector<Point> Resampler::interpolatedGivenSourcePoints(time_t fromTime, time_t toTime, std::vector<Point> sourcePoints) {
-  std::vector<Point> resampled;
-  Units sourceU = source()->units();
-  
+void Resampler::interpolatedGivenSourcePoints(time_t fromTime, time_t toTime, const std::vector<Point>& sourcePoints, std::vector<Point>& resampled) {
   // check the source points
   if (sourcePoints.size() < 2) {
-    return resampled;
+    return;
   }
-    
+  
   // also check that there is some data in between the requested bounds
   if ( sourcePoints.back().time < fromTime || toTime < sourcePoints.front().time ) {
-    return resampled;
+    return;
   }
   
   if ( fromTime < sourcePoints.front().time || sourcePoints.back().time < toTime) {
     // source data doesn't cover my whole range...
-    cerr << "source data does not cover requested range" << endl;
+    RTX_LOG(debug, "Resampler", "source data does not cover requested range");
   }
   
-  // reserve for the new points
-  {
-    std::vector<Point>::size_type s = (toTime - fromTime) / period() + 1;
-    resampled.reserve(s);
+  // the output times: fast forward to meet the first source point, and stop at the last one.
+  // this runs for every range, every step, so its working arrays are the thread's scratch buffers.
+  Scratch::Vector<time_t> timeBuffer;
+  std::vector<time_t>& times = *timeBuffer;
+  if (period() > 0) {
+    times.reserve((toTime - fromTime) / period() + 1);
   }
-  
-  
-  // scrub through the source Points and interpolate as we go.
   time_t now = fromTime;
-  vector<Point>::const_iterator sourceIt = sourcePoints.begin();
-    
-  Point sourceLeft, sourceRight;
-  sourceLeft = *sourceIt;
-  ++sourceIt;
-  sourceRight = *sourceIt;
-  
-  // fast forward now to meet our first available source point.
-  while (sourceLeft.time > now && now <= toTime) {
-    // warning!
+  while (now != 0 && now < sourcePoints.front().time && now <= toTime) {
+    now = clock()->timeAfter(now);
+  }
+  while (now != 0 && now <= toTime && now <= sourcePoints.back().time) {
+    times.push_back(now);
     now = clock()->timeAfter(now);
   }
+  if (now != 0 && now <= toTime) {
+    RTX_LOG(debug, "Resampler", "ending resample before the requested bound");
+  }
   
-  // start at the beginning, don't go past the end
-  while (now <= toTime && sourceIt != sourcePoints.end()) {
-    
-    // are we in the right position?
-    if (sourceLeft.time <= now && now <= sourceRight.time ) {
-      // ok, interpolate.
-      Point interp = interpolated(sourceLeft, sourceRight, now, sourceU);
-      if (interp.isValid) {
-        resampled.push_back(interp);
-      }
-      now = clock()->timeAfter(now);
-      continue;
+  size_t count = times.size();
+  if (count == 0) {
+    return;
+  }
+  
+  // merge-walk the output times against the source, gathering each output's bracketing pair into flat columns.
+  // a bracket that touches a missing point is masked out.
+  Scratch::Vector<size_t> leftBuffer;
+  Scratch::Vector<double> columnBuffer;
+  Scratch::Vector<unsigned char> keepBuffer;
+  std::vector<size_t>& leftIndex = *leftBuffer;
+  std::vector<unsigned char>& keep = *keepBuffer;
+  leftIndex.resize(count);
+  keep.resize(count);
+  columnBuffer->resize(6 * count);
+  double* t = &(*columnBuffer)[0];
+  double* t0 = t + count;
+  double* t1 = t0 + count;
+  double* v0 = t1 + count;
+  double* v1 = v0 + count;
+  double* interpolatedValues = v1 + count;
+  size_t lastLeft = sourcePoints.size() - 2;
+  size_t left = 0;
+  for (size_t k = 0; k < count; ++k) {
+    while (left < lastLeft && sourcePoints[left + 1].time <= times[k]) {
+      ++left;
+    }
+    const Point& p0 = sourcePoints[left];
+    const Point& p1 = sourcePoints[left + 1];
+    leftIndex[k] = left;
+    t[k] = (double)times[k];
+    t0[k] = (double)p0.time;
+    t1[k] = (double)p1.time;
+    v0[k] = p0.value;
+    v1[k] = p1.value;
+    if (times[k] == p0.time) {
+      keep[k] = (p0.quality != Point::missing);
     }
-    
-    // if we weren't in the right position, let's try to get there.
-    else if ( now < sourceLeft.time ) {
-      // this shouldn't happen
-      cerr << "what did you do??" << endl;
+    else if (times[k] == p1.time) {
+      keep[k] = (p1.quality != Point::missing);
     }
-    
-    else if ( sourceRight.time < now ) {
-      sourceLeft = sourceRight;
-      ++sourceIt;
-      if (sourceIt == sourcePoints.end()) {
-        cerr << "ending resample before the requested bound" << endl;
-        break;
-      }
-      sourceRight = *sourceIt;
+    else {
+      keep[k] = (p0.quality != Point::missing && p1.quality != Point::missing);
     }
-    
   }
   
+  // the arithmetic itself runs over contiguous arrays in one branch-free pass.
+  double unitScale = sourceConverter().scale();
+  interpolateColumns(count, t, t0, t1, v0, v1, unitScale, interpolatedValues);
   
-  return resampled;
-  
+  // finally, assemble the points that made it through the mask.
+  resampled.reserve(resampled.size() + count);
+  for (size_t k = 0; k < count; ++k) {
+    if (!keep[k]) {
+      continue;
+    }
+    const Point& p0 = sourcePoints[leftIndex[k]];
+    const Point& p1 = sourcePoints[leftIndex[k] + 1];
+    if (times[k] == p0.time) {
+      resampled.push_back(Point(times[k], interpolatedValues[k], p0.quality, p0.confidence * unitScale));
+    }
+    else if (times[k] == p1.time) {
+      resampled.push_back(Point(times[k], interpolatedValues[k], p1.quality, p1.confidence * unitScale));
+    }
+    else {
+      double newConfidence = (p0.confidence + p1.confidence) / 2; // TODO -- more elegant confidence estimation
+      resampled.push_back(Point(times[k], interpolatedValues[k], Point::interpolated, newConfidence * unitScale));
+    }
+  }
 }
 
-
-Point Resampler::interpolated(Point p1, Point p2, time_t t, Units fromUnits) {
-  
-  if (p1.time == t) {
-    return p1;
-  }
-  if (p2.time == t) {
-    return p2;
+void Resampler::interpolateColumns(size_t count, const double* t, const double* t0, const double* t1, const double* v0, const double* v1, double scale, double* out) {
+  // written so the compiler can vectorize it: no branches, no aliasing between inputs and output.
+  // the weighted form is exact at either end of the bracket (f == 0 or f == 1).
+  for (size_t k = 0; k < count; ++k) {
+    double f = (t[k] - t0[k]) / (t1[k] - t0[k]);
+    out[k] = scale * ((1. - f) * v0[k] + f * v1[k]);
   }
-  
-  
-  time_t dt = p2.time - p1.time;
-  double dv = p2.value - p1.value;
-  time_t dt2 = t - p1.time;
-  double dv2 = dv * dt2 / dt;
-  double newValue = p1.value + dv2;
-  double newConfidence = (p1.confidence + p2.confidence) / 2; // TODO -- more elegant confidence estimation
-  return Point(t, newValue, Point::interpolated, newConfidence);
 }
@@ -21,14 +21,19 @@ namespace RTX {
     virtual ~Resampler();
     
     virtual Point point(time_t time);
-    virtual std::vector<Point> points(time_t start, time_t end);
+    virtual bool valueTransform(ValueTransform& transform);
+    virtual PointRecord::time_pair_t affectedRange(time_t start, time_t end);
     
   protected:
     virtual bool isCompatibleWith(TimeSeries::sharedPointer withTimeSeries);
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out);
     
   private:
-    std::vector<Point> interpolatedGivenSourcePoints(time_t fromTime, time_t toTime, std::vector<Point> sourcePoints);
-    Point interpolated(Point p1, Point p2, time_t t, Units fromUnits);
+    Point computePoint(time_t time);
+    //! appends the resampled points to out
+    void interpolatedGivenSourcePoints(time_t fromTime, time_t toTime, const std::vector<Point>& sourcePoints, std::vector<Point>& out);
+    //! batch kernel: out[k] = scale * linear interpolation of (t0,v0)-(t1,v1) at t[k], over flat arrays
+    static void interpolateColumns(size_t count, const double* t, const double* t0, const double* t1, const double* v0, const double* v1, double scale, double* out);
   };
   
 }
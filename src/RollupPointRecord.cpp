@@ -0,0 +1,276 @@
+//
+//  RollupPointRecord.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "RollupPointRecord.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+
+RollupPointRecord::RollupPointRecord(PointRecord::sharedPointer record, std::vector<time_t> resolutions) : _record(record) {
+  if (resolutions.empty()) {
+    resolutions.push_back(60);
+    resolutions.push_back(15*60);
+    resolutions.push_back(60*60);
+    resolutions.push_back(24*60*60);
+  }
+  std::sort(resolutions.begin(), resolutions.end());
+  
+  // coarser levels are built out of finer ones, so each has to divide evenly into the next.
+  BOOST_FOREACH(time_t resolution, resolutions) {
+    if (resolution < 1 || (!_resolutions.empty() && resolution % _resolutions.back() != 0)) {
+      RTX_LOG(warning, "RollupPointRecord", "skipping resolution " << resolution << " -- it must be a multiple of the one below it");
+      continue;
+    }
+    if (!_resolutions.empty() && resolution == _resolutions.back()) {
+      continue;
+    }
+    _resolutions.push_back(resolution);
+  }
+}
+
+std::ostream& RollupPointRecord::toStream(std::ostream &stream) {
+  stream << "Rollup Point Record -- " << _resolutions.size() << " levels over:" << endl;
+  stream << *_record;
+  return stream;
+}
+
+PointRecord::sharedPointer RollupPointRecord::record() {
+  return _record;
+}
+
+std::vector<time_t> RollupPointRecord::resolutions() {
+  return _resolutions;
+}
+
+
+#pragma mark - Pass-Through
+
+std::string RollupPointRecord::registerAndGetIdentifier(std::string recordName) {
+  return _record->registerAndGetIdentifier(recordName);
+}
+
+std::vector<std::string> RollupPointRecord::identifiers() {
+  return _record->identifiers();
+}
+
+Point RollupPointRecord::point(const string& identifier, time_t time) {
+  return _record->point(identifier, time);
+}
+
+Point RollupPointRecord::pointBefore(const string& identifier, time_t time) {
+  return _record->pointBefore(identifier, time);
+}
+
+Point RollupPointRecord::pointAfter(const string& identifier, time_t time) {
+  return _record->pointAfter(identifier, time);
+}
+
+std::vector<Point> RollupPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
+  return _record->pointsInRange(identifier, startTime, endTime);
+}
+
+void RollupPointRecord::visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  _record->visitPointsInRange(identifier, startTime, endTime, visitor);
+}
+
+Point RollupPointRecord::firstPoint(const string& id) {
+  return _record->firstPoint(id);
+}
+
+Point RollupPointRecord::lastPoint(const string& id) {
+  return _record->lastPoint(id);
+}
+
+PointRecord::time_pair_t RollupPointRecord::range(const string& id) {
+  return _record->range(id);
+}
+
+unsigned long RollupPointRecord::evictionCount(const std::string& identifier) {
+  return _record->evictionCount(identifier);
+}
+
+
+#pragma mark - Writes
+
+void RollupPointRecord::addPoint(const string& identifier, Point point) {
+  // the write and the bucket update go together, so a query can't read the point and then have it added again.
+  scopedLock_t lock(_rollupMutex);
+  _record->addPoint(identifier, point);
+  addToSeries(seriesForName(identifier), point);
+}
+
+void RollupPointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
+  scopedLock_t lock(_rollupMutex);
+  _record->addPoints(identifier, points);
+  std::vector<Point> scratch;
+  const std::vector<Point>& ordered = orderedPoints(points, scratch);
+  Series& series = seriesForName(identifier);
+  BOOST_FOREACH(const Point& point, ordered) {
+    addToSeries(series, point);
+  }
+}
+
+void RollupPointRecord::reset() {
+  scopedLock_t lock(_rollupMutex);
+  _record->reset();
+  _series.clear();
+}
+
+void RollupPointRecord::reset(const string& identifier) {
+  scopedLock_t lock(_rollupMutex);
+  _record->reset(identifier);
+  _series.erase(identifier);
+}
+
+
+#pragma mark - Summaries
+
+std::vector<PointSummary> RollupPointRecord::summaries(const std::string& identifier, time_t startTime, time_t endTime, time_t resolution) {
+  // the coarsest level that's still fine enough
+  size_t levelCount = 0;
+  while (levelCount < _resolutions.size() && _resolutions[levelCount] <= resolution) {
+    ++levelCount;
+  }
+  if (levelCount == 0 || endTime < startTime) {
+    // finer than anything kept here: bucket the raw points
+    return PointRecord::summaries(identifier, startTime, endTime, resolution);
+  }
+  size_t level = levelCount - 1;
+  time_t first = bucketStart(level, startTime);
+  time_t last = bucketStart(level, endTime);
+  
+  std::vector<PointSummary> summaries;
+  scopedLock_t lock(_rollupMutex);
+  Series& series = seriesForName(identifier);
+  fillLevel(identifier, series, level, first, last);
+  
+  const Level_t& buckets = series.levels[level];
+  Level_t::const_iterator it = buckets.lower_bound(first);
+  while (it != buckets.end() && it->first <= last) {
+    if (it->second.count > 0) {
+      summaries.push_back(it->second);
+    }
+    ++it;
+  }
+  return summaries;
+}
+
+
+#pragma mark - Private Methods
+
+RollupPointRecord::Series& RollupPointRecord::seriesForName(const std::string& identifier) {
+  std::map<std::string, Series>::iterator it = _series.find(identifier);
+  if (it == _series.end()) {
+    it = _series.insert(make_pair(identifier, Series(_resolutions.size()))).first;
+  }
+  return it->second;
+}
+
+time_t RollupPointRecord::bucketStart(size_t level, time_t time) {
+  return time - (time % _resolutions[level]);
+}
+
+void RollupPointRecord::addToSeries(Series& series, const Point& point) {
+  bool countable = (point.isValid && point.quality != Point::missing);
+  if (point.time > series.lastTime) {
+    // past anything written here, so it can't be replacing a point the buckets already counted.
+    if (countable) {
+      for (size_t level = 0; level < _resolutions.size(); ++level) {
+        Level_t::iterator bucket = series.levels[level].find(bucketStart(level, point.time));
+        if (bucket != series.levels[level].end()) {
+          bucket->second.add(point.value);
+        }
+      }
+    }
+    series.lastTime = point.time;
+  }
+  else {
+    // it may have replaced something: let those buckets be read again when they're next needed.
+    for (size_t level = 0; level < _resolutions.size(); ++level) {
+      series.levels[level].erase(bucketStart(level, point.time));
+    }
+  }
+}
+
+namespace {
+  // adds each point into the (already present) bucket it falls in
+  class RollupVisitor : public PointVisitor {
+  public:
+    RollupVisitor(std::map<time_t, PointSummary>& buckets, time_t period) : _buckets(buckets), _period(period) {};
+    virtual bool visit(const Point& point) {
+      if (!point.isValid || point.quality == Point::missing) {
+        return true;
+      }
+      std::map<time_t, PointSummary>::iterator bucket = _buckets.find(point.time - (point.time % _period));
+      if (bucket != _buckets.end()) {
+        bucket->second.add(point.value);
+      }
+      return true;
+    }
+  private:
+    std::map<time_t, PointSummary>& _buckets;
+    time_t _period;
+  };
+}
+
+void RollupPointRecord::fillLevel(const std::string& identifier, Series& series, size_t level, time_t first, time_t last) {
+  Level_t& buckets = series.levels[level];
+  time_t period = _resolutions[level];
+  
+  // anything the finer level already has complete is just combined.
+  std::vector<time_t> missing;
+  for (time_t start = first; start <= last; start += period) {
+    if (buckets.find(start) != buckets.end()) {
+      continue;
+    }
+    if (level > 0) {
+      const Level_t& finer = series.levels[level - 1];
+      time_t finerPeriod = _resolutions[level - 1];
+      PointSummary combined(start, period);
+      bool complete = true;
+      for (time_t sub = start; sub < start + period; sub += finerPeriod) {
+        Level_t::const_iterator subBucket = finer.find(sub);
+        if (subBucket == finer.end()) {
+          complete = false;
+          break;
+        }
+        combined.add(subBucket->second);
+      }
+      if (complete) {
+        buckets.insert(make_pair(start, combined));
+        continue;
+      }
+    }
+    missing.push_back(start);
+  }
+  
+  // the rest come from the raw points, one read per contiguous run of missing buckets.
+  size_t runBegin = 0;
+  while (runBegin < missing.size()) {
+    size_t runEnd = runBegin + 1;
+    while (runEnd < missing.size() && missing[runEnd] == missing[runEnd - 1] + period) {
+      ++runEnd;
+    }
+    for (size_t k = runBegin; k < runEnd; ++k) {
+      buckets.insert(make_pair(missing[k], PointSummary(missing[k], period)));
+    }
+    RollupVisitor visitor(buckets, period);
+    _record->visitPointsInRange(identifier, missing[runBegin], missing[runEnd - 1] + period - 1, visitor);
+    runBegin = runEnd;
+  }
+}
@@ -0,0 +1,99 @@
+//
+//  RollupPointRecord.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_RollupPointRecord_h
+#define epanet_rtx_RollupPointRecord_h
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Point.h"
+#include "rtxMacros.h"
+#include "PointRecord.h"
+
+#include <boost/thread/mutex.hpp>
+
+namespace RTX {
+  
+  /*!
+   \class RollupPointRecord
+   \brief Wraps another PointRecord and keeps a pyramid of min/max/mean/count buckets over its points.
+  
+   Everything but summaries() is passed straight through to the wrapped record. summaries() is answered from the
+   coarsest level that is no wider than the requested resolution, so a year of a meter at daily resolution is a few
+   hundred buckets instead of a few hundred thousand points.
+  
+   Buckets are filled lazily: the first query over a span reads it from the wrapped record once (or combines the
+   finer level, where that's already complete), and the result is kept. After that, points written through this
+   record keep the buckets current -- appends are added in, and anything written out of order (which may replace an
+   existing point) drops the buckets it lands in until they're asked for again. Points that reach the wrapped record
+   some other way aren't seen, so reset() the series if that happens.
+   */
+  
+  /*!
+   \fn RollupPointRecord::RollupPointRecord(PointRecord::sharedPointer record, std::vector<time_t> resolutions)
+   \brief Wrap a record.
+   \param record The record that holds the points.
+   \param resolutions Bucket widths in seconds. Each must be a multiple of the next finer one. An empty list means 1 minute, 15 minutes, 1 hour and 1 day.
+   */
+  
+  class RollupPointRecord : public PointRecord {
+  public:
+    RTX_SHARED_POINTER(RollupPointRecord);
+    RollupPointRecord(PointRecord::sharedPointer record, std::vector<time_t> resolutions = std::vector<time_t>());
+    virtual ~RollupPointRecord() {};
+  
+    PointRecord::sharedPointer record();
+    std::vector<time_t> resolutions();
+  
+    virtual std::string registerAndGetIdentifier(std::string recordName);
+    virtual std::vector<std::string> identifiers();
+  
+    virtual Point point(const string& identifier, time_t time);
+    virtual Point pointBefore(const string& identifier, time_t time);
+    virtual Point pointAfter(const string& identifier, time_t time);
+    virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(const string& identifier, Point point);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
+    virtual void reset();
+    virtual void reset(const string& identifier);
+    virtual Point firstPoint(const string& id);
+    virtual Point lastPoint(const string& id);
+    virtual time_pair_t range(const string& id);
+    virtual unsigned long evictionCount(const std::string& identifier);
+    virtual std::vector<PointSummary> summaries(const std::string& identifier, time_t startTime, time_t endTime, time_t resolution);
+  
+    virtual std::ostream& toStream(std::ostream &stream);
+  
+  private:
+    //! one level of the pyramid: buckets by start time. empty buckets are kept too, so they aren't read again.
+    typedef std::map<time_t, PointSummary> Level_t;
+    //! every level for one series, finest first, and the latest time written through this record
+    class Series {
+    public:
+      Series(size_t levelCount) : levels(levelCount), lastTime(0) {};
+      std::vector<Level_t> levels;
+      time_t lastTime;
+    };
+  
+    Series& seriesForName(const std::string& identifier);   //! caller holds the lock
+    void addToSeries(Series& series, const Point& point);   //! caller holds the lock
+    void fillLevel(const std::string& identifier, Series& series, size_t level, time_t first, time_t last); //! caller holds the lock
+    time_t bucketStart(size_t level, time_t time);
+  
+    PointRecord::sharedPointer _record;
+    std::vector<time_t> _resolutions;
+    std::map<std::string, Series> _series;
+    boost::mutex _rollupMutex;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,47 @@
+//
+//  RuntimeContext.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "RuntimeContext.h"
+
+using namespace RTX;
+
+namespace {
+  boost::mutex defaultContextMutex;
+  RuntimeContext::sharedPointer defaultRuntimeContext;
+}
+
+
+RuntimeContext::RuntimeContext(const Scheduler::Options& options) {
+  _scheduler.reset(new Scheduler(options));
+}
+
+RuntimeContext::RuntimeContext(Scheduler::sharedPointer scheduler) : _scheduler(scheduler) {
+  if (!_scheduler) {
+    _scheduler.reset(new Scheduler());
+  }
+}
+
+Scheduler::sharedPointer RuntimeContext::scheduler() {
+  return _scheduler;
+}
+
+RuntimeContext::sharedPointer RuntimeContext::defaultContext() {
+  boost::lock_guard<boost::mutex> lock(defaultContextMutex);
+  if (!defaultRuntimeContext) {
+    defaultRuntimeContext.reset(new RuntimeContext());
+  }
+  return defaultRuntimeContext;
+}
+
+void RuntimeContext::setDefaultContext(sharedPointer context) {
+  boost::lock_guard<boost::mutex> lock(defaultContextMutex);
+  defaultRuntimeContext = context;
+}
@@ -0,0 +1,45 @@
+//
+//  RuntimeContext.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_RuntimeContext_h
+#define epanet_rtx_RuntimeContext_h
+
+#include "rtxMacros.h"
+#include "Scheduler.h"
+
+namespace RTX {
+
+  /*!
+   \class RuntimeContext
+   \brief What a process's models, records and series share to run on -- for now, the Scheduler.
+
+   A Model or ConfigFactory can be handed one (ConfigFactory hands its own to the model and the database records it
+   makes, and a model's clones get the model's). Anything that isn't handed one runs on the default context, made the
+   first time it's asked for with the default Scheduler options -- so the library as a whole keeps to one pool of
+   threads per hardware core, unless it's told otherwise.
+   */
+
+  class RuntimeContext {
+  public:
+    RTX_SHARED_POINTER(RuntimeContext);
+    RuntimeContext(const Scheduler::Options& options = Scheduler::Options());
+    RuntimeContext(Scheduler::sharedPointer scheduler);
+    virtual ~RuntimeContext() {};
+
+    Scheduler::sharedPointer scheduler();
+
+    static sharedPointer defaultContext();
+    static void setDefaultContext(sharedPointer context); //! before anything's started on the old one, preferably
+
+  private:
+    Scheduler::sharedPointer _scheduler;
+  };
+
+}
+
+#endif
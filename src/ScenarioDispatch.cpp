@@ -0,0 +1,560 @@
+//
+//  ScenarioDispatch.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "ScenarioDispatch.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+namespace fs = boost::filesystem;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+typedef ScenarioEnsemble::Scenario Scenario;
+
+namespace {
+  const char* spoolDirectories[] = {"pending", "running", "done", "failed", "tmp"};
+
+  vector<string> splitTabs(string line) {
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    vector<string> fields;
+    stringstream stream(line);
+    string field;
+    while (getline(stream, field, '\t')) {
+      fields.push_back(field);
+    }
+    return fields;
+  }
+
+  // a line of a scenario's definition. false if it's not one.
+  bool readScenarioLine(const vector<string>& fields, Scenario::sharedPointer& scenario) {
+    const string& key = fields[0];
+    if (key == "scenario" && fields.size() > 1) {
+      scenario.reset(new Scenario(fields[1]));
+      return true;
+    }
+    if (!scenario) {
+      return false;
+    }
+    if (key == "demand" && fields.size() > 1) {
+      scenario->setDemandMultiplier(atof(fields[1].c_str()));
+    }
+    else if (key == "pump" && fields.size() > 2) {
+      scenario->setPumpStatus(fields[1], (atof(fields[2].c_str()) != 0) ? Pipe::OPEN : Pipe::CLOSED);
+    }
+    else if (key == "pipe" && fields.size() > 2) {
+      scenario->setPipeStatus(fields[1], (atof(fields[2].c_str()) != 0) ? Pipe::OPEN : Pipe::CLOSED);
+    }
+    else if (key == "valve" && fields.size() > 2) {
+      scenario->setValveSetting(fields[1], atof(fields[2].c_str()));
+    }
+    else {
+      return false;
+    }
+    return true;
+  }
+
+  void writeScenario(ostream& stream, Scenario::sharedPointer scenario) {
+    typedef map<string, double>::value_type override_t;
+    stream << "scenario\t" << scenario->name() << "\n";
+    stream << setprecision(17);
+    if (scenario->demandMultiplier() != 1.) {
+      stream << "demand\t" << scenario->demandMultiplier() << "\n";
+    }
+    BOOST_FOREACH(const override_t& entry, scenario->pumpStatuses()) {
+      stream << "pump\t" << entry.first << "\t" << entry.second << "\n";
+    }
+    BOOST_FOREACH(const override_t& entry, scenario->pipeStatuses()) {
+      stream << "pipe\t" << entry.first << "\t" << entry.second << "\n";
+    }
+    BOOST_FOREACH(const override_t& entry, scenario->valveSettings()) {
+      stream << "valve\t" << entry.first << "\t" << entry.second << "\n";
+    }
+  }
+
+  // what a job file says: the scenario, and the rest of its fields by key
+  bool readJob(const fs::path& path, map<string, string>& fields, Scenario::sharedPointer& scenario, string& text) {
+    ifstream file(path.string().c_str());
+    if (!file) {
+      return false;
+    }
+    stringstream all;
+    all << file.rdbuf();
+    text = all.str();
+    stringstream lines(text);
+    string line;
+    while (getline(lines, line)) {
+      vector<string> lineFields = splitTabs(line);
+      if (lineFields.empty() || readScenarioLine(lineFields, scenario)) {
+        continue;
+      }
+      fields[lineFields[0]] = (lineFields.size() > 1) ? lineFields[1] : "";
+    }
+    return true;
+  }
+
+  // written off to the side, then renamed into place, so nobody ever sees half a file
+  bool writeFileInto(const fs::path& spool, const string& directory, const string& fileName, const string& text, const string& writer) {
+    fs::path partial = spool / "tmp" / (fileName + "." + writer);
+    {
+      ofstream file(partial.string().c_str());
+      file << text;
+      if (!file) {
+        return false;
+      }
+    }
+    boost::system::error_code error;
+    fs::rename(partial, spool / directory / fileName, error);
+    return !error;
+  }
+
+  // job files in one of the spool's directories, in order
+  vector<string> jobFiles(const fs::path& directory) {
+    vector<string> files;
+    boost::system::error_code error;
+    for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+      string name = it->path().filename().string();
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".job") == 0) {
+        files.push_back(name);
+      }
+    }
+    sort(files.begin(), files.end());
+    return files;
+  }
+
+  // a job's name, without the worker that claimed it
+  string jobName(const string& fileName) {
+    size_t end = fileName.find('@');
+    if (end == string::npos) {
+      end = fileName.size() - 4;
+    }
+    return fileName.substr(0, end);
+  }
+
+  size_t fieldValue(const map<string, string>& fields, const string& key, size_t otherwise) {
+    map<string, string>::const_iterator it = fields.find(key);
+    return (it == fields.end()) ? otherwise : (size_t)atol(it->second.c_str());
+  }
+}
+
+
+#pragma mark - Dispatcher
+
+ScenarioDispatcher::ScenarioDispatcher(const std::string& spoolPath) : _spoolPath(spoolPath), _start(0), _end(0), _leaseTimeout(300), _pollInterval(1), _maxAttempts(3) {
+
+}
+
+void ScenarioDispatcher::addScenario(ScenarioEnsemble::Scenario::sharedPointer scenario) {
+  if (!scenario) {
+    RTX_LOG(warning, "ScenarioDispatcher", "scenario not specified");
+    return;
+  }
+  _scenarios.push_back(scenario);
+}
+
+const std::vector<ScenarioEnsemble::Scenario::sharedPointer>& ScenarioDispatcher::scenarios() {
+  return _scenarios;
+}
+
+void ScenarioDispatcher::setLeaseTimeout(time_t seconds) {
+  _leaseTimeout = RTX_MAX(seconds, (time_t)4);
+}
+
+time_t ScenarioDispatcher::leaseTimeout() {
+  return _leaseTimeout;
+}
+
+void ScenarioDispatcher::setMaxAttempts(size_t attempts) {
+  _maxAttempts = RTX_MAX(attempts, (size_t)1);
+}
+
+size_t ScenarioDispatcher::maxAttempts() {
+  return _maxAttempts;
+}
+
+void ScenarioDispatcher::setPollInterval(time_t seconds) {
+  _pollInterval = RTX_MAX(seconds, (time_t)1);
+}
+
+ScenarioDispatcher::progress_t ScenarioDispatcher::progress() {
+  scopedLock_t lock(_mutex);
+  return _progress;
+}
+
+void ScenarioDispatcher::stopWorkers() {
+  ofstream stop((fs::path(_spoolPath) / "stop").string().c_str());
+}
+
+std::vector<ScenarioEnsemble::Scenario::sharedPointer> ScenarioDispatcher::readScenarios(const std::string& path) throw(RtxException) {
+  ifstream file(path.c_str());
+  if (!file) {
+    throw RtxIoException();
+  }
+  vector<Scenario::sharedPointer> scenarios;
+  Scenario::sharedPointer scenario;
+  string line;
+  while (getline(file, line)) {
+    vector<string> fields = splitTabs(line);
+    if (fields.empty() || fields[0].empty() || fields[0][0] == '#') {
+      continue;
+    }
+    Scenario::sharedPointer previous = scenario;
+    if (!readScenarioLine(fields, scenario)) {
+      RTX_LOG(warning, "ScenarioDispatcher", "not understood: " << line);
+    }
+    else if (scenario != previous) {
+      scenarios.push_back(scenario);
+    }
+  }
+  return scenarios;
+}
+
+
+#pragma mark - Running
+
+void ScenarioDispatcher::run(time_t start, time_t end) throw(RtxException) {
+  fs::path spool(_spoolPath);
+  boost::system::error_code error;
+  BOOST_FOREACH(const char* directory, spoolDirectories) {
+    fs::create_directories(spool / directory, error);
+    if (error) {
+      throw RtxException("could not set up the spool directory " + (spool / directory).string());
+    }
+    // whatever an earlier batch left
+    for (fs::directory_iterator it(spool / directory, error), last; !error && it != last; it.increment(error)) {
+      boost::system::error_code ignored;
+      fs::remove(it->path(), ignored);
+    }
+  }
+  fs::remove(spool / "stop", error);
+
+  _start = start;
+  _end = end;
+  _batch = boost::lexical_cast<string>(time(NULL)) + "." + boost::lexical_cast<string>(getpid());
+  _states.assign(_scenarios.size(), queued);
+  {
+    scopedLock_t lock(_mutex);
+    _progress = progress_t();
+    _progress.scenarios = _scenarios.size();
+  }
+  for (size_t i = 0; i < _scenarios.size(); ++i) {
+    retry(jobFileName(i), 0, "");
+  }
+  RTX_LOG(info, "ScenarioDispatcher", "batch " << _batch << ": " << _scenarios.size() << " scenarios queued in " << _spoolPath);
+
+  while (true) {
+    collectDone();
+    collectFailed();
+    collectExpired();
+    {
+      scopedLock_t lock(_mutex);
+      if (_progress.finished + _progress.failed >= _progress.scenarios) {
+        break;
+      }
+    }
+    boost::this_thread::sleep(boost::posix_time::seconds(_pollInterval));
+  }
+  RTX_LOG(info, "ScenarioDispatcher", "batch " << _batch << ": " << _progress.finished << " finished, " << _progress.failed << " failed, " << _progress.retried << " retried");
+}
+
+
+#pragma mark - Private Methods
+
+std::string ScenarioDispatcher::jobFileName(size_t index) {
+  stringstream name;
+  name << _batch << "-" << setw(6) << setfill('0') << index << ".job";
+  return name.str();
+}
+
+size_t ScenarioDispatcher::indexOf(const std::string& fileName) {
+  string prefix = _batch + "-";
+  if (fileName.compare(0, prefix.size(), prefix) != 0) {
+    return _scenarios.size();
+  }
+  size_t index = (size_t)atol(fileName.c_str() + prefix.size());
+  return (index < _scenarios.size()) ? index : _scenarios.size();
+}
+
+void ScenarioDispatcher::collectDone() {
+  fs::path spool(_spoolPath);
+  BOOST_FOREACH(const string& fileName, jobFiles(spool / "done")) {
+    size_t index = indexOf(fileName);
+    boost::system::error_code error;
+    if (index == _scenarios.size()) {
+      fs::remove(spool / "done" / fileName, error);
+      continue;
+    }
+    if (_states[index] == finished) {
+      continue;
+    }
+    // a lease can run out on a worker that was only slow. if it finishes after all, that's as good as the retry.
+    scopedLock_t lock(_mutex);
+    if (_states[index] == failed) {
+      --_progress.failed;
+    }
+    _states[index] = finished;
+    ++_progress.finished;
+    fs::remove(spool / "pending" / fileName, error);
+  }
+}
+
+void ScenarioDispatcher::collectFailed() {
+  fs::path spool(_spoolPath);
+  BOOST_FOREACH(const string& fileName, jobFiles(spool / "failed")) {
+    fs::path path = spool / "failed" / fileName;
+    map<string, string> fields;
+    Scenario::sharedPointer scenario;
+    string text;
+    readJob(path, fields, scenario, text);
+    boost::system::error_code error;
+    fs::remove(path, error);
+    size_t index = indexOf(fileName);
+    if (index == _scenarios.size() || _states[index] != queued) {
+      continue;
+    }
+    retry(fileName, fieldValue(fields, "attempt", _maxAttempts), "failed on " + fields["worker"] + ": " + fields["error"]);
+  }
+}
+
+void ScenarioDispatcher::collectExpired() {
+  fs::path spool(_spoolPath);
+  time_t now = time(NULL);
+  BOOST_FOREACH(const string& fileName, jobFiles(spool / "running")) {
+    fs::path path = spool / "running" / fileName;
+    boost::system::error_code error;
+    time_t touched = fs::last_write_time(path, error);
+    if (error || now - touched <= _leaseTimeout) {
+      continue;
+    }
+    map<string, string> fields;
+    Scenario::sharedPointer scenario;
+    string text;
+    readJob(path, fields, scenario, text);
+    // if it's gone already, its worker has just finished with it
+    fs::remove(path, error);
+    size_t index = indexOf(fileName);
+    if (error || index == _scenarios.size() || _states[index] != queued) {
+      continue;
+    }
+    string worker = fileName.substr(jobName(fileName).size() + 1, fileName.size() - jobName(fileName).size() - 5);
+    retry(jobName(fileName) + ".job", fieldValue(fields, "attempt", _maxAttempts), "its lease ran out on " + worker);
+  }
+}
+
+void ScenarioDispatcher::retry(const std::string& fileName, size_t attempt, const std::string& reason) {
+  size_t index = indexOf(fileName);
+  if (attempt > 0) {
+    scopedLock_t lock(_mutex);
+    if (attempt >= _maxAttempts) {
+      RTX_LOG(error, "ScenarioDispatcher", "scenario " << _scenarios[index]->name() << " gave up after " << attempt << " attempts: " << reason);
+      _states[index] = failed;
+      ++_progress.failed;
+      return;
+    }
+    RTX_LOG(warning, "ScenarioDispatcher", "scenario " << _scenarios[index]->name() << " queued again: " << reason);
+    ++_progress.retried;
+  }
+  stringstream job;
+  job << "batch\t" << _batch << "\n";
+  job << "start\t" << _start << "\n";
+  job << "end\t" << _end << "\n";
+  job << "attempt\t" << attempt + 1 << "\n";
+  job << "lease\t" << _leaseTimeout << "\n";
+  writeScenario(job, _scenarios[index]);
+  if (!writeFileInto(fs::path(_spoolPath), "pending", fileName, job.str(), "dispatcher")) {
+    RTX_LOG(error, "ScenarioDispatcher", "could not queue scenario " << _scenarios[index]->name());
+    scopedLock_t lock(_mutex);
+    _states[index] = failed;
+    ++_progress.failed;
+  }
+}
+
+
+#pragma mark - Worker
+
+ScenarioWorker::ScenarioWorker(Model::sharedPointer model, const std::string& spoolPath, size_t threadCount) : _model(model), _spoolPath(spoolPath), _threadCount(RTX_MAX(threadCount, (size_t)1)), _exitsWhenIdle(false), _isCancelled(false), _isRunning(false), _finished(0), _failed(0) {
+  char host[RTX_MAX_CHAR_STRING];
+  if (gethostname(host, sizeof(host)) != 0) {
+    host[0] = '\0';
+  }
+  host[sizeof(host) - 1] = '\0';
+  _name = string(host) + "-" + boost::lexical_cast<string>(getpid());
+}
+
+void ScenarioWorker::setStorage(PointRecord::sharedPointer record) {
+  _record = record;
+}
+
+PointRecord::sharedPointer ScenarioWorker::storage() {
+  return _record;
+}
+
+void ScenarioWorker::setName(const std::string& name) {
+  _name = name;
+}
+
+const std::string& ScenarioWorker::name() {
+  return _name;
+}
+
+void ScenarioWorker::setExitsWhenIdle(bool exits) {
+  _exitsWhenIdle = exits;
+}
+
+size_t ScenarioWorker::threadCount() {
+  return _threadCount;
+}
+
+void ScenarioWorker::cancel() {
+  _isCancelled = true;
+}
+
+size_t ScenarioWorker::finishedCount() {
+  return _finished;
+}
+
+size_t ScenarioWorker::failedCount() {
+  return _failed;
+}
+
+void ScenarioWorker::run() {
+  _isCancelled = false;
+  _isRunning = true;
+  RTX_LOG(info, "ScenarioWorker", _name << " taking jobs from " << _spoolPath << " on " << _threadCount << " threads");
+  boost::thread heartbeat(&ScenarioWorker::heartbeatLoop, this);
+  boost::thread_group threads;
+  for (size_t i = 1; i < _threadCount; ++i) {
+    threads.create_thread(boost::bind(&ScenarioWorker::workerLoop, this));
+  }
+  workerLoop(); // the calling thread works too
+  threads.join_all();
+  _isRunning = false;
+  heartbeat.join();
+  RTX_LOG(info, "ScenarioWorker", _name << " ran " << _finished << " jobs, " << _failed << " failed");
+}
+
+
+#pragma mark - Private Methods
+
+bool ScenarioWorker::shouldStop() {
+  boost::system::error_code error;
+  return (_isCancelled || fs::exists(fs::path(_spoolPath) / "stop", error));
+}
+
+void ScenarioWorker::workerLoop() {
+  while (!shouldStop()) {
+    string job, claimedPath;
+    if (!claim(job, claimedPath)) {
+      if (_exitsWhenIdle) {
+        return;
+      }
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+      continue;
+    }
+    runJob(job, claimedPath);
+  }
+}
+
+bool ScenarioWorker::claim(std::string& job, std::string& claimedPath) {
+  fs::path spool(_spoolPath);
+  BOOST_FOREACH(const string& fileName, jobFiles(spool / "pending")) {
+    job = jobName(fileName);
+    fs::path claimed = spool / "running" / (job + "@" + _name + ".job");
+    boost::system::error_code error;
+    fs::rename(spool / "pending" / fileName, claimed, error);
+    if (error) {
+      continue; // someone else got there first
+    }
+    // a rename keeps the time it was queued, which may be longer ago than the lease
+    fs::last_write_time(claimed, time(NULL), error);
+    claimedPath = claimed.string();
+    return true;
+  }
+  return false;
+}
+
+void ScenarioWorker::runJob(const std::string& job, const std::string& claimedPath) {
+  map<string, string> fields;
+  Scenario::sharedPointer scenario;
+  string text, failure;
+  if (!readJob(claimedPath, fields, scenario, text) || !scenario) {
+    failure = "the job could not be read";
+  }
+  else {
+    {
+      scopedLock_t lock(_mutex);
+      _claimed[claimedPath] = lease_t(fieldValue(fields, "lease", 300), time(NULL));
+    }
+    RTX_LOG(info, "ScenarioWorker", _name << " running " << scenario->name() << " (attempt " << fields["attempt"] << ")");
+    ScenarioEnsemble ensemble(_model, 1);
+    if (_record) {
+      ensemble.setStorage(_record);
+    }
+    ensemble.addScenario(scenario);
+    try {
+      ensemble.run((time_t)atol(fields["start"].c_str()), (time_t)atol(fields["end"].c_str()));
+      if (scenario->didFail()) {
+        failure = scenario->error();
+      }
+    } catch (std::exception& e) {
+      failure = e.what();
+    }
+    scopedLock_t lock(_mutex);
+    _claimed.erase(claimedPath);
+  }
+
+  text += "worker\t" + _name + "\n";
+  if (!failure.empty()) {
+    replace(failure.begin(), failure.end(), '\n', ' ');
+    text += "error\t" + failure + "\n";
+  }
+  if (!writeFileInto(fs::path(_spoolPath), failure.empty() ? "done" : "failed", job + ".job", text, _name)) {
+    RTX_LOG(error, "ScenarioWorker", _name << " could not report on " << job);
+  }
+  boost::system::error_code error;
+  fs::remove(claimedPath, error);
+  if (failure.empty()) {
+    ++_finished;
+  }
+  else {
+    ++_failed;
+    RTX_LOG(warning, "ScenarioWorker", _name << " failed on " << job << ": " << failure);
+  }
+}
+
+void ScenarioWorker::heartbeatLoop() {
+  while (_isRunning) {
+    boost::this_thread::sleep(boost::posix_time::seconds(1));
+    time_t now = time(NULL);
+    scopedLock_t lock(_mutex);
+    typedef map<string, lease_t>::value_type claimed_t;
+    BOOST_FOREACH(claimed_t& entry, _claimed) {
+      if ((now - entry.second.touched) * 4 >= entry.second.seconds) {
+        boost::system::error_code error;
+        fs::last_write_time(entry.first, now, error);
+        entry.second.touched = now;
+      }
+    }
+  }
+}
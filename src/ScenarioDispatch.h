@@ -0,0 +1,178 @@
+//
+//  ScenarioDispatch.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_ScenarioDispatch_h
+#define epanet_rtx_ScenarioDispatch_h
+
+#include <vector>
+#include <map>
+#include <string>
+#include <iostream>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "ScenarioEnsemble.h"
+
+namespace RTX {
+
+  /*!
+   \class ScenarioDispatcher
+   \brief Farms a sweep of scenarios out to ScenarioWorkers on any number of machines, through a shared directory.
+
+   The dispatcher and its workers only share a spool directory (on a network file system, say), and whatever
+   record the workers store their results in. Each scenario becomes a small text file of its overrides and time
+   window, written to the spool's pending directory. A worker claims one by renaming it into running -- only one
+   rename can win, so a job is never claimed twice -- runs it through a ScenarioEnsemble on its own copy of the
+   model, and moves it on to done, or to failed with the reason. Workers pull as they finish, so a fast machine
+   simply takes more of the sweep, and machines can join or leave part way through.
+
+   While a worker runs a job it touches the job's file every quarter of the lease. A job that goes a whole lease
+   untouched belongs to a worker that has died or lost the spool, and goes back to pending, as does one that
+   failed -- up to maxAttempts() in all. The machines' clocks need to agree to well within the lease. A job run
+   twice this way gives the same points twice, so results are safe to write to the same record again.
+
+   run() blocks until every scenario has either finished or run out of attempts. Each run is a batch of its own:
+   files left in the spool from an earlier one are cleared away first, and ignored if they turn up later.
+   */
+
+  /*!
+   \fn void ScenarioDispatcher::run(time_t start, time_t end)
+   \brief Queue every scenario over [start, end], and wait for the workers to get through them.
+   \throw RtxException if the spool directory can't be set up.
+   */
+
+  /*!
+   \fn std::vector<ScenarioEnsemble::Scenario::sharedPointer> ScenarioDispatcher::readScenarios(const std::string& path)
+   \brief Read a sweep from a file, one tab-separated override to a line, each scenario starting with its name:
+
+     scenario <name>
+     demand   <multiplier>
+     pump     <pump> <0 or 1>
+     pipe     <pipe> <0 or 1>
+     valve    <valve> <setting>
+
+   Blank lines and lines starting with # are skipped.
+   \throw RtxIoException if the file can't be read.
+   */
+
+  class ScenarioDispatcher {
+  public:
+    RTX_SHARED_POINTER(ScenarioDispatcher);
+    class progress_t {
+    public:
+      progress_t() : scenarios(0), finished(0), failed(0), retried(0) {};
+      // simple tuple class, so no getters/setters
+      size_t scenarios, finished, failed; //! failed: out of attempts
+      size_t retried;                     //! attempts that failed or timed out, and were queued again
+    };
+
+    ScenarioDispatcher(const std::string& spoolPath);
+    virtual ~ScenarioDispatcher() {};
+
+    void addScenario(ScenarioEnsemble::Scenario::sharedPointer scenario);
+    const std::vector<ScenarioEnsemble::Scenario::sharedPointer>& scenarios();
+    void setLeaseTimeout(time_t seconds);
+    time_t leaseTimeout();
+    void setMaxAttempts(size_t attempts);
+    size_t maxAttempts();
+    void setPollInterval(time_t seconds);
+
+    void run(time_t start, time_t end) throw(RtxException);
+    progress_t progress();
+    void stopWorkers(); //! the workers finish what they have, and stop
+
+    static std::vector<ScenarioEnsemble::Scenario::sharedPointer> readScenarios(const std::string& path) throw(RtxException);
+
+  private:
+    typedef enum {
+      queued,
+      finished,
+      failed
+    } state_t;
+
+    void collectDone();
+    void collectFailed();
+    void collectExpired();
+    void retry(const std::string& fileName, size_t attempt, const std::string& reason); //! queues the next attempt, if there's one left
+    std::string jobFileName(size_t index);
+    size_t indexOf(const std::string& fileName); //! the scenario a job file is for, or scenarios().size() if not this batch's
+
+    std::string _spoolPath, _batch;
+    std::vector<ScenarioEnsemble::Scenario::sharedPointer> _scenarios;
+    std::vector<state_t> _states;
+    time_t _start, _end;
+    time_t _leaseTimeout, _pollInterval;
+    size_t _maxAttempts;
+    progress_t _progress;
+    boost::mutex _mutex; // guards the progress
+  };
+
+
+  /*!
+   \class ScenarioWorker
+   \brief Runs a ScenarioDispatcher's jobs on one machine, from the shared spool directory.
+
+   The model is loaded once, before the worker starts -- with its solver cache file set, ideally, so that cloning
+   it for each job is cheap (see EpanetModel::setSolverCacheFile). The boundary data comes from whatever records
+   the model's configuration names, which for a sweep would be the shared store. Each job's results go to the
+   worker's storage record under the scenario's name (see ScenarioEnsemble::setStorage), or stay in the clone
+   when there's no record, which is only useful for trying things out.
+
+   run() takes jobs on threadCount() threads until the dispatcher says to stop, cancel() is called, or -- if it
+   exits when idle -- there's nothing left pending.
+   */
+
+  class ScenarioWorker {
+  public:
+    RTX_SHARED_POINTER(ScenarioWorker);
+    ScenarioWorker(Model::sharedPointer model, const std::string& spoolPath, size_t threadCount = 1);
+    virtual ~ScenarioWorker() {};
+
+    void setStorage(PointRecord::sharedPointer record);
+    PointRecord::sharedPointer storage();
+    void setName(const std::string& name); //! unique in the sweep; the host name and process id by default
+    const std::string& name();
+    void setExitsWhenIdle(bool exits);
+    size_t threadCount();
+
+    void run();
+    void cancel();
+    size_t finishedCount();
+    size_t failedCount();
+
+  private:
+    class lease_t {
+    public:
+      lease_t(time_t seconds = 0, time_t touched = 0) : seconds(seconds), touched(touched) {};
+      // simple tuple class, so no getters/setters
+      time_t seconds, touched;
+    };
+
+    bool claim(std::string& job, std::string& claimedPath); //! the next pending job, if there is one
+    void runJob(const std::string& job, const std::string& claimedPath);
+    void workerLoop();
+    void heartbeatLoop();
+    bool shouldStop();
+
+    Model::sharedPointer _model;
+    std::string _spoolPath, _name;
+    size_t _threadCount;
+    PointRecord::sharedPointer _record;
+    bool _exitsWhenIdle;
+    boost::atomic<bool> _isCancelled, _isRunning;
+    boost::atomic<size_t> _finished, _failed;
+    std::map<std::string, lease_t> _claimed; // running files, for the heartbeat to touch
+    boost::mutex _mutex;                     // guards the claimed files
+  };
+
+}
+
+#endif
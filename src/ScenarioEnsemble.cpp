@@ -0,0 +1,265 @@
+//
+//  ScenarioEnsemble.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "ScenarioEnsemble.h"
+#include "Log.h"
+#include "AggregatorTimeSeries.h"
+
+using namespace RTX;
+using namespace std;
+
+namespace {
+  // an override's value at any time the simulation asks for -- including the intermediate steps it takes for tank
+  // and control events, which no clock would line up with.
+  class ConstantTimeSeries : public TimeSeries {
+  public:
+    ConstantTimeSeries(double value) : _value(value) {};
+    virtual Point point(time_t time) {
+      return Point(time, _value, Point::constant);
+    };
+  private:
+    double _value;
+  };
+}
+
+
+#pragma mark - Scenario
+
+ScenarioEnsemble::Scenario::Scenario(const std::string& name) : _name(name) {
+  _demandMultiplier = 1.;
+  _didFail = false;
+}
+
+const std::string& ScenarioEnsemble::Scenario::name() {
+  return _name;
+}
+
+void ScenarioEnsemble::Scenario::setDemandMultiplier(double multiplier) {
+  _demandMultiplier = multiplier;
+}
+
+double ScenarioEnsemble::Scenario::demandMultiplier() {
+  return _demandMultiplier;
+}
+
+void ScenarioEnsemble::Scenario::setPumpStatus(const std::string& pump, Pipe::status_t status) {
+  _pumpStatuses[pump] = status;
+}
+
+void ScenarioEnsemble::Scenario::setPipeStatus(const std::string& pipe, Pipe::status_t status) {
+  _pipeStatuses[pipe] = status;
+}
+
+void ScenarioEnsemble::Scenario::setValveSetting(const std::string& valve, double setting) {
+  _valveSettings[valve] = setting;
+}
+
+const std::map<std::string, double>& ScenarioEnsemble::Scenario::pumpStatuses() {
+  return _pumpStatuses;
+}
+
+const std::map<std::string, double>& ScenarioEnsemble::Scenario::pipeStatuses() {
+  return _pipeStatuses;
+}
+
+const std::map<std::string, double>& ScenarioEnsemble::Scenario::valveSettings() {
+  return _valveSettings;
+}
+
+void ScenarioEnsemble::Scenario::setStorage(PointRecord::sharedPointer record) {
+  _record = record;
+}
+
+PointRecord::sharedPointer ScenarioEnsemble::Scenario::storage() {
+  return _record;
+}
+
+Model::sharedPointer ScenarioEnsemble::Scenario::model() {
+  return _model;
+}
+
+bool ScenarioEnsemble::Scenario::didFail() {
+  return _didFail;
+}
+
+const std::string& ScenarioEnsemble::Scenario::error() {
+  return _error;
+}
+
+
+#pragma mark - Ensemble
+
+ScenarioEnsemble::ScenarioEnsemble(Model::sharedPointer baseModel, size_t threadCount) : _baseModel(baseModel) {
+  _threadCount = threadCount;
+  if (_threadCount == 0) {
+    _threadCount = boost::thread::hardware_concurrency();
+  }
+  if (_threadCount == 0) {
+    _threadCount = 1;
+  }
+  _start = 0;
+  _end = 0;
+  _nextScenario = 0;
+}
+
+Model::sharedPointer ScenarioEnsemble::baseModel() {
+  return _baseModel;
+}
+
+void ScenarioEnsemble::addScenario(Scenario::sharedPointer scenario) {
+  if (!scenario) {
+    RTX_LOG(warning, "ScenarioEnsemble", "scenario not specified");
+    return;
+  }
+  _scenarios.push_back(scenario);
+}
+
+const std::vector<ScenarioEnsemble::Scenario::sharedPointer>& ScenarioEnsemble::scenarios() {
+  return _scenarios;
+}
+
+void ScenarioEnsemble::setStorage(PointRecord::sharedPointer record) {
+  _record = record;
+}
+
+PointRecord::sharedPointer ScenarioEnsemble::storage() {
+  return _record;
+}
+
+size_t ScenarioEnsemble::threadCount() {
+  return _threadCount;
+}
+
+
+#pragma mark - Public Methods
+
+void ScenarioEnsemble::run(time_t start, time_t end) throw(RtxException) {
+  // a misspelled element would otherwise quietly run the base case -- better to find out before anything runs.
+  BOOST_FOREACH(Scenario::sharedPointer scenario, _scenarios) {
+    checkOverrides(scenario);
+  }
+  if (_scenarios.empty()) {
+    return;
+  }
+  _start = start;
+  _end = end;
+  _nextScenario = 0;
+
+  size_t workers = RTX_MIN(_threadCount, _scenarios.size());
+  std::vector<Scheduler::task_t> tasks(workers, boost::bind(&ScenarioEnsemble::workerLoop, this));
+  _baseModel->runtime()->scheduler()->run(tasks, _baseModel->runPriority()); // the calling thread works too
+}
+
+
+Model::sharedPointer ScenarioEnsemble::whatIf(Scenario::sharedPointer scenario) throw(RtxException) {
+  if (!scenario) {
+    throw RtxException("scenario not specified");
+  }
+  checkOverrides(scenario);
+  scenario->_didFail = false;
+  scenario->_error.clear();
+  applyScenario(scenario, _baseModel->fork());
+  return scenario->_model;
+}
+
+
+#pragma mark - Private Methods
+
+void ScenarioEnsemble::checkOverrides(Scenario::sharedPointer scenario) throw(RtxException) {
+  typedef std::map<std::string, double>::value_type override_t;
+  BOOST_FOREACH(const override_t& entry, scenario->_pumpStatuses) {
+    if (!boost::dynamic_pointer_cast<Pump>(_baseModel->linkWithName(entry.first))) {
+      throw RtxException("Scenario " + scenario->name() + ": no pump named " + entry.first);
+    }
+  }
+  BOOST_FOREACH(const override_t& entry, scenario->_pipeStatuses) {
+    if (!boost::dynamic_pointer_cast<Pipe>(_baseModel->linkWithName(entry.first))) {
+      throw RtxException("Scenario " + scenario->name() + ": no pipe named " + entry.first);
+    }
+  }
+  BOOST_FOREACH(const override_t& entry, scenario->_valveSettings) {
+    if (!boost::dynamic_pointer_cast<Valve>(_baseModel->linkWithName(entry.first))) {
+      throw RtxException("Scenario " + scenario->name() + ": no valve named " + entry.first);
+    }
+  }
+}
+
+void ScenarioEnsemble::prepare(Scenario::sharedPointer scenario) {
+  applyScenario(scenario, _baseModel->clone());
+}
+
+void ScenarioEnsemble::applyScenario(Scenario::sharedPointer scenario, Model::sharedPointer model) {
+  if (scenario->_demandMultiplier != 1.) {
+    BOOST_FOREACH(const Junction::sharedPointer& junction, model->junctions()) {
+      if (!junction->doesHaveBoundaryFlow()) {
+        continue;
+      }
+      TimeSeries::sharedPointer shared = junction->boundaryFlow();
+      AggregatorTimeSeries::sharedPointer scaled(new AggregatorTimeSeries());
+      scaled->setName(scenario->name() + "/" + shared->name());
+      scaled->setUnits(shared->units());
+      scaled->addSource(shared, scenario->_demandMultiplier);
+      junction->setBoundaryFlow(scaled);
+    }
+  }
+
+  typedef std::map<std::string, double>::value_type override_t;
+  BOOST_FOREACH(const override_t& entry, scenario->_pumpStatuses) {
+    Pipe::sharedPointer pump = boost::dynamic_pointer_cast<Pipe>(model->linkWithName(entry.first));
+    pump->setStatusParameter(TimeSeries::sharedPointer(new ConstantTimeSeries(entry.second)));
+  }
+  BOOST_FOREACH(const override_t& entry, scenario->_pipeStatuses) {
+    Pipe::sharedPointer pipe = boost::dynamic_pointer_cast<Pipe>(model->linkWithName(entry.first));
+    pipe->setStatusParameter(TimeSeries::sharedPointer(new ConstantTimeSeries(entry.second)));
+  }
+  BOOST_FOREACH(const override_t& entry, scenario->_valveSettings) {
+    Valve::sharedPointer valve = boost::dynamic_pointer_cast<Valve>(model->linkWithName(entry.first));
+    valve->setSettingParameter(TimeSeries::sharedPointer(new ConstantTimeSeries(entry.second)));
+  }
+
+  if (scenario->_record) {
+    model->setStorage(scenario->_record);
+  }
+  else if (_record) {
+    model->tagStates(scenario->name() + "/");
+    model->setStorage(_record);
+  }
+  scenario->_model = model;
+}
+
+void ScenarioEnsemble::workerLoop() {
+  size_t index;
+  while ((index = _nextScenario++) < _scenarios.size()) {
+    Scenario::sharedPointer scenario = _scenarios[index];
+    scenario->_didFail = false;
+    scenario->_error.clear();
+    // cloning loads the model file too, so that happens out here on the pool as well.
+    try {
+      prepare(scenario);
+      scenario->_model->runExtendedPeriod(_start, _end);
+    } catch (std::exception& e) {
+      scenario->_didFail = true;
+      scenario->_error = e.what();
+    } catch (std::string& error) {
+      scenario->_didFail = true;
+      scenario->_error = error;
+    } catch (...) {
+      scenario->_didFail = true;
+      scenario->_error = "unknown error";
+    }
+    if (scenario->_didFail) {
+      RTX_LOG(error, "ScenarioEnsemble", "scenario " << scenario->name() << " failed: " << scenario->_error);
+    }
+  }
+}
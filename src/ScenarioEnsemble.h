@@ -0,0 +1,124 @@
+//
+//  ScenarioEnsemble.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_ScenarioEnsemble_h
+#define epanet_rtx_ScenarioEnsemble_h
+
+#include <vector>
+#include <map>
+#include <string>
+
+#include <boost/atomic.hpp>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "Model.h"
+#include "PointRecord.h"
+
+namespace RTX {
+
+  /*!
+   \class ScenarioEnsemble
+   \brief Runs what-if variations of a loaded model over the same window, concurrently.
+
+   Each scenario runs on its own clone of the base model (see Model::clone). A clone takes its boundary conditions
+   from the same series as the base, so boundary data that one scenario has pulled is already cached for the rest.
+   A scenario's overrides then replace or scale these series in its clone only:
+   - a demand multiplier scales every junction's boundary flow
+   - pump and pipe statuses, and valve settings, are held fixed for the whole run (an outage, a closure)
+
+   The clones run runExtendedPeriod several at once, on the base model's Scheduler (see Model::runtime). A scenario's
+   results go to its own record if it has one; otherwise to the ensemble's record, under series names tagged with the
+   scenario's name (see Model::tagStates), e.g. "pump outage/L P1 flow". With neither, they stay in each clone's
+   series, which can be reached through Scenario::model.
+   */
+
+  /*!
+   \fn void ScenarioEnsemble::run(time_t start, time_t end)
+   \brief Clone the base model for each scenario, apply its overrides, and run them all over [start, end].
+   \throw RtxException if a scenario overrides an element the base model doesn't have.
+
+   A scenario that fails while it runs is logged, and marked (see Scenario::didFail); the others carry on.
+   */
+
+  /*!
+   \fn Model::sharedPointer ScenarioEnsemble::whatIf(Scenario::sharedPointer scenario)
+   \brief Fork the base model as it is now (see Model::fork), and apply the scenario's overrides to the fork.
+   \return The fork, to run on from the base model's current simulation time. It's the scenario's model, too.
+   \throw RtxException if the scenario overrides an element the base model doesn't have, or it can't be forked.
+
+   The scenario needn't have been added to the ensemble. Its results are stored as a run's would be.
+   */
+
+  class ScenarioEnsemble {
+  public:
+    RTX_SHARED_POINTER(ScenarioEnsemble);
+
+    class Scenario {
+    public:
+      RTX_SHARED_POINTER(Scenario);
+      Scenario(const std::string& name);
+      const std::string& name();
+
+      void setDemandMultiplier(double multiplier);
+      double demandMultiplier();
+      void setPumpStatus(const std::string& pump, Pipe::status_t status);
+      void setPipeStatus(const std::string& pipe, Pipe::status_t status);
+      void setValveSetting(const std::string& valve, double setting);
+      const std::map<std::string, double>& pumpStatuses();
+      const std::map<std::string, double>& pipeStatuses();
+      const std::map<std::string, double>& valveSettings();
+
+      void setStorage(PointRecord::sharedPointer record);  //! its own record, instead of the ensemble's
+      PointRecord::sharedPointer storage();
+
+      Model::sharedPointer model();  //! the clone it ran on, once the ensemble has run it
+      bool didFail();                //! in the last run
+      const std::string& error();    //! why, if it did
+
+    private:
+      friend class ScenarioEnsemble;
+      std::string _name;
+      double _demandMultiplier;
+      std::map<std::string, double> _pumpStatuses, _pipeStatuses, _valveSettings;
+      PointRecord::sharedPointer _record;
+      Model::sharedPointer _model;
+      bool _didFail;
+      std::string _error;
+    };
+
+    ScenarioEnsemble(Model::sharedPointer baseModel, size_t threadCount = 0); //! 0 means one thread per hardware core
+    virtual ~ScenarioEnsemble() {};
+
+    Model::sharedPointer baseModel();
+    void addScenario(Scenario::sharedPointer scenario);
+    const std::vector<Scenario::sharedPointer>& scenarios();
+    void setStorage(PointRecord::sharedPointer record);  //! shared by the scenarios without their own, tagged by name
+    PointRecord::sharedPointer storage();
+    size_t threadCount();
+
+    void run(time_t start, time_t end) throw(RtxException);
+    Model::sharedPointer whatIf(Scenario::sharedPointer scenario) throw(RtxException);
+
+  private:
+    void checkOverrides(Scenario::sharedPointer scenario) throw(RtxException);
+    void prepare(Scenario::sharedPointer scenario);
+    void applyScenario(Scenario::sharedPointer scenario, Model::sharedPointer model);
+    void workerLoop();
+
+    Model::sharedPointer _baseModel;
+    size_t _threadCount;
+    std::vector<Scenario::sharedPointer> _scenarios;
+    PointRecord::sharedPointer _record;
+    time_t _start, _end;
+    boost::atomic<size_t> _nextScenario;  // next one for a worker to take
+  };
+
+}
+
+#endif
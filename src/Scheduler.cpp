@@ -0,0 +1,481 @@
+//
+//  Scheduler.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Scheduler.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+namespace {
+  // a sysfs cpu list, like "0-3,8-11"
+  vector<int> parseCpuList(const string& list) {
+    vector<int> cpus;
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+      if (range.empty()) {
+        continue;
+      }
+      size_t dash = range.find('-');
+      int first = atoi(range.substr(0, dash).c_str());
+      int last = (dash == string::npos) ? first : atoi(range.substr(dash + 1).c_str());
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+    return cpus;
+  }
+}
+
+
+Scheduler::Scheduler(const Options& options) : _options(options) {
+  if (_options.cpuThreads == 0) {
+    _options.cpuThreads = boost::thread::hardware_concurrency();
+  }
+  _options.cpuThreads = RTX_MAX(_options.cpuThreads, (size_t)1);
+  _options.ioThreads = RTX_MAX(_options.ioThreads, (size_t)1);
+  _options.ioQueueCapacity = RTX_MAX(_options.ioQueueCapacity, (size_t)1);
+  _isStarted = false;
+  _isIoStarted = false;
+  _isStopping = false;
+  _isIoStopping = false;
+  _ioQueued = 0;
+  _ioBackgroundRunning = 0;
+  _nextQueue = 0;
+  for (int p = 0; p < priorityCount; ++p) {
+    _queued[p] = 0;
+  }
+  _realtimeInFlight = 0;
+  for (size_t i = 0; i < _options.cpuThreads; ++i) {
+    _queues.push_back(WorkQueuePointer(new WorkQueue()));
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    scopedLock_t lock(_wakeMutex);
+    _isStopping = true;
+  }
+  {
+    scopedLock_t lock(_ioMutex);
+    _isIoStopping = true;
+  }
+  _workAvailable.notify_all();
+  _ioAvailable.notify_all();
+  _ioRoom.notify_all();
+  _workers.join_all();
+  _ioWorkers.join_all();
+}
+
+Scheduler::Options Scheduler::options() {
+  return _options;
+}
+
+size_t Scheduler::cpuThreadCount() {
+  return _options.cpuThreads;
+}
+
+
+#pragma mark - Public Methods
+
+// the first task is left to the caller, who'd otherwise only wait
+void Scheduler::run(const std::vector<task_t>& tasks, priority_t priority) {
+  if (tasks.empty()) {
+    return;
+  }
+  groupPointer_t group(new Group(tasks));
+  if (tasks.size() > 1) {
+    startWorkers();
+    if (priority == realtimePriority) {
+      beginRealtime();
+    }
+    for (size_t i = 1; i < tasks.size(); ++i) {
+      enqueue(Item(group, i), priority);
+    }
+  }
+  finish(group);
+  if (tasks.size() > 1 && priority == realtimePriority) {
+    endRealtime();
+  }
+}
+
+void Scheduler::runIo(const std::vector<task_t>& tasks, priority_t priority) {
+  if (tasks.empty()) {
+    return;
+  }
+  groupPointer_t group(new Group(tasks));
+  if (tasks.size() > 1) {
+    startIoWorkers();
+    for (size_t i = 1; i < tasks.size(); ++i) {
+      if (!enqueueIo(Item(group, i), priority, false)) {
+        break; // the queue's full: the caller runs the rest
+      }
+    }
+  }
+  finish(group);
+}
+
+void Scheduler::submit(const task_t& task, priority_t priority) {
+  startWorkers();
+  enqueue(Item(groupPointer_t(new Group(vector<task_t>(1, task))), 0), priority);
+}
+
+// an i/o thread waiting for room in its own queue might wait forever, so it runs the task itself instead
+void Scheduler::submitIo(const task_t& task, priority_t priority) {
+  startIoWorkers();
+  size_t worker;
+  Item item(groupPointer_t(new Group(vector<task_t>(1, task))), 0);
+  if (!enqueueIo(item, priority, !isWorkerThread(true, worker)) && claim(item)) {
+    execute(item);
+  }
+}
+
+bool Scheduler::shouldYield(priority_t priority) {
+  scopedLock_t lock(_wakeMutex);
+  if (priority == backgroundPriority && _realtimeInFlight > 0) {
+    return true;
+  }
+  for (int p = 0; p < (int)priority; ++p) {
+    if (_queued[p] > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+#pragma mark - Real-time Sections
+
+Scheduler::RealtimeSection::RealtimeSection(Scheduler::sharedPointer scheduler) : _scheduler(scheduler) {
+  if (_scheduler) {
+    _scheduler->beginRealtime();
+  }
+}
+
+Scheduler::RealtimeSection::~RealtimeSection() {
+  if (_scheduler) {
+    _scheduler->endRealtime();
+  }
+}
+
+void Scheduler::beginRealtime() {
+  scopedLock_t lock(_wakeMutex);
+  ++_realtimeInFlight;
+}
+
+void Scheduler::endRealtime() {
+  {
+    scopedLock_t lock(_wakeMutex);
+    --_realtimeInFlight;
+  }
+  _workAvailable.notify_all(); // held background work can go now
+}
+
+
+#pragma mark - Groups
+
+bool Scheduler::claim(const Item& item) {
+  scopedLock_t lock(item.group->mutex);
+  if (item.group->claimed[item.index]) {
+    return false;
+  }
+  item.group->claimed[item.index] = true;
+  return true;
+}
+
+void Scheduler::execute(const Item& item) {
+  Group& group = *item.group;
+  try {
+    group.tasks[item.index]();
+  } catch (std::exception& e) {
+    RTX_LOG(error, "Scheduler", "task failed: " << e.what());
+  } catch (...) {
+    RTX_LOG(error, "Scheduler", "task failed");
+  }
+  {
+    scopedLock_t lock(group.mutex);
+    --group.remaining;
+  }
+  group.finished.notify_all();
+}
+
+void Scheduler::finish(const groupPointer_t& group) {
+  for (size_t i = 0; i < group->tasks.size(); ++i) {
+    Item item(group, i);
+    if (claim(item)) {
+      execute(item);
+    }
+  }
+  scopedLock_t lock(group->mutex);
+  while (group->remaining > 0) {
+    group->finished.wait(lock);
+  }
+}
+
+
+#pragma mark - Computation Pool
+
+void Scheduler::startWorkers() {
+  scopedLock_t lock(_wakeMutex);
+  if (_isStarted || _isStopping) {
+    return;
+  }
+  _isStarted = true;
+  vector<int> cpus = cpuOrder();
+  for (size_t i = 0; i < _options.cpuThreads; ++i) {
+    int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    _workers.create_thread(boost::bind(&Scheduler::workerLoop, this, i, cpu));
+  }
+}
+
+void Scheduler::workerLoop(size_t worker, int cpu) {
+  _identity.reset(new WorkerIdentity(worker, false));
+  if (cpu >= 0) {
+    pinThread(cpu);
+  }
+  Item item;
+  while (takeWork(worker, item)) {
+    if (claim(item)) {
+      execute(item);
+    }
+    item = Item(); // let the group go
+  }
+}
+
+// work from one of the pool's own threads stays with it, where what it's just computed is still warm
+void Scheduler::enqueue(const Item& item, priority_t priority) {
+  size_t worker;
+  if (!isWorkerThread(false, worker)) {
+    scopedLock_t lock(_wakeMutex);
+    worker = _nextQueue;
+    _nextQueue = (_nextQueue + 1) % _queues.size();
+  }
+  {
+    scopedLock_t lock(_queues[worker]->mutex);
+    _queues[worker]->ready[priority].push_back(item);
+  }
+  {
+    scopedLock_t lock(_wakeMutex);
+    ++_queued[priority];
+  }
+  _workAvailable.notify_one();
+}
+
+bool Scheduler::takeWork(size_t worker, Item& item) {
+  while (true) {
+    bool holdsBackground;
+    {
+      scopedLock_t lock(_wakeMutex);
+      if (_isStopping) {
+        return false;
+      }
+      holdsBackground = (_realtimeInFlight > 0);
+    }
+    for (int p = 0; p < priorityCount; ++p) {
+      if (p == backgroundPriority && holdsBackground) {
+        break;
+      }
+      bool found = false;
+      // my own queue first, newest first
+      {
+        scopedLock_t lock(_queues[worker]->mutex);
+        if (!_queues[worker]->ready[p].empty()) {
+          item = _queues[worker]->ready[p].back();
+          _queues[worker]->ready[p].pop_back();
+          found = true;
+        }
+      }
+      // otherwise steal the oldest from someone else
+      for (size_t i = 1; !found && i < _queues.size(); ++i) {
+        WorkQueue& victim = *_queues[(worker + i) % _queues.size()];
+        scopedLock_t lock(victim.mutex);
+        if (!victim.ready[p].empty()) {
+          item = victim.ready[p].front();
+          victim.ready[p].pop_front();
+          found = true;
+        }
+      }
+      if (found) {
+        scopedLock_t lock(_wakeMutex);
+        --_queued[p];
+        return true;
+      }
+    }
+
+    // nothing to take: wait for some
+    scopedLock_t lock(_wakeMutex);
+    while (!_isStopping && _queued[realtimePriority] <= 0 && _queued[normalPriority] <= 0 && (_queued[backgroundPriority] <= 0 || _realtimeInFlight > 0)) {
+      _workAvailable.wait(lock);
+    }
+  }
+}
+
+bool Scheduler::isWorkerThread(bool isIo, size_t& worker) {
+  WorkerIdentity* identity = _identity.get();
+  if (!identity || identity->isIo != isIo) {
+    return false;
+  }
+  worker = identity->worker;
+  return true;
+}
+
+
+#pragma mark - I/O Pool
+
+void Scheduler::startIoWorkers() {
+  scopedLock_t lock(_ioMutex);
+  if (_isIoStarted || _isIoStopping) {
+    return;
+  }
+  _isIoStarted = true;
+  for (size_t i = 0; i < _options.ioThreads; ++i) {
+    _ioWorkers.create_thread(boost::bind(&Scheduler::ioLoop, this, i));
+  }
+}
+
+bool Scheduler::enqueueIo(const Item& item, priority_t priority, bool waitsForRoom) {
+  {
+    scopedLock_t lock(_ioMutex);
+    while (_ioQueued >= _options.ioQueueCapacity) {
+      if (!waitsForRoom || _isIoStopping) {
+        return false;
+      }
+      _ioRoom.wait(lock);
+    }
+    _ioQueue[priority].push_back(item);
+    ++_ioQueued;
+  }
+  _ioAvailable.notify_one();
+  return true;
+}
+
+void Scheduler::ioLoop(size_t worker) {
+  _identity.reset(new WorkerIdentity(worker, true));
+  Item item;
+  bool isBackground;
+  while (takeIoWork(item, isBackground)) {
+    if (claim(item)) {
+      execute(item);
+    }
+    item = Item();
+    if (isBackground) {
+      {
+        scopedLock_t lock(_ioMutex);
+        --_ioBackgroundRunning;
+      }
+      _ioAvailable.notify_all(); // another can start
+    }
+  }
+}
+
+// background work can have all but one of the threads
+bool Scheduler::takeIoWork(Item& item, bool& isBackground) {
+  size_t backgroundLimit = RTX_MAX(_options.ioThreads - 1, (size_t)1);
+  scopedLock_t lock(_ioMutex);
+  while (true) {
+    if (_isIoStopping) {
+      return false;
+    }
+    for (int p = 0; p < priorityCount; ++p) {
+      isBackground = (p == backgroundPriority);
+      if (_ioQueue[p].empty() || (isBackground && _ioBackgroundRunning >= backgroundLimit)) {
+        continue;
+      }
+      item = _ioQueue[p].front();
+      _ioQueue[p].pop_front();
+      --_ioQueued;
+      if (isBackground) {
+        ++_ioBackgroundRunning;
+      }
+      lock.unlock();
+      _ioRoom.notify_one();
+      return true;
+    }
+    _ioAvailable.wait(lock);
+  }
+}
+
+
+#pragma mark - Placement
+
+// the cores to pin the pool's threads to, in order -- empty for none
+vector<int> Scheduler::cpuOrder() {
+  vector<int> order;
+  if (_options.placement == anyPlacement) {
+    return order;
+  }
+#ifdef __linux__
+  vector<vector<int> > nodes;
+  for (int iNode = 0; ; ++iNode) {
+    stringstream path;
+    path << "/sys/devices/system/node/node" << iNode << "/cpulist";
+    ifstream file(path.str().c_str());
+    string list;
+    if (!file.is_open() || !getline(file, list)) {
+      break;
+    }
+    vector<int> cpus = parseCpuList(list);
+    if (!cpus.empty()) {
+      nodes.push_back(cpus);
+    }
+  }
+  if (nodes.empty()) {
+    RTX_LOG(warning, "Scheduler", "no NUMA nodes found -- threads won't be pinned");
+    return order;
+  }
+  if (_options.placement == compactPlacement) {
+    BOOST_FOREACH(const vector<int>& cpus, nodes) {
+      order.insert(order.end(), cpus.begin(), cpus.end());
+    }
+  }
+  else {
+    for (size_t k = 0; order.size() < _options.cpuThreads; ++k) {
+      bool any = false;
+      BOOST_FOREACH(const vector<int>& cpus, nodes) {
+        if (k < cpus.size()) {
+          order.push_back(cpus[k]);
+          any = true;
+        }
+      }
+      if (!any) {
+        break;
+      }
+    }
+  }
+#else
+  RTX_LOG(warning, "Scheduler", "thread placement isn't supported on this platform -- threads won't be pinned");
+#endif
+  return order;
+}
+
+void Scheduler::pinThread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    RTX_LOG(warning, "Scheduler", "could not pin a thread to cpu " << cpu);
+  }
+#endif
+}
@@ -0,0 +1,179 @@
+//
+//  Scheduler.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_Scheduler_h
+#define epanet_rtx_Scheduler_h
+
+#include <vector>
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "rtxMacros.h"
+
+namespace RTX {
+
+  /*!
+   \class Scheduler
+   \brief The threads the library's parallel work runs on: a work-stealing pool for computation, and a bounded one
+   for blocking i/o.
+
+   Rather than each subsystem starting threads of its own -- and several of them together oversubscribing the
+   machine -- they hand their work here (see RuntimeContext, for which scheduler that is). Either pool starts with the
+   first work it's given.
+
+   The computation pool keeps a queue of ready tasks per thread and priority. A thread takes from its own queue first,
+   newest first, and then the oldest from the others'; work a task hands in from a pool thread goes to that thread's
+   queue. Tasks are taken highest priority first, and background tasks aren't started at all while any real-time
+   work is in flight (a real-time run, or a RealtimeSection) -- so a real-time step gets every thread there is, once
+   those running finish their task. A long
+   background task can check shouldYield between pieces of its work to make way sooner. Nothing is interrupted.
+
+   run() waits for its tasks, and the calling thread runs whichever of them no pool thread has started -- so work
+   handed in from inside a task never waits on itself, and a call always gets done, however busy the pool.
+
+   Pool threads can be pinned to cores. compactPlacement fills one NUMA node's cores before the next (for work that
+   shares a lot of memory), spreadPlacement takes a core from each node in turn (for memory bandwidth). The nodes are
+   read from /sys/devices/system/node on Linux; elsewhere, or if they can't be read, threads aren't pinned.
+
+   The i/o pool is for work that waits on a database or historian: a fixed number of threads, taking the oldest task
+   of the highest priority there is, with at most ioQueueCapacity tasks waiting (submitIo waits for room when it's
+   full). Background i/o -- a backfill, an export -- never has every thread, so there's always one free for a
+   real-time step's fetches.
+   */
+
+  /*!
+   \fn void Scheduler::run(const std::vector<task_t>& tasks, priority_t priority)
+   \brief Run the tasks on the computation pool and the calling thread, and return when they've all finished.
+
+   A task that throws is logged; the rest still run.
+   */
+
+  class Scheduler {
+  public:
+    RTX_SHARED_POINTER(Scheduler);
+    typedef enum {
+      realtimePriority,
+      normalPriority,
+      backgroundPriority
+    } priority_t;
+    typedef enum {
+      anyPlacement,     // not pinned
+      compactPlacement,
+      spreadPlacement
+    } placement_t;
+    typedef boost::function<void()> task_t;
+
+    class Options {
+    public:
+      Options() : cpuThreads(0), ioThreads(4), ioQueueCapacity(256), placement(anyPlacement) {};
+      // simple tuple class, so no getters/setters
+      size_t cpuThreads;      // 0 means one per hardware core
+      size_t ioThreads;
+      size_t ioQueueCapacity; // tasks waiting for an i/o thread
+      placement_t placement;
+    };
+
+    Scheduler(const Options& options = Options());
+    virtual ~Scheduler(); //! waits for the tasks running. those still queued aren't run
+
+    Options options();
+    size_t cpuThreadCount();
+
+    void run(const std::vector<task_t>& tasks, priority_t priority = normalPriority);
+    void runIo(const std::vector<task_t>& tasks, priority_t priority = normalPriority); //! as run, on the i/o pool
+    void submit(const task_t& task, priority_t priority = backgroundPriority); //! run it sometime, without waiting
+    void submitIo(const task_t& task, priority_t priority = normalPriority); //! the same on the i/o pool. waits while its queue is full
+    bool shouldYield(priority_t priority); //! whether more urgent work is waiting for a thread
+
+    // holds background work back while it's in scope, as a real-time run does -- for a whole live step, say
+    class RealtimeSection {
+    public:
+      RealtimeSection(Scheduler::sharedPointer scheduler);
+      ~RealtimeSection();
+    private:
+      Scheduler::sharedPointer _scheduler;
+    };
+    friend class RealtimeSection;
+
+  private:
+    // one run's tasks. each is run once, by whoever claims it first -- a pool thread, or the caller.
+    class Group {
+    public:
+      Group(const std::vector<task_t>& tasks) : tasks(tasks), claimed(tasks.size(), false), remaining(tasks.size()) {};
+      std::vector<task_t> tasks;
+      std::vector<bool> claimed;
+      size_t remaining;
+      boost::mutex mutex;
+      boost::condition_variable finished;
+    };
+    typedef boost::shared_ptr<Group> groupPointer_t;
+    class Item {
+    public:
+      // simple tuple class, so no getters/setters
+      Item() : index(0) {};
+      Item(groupPointer_t group, size_t index) : group(group), index(index) {};
+      groupPointer_t group;
+      size_t index;
+    };
+    enum { priorityCount = 3 };
+    class WorkQueue {
+    public:
+      boost::mutex mutex;
+      std::deque<Item> ready[priorityCount];
+    };
+    typedef boost::shared_ptr<WorkQueue> WorkQueuePointer;
+    class WorkerIdentity {
+    public:
+      WorkerIdentity(size_t worker, bool isIo) : worker(worker), isIo(isIo) {};
+      size_t worker;
+      bool isIo;
+    };
+
+    static bool claim(const Item& item);
+    static void execute(const Item& item);
+    static void finish(const groupPointer_t& group); //! helps, then waits for the rest
+    void beginRealtime();
+    void endRealtime();
+    void startWorkers();
+    void startIoWorkers();
+    void workerLoop(size_t worker, int cpu);
+    void ioLoop(size_t worker);
+    bool takeWork(size_t worker, Item& item);
+    void enqueue(const Item& item, priority_t priority);
+    bool enqueueIo(const Item& item, priority_t priority, bool waitsForRoom);
+    bool takeIoWork(Item& item, bool& isBackground);
+    bool isWorkerThread(bool isIo, size_t& worker);
+    std::vector<int> cpuOrder();
+    static void pinThread(int cpu);
+
+    Options _options;
+    std::vector<WorkQueuePointer> _queues;
+    boost::thread_group _workers, _ioWorkers;
+    bool _isStarted, _isStopping;
+    size_t _nextQueue;                 // where work from outside the pool goes next
+    long _queued[priorityCount];       // items in the queues, by priority
+    size_t _realtimeInFlight;          // real-time runs not yet finished
+    boost::mutex _wakeMutex;           // guards the above
+    boost::condition_variable _workAvailable;
+    std::deque<Item> _ioQueue[priorityCount];
+    size_t _ioQueued, _ioBackgroundRunning;
+    bool _isIoStarted, _isIoStopping;
+    boost::mutex _ioMutex;             // guards the i/o queue and its flags
+    boost::condition_variable _ioAvailable, _ioRoom;
+    boost::thread_specific_ptr<WorkerIdentity> _identity;
+  };
+
+}
+
+#endif
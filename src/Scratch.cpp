@@ -0,0 +1,62 @@
+//
+//  Scratch.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <boost/thread/tss.hpp>
+
+#include "Scratch.h"
+
+// what each thread keeps between steps, unless told otherwise
+#define RTX_SCRATCH_RETAINED_BYTES (8 << 20)
+
+using namespace RTX;
+
+boost::atomic<size_t> Scratch::_retainedBytes(RTX_SCRATCH_RETAINED_BYTES);
+
+
+#pragma mark - Steps
+
+void Scratch::endStep() {
+  size_t budget = _retainedBytes.load(boost::memory_order_relaxed);
+  std::vector<PoolBase*>& pools = threadPools();
+  for (size_t i = 0; i < pools.size(); ++i) {
+    if (pools[i]) {
+      budget -= pools[i]->trim(budget);
+    }
+  }
+}
+
+void Scratch::setRetainedBytes(size_t bytes) {
+  _retainedBytes = bytes;
+}
+
+size_t Scratch::retainedBytes() {
+  return _retainedBytes;
+}
+
+
+#pragma mark - Private
+
+std::vector<Scratch::PoolBase*>& Scratch::threadPools() {
+  static boost::thread_specific_ptr< std::vector<PoolBase*> > current(&deletePools);
+  if (!current.get()) {
+    current.reset(new std::vector<PoolBase*>());
+  }
+  return *current;
+}
+
+void Scratch::deletePools(std::vector<PoolBase*>* pools) {
+  for (size_t i = 0; i < pools->size(); ++i) {
+    delete (*pools)[i];
+  }
+  delete pools;
+}
+
+size_t Scratch::nextTypeIndex() {
+  static boost::atomic<size_t> next(0);
+  return next.fetch_add(1);
+}
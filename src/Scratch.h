@@ -0,0 +1,120 @@
+//
+//  Scratch.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_Scratch_h
+#define epanet_rtx_Scratch_h
+
+#include <vector>
+#include <stddef.h>
+
+#include <boost/atomic.hpp>
+#include <boost/utility.hpp>
+
+namespace RTX {
+
+  /*!
+   \class Scratch
+   \brief Reusable, per-thread vectors for the temporaries of a step or a range query.
+
+   A Scratch::Vector leases a vector from the calling thread's pool for the scope it's declared in. It starts out
+   empty, but keeps whatever capacity it had the last time it was used, so a range query that runs every step
+   stops allocating once its buffers have grown to fit. Leases are per thread, so there's no locking, and a
+   buffer handed out is never touched by anyone else until it's given back.
+
+   The pool only ever holds buffers that nobody has leased. endStep() trims the calling thread's idle buffers back
+   to retainedBytes(), so a one-off wide query doesn't pin its memory for the life of the process. Model calls it
+   at the end of every period of runExtendedPeriod; a thread's pool goes away with the thread.
+   */
+
+  class Scratch {
+    class PoolBase;
+    template<class T> class Pool;
+  public:
+    //! a vector leased from the calling thread's pool, for as long as this is in scope
+    template<class T> class Vector : boost::noncopyable {
+    public:
+      Vector() : _pool(Scratch::pool<T>()), _vector(_pool.lease()) {};
+      ~Vector() { _pool.giveBack(_vector); };
+      std::vector<T>& operator*() { return *_vector; };
+      std::vector<T>* operator->() { return _vector; };
+    private:
+      Pool<T>& _pool;
+      std::vector<T>* _vector;
+    };
+
+    static void endStep(); //! trims the calling thread's idle buffers back to retainedBytes()
+    static void setRetainedBytes(size_t bytes);
+    static size_t retainedBytes(); //! per thread, over all of its idle buffers
+
+  private:
+    class PoolBase {
+    public:
+      virtual ~PoolBase() {};
+      virtual size_t trim(size_t budget) = 0; //! keeps what fits in the budget, and says how much that was
+    };
+
+    template<class T> class Pool : public PoolBase {
+    public:
+      virtual ~Pool() {
+        for (size_t i = 0; i < _idle.size(); ++i) {
+          delete _idle[i];
+        }
+      };
+      std::vector<T>* lease() {
+        if (_idle.empty()) {
+          return new std::vector<T>();
+        }
+        std::vector<T>* v = _idle.back();
+        _idle.pop_back();
+        return v;
+      };
+      void giveBack(std::vector<T>* v) {
+        v->clear();
+        _idle.push_back(v);
+      };
+      virtual size_t trim(size_t budget) {
+        size_t kept = 0;
+        std::vector< std::vector<T>* > keep;
+        for (size_t i = 0; i < _idle.size(); ++i) {
+          size_t bytes = _idle[i]->capacity() * sizeof(T);
+          if (kept + bytes <= budget) {
+            kept += bytes;
+            keep.push_back(_idle[i]);
+          }
+          else {
+            delete _idle[i];
+          }
+        }
+        _idle.swap(keep);
+        return kept;
+      };
+    private:
+      std::vector< std::vector<T>* > _idle;
+    };
+
+    static std::vector<PoolBase*>& threadPools(); //! the calling thread's, one slot per element type
+    static void deletePools(std::vector<PoolBase*>* pools); //! as its thread exits
+    static size_t nextTypeIndex();
+    template<class T> static Pool<T>& pool() {
+      static size_t typeIndex = nextTypeIndex();
+      std::vector<PoolBase*>& pools = threadPools();
+      if (pools.size() <= typeIndex) {
+        pools.resize(typeIndex + 1, NULL);
+      }
+      if (!pools[typeIndex]) {
+        pools[typeIndex] = new Pool<T>();
+      }
+      return *static_cast<Pool<T>*>(pools[typeIndex]);
+    };
+
+    static boost::atomic<size_t> _retainedBytes;
+  };
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+//
+//  SeriesArchive.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <cstring>
+#include <iomanip>
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "SeriesArchive.h"
+#include "BufferPointRecord.h"
+#include "CompressedPointRecord.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+static const char archiveMagic[8] = {'R','T','X','A','R','C','H','1'};
+static const uint32_t archiveVersion = 1;
+static const size_t archiveWriteBuffer = 1 << 20;
+
+const size_t SeriesArchive::blockPoints = 1024;
+
+namespace {
+  // takes each series' points as they're visited, and writes them out as they fill a block (or a line each, as text)
+  class ArchiveWriter : public PointVisitor {
+  public:
+    ArchiveWriter(const std::string& path, SeriesArchive::format_t format) : _format(format), _buffer(archiveWriteBuffer) {
+      // a big buffer, set before opening, so the file is written in long sequential runs
+      _file.rdbuf()->pubsetbuf(&_buffer[0], _buffer.size());
+      _file.open(path.c_str(), ios::binary | ios::trunc);
+      if (!_file) {
+        throw RtxIoException();
+      }
+      if (_format == SeriesArchive::binaryFormat) {
+        _file.write(archiveMagic, sizeof(archiveMagic));
+        BufferPointRecord::writeValue(_file, archiveVersion);
+      }
+      else {
+        _file << setprecision(12);
+      }
+    };
+    void beginSeries(const std::string& name, const std::string& units) {
+      _series = SeriesArchive::series_t();
+      _series.name = name;
+      _series.units = units;
+      _block = CompressedPointRecord::Block();
+    };
+    virtual bool visit(const Point& point) {
+      if (_format == SeriesArchive::textFormat) {
+        _file << _series.name << "," << point.time << "," << point.value << "," << (int)point.quality << "," << point.confidence << "\n";
+        return true;
+      }
+      _block.append(point);
+      ++_series.pointCount;
+      if (_block.count() >= SeriesArchive::blockPoints) {
+        writeBlock();
+      }
+      return true;
+    };
+    void endSeries() {
+      writeBlock();
+      _directory.push_back(_series);
+      if (!_file) {
+        throw RtxIoException();
+      }
+    };
+    void finish() {
+      if (_format == SeriesArchive::binaryFormat) {
+        uint64_t directoryOffset = (uint64_t)_file.tellp();
+        BufferPointRecord::writeValue(_file, (uint64_t)_directory.size());
+        BOOST_FOREACH(const SeriesArchive::series_t& series, _directory) {
+          BufferPointRecord::writeString(_file, series.name);
+          BufferPointRecord::writeString(_file, series.units);
+          BufferPointRecord::writeValue(_file, series.pointCount);
+          BufferPointRecord::writeValue(_file, (uint64_t)series.blocks.size());
+          BOOST_FOREACH(const SeriesArchive::block_t& block, series.blocks) {
+            BufferPointRecord::writeValue(_file, block.offset);
+            BufferPointRecord::writeValue(_file, (int64_t)block.firstTime);
+            BufferPointRecord::writeValue(_file, (int64_t)block.lastTime);
+          }
+        }
+        // the footer says where the directory is
+        BufferPointRecord::writeValue(_file, directoryOffset);
+        _file.write(archiveMagic, sizeof(archiveMagic));
+      }
+      _file.close();
+      if (_file.fail()) {
+        throw RtxIoException();
+      }
+    };
+  private:
+    void writeBlock() {
+      if (_block.count() == 0) {
+        return;
+      }
+      SeriesArchive::block_t block;
+      block.offset = (uint64_t)_file.tellp();
+      block.firstTime = _block.firstTime();
+      block.lastTime = _block.lastTime();
+      _block.write(_file);
+      _series.blocks.push_back(block);
+      _block = CompressedPointRecord::Block();
+    };
+    SeriesArchive::format_t _format;
+    std::vector<char> _buffer;
+    std::ofstream _file;
+    SeriesArchive::series_t _series;
+    CompressedPointRecord::Block _block;
+    std::vector<SeriesArchive::series_t> _directory;
+  };
+}
+
+
+#pragma mark - Writing
+
+void SeriesArchive::write(const std::string& path, PointRecord::sharedPointer record, const std::vector<std::string>& ids, time_t start, time_t end, format_t format) throw(RtxException) {
+  ArchiveWriter writer(path, format);
+  BOOST_FOREACH(const std::string& id, ids) {
+    writer.beginSeries(id, "");
+    record->visitPointsInRange(id, start, end, writer);
+    writer.endSeries();
+  }
+  writer.finish();
+}
+
+void SeriesArchive::write(const std::string& path, const std::vector<TimeSeries::sharedPointer>& series, time_t start, time_t end, format_t format) throw(RtxException) {
+  ArchiveWriter writer(path, format);
+  BOOST_FOREACH(TimeSeries::sharedPointer ts, series) {
+    writer.beginSeries(ts->name(), ts->units().unitString());
+    ts->visitPoints(start, end, writer);
+    writer.endSeries();
+  }
+  writer.finish();
+}
+
+
+#pragma mark - Reading
+
+SeriesArchive::SeriesArchive(const std::string& path) throw(RtxException) {
+  _file.open(path.c_str(), ios::binary);
+  char magic[sizeof(archiveMagic)];
+  uint32_t version = 0;
+  if (_file.read(magic, sizeof(magic)).fail() || memcmp(magic, archiveMagic, sizeof(magic)) != 0 || !BufferPointRecord::readValue(_file, version) || version != archiveVersion) {
+    throw RtxIoException();
+  }
+
+  // the footer, then the directory it points to
+  uint64_t directoryOffset = 0, seriesCount = 0;
+  _file.seekg(-(streamoff)(sizeof(uint64_t) + sizeof(archiveMagic)), ios::end);
+  if (!BufferPointRecord::readValue(_file, directoryOffset) || _file.read(magic, sizeof(magic)).fail() || memcmp(magic, archiveMagic, sizeof(magic)) != 0) {
+    throw RtxIoException();
+  }
+  _file.seekg((streamoff)directoryOffset, ios::beg);
+  if (!BufferPointRecord::readValue(_file, seriesCount)) {
+    throw RtxIoException();
+  }
+  for (uint64_t iSeries = 0; iSeries < seriesCount; ++iSeries) {
+    series_t series;
+    uint64_t blockCount = 0;
+    if (!BufferPointRecord::readString(_file, series.name) || !BufferPointRecord::readString(_file, series.units) || !BufferPointRecord::readValue(_file, series.pointCount) || !BufferPointRecord::readValue(_file, blockCount) || blockCount > directoryOffset) {
+      throw RtxIoException();
+    }
+    for (uint64_t iBlock = 0; iBlock < blockCount; ++iBlock) {
+      block_t block;
+      int64_t firstTime, lastTime;
+      if (!BufferPointRecord::readValue(_file, block.offset) || !BufferPointRecord::readValue(_file, firstTime) || !BufferPointRecord::readValue(_file, lastTime)) {
+        throw RtxIoException();
+      }
+      block.firstTime = (time_t)firstTime;
+      block.lastTime = (time_t)lastTime;
+      series.blocks.push_back(block);
+    }
+    _order.push_back(series.name);
+    _series[series.name] = series;
+  }
+}
+
+std::vector<std::string> SeriesArchive::identifiers() {
+  return _order;
+}
+
+std::vector<Point> SeriesArchive::points(const std::string& id, time_t start, time_t end) {
+  vector<Point> points;
+  map<string, series_t>::const_iterator found = _series.find(id);
+  if (found == _series.end()) {
+    return points;
+  }
+  scopedLock_t lock(_fileMutex);
+  BOOST_FOREACH(const block_t& block, found->second.blocks) {
+    if (block.lastTime < start) {
+      continue;
+    }
+    if (block.firstTime > end) {
+      break;
+    }
+    CompressedPointRecord::Block packed;
+    _file.clear();
+    _file.seekg((streamoff)block.offset, ios::beg);
+    if (!packed.read(_file)) {
+      throw RtxIoException();
+    }
+    packed.decodeRange(start, end, points);
+  }
+  return points;
+}
+
+PointRecord::time_pair_t SeriesArchive::range(const std::string& id) {
+  map<string, series_t>::const_iterator found = _series.find(id);
+  if (found == _series.end() || found->second.blocks.empty()) {
+    return make_pair(0, 0);
+  }
+  return make_pair(found->second.blocks.front().firstTime, found->second.blocks.back().lastTime);
+}
+
+size_t SeriesArchive::pointCount(const std::string& id) {
+  map<string, series_t>::const_iterator found = _series.find(id);
+  return (found == _series.end()) ? 0 : (size_t)found->second.pointCount;
+}
+
+std::string SeriesArchive::unitString(const std::string& id) {
+  map<string, series_t>::const_iterator found = _series.find(id);
+  return (found == _series.end()) ? "" : found->second.units;
+}
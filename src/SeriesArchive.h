@@ -0,0 +1,103 @@
+//
+//  SeriesArchive.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_SeriesArchive_h
+#define epanet_rtx_SeriesArchive_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <stdint.h>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "Point.h"
+#include "PointRecord.h"
+#include "TimeSeries.h"
+
+#include <boost/thread/mutex.hpp>
+
+namespace RTX {
+
+  /*!
+   \class SeriesArchive
+   \brief A compact file of many series' points, written in one sequential pass and read back a series at a time.
+
+   write() streams each series out of its record (or through its TimeSeries) into the file, a block at a time, so a
+   month of results for every element of a large model is never held in memory at once. Points are packed the way
+   CompressedPointRecord packs them -- each block's times by delta-of-delta, its values and confidences by XOR with
+   the one before, its qualities only where they change -- and the file ends with a directory of every series'
+   blocks and the times they span.
+
+   Opening an archive reads only that directory. points() then reads just the blocks that overlap the range asked
+   for, so one series can be pulled out of a file of thousands without reading the rest.
+
+   Written as text instead, each point is a line of comma-separated series name, time, value, quality and
+   confidence. Only the binary form can be opened again.
+   */
+
+  /*!
+   \fn void SeriesArchive::write(const std::string& path, PointRecord::sharedPointer record, const std::vector<std::string>& ids, time_t start, time_t end, format_t format)
+   \brief Write the points stored under some of a record's identifiers.
+   \param path The file to write. It's replaced if it exists.
+   \param record Where the points are stored.
+   \param ids Which of its series to write, in this order.
+   \param start The beginning of the time range.
+   \param end The end of the time range.
+   \param format Binary (the default) or text.
+   */
+
+  class SeriesArchive {
+  public:
+    RTX_SHARED_POINTER(SeriesArchive);
+    SeriesArchive(const std::string& path) throw(RtxException); //! opens a binary archive for reading
+
+    typedef enum {
+      binaryFormat,
+      textFormat
+    } format_t;
+
+    // writing
+    static void write(const std::string& path, PointRecord::sharedPointer record, const std::vector<std::string>& ids, time_t start, time_t end, format_t format = binaryFormat) throw(RtxException);
+    static void write(const std::string& path, const std::vector<TimeSeries::sharedPointer>& series, time_t start, time_t end, format_t format = binaryFormat) throw(RtxException);
+    static const size_t blockPoints; //! how many points are packed together
+
+    // reading
+    std::vector<std::string> identifiers();
+    std::vector<Point> points(const std::string& id, time_t start, time_t end);
+    PointRecord::time_pair_t range(const std::string& id);
+    size_t pointCount(const std::string& id);
+    std::string unitString(const std::string& id); //! the series' units, as Units::unitOfType takes them. empty if written from a record
+
+    // the directory
+    class block_t {
+    public:
+      // simple tuple class, so no getters/setters
+      uint64_t offset;
+      time_t firstTime, lastTime;
+    };
+    class series_t {
+    public:
+      series_t() : pointCount(0) {};
+      // simple tuple class, so no getters/setters
+      std::string name, units;
+      uint64_t pointCount;
+      std::vector<block_t> blocks;
+    };
+
+  private:
+    std::ifstream _file;
+    std::map<std::string, series_t> _series;
+    std::vector<std::string> _order; // as written
+    boost::mutex _fileMutex;
+  };
+
+}
+
+#endif
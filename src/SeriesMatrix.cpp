@@ -0,0 +1,172 @@
+//
+//  SeriesMatrix.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <limits>
+#include <set>
+#include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "SeriesMatrix.h"
+#include "ParallelEvaluator.h"
+#include "Log.h"
+#include "RuntimeContext.h"
+
+using namespace RTX;
+using namespace std;
+
+namespace {
+  // drops a series' points into its cells, at the times it shares with the clock
+  class CellWriter : public PointVisitor {
+  public:
+    CellWriter(const std::vector<time_t>& times, double* values, unsigned char* good, size_t stride) : _times(times), _values(values), _good(good), _stride(stride), _next(0) {};
+    virtual bool visit(const Point& point) {
+      while (_next < _times.size() && _times[_next] < point.time) {
+        ++_next;
+      }
+      if (_next == _times.size()) {
+        return false;
+      }
+      if (_times[_next] == point.time) {
+        _values[_next * _stride] = point.value;
+        _good[_next * _stride] = (point.quality == Point::good);
+        ++_next;
+      }
+      return true;
+    };
+  private:
+    const std::vector<time_t>& _times;
+    double* _values;
+    unsigned char* _good;
+    size_t _stride, _next;
+  };
+}
+
+
+#pragma mark - Constructor
+
+SeriesMatrix::SeriesMatrix(layout_t layout, size_t threadCount) : _layout(layout), _threadCount(threadCount), _start(0), _end(0), _nextColumn(0) {
+  if (_threadCount == 0) {
+    _threadCount = boost::thread::hardware_concurrency();
+  }
+  if (_threadCount == 0) {
+    _threadCount = 1;
+  }
+}
+
+
+#pragma mark - Filling
+
+void SeriesMatrix::fill(const std::vector<TimeSeries::sharedPointer>& series, Clock::sharedPointer clock, time_t start, time_t end) throw(RtxException) {
+  if (!clock) {
+    throw RtxException("a SeriesMatrix needs a clock");
+  }
+  _series = series;
+  _start = start;
+  _end = end;
+  _times = clock->timeValuesInRange(start, end);
+  _values.assign(_times.size() * _series.size(), numeric_limits<double>::quiet_NaN());
+  _good.assign(_values.size(), 0);
+
+  // what the series are computed from, evaluated together. the series themselves are left for fillColumns to
+  // stream, so they're never collected into vectors of points.
+  vector<TimeSeries::sharedPointer> upstream;
+  set<TimeSeries*> seen;
+  BOOST_FOREACH(TimeSeries::sharedPointer ts, _series) {
+    if (!ts) {
+      continue;
+    }
+    BOOST_FOREACH(TimeSeries::sharedPointer source, ts->upstreamSeries()) {
+      if (source && seen.insert(source.get()).second) {
+        upstream.push_back(source);
+      }
+    }
+  }
+  if (!upstream.empty()) {
+    ParallelEvaluator evaluator(_threadCount);
+    evaluator.evaluate(upstream, start, end);
+  }
+
+  fillColumns();
+
+  // pack the quality bytes into bits
+  _mask.assign((_good.size() + 63) / 64, 0);
+  for (size_t i = 0; i < _good.size(); ++i) {
+    if (_good[i]) {
+      _mask[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+  }
+  _good.clear();
+}
+
+void SeriesMatrix::fillColumns() {
+  size_t threadCount = RTX_MIN(_threadCount, _series.size());
+  _nextColumn = 0;
+  vector<Scheduler::task_t> tasks(threadCount, boost::bind(&SeriesMatrix::columnLoop, this));
+  RuntimeContext::defaultContext()->scheduler()->run(tasks); // the calling thread works too
+}
+
+void SeriesMatrix::columnLoop() {
+  size_t iSeries;
+  while ((iSeries = _nextColumn.fetch_add(1)) < _series.size()) {
+    TimeSeries::sharedPointer ts = _series[iSeries];
+    if (!ts || _times.empty()) {
+      continue;
+    }
+    size_t first = index(0, iSeries);
+    size_t stride = (_layout == rowMajor) ? _series.size() : 1;
+    CellWriter writer(_times, &_values[first], &_good[first], stride);
+    try {
+      ts->visitPoints(_start, _end, writer);
+    } catch (std::exception& e) {
+      RTX_LOG(error, "SeriesMatrix", "could not evaluate " << ts->name() << ": " << e.what());
+    } catch (...) {
+      RTX_LOG(error, "SeriesMatrix", "could not evaluate " << ts->name());
+    }
+  }
+}
+
+
+#pragma mark - Result
+
+SeriesMatrix::layout_t SeriesMatrix::layout() {
+  return _layout;
+}
+
+size_t SeriesMatrix::timeCount() {
+  return _times.size();
+}
+
+size_t SeriesMatrix::seriesCount() {
+  return _series.size();
+}
+
+const std::vector<time_t>& SeriesMatrix::times() {
+  return _times;
+}
+
+const std::vector<double>& SeriesMatrix::values() {
+  return _values;
+}
+
+const std::vector<uint64_t>& SeriesMatrix::qualityMask() {
+  return _mask;
+}
+
+size_t SeriesMatrix::index(size_t iTime, size_t iSeries) {
+  return (_layout == rowMajor) ? iTime * _series.size() + iSeries : iSeries * _times.size() + iTime;
+}
+
+double SeriesMatrix::value(size_t iTime, size_t iSeries) {
+  return _values[index(iTime, iSeries)];
+}
+
+bool SeriesMatrix::isGood(size_t iTime, size_t iSeries) {
+  size_t i = index(iTime, iSeries);
+  return (_mask[i / 64] >> (i % 64)) & 1;
+}
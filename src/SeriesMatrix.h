@@ -0,0 +1,95 @@
+//
+//  SeriesMatrix.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_SeriesMatrix_h
+#define epanet_rtx_SeriesMatrix_h
+
+#include <vector>
+#include <stdint.h>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+#include "TimeSeries.h"
+#include "Clock.h"
+
+#include <boost/atomic.hpp>
+
+namespace RTX {
+
+  /*!
+   \class SeriesMatrix
+   \brief Many series on one clock over a window, as a dense matrix of doubles.
+
+   fill() takes the clock's times in the window as the rows and the series as the columns. Each cell holds the
+   value of that series' point at exactly that time, the way TimeSeries::point would find it. A cell whose series
+   has no point there is NaN. Put a Resampler in front of a series on a different clock to have it interpolated
+   onto this one.
+
+   Filling happens in two stages. First, everything upstream of the series is evaluated over the window by a
+   ParallelEvaluator, so shared sources are computed once and independent branches run at the same time. Then
+   each series is streamed through visitPoints, a series per worker thread, directly into its cells. No Point
+   vectors are built for the series themselves, and there is no separate pass to align them.
+
+   The values are one contiguous block, in row-major order (a time's values for every series side by side) or
+   column-major order (a series' values at every time side by side). The quality mask has one bit per cell, in
+   the same order, set where the cell holds a valid point of Point::good quality. A cell with a value and its bit
+   clear was estimated, interpolated, forecast or held constant.
+   */
+
+  /*!
+   \fn void SeriesMatrix::fill(const std::vector<TimeSeries::sharedPointer>& series, Clock::sharedPointer clock, time_t start, time_t end)
+   \brief Evaluate the series over a window, and lay their values out on a clock.
+   \param series The columns, in this order.
+   \param clock Whose times in the window are the rows.
+   \param start The beginning of the window.
+   \param end The end of the window.
+   \throw RtxException if there is no clock, or the series' graph has a cycle.
+   */
+
+  class SeriesMatrix {
+  public:
+    RTX_SHARED_POINTER(SeriesMatrix);
+    typedef enum {
+      rowMajor,
+      columnMajor
+    } layout_t;
+
+    SeriesMatrix(layout_t layout = rowMajor, size_t threadCount = 0); //! 0 means one thread per hardware core
+    virtual ~SeriesMatrix() {};
+
+    void fill(const std::vector<TimeSeries::sharedPointer>& series, Clock::sharedPointer clock, time_t start, time_t end) throw(RtxException);
+
+    // the result
+    layout_t layout();
+    size_t timeCount();   //! rows
+    size_t seriesCount(); //! columns
+    const std::vector<time_t>& times();
+    const std::vector<double>& values();        //! timeCount() x seriesCount(), in layout() order
+    const std::vector<uint64_t>& qualityMask(); //! cell i is bit (i % 64) of word (i / 64)
+    size_t index(size_t iTime, size_t iSeries); //! of a cell, in values() and qualityMask()
+    double value(size_t iTime, size_t iSeries);
+    bool isGood(size_t iTime, size_t iSeries);
+
+  private:
+    void fillColumns();
+    void columnLoop(); //! each worker takes the next series until there are none left
+
+    layout_t _layout;
+    size_t _threadCount;
+    std::vector<TimeSeries::sharedPointer> _series;
+    time_t _start, _end;
+    std::vector<time_t> _times;
+    std::vector<double> _values;
+    std::vector<unsigned char> _good; // a byte per cell while filling, so columns can be written at the same time
+    std::vector<uint64_t> _mask;
+    boost::atomic<size_t> _nextColumn;
+  };
+
+}
+
+#endif
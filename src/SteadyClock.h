@@ -0,0 +1,29 @@
+//
+//  SteadyClock.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_SteadyClock_h
+#define epanet_rtx_SteadyClock_h
+
+#include <boost/chrono/system_clocks.hpp>
+
+namespace RTX {
+
+  // for timing, not telling the time: a monotonic clock, from an arbitrary start, that setting the system clock (or
+  // ntp slewing it) doesn't move. only differences between readings mean anything.
+
+  inline unsigned long steadyMicroseconds() {
+    return (unsigned long)boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  inline double steadySeconds() {
+    return (double)steadyMicroseconds() / 1.e6;
+  }
+
+}
+
+#endif
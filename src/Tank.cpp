@@ -70,6 +70,9 @@ TimeSeries::sharedPointer Tank::levelMeasure() {
 void Tank::setHeadMeasure(TimeSeries::sharedPointer head) {
   // base class method first
   Junction::setHeadMeasure(head);
+  if (!head) {
+    return;
+  }
   
   // now hook it up to the "measured" level->volume->flow chain.
   // assumption about elevation units is made here.
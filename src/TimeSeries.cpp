@@ -6,16 +6,57 @@
 //  See README.md and license.txt for more information
 //  
 
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <set>
+#include <iomanip>
+
 #include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
 
 #include "TimeSeries.h"
+#include "Log.h"
 #include "IrregularClock.h"
 #include "BufferPointRecord.h"
+#include "Tracer.h"
+#include "Scratch.h"
+#include "SteadyClock.h"
 
 using namespace RTX;
 
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
 
-TimeSeries::TimeSeries() : _units(1) {
+namespace {
+  // a series' line in statsToStream, then its sources', indented under it. each series and record is listed once.
+  void reportSeriesStats(TimeSeries* series, int depth, std::ostream& stream, std::set<TimeSeries*>& seen, std::vector< std::pair<std::string, PointRecord::sharedPointer> >& records) {
+    if (!seen.insert(series).second) {
+      return;
+    }
+    TimeSeries::stats_t stats = series->stats();
+    stream << std::string(2 * depth, ' ') << "\"" << series->name() << "\": " << stats.cacheHits << " hits, "
+           << stats.cacheMisses << " misses, " << stats.upstreamCalls << " upstream calls, " << stats.pointsComputed
+           << " computed, " << std::fixed << std::setprecision(3) << stats.computeSeconds << " s" << std::endl;
+    PointRecord::sharedPointer record = series->record();
+    bool listed = false;
+    for (size_t i = 0; i < records.size(); ++i) {
+      listed |= (records[i].second == record);
+    }
+    if (record && !listed) {
+      records.push_back(std::make_pair(series->name(), record));
+    }
+    BOOST_FOREACH(TimeSeries::sharedPointer upstream, series->upstreamSeries()) {
+      reportSeriesStats(upstream.get(), depth + 1, stream, seen, records);
+    }
+  }
+}
+
+
+TimeSeries::TimeSeries() : _hasDirtyRanges(false), _isStreaming(false), _units(1), _hasWriteDeadband(false), _cacheHits(0), _cacheMisses(0), _upstreamCalls(0), _pointsComputed(0), _computeMicroseconds(0) {
+  _deadbandAbsolute = 0;
+  _deadbandRelative = 0;
+  _heartbeat = 0;
+  _lastInserted = 0;
   _name = "";  
   _cacheSize = 1000; // default cache size
   _points.reset( new BufferPointRecord() );
@@ -25,7 +66,9 @@ TimeSeries::TimeSeries() : _units(1) {
 }
 
 TimeSeries::~TimeSeries() {
-  // empty Dtor
+  if (_points) {
+    _points->removeObserver(_name, this);
+  }
 }
 
 std::ostream& RTX::operator<< (std::ostream &out, TimeSeries &ts) {
@@ -37,8 +80,11 @@ std::ostream& RTX::operator<< (std::ostream &out, TimeSeries &ts) {
 
 
 void TimeSeries::setName(const std::string& name) {
+  scopedLock_t lock(_configMutex);
+  _points->removeObserver(_name, this);
   _name = name;
-  _points->registerAndGetIdentifier(name);
+  _handle = _points->registerAndGetHandle(name);
+  _points->addObserver(name, this);
   if (_clock && !_clock->isRegular()) {
     // reset the clock to point to the new record ID, but only if we start with an irregular clock.
     _clock.reset( new IrregularClock(_points, name) );
@@ -47,15 +93,42 @@ void TimeSeries::setName(const std::string& name) {
 }
 
 std::string TimeSeries::name() {
+  scopedLock_t lock(_configMutex);
   return _name; 
 }
 
 void TimeSeries::insert(Point thisPoint) {
-  _points->addPoint(name(), thisPoint);
+  if (_hasWriteDeadband && !shouldStore(thisPoint)) {
+    return;
+  }
+  PointRecord::handle_t handle;
+  recordAndHandle(handle)->addPoint(handle, thisPoint);
+  didAddPoints(std::vector<Point>(1, thisPoint));
 }
 
-void TimeSeries::insertPoints(std::vector<Point> points) {
-  _points->addPoints(name(), points);
+void TimeSeries::insertPoints(const std::vector<Point>& points) {
+  if (_hasWriteDeadband) {
+    std::vector<Point> changes;
+    BOOST_FOREACH(const Point& p, points) {
+      if (shouldStore(p)) {
+        changes.push_back(p);
+      }
+    }
+    if (changes.size() < points.size()) {
+      if (!changes.empty()) {
+        PointRecord::handle_t handle;
+        recordAndHandle(handle)->addPoints(handle, changes);
+        didAddPoints(changes);
+      }
+      return;
+    }
+  }
+  if (points.empty()) {
+    return;
+  }
+  PointRecord::handle_t handle;
+  recordAndHandle(handle)->addPoints(handle, points);
+  didAddPoints(points);
 }
 /*
 bool TimeSeries::isPointAvailable(time_t time) {
@@ -66,69 +139,122 @@ Point TimeSeries::point(time_t time) {
   Point p;
   //time = clock()->validTime(time);
   
-  p = _points->point(name(), time);
+  PointRecord::handle_t handle;
+  PointRecord::sharedPointer record = recordAndHandle(handle);
+  p = record->point(handle, time);
+  if (p.isValid && isDirty(time)) {
+    // stale -- as good as not cached
+    return Point();
+  }
+  if (!p.isValid && _hasWriteDeadband) {
+    p = heldPoint(record, handle, time);
+  }
+  if (p.isValid) {
+    countCacheHits(1);
+  }
   
   return p;
 }
 
+namespace {
+  // collects visited points into a vector
+  class PointCollector : public PointVisitor {
+  public:
+    PointCollector(std::vector<Point>& points) : _points(points) {};
+    virtual bool visit(const Point& point) {
+      _points.push_back(point);
+      return true;
+    }
+  private:
+    std::vector<Point>& _points;
+  };
+}
+
 // get a range of points from this TimeSeries' point method
 std::vector< Point > TimeSeries::points(time_t start, time_t end) {
+  RTX_TRACE_SPAN(span, ("points", "series", name(), start, end));
   // container for points in this range
   std::vector< Point > points;
-  
+  PointCollector collector(points);
+  TimeSeries::visitPoints(start, end, collector);
+  return points;
+}
+
+void TimeSeries::visitPoints(time_t start, time_t end, PointVisitor& visitor) {
   // sanity
   if ((start == end) || (start < 0) || (end < 0)) {
-    return points;
+    return;
   }
   
-  std::vector<time_t> timeList;
+  // a regular clock is just arithmetic, so its times are generated as we go. an irregular clock's are gathered up
+  // front: point() may need to write into the record that the clock is reading from.
+  Clock::sharedPointer clock = this->clock();
+  bool regular = (clock && clock->isRegular() && clock->period() > 0);
+  time_t period = (regular) ? clock->period() : 0;
+  time_t regularTime = 0;
+  Scratch::Vector<time_t> timeBuffer;
+  std::vector<time_t>& timeList = *timeBuffer;
+  std::vector<time_t>::size_type timeIndex = 0;
   
-  if (_clock) {
-    timeList = _clock->timeValuesInRange(start, end);
+  if (regular) {
+    regularTime = (clock->isValid(start)) ? start : clock->timeAfter(start);
+  }
+  else if (clock) {
+    clock->timeValuesInRange(start, end, timeList);
   }
   
-  BOOST_FOREACH(time_t time, timeList) {
+  // one record read for whatever is already here; point() is only called for the times it doesn't cover.
+  PointRecord::handle_t handle;
+  std::vector<Point> cached = recordAndHandle(handle)->pointsInRange(handle, start, end);
+  std::vector<Point>::const_iterator cacheIt = cached.begin();
+  size_t hits = 0;
+  
+  time_t previousTime = 0;
+  bool havePrevious = false;
+  while (true) {
+    time_t time;
+    if (regular) {
+      if (regularTime == 0 || regularTime >= end) {
+        break;
+      }
+      time = regularTime;
+      regularTime += period;
+    }
+    else {
+      if (timeIndex >= timeList.size()) {
+        break;
+      }
+      time = timeList[timeIndex++];
+    }
     // check the time
     if (! (time >= start && time <= end) ) {
       // skip this time
-      std::cerr << "time out of bounds. ignoring." << std::endl;
+      RTX_LOG(debug, "TimeSeries", "time out of bounds. ignoring.");
       continue;
     }
-    Point aNewPoint;
-    if ( !points.empty() && points.back().time == time) {
+    if (havePrevious && previousTime == time) {
       //std::cerr << "duplicate time detected" << std::endl;
       continue;
     }
-    aNewPoint = point(time);
-    
+    while (cacheIt != cached.end() && cacheIt->time < time) {
+      ++cacheIt;
+    }
+    bool isCached = (cacheIt != cached.end() && cacheIt->time == time && cacheIt->isValid && !isDirty(time));
+    hits += (isCached) ? 1 : 0;
+    Point aNewPoint = (isCached) ? *cacheIt : point(time);
+  
     if (!aNewPoint.isValid) {
       //std::cerr << "bad point" << std::endl;
     }
     else {
-      points.push_back(aNewPoint);
+      previousTime = time;
+      havePrevious = true;
+      if (!visitor.visit(aNewPoint)) {
+        break;
+      }
     }
   }
-  
-  /*
-  Point aPoint;
-
-  time_t queryTime;
-
- 
-  
-  
-  queryTime = start;
-  while (queryTime <= end) {
-    aPoint = pointAfter(queryTime);
-    if (!aPoint) {
-      break;
-    }
-    points.push_back(aPoint);
-    queryTime = aPoint->time;
-  }
-   */
-    
-  return points;
+  countCacheHits(hits);
 }
 
 std::pair< Point, Point > TimeSeries::adjacentPoints(time_t time) {
@@ -163,7 +289,7 @@ Point TimeSeries::pointAfter(time_t time) {
   time_t timeAfter = clock()->timeAfter(time);
   if (timeAfter > 0) {
     myPoint = point(timeAfter);
-
+  
   }
   
   
@@ -177,9 +303,186 @@ Point TimeSeries::pointAfter(time_t time) {
   return myPoint;
 }
 
+std::vector<TimeSeries::sharedPointer> TimeSeries::upstreamSeries() {
+  return std::vector<TimeSeries::sharedPointer>();
+}
+
+void TimeSeries::addDependent(TimeSeries* dependent) {
+  scopedLock_t lock(_dependencyMutex);
+  _dependents.push_back(dependent);
+}
+
+void TimeSeries::removeDependent(TimeSeries* dependent) {
+  // just the one registration: a series can depend on me more than once.
+  scopedLock_t lock(_dependencyMutex);
+  std::vector<TimeSeries*>::iterator it = std::find(_dependents.begin(), _dependents.end(), dependent);
+  if (it != _dependents.end()) {
+    _dependents.erase(it);
+  }
+}
+
+void TimeSeries::invalidate(time_t start, time_t end) {
+  if (end < start) {
+    return;
+  }
+  invalidateDependents(start, end);
+  {
+    // merge [start, end] into the sorted, disjoint list
+    scopedLock_t lock(_dependencyMutex);
+    std::vector<PointRecord::time_pair_t> merged;
+    merged.reserve(_dirtyRanges.size() + 1);
+    bool placed = false;
+    BOOST_FOREACH(const PointRecord::time_pair_t& range, _dirtyRanges) {
+      if (range.second < start - 1) {
+        merged.push_back(range);
+      }
+      else if (end + 1 < range.first) {
+        if (!placed) {
+          merged.push_back(std::make_pair(start, end));
+          placed = true;
+        }
+        merged.push_back(range);
+      }
+      else {
+        // overlapping or touching: absorb it
+        start = RTX_MIN(start, range.first);
+        end = RTX_MAX(end, range.second);
+      }
+    }
+    if (!placed) {
+      merged.push_back(std::make_pair(start, end));
+    }
+    _dirtyRanges.swap(merged);
+    _hasDirtyRanges = true;
+  }
+}
+
+bool TimeSeries::isDirty(time_t time) {
+  if (!_hasDirtyRanges) {
+    return false;
+  }
+  scopedLock_t lock(_dependencyMutex);
+  // the last range that starts at or before this time
+  std::vector<PointRecord::time_pair_t>::const_iterator it = std::upper_bound(_dirtyRanges.begin(), _dirtyRanges.end(), std::make_pair(time, std::numeric_limits<time_t>::max()));
+  if (it == _dirtyRanges.begin()) {
+    return false;
+  }
+  --it;
+  return (time <= it->second);
+}
+
+PointRecord::time_pair_t TimeSeries::affectedRange(time_t start, time_t end) {
+  return std::make_pair(start, end);
+}
+
+void TimeSeries::sourceUnitsDidChange(TimeSeries* source) {
+  // the base class doesn't convert from anything.
+}
+
+void TimeSeries::subscribe(TimeSeriesObserver* observer) {
+  scopedLock_t lock(_dependencyMutex);
+  _observers.push_back(observer);
+}
+
+void TimeSeries::unsubscribe(TimeSeriesObserver* observer) {
+  scopedLock_t lock(_dependencyMutex);
+  std::vector<TimeSeriesObserver*>::iterator it = std::find(_observers.begin(), _observers.end(), observer);
+  if (it != _observers.end()) {
+    _observers.erase(it);
+  }
+}
+
+void TimeSeries::setStreaming(bool streaming) {
+  _isStreaming = streaming;
+}
+
+bool TimeSeries::isStreaming() {
+  return _isStreaming;
+}
+
+#pragma mark - Change-only storage
+
+void TimeSeries::setWriteDeadband(double absolute, double relative, time_t heartbeat) {
+  scopedLock_t lock(_deadbandMutex);
+  _deadbandAbsolute = RTX_MAX(absolute, 0.);
+  _deadbandRelative = RTX_MAX(relative, 0.);
+  _heartbeat = RTX_MAX(heartbeat, (time_t)0);
+  _lastStored = Point();
+  _hasWriteDeadband = (_deadbandAbsolute > 0 || _deadbandRelative > 0);
+}
+
+bool TimeSeries::hasWriteDeadband() {
+  return _hasWriteDeadband;
+}
+
+// a point goes in if it's moved out of the deadband, or the heartbeat is due -- or it isn't after the last one stored,
+// which leaves a rewrite of history alone.
+bool TimeSeries::shouldStore(const Point& point) {
+  scopedLock_t lock(_deadbandMutex);
+  _lastInserted = RTX_MAX(_lastInserted, point.time);
+  if (_lastStored.isValid && point.time > _lastStored.time && point.isValid == _lastStored.isValid) {
+    double band = RTX_MAX(_deadbandAbsolute, _deadbandRelative * fabs(_lastStored.value));
+    bool isHeartbeatDue = (_heartbeat > 0 && point.time - _lastStored.time >= _heartbeat);
+    if (fabs(point.value - _lastStored.value) <= band && !isHeartbeatDue) {
+      return false;
+    }
+  }
+  if (!_lastStored.isValid || point.time >= _lastStored.time) {
+    _lastStored = point;
+  }
+  return true;
+}
+
+// the stored point before a dropped one, held over it
+Point TimeSeries::heldPoint(PointRecord::sharedPointer record, PointRecord::handle_t handle, time_t time) {
+  Point before = record->pointBefore(handle, time);
+  if (!before.isValid) {
+    return Point();
+  }
+  time_t heldUntil;
+  {
+    scopedLock_t lock(_deadbandMutex);
+    heldUntil = _lastInserted;
+    if (_heartbeat > 0) {
+      heldUntil = RTX_MAX(heldUntil, before.time + _heartbeat);
+    }
+  }
+  if (time > heldUntil) {
+    return Point();
+  }
+  return Point(time, before.value, Point::constant, before.confidence);
+}
+
+void TimeSeries::sourceDidUpdate(time_t start, time_t end) {
+  // by now the range is marked dirty. streaming or not, downstream needs to hear about it.
+  PointRecord::time_pair_t range = affectedRange(start, end);
+  std::vector<Point> fresh;
+  if (_isStreaming) {
+    if (range.first == range.second) {
+      Point p = this->point(range.first);
+      if (p.isValid && p.time == range.first) {
+        fresh.push_back(p);
+      }
+    }
+    else {
+      fresh = this->points(range.first, range.second);
+    }
+  }
+  publish(range.first, range.second, fresh);
+}
+
+void TimeSeries::recordDidAddPoints(PointRecord* record, const std::string& identifier, const std::vector<Point>& points) {
+  // written straight into my record by whatever feeds it
+  if (record != this->record().get() || identifier != name() || points.empty()) {
+    return;
+  }
+  didAddPoints(points);
+}
+
 time_t TimeSeries::period() {
-  if (_clock) {
-    return _clock->period();
+  Clock::sharedPointer clock = this->clock();
+  if (clock) {
+    return clock->period();
   }
   else {
     return 0;
@@ -187,59 +490,310 @@ time_t TimeSeries::period() {
 }
 
 void TimeSeries::setRecord(PointRecord::sharedPointer record) {
+  scopedLock_t lock(_configMutex);
   if(_points) {
-    _points->reset(name());
+    _points->reset(_name);
+    _points->removeObserver(_name, this);
   }
   _points = record;
-  record->registerAndGetIdentifier(name());
+  _handle = record->registerAndGetHandle(_name);
+  _points->addObserver(_name, this);
   
   // if my clock is irregular, then re-set it with the current pointRecord as the master synchronizer.
   if (!_clock || !_clock->isRegular()) {
-    _clock.reset( new IrregularClock(_points, name()) );
+    _clock.reset( new IrregularClock(_points, _name) );
   }
 }
 
 PointRecord::sharedPointer TimeSeries::record() {
+  scopedLock_t lock(_configMutex);
   return _points;
 }
 
 void TimeSeries::resetCache() {
-  _points->reset(name());
-  _points->registerAndGetIdentifier(name());
+  {
+    scopedLock_t lock(_configMutex);
+    _points->reset(_name);
+    _handle = _points->registerAndGetHandle(_name);
+  }
+  IrregularClock* indexedClock = dynamic_cast<IrregularClock*>(clock().get());
+  if (indexedClock) {
+    indexedClock->resetIndex();
+  }
+  
+  // nothing cached means nothing stale here -- but everything computed from me is.
+  std::vector<TimeSeries*> dependents;
+  {
+    scopedLock_t lock(_dependencyMutex);
+    _dirtyRanges.clear();
+    _hasDirtyRanges = false;
+    dependents = _dependents;
+  }
+  BOOST_FOREACH(TimeSeries* dependent, dependents) {
+    dependent->resetCache();
+  }
 }
 
 void TimeSeries::setClock(Clock::sharedPointer clock) {
   //_hasClock = (clock ? true : false);
+  scopedLock_t lock(_configMutex);
   _clock = clock;
 }
 
 Clock::sharedPointer TimeSeries::clock() {
+  scopedLock_t lock(_configMutex);
   return _clock;
 }
 
 void TimeSeries::setUnits(Units newUnits) {
   // changing units means the values here are no good anymore.
   this->resetCache();
+  {
+    scopedLock_t lock(_configMutex);
   _units = newUnits;
+  }
+  
+  // and anything converting from my units has to work out its conversion again.
+  std::vector<TimeSeries*> dependents;
+  {
+    scopedLock_t lock(_dependencyMutex);
+    dependents = _dependents;
+  }
+  BOOST_FOREACH(TimeSeries* dependent, dependents) {
+    dependent->sourceUnitsDidChange(this);
+  }
 }
 
 Units TimeSeries::units() {
+  scopedLock_t lock(_configMutex);
   return _units;
 }
 
+#pragma mark - Instrumentation
+
+TimeSeries::stats_t TimeSeries::stats() {
+  stats_t stats;
+  stats.cacheHits = _cacheHits;
+  stats.cacheMisses = _cacheMisses;
+  stats.upstreamCalls = _upstreamCalls;
+  stats.pointsComputed = _pointsComputed;
+  stats.computeSeconds = (double)_computeMicroseconds / 1.e6;
+  return stats;
+}
+
+void TimeSeries::resetStats() {
+  _cacheHits = 0;
+  _cacheMisses = 0;
+  _upstreamCalls = 0;
+  _pointsComputed = 0;
+  _computeMicroseconds = 0;
+}
+
+size_t TimeSeries::memoryFootprint() {
+  PointRecord::sharedPointer points = record();
+  return points ? points->seriesMemoryFootprint(name()) : 0;
+}
+
+std::ostream& TimeSeries::statsToStream(std::ostream& stream) {
+  std::set<TimeSeries*> seen;
+  std::vector< std::pair<std::string, PointRecord::sharedPointer> > records;
+  reportSeriesStats(this, 0, stream, seen, records);
+  typedef std::pair<std::string, PointRecord::sharedPointer> namedRecord_t;
+  BOOST_FOREACH(const namedRecord_t& named, records) {
+    PointRecord::stats_t stats = named.second->stats();
+    if (stats.cacheHits + stats.cacheMisses + stats.queries == 0) {
+      continue;
+    }
+    stream << "record of \"" << named.first << "\": " << stats.cacheHits << " hits, " << stats.cacheMisses << " misses, "
+           << stats.queries << " queries, " << stats.pointsFetched << " fetched, " << std::fixed << std::setprecision(3)
+           << stats.querySeconds << " s" << std::endl;
+  }
+  return stream;
+}
+
+
 #pragma mark - Protected Methods
 
+TimeSeries::ComputeLock::ComputeLock(TimeSeries& series, time_t start, time_t end) : _series(series), _start(start), _end(end), _held(false), _started(0) {
+  boost::thread::id me = boost::this_thread::get_id();
+  scopedLock_t lock(_series._computeMutex);
+  while (true) {
+    bool mine = false, theirs = false;
+    BOOST_FOREACH(const Computation_t& computation, _series._computing) {
+      if (computation.start <= end && start <= computation.end) {
+        if (computation.owner == me) {
+          mine = true;
+        }
+        else {
+          theirs = true;
+        }
+      }
+    }
+    if (mine) {
+      // already computing this here, further up the stack. waiting on myself would never end.
+      return;
+    }
+    if (!theirs) {
+      break;
+    }
+    _series._computeDone.wait(lock);
+  }
+  _series._computing.push_back(Computation_t(start, end));
+  _held = true;
+  RTX_STATS(_series._cacheMisses.fetch_add(1, boost::memory_order_relaxed));
+  RTX_STATS(_started = steadyMicroseconds());
+}
+
+TimeSeries::ComputeLock::~ComputeLock() {
+  if (!_held) {
+    return;
+  }
+  RTX_STATS(_series._computeMicroseconds.fetch_add(steadyMicroseconds() - _started, boost::memory_order_relaxed));
+  boost::thread::id me = boost::this_thread::get_id();
+  scopedLock_t lock(_series._computeMutex);
+  std::list<Computation_t>::iterator it = _series._computing.begin();
+  while (it != _series._computing.end()) {
+    if (it->owner == me && it->start == _start && it->end == _end) {
+      _series._computing.erase(it);
+      break;
+    }
+    ++it;
+  }
+  _series._computeDone.notify_all();
+}
+
+void TimeSeries::cachePoint(Point aPoint) {
+  PointRecord::handle_t handle;
+  PointRecord::sharedPointer record = recordAndHandle(handle);
+  record->addPoint(handle, aPoint);
+  RTX_STATS(_pointsComputed.fetch_add(1, boost::memory_order_relaxed));
+  IrregularClock* indexedClock = dynamic_cast<IrregularClock*>(clock().get());
+  if (indexedClock) {
+    indexedClock->didAddPoints(record.get(), name(), std::vector<Point>(1, aPoint));
+  }
+  if (_hasDirtyRanges) {
+    clearDirty(std::vector<Point>(1, aPoint));
+  }
+}
+
+void TimeSeries::cachePoints(const std::vector<Point>& points) {
+  PointRecord::handle_t handle;
+  PointRecord::sharedPointer record = recordAndHandle(handle);
+  record->addPoints(handle, points);
+  RTX_STATS(_pointsComputed.fetch_add((unsigned long)points.size(), boost::memory_order_relaxed));
+  IrregularClock* indexedClock = dynamic_cast<IrregularClock*>(clock().get());
+  if (indexedClock) {
+    indexedClock->didAddPoints(record.get(), name(), points);
+  }
+  if (_hasDirtyRanges && !points.empty()) {
+    std::vector<Point> sorted(points);
+    std::sort(sorted.begin(), sorted.end(), &Point::comparePointTime);
+    clearDirty(sorted);
+  }
+}
+
+void TimeSeries::publish(time_t start, time_t end, const std::vector<Point>& points) {
+  std::vector<TimeSeriesObserver*> observers;
+  std::vector<TimeSeries*> dependents;
+  {
+    scopedLock_t lock(_dependencyMutex);
+    observers = _observers;
+    dependents = _dependents;
+  }
+  if (!points.empty()) {
+    BOOST_FOREACH(TimeSeriesObserver* observer, observers) {
+      observer->seriesDidUpdate(this, points);
+    }
+  }
+  BOOST_FOREACH(TimeSeries* dependent, dependents) {
+    dependent->sourceDidUpdate(start, end);
+  }
+}
+
+void TimeSeries::invalidateDependents(time_t start, time_t end) {
+  // copied out, so a dependent can touch my registry while it invalidates
+  std::vector<TimeSeries*> dependents;
+  {
+    scopedLock_t lock(_dependencyMutex);
+    dependents = _dependents;
+  }
+  BOOST_FOREACH(TimeSeries* dependent, dependents) {
+    PointRecord::time_pair_t range = dependent->affectedRange(start, end);
+    dependent->invalidate(range.first, range.second);
+  }
+}
+
 std::ostream& TimeSeries::toStream(std::ostream &stream) {
-  stream << "Time Series: \"" << _name << "\"\n";
-  if (_clock) {
-    stream << "clock: " << *_clock;
+  Clock::sharedPointer clock = this->clock();
+  Units units = this->units();
+  stream << "Time Series: \"" << name() << "\"\n";
+  if (clock) {
+    stream << "clock: " << *clock;
   }
-  stream << "Units: " << _units << std::endl;
+  stream << "Units: " << units << std::endl;
+  stats_t stats = this->stats();
+  stream << "Stats: " << stats.cacheHits << " hits, " << stats.cacheMisses << " misses, " << stats.upstreamCalls
+         << " upstream calls, " << stats.pointsComputed << " computed, " << stats.computeSeconds << " s" << std::endl;
   stream << "Cached Points:" << std::endl;
-  stream << *_points;
+  stream << *record();
   return stream;
 }
 
+void TimeSeries::didAddPoints(const std::vector<Point>& points) {
+  // new data here: it's clean, everything computed from it is stale, and anyone listening gets told.
+  std::vector<Point> sorted(points);
+  std::sort(sorted.begin(), sorted.end(), &Point::comparePointTime);
+  IrregularClock* indexedClock = dynamic_cast<IrregularClock*>(clock().get());
+  if (indexedClock) {
+    indexedClock->didAddPoints(record().get(), name(), sorted);
+  }
+  if (_hasDirtyRanges) {
+    clearDirty(sorted);
+  }
+  invalidateDependents(sorted.front().time, sorted.back().time);
+  publish(sorted.front().time, sorted.back().time, sorted);
+}
+
+void TimeSeries::clearDirty(const std::vector<Point>& points) {
+  // the freshly-written times (sorted) are clean now. what's left of each dirty range is the pieces between
+  // them -- but a piece that doesn't hold one of my clock times has nothing left to recompute, so it goes too.
+  Clock::sharedPointer clock = this->clock();
+  scopedLock_t lock(_dependencyMutex);
+  std::vector<PointRecord::time_pair_t> remaining;
+  std::vector<Point>::const_iterator pIt = points.begin();
+  BOOST_FOREACH(const PointRecord::time_pair_t& range, _dirtyRanges) {
+    while (pIt != points.end() && pIt->time < range.first) {
+      ++pIt;
+    }
+    time_t pieceStart = range.first;
+    while (pieceStart <= range.second) {
+      time_t pieceEnd = range.second;
+      if (pIt != points.end() && pIt->time <= range.second) {
+        pieceEnd = pIt->time - 1;
+      }
+      if (pieceStart <= pieceEnd) {
+        time_t next = (clock->isValid(pieceStart)) ? pieceStart : clock->timeAfter(pieceStart);
+        if (next != 0 && next <= pieceEnd) {
+          remaining.push_back(std::make_pair(pieceStart, pieceEnd));
+        }
+      }
+      if (pieceEnd == range.second) {
+        break;
+      }
+      pieceStart = pIt->time + 1;
+      ++pIt;
+    }
+  }
+  _dirtyRanges.swap(remaining);
+  _hasDirtyRanges = !_dirtyRanges.empty();
+}
+
+PointRecord::sharedPointer TimeSeries::recordAndHandle(PointRecord::handle_t& handle) {
+  scopedLock_t lock(_configMutex);
+  handle = _handle;
+  return _points;
+}
+
 bool TimeSeries::isCompatibleWith(TimeSeries::sharedPointer otherSeries) {
   
   // basic check for compatible regular time series.
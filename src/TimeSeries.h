@@ -11,6 +11,7 @@
 
 #include <vector>
 #include <map>
+#include <list>
 #include <iostream>
 
 #include "rtxMacros.h"
@@ -19,14 +20,50 @@
 #include "Clock.h"
 #include "Units.h"
 
-namespace RTX {
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/atomic.hpp>
 
+namespace RTX {
+  
+  class TimeSeries;
+  
+//!   Callback interface for hearing about new points in a TimeSeries as they're produced.
+/*!
+      Register with TimeSeries::subscribe. Raw series report what is inserted into them; derived series report what
+      they compute in streaming mode. The same point may be reported more than once (a series with several paths to
+      one source hears about it once per path).
+*/
+  class TimeSeriesObserver {
+  public:
+    virtual ~TimeSeriesObserver() {};
+    virtual void seriesDidUpdate(TimeSeries* series, const std::vector<Point>& points) = 0;
+  };
   
   /*!
    \class TimeSeries
    \brief An abstraction of Points ordered in time.
-   
+  
    The base TimeSeries class doesn't do much. Derive for added flavor.
+  
+   A series may be shared between threads. point(), points() and visitPoints() can be called from any number of
+   threads at once, on any series in a graph, and so can the TimeSeries setters (setName, setRecord, setClock,
+   setUnits) -- a read that overlaps a setter sees either the old configuration or the new one, never a mix.
+   Derived series compute a missing point at most once: the first thread to ask for a time computes and caches it
+   while holding a ComputeLock (see pointComputedOnce), and any other thread asking for it in the meantime waits for
+   that and then reads the cached point. Set up anything a derived class adds (its sources, windows, curves) before sharing the series.
+   */
+  
+  /*!
+   \class TimeSeries::ComputeLock
+   \brief Claims a span of a series' times while a thread computes them.
+  
+   Hold one around the work of producing points that weren't in the cache, up to and including caching them. If
+   another thread holds an overlapping claim, the constructor waits for it to finish before taking the claim, so
+   once it returns, look in the cache again -- the points may be there now. A thread that already holds an
+   overlapping claim on the same series (a series evaluating itself) doesn't wait.
    */
   
   /*!
@@ -42,36 +79,150 @@ namespace RTX {
    \param start The beginning of the requested time range.
    \param end The end of the requested time range.
    \return The requested Points (as a vector)
-   
+  
    The base class provides some brute-force logic to retrieve points, by calling Point() repeatedly. For more efficient access, you may wish to override this method.
-   
+  
    \sa Point
    */
+  /*!
+   \fn virtual void TimeSeries::visitPoints(time_t start, time_t end, PointVisitor& visitor)
+   \brief Stream the Points within a time range through a visitor, without building a vector.
+   \param start The beginning of the requested time range.
+   \param end The end of the requested time range.
+   \param visitor Called once per valid Point, in time order; return false from PointVisitor::visit to stop early.
+  
+   Same points, same order as points(start, end). Derived classes that override points() to warm up their sources
+   should override this too.
+  
+   \sa PointVisitor
+   */
+  /*!
+   \fn void TimeSeries::invalidate(time_t start, time_t end)
+   \brief Mark a span of this series as stale, along with whatever is computed from it.
+   \param start The beginning of the stale span.
+   \param end The end of the stale span.
+  
+   Nothing is recomputed here. Cached points inside a dirty span are simply ignored until they are next requested,
+   at which point derived series rebuild just those times. Each dependent widens the span by its own footprint (see
+   affectedRange) before passing it further downstream. insert() and insertPoints() call this on the dependents of
+   the series being written, so late or corrected data reaches everything downstream without a resetCache().
+   */
+  /*!
+   \fn virtual PointRecord::time_pair_t TimeSeries::affectedRange(time_t start, time_t end)
+   \brief Which of my times depend on upstream data in a span.
+   \param start The beginning of the span that changed upstream.
+   \param end The end of the span that changed upstream.
+   \return The span of my times that need recomputing.
+  
+   The base class is point-for-point, so it's the same span. Stages that look at neighboring source points
+   (windows, interpolation, differences) widen it.
+   */
+  /*!
+   \fn void TimeSeries::setStreaming(bool streaming)
+   \brief Compute new points as soon as the data they depend on arrives, rather than when they're asked for.
+   \param streaming true to push, false (the default) to pull.
+  
+   Whenever a series gets new points -- by insert(), or by its PointRecord's notifyObservers() -- it tells the
+   series computed from it, through sourceDidUpdate(). A streaming series then recomputes just its affectedRange(),
+   caches the result, and reports it to its subscribers and on down the graph. A series that isn't streaming only
+   passes the range along (it has already been marked dirty), so streaming stages further down still hear about it.
+   The work per pushed sample is bounded by each stage's footprint, not by the length of the series.
+   */
+  /*!
+   \fn void TimeSeries::setWriteDeadband(double absolute, double relative, time_t heartbeat)
+   \brief Store only the points that change, for a series that holds still for long stretches.
+   \param absolute How far a value may move from the last stored one and still not be stored.
+   \param relative The same, as a fraction of the last stored value; whichever of the two is larger applies.
+   \param heartbeat A point is stored at least this often (in seconds) whatever its value. 0 for no heartbeat.
+  
+   An inserted point within the deadband of the last stored one is dropped, and point() holds the last stored value
+   over it instead, with Point::constant quality -- up to the latest time inserted, or (once the series is read back
+   from a record) a heartbeat on from the stored point. points() returns just what was stored. A deadband of 0,
+   the default, stores everything.
+   */
+  /*!
+   \fn TimeSeries::stats_t TimeSeries::stats()
+   \brief What reading this series has cost, since it was made or since resetStats().
+  
+   A hit is a point served from the series' own record. A miss is a computation: a span of times that wasn't
+   cached, claimed and computed (a raw series never computes, so its misses are counted by its record instead --
+   see PointRecord::stats). Upstream calls are the requests the series made of its sources while computing, and
+   compute time is the wall time spent in computations, sources included. A stage whose upstream calls keep pace
+   with its misses, or whose compute time dwarfs its sources', is the one to look at. All zero in an
+   RTX_NO_INSTRUMENTATION build.
+   */
+  /*!
+   \fn std::ostream& TimeSeries::statsToStream(std::ostream& stream)
+   \brief A report of stats() for this series and everything it's computed from.
+   \param stream Where the report goes.
+   \return The stream.
+  
+   One line per series, this one first and its sources depth-first after it, each listed once however many paths
+   lead to it. Then one line per record under the graph that has been to its backing store.
+   */
   
   
   
   
-  class TimeSeries {    
+  class TimeSeries : public PointRecordObserver {
   public:
     RTX_SHARED_POINTER(TimeSeries);
-    
+  
     // ctor & dtor
     TimeSeries();
     ~TimeSeries();
-    
+  
     // methods
     virtual void insert(Point aPoint);
-    virtual void insertPoints(std::vector<Point>);  /// option to add lots of (un)ordered points all at once.
-    
+    virtual void insertPoints(const std::vector<Point>&);  /// option to add lots of (un)ordered points all at once.
+  
     // getters
     virtual Point point(time_t time);
     virtual Point pointBefore(time_t time);
     virtual Point pointAfter(time_t time);
     virtual std::vector< Point > points(time_t start, time_t end); // points in range
+    virtual void visitPoints(time_t start, time_t end, PointVisitor& visitor); // points in range, streamed
     virtual std::pair< Point, Point > adjacentPoints(time_t time); // adjacent points
     virtual time_t period();                              //! 1/frequency (# seconds between data points)
     virtual std::string name();
-    
+    virtual std::vector<TimeSeries::sharedPointer> upstreamSeries(); //! the series this one is computed from (none, for the base class)
+  
+    // dependency tracking and invalidation
+    void addDependent(TimeSeries* dependent);     //! called by a series that computes from this one
+    void removeDependent(TimeSeries* dependent);
+    void invalidate(time_t start, time_t end);
+    bool isDirty(time_t time);
+    virtual PointRecord::time_pair_t affectedRange(time_t start, time_t end);
+    virtual void sourceUnitsDidChange(TimeSeries* source); //! an upstream series changed units (nothing to do here)
+  
+    // push-based streaming
+    void subscribe(TimeSeriesObserver* observer);
+    void unsubscribe(TimeSeriesObserver* observer);
+    void setStreaming(bool streaming);
+    bool isStreaming();
+  
+    // change-only storage
+    void setWriteDeadband(double absolute, double relative = 0., time_t heartbeat = 0);
+    bool hasWriteDeadband();
+    virtual void sourceDidUpdate(time_t start, time_t end); //! an upstream series has new points over [start, end]
+    virtual void recordDidAddPoints(PointRecord* record, const std::string& identifier, const std::vector<Point>& points);
+  
+    // instrumentation
+    class stats_t {
+    public:
+      stats_t() : cacheHits(0), cacheMisses(0), upstreamCalls(0), pointsComputed(0), computeSeconds(0) {};
+      // simple tuple class, so no getters/setters
+      unsigned long cacheHits;      // points served from my record
+      unsigned long cacheMisses;    // spans claimed and computed
+      unsigned long upstreamCalls;  // requests made of my sources
+      unsigned long pointsComputed; // points computed and cached
+      double computeSeconds;        // wall time spent computing, sources included
+    };
+    stats_t stats();
+    void resetStats();
+    std::ostream& statsToStream(std::ostream& stream);
+    size_t memoryFootprint(); //! bytes my record holds for my points (see PointRecord::seriesMemoryFootprint)
+  
     // setters
     virtual void setName(const std::string& name);
     void setRecord(PointRecord::sharedPointer record);
@@ -81,29 +232,94 @@ namespace RTX {
     Clock::sharedPointer clock();
     virtual void setUnits(Units newUnits);
     Units units();
-    
+  
     // tests
     //virtual bool isPointAvailable(time_t time);
-    
+  
     virtual std::ostream& toStream(std::ostream &stream);
-
+  
   protected:
+    class ComputeLock : boost::noncopyable {
+    public:
+      ComputeLock(TimeSeries& series, time_t start, time_t end);
+      ~ComputeLock();
+    private:
+      TimeSeries& _series;
+      time_t _start, _end;
+      bool _held;
+      unsigned long _started; // microseconds, for stats()
+    };
+    friend class ComputeLock;
+
+    //! the cached point at time, or else compute(time) -- which caches what it makes. one thread computes a missing
+    //! point; anyone else asking for it waits, then finds it cached.
+    template<class Compute> Point pointComputedOnce(time_t time, Compute compute) {
+      Point p = TimeSeries::point(time);
+      if (p.isValid) {
+        return p;
+      }
+      ComputeLock computing(*this, time, time);
+      if ((p = TimeSeries::point(time)).isValid) {
+        return p;
+      }
+      return compute(time);
+    };
+  
     // methods which may be needed by subclasses but shouldn't be public:
     virtual bool isCompatibleWith(TimeSeries::sharedPointer withTimeSeries);
-    
+    void cachePoint(Point aPoint);                    //! store a computed point, without notifying dependents
+    void cachePoints(const std::vector<Point>& points);
+    void invalidateDependents(time_t start, time_t end);
+    void publish(time_t start, time_t end, const std::vector<Point>& points); //! tell observers and dependents
+    void countCacheHits(size_t hits) { RTX_STATS(_cacheHits.fetch_add((unsigned long)hits, boost::memory_order_relaxed)); }
+    void countUpstreamCalls(size_t calls = 1) { RTX_STATS(_upstreamCalls.fetch_add((unsigned long)calls, boost::memory_order_relaxed)); }
+  
   private:
+    void didAddPoints(const std::vector<Point>& points);
+    void clearDirty(const std::vector<Point>& points);
+    PointRecord::sharedPointer recordAndHandle(PointRecord::handle_t& handle); //! a matching pair, taken under the lock
+    bool shouldStore(const Point& point);               //! under the write deadband
+    Point heldPoint(PointRecord::sharedPointer record, PointRecord::handle_t handle, time_t time);
+    std::vector<PointRecord::time_pair_t> _dirtyRanges; // sorted and disjoint
+    boost::atomic<bool> _hasDirtyRanges;                // lets clean series skip the lock
+    std::vector<TimeSeries*> _dependents;
+    std::vector<TimeSeriesObserver*> _observers;
+    boost::atomic<bool> _isStreaming;
+    boost::mutex _dependencyMutex;                      // guards the dirty ranges, dependents and observers
     PointRecord::sharedPointer _points;
+    PointRecord::handle_t _handle;
     std::string _name;
     int _cacheSize;
     Clock::sharedPointer _clock;
     //TimeSeries::sharedPointer _source;
     // TODO -- units
     Units _units;
+    boost::mutex _configMutex;                          // guards the record, handle, name, clock and units
+  
+    boost::atomic<bool> _hasWriteDeadband;              // lets a series without one skip the lock
+    double _deadbandAbsolute, _deadbandRelative;
+    time_t _heartbeat;
+    Point _lastStored;                                  // the last point stored under the deadband,
+    time_t _lastInserted;                               // and the latest time inserted, stored or not
+    boost::mutex _deadbandMutex;                        // guards the deadband and the two above
+  
+    boost::atomic<unsigned long> _cacheHits, _cacheMisses, _upstreamCalls, _pointsComputed, _computeMicroseconds;
+  
+    // spans being computed right now, and by whom
+    class Computation_t {
+    public:
+      Computation_t(time_t s, time_t e) : start(s), end(e), owner(boost::this_thread::get_id()) {};
+      time_t start, end;
+      boost::thread::id owner;
+    };
+    std::list<Computation_t> _computing;
+    boost::mutex _computeMutex;
+    boost::condition_variable _computeDone;
   
   };
-
+  
   std::ostream& operator<< (std::ostream &out, TimeSeries &ts);
-
+  
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+//
+//  Topology.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include "Topology.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+
+Topology::Topology(const std::vector<Node::sharedPointer>& nodes, const std::vector<Link::sharedPointer>& links) : _nodes(nodes), _links(links) {
+  int nNodes = (int)_nodes.size();
+  int nLinks = (int)_links.size();
+
+  for (int i = 0; i < nNodes; ++i) {
+    _nodeIndexes[_nodes[i].get()] = i;
+  }
+  for (int i = 0; i < nLinks; ++i) {
+    _linkIndexes[_links[i].get()] = i;
+  }
+
+  // each link's end nodes, and a count of each node's incidences
+  _fromNode.resize(nLinks, -1);
+  _toNode.resize(nLinks, -1);
+  _firstIncidence.assign(nNodes + 1, 0);
+  for (int i = 0; i < nLinks; ++i) {
+    int from = nodeIndex(_links[i]->from());
+    int to = nodeIndex(_links[i]->to());
+    if (from < 0 || to < 0) {
+      RTX_LOG(warning, "Topology", "link " << _links[i]->name() << " has an end node outside the network");
+      continue;
+    }
+    _fromNode[i] = from;
+    _toNode[i] = to;
+    ++_firstIncidence[from + 1];
+    ++_firstIncidence[to + 1];
+  }
+  for (int i = 0; i < nNodes; ++i) {
+    _firstIncidence[i + 1] += _firstIncidence[i];
+  }
+
+  // then fill them in, in link order
+  int nIncidences = _firstIncidence[nNodes];
+  _incidentLink.resize(nIncidences);
+  _neighbor.resize(nIncidences);
+  _isOutgoing.resize(nIncidences);
+  vector<int> next(_firstIncidence.begin(), _firstIncidence.end() - 1);
+  for (int i = 0; i < nLinks; ++i) {
+    int from = _fromNode[i], to = _toNode[i];
+    if (from < 0) {
+      continue;
+    }
+    int k = next[from]++;
+    _incidentLink[k] = i;
+    _neighbor[k] = to;
+    _isOutgoing[k] = true;
+    k = next[to]++;
+    _incidentLink[k] = i;
+    _neighbor[k] = from;
+    _isOutgoing[k] = false;
+  }
+}
+
+#pragma mark - Elements
+
+int Topology::nodeCount() const {
+  return (int)_nodes.size();
+}
+
+int Topology::linkCount() const {
+  return (int)_links.size();
+}
+
+Node::sharedPointer Topology::node(int node) const {
+  return _nodes.at(node);
+}
+
+Link::sharedPointer Topology::link(int link) const {
+  return _links.at(link);
+}
+
+int Topology::nodeIndex(const Node::sharedPointer& node) const {
+  std::tr1::unordered_map<Node*, int>::const_iterator found = _nodeIndexes.find(node.get());
+  return (found == _nodeIndexes.end()) ? -1 : found->second;
+}
+
+int Topology::linkIndex(const Link::sharedPointer& link) const {
+  std::tr1::unordered_map<Link*, int>::const_iterator found = _linkIndexes.find(link.get());
+  return (found == _linkIndexes.end()) ? -1 : found->second;
+}
+
+int Topology::fromNode(int link) const {
+  return _fromNode[link];
+}
+
+int Topology::toNode(int link) const {
+  return _toNode[link];
+}
+
+#pragma mark - Incidences
+
+int Topology::firstIncidence(int node) const {
+  return _firstIncidence[node];
+}
+
+int Topology::incidentLink(int incidence) const {
+  return _incidentLink[incidence];
+}
+
+int Topology::neighbor(int incidence) const {
+  return _neighbor[incidence];
+}
+
+bool Topology::isOutgoing(int incidence) const {
+  return _isOutgoing[incidence] != 0;
+}
+
+#pragma mark - Connectivity
+
+int Topology::components(const std::vector<bool>& isCut, std::vector<int>& component) const {
+  int nNodes = nodeCount();
+  component.assign(nNodes, -1);
+  vector<int> queue;
+  queue.reserve(nNodes);
+  int count = 0;
+
+  for (int root = 0; root < nNodes; ++root) {
+    if (component[root] >= 0) {
+      continue;
+    }
+    // breadth first from here; the queue is just the component's nodes so far, read in order
+    queue.clear();
+    queue.push_back(root);
+    component[root] = count;
+    for (size_t head = 0; head < queue.size(); ++head) {
+      int n = queue[head];
+      for (int k = _firstIncidence[n]; k < _firstIncidence[n + 1]; ++k) {
+        int other = _neighbor[k];
+        if (component[other] < 0 && (isCut.empty() || !isCut[_incidentLink[k]])) {
+          component[other] = count;
+          queue.push_back(other);
+        }
+      }
+    }
+    ++count;
+  }
+
+  return count;
+}
+
+std::vector<int> Topology::reachableNodes(int node, const std::vector<bool>& isCut) const {
+  vector<int> reached;
+  vector<char> isReached(nodeCount(), false);
+  reached.push_back(node);
+  isReached[node] = true;
+  for (size_t head = 0; head < reached.size(); ++head) {
+    int n = reached[head];
+    for (int k = _firstIncidence[n]; k < _firstIncidence[n + 1]; ++k) {
+      int other = _neighbor[k];
+      if (!isReached[other] && (isCut.empty() || !isCut[_incidentLink[k]])) {
+        isReached[other] = true;
+        reached.push_back(other);
+      }
+    }
+  }
+  return reached;
+}
@@ -0,0 +1,91 @@
+//
+//  Topology.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_Topology_h
+#define epanet_rtx_Topology_h
+
+#include <vector>
+#include <tr1/unordered_map>
+#include "rtxMacros.h"
+#include "Node.h"
+#include "Link.h"
+
+namespace RTX {
+
+  /*!
+   \class Topology
+   \brief A network's connectivity, stored compactly for traversals.
+
+   Nodes and links are numbered from 0, in the order they're given. Each node's incident links sit together in one
+   array (compressed sparse row form), along with the node at each link's other end and the link's direction, so a
+   traversal is a scan over integers rather than a walk through elements and their link lists. A topology is built
+   once from a model's elements (see Model::topology), and doesn't change afterwards.
+
+   \sa Model, Zone
+
+
+   \fn int Topology::firstIncidence(int node)
+   \brief Where a node's incident links start.
+
+   The node's incidences are firstIncidence(node) up to, but not including, firstIncidence(node + 1). Each is
+   read with incidentLink, neighbor and isOutgoing.
+
+
+   \fn int Topology::components(const std::vector<bool>& isCut, std::vector<int>& component)
+   \brief Number each node's connected component.
+
+   Components are numbered from 0, in the order of their first node. Links marked in isCut (by link index) are not
+   crossed, so they separate components -- flow-measured links, say, or closed valves. An empty isCut crosses every link.
+
+   \param isCut Whether each link is cut, by link index.
+   \param component Filled with each node's component, by node index.
+   \return The number of components.
+
+
+   \fn std::vector<int> Topology::reachableNodes(int node, const std::vector<bool>& isCut)
+   \brief The nodes reachable from a node without crossing a cut link, starting with the node itself, breadth first.
+   */
+
+  class Topology {
+  public:
+    RTX_SHARED_POINTER(Topology);
+    Topology(const std::vector<Node::sharedPointer>& nodes, const std::vector<Link::sharedPointer>& links);
+
+    int nodeCount() const;
+    int linkCount() const;
+    Node::sharedPointer node(int node) const;
+    Link::sharedPointer link(int link) const;
+    int nodeIndex(const Node::sharedPointer& node) const; //! -1 if it isn't in the network
+    int linkIndex(const Link::sharedPointer& link) const; //! -1 if it isn't in the network
+    int fromNode(int link) const;
+    int toNode(int link) const;
+
+    // incidences -- see firstIncidence
+    int firstIncidence(int node) const;
+    int incidentLink(int incidence) const;
+    int neighbor(int incidence) const;    //! the node at the link's other end
+    bool isOutgoing(int incidence) const; //! whether the link starts at this node
+
+    // connectivity
+    int components(const std::vector<bool>& isCut, std::vector<int>& component) const;
+    std::vector<int> reachableNodes(int node, const std::vector<bool>& isCut) const;
+
+  private:
+    std::vector<Node::sharedPointer> _nodes;
+    std::vector<Link::sharedPointer> _links;
+    std::tr1::unordered_map<Node*, int> _nodeIndexes;
+    std::tr1::unordered_map<Link*, int> _linkIndexes;
+    std::vector<int> _fromNode, _toNode;  // by link
+    std::vector<int> _firstIncidence;     // by node, with one past the last
+    std::vector<int> _incidentLink, _neighbor;
+    std::vector<char> _isOutgoing;
+  };
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+//
+//  Tracer.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <fstream>
+#include <iomanip>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "Tracer.h"
+#include "SteadyClock.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::unique_lock<boost::mutex> scopedLock_t;
+
+//! one thread's spans, in the order they were opened. only its own thread adds to them; the lock is for export and clear.
+class Tracer::ThreadTrace {
+public:
+  class event_t {
+  public:
+    // simple tuple class, so no getters/setters
+    std::string name;
+    const char* category;
+    std::string series;
+    time_t startTime, endTime;
+    double begin, duration; // microseconds. duration is negative while the span is open
+    int depth;
+  };
+  ThreadTrace(int id) : thread(id), depth(0), generation(0) {};
+  boost::mutex mutex;
+  int thread;
+  int depth;                // spans open on this thread
+  unsigned long generation; // bumped by clear, so a span opened before it doesn't close an event after it
+  std::vector<event_t> events;
+};
+
+boost::atomic<bool> Tracer::_isTracing(false);
+
+namespace {
+  void jsonString(std::ostream& stream, const std::string& text) {
+    stream << '"';
+    BOOST_FOREACH(char c, text) {
+      switch (c) {
+        case '"':
+          stream << "\\\"";
+          break;
+        case '\\':
+          stream << "\\\\";
+          break;
+        case '\n':
+          stream << "\\n";
+          break;
+        case '\t':
+          stream << "\\t";
+          break;
+        default:
+          if ((unsigned char)c < 0x20) {
+            stream << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec << setfill(' ');
+          }
+          else {
+            stream << c;
+          }
+          break;
+      }
+    }
+    stream << '"';
+  }
+}
+
+
+#pragma mark - Recording
+
+void Tracer::start() {
+  _isTracing = true;
+}
+
+void Tracer::stop() {
+  _isTracing = false;
+}
+
+void Tracer::clear() {
+  scopedLock_t lock(registryMutex());
+  BOOST_FOREACH(const boost::shared_ptr<ThreadTrace>& trace, registry()) {
+    scopedLock_t traceLock(trace->mutex);
+    trace->events.clear();
+    trace->generation++;
+  }
+}
+
+size_t Tracer::spanCount() {
+  size_t count = 0;
+  scopedLock_t lock(registryMutex());
+  BOOST_FOREACH(const boost::shared_ptr<ThreadTrace>& trace, registry()) {
+    scopedLock_t traceLock(trace->mutex);
+    count += trace->events.size();
+  }
+  return count;
+}
+
+void Tracer::Span::open(const std::string& name, const char* category, const std::string& series, time_t startTime, time_t endTime) {
+  ThreadTrace* trace = threadTrace();
+  ThreadTrace::event_t event;
+  event.name = name;
+  event.category = category;
+  event.series = series;
+  event.startTime = startTime;
+  event.endTime = endTime;
+  event.duration = -1;
+  scopedLock_t lock(trace->mutex);
+  event.depth = trace->depth++;
+  event.begin = (double)steadyMicroseconds();
+  _thread = trace;
+  _index = trace->events.size();
+  _generation = trace->generation;
+  trace->events.push_back(event);
+}
+
+void Tracer::Span::close() {
+  double now = (double)steadyMicroseconds();
+  scopedLock_t lock(_thread->mutex);
+  _thread->depth--;
+  if (_thread->generation == _generation && _index < _thread->events.size()) {
+    ThreadTrace::event_t& event = _thread->events[_index];
+    event.duration = now - event.begin;
+  }
+  _thread = NULL;
+}
+
+
+#pragma mark - Threads
+
+Tracer::registry_t& Tracer::registry() {
+  static registry_t traces;
+  return traces;
+}
+
+boost::mutex& Tracer::registryMutex() {
+  static boost::mutex mutex;
+  return mutex;
+}
+
+Tracer::ThreadTrace* Tracer::threadTrace() {
+  static boost::thread_specific_ptr<ThreadTrace> current(&keepTrace);
+  if (!current.get()) {
+    scopedLock_t lock(registryMutex());
+    boost::shared_ptr<ThreadTrace> trace(new ThreadTrace((int)registry().size() + 1));
+    registry().push_back(trace);
+    current.reset(trace.get());
+  }
+  return current.get();
+}
+
+void Tracer::keepTrace(ThreadTrace* trace) {
+  // the registry has it
+}
+
+
+#pragma mark - Export
+
+std::ostream& Tracer::toStream(std::ostream& stream) {
+  double now = (double)steadyMicroseconds();
+  bool isFirst = true;
+  ios_base::fmtflags flags = stream.flags();
+  streamsize precision = stream.precision(1);
+  stream << "{\"traceEvents\":[" << endl << fixed;
+  scopedLock_t lock(registryMutex());
+  BOOST_FOREACH(const boost::shared_ptr<ThreadTrace>& trace, registry()) {
+    scopedLock_t traceLock(trace->mutex);
+    BOOST_FOREACH(const ThreadTrace::event_t& event, trace->events) {
+      // a span still open runs up to now
+      double duration = (event.duration < 0) ? (now - event.begin) : event.duration;
+      stream << (isFirst ? "" : ",\n") << "{\"name\":";
+      jsonString(stream, event.name);
+      stream << ",\"cat\":";
+      jsonString(stream, event.category);
+      stream << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace->thread << ",\"ts\":" << event.begin << ",\"dur\":" << duration;
+      stream << ",\"args\":{\"depth\":" << event.depth;
+      if (!event.series.empty()) {
+        stream << ",\"series\":";
+        jsonString(stream, event.series);
+      }
+      if (event.startTime != 0 || event.endTime != 0) {
+        stream << ",\"start\":" << event.startTime << ",\"end\":" << event.endTime;
+      }
+      stream << "}}";
+      isFirst = false;
+    }
+  }
+  stream << endl << "],\"displayTimeUnit\":\"ms\"}" << endl;
+  stream.flags(flags);
+  stream.precision(precision);
+  return stream;
+}
+
+void Tracer::writeFile(const std::string& path) throw(RtxException) {
+  ofstream file(path.c_str());
+  if (!file) {
+    throw RtxIoException();
+  }
+  toStream(file);
+  if (!file) {
+    throw RtxIoException();
+  }
+}
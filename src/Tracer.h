@@ -0,0 +1,90 @@
+//
+//  Tracer.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_Tracer_h
+#define epanet_rtx_Tracer_h
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <time.h>
+
+#include "rtxMacros.h"
+#include "rtxExceptions.h"
+
+#include <boost/atomic.hpp>
+#include <boost/utility.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace RTX {
+
+  /*!
+   \class Tracer
+   \brief Records nested, timed spans from any thread, and writes them out as Chrome trace-event JSON.
+
+   Spans cover a model run's steps and what goes on in them -- the boundary conditions, each zone's demand allocation,
+   the engine's hydraulic solution, saving the states -- along with each range a TimeSeries is asked for (nested as
+   the pull runs upstream, one span per series) and each database query. A span carries the series, zone or query it
+   was for, the time range asked for, and how deep it sat on its thread. Load the file into chrome://tracing or
+   Perfetto to see which pull chain or query held a late step up.
+
+   Tracing is off until start(). While it's off a span costs one relaxed load of a flag, and built with
+   -DRTX_NO_INSTRUMENTATION, nothing at all.
+   */
+
+  /*!
+   \fn void Tracer::writeFile(const std::string& path)
+   \brief Write the spans recorded so far to a file, as toStream does.
+   \param path Where to write them (conventionally, a .json file).
+   \throw RtxIoException if the file can't be written.
+   */
+
+  class Tracer {
+    class ThreadTrace;
+  public:
+    static void start();
+    static void stop();  //! spans still open are kept, and finish as they would have
+    static bool isTracing() { return _isTracing.load(boost::memory_order_relaxed); };
+    static void clear(); //! forgets the spans recorded so far
+    static size_t spanCount();
+    static std::ostream& toStream(std::ostream& stream); //! a trace-event JSON object, spans as complete ("X") events
+    static void writeFile(const std::string& path) throw(RtxException);
+
+    //! times the rest of the scope it's declared in, once it's opened. RTX_TRACE_SPAN opens one only while tracing.
+    class Span : boost::noncopyable {
+    public:
+      Span() : _thread(NULL), _index(0), _generation(0) {};
+      ~Span() { if (_thread) close(); };
+      void open(const std::string& name, const char* category, const std::string& series = "", time_t startTime = 0, time_t endTime = 0);
+    private:
+      void close();
+      ThreadTrace* _thread;
+      size_t _index;
+      unsigned long _generation;
+    };
+
+  private:
+    static boost::atomic<bool> _isTracing;
+    // every thread's trace. a trace outlives its thread, so the thread-local pointer doesn't own it (keepTrace).
+    typedef std::vector<boost::shared_ptr<ThreadTrace> > registry_t;
+    static registry_t& registry();
+    static boost::mutex& registryMutex();
+    static ThreadTrace* threadTrace(); //! the calling thread's, registered on first use
+    static void keepTrace(ThreadTrace* trace);
+  };
+
+}
+
+// a span named span, opened with this parenthesized list of Span::open arguments if tracing is on
+#ifndef RTX_NO_INSTRUMENTATION
+#define RTX_TRACE_SPAN(span, arguments) RTX::Tracer::Span span; if (RTX::Tracer::isTracing()) { span.open arguments; }
+#else
+#define RTX_TRACE_SPAN(span, arguments)
+#endif
+
+#endif
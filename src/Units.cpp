@@ -9,6 +9,7 @@
 #include <iostream>
 #include <map>
 #include "Units.h"
+#include "Log.h"
 
 using namespace RTX;
 using namespace std;
@@ -143,7 +144,7 @@ double Units::convertValue(double value, const Units& fromUnits, const Units& to
     return (value * fromUnits._conversion / toUnits._conversion);
   }
   else {
-    cerr << "Units are not dimensionally consistent" << endl;
+    RTX_LOG(warning, "Units", "Units are not dimensionally consistent");
     return 0.;
   }
 }
@@ -180,9 +181,40 @@ Units Units::unitOfType(const string& unitString) {
     return unitMap[unitString];
   }
   else {
-    cerr << "Units not recognized: " << unitString << endl;
+    RTX_LOG(warning, "Units", "Units not recognized: " << unitString);
     return RTX_DIMENSIONLESS;
   }
 }
 
 
+
+#pragma mark - UnitConverter
+
+UnitConverter::UnitConverter() {
+  _scale = 1.;
+  _isValid = true;
+}
+
+UnitConverter::UnitConverter(const Units& fromUnits, const Units& toUnits) {
+  _isValid = fromUnits.isSameDimensionAs(toUnits);
+  _scale = (_isValid) ? (fromUnits.conversion() / toUnits.conversion()) : 0.;
+}
+
+bool UnitConverter::isValid() const {
+  return _isValid;
+}
+
+double UnitConverter::scale() const {
+  return _scale;
+}
+
+double UnitConverter::convert(double value) const {
+  return value * _scale;
+}
+
+void UnitConverter::convert(size_t count, double* values) const {
+  const double scale = _scale;
+  for (size_t k = 0; k < count; ++k) {
+    values[k] *= scale;
+  }
+}
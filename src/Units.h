@@ -9,62 +9,213 @@
 #ifndef epanet_rtx_units_h
 #define epanet_rtx_units_h
 
-// convenience defines ------------ unit= conversion,   dimension (m,l,t,current,temp,amount,intensity)
-#define RTX_DIMENSIONLESS           Units(1)
+#include <cstddef>
+#include <string>
+#include <map>
+#include <iostream>
+#include <boost/static_assert.hpp>
+
+// convenience defines ------------ runtime Units for the static units below (see Unit::)
+#define RTX_DIMENSIONLESS           RTX::Units::of<RTX::Unit::Dimensionless>()
 // Pressure
-#define RTX_PSI                     Units(0.0001450378911491,1,-1,-2)
-#define RTX_PASCAL                  Units(1,            1,-1,-2)
-#define RTX_KILOPASCAL              Units(.001,         1,-1,-2)
+#define RTX_PSI                     RTX::Units::of<RTX::Unit::Psi>()
+#define RTX_PASCAL                  RTX::Units::of<RTX::Unit::Pascal>()
+#define RTX_KILOPASCAL              RTX::Units::of<RTX::Unit::Kilopascal>()
 // distance
-#define RTX_FOOT                    Units(.3048,        0,1,0)
-#define RTX_INCH                    Units(.0254,        0,1,0)
-#define RTX_METER                   Units(1,            0,1,0)
-#define RTX_CENTIMETER              Units(.01,          0,1,0)
+#define RTX_FOOT                    RTX::Units::of<RTX::Unit::Foot>()
+#define RTX_INCH                    RTX::Units::of<RTX::Unit::Inch>()
+#define RTX_METER                   RTX::Units::of<RTX::Unit::Meter>()
+#define RTX_CENTIMETER              RTX::Units::of<RTX::Unit::Centimeter>()
 // volume
-#define RTX_CUBIC_METER             Units(1,            0,3,0)
-#define RTX_GALLON                  Units(.00378541,    0,3,0)
-#define RTX_MILLION_GALLON          Units(3785.41178,   0,3,0)
-#define RTX_LITER                   Units(.001,         0,3,0)
-#define RTX_CUBIC_FOOT              Units(.0283168466,  0,3,0)
+#define RTX_CUBIC_METER             RTX::Units::of<RTX::Unit::CubicMeter>()
+#define RTX_GALLON                  RTX::Units::of<RTX::Unit::Gallon>()
+#define RTX_MILLION_GALLON          RTX::Units::of<RTX::Unit::MillionGallon>()
+#define RTX_LITER                   RTX::Units::of<RTX::Unit::Liter>()
+#define RTX_CUBIC_FOOT              RTX::Units::of<RTX::Unit::CubicFoot>()
 //flow
-#define RTX_CUBIC_METER_PER_SECOND  Units(1,            0,3,-1)
-#define RTX_CUBIC_FOOT_PER_SECOND   Units(.0283168466,  0,3,-1)
-#define RTX_GALLON_PER_SECOND       Units(.00378541178, 0,3,-1)
-#define RTX_GALLON_PER_MINUTE       Units(.00006309020, 0,3,-1)
-#define RTX_MILLION_GALLON_PER_DAY  Units(.0438126364,  0,3,-1)
-#define RTX_LITER_PER_SECOND        Units(.001,         0,3,-1)
-#define RTX_LITER_PER_MINUTE        Units(.00001666667, 0,3,-1)
-#define RTX_MILLION_LITER_PER_DAY   Units(.0115740741,  0,3,-1)
-#define RTX_CUBIC_METER_PER_HOUR    Units(.000277777778,0,3,-1)
-#define RTX_CUBIC_METER_PER_DAY     Units(.000011574074,0,3,-1)
-#define RTX_ACRE_FOOT_PER_DAY       Units(.0142764102,  0,3,-1)
-#define RTX_IMPERIAL_MILLION_GALLON_PER_DAY Units(.0526168042,0,3,-1)
+#define RTX_CUBIC_METER_PER_SECOND  RTX::Units::of<RTX::Unit::CubicMeterPerSecond>()
+#define RTX_CUBIC_FOOT_PER_SECOND   RTX::Units::of<RTX::Unit::CubicFootPerSecond>()
+#define RTX_GALLON_PER_SECOND       RTX::Units::of<RTX::Unit::GallonPerSecond>()
+#define RTX_GALLON_PER_MINUTE       RTX::Units::of<RTX::Unit::GallonPerMinute>()
+#define RTX_MILLION_GALLON_PER_DAY  RTX::Units::of<RTX::Unit::MillionGallonPerDay>()
+#define RTX_LITER_PER_SECOND        RTX::Units::of<RTX::Unit::LiterPerSecond>()
+#define RTX_LITER_PER_MINUTE        RTX::Units::of<RTX::Unit::LiterPerMinute>()
+#define RTX_MILLION_LITER_PER_DAY   RTX::Units::of<RTX::Unit::MillionLiterPerDay>()
+#define RTX_CUBIC_METER_PER_HOUR    RTX::Units::of<RTX::Unit::CubicMeterPerHour>()
+#define RTX_CUBIC_METER_PER_DAY     RTX::Units::of<RTX::Unit::CubicMeterPerDay>()
+#define RTX_ACRE_FOOT_PER_DAY       RTX::Units::of<RTX::Unit::AcreFootPerDay>()
+#define RTX_IMPERIAL_MILLION_GALLON_PER_DAY RTX::Units::of<RTX::Unit::ImperialMillionGallonPerDay>()
 // time
-#define RTX_SECOND                  Units(1,            0,0,1)
-#define RTX_MINUTE                  Units(60,           0,0,1)
-#define RTX_HOUR                    Units(3600,         0,0,1)
-#define RTX_DAY                     Units(86400,        0,0,1)
+#define RTX_SECOND                  RTX::Units::of<RTX::Unit::Second>()
+#define RTX_MINUTE                  RTX::Units::of<RTX::Unit::Minute>()
+#define RTX_HOUR                    RTX::Units::of<RTX::Unit::Hour>()
+#define RTX_DAY                     RTX::Units::of<RTX::Unit::Day>()
 // mass
-#define RTX_MILLIGRAM               Units(.000001       1,0,0)
-#define RTX_GRAM                    Units(.001          1,0,0)
-#define RTX_KILOGRAM                Units(1,            1,0,0)
+#define RTX_MILLIGRAM               RTX::Units::of<RTX::Unit::Milligram>()
+#define RTX_GRAM                    RTX::Units::of<RTX::Unit::Gram>()
+#define RTX_KILOGRAM                RTX::Units::of<RTX::Unit::Kilogram>()
 // concentration
-#define RTX_MILLIGRAMS_PER_LITER    Units(.001,         1,-3,0)
+#define RTX_MILLIGRAMS_PER_LITER    RTX::Units::of<RTX::Unit::MilligramPerLiter>()
 // conductance
-#define RTX_MICROSIEMENS_PER_CM     Units(.0001,        -1,-3,3,2)
+#define RTX_MICROSIEMENS_PER_CM     RTX::Units::of<RTX::Unit::MicrosiemensPerCentimeter>()
 
 
 namespace RTX {
   
+  /*!
+   \namespace RTX::Unit
+   \brief Units of measure known when the program is written, as types.
+  
+   Each unit is a class with its Dimension as a type and its conversion factor (to SI) as an inline static, so a
+   conversion between two of them folds down to a constant multiply when optimized, and converting between units of
+   different dimensions doesn't compile:
+  
+     double feet = Unit::convert<Unit::Meter, Unit::Foot>(meters);
+     double bad = Unit::convert<Unit::Meter, Unit::Second>(meters);  // compile error
+  
+   Units::of<U>() gives the runtime Units for one, for the config-driven cases, and the RTX_* defines are those.
+   Per<A,B> and Times<A,B> make compound units.
+   */
+  
+  namespace Unit {
+    
+    //! exponents of the seven base quantities, as template arguments (mass, length, time first -- as for Units)
+    template<int M, int L, int T, int I = 0, int K = 0, int N = 0, int J = 0>
+    class Dimension {
+    public:
+      enum { mass = M, length = L, time = T, current = I, temperature = K, amount = N, intensity = J };
+    };
+    
+    template<class A, class B>
+    class IsSameDimension {
+    public:
+      enum { value = ((int)A::mass == (int)B::mass &&
+                      (int)A::length == (int)B::length &&
+                      (int)A::time == (int)B::time &&
+                      (int)A::current == (int)B::current &&
+                      (int)A::temperature == (int)B::temperature &&
+                      (int)A::amount == (int)B::amount &&
+                      (int)A::intensity == (int)B::intensity) };
+    };
+    
+    template<class A, class B>
+    class DimensionProduct {
+    public:
+      typedef Dimension<A::mass + B::mass, A::length + B::length, A::time + B::time, A::current + B::current,
+                        A::temperature + B::temperature, A::amount + B::amount, A::intensity + B::intensity> type;
+    };
+    
+    template<class A, class B>
+    class DimensionQuotient {
+    public:
+      typedef Dimension<A::mass - B::mass, A::length - B::length, A::time - B::time, A::current - B::current,
+                        A::temperature - B::temperature, A::amount - B::amount, A::intensity - B::intensity> type;
+    };
+    
+    namespace Dimensions {
+      typedef Dimension<0, 0, 0>        Dimensionless;
+      typedef Dimension<1,-1,-2>        Pressure;
+      typedef Dimension<0, 1, 0>        Length;
+      typedef Dimension<0, 3, 0>        Volume;
+      typedef Dimension<0, 3,-1>        Flow;
+      typedef Dimension<0, 0, 1>        Time;
+      typedef Dimension<1, 0, 0>        Mass;
+      typedef Dimension<1,-3, 0>        Concentration;
+      typedef Dimension<-1,-3,3,2>      Conductance;
+    }
+    
+    // a unit is any class with a dimension type and a conversion() to SI; these are the known ones.
+#define RTX_STATIC_UNIT(name, factor, dimensions) \
+    class name { public: typedef Dimensions::dimensions dimension; static double conversion() { return factor; } };
+    
+    // dimensionless
+    RTX_STATIC_UNIT(Dimensionless,               1.,               Dimensionless)
+    // pressure
+    RTX_STATIC_UNIT(Psi,                         6894.757293168,   Pressure)
+    RTX_STATIC_UNIT(Pascal,                      1.,               Pressure)
+    RTX_STATIC_UNIT(Kilopascal,                  1000.,            Pressure)
+    // distance
+    RTX_STATIC_UNIT(Foot,                        .3048,            Length)
+    RTX_STATIC_UNIT(Inch,                        .0254,            Length)
+    RTX_STATIC_UNIT(Meter,                       1.,               Length)
+    RTX_STATIC_UNIT(Centimeter,                  .01,              Length)
+    // volume
+    RTX_STATIC_UNIT(CubicMeter,                  1.,               Volume)
+    RTX_STATIC_UNIT(Gallon,                      .00378541,        Volume)
+    RTX_STATIC_UNIT(MillionGallon,               3785.41178,       Volume)
+    RTX_STATIC_UNIT(Liter,                       .001,             Volume)
+    RTX_STATIC_UNIT(CubicFoot,                   .0283168466,      Volume)
+    // flow
+    RTX_STATIC_UNIT(CubicMeterPerSecond,         1.,               Flow)
+    RTX_STATIC_UNIT(CubicFootPerSecond,          .0283168466,      Flow)
+    RTX_STATIC_UNIT(GallonPerSecond,             .00378541178,     Flow)
+    RTX_STATIC_UNIT(GallonPerMinute,             .00006309020,     Flow)
+    RTX_STATIC_UNIT(MillionGallonPerDay,         .0438126364,      Flow)
+    RTX_STATIC_UNIT(LiterPerSecond,              .001,             Flow)
+    RTX_STATIC_UNIT(LiterPerMinute,              .00001666667,     Flow)
+    RTX_STATIC_UNIT(MillionLiterPerDay,          .0115740741,      Flow)
+    RTX_STATIC_UNIT(CubicMeterPerHour,           .000277777778,    Flow)
+    RTX_STATIC_UNIT(CubicMeterPerDay,            .000011574074,    Flow)
+    RTX_STATIC_UNIT(AcreFootPerDay,              .0142764102,      Flow)
+    RTX_STATIC_UNIT(ImperialMillionGallonPerDay, .0526168042,      Flow)
+    // time
+    RTX_STATIC_UNIT(Second,                      1.,               Time)
+    RTX_STATIC_UNIT(Minute,                      60.,              Time)
+    RTX_STATIC_UNIT(Hour,                        3600.,            Time)
+    RTX_STATIC_UNIT(Day,                         86400.,           Time)
+    // mass
+    RTX_STATIC_UNIT(Milligram,                   .000001,          Mass)
+    RTX_STATIC_UNIT(Gram,                        .001,             Mass)
+    RTX_STATIC_UNIT(Kilogram,                    1.,               Mass)
+    // concentration
+    RTX_STATIC_UNIT(MilligramPerLiter,           .001,             Concentration)
+    // conductance
+    RTX_STATIC_UNIT(MicrosiemensPerCentimeter,   .0001,            Conductance)
+    
+#undef RTX_STATIC_UNIT
+    
+    //! compound units: Per<Meter, Second>, Times<Kilogram, Meter>
+    template<class A, class B>
+    class Per {
+    public:
+      typedef typename DimensionQuotient<typename A::dimension, typename B::dimension>::type dimension;
+      static double conversion() { return A::conversion() / B::conversion(); }
+    };
+    
+    template<class A, class B>
+    class Times {
+    public:
+      typedef typename DimensionProduct<typename A::dimension, typename B::dimension>::type dimension;
+      static double conversion() { return A::conversion() * B::conversion(); }
+    };
+    
+    //! from one static unit to another; using it with units of different dimensions is a compile error.
+    template<class From, class To>
+    class Conversion {
+      BOOST_STATIC_ASSERT((IsSameDimension<typename From::dimension, typename To::dimension>::value));
+    public:
+      static double factor() { return From::conversion() / To::conversion(); }
+      static double convert(double value) { return value * factor(); }
+    };
+    
+    template<class From, class To>
+    inline double convert(double value) {
+      return Conversion<From, To>::convert(value);
+    }
+    
+  } // namespace Unit
+  
+  
+  
   
   /*!
    \class Units
    \brief Keep track of dimensions and units of measure.
-   
+  
    In general, any unit can be expressed as a set of mutually independent exponent factors of the
    quantities listed below. We shall support all of the seven (7) exponents, even though we expect to
    never use the candela, but why limit the future, right?
-   
+  
    - length = meter (m)
    - mass = kilogram (kg)
    - time = second (s)
@@ -72,14 +223,19 @@ namespace RTX {
    - thermodynamic temperature = kelvin (K)
    - amount of substance = mole (mol)
    - luminous intensity = candela (cd)
-   
+  
   */
   /*!
    \fn Units::Units(double conversion, int mass, int length, int time, int current, int temperature, int amount, int intensity)
    \brief Create a new Units object with the specified dimensions and conversion factor.
-   
+  
    The default dimensional exponents are all zero (0), which means dimensionless. See Units.h for some predefined units of measure.
-   
+  
+   */
+  /*!
+   \fn Units Units::of()
+   \brief The runtime Units for a static unit (see RTX::Unit), such as Units::of<Unit::Foot>().
+  
    */
   
   
@@ -90,11 +246,15 @@ namespace RTX {
   class Units {
   public:
     Units(double conversion = 1., int mass = 0, int length = 0, int time = 0, int current = 0, int temperature = 0, int amount = 0, int intensity = 0);
-    
+    template<class U> static Units of() {
+      typedef typename U::dimension D;
+      return Units(U::conversion(), D::mass, D::length, D::time, D::current, D::temperature, D::amount, D::intensity);
+    };
+  
     Units operator*(const Units& unit) const;
     Units operator/(const Units& unit) const;
     bool operator==(const Units& unit) const;
-    
+  
     bool isSameDimensionAs(const Units& unit) const;
     bool isDimensionless();
     double conversion() const;
@@ -102,9 +262,9 @@ namespace RTX {
     static Units unitOfType(const std::string& unitString);
     static std::map<std::string, Units> unitStringMap();
     std::string unitString();
-    
+  
     virtual std::ostream& toStream(std::ostream &stream);
-    
+  
   private:
     int _length;
     int _mass;
@@ -117,7 +277,44 @@ namespace RTX {
   };
   
   std::ostream& operator<< (std::ostream &out, Units &unit);
-
+  
+  
+  /*!
+   \class UnitConverter
+   \brief A conversion from one unit of measure to another, worked out once.
+  
+   Units::convertValue checks the dimensions and divides the conversion factors on every call. Where a pair of units
+   stays put for many values (a series and its source, say), build a UnitConverter when the units are set and use
+   that instead -- converting is then a single multiply, and whole arrays can be converted in one pass.
+  
+   Like convertValue, converting between units of different dimensions gives zero; check isValid() first.
+   */
+  /*!
+   \fn UnitConverter::UnitConverter(const Units& fromUnits, const Units& toUnits)
+   \brief Work out the conversion between two units. The default converter passes values through unchanged.
+   */
+  
+  class UnitConverter {
+  public:
+    UnitConverter();
+    UnitConverter(const Units& fromUnits, const Units& toUnits);
+    //! between static units, worked out (and dimension-checked) at compile time
+    template<class From, class To> static UnitConverter of() {
+      UnitConverter converter;
+      converter._scale = Unit::Conversion<From, To>::factor();
+      return converter;
+    };
+  
+    bool isValid() const;       //! false if the units aren't dimensionally consistent
+    double scale() const;
+    double convert(double value) const;
+    void convert(size_t count, double* values) const; //! in place
+  
+  private:
+    double _scale;
+    bool _isValid;
+  };
+  
 } // namespace
 
 
@@ -0,0 +1,205 @@
+//
+//  ValidationFilter.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include <cmath>
+#include <boost/bind/bind.hpp>
+
+#include "ValidationFilter.h"
+#include "Log.h"
+
+using namespace RTX;
+using namespace std;
+using namespace boost::placeholders;
+
+
+ValidationFilter::ValidationFilter() : ModularTimeSeries::ModularTimeSeries() {
+  _hasRange = false;
+  _minimum = 0;
+  _maximum = 0;
+  _maximumRate = 0;
+  _flatlineDuration = 0;
+  _deadband = 0;
+}
+
+ValidationFilter::~ValidationFilter() {
+
+}
+
+#pragma mark - Added Methods
+
+void ValidationFilter::setRange(double minimum, double maximum) {
+  if (maximum < minimum) {
+    RTX_LOG(warning, "ValidationFilter", "range [" << minimum << "," << maximum << "] is empty -- ignoring");
+    return;
+  }
+  resetCache();
+  _hasRange = true;
+  _minimum = minimum;
+  _maximum = maximum;
+}
+
+void ValidationFilter::clearRange() {
+  resetCache();
+  _hasRange = false;
+}
+
+bool ValidationFilter::hasRange() {
+  return _hasRange;
+}
+
+double ValidationFilter::minimum() {
+  return _minimum;
+}
+
+double ValidationFilter::maximum() {
+  return _maximum;
+}
+
+void ValidationFilter::setMaximumRate(double perSecond) {
+  resetCache();
+  _maximumRate = std::abs(perSecond);
+}
+
+double ValidationFilter::maximumRate() {
+  return _maximumRate;
+}
+
+void ValidationFilter::setFlatline(time_t duration, double deadband) {
+  resetCache();
+  _flatlineDuration = RTX_MAX(duration, (time_t)0);
+  _deadband = std::abs(deadband);
+}
+
+time_t ValidationFilter::flatlineDuration() {
+  return _flatlineDuration;
+}
+
+double ValidationFilter::deadband() {
+  return _deadband;
+}
+
+#pragma mark - Public Overridden Methods
+
+Point ValidationFilter::point(time_t time) {
+  if ( !(clock()->isValid(time)) ) {
+    time = clock()->timeBefore(time);
+  }
+  return pointComputedOnce(time, boost::bind(&ValidationFilter::computePoint, this, _1));
+}
+
+Point ValidationFilter::computePoint(time_t time) {
+  // a range of one -- the pass still reads back through the history the checks need.
+  std::vector<Point> checked;
+  this->evaluateRange(time, time, checked);
+  if (checked.empty() || checked.back().time != time) {
+    return Point();
+  }
+  this->cachePoint(checked.back());
+  return checked.back();
+}
+
+bool ValidationFilter::valueTransform(ValueTransform& transform) {
+  return false; // whether a point passes depends on the ones before it
+}
+
+PointRecord::time_pair_t ValidationFilter::affectedRange(time_t start, time_t end) {
+  // a changed point can move the rate check's reference, or start or break a flatline run, for as far ahead as a
+  // pass looks back.
+  return make_pair(start, end + history());
+}
+
+std::ostream& ValidationFilter::toStream(std::ostream &stream) {
+  ModularTimeSeries::toStream(stream);
+  stream << "Validation:";
+  if (_hasRange) {
+    stream << " range [" << _minimum << "," << _maximum << "]";
+  }
+  if (_maximumRate > 0) {
+    stream << " rate " << _maximumRate << "/s";
+  }
+  if (_flatlineDuration > 0) {
+    stream << " flatline " << _flatlineDuration << "s (deadband " << _deadband << ")";
+  }
+  stream << endl;
+  return stream;
+}
+
+#pragma mark - Protected Methods
+
+void ValidationFilter::evaluateRange(time_t start, time_t end, std::vector<Point>& out) {
+  time_t lookBack = history();
+  time_t from = (start > lookBack) ? start - lookBack : 1;
+  std::vector<Point> sourcePoints = sourcePointsInRange(from, end);
+  size_t count = sourcePoints.size();
+  if (count == 0) {
+    return;
+  }
+
+  // columns, converted in one go, with the range check run straight down them.
+  UnitConverter converter = sourceConverter();
+  std::vector<double> values(count);
+  std::vector<unsigned char> failed(count, 0);
+  for (size_t k = 0; k < count; ++k) {
+    values[k] = sourcePoints[k].value;
+  }
+  converter.convert(count, &values[0]);
+  if (_hasRange) {
+    for (size_t k = 0; k < count; ++k) {
+      failed[k] = (values[k] < _minimum || _maximum < values[k]);
+    }
+  }
+
+  // the rate and flatline checks carry state from one point to the next.
+  bool haveReference = false, haveRun = false;
+  time_t referenceTime = 0, runStart = 0;
+  double referenceValue = 0, runValue = 0;
+  for (size_t k = 0; k < count; ++k) {
+    const Point& p = sourcePoints[k];
+    if (p.quality == Point::missing || failed[k]) {
+      continue;
+    }
+    if (_maximumRate > 0 && haveReference && p.time > referenceTime) {
+      double allowed = _maximumRate * (double)(p.time - referenceTime);
+      failed[k] = (std::abs(values[k] - referenceValue) > allowed);
+    }
+    if (_flatlineDuration > 0 && !failed[k]) {
+      if (haveRun && std::abs(values[k] - runValue) <= _deadband) {
+        failed[k] = (p.time - runStart > _flatlineDuration);
+      }
+      else {
+        haveRun = true;
+        runStart = p.time;
+        runValue = values[k];
+      }
+    }
+    if (!failed[k]) {
+      haveReference = true;
+      referenceTime = p.time;
+      referenceValue = values[k];
+    }
+  }
+
+  double confidenceScale = std::abs(converter.scale());
+  for (size_t k = 0; k < count; ++k) {
+    const Point& p = sourcePoints[k];
+    if (p.time < start) {
+      continue;
+    }
+    Point::Qual_t quality = (failed[k]) ? Point::missing : p.quality;
+    out.push_back(Point(p.time, values[k], quality, p.confidence * confidenceScale));
+  }
+}
+
+#pragma mark - Private Methods
+
+time_t ValidationFilter::history() {
+  time_t sourcePeriod = (doesHaveSource()) ? source()->period() : 0;
+  time_t history = RTX_MAX((time_t)(60*60), 10 * sourcePeriod);
+  return history + _flatlineDuration;
+}
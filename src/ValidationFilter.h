@@ -0,0 +1,86 @@
+//
+//  ValidationFilter.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_ValidationFilter_h
+#define epanet_rtx_ValidationFilter_h
+
+#include "ModularTimeSeries.h"
+
+namespace RTX {
+
+  /*!
+   \class ValidationFilter
+   \brief Passes the source's points through, flagging the ones that fail range, rate-of-change or flatline checks.
+
+   Failed points keep their value but are given Point::missing quality, so Resampler, AggregatorTimeSeries and
+   anything else downstream already treats them as gaps. Every check is off until it is set:
+   - range: values outside [minimum, maximum]
+   - rate of change: a jump from the last point that passed, faster than the limit (per second, in this series' units)
+   - flatline: once the value has stayed within the deadband of where it settled for the flatline duration, every
+     further point in that run is flagged (a stuck meter or a frozen SCADA tag)
+
+   All of the checks run together in one pass over a range of the source, so validating a tag costs a single pull.
+   So that a range validates the same however it was split up, the pass starts far enough back to pick up the
+   history the checks depend on: the flatline duration, plus an hour or ten source periods (whichever is longer).
+   The checks are causal -- the first flatline duration of a stuck run passes, since it isn't stuck yet.
+   */
+
+  /*!
+   \fn void ValidationFilter::setRange(double minimum, double maximum)
+   \brief Flag values outside [minimum, maximum], in this series' units.
+   */
+  /*!
+   \fn void ValidationFilter::setMaximumRate(double perSecond)
+   \brief Flag jumps faster than this, in this series' units per second. Zero turns the check off.
+   */
+  /*!
+   \fn void ValidationFilter::setFlatline(time_t duration, double deadband)
+   \brief Flag a value that hasn't moved by more than the deadband for longer than the duration. Zero duration turns the check off.
+   */
+
+  class ValidationFilter : public ModularTimeSeries {
+  public:
+    RTX_SHARED_POINTER(ValidationFilter);
+    ValidationFilter();
+    virtual ~ValidationFilter();
+
+    // added functionality
+    void setRange(double minimum, double maximum);
+    void clearRange();
+    bool hasRange();
+    double minimum();
+    double maximum();
+    void setMaximumRate(double perSecond);
+    double maximumRate();
+    void setFlatline(time_t duration, double deadband = 0.);
+    time_t flatlineDuration();
+    double deadband();
+
+    // overridden methods (from derived classes)
+    virtual Point point(time_t time);
+    virtual bool valueTransform(ValueTransform& transform);
+    virtual PointRecord::time_pair_t affectedRange(time_t start, time_t end);
+
+    virtual std::ostream& toStream(std::ostream &stream);
+
+  protected:
+    virtual void evaluateRange(time_t start, time_t end, std::vector<Point>& out);
+
+  private:
+    Point computePoint(time_t time);
+    time_t history();  //! how far back a pass starts, so the checks have something to compare with
+    bool _hasRange;
+    double _minimum, _maximum;
+    double _maximumRate;
+    time_t _flatlineDuration;
+    double _deadband;
+  };
+
+}
+
+#endif
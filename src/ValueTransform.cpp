@@ -0,0 +1,161 @@
+//
+//  ValueTransform.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <algorithm>
+
+#include "ValueTransform.h"
+
+using namespace RTX;
+using namespace std;
+
+ValueTransform::ValueTransform() : _isCurve(false), _scale(1.), _offset(0.) {
+  
+}
+
+ValueTransform ValueTransform::affine(double scale, double offset) {
+  ValueTransform transform;
+  transform._scale = scale;
+  transform._offset = offset;
+  return transform;
+}
+
+ValueTransform ValueTransform::curve(const std::vector< std::pair<double,double> >& coordinates) {
+  vector<double> x, y;
+  x.reserve(coordinates.size());
+  y.reserve(coordinates.size());
+  for (size_t i = 0; i < coordinates.size(); ++i) {
+    x.push_back(coordinates[i].first);
+    y.push_back(coordinates[i].second);
+  }
+  ValueTransform transform;
+  transform.setCurve(x, y);
+  return transform;
+}
+
+
+#pragma mark - Public Methods
+
+ValueTransform ValueTransform::then(const ValueTransform& outer) const {
+  // affine, then affine
+  if (!_isCurve && !outer._isCurve) {
+    return affine(outer._scale * _scale, outer._scale * _offset + outer._offset);
+  }
+  
+  // curve, then affine: map the outputs
+  if (_isCurve && !outer._isCurve) {
+    vector<double> y(_y.size());
+    for (size_t i = 0; i < _y.size(); ++i) {
+      y[i] = outer(_y[i]);
+    }
+    ValueTransform transform;
+    transform.setCurve(_x, y);
+    return transform;
+  }
+  
+  // affine, then curve: pull the breakpoints back through the affine map
+  if (!_isCurve && outer._isCurve) {
+    if (_scale == 0.) {
+      return affine(0., outer(_offset));
+    }
+    size_t n = outer._x.size();
+    vector<double> x(n), y(n);
+    for (size_t i = 0; i < n; ++i) {
+      // a negative scale flips the curve end for end
+      size_t from = (_scale > 0.) ? i : n - 1 - i;
+      x[i] = (outer._x[from] - _offset) / _scale;
+      y[i] = outer._y[from];
+    }
+    ValueTransform transform;
+    transform.setCurve(x, y);
+    return transform;
+  }
+  
+  // curve, then curve: the breakpoints are my own, plus wherever a segment of mine crosses one of the outer curve's.
+  vector<double> x = _x;
+  for (size_t i = 0; i + 1 < _x.size(); ++i) {
+    double y0 = _y[i], y1 = _y[i+1];
+    if (y0 == y1) {
+      continue;
+    }
+    for (size_t j = 0; j < outer._x.size(); ++j) {
+      double u = outer._x[j];
+      if ((y0 < u && u < y1) || (y1 < u && u < y0)) {
+        x.push_back(_x[i] + (u - y0) / _slopes[i]);
+      }
+    }
+  }
+  sort(x.begin(), x.end());
+  x.erase(unique(x.begin(), x.end()), x.end());
+  vector<double> y(x.size());
+  for (size_t i = 0; i < x.size(); ++i) {
+    y[i] = outer.curveValue(curveValue(x[i]));
+  }
+  ValueTransform transform;
+  transform.setCurve(x, y);
+  return transform;
+}
+
+double ValueTransform::operator()(double x) const {
+  return (_isCurve) ? curveValue(x) : (_scale * x + _offset);
+}
+
+void ValueTransform::apply(size_t count, double* values) const {
+  if (!_isCurve) {
+    // branch-free, so the compiler can vectorize it
+    double scale = _scale, offset = _offset;
+    for (size_t k = 0; k < count; ++k) {
+      values[k] = scale * values[k] + offset;
+    }
+    return;
+  }
+  for (size_t k = 0; k < count; ++k) {
+    values[k] = curveValue(values[k]);
+  }
+}
+
+bool ValueTransform::isAffine() const {
+  return !_isCurve;
+}
+
+double ValueTransform::scale() const {
+  return _scale;
+}
+
+double ValueTransform::offset() const {
+  return _offset;
+}
+
+
+#pragma mark - Private Methods
+
+void ValueTransform::setCurve(const std::vector<double>& x, const std::vector<double>& y) {
+  _isCurve = true;
+  _x = x;
+  _y = y;
+  _slopes.clear();
+  for (size_t i = 1; i < _x.size(); ++i) {
+    _slopes.push_back( (_y[i] - _y[i-1]) / (_x[i] - _x[i-1]) );
+  }
+}
+
+double ValueTransform::curveValue(double x) const {
+  if (_x.empty()) {
+    return 0.;
+  }
+  // off either end of the curve, hold the end value.
+  if (x <= _x.front()) {
+    return _y.front();
+  }
+  if (x >= _x.back()) {
+    return _y.back();
+  }
+  
+  // otherwise binary search for the segment, and use its precomputed slope.
+  size_t i = upper_bound(_x.begin(), _x.end(), x) - _x.begin() - 1;
+  return _y[i] + (x - _x[i]) * _slopes[i];
+}
@@ -0,0 +1,61 @@
+//
+//  ValueTransform.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_ValueTransform_h
+#define epanet_rtx_ValueTransform_h
+
+#include <vector>
+#include <utility>
+
+namespace RTX {
+
+  /*!
+   \class ValueTransform
+   \brief A stateless, point-by-point mapping of values: either affine (scale * x + offset) or a piecewise-linear curve.
+
+   Stateless TimeSeries stages (unit conversion, offsets, curve functions) describe themselves with one of these,
+   so a chain of them can be collapsed into a single transform and applied to a source range in one pass. The set
+   is closed under composition: an affine map before or after a curve folds into the curve's breakpoints, and two
+   curves compose into another curve whose breakpoints are the union of both.
+
+   Curves hold their end values outside their range (no extrapolation). A curve with one breakpoint is a constant.
+   */
+
+  /*!
+   \fn ValueTransform ValueTransform::then(const ValueTransform& outer) const
+   \brief Compose two transforms.
+   \param outer The transform to apply after this one.
+   \return A transform equivalent to outer(this(x)).
+   */
+
+  class ValueTransform {
+  public:
+    ValueTransform(); //! the identity
+    static ValueTransform affine(double scale, double offset);
+    static ValueTransform curve(const std::vector< std::pair<double,double> >& coordinates); //! (x,y) pairs, sorted by x
+
+    ValueTransform then(const ValueTransform& outer) const;
+    double operator()(double x) const;
+    void apply(size_t count, double* values) const; //! in place, over a flat array
+
+    bool isAffine() const;
+    double scale() const;   //! affine only
+    double offset() const;  //! affine only
+
+  private:
+    bool _isCurve;
+    double _scale, _offset;
+    std::vector<double> _x, _y, _slopes; // breakpoints, and the slope from each to the next
+
+    void setCurve(const std::vector<double>& x, const std::vector<double>& y);
+    double curveValue(double x) const;
+  };
+
+}
+
+#endif
@@ -0,0 +1,310 @@
+//
+//  VectorPointRecord.cpp
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#include <iostream>
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "VectorPointRecord.h"
+
+using namespace RTX;
+using namespace std;
+
+typedef boost::shared_lock<boost::shared_mutex> readLock_t;
+typedef boost::unique_lock<boost::shared_mutex> writeLock_t;
+
+typedef std::vector<Point>::iterator pointIterator_t;
+
+// mixed point/time comparisons, for searching the sorted vectors
+static bool pointIsBeforeTime(const Point& point, time_t time) {
+  return point.time < time;
+}
+
+static bool timeIsBeforePoint(time_t time, const Point& point) {
+  return time < point.time;
+}
+
+
+#pragma mark - Constructor
+
+VectorPointRecord::VectorPointRecord() {
+  
+}
+
+std::ostream& RTX::operator<< (std::ostream &out, VectorPointRecord &pr) {
+  return pr.toStream(out);
+}
+
+std::ostream& VectorPointRecord::toStream(std::ostream &stream) {
+  stream << "Vector Point Record" << std::endl;
+  return stream;
+}
+
+
+#pragma mark - Registration
+
+std::string VectorPointRecord::registerAndGetIdentifier(std::string recordName) {
+  writeLock_t registryLock(_registryMutex);
+  if (_series.find(recordName) == _series.end()) {
+    _series[recordName] = SeriesPointer( new Series() );
+  }
+  return recordName;
+}
+
+std::vector<std::string> VectorPointRecord::identifiers() {
+  typedef std::map<std::string, SeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  vector<string> names;
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    names.push_back(entry.first);
+  }
+  return names;
+}
+
+VectorPointRecord::SeriesPointer VectorPointRecord::seriesForName(const std::string& identifier) {
+  readLock_t registryLock(_registryMutex);
+  std::map<std::string, SeriesPointer>::iterator it = _series.find(identifier);
+  if (it == _series.end()) {
+    return SeriesPointer();
+  }
+  return it->second;
+}
+
+size_t VectorPointRecord::pointCount(const std::string& identifier) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return 0;
+  }
+  readLock_t seriesLock(series->mutex);
+  return series->points.size();
+}
+
+size_t VectorPointRecord::seriesMemoryFootprint(const std::string& identifier) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return 0;
+  }
+  readLock_t seriesLock(series->mutex);
+  return series->points.capacity() * sizeof(Point);
+}
+
+
+#pragma mark - Retrieval
+
+Point VectorPointRecord::point(const string& identifier, time_t time) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  std::vector<Point>& points = series->points;
+  pointIterator_t it = std::lower_bound(points.begin(), points.end(), time, pointIsBeforeTime);
+  if (it == points.end() || it->time != time) {
+    return Point();
+  }
+  return *it;
+}
+
+Point VectorPointRecord::pointBefore(const string& identifier, time_t time) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  std::vector<Point>& points = series->points;
+  pointIterator_t it = std::lower_bound(points.begin(), points.end(), time, pointIsBeforeTime);
+  if (it == points.begin()) {
+    return Point();
+  }
+  return *(--it);
+}
+
+Point VectorPointRecord::pointAfter(const string& identifier, time_t time) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return Point();
+  }
+  readLock_t seriesLock(series->mutex);
+  std::vector<Point>& points = series->points;
+  pointIterator_t it = std::upper_bound(points.begin(), points.end(), time, timeIsBeforePoint);
+  if (it == points.end()) {
+    return Point();
+  }
+  return *it;
+}
+
+std::vector<Point> VectorPointRecord::pointsInRange(const string& identifier, time_t startTime, time_t endTime) {
+  std::vector<Point> pointVector;
+  SeriesPointer series = seriesForName(identifier);
+  if (!series || endTime < startTime) {
+    return pointVector;
+  }
+  readLock_t seriesLock(series->mutex);
+  std::vector<Point>& points = series->points;
+  pointIterator_t first = std::lower_bound(points.begin(), points.end(), startTime, pointIsBeforeTime);
+  pointIterator_t last = std::upper_bound(first, points.end(), endTime, timeIsBeforePoint);
+  pointVector.assign(first, last);
+  return pointVector;
+}
+
+void VectorPointRecord::visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return;
+  }
+  readLock_t seriesLock(series->mutex);
+  std::vector<Point>& points = series->points;
+  pointIterator_t it = std::lower_bound(points.begin(), points.end(), startTime, pointIsBeforeTime);
+  for ( ; it != points.end() && it->time <= endTime; ++it) {
+    if (!visitor.visit(*it)) {
+      break;
+    }
+  }
+}
+
+Point VectorPointRecord::firstPoint(const string& id) {
+  Point foundPoint;
+  SeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (!series->points.empty()) {
+      foundPoint = series->points.front();
+    }
+  }
+  return foundPoint;
+}
+
+Point VectorPointRecord::lastPoint(const string& id) {
+  Point foundPoint;
+  SeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (!series->points.empty()) {
+      foundPoint = series->points.back();
+    }
+  }
+  return foundPoint;
+}
+
+PointRecord::time_pair_t VectorPointRecord::range(const string& id) {
+  time_pair_t range(0,0);
+  SeriesPointer series = seriesForName(id);
+  if (series) {
+    readLock_t seriesLock(series->mutex);
+    if (!series->points.empty()) {
+      range = make_pair(series->points.front().time, series->points.back().time);
+    }
+  }
+  return range;
+}
+
+
+#pragma mark - Insertion
+
+void VectorPointRecord::addPoint(const string& identifier, Point point) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series) {
+    return;
+  }
+  writeLock_t seriesLock(series->mutex);
+  std::vector<Point>& points = series->points;
+  
+  // fast path: appending
+  if (points.empty() || points.back().time < point.time) {
+    points.push_back(point);
+    return;
+  }
+  
+  pointIterator_t it = std::lower_bound(points.begin(), points.end(), point.time, pointIsBeforeTime);
+  if (it != points.end() && it->time == point.time) {
+    *it = point;
+  }
+  else {
+    points.insert(it, point);
+  }
+}
+
+void VectorPointRecord::addPoints(const string& identifier, const std::vector<Point>& points) {
+  SeriesPointer series = seriesForName(identifier);
+  if (!series || points.empty()) {
+    return;
+  }
+  
+  // get the batch sorted and unique before taking the lock. stable, so the last of any duplicates wins.
+  std::vector<Point> scratch;
+  const std::vector<Point>& ordered = orderedPoints(points, scratch);
+  if (&ordered == &scratch) {
+    std::vector<Point>::size_type kept = 0;
+    for (std::vector<Point>::size_type i = 0; i < scratch.size(); ++i) {
+      if (kept > 0 && scratch[kept - 1].time == scratch[i].time) {
+        scratch[kept - 1] = scratch[i];
+      }
+      else {
+        scratch[kept++] = scratch[i];
+      }
+    }
+    scratch.resize(kept);
+  }
+  
+  writeLock_t seriesLock(series->mutex);
+  mergePoints(series->points, ordered);
+}
+
+void VectorPointRecord::mergePoints(std::vector<Point>& points, const std::vector<Point>& incoming) {
+  // fast path: the whole batch goes on the end
+  if (points.empty() || points.back().time < incoming.front().time) {
+    points.insert(points.end(), incoming.begin(), incoming.end());
+    return;
+  }
+  
+  // only the overlapping tail of the existing series takes part in the merge.
+  pointIterator_t overlap = std::lower_bound(points.begin(), points.end(), incoming.front().time, pointIsBeforeTime);
+  std::vector<Point> merged;
+  merged.reserve((points.end() - overlap) + incoming.size());
+  
+  pointIterator_t existingIt = overlap;
+  std::vector<Point>::const_iterator incomingIt = incoming.begin();
+  while (existingIt != points.end() && incomingIt != incoming.end()) {
+    if (existingIt->time < incomingIt->time) {
+      merged.push_back(*existingIt++);
+    }
+    else {
+      if (existingIt->time == incomingIt->time) {
+        ++existingIt; // replaced
+      }
+      merged.push_back(*incomingIt++);
+    }
+  }
+  merged.insert(merged.end(), existingIt, points.end());
+  merged.insert(merged.end(), incomingIt, incoming.end());
+  
+  points.erase(overlap, points.end());
+  points.insert(points.end(), merged.begin(), merged.end());
+}
+
+
+#pragma mark - Reset
+
+void VectorPointRecord::reset() {
+  typedef std::map<std::string, SeriesPointer>::value_type& seriesMapValue_t;
+  readLock_t registryLock(_registryMutex);
+  BOOST_FOREACH(seriesMapValue_t entry, _series) {
+    writeLock_t seriesLock(entry.second->mutex);
+    std::vector<Point>().swap(entry.second->points);
+  }
+}
+
+void VectorPointRecord::reset(const string& identifier) {
+  SeriesPointer series = seriesForName(identifier);
+  if (series) {
+    writeLock_t seriesLock(series->mutex);
+    std::vector<Point>().swap(series->points);
+  }
+}
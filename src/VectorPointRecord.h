@@ -0,0 +1,89 @@
+//
+//  VectorPointRecord.h
+//  epanet-rtx
+//
+//  Created by the EPANET-RTX Development Team
+//  See README.md and license.txt for more information
+//
+
+#ifndef epanet_rtx_VectorPointRecord_h
+#define epanet_rtx_VectorPointRecord_h
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Point.h"
+#include "rtxMacros.h"
+#include "PointRecord.h"
+
+#include <boost/thread/shared_mutex.hpp>
+
+namespace RTX {
+
+  /*!
+   \class VectorPointRecord
+   \brief An in-memory PointRecord that keeps each series in a flat, time-sorted vector.
+
+   A drop-in alternative to MapPointRecord: same keep-everything, last-write-wins semantics, but points live in
+   contiguous storage instead of one tree node apiece. Lookups are binary searches, range reads are a single
+   contiguous copy, and bulk loads cost an append (for in-order data) or one merge pass (for out-of-order batches).
+   */
+
+  /*!
+   \fn void VectorPointRecord::addPoints(const string& identifier, const std::vector<Point>& points)
+   \brief Add a batch of points to a series.
+   \param identifier The name of the data source (tag name).
+   \param points The points to add, in any order.
+
+   Points with the same time as an existing point replace it. If several points in the batch share a time, the
+   last one wins.
+   */
+
+  class VectorPointRecord : public PointRecord {
+  public:
+    RTX_SHARED_POINTER(VectorPointRecord);
+    VectorPointRecord();
+    virtual ~VectorPointRecord() {};
+
+    virtual std::string registerAndGetIdentifier(std::string recordName);
+    virtual std::vector<std::string> identifiers();
+
+    virtual Point point(const string& identifier, time_t time);
+    virtual Point pointBefore(const string& identifier, time_t time);
+    virtual Point pointAfter(const string& identifier, time_t time);
+    virtual std::vector<Point> pointsInRange(const string& identifier, time_t startTime, time_t endTime);
+    virtual void visitPointsInRange(const string& identifier, time_t startTime, time_t endTime, PointVisitor& visitor);
+    virtual void addPoint(const string& identifier, Point point);
+    virtual void addPoints(const string& identifier, const std::vector<Point>& points);
+    virtual void reset();
+    virtual void reset(const string& identifier);
+    virtual Point firstPoint(const string& id);
+    virtual Point lastPoint(const string& id);
+    virtual time_pair_t range(const string& id);
+
+    size_t pointCount(const std::string& identifier);
+    virtual size_t seriesMemoryFootprint(const std::string& identifier);
+
+    virtual std::ostream& toStream(std::ostream &stream);
+
+  private:
+    class Series {
+    public:
+      std::vector<Point> points;
+      boost::shared_mutex mutex;
+    };
+    typedef boost::shared_ptr<Series> SeriesPointer;
+
+    SeriesPointer seriesForName(const std::string& identifier);
+    static void mergePoints(std::vector<Point>& points, const std::vector<Point>& incoming); // caller holds the write lock
+
+    std::map<std::string, SeriesPointer> _series;
+    boost::shared_mutex _registryMutex;
+  };
+
+  std::ostream& operator<< (std::ostream &out, VectorPointRecord &pr);
+
+}
+
+#endif
@@ -7,13 +7,16 @@
 //  
 
 #include "Zone.h"
+#include "Log.h"
+#include <tr1/unordered_set>
 #include <boost/foreach.hpp>
 
 using namespace RTX;
 using namespace std;
 
-Zone::Zone(const std::string& name) : Element(name), _flowUnits(1) {
+Zone::Zone(const std::string& name) : Element(name), _flowUnits(1), _allocationUnits(1) {
   this->setType(ZONE);
+  _hasAllocation = false;
   _flowUnits = RTX_LITER_PER_SECOND;
   // set to aggregator type because that's the most likely scenario.
   // presumably, we will use Zone::enumerateJunctionsWithRootNode to populate the aggregation.
@@ -33,86 +36,102 @@ void Zone::setRecord(PointRecord::sharedPointer record) {
 
 void Zone::setJunctionFlowUnits(RTX::Units units) {
   _flowUnits = units;
+  resetAllocation();
 }
 
 void Zone::addJunction(Junction::sharedPointer junction) {
   if (_junctions.find(junction->name()) != _junctions.end()) {
-    cerr << "err: junction already exists" << endl;
+    RTX_LOG(warning, "Zone", "junction already exists");
   }
   else {
     _junctions[junction->name()] = junction;
+    resetAllocation();
   }
 }
 
+namespace {
+  // one junction on the enumeration's stack: its links, and the next of them to follow
+  class Frame {
+  public:
+    Junction::sharedPointer junction;
+    std::vector<Link::sharedPointer> links;
+    size_t next;
+  };
+}
+
 void Zone::enumerateJunctionsWithRootNode(Junction::sharedPointer junction) {
   
-  cout << "==========" << endl;
-  cout << "Zone " << name() << " : enumerating junctions" << endl;
-  this->followJunction(junction);
+  RTX_LOG(debug, "Zone", name() << ": enumerating junctions");
   
-}
+  // depth-first, with the stack kept here rather than on the call stack -- a large zone goes thousands of junctions
+  // deep.
+  typedef std::pair<TimeSeries::sharedPointer, double> source_t;
+  std::vector<source_t> sources;   // the zone's demand terms, added to its aggregator once the zone is walked
+  std::tr1::unordered_set<Junction*> visited;
+  std::vector<Frame> stack;
 
-void Zone::followJunction(Junction::sharedPointer junction) {
-  // don't let us add the same junction twice.
   if (!junction || find(junction->name())) {
     return;
   }
   
-  cout << "adding junction " << junction->name() << std::endl;
-  // perform dfs
-  // add the junction to my list
-  addJunction(junction);
-  
+  Frame root;
+  root.junction = junction;
+  stack.push_back(root);
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    if (visited.insert(frame.junction.get()).second) {
+      // first visit: add the junction to my list, and take in its links
+      addJunction(frame.junction);
+      frame.links = frame.junction->links();
+      frame.next = 0;
   // see if the junction is a tank -- if so, add in the tank's flowrate.
-  if (junction->type() == Element::TANK) {
-    Tank::sharedPointer thisTank = boost::static_pointer_cast<Tank>(junction);
-    TimeSeries::sharedPointer flow = thisTank->flowMeasure();
-    
+      if (frame.junction->type() == Element::TANK) {
+        Tank::sharedPointer thisTank = boost::static_pointer_cast<Tank>(frame.junction);
     // flow is positive into the tank (out of the zone), so its sign for demand aggregation purposes should be negative.
-    AggregatorTimeSeries::sharedPointer zoneDemand = boost::static_pointer_cast<AggregatorTimeSeries>(this->demand());
-    cout << "zone " << this->name() << " : adding tank source : " << flow->name() << endl;
-    zoneDemand->addSource(flow, -1.);
+        sources.push_back(source_t(thisTank->flowMeasure(), -1.));
+      }
   }
   
+    if (frame.next >= frame.links.size()) {
+      stack.pop_back();
+      continue;
+    }
   
-  // for each link connected to the junction, follow it and add its junctions
-  BOOST_FOREACH(Link::sharedPointer link, junction->links()) {
-    cout << "... examining pipe " << link->name() << endl;
-    Pipe::sharedPointer pipe = boost::static_pointer_cast<Pipe>(link);
-    
+    // follow the next link connected to the junction
+    Pipe::sharedPointer pipe = boost::static_pointer_cast<Pipe>(frame.links[frame.next++]);
     // get the link direction. into the zone is positive.
-    bool directionIsOut = (junction == pipe->from());
-    
+    bool directionIsOut = (frame.junction == pipe->from());
     // sanity
-    if (!directionIsOut && junction != pipe->to()) {
-      cerr << "Could not resolve start/end node(s) for pipe: " << pipe->name() << endl;
+    if (!directionIsOut && frame.junction != pipe->to()) {
+      RTX_LOG(warning, "Zone", "Could not resolve start/end node(s) for pipe: " << pipe->name());
       continue;
     }
     
-    // make sure we can follow this link,
-    // then get this link's nodes
     if ( !(pipe->doesHaveFlowMeasure()) ) {
-      // follow each of the link's nodes.
-      if (directionIsOut) {
-        followJunction(boost::static_pointer_cast<Junction>( pipe->to() ) );
-      }
-      else {
-        followJunction(boost::static_pointer_cast<Junction>( pipe->from() ) );
+      // follow the link to its other node, unless that's been here already
+      Junction::sharedPointer otherJunction = boost::static_pointer_cast<Junction>( directionIsOut ? pipe->to() : pipe->from() );
+      if (otherJunction && visited.count(otherJunction.get()) == 0 && !find(otherJunction->name())) {
+        Frame child;
+        child.junction = otherJunction;
+        stack.push_back(child); // frame is no longer valid past here
       }
     }
     else {
       // we have found a measurement.
       // add it to the control volume calculation.
-      double direction = (directionIsOut? -1. : 1.);
-      AggregatorTimeSeries::sharedPointer zoneDemand = boost::static_pointer_cast<AggregatorTimeSeries>(this->demand());
-      if (!zoneDemand) {
-        cerr << "zone time series wrong type: " << *(this->demand()) << endl;
-      }
-      cout << "zone " << this->name() << " : adding source " << pipe->flowMeasure()->name() << endl;
-      zoneDemand->addSource(pipe->flowMeasure(), direction);
+      sources.push_back(source_t(pipe->flowMeasure(), (directionIsOut? -1. : 1.)));
     }
   }
   
+  AggregatorTimeSeries::sharedPointer zoneDemand = boost::dynamic_pointer_cast<AggregatorTimeSeries>(this->demand());
+  if (!zoneDemand) {
+    RTX_LOG(warning, "Zone", "zone time series wrong type: " << *(this->demand()));
+    return;
+  }
+  BOOST_FOREACH(const source_t& source, sources) {
+    RTX_LOG(debug, "Zone", this->name() << ": adding source " << source.first->name());
+    zoneDemand->addSource(source.first, source.second);
+  }
 }
 
 Junction::sharedPointer Zone::find(std::string name) {
@@ -134,6 +153,7 @@ std::vector<Junction::sharedPointer> Zone::junctions() {
 
 void Zone::setDemand(TimeSeries::sharedPointer demand) {
   _demand = demand;
+  resetAllocation();
 }
 
 TimeSeries::sharedPointer Zone::demand() {
@@ -141,69 +161,62 @@ TimeSeries::sharedPointer Zone::demand() {
 }
 
 void Zone::allocateDemandToJunctions(time_t time) {
-  // get each node's base demand for the current time
-  // add the base demands together. this is the total base demand.
-  // get the input demand value for the current time - from the demand() method
-  // compute the global scaling factor
-  // apply this to each base demand
-  // add each scaled base demand to the appropriate node's demand pattern.
-  
-  typedef std::map< std::string, Junction::sharedPointer > JunctionMapType;
-  double totalBaseDemand = 0;
-  double zoneDemand = 0;
-  double allocableDemand = 0;
-  double meteredDemand = 0;
-  
+  // the zone's demand, less what its metered junctions account for, is shared out to the rest by base demand.
   Units myUnits = demand()->units();
-  Units modelUnits = _flowUnits;
-  
-  
-  // if the junction has a boundary flow condition, add it to the "known" demand pool.
-  // otherwise, add the nominal base demand to the totalBaseDemand pool.
-  BOOST_FOREACH(JunctionMapType::value_type& junctionPair, _junctions) {
-    Junction::sharedPointer junction = junctionPair.second;
-    
-    if ( junction->doesHaveBoundaryFlow() ) {
-      double demand = Units::convertValue(junction->boundaryFlow()->point(time).value, junction->boundaryFlow()->units(), myUnits);
-      meteredDemand += demand;
-    }
-    else {
-      double demand = Units::convertValue(junction->baseDemand(), modelUnits, myUnits);
-      totalBaseDemand += demand;
-    }
+  if (!_hasAllocation || !(_allocationUnits == myUnits)) {
+    computeAllocation();
+  }
     
+  // metered junctions: the boundary flow is known demand, and just gets copied into the junction's demand series
+  double meteredDemand = 0;
+  BOOST_FOREACH(const Junction::sharedPointer& junction, _meteredJunctions) {
+    TimeSeries::sharedPointer boundaryFlow = junction->boundaryFlow();
+    Point demandPoint = boundaryFlow->point(time);
+    meteredDemand += Units::convertValue(demandPoint.value, boundaryFlow->units(), myUnits);
+    junction->demand()->insert( Point::convertPoint(demandPoint, boundaryFlow->units(), junction->demand()->units()) );
   }
   
-  // now we have the total (nominal) base demand for the zone.
   // total demand for the zone (includes metered and unmetered) -- already in myUnits.
-  zoneDemand = this->demand()->point(time).value;
-  allocableDemand = zoneDemand - meteredDemand; // the total unmetered demand
+  double allocableDemand = this->demand()->point(time).value - meteredDemand;
   
-  cout << "-------------------" << endl;
-  cout << "time: " << time << endl;
-  cout << "zone demand: " << zoneDemand << endl;
-  cout << "metered demand: " << meteredDemand << endl;
-  cout << "allocable demand: " << allocableDemand << endl;
+  // set the demand values for unmetered junctions, according to their shares.
+  for (size_t i = 0; i < _allocatedJunctions.size(); ++i) {
+    _allocatedJunctions[i]->demand()->insert( Point(time, _allocationWeights[i] * allocableDemand) );
+  }
+}
   
-  // set the demand values for unmetered junctions, according to their base demands.
+void Zone::resetAllocation() {
+  _hasAllocation = false;
+}
+
+// sort the junctions into metered and allocated ones, and find each allocated junction's share of the unmetered
+// demand -- its base demand over the total, with the conversion from zone units to its own demand units folded in.
+void Zone::computeAllocation() {
+  typedef std::map< std::string, Junction::sharedPointer > JunctionMapType;
+  Units myUnits = demand()->units();
+  double totalBaseDemand = 0;
+  
+  _meteredJunctions.clear();
+  _allocatedJunctions.clear();
+  _allocationWeights.clear();
   BOOST_FOREACH(JunctionMapType::value_type& junctionPair, _junctions) {
     Junction::sharedPointer junction = junctionPair.second;
-    if (junction->doesHaveBoundaryFlow()) {
-      // junction does have boundary flow...
-      // just need to copy the boundary flow into the junction's demand time series
-      Point demandPoint = junction->boundaryFlow()->point(time);
-      junction->demand()->insert( Point::convertPoint(demandPoint, junction->boundaryFlow()->units(), junction->demand()->units()) );
+    if ( junction->doesHaveBoundaryFlow() ) {
+      _meteredJunctions.push_back(junction);
     }
     else {
-      // junction relies on us to set its demand value...
-      double baseDemand = Units::convertValue(junction->baseDemand(), modelUnits, myUnits);
-      double newDemand = baseDemand * ( allocableDemand / totalBaseDemand );
-      Point demandPoint(time, newDemand);
-      junction->demand()->insert( Point::convertPoint(demandPoint, myUnits, junction->demand()->units()) );
+      double baseDemand = Units::convertValue(junction->baseDemand(), _flowUnits, myUnits);
+      totalBaseDemand += baseDemand;
+      _allocatedJunctions.push_back(junction);
+      _allocationWeights.push_back(baseDemand);
     }
   }
   
+  for (size_t i = 0; i < _allocatedJunctions.size(); ++i) {
+    double toJunctionUnits = Units::convertValue(1., myUnits, _allocatedJunctions[i]->demand()->units());
+    _allocationWeights[i] *= toJunctionUnits / totalBaseDemand;
+  }
   
-  
+  _allocationUnits = myUnits;
+  _hasAllocation = true;
 }
-
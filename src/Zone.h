@@ -37,7 +37,7 @@ namespace RTX {
    \fn void Zone::enumerateJunctionsWithRootNode(Junction::sharedPointer junction)
    \brief Add a group of junctions to a Zone.
    
-   Uses graph connectivity to enumerate the junctions in a zone starting with the passed Junction pointer. The enumeration uses a depth-first search to follow Pipe elements, and stops at links which return true to the doesHaveFlowMeasure() method.
+   Uses graph connectivity to enumerate the junctions in a zone starting with the passed Junction pointer. The enumeration uses a depth-first search to follow Pipe elements, and stops at links which return true to the doesHaveFlowMeasure() method. The search keeps its own stack, so a zone can be any number of junctions deep.
    
    \param junction A single junction within the intended zone.
    \sa Junction Pipe
@@ -52,8 +52,17 @@ namespace RTX {
    
    \fn virtual void Zone::allocateDemandToJunctions(time_t time)
    \brief Allocate demand from the Zone's demand TimeSeries to the constituent junctions.
+   
+   The demand left once metered junctions' boundary flows are taken out is shared among the other junctions in
+   proportion to their base demands. Those shares are worked out on first use, and again whenever junctions are
+   added or units change.
+   
    \param time The time frame for which to perform the allocation.
    \sa TimeSeries Junction
+   
+   
+   \fn void Zone::resetAllocation()
+   \brief Work the allocation shares out again at the next allocation -- after changing member junctions' base demands or boundary flows.
    */
   
   
@@ -78,13 +87,19 @@ namespace RTX {
     
     // business logic
     virtual void allocateDemandToJunctions(time_t time);
+    void resetAllocation();
     
   private:
-    void followJunction(Junction::sharedPointer junction);
+    void computeAllocation();
     std::map< std::string, Junction::sharedPointer> _junctions;
     std::vector<Pipe::sharedPointer> _boundaryPipes;
     TimeSeries::sharedPointer _demand;
     Units _flowUnits;
+    // allocation shares (see allocateDemandToJunctions), for the zone demand's units at the time
+    bool _hasAllocation;
+    Units _allocationUnits;
+    std::vector<Junction::sharedPointer> _meteredJunctions, _allocatedJunctions;
+    std::vector<double> _allocationWeights; // share of the unmetered demand, in each junction's demand units
   };
 }
 
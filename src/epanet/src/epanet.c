@@ -79,6 +79,9 @@ This module calls the following functions that reside in other modules:
      runhyd()
      nexthyd()
      closehyd()
+     indexcontrols()
+     demandresponse()
+     demandsolve()
      resistance()
      tankvolume()
      getenergy()
@@ -139,11 +142,11 @@ execute function x and set the error code equal to its return value.
 #include "types.h"
 #include "enumstxt.h"
 #include "funcs.h"
-#define  EXTERN
+#define  EXTERN  EN_THREAD
 #include "vars.h"
 #include "toolkit.h"
 
-void (* viewprog) (char *);     /* Pointer to progress viewing function */   
+EN_THREAD void (* viewprog) (char *);     /* Pointer to progress viewing function */   
 
 
 /*
@@ -313,9 +316,15 @@ int DLLEXPORT ENopen(char *f1, char *f2, char *f3)
    ERRCODE(getdata());
 
 /* Free temporary linked lists used for Patterns & Curves */
-   freeTmplist(Patlist);
-   freeTmplist(Curvelist);
-   freeTmplist(Coordlist); //06.02.2010 woohn
+   freeTmplist(Patlist,Patht);
+   freeTmplist(Curvelist,Curveht);
+   freeTmplist(Coordlist,Coordht); //06.02.2010 woohn
+   Patht = NULL;
+   Curveht = NULL;
+   Coordht = NULL;
+
+/* Release the image of the input file */
+   closeinput();
 
 /* If using previously saved hydraulics then open its file */
    if (Hydflag == USE) ERRCODE(openhydfile());          
@@ -365,9 +374,11 @@ int DLLEXPORT ENclose()
    }                                                                           //(2.00.12 - LR)
 
    if (InFile  != NULL) fclose(InFile);
-   if (RptFile != NULL) fclose(RptFile);
+   if (RptFile != NULL && RptFile != stdout) fclose(RptFile);
    if (HydFile != NULL) fclose(HydFile);
    if (OutFile != NULL) fclose(OutFile);
+   free(HydBuf);
+   HydBuf = NULL;
   
    if (Hydflag == SCRATCH) remove(HydFname);                                   //(2.00.12 - LR)
    if (Outflag == SCRATCH) remove(OutFname);                                   //(2.00.12 - LR)
@@ -477,6 +488,37 @@ int DLLEXPORT ENsaveH()
 }
 
 
+int DLLEXPORT ENsethydassembly(int threads, int fastpow)
+/*----------------------------------------------------------------
+**  Input:   threads = number of threads to assemble the
+**                     hydraulic equations with
+**           fastpow = 1 to raise pipe flows & emitter flows to
+**                     their exponents with a faster, near-exact
+**                     power function, 0 to use pow()
+**  Output:  none
+**  Returns: error code
+**  Purpose: shares the computation of each hydraulic trial's
+**           link & emitter coefficients, and of its flow
+**           changes, among several threads
+**
+**  The coefficients are added into the matrix, and the flow
+**  changes summed, in the same order as on one thread, so with
+**  exact powers the results don't depend on the number of
+**  threads. Fast powers are within a relative error of 1e-13
+**  of pow(). Networks too small to gain from more threads, and
+**  builds without POSIX threads, stay on one. Takes effect
+**  from the next hydraulic solution.
+**----------------------------------------------------------------
+*/
+{
+   if (!Openflag) return(102);
+   if (threads < 1) return(202);
+   HydThreads = threads;
+   Fastpowflag = (char)(fastpow != 0);
+   return(0);
+}
+
+
 int DLLEXPORT ENopenH()
 /*----------------------------------------------------------------
 **  Input:   none                   
@@ -667,6 +709,209 @@ int DLLEXPORT ENusehydfile(char *filename)
 }
 
 
+int DLLEXPORT ENusesparsefile(char *filename)
+/*----------------------------------------------------------------
+**  Input:   filename = name of file, or "" for none
+**  Output:  none 
+**  Returns: error code
+**  Purpose: keeps the node ordering and factor structure of the
+**           hydraulic solution matrix in a file, so that opening
+**           the hydraulics system for the same network again
+**           reads them instead of working them out
+**----------------------------------------------------------------
+*/
+{
+/* Check that input data exists & hydraulics system closed */
+   if (!Openflag) return(102);
+   if (OpenHflag) return(108);
+
+   strncpy(SparseFname, filename, MAXFNAME);
+   return(0);
+}
+
+
+int DLLEXPORT ENsethydbuffer(int records)
+/*----------------------------------------------------------------
+**  Input:   records = number of hydraulic solutions to keep in
+**                     memory, or 0 for a scratch file
+**  Output:  none 
+**  Returns: error code
+**  Purpose: hands hydraulic results to the WQ solver in memory
+**           rather than through a scratch hydraulics file
+**
+**  With a buffer, the WQ solver keeps its own copy of the
+**  hydraulic state, so it can also run alongside the hydraulic
+**  solver (ENrunH, ENrunQ, ENnextH, ENnextQ, ...), reading each
+**  solution once ENnextH has saved it. The hydraulics can only
+**  get as many solutions ahead as the buffer holds (error 308).
+**  Takes effect from the next ENinitH() that saves results.
+**----------------------------------------------------------------
+*/
+{
+   if (!Openflag) return(102);
+   if (OpenQflag || (OpenHflag && Saveflag)) return(108);
+   if (records < 0) return(202);
+   HydBuffer = records;
+   free(HydBuf);
+   HydBuf = NULL;
+   return(0);
+}
+
+
+int DLLEXPORT ENgethydstatesize(int *size)
+/*----------------------------------------------------------------
+**  Input:   none
+**  Output:  *size = number of bytes in the hydraulic state
+**  Returns: error code
+**  Purpose: finds the size of buffer that ENsavehydstate() needs
+**----------------------------------------------------------------
+*/
+{
+   *size = 0;
+   if (!Openflag) return(102);
+   return(hydstate(NULL, TRUE, size));
+}
+
+
+int DLLEXPORT ENsavehydstate(char *state)
+/*----------------------------------------------------------------
+**  Input:   state = buffer of ENgethydstatesize() bytes
+**  Output:  none 
+**  Returns: error code
+**  Purpose: copies the state that the hydraulic solution carries
+**           from one period to the next (heads, tank volumes, link
+**           flows, status and settings) into the buffer
+**----------------------------------------------------------------
+*/
+{
+   int size;
+   if (!Openflag) return(102);
+   if (!OpenHflag) return(103);
+   return(hydstate(state, TRUE, &size));
+}
+
+
+int DLLEXPORT ENloadhydstate(char *state)
+/*----------------------------------------------------------------
+**  Input:   state = buffer filled by ENsavehydstate()
+**  Output:  none 
+**  Returns: error code
+**  Purpose: restores a hydraulic state saved by ENsavehydstate(),
+**           so that the next ENrunH() carries on from it
+**----------------------------------------------------------------
+*/
+{
+   int size;
+   if (!Openflag) return(102);
+   if (!OpenHflag) return(103);
+   return(hydstate(state, FALSE, &size));
+}
+
+
+int DLLEXPORT ENgetdemandresponse(int sets, int count, int *nodes,
+                                  double *changes, double *headchanges,
+                                  double *flowchanges)
+/*----------------------------------------------------------------
+**  Input:   sets    = number of sets of demand changes
+**           count   = number of junctions in each set
+**           nodes   = junction indexes, nodes[s*count+c] for the
+**                     c-th junction of the s-th set
+**           changes = demand changes, changes[s*count+c] for the
+**                     same junction
+**  Output:  headchanges[s*Nnodes+i-1] = change in head at node i,
+**           flowchanges[s*Nlinks+k-1] = change in flow in link k,
+**           for the s-th set (closed links don't change)
+**  Returns: error code
+**  Purpose: finds how the current hydraulic solution responds,
+**           to first order, to each set of demand changes
+**
+**  All of the sets share one factorization of the equations of
+**  the current solution, so many of them (a unit change at each
+**  junction in turn, say) cost little more than one.
+**----------------------------------------------------------------
+*/
+{
+   int    i, k, errcode;
+   double *d;
+
+   if (!Openflag) return(102);
+   if (!OpenHflag) return(103);
+   if (sets < 0 || count < 0) return(202);
+   for (i = 0; i < sets*count; i++)
+   {
+      if (nodes[i] <= 0 || nodes[i] > Njuncs) return(203);
+   }
+   if (sets == 0) return(0);
+
+   d = (double *) calloc(sets*count+1, sizeof(double));
+   if (d == NULL) return(101);
+   for (i = 0; i < sets*count; i++) d[i] = changes[i]/Ucf[FLOW];
+   errcode = demandresponse(sets, count, nodes, d, headchanges, flowchanges);
+   free(d);
+   if (errcode) return(errcode);
+
+   for (i = 0; i < sets*Nnodes; i++) headchanges[i] *= Ucf[HEAD];
+   for (i = 0; i < sets*Nlinks; i++)
+   {
+      k = i%Nlinks + 1;
+      flowchanges[i] = (S[k] <= CLOSED) ? 0.0 : flowchanges[i]*Ucf[FLOW];
+   }
+   return(0);
+}
+
+
+int DLLEXPORT ENsolvedemandchange(int count, int *nodes, double *changes,
+                                  double *flowguess, double *heads,
+                                  double *flows, int *iterations)
+/*----------------------------------------------------------------
+**  Input:   count     = number of junctions with changed demands
+**           nodes     = the junctions' indexes
+**           changes   = the change in demand at each of them
+**           flowguess = estimated change in each link's flow, to
+**                       start from (see ENgetdemandresponse()),
+**                       or NULL to start from the current flows
+**  Output:  heads[i-1] = head at node i, flows[k-1] = flow in
+**           link k, with the changed demands
+**           *iterations = trials taken to reach the solution
+**  Returns: error code
+**  Purpose: re-solves the current time period's hydraulics with
+**           changed demands, leaving the current solution as it
+**           was (so ENnextH() carries on from it)
+**----------------------------------------------------------------
+*/
+{
+   int    i, errcode;
+   double *d, *dq = NULL, relerr;
+
+   *iterations = 0;
+   if (!Openflag) return(102);
+   if (!OpenHflag) return(103);
+   if (count < 0) return(202);
+   for (i = 0; i < count; i++)
+   {
+      if (nodes[i] <= 0 || nodes[i] > Njuncs) return(203);
+   }
+
+   d = (double *) calloc(count+1, sizeof(double));
+   if (flowguess != NULL) dq = (double *) calloc(Nlinks+1, sizeof(double));
+   if (d == NULL || (flowguess != NULL && dq == NULL))
+   {
+      free(d);
+      free(dq);
+      return(101);
+   }
+   for (i = 0; i < count; i++) d[i] = changes[i]/Ucf[FLOW];
+   if (dq != NULL) for (i = 0; i < Nlinks; i++) dq[i] = flowguess[i]/Ucf[FLOW];
+   errcode = demandsolve(count, nodes, d, dq, heads, flows, iterations, &relerr);
+   free(d);
+   free(dq);
+
+   for (i = 0; i < Nnodes; i++) heads[i] *= Ucf[HEAD];
+   for (i = 0; i < Nlinks; i++) flows[i] *= Ucf[FLOW];
+   return(errcode);
+}
+
+
 /*
 ----------------------------------------------------------------
    Functions for running a WQ analysis
@@ -736,6 +981,31 @@ int DLLEXPORT ENsolveQ()
 }
 
 
+int DLLEXPORT ENsetqualthreads(int threads)
+/*----------------------------------------------------------------
+**  Input:   threads = number of threads to transport WQ with
+**  Output:  none
+**  Returns: error code
+**  Purpose: shares the WQ solver's transport of constituents
+**           through the network among several threads
+**
+**  Each thread moves and reacts the water in its own share of
+**  the links, and the inflows mixed at each node are summed in
+**  the same order as on one thread, so results don't depend on
+**  the number of threads. Networks too small to gain from it,
+**  and builds without POSIX threads, stay on one thread. Takes
+**  effect from the next ENopenQ().
+**----------------------------------------------------------------
+*/
+{
+   if (!Openflag) return(102);
+   if (OpenQflag) return(108);
+   if (threads < 1) return(202);
+   QualThreads = threads;
+   return(0);
+}
+
+
 int DLLEXPORT ENopenQ()
 /*----------------------------------------------------------------
 **  Input:   none                    
@@ -751,10 +1021,16 @@ int DLLEXPORT ENopenQ()
    OpenQflag = FALSE;
    SaveQflag = FALSE;
    if (!Openflag) return(102);
-   if (!SaveHflag) return(104);
+   if (!SaveHflag && HydBuf == NULL) return(104);
 
-/* Open WQ solver */
-   ERRCODE(openqual());
+/* Open WQ solver (with its own hydraulics if they come from memory) */
+   ERRCODE(openqualhyd());
+   if (!errcode)
+   {
+      swapqualhyd();
+      errcode = openqual();
+      swapqualhyd();
+   }
    if (!errcode) OpenQflag = TRUE;
    else errmsg(errcode);
    return(errcode);
@@ -773,6 +1049,7 @@ int DLLEXPORT ENinitQ(int saveflag)
 {
    int errcode = 0;
    if (!OpenQflag) return(105);
+   swapqualhyd();
    initqual();
    SaveQflag = FALSE;
    Saveflag = FALSE;
@@ -781,6 +1058,7 @@ int DLLEXPORT ENinitQ(int saveflag)
       errcode = openoutfile();
       if (!errcode) Saveflag = TRUE;
    }
+   swapqualhyd();
    return(errcode);
 }
 
@@ -801,7 +1079,9 @@ int DLLEXPORT ENrunQ(long *t)
    int errcode;
    *t = 0;
    if (!OpenQflag) return(105);
+   swapqualhyd();
    errcode = runqual(t);
+   swapqualhyd();
    if (errcode) errmsg(errcode);
    return(errcode);
 }
@@ -824,8 +1104,10 @@ int DLLEXPORT ENnextQ(long *tstep)
    int errcode;
    *tstep = 0;
    if (!OpenQflag) return(105);
+   swapqualhyd();
    errcode = nextqual(tstep);
    if (!errcode && Saveflag && *tstep == 0) SaveQflag = TRUE;
+   swapqualhyd();
    if (errcode) errmsg(errcode);
    return(errcode);
 }
@@ -846,8 +1128,10 @@ int DLLEXPORT ENstepQ(long *tleft)
    int errcode;
    *tleft = 0;
    if (!OpenQflag) return(105);
+   swapqualhyd();
    errcode = stepqual(tleft);
    if (!errcode && Saveflag && *tleft == 0) SaveQflag = TRUE;
+   swapqualhyd();
    if (errcode) errmsg(errcode);
    return(errcode);
 }
@@ -863,7 +1147,10 @@ int DLLEXPORT ENcloseQ()
 */
 {
    if (!Openflag) return(102);
+   swapqualhyd();
    closequal();
+   swapqualhyd();
+   closequalhyd();
    OpenQflag = FALSE;
    return(0);
 }
@@ -1074,6 +1361,18 @@ int  DLLEXPORT ENgetoption(int code, double *value)
                           break;
       case EN_DEMANDMULT: v = Dmult;
                           break;
+      case EN_STARTMODE:  v = (Warmflag) ? EN_WARMSTART : EN_COLDSTART;
+                          break;
+      case EN_GLOBALEFFIC: v = Epump;
+                          break;
+      case EN_GLOBALPRICE: v = Ecost;
+                          break;
+      case EN_GLOBALPATTERN: v = (double)Epat;
+                          break;
+      case EN_DEMANDCHARGE: v = Dcost;
+                          break;
+      case EN_SPECGRAVITY: v = SpGrav;
+                          break;
       default:            return(251);
    }
    *value = v;
@@ -1269,6 +1568,18 @@ int  DLLEXPORT ENgetstatistic(int code, int* value)
     case EN_RELATIVEERROR:
       *value = _relativeError;
       break;
+    case EN_LINSOLVETIME:
+      *value = _linsolveTime;
+      break;
+    case EN_POOLBYTES:
+      *value = (int)qualpoolbytes(FALSE);
+      break;
+    case EN_PEAKPOOLBYTES:
+      *value = (int)qualpoolbytes(TRUE);
+      break;
+    case EN_MATRIXBYTES:
+      *value = (int)matrixbytes();
+      break;
     default:
       break;
   }
@@ -1628,6 +1939,45 @@ int  DLLEXPORT ENgetcurve(int curveIndex, int *nValues, double **xValues, double
 }
 
 
+int  DLLEXPORT ENgetcurvelen(int curveIndex, int *len)
+/*----------------------------------------------------------------
+**  Input:   curveIndex = curve index
+**  Output:  *len = number of points on curve
+**  Returns: error code
+**  Purpose: retrieves number of points in a curve
+**----------------------------------------------------------------
+*/
+{
+   *len = 0;
+   if (!Openflag) return(102);
+   if (curveIndex < 1 || curveIndex > Ncurves) return(206);
+   *len = Curve[curveIndex].Npts;
+   return(0);
+}
+
+
+int  DLLEXPORT ENgetcurvevalue(int curveIndex, int pointIndex, double *x, double *y)
+/*----------------------------------------------------------------
+**  Input:   curveIndex = curve index
+**           pointIndex = point index, from 1
+**  Output:  *x, *y = the point, unscaled -- as the curve was input
+**  Returns: error code
+**  Purpose: retrieves one point of a curve (see ENgetcurve for
+**           a whole volume curve, scaled)
+**----------------------------------------------------------------
+*/
+{
+   *x = 0.0;
+   *y = 0.0;
+   if (!Openflag) return(102);
+   if (curveIndex < 1 || curveIndex > Ncurves) return(206);
+   if (pointIndex < 1 || pointIndex > Curve[curveIndex].Npts) return(251);
+   *x = Curve[curveIndex].X[pointIndex-1];
+   *y = Curve[curveIndex].Y[pointIndex-1];
+   return(0);
+}
+
+
 int  DLLEXPORT ENgetlinknodes(int index, int *node1, int *node2)
 /*----------------------------------------------------------------
 **  Input:   index = link index                    
@@ -1779,6 +2129,22 @@ int DLLEXPORT ENgetlinkvalue(int index, int code, double *value)
       case EN_ENERGY:
          getenergy(index, &v, &a);
          break;
+
+/* Pump energy data, as pumpenergy() uses it */
+      case EN_PUMP_ECURVE:
+         if (Link[index].Type != PUMP) return(251);
+         v = (double)Pump[PUMPINDEX(index)].Ecurve;
+         break;
+
+      case EN_PUMP_ECOST:
+         if (Link[index].Type != PUMP) return(251);
+         v = (Pump[PUMPINDEX(index)].Ecost > 0.0) ? Pump[PUMPINDEX(index)].Ecost : Ecost;
+         break;
+
+      case EN_PUMP_EPAT:
+         if (Link[index].Type != PUMP) return(251);
+         v = (double)Pump[PUMPINDEX(index)].Epat;
+         break;
          
       default: return(251);
    }
@@ -1787,6 +2153,106 @@ int DLLEXPORT ENgetlinkvalue(int index, int code, double *value)
 }
 
 
+int DLLEXPORT ENgetnodevalues(int code, int count, int *indexes, double *values)
+/*----------------------------------------------------------------
+**  Input:   code    = node parameter code (see TOOLKIT.H)
+**           count   = number of values
+**           indexes = node indexes, or NULL for every node in order
+**                     (count must then be the node count)
+**  Output:  values[i] = value of the parameter for the i-th node
+**  Returns: error code of the first node that fails
+**  Purpose: retrieves a parameter for many nodes at once  
+**----------------------------------------------------------------
+*/
+{
+   int i, index, errcode;
+
+   if (!Openflag) return(102);
+   if (indexes == NULL && count != Nnodes) return(202);
+   for (i = 0; i < count; i++)
+   {
+      index = (indexes == NULL) ? i+1 : indexes[i];
+      if (index <= 0 || index > Nnodes) return(203);
+   }
+
+/* Computed results are straight array reads, so skip the per-node switch */
+   switch (code)
+   {
+      case EN_DEMAND:
+         for (i = 0; i < count; i++)
+            values[i] = D[(indexes == NULL) ? i+1 : indexes[i]]*Ucf[FLOW];
+         return(0);
+
+      case EN_HEAD:
+         for (i = 0; i < count; i++)
+            values[i] = H[(indexes == NULL) ? i+1 : indexes[i]]*Ucf[HEAD];
+         return(0);
+
+      case EN_PRESSURE:
+         for (i = 0; i < count; i++)
+         {
+            index = (indexes == NULL) ? i+1 : indexes[i];
+            values[i] = (H[index] - Node[index].El)*Ucf[PRESSURE];
+         }
+         return(0);
+
+      case EN_QUALITY:
+         for (i = 0; i < count; i++)
+            values[i] = C[(indexes == NULL) ? i+1 : indexes[i]]*Ucf[QUALITY];
+         return(0);
+   }
+
+   for (i = 0; i < count; i++)
+   {
+      errcode = ENgetnodevalue((indexes == NULL) ? i+1 : indexes[i], code, &values[i]);
+      if (errcode) return(errcode);
+   }
+   return(0);
+}
+
+
+int DLLEXPORT ENgetlinkvalues(int code, int count, int *indexes, double *values)
+/*----------------------------------------------------------------
+**  Input:   code    = link parameter code (see TOOLKIT.H)
+**           count   = number of values
+**           indexes = link indexes, or NULL for every link in order
+**                     (count must then be the link count)
+**  Output:  values[i] = value of the parameter for the i-th link
+**  Returns: error code of the first link that fails
+**  Purpose: retrieves a parameter for many links at once  
+**----------------------------------------------------------------
+*/
+{
+   int i, index, errcode;
+
+   if (!Openflag) return(102);
+   if (indexes == NULL && count != Nlinks) return(202);
+   for (i = 0; i < count; i++)
+   {
+      index = (indexes == NULL) ? i+1 : indexes[i];
+      if (index <= 0 || index > Nlinks) return(204);
+   }
+
+/* Flow is a straight array read, so skip the per-link switch */
+   if (code == EN_FLOW)
+   {
+      for (i = 0; i < count; i++)
+      {
+         index = (indexes == NULL) ? i+1 : indexes[i];
+         values[i] = (S[index] <= CLOSED) ? 0.0 : Q[index]*Ucf[FLOW];
+      }
+      return(0);
+   }
+
+   for (i = 0; i < count; i++)
+   {
+      errcode = ENgetlinkvalue((indexes == NULL) ? i+1 : indexes[i], code, &values[i]);
+      if (errcode) return(errcode);
+   }
+   return(0);
+}
+
+
 /*
 ----------------------------------------------------------------
    Functions for changing network data 
@@ -1879,6 +2345,9 @@ int DLLEXPORT ENsetcontrol(int cindex, int ctype, int lindex,
    Control[cindex].Setting = s;
    Control[cindex].Grade = lvl;
    Control[cindex].Time = t;
+
+/* Regroup the controls if the hydraulics solver is using them */
+   if (OpenHflag) indexcontrols();
    return(0);
 }         
 
@@ -2205,12 +2674,73 @@ int DLLEXPORT ENsetlinkvalue(int index, int code, double v)
          }
          break;
 
+      /* Starting estimate of the flow for the next warm-started */
+      /* solution (a closed link's flow stays at zero)           */
+      case EN_FLOW:
+         if (!OpenHflag) return(103);
+         if (S[index] > CLOSED) Q[index] = value/Ucf[FLOW];
+         break;
+
       default: return(251);
    }
    return(0);
 }
 
 
+int DLLEXPORT ENsetnodevalues(int code, int count, int *indexes, double *values)
+/*----------------------------------------------------------------
+**  Input:   code    = node parameter code (see TOOLKIT.H)
+**           count   = number of values
+**           indexes = node indexes, or NULL for every node in order
+**                     (count must then be the node count)
+**           values[i] = new value of the parameter for the i-th node
+**  Output:  none
+**  Returns: error code of the first node that fails; the nodes
+**           before it have been set
+**  Purpose: sets a parameter for many nodes at once  
+**----------------------------------------------------------------
+*/
+{
+   int i, errcode;
+
+   if (!Openflag) return(102);
+   if (indexes == NULL && count != Nnodes) return(202);
+   for (i = 0; i < count; i++)
+   {
+      errcode = ENsetnodevalue((indexes == NULL) ? i+1 : indexes[i], code, values[i]);
+      if (errcode) return(errcode);
+   }
+   return(0);
+}
+
+
+int DLLEXPORT ENsetlinkvalues(int code, int count, int *indexes, double *values)
+/*----------------------------------------------------------------
+**  Input:   code    = link parameter code (see TOOLKIT.H)
+**           count   = number of values
+**           indexes = link indexes, or NULL for every link in order
+**                     (count must then be the link count)
+**           values[i] = new value of the parameter for the i-th link
+**  Output:  none
+**  Returns: error code of the first link that fails; the links
+**           before it have been set
+**  Purpose: sets a parameter for many links at once  
+**----------------------------------------------------------------
+*/
+{
+   int i, errcode;
+
+   if (!Openflag) return(102);
+   if (indexes == NULL && count != Nlinks) return(202);
+   for (i = 0; i < count; i++)
+   {
+      errcode = ENsetlinkvalue((indexes == NULL) ? i+1 : indexes[i], code, values[i]);
+      if (errcode) return(errcode);
+   }
+   return(0);
+}
+
+
 int  DLLEXPORT  ENaddpattern(char *id)
 /*----------------------------------------------------------------
 **   Input:   id = ID name of the new pattern
@@ -2422,6 +2952,10 @@ int  DLLEXPORT ENsetoption(int code, double v)
       case EN_DEMANDMULT: if (value <= 0.0) return(202);
                           Dmult = value;
                           break;
+      case EN_STARTMODE:  if (value == EN_WARMSTART) Warmflag = TRUE;
+                          else if (value == EN_COLDSTART) Warmflag = FALSE;
+                          else return(202);
+                          break;
       default:            return(251);
    }
    return(0);
@@ -2578,6 +3112,11 @@ int  openhydfile()
    INT4 version;
    int errcode = 0;
 
+/* Keep results in memory in place of a scratch file if asked to */
+   if (Hydflag == SCRATCH && HydBuffer > 0) return(openhydbuffer());
+   free(HydBuf);
+   HydBuf = NULL;
+
 /* If HydFile currently open, then close it if its not a scratch file */
    if (HydFile != NULL)
    {
@@ -2742,6 +3281,9 @@ void initpointers()
    Patlist  = NULL;
    Curvelist = NULL;
    Coordlist = NULL;	//06.02.2010 woohn
+   Patht    = NULL;
+   Curveht  = NULL;
+   Coordht  = NULL;
    Adjlist  = NULL;
    Aii      = NULL;
    Aij      = NULL;
@@ -2867,9 +3409,10 @@ int  allocdata()
 }                                       /* End of allocdata */
 
 
-void  freeTmplist(STmplist *t)
+void  freeTmplist(STmplist *t, HTtable *ht)
 /*----------------------------------------------------------------
 **  Input:   t = pointer to start of a temporary list
+**           ht = hash table of the list's IDs (or NULL)
 **  Output:  none
 **  Purpose: frees memory used for temporary storage
 **           of pattern & curve data
@@ -2877,6 +3420,7 @@ void  freeTmplist(STmplist *t)
 */
 {
    STmplist   *tnext;
+   if (ht != NULL) HTfree(ht);
    while (t != NULL)
    {
        tnext = t->next;
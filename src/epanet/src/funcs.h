@@ -27,7 +27,7 @@ AUTHOR:     L. Rossman
 */
 void    initpointers(void);               /* Initializes pointers       */
 int     allocdata(void);                  /* Allocates memory           */
-void    freeTmplist(STmplist *);          /* Frees items in linked list */
+void    freeTmplist(STmplist *,HTtable *);/* Frees items in linked list */
 void    freeFloatlist(SFloatlist *);      /* Frees list of floats       */
 void    freedata(void);                   /* Frees allocated memory     */
 int     openfiles(char *,char *,char *);  /* Opens input & report files */
@@ -63,7 +63,11 @@ int     addpattern(char *);               /* Adds pattern to data base  */
 int     addcurve(char *);                 /* Adds curve to data base    */
 int     addcoord(char *);                 /* Adds coord to data base    */ //06/02.2010-woohn
 
-STmplist *findID(char *, STmplist *);     /* Locates ID on linked list  */
+void    openinput(void);                  /* Makes image of input file  */
+char    *nextline(char *);                /* Reads line of input file   */
+void    rewindinput(void);                /* Rewinds input file         */
+void    closeinput(void);                 /* Frees image of input file  */
+STmplist *findID(char *, HTtable *);      /* Locates ID on linked list  */
 int     unlinked(void);                   /* Checks for unlinked nodes  */
 int     getpumpparams(void);              /* Computes pump curve coeffs.*/
 int     getpatterns(void);                /* Gets pattern data from list*/
@@ -72,6 +76,7 @@ int     getcoords(void);                  /* Gets coordinate data from list  */
 int     findmatch(char *,char *[]);       /* Finds keyword in line      */
 int     match(char *, char *);            /* Checks for word match      */
 int     gettokens(char *);                /* Tokenizes input line       */
+int     fastfloat(char *, double *);      /* Converts plain decimal     */
 int     getfloat(char *, double *);       /* Converts string to double   */
 double  hour(char *, char *);             /* Converts time to hours     */
 int     setreport(char *);                /* Processes reporting command*/
@@ -112,6 +117,9 @@ void    initrules(void);                  /* Initializes rule base      */
 void    addrule(char *);                  /* Adds rule to rule base     */
 int     allocrules(void);                 /* Allocates memory for rule  */
 int     ruledata(void);                   /* Processes rule input data  */
+int     openrules(void);                  /* Indexes rules' premises    */
+void    closerules(void);                 /* Frees rule index           */
+void    resetrules(void);                 /* Marks rules for evaluation */
 int     checkrules(long);                 /* Checks all rules           */
 void    freerules(void);                  /* Frees rule base memory     */  
 
@@ -149,6 +157,18 @@ void    inithyd(int);                     /* Re-sets initial conditions */
 int     runhyd(long *);                   /* Solves 1-period hydraulics */
 int     nexthyd(long *);                  /* Moves to next time period  */
 void    closehyd(void);                   /* Closes hydraulics solver   */
+int     opencontrols(void);               /* Allocates control index    */
+void    closecontrols(void);              /* Frees control index        */
+void    indexcontrols(void);              /* Groups controls by kind    */
+int     ctltimecmp(const void *,          /* Orders controls by time    */
+                   const void *);
+int     firstctl(int *, int, long);       /* Finds first control due    */
+int     ctlchanges(int);                  /* Checks if control acts     */
+int     hydstate(char *, int, int *);     /* Copies hydraulic state     */
+int     demandresponse(int, int, int *,   /* Response to demand changes */
+                       double *, double *, double *);
+int     demandsolve(int, int *, double *, /* Solves with demand changes */
+                    double *, double *, double *, int *, double *);
 int     allocmatrix(void);                /* Allocates matrix coeffs.   */
 void    freematrix(void);                 /* Frees matrix coeffs.       */
 void    initlinkflow(int, char, double);  /* Initializes link flow      */
@@ -170,6 +190,7 @@ void    tanklevels(long);                 /* Computes new tank levels   */
 double  tankvolume(int,double);           /* Finds tank vol. from grade */
 double  tankgrade(int,double);            /* Finds tank grade from vol. */
 int     netsolve(int *,double *);         /* Solves network equations   */
+double  walltime(void);                   /* Wall-clock seconds         */
 int     badvalve(int);                    /* Checks for bad valve       */
 int     valvestatus(void);                /* Updates valve status       */
 int     linkstatus(void);                 /* Updates link status        */
@@ -186,6 +207,9 @@ int     pswitch(void);                    /* Pressure switch controls   */
 double  newflows(void);                   /* Updates link flows         */
 void    newcoeffs(void);                  /* Computes matrix coeffs.    */
 void    linkcoeffs(void);                 /* Computes link coeffs.      */
+int     linkcoeff(int);                   /* Computes a link's coeffs.  */
+void    addlinkcoeff(int);                /* Adds them to matrix        */
+double  flowchange(int);                  /* Updates a link's flow      */
 void    nodecoeffs(void);                 /* Computes node coeffs.      */
 void    valvecoeffs(void);                /* Computes valve coeffs.     */
 void    pipecoeff(int);                   /* Computes pipe coeff.       */
@@ -204,12 +228,35 @@ void    prvcoeff(int,int,int);            /* Computes PRV coeff.        */
 void    psvcoeff(int,int,int);            /* Computes PSV coeff.        */
 void    fcvcoeff(int,int,int);            /* Computes FCV coeff.        */
 void    emittercoeffs(void);              /* Computes emitter coeffs.   */
+void    emittercoeff(int,double *,        /* Computes an emitter's      */
+                     double *);           /*   coeffs.                  */
+void    addemittercoeff(int,double,       /* Adds them to matrix        */
+                        double);
 double  emitflowchange(int);              /* Computes new emitter flow  */
+struct  Shydassembly;                     /* Coeff. assembly workers    */
+struct  Shydworker;
+void    openassembly(void);               /* Starts assembly workers    */
+int     newassembly(int);                 /* Allocates them             */
+void    closeassembly(void);              /* Stops them                 */
+void    *assemblyworker(void *);          /* Runs an assembly thread    */
+void    waitassembly(struct Shydassembly *);/* Waits for all workers    */
+void    runassembly(int);                 /* Has them do a job          */
+void    shareassembly(struct Shydworker *);/* Does a worker's part      */
+void    assemblecoeffs(void);             /* Coeffs. with workers       */
+void    pipekernel(struct Shydassembly *, /* Computes run of pipe coeffs*/
+                   int,int);
+void    powkernel(double *,int,double,    /* Raises numbers to a power  */
+                  double *);
+double  hydpow(double,double);            /* Raises number to a power   */
 
 /* ----------- SMATRIX.C ---------------*/
 int     createsparse(void);               /* Creates sparse matrix      */
 int     allocsparse(void);                /* Allocates matrix memory    */
 void    freesparse(void);                 /* Frees matrix memory        */
+long    matrixbytes(void);                /* Memory the matrix holds    */
+int     findsparse(void);                 /* Finds ordering & structure */
+int     readsparse(void);                 /* Reads them from sparse file*/
+int     writesparse(void);                /* Writes them to sparse file */
 int     buildlists(int);                  /* Builds adjacency lists     */
 int     paralink(int, int, int);          /* Checks for parallel links  */
 void    xparalinks(void);                 /* Removes parallel links     */
@@ -223,30 +270,44 @@ int     linked(int, int);                 /* Checks if 2 nodes linked   */
 int     addlink(int, int, int);           /* Creates new fill-in        */
 int     storesparse(int);                 /* Stores sparse matrix       */
 int     ordersparse(int);                 /* Orders matrix storage      */
+int     factororder(int);                 /* Lays out coeffs. for solve */
+int     supernodes(int);                  /* Finds factor's supernodes  */
 void    transpose(int,int *,int *,        /* Transposes sparse matrix   */
         int *,int *,int *,int *,int *);
 int     linsolve(int, double *, double *, /* Solution of linear eqns.   */
                  double *);               /* via Cholesky factorization */
+int     linfactor(int, double *,          /* Cholesky factorization     */
+                  double *);
+void    linsubst(int, double *, double *, /* Solution for many right    */
+                 double *, int);          /* hand sides, once factored  */
 
 /* ----------- QUALITY.C ---------------*/
+struct  Stransport;                       /* Transport workers          */
+struct  Sworker;                          /* A transport worker         */
 int     openqual(void);                   /* Opens WQ solver system     */
 void    initqual(void);                   /* Initializes WQ solver      */
 int     runqual(long *);                  /* Gets current WQ results    */
 int     nextqual(long *);                 /* Updates WQ by hyd.timestep */
 int     stepqual(long *);                 /* Updates WQ by WQ time step */
 int     closequal(void);                  /* Closes WQ solver system    */
+long    qualpoolbytes(int);               /* Memory in WQ segment pools */
+int     openqualhyd(void);                /* Opens WQ copy of hydraulics*/
+void    swapqualhyd(void);                /* Swaps in WQ copy of hyd.   */
+void    closequalhyd(void);               /* Frees WQ copy of hydraulics*/
 int     gethyd(long *, long *);           /* Gets next hyd. results     */
 char    setReactflag(void);               /* Checks for reactive chem.  */
 void    transport(long);                  /* Transports mass in network */
 void    initsegs(void);                   /* Initializes WQ segments    */
 void    reorientsegs(void);               /* Re-orients WQ segments     */
 void    updatesegs(long);                 /* Updates quality in segments*/
+void    reactlink(int,long);              /* Reacts segments in a link  */
 void    removesegs(int);                  /* Removes a WQ segment       */
 void    addseg(int,double,double);        /* Adds a WQ segment to pipe  */
 void    accumulate(long);                 /* Sums mass flow into node   */
 void    updatenodes(long);                /* Updates WQ at nodes        */
 void    sourceinput(long);                /* Computes source inputs     */
 void    release(long);                    /* Releases mass from nodes   */
+void    releaselink(int,long);            /* Releases mass into a link  */
 void    updatetanks(long);                /* Updates WQ in tanks        */
 void    updatesourcenodes(long);          /* Updates WQ at source nodes */
 void    tankmix1(int, long);              /* Complete mix tank model    */
@@ -263,6 +324,21 @@ double  tankreact(double,double,double,
 double  bulkrate(double,double,double);   /* Finds bulk reaction rate   */
 double  wallrate(double,double,double,double);/* Finds wall reaction rate   */
 double getucf(double order);
+int     openworkers(void);                /* Starts transport threads   */
+void    initworkers(void);                /* Resets transport threads   */
+void    closeworkers(void);               /* Stops transport threads    */
+void    *transportworker(void *);         /* Runs a transport thread    */
+void    waitworkers(struct Stransport *); /* Waits for all of workers   */
+void    paralleltransport(long);          /* Transports with workers    */
+void    sharetransport(struct Sworker *); /* Does a worker's transport  */
+void    movelinks(struct Sworker *,long); /* Moves water in its links   */
+void    mixnodes(struct Sworker *,long);  /* Mixes flow at its nodes    */
+
+
+/* ------------ PROJECT.C --------------*/
+struct  ENproject;                        /* A project's state          */
+int     copystate(struct ENproject **);   /* Copies thread's globals    */
+void    usestate(struct ENproject *);     /* Loads copy of globals      */
 
 
 /* ------------ OUTPUT.C ---------------*/
@@ -272,6 +348,8 @@ int     savehydstep(long *);              /* Saves hydraulic timestep   */
 int     saveenergy(void);                 /* Saves energy usage         */
 int     readhyd(long *);                  /* Reads hydraulics from file */
 int     readhydstep(long *);              /* Reads time step from file  */
+int     openhydbuffer(void);              /* Opens hydraulics buffer    */
+void    rewindhyd(void);                  /* Rewinds hydraulics results */
 int     saveoutput(void);                 /* Saves results to file      */
 int     nodeoutput(int, REAL4 *, double); /* Saves node results to file */
 int     linkoutput(int, REAL4 *, double); /* Saves link results to file */
@@ -8,13 +8,21 @@
 **
 **   The hash table data structure (HTable) is defined in "hash.h".
 **   Interface Functions:
-**      HTcreate() - creates a hash table
-**      HTinsert() - inserts a string & its index value into a hash table
-**      HTfind()   - retrieves the index value of a string from a table
-**      HTfree()   - frees a hash table
+**      HTcreate()     - creates a hash table
+**      HTinsert()     - inserts a string & its index value into a hash table
+**      HTinsertItem() - inserts a string & a pointer into a hash table
+**      HTfind()       - retrieves the index value of a string from a table
+**      HTfindItem()   - retrieves the pointer stored with a string
+**      HTfree()       - frees a hash table
 **
 *********************************************************************
 **   NOTE:  This is a modified version of the original HASH.C module.
+**          The table is a flat array of slots searched by linear
+**          probing, which doubles in size whenever it becomes half
+**          full, so that a lookup takes about one string comparison
+**          however many keys are stored. Inserting a key that is
+**          already present replaces its value, so that the most
+**          recently inserted value is the one found, as before.
 *********************************************************************
 */
 
@@ -22,89 +30,127 @@
 #include <stdlib.h>
 #include "hash.h"
 
-/* Use Fletcher's checksum to compute 2-byte hash of string */
+/* Use the FNV-1a hash of a string */
 unsigned int hash(char *str)
 {
-    unsigned int sum1= 0, check1;
-    unsigned long sum2= 0L;
-	while(  '\0' != *str  )
+    unsigned int h = 2166136261u;
+    while ( '\0' != *str )
     {
-        sum1 += (*str);
+        h ^= (unsigned char)(*str);
+        h *= 16777619u;
         str++;
-        if (  255 <= sum1  ) sum1 -= 255;
-        sum2 += sum1;
     }
-    check1= (unsigned int)sum2;
-    check1 %= 255;
-    check1= 255 - (sum1+check1) % 255;
-    sum1= 255 - (sum1+check1) % 255;
-    return( ( ( check1 << 8 )  |  sum1  ) % HTMAXSIZE);
+    return(h);
+}
+
+static struct HTentry *HTslot(HTtable *ht, char *key, unsigned int code)
+/*
+** Returns the slot holding key, or the empty slot where it belongs.
+** There is always an empty slot, since the table is never full.
+*/
+{
+        unsigned int mask = ht->size - 1;
+        unsigned int i = code & mask;
+        struct HTentry *entry;
+        for (;;)
+        {
+            entry = &ht->slot[i];
+            if (entry->key == NULL) return(entry);
+            if (entry->code == code && strcmp(entry->key,key) == 0) return(entry);
+            i = (i + 1) & mask;
+        }
+}
+
+static int HTgrow(HTtable *ht)
+{
+        struct HTentry *old = ht->slot;
+        struct HTentry *entry;
+        unsigned int oldsize = ht->size;
+        unsigned int i;
+        ht->slot = (struct HTentry *) calloc(2*oldsize, sizeof(struct HTentry));
+        if (ht->slot == NULL)
+        {
+            ht->slot = old;
+            return(0);
+        }
+        ht->size = 2*oldsize;
+        for (i=0; i<oldsize; i++)
+        {
+            if (old[i].key == NULL) continue;
+            entry = HTslot(ht, old[i].key, old[i].code);
+            *entry = old[i];
+        }
+        free(old);
+        return(1);
+}
+
+static struct HTentry *HTput(HTtable *ht, char *key)
+{
+        unsigned int code = hash(key);
+        struct HTentry *entry;
+        if (2*(ht->count + 1) > ht->size && !HTgrow(ht)) return(NULL);
+        entry = HTslot(ht, key, code);
+        if (entry->key == NULL) ht->count++;
+        entry->key = key;
+        entry->code = code;
+        return(entry);
 }
 
 HTtable *HTcreate()
 {
-        int i;
-        HTtable *ht = (HTtable*)calloc(HTMAXSIZE, sizeof(HTtable));
-        if (ht != NULL) for (i=0; i<HTMAXSIZE; i++) ht[i] = NULL;
+        HTtable *ht = (HTtable *) malloc(sizeof(HTtable));
+        if (ht == NULL) return(NULL);
+        ht->slot = (struct HTentry *) calloc(HTMINSIZE, sizeof(struct HTentry));
+        if (ht->slot == NULL)
+        {
+            free(ht);
+            return(NULL);
+        }
+        ht->size = HTMINSIZE;
+        ht->count = 0;
         return(ht);
 }
 
 int     HTinsert(HTtable *ht, char *key, int data)
 {
-        unsigned int i = hash(key);
-        struct HTentry *entry;
-        if ( i >= HTMAXSIZE ) return(0);
-        entry = (struct HTentry *) malloc(sizeof(struct HTentry));
+        struct HTentry *entry = HTput(ht, key);
         if (entry == NULL) return(0);
-        entry->key = key;
         entry->data = data;
-        entry->next = ht[i];
-        ht[i] = entry;
+        entry->item = NULL;
+        return(1);
+}
+
+int     HTinsertItem(HTtable *ht, char *key, void *item)
+{
+        struct HTentry *entry = HTput(ht, key);
+        if (entry == NULL) return(0);
+        entry->data = NOTFOUND;
+        entry->item = item;
         return(1);
 }
 
 int     HTfind(HTtable *ht, char *key)
 {
-        unsigned int i = hash(key);
-        struct HTentry *entry;
-        if ( i >= HTMAXSIZE ) return(NOTFOUND);
-        entry = ht[i];
-        while (entry != NULL)
-        {
-            if ( strcmp(entry->key,key) == 0 ) return(entry->data);
-            entry = entry->next;
-        }
-        return(NOTFOUND);
+        struct HTentry *entry = HTslot(ht, key, hash(key));
+        if (entry->key == NULL) return(NOTFOUND);
+        return(entry->data);
+}
+
+void    *HTfindItem(HTtable *ht, char *key)
+{
+        struct HTentry *entry = HTslot(ht, key, hash(key));
+        if (entry->key == NULL) return(NULL);
+        return(entry->item);
 }
 
 char    *HTfindKey(HTtable *ht, char *key)
 {
-        unsigned int i = hash(key);
-        struct HTentry *entry;
-        if ( i >= HTMAXSIZE ) return(NULL);
-        entry = ht[i];
-        while (entry != NULL)
-        {
-            if ( strcmp(entry->key,key) == 0 ) return(entry->key);
-            entry = entry->next;
-        }
-        return(NULL);
+        struct HTentry *entry = HTslot(ht, key, hash(key));
+        return(entry->key);
 }
 
 void    HTfree(HTtable *ht)
 {
-        struct HTentry *entry,
-                       *nextentry;
-        int i;
-        for (i=0; i<HTMAXSIZE; i++)
-        {
-            entry = ht[i];
-            while (entry != NULL)
-            {
-                nextentry = entry->next;
-                free(entry);
-                entry = nextentry;
-            }
-        }
+        free(ht->slot);
         free(ht);
 }
@@ -4,21 +4,29 @@
 **
 */
 
-#define HTMAXSIZE 1999
+#define HTMINSIZE 64      /* Initial number of slots (a power of 2) */
 #define NOTFOUND  0
 
 struct HTentry
 {
-	char 	*key;
+	char 	*key;        /* NULL if the slot is empty     */
+	unsigned int code;   /* Full hash code of key         */
 	int 	data;
-	struct	HTentry *next;
+	void	*item;
 };
 
-typedef struct HTentry *HTtable;
+typedef struct
+{
+	struct	HTentry *slot;
+	unsigned int size;   /* Number of slots               */
+	unsigned int count;  /* Number of keys stored         */
+} HTtable;
 
 unsigned int hash(char *str);
 HTtable *HTcreate(void);
 int     HTinsert(HTtable *, char *, int);
+int     HTinsertItem(HTtable *, char *, void *);
 int 	HTfind(HTtable *, char *);
+void    *HTfindItem(HTtable *, char *);
 char    *HTfindKey(HTtable *, char *);
-void	HTfree(HTtable *);
\ No newline at end of file
+void	HTfree(HTtable *);
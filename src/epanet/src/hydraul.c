@@ -27,15 +27,31 @@ AUTHOR:     L. Rossman
      runhyd()     -- called from ENrunH() in EPANET.C
      nexthyd()    -- called from ENnextH() in EPANET.C
      closehyd()   -- called from ENcloseH() in EPANET.C
+     indexcontrols() -- called from ENsetcontrol() in EPANET.C
+     hydstate()   -- called from ENgethydstatesize(), ENsavehydstate()
+                     and ENloadhydstate() in EPANET.C
+     demandresponse() -- called from ENgetdemandresponse() in EPANET.C
+     demandsolve() -- called from ENsolvedemandchange() in EPANET.C
      tankvolume() -- called from ENsetnodevalue() in EPANET.C
      setlinkstatus(),
      setlinksetting(),
      resistance()-- all called from ENsetlinkvalue() in EPANET.C
 
+  With more than one thread set by ENsethydassembly() on a large
+  network, or with its fast powers, each Newton iteration's link
+  & emitter coefficients and flow changes are computed by
+  assembly workers (see assemblecoeffs()), which start with the
+  first netsolve() and stop with the solver (closeassembly()).
+
   External functions called by this module are:
      createsparse() -- see SMATRIX.C
      freesparse()   -- see SMATRIX.C
      linsolve()     -- see SMATRIX.C
+     linfactor()    -- see SMATRIX.C
+     linsubst()     -- see SMATRIX.C
+     openrules()    -- see RULES.C
+     closerules()   -- see RULES.C
+     resetrules()   -- see RULES.C
      checkrules()   -- see RULES.C
      interp()       -- see EPANET.C
      savehyd()      -- see OUTPUT.C
@@ -50,11 +66,17 @@ AUTHOR:     L. Rossman
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#include <pthread.h>
+#define   PARALLEL_ASSEMBLY   /* Assembly can use worker threads */
+#endif
 #include "hash.h"
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 #define   QZERO  1.e-6  /* Equivalent to zero flow */
@@ -74,10 +96,78 @@ AUTHOR:     L. Rossman
 
 /*** Updated 3/1/01 ***/
 /* Flag used to halt taking further time steps */
-int Haltflag;
+EN_THREAD int Haltflag;
 
 /* Relaxation factor used for updating flow changes */                         //(2.00.11 - LR)
-double RelaxFactor;                                                            //(2.00.11 - LR)
+EN_THREAD double RelaxFactor;                                                            //(2.00.11 - LR)
+
+/* Simple controls, grouped by what sets them off (see indexcontrols()) */
+EN_THREAD int *Tankctl, Ntankctl;     /* On tank levels, in index order      */
+EN_THREAD int *Juncctl, Njuncctl;     /* On junction pressures, likewise     */
+EN_THREAD int *Timectl, Ntimectl;     /* Timers, by time                     */
+EN_THREAD int *Dayctl,  Ndayctl;      /* Time-of-day controls, by time       */
+EN_THREAD int *Ctlfired;              /* Controls set off in controls()      */
+
+/*
+** Coefficient assembly workers. Each owns a range of links and
+** of junctions, and only writes the P, Y, Q & E entries of its
+** own, and its own entries in the arrays below. The calling
+** thread then adds them into Aii, Aij, F & X, and sums flow
+** changes, in order of index -- as the serial code does -- so
+** the results don't depend on the number of workers.
+*/
+#define   MINHYDLINKS  2000   /* Fewest links worth a worker thread */
+#define   COEFFJOB     1      /* Compute link & emitter coeffs.     */
+#define   FLOWJOB      2      /* Compute link & emitter flow changes*/
+#define   FASTPOWMIN  1.e-100     /* Range hydpow() uses fast powers in */
+
+/* Constants of powkernel()'s fast powers */
+#define   LOG2E      1.4426950408889634      /* 1/ln(2)          */
+#define   LN2        0.6931471805599453      /* ln(2)            */
+#define   TWO52      4503599627370496.0      /* 2^52             */
+#define   TWO52BITS  0x4330000000000000ULL   /* Its bits         */
+#define   MANTISSA   0x000fffffffffffffULL   /* Mantissa bits    */
+#define   SQRT2BITS  0x0006a09e667f3bcdULL   /* Those of sqrt(2) */
+
+typedef struct Shydworker      /* Coefficient assembly worker        */
+{
+   int    index;               /* 0 for the thread calling netsolve  */
+   int    lo, hi;              /* Links it owns                      */
+   int    nlo, nhi;            /* Junctions it owns                  */
+   int    plo, phi;            /* Its part of the pipe kernel arrays */
+   struct Shydassembly *owner; /* Assembly it works for              */
+#ifdef PARALLEL_ASSEMBLY
+   pthread_t thread;
+#endif
+}  Shydworker;
+
+struct Shydassembly            /* Workers of the hydraulic solver    */
+{
+   int       n;                /* Number of workers (incl. caller)   */
+   int       nthreads;         /* Worker threads started             */
+   int       count;            /* Threads that meet at the barrier   */
+   Shydworker *worker;
+   int       npipes;           /* Pipes done by pipekernel()         */
+   int       *pipe;            /* Their link indexes, in order       */
+   double    *pr, *pkm;        /* Their resistance & minor loss coeffs.*/
+   double    *pq, *ph;         /* Their abs. flows & friction losses */
+   char      *kernel;          /* Whether a link is one of them      */
+   char      *added;           /* Whether a link's coeffs. are added */
+   double    *dq;              /* Flow change of each link           */
+   double    *ep, *ey, *edq;   /* Emitter coeffs. & flow changes     */
+   struct ENproject *state;    /* Globals of the calling thread      */
+   int       job;              /* Job being done                     */
+   char      quit;             /* Stop the worker threads            */
+#ifdef PARALLEL_ASSEMBLY
+   pthread_mutex_t lock;       /* Barrier that all workers meet at   */
+   pthread_cond_t  cond;
+   int       waiting;
+   unsigned  generation;
+#endif
+};
+typedef struct Shydassembly Shydassembly;
+
+EN_THREAD Shydassembly *Hydassembly;  /* Workers, or NULL if serial     */
 
 /* Function to find flow coeffs. through open/closed valves */                 //(2.00.11 - LR)
 void valvecoeff(int k);                                                        //(2.00.11 - LR)
@@ -96,6 +186,8 @@ int  openhyd()
    int  errcode = 0;
    ERRCODE(createsparse());     /* See SMATRIX.C  */
    ERRCODE(allocmatrix());      /* Allocate solution matrices */
+   ERRCODE(opencontrols());     /* Index simple controls */
+   ERRCODE(openrules());        /* See RULES.C */
    for (i=1; i<=Nlinks; i++)    /* Initialize flows */
       initlinkflow(i,Link[i].Stat,Link[i].Kc);
    return(errcode);
@@ -162,8 +254,12 @@ void inithyd(int initflag)
       for (j=0; j<6; j++) Pump[i].Energy[j] = 0.0;
    }
 
-   /* Re-position hydraulics file */
-   if (Saveflag) fseek(HydFile,HydOffset,SEEK_SET);
+   /* Re-position hydraulics file (or empty the buffer kept instead) */
+   if (Saveflag)
+   {
+      if (HydBuf != NULL) HydBufCount = HydBufRead = 0;
+      else fseek(HydFile,HydOffset,SEEK_SET);
+   }
 
 /*** Updated 3/1/01 ***/
    /* Initialize current time */
@@ -184,10 +280,23 @@ int   runhyd(long *t)
 **--------------------------------------------------------------
 */
 {
+   int   i;                             /* Link/node index   */
    int   iter;                          /* Iteration count   */
    int   errcode;                       /* Error code        */
    double relerr;                        /* Solution accuracy */
 
+   /* Unless warm starting from the last solution's flows, */
+   /* start from the same initial flows as inithyd() does. */
+   if (!Warmflag)
+   {
+      for (i=1; i<=Nlinks; i++)
+      {
+         if (S[i] <= CLOSED) Q[i] = QZERO;
+         else initlinkflow(i, S[i], K[i]);
+      }
+      for (i=1; i<=Njuncs; i++) E[i] = (Node[i].Ke > 0.0) ? 1.0 : 0.0;
+   }
+
    /* Find new demands & control actions */
    *t = Htime;
    demands();
@@ -272,9 +381,395 @@ void  closehyd()
 {
    freesparse();           /* see SMATRIX.C */
    freematrix();
+   closeassembly();
+   closecontrols();
+   closerules();           /* see RULES.C */
+}
+
+
+int  opencontrols()
+/*
+**--------------------------------------------------------------
+**  Input:   none
+**  Output:  returns error code
+**  Purpose: allocates and builds the index of simple controls
+**--------------------------------------------------------------
+*/
+{
+   int n = Ncontrols+1;
+   closecontrols();
+   Tankctl  = (int *) calloc(n,sizeof(int));
+   Juncctl  = (int *) calloc(n,sizeof(int));
+   Timectl  = (int *) calloc(n,sizeof(int));
+   Dayctl   = (int *) calloc(n,sizeof(int));
+   Ctlfired = (int *) calloc(n,sizeof(int));
+   if (Tankctl == NULL || Juncctl == NULL || Timectl == NULL ||
+       Dayctl == NULL || Ctlfired == NULL) return(101);
+   indexcontrols();
+   return(0);
+}
+
+
+void  closecontrols()
+/*
+**--------------------------------------------------------------
+**  Input:   none
+**  Output:  none
+**  Purpose: frees the index of simple controls
+**--------------------------------------------------------------
+*/
+{
+   free(Tankctl);
+   free(Juncctl);
+   free(Timectl);
+   free(Dayctl);
+   free(Ctlfired);
+   Tankctl = Juncctl = Timectl = Dayctl = Ctlfired = NULL;
+   Ntankctl = Njuncctl = Ntimectl = Ndayctl = 0;
+}
+
+
+int  ctltimecmp(const void *a, const void *b)
+/*
+**--------------------------------------------------------------
+**  Purpose: orders controls by time, then by index (for qsort)
+**--------------------------------------------------------------
+*/
+{
+   int i = *(const int *)a,
+       j = *(const int *)b;
+   if (Control[i].Time != Control[j].Time)
+      return((Control[i].Time < Control[j].Time) ? -1 : 1);
+   return(i-j);
+}
+
+
+void  indexcontrols()
+/*
+**--------------------------------------------------------------
+**  Input:   none
+**  Output:  none
+**  Purpose: groups the simple controls by what sets them off,
+**           so that each time step only looks at those that
+**           can act: every tank level control, and the timers
+**           and time-of-day controls that fall due (found by
+**           bisection). Each group keeps the controls in the
+**           order that the full scan took them in, or by time.
+**
+**  NOTE:    rebuilt whenever a control changes while the
+**           hydraulics solver is open (see ENsetcontrol()).
+**--------------------------------------------------------------
+*/
+{
+   int i, n;
+
+   Ntankctl = Njuncctl = Ntimectl = Ndayctl = 0;
+   for (i=1; i<=Ncontrols; i++)
+   {
+      n = Control[i].Node;
+      if (n > Njuncs) Tankctl[Ntankctl++] = i;
+      else if (n > 0) Juncctl[Njuncctl++] = i;
+      else if (Control[i].Type == TIMER) Timectl[Ntimectl++] = i;
+      else if (Control[i].Type == TIMEOFDAY) Dayctl[Ndayctl++] = i;
+   }
+   qsort(Timectl, Ntimectl, sizeof(int), ctltimecmp);
+   qsort(Dayctl, Ndayctl, sizeof(int), ctltimecmp);
 }
 
 
+int  firstctl(int *ctl, int n, long t)
+/*
+**--------------------------------------------------------------
+**  Input:   ctl = controls sorted by time
+**           n   = number of them
+**           t   = time (sec)
+**  Output:  returns position of the first control due at or
+**           after time t (n if none)
+**--------------------------------------------------------------
+*/
+{
+   int lo = 0, hi = n, mid;
+   while (lo < hi)
+   {
+      mid = (lo+hi)/2;
+      if (Control[ctl[mid]].Time < t) lo = mid+1;
+      else hi = mid;
+   }
+   return(lo);
+}
+
+
+int  hydstate(char *state, int save, int *size)
+/*
+**--------------------------------------------------------------
+**  Input:   state = buffer, or NULL to only find its size
+**           save  = TRUE to copy the hydraulic state into the
+**                   buffer, FALSE to restore it from the buffer
+**  Output:  *size = size of the state in bytes
+**           returns error code
+**  Purpose: copies the hydraulic state between the solver and
+**           a buffer (see ENsavehydstate())
+**
+**  NOTE:   The state is what carries over from one period to
+**          the next: node heads, tank volumes, link flows and
+**          status, pump and valve settings, and emitter flows.
+**          A buffer is only restored into a network of the same
+**          size, with emitters at as many junctions.
+**--------------------------------------------------------------
+*/
+{
+   int  layout[3];
+   int  i, n;
+
+   layout[0] = Nnodes;
+   layout[1] = Nlinks;
+   layout[2] = 0;
+   for (i=1; i<=Njuncs; i++) if (Node[i].Ke > 0.0) layout[2]++;
+   if (state != NULL && !save && memcmp(state,layout,sizeof(layout)) != 0)
+      return(250);
+
+/* Copy each part of the state in turn */
+#define  HYDSTATE(x) \
+   {  if (state != NULL && save)  memcpy(state+n,&(x),sizeof(x)); \
+      if (state != NULL && !save) memcpy(&(x),state+n,sizeof(x)); \
+      n += sizeof(x);  }
+
+   n = 0;
+   HYDSTATE(layout);
+   for (i=1; i<=Nnodes; i++) HYDSTATE(H[i]);
+   for (i=1; i<=Ntanks; i++) HYDSTATE(Tank[i].V);
+   for (i=1; i<=Nlinks; i++) HYDSTATE(Q[i]);
+   for (i=1; i<=Nlinks; i++) if (Link[i].Type > PIPE) HYDSTATE(K[i]);
+   for (i=1; i<=Njuncs; i++) if (Node[i].Ke > 0.0) HYDSTATE(E[i]);
+   for (i=1; i<=Nlinks; i++) HYDSTATE(S[i]);
+
+#undef   HYDSTATE
+   *size = n;
+   return(0);
+}                        /* End of hydstate */
+
+
+int  demandresponse(int nsets, int count, int *nodes, double *changes,
+                    double *dh, double *dq)
+/*
+**--------------------------------------------------------------
+**  Input:   nsets   = number of sets of demand changes
+**           count   = number of junctions in each set
+**           nodes   = junction indexes, nodes[s*count+c] for the
+**                     c-th junction of the s-th set
+**           changes = demand changes, changes[s*count+c] for the
+**                     same junction
+**  Output:  dh[s*Nnodes+i-1] = change in head at node i, and
+**           dq[s*Nlinks+k-1] = change in flow in link k, for
+**           the s-th set of changes
+**           returns error code
+**  Purpose: finds the first-order response of the current
+**           solution to each set of demand changes
+**
+**  NOTE:   The equations are linearized and factorized once, at
+**          the current solution, and the responses to all of the
+**          sets are then substituted together (see linsubst()).
+**          Fixed grade nodes don't change head. An active PRV
+**          (or PSV) holds the head below it (or above it), so its
+**          flow takes up the change in demand on that side, and
+**          passes it on to the other side; the substitutions are
+**          repeated until those valve flows settle, once for each
+**          active valve at most.
+**--------------------------------------------------------------
+*/
+{
+   int    c, i, k, n, n1, n2, s, pass, nactive, changed;
+   double *b, *x, ke, p, q, z;
+
+   /* Linearize & factorize the equations at the current solution */
+   openassembly();
+   newcoeffs();
+   if (linfactor(Njuncs,Aii,Aij) > 0) return(110);
+   b = (double *) calloc((Njuncs+1)*nsets,sizeof(double));
+   x = (double *) calloc((Nnodes+1)*nsets,sizeof(double));
+   if (b == NULL || x == NULL)
+   {
+      free(b);
+      free(x);
+      return(101);
+   }
+
+   /* Count the active pressure valves */
+   nactive = 0;
+   for (i=1; i<=Nvalves; i++)
+   {
+      k = Valve[i].Link;
+      if ((Link[k].Type == PRV || Link[k].Type == PSV)
+      && K[k] != MISSING && S[k] == ACTIVE) nactive++;
+   }
+
+   memset(dq,0,nsets*Nlinks*sizeof(double));
+   for (pass=0; pass<=nactive; pass++)
+   {
+      /* Right hand sides: demand changes, and flows through */
+      /* active pressure valves from the last pass          */
+      memset(b,0,(Njuncs+1)*nsets*sizeof(double));
+      for (s=0; s<nsets; s++)
+      {
+         for (c=0; c<count; c++)
+            b[Row[nodes[s*count+c]]*nsets+s] -= changes[s*count+c];
+      }
+      for (i=1; i<=Nvalves && nactive>0; i++)
+      {
+         k = Valve[i].Link;
+         if ((Link[k].Type != PRV && Link[k].Type != PSV)
+         || K[k] == MISSING || S[k] != ACTIVE) continue;
+         n1 = Link[k].N1;
+         n2 = Link[k].N2;
+         for (s=0; s<nsets; s++)
+         {
+            q = dq[s*Nlinks+k-1];
+            if (n1 <= Njuncs) b[Row[n1]*nsets+s] -= q;
+            if (n2 <= Njuncs) b[Row[n2]*nsets+s] += q;
+         }
+      }
+      linsubst(Njuncs,Aii,Aij,b,nsets);
+
+      /* Head changes */
+      for (s=0; s<nsets; s++)
+      {
+         for (i=1; i<=Nnodes; i++)
+            dh[s*Nnodes+i-1] = (i <= Njuncs) ? b[Row[i]*nsets+s] : 0.0;
+      }
+
+      /* Flow changes in the other links, and the change */
+      /* in flow imbalance that they leave at each node  */
+      memset(x,0,(Nnodes+1)*nsets*sizeof(double));
+      for (s=0; s<nsets; s++)
+      {
+         for (c=0; c<count; c++)
+            x[nodes[s*count+c]*nsets+s] -= changes[s*count+c];
+      }
+      for (k=1; k<=Nlinks; k++)
+      {
+         if ((Link[k].Type == PRV || Link[k].Type == PSV)
+         && K[k] != MISSING && S[k] == ACTIVE) continue;
+         n1 = Link[k].N1;
+         n2 = Link[k].N2;
+         for (s=0; s<nsets; s++)
+         {
+            q = P[k]*(dh[s*Nnodes+n1-1] - dh[s*Nnodes+n2-1]);
+            dq[s*Nlinks+k-1] = q;
+            x[n1*nsets+s] -= q;
+            x[n2*nsets+s] += q;
+         }
+      }
+      for (i=1; i<=Njuncs; i++)
+      {
+         if (Node[i].Ke == 0.0) continue;
+         ke = MAX(CSMALL, Node[i].Ke);
+         z = ke*pow(ABS(E[i]),Qexp);
+         p = Qexp*z/ABS(E[i]);
+         if (p < RQtol) p = 1.0/RQtol;
+         else p = 1.0/p;
+         for (s=0; s<nsets; s++) x[i*nsets+s] -= p*dh[s*Nnodes+i-1];
+      }
+
+      /* Active pressure valves balance the node they hold */
+      changed = FALSE;
+      for (i=1; i<=Nvalves && nactive>0; i++)
+      {
+         k = Valve[i].Link;
+         if ((Link[k].Type != PRV && Link[k].Type != PSV)
+         || K[k] == MISSING || S[k] != ACTIVE) continue;
+         n = (Link[k].Type == PRV) ? Link[k].N2 : Link[k].N1;
+         for (s=0; s<nsets; s++)
+         {
+            q = (Link[k].Type == PRV) ? -x[n*nsets+s] : x[n*nsets+s];
+            if (q != dq[s*Nlinks+k-1]) changed = TRUE;
+            dq[s*Nlinks+k-1] = q;
+         }
+      }
+      if (!changed) break;
+   }
+   free(b);
+   free(x);
+   return(0);
+}                        /* End of demandresponse */
+
+
+int  demandsolve(int count, int *nodes, double *changes, double *dq0,
+                 double *h, double *q, int *iter, double *relerr)
+/*
+**--------------------------------------------------------------
+**  Input:   count   = number of junctions with demand changes
+**           nodes   = the junctions' indexes
+**           changes = the change in demand at each of them
+**           dq0     = change in each link's flow to start the
+**                     solution from, or NULL to start it from
+**                     the current flows
+**  Output:  h[i-1]  = head at node i, and
+**           q[k-1]  = flow in link k, with the changed demands
+**           *iter   = # of iterations to reach the solution
+**           *relerr = convergence error in the solution
+**           returns error code
+**  Purpose: re-solves the current time period with changed
+**           demands, leaving the current solution as it was
+**
+**  NOTE:   The solution starts from the current one, so with a
+**          good estimate of how the flows change (such as from
+**          demandresponse()) it takes only a few iterations.
+**          Time controls aren't re-applied; status changes
+**          during the iterations are made as usual.
+**--------------------------------------------------------------
+*/
+{
+   int    i, k, size, errcode;
+   char   statflag;
+   char   *state;
+   double *d, dsystem, qk;
+
+   /* Keep the current solution, to restore afterwards */
+   hydstate(NULL,TRUE,&size);
+   state = (char *) malloc(size);
+   d = (double *) calloc(Nnodes+1,sizeof(double));
+   if (state == NULL || d == NULL)
+   {
+      free(state);
+      free(d);
+      return(101);
+   }
+   hydstate(state,TRUE,&size);
+   memcpy(d,D,(Nnodes+1)*sizeof(double));
+   dsystem = Dsystem;
+   statflag = Statflag;
+   Statflag = FALSE;
+
+   /* Start from the current flows, moved by the estimated changes */
+   /* (but not so far as to reverse them)                          */
+   if (dq0 != NULL)
+   {
+      for (k=1; k<=Nlinks; k++)
+      {
+         if (S[k] <= CLOSED) continue;
+         qk = Q[k] + dq0[k-1];
+         if (qk*Q[k] > 0.0) Q[k] = qk;
+      }
+   }
+
+   /* Solve with the changed demands */
+   demands();
+   for (i=0; i<count; i++) D[nodes[i]] += changes[i];
+   errcode = netsolve(iter,relerr);
+   for (i=1; i<=Nnodes; i++) h[i-1] = H[i];
+   for (k=1; k<=Nlinks; k++) q[k-1] = (S[k] <= CLOSED) ? 0.0 : Q[k];
+
+   /* Restore the current solution */
+   hydstate(state,FALSE,&size);
+   memcpy(D,d,(Nnodes+1)*sizeof(double));
+   Dsystem = dsystem;
+   Statflag = statflag;
+   free(state);
+   free(d);
+   return(errcode);
+}                        /* End of demandsolve */
+
+
 int  allocmatrix()
 /*
 **--------------------------------------------------------------
@@ -640,63 +1135,82 @@ int  controls()
 **---------------------------------------------------------------------
 */
 {
-   int   i, k, n, reset, setsum;
+   int   i, j, k, n, m, nfired, setsum;
+   long  t;
    double h, vplus;
    double v1, v2;
    double k1, k2;
    char  s1, s2;
 
-   /* Examine each control statement */
-   setsum = 0;
-   for (i=1; i<=Ncontrols; i++)
+   /* Find the controls that are set off now */
+   nfired = 0;
+
+   /* Links controlled by tank level */
+   for (j=0; j<Ntankctl; j++)
    {
-      /* Make sure that link is defined */
-      reset = 0;
-      if ( (k = Control[i].Link) <= 0) continue;
+      i = Tankctl[j];
+      if (Control[i].Link <= 0) continue;
+      n = Control[i].Node;
+      h = H[n];
+      vplus = ABS(D[n]);
+      v1 = tankvolume(n-Njuncs,h);
+      v2 = tankvolume(n-Njuncs,Control[i].Grade);
+      if ((Control[i].Type == LOWLEVEL && v1 <= v2 + vplus) ||
+          (Control[i].Type == HILEVEL && v1 >= v2 - vplus))
+         Ctlfired[nfired++] = i;
+   }
 
-      /* Link is controlled by tank level */
-      if ((n = Control[i].Node) > 0 && n > Njuncs)
-      {
-         h = H[n];
-         vplus = ABS(D[n]);
-         v1 = tankvolume(n-Njuncs,h);
-         v2 = tankvolume(n-Njuncs,Control[i].Grade);
-         if (Control[i].Type == LOWLEVEL && v1 <= v2 + vplus)
-            reset = 1;
-         if (Control[i].Type == HILEVEL && v1 >= v2 - vplus)
-            reset = 1;
-      }
+   /* Time-controlled links */
+   m = nfired;
+   for (j=firstctl(Timectl,Ntimectl,Htime); j<Ntimectl; j++)
+   {
+      i = Timectl[j];
+      if (Control[i].Time != Htime) break;
+      if (Control[i].Link > 0) Ctlfired[nfired++] = i;
+   }
 
-      /* Link is time-controlled */
-      if (Control[i].Type == TIMER)
-      {
-          if (Control[i].Time == Htime) reset = 1;
-      }
+   /* Time-of-day controlled links */
+   t = (Htime + Tstart) % SECperDAY;
+   for (j=firstctl(Dayctl,Ndayctl,t); j<Ndayctl; j++)
+   {
+      i = Dayctl[j];
+      if (Control[i].Time != t) break;
+      if (Control[i].Link > 0) Ctlfired[nfired++] = i;
+   }
 
-      /* Link is time-of-day controlled */
-      if (Control[i].Type == TIMEOFDAY)
+   /* Put them back in index order, since a later control on */
+   /* a link overrides an earlier one (there are seldom more */
+   /* than a few, so an insertion sort does).                */
+   if (m < nfired)
+   {
+      for (j=1; j<nfired; j++)
       {
-          if ((Htime + Tstart) % SECperDAY == Control[i].Time) reset = 1;
+         i = Ctlfired[j];
+         for (m=j; m>0 && Ctlfired[m-1] > i; m--) Ctlfired[m] = Ctlfired[m-1];
+         Ctlfired[m] = i;
       }
+   }
 
-      /* Update link status & pump speed or valve setting */
-      if (reset == 1)
+   /* Update link status & pump speed or valve setting */
+   setsum = 0;
+   for (j=0; j<nfired; j++)
+   {
+      i = Ctlfired[j];
+      k = Control[i].Link;
+      if (S[k] <= CLOSED) s1 = CLOSED;
+      else                s1 = OPEN;
+      s2 = Control[i].Status;
+      k1 = K[k];
+      k2 = k1;
+      if (Link[k].Type > PIPE) k2 = Control[i].Setting;
+      if (s1 != s2 || k1 != k2)
       {
-         if (S[k] <= CLOSED) s1 = CLOSED;
-         else                s1 = OPEN;
-         s2 = Control[i].Status;
-         k1 = K[k];
-         k2 = k1;
-         if (Link[k].Type > PIPE) k2 = Control[i].Setting;
-         if (s1 != s2 || k1 != k2)
-         {
-            S[k] = s2;
-            K[k] = k2;
-            if (Statflag) writecontrolaction(k,i);
- //           if (s1 != s2) initlinkflow(k, S[k], K[k]);
-            setsum++;
-         }
-      }   
+         S[k] = s2;
+         K[k] = k2;
+         if (Statflag) writecontrolaction(k,i);
+ //        if (s1 != s2) initlinkflow(k, S[k], K[k]);
+         setsum++;
+      }
    }
    return(setsum);
 }                        /* End of controls */
@@ -787,63 +1301,84 @@ void  controltimestep(long *tstep)
 **------------------------------------------------------------------
 */
 {
-   int   i,j,k,n;
+   int   i,j,m,n;
    double h,q,v;
-   long  t,t1,t2;
+   long  t,t1;
 
-   for (i=1; i<=Ncontrols; i++)
+   for (m=0; m<Ntankctl; m++)                /* Node control:        */
    {
-      t = 0;
-      if ( (n = Control[i].Node) > 0)           /* Node control:       */
-      {
-         if ((j = n-Njuncs) <= 0) continue;     /* Node is a tank      */
-         h = H[n];                              /* Current tank grade  */
-         q = D[n];                              /* Flow into tank      */
-         if (ABS(q) <= QZERO) continue;
-         if
-         ( (h < Control[i].Grade &&
-            Control[i].Type == HILEVEL &&       /* Tank below hi level */
-            q > 0.0)                            /* & is filling        */
-         || (h > Control[i].Grade &&
-             Control[i].Type == LOWLEVEL &&     /* Tank above low level */
-             q < 0.0)                           /* & is emptying        */
-         )
-         {                                      /* Time to reach level  */
-            v = tankvolume(j,Control[i].Grade)-Tank[j].V;
-            t = (long)ROUND(v/q);
-         }
-      }
-
-      if (Control[i].Type == TIMER)             /* Time control:        */
-      {              
-         if (Control[i].Time > Htime)
-             t = Control[i].Time - Htime;
+      i = Tankctl[m];                        /* (node is a tank)     */
+      n = Control[i].Node;
+      j = n-Njuncs;
+      h = H[n];                              /* Current tank grade   */
+      q = D[n];                              /* Flow into tank       */
+      if (ABS(q) <= QZERO) continue;
+      if
+      ( (h < Control[i].Grade &&
+         Control[i].Type == HILEVEL &&       /* Tank below hi level  */
+         q > 0.0)                            /* & is filling         */
+      || (h > Control[i].Grade &&
+          Control[i].Type == LOWLEVEL &&     /* Tank above low level */
+          q < 0.0)                           /* & is emptying        */
+      )
+      {                                      /* Time to reach level  */
+         v = tankvolume(j,Control[i].Grade)-Tank[j].V;
+         t = (long)ROUND(v/q);
+         if (t > 0 && t < *tstep && ctlchanges(i)) *tstep = t;
       }
+   }
 
-      if (Control[i].Type == TIMEOFDAY)         /* Time-of-day control: */
+   /* Time controls: the first one due after now that changes */
+   /* its link, unless that's beyond the current time step     */
+   for (m=firstctl(Timectl,Ntimectl,Htime+1); m<Ntimectl; m++)
+   {
+      i = Timectl[m];
+      t = Control[i].Time - Htime;
+      if (t >= *tstep) break;
+      if (ctlchanges(i))
       {
-         t1 = (Htime + Tstart) % SECperDAY;
-         t2 = Control[i].Time;
-         if (t2 >= t1) t = t2 - t1;
-         else t = SECperDAY - t1 + t2;
+         *tstep = t;
+         break;
       }
+   }
 
-      if (t > 0 && t < *tstep)               /* Revise time step     */
+   /* Time-of-day controls: likewise, from the current time of */
+   /* day round to just before the same time the next day      */
+   if (Ndayctl > 0)
+   {
+      t1 = (Htime + Tstart) % SECperDAY;
+      j = firstctl(Dayctl,Ndayctl,t1+1);
+      for (m=0; m<Ndayctl; m++)
       {
-         /* Check if rule actually changes link status or setting */
-         k = Control[i].Link;
-         if (
-              (Link[k].Type > PIPE && K[k] != Control[i].Setting) ||
-              (S[k] != Control[i].Status)
-             ) {
-                  *tstep = t;
-                }
-        
+         i = Dayctl[(j+m) % Ndayctl];
+         t = Control[i].Time - t1;
+         if (t < 0) t += SECperDAY;
+         if (t == 0 || t >= *tstep) break;
+         if (ctlchanges(i))
+         {
+            *tstep = t;
+            break;
+         }
       }
    }
 }                        /* End of timestep */
 
 
+int  ctlchanges(int i)
+/*
+**------------------------------------------------------------------
+**  Input:   i = control index
+**  Output:  returns 1 if control i would change its link's status
+**           or setting, 0 if not
+**------------------------------------------------------------------
+*/
+{
+   int k = Control[i].Link;
+   return((Link[k].Type > PIPE && K[k] != Control[i].Setting) ||
+          (S[k] != Control[i].Status));
+}
+
+
 void  ruletimestep(long *tstep)
 /*
 **--------------------------------------------------------------
@@ -863,6 +1398,9 @@ void  ruletimestep(long *tstep)
    tnow = Htime;
    tmax = tnow + *tstep;
 
+   /* Check every rule's premises afresh in this time step */
+   resetrules();
+
    /* If no rules, then time increment equals current time step */
    if (Nrules == 0)
    {
@@ -1148,10 +1686,13 @@ int  netsolve(int *iter, double *relerr)
    double newerr;                /* New convergence error */
    int    valveChange;           /* Valve status change flag */
    int    statChange;
+   double started;               /* Start of a linsolve call */
+   double solving = 0.0;         /* Time spent in linsolve */
 
    /* Initialize status checking & relaxation factor */   
    nextcheck = CheckFreq;
    RelaxFactor = 1.0;
+   openassembly();
   
    /* Repeat iterations until convergence or trial limit is exceeded. */
    /* (ExtraIter used to increase trials in case of status cycling.)  */
@@ -1168,7 +1709,9 @@ int  netsolve(int *iter, double *relerr)
       ** Solution for H is returned in F from call to linsolve().
       */
       newcoeffs();
+      started = walltime();
       errcode = linsolve(Njuncs,Aii,Aij,F);
+      solving += walltime() - started;
 
       /* Take action depending on error code */
       if (errcode < 0) break;    /* Memory allocation problem */
@@ -1239,10 +1782,31 @@ int  netsolve(int *iter, double *relerr)
 
    /* Add any emitter flows to junction demands */
    for (i=1; i<=Njuncs; i++) D[i] += E[i];
+   _linsolveTime = (int)(solving*1.e6);
    return(errcode);
 }                        /* End of netsolve */
 
 
+double  walltime()
+/*
+**-----------------------------------------------------------------
+**  Input:   none
+**  Output:  returns wall-clock time in seconds
+**  Purpose: times parts of a solution (see EN_LINSOLVETIME). Only
+**           differences between two calls mean anything.
+**-----------------------------------------------------------------
+*/
+{
+#ifndef _WIN32
+   struct timeval now;
+   gettimeofday(&now, NULL);
+   return(now.tv_sec + now.tv_usec*1.e-6);
+#else
+   return((double)clock()/CLOCKS_PER_SEC);
+#endif
+}                        /* End of walltime */
+
+
 int  badvalve(int n)
 /*
 **-----------------------------------------------------------------
@@ -1657,6 +2221,7 @@ int  pswitch()
 */
 {
    int   i,                 /* Control statement index */
+         j,                 /* Position in junction controls */
          k,                 /* Link being controlled */
          n,                 /* Node controlling link */
          reset,             /* Flag on control conditions */
@@ -1664,9 +2229,10 @@ int  pswitch()
          anychange = 0;     /* Flag for 1 or more changes */
    char  s;                 /* Current link status */
 
-   /* Check each control statement */
-   for (i=1; i<=Ncontrols; i++)
+   /* Check each control statement on a junction */
+   for (j=0; j<Njuncctl; j++)
    {
+      i = Juncctl[j];
       reset = 0;
       if ( (k = Control[i].Link) <= 0) continue;
 
@@ -1728,13 +2294,11 @@ double newflows()
 **----------------------------------------------------------------
 */
 {
-   double  dh,                    /* Link head loss       */
-           dq;                    /* Link flow change     */
+   double  dq;                    /* Link flow change     */
    double  dqsum,                 /* Network flow change  */
            qsum;                  /* Network total flow   */
    int   k, n, n1, n2;
-  
-  //float* fQ;
+   Shydassembly *a = Hydassembly;
 
    /* Initialize net inflows (i.e., demands) at tanks */
    for (n=Njuncs+1; n <= Nnodes; n++) D[n] = 0.0;
@@ -1743,36 +2307,16 @@ double newflows()
    qsum  = 0.0;
    dqsum = 0.0;
 
-  
-  
-  
+   /* Have any assembly workers update link & emitter flows */
+   if (a != NULL) runassembly(FLOWJOB);
+
    /* Update flows in all links */
    for (k=1; k<=Nlinks; k++)
    {
-
-      /*
-      ** Apply flow update formula:                   
-      **   dq = Y - P*(new head loss)                 
-      **    P = 1/(dh/dq)                             
-      **    Y = P*(head loss based on current flow)   
-      ** where P & Y were computed in newcoeffs().   
-      */
-
       n1 = Link[k].N1;
       n2 = Link[k].N2;
-      dh = H[n1] - H[n2];
-      dq = Y[k] - P[k]*dh;
-
-      /* Adjust flow change by the relaxation factor */                        //(2.00.11 - LR)
-      dq *= RelaxFactor;                                                       //(2.00.11 - LR)
-
-      /* Prevent flow in constant HP pumps from going negative */
-      if (Link[k].Type == PUMP)
-      {
-         n = PUMPINDEX(k);
-         if (Pump[n].Ptype == CONST_HP && dq > Q[k]) dq = Q[k]/2.0;
-      }
-      Q[k] -= dq;
+      if (a != NULL) dq = a->dq[k];
+      else dq = flowchange(k);
 
       /* Update sum of absolute flows & flow corrections */
       qsum += ABS(Q[k]);
@@ -1791,8 +2335,12 @@ double newflows()
    for (k=1; k<=Njuncs; k++)
    {
       if (Node[k].Ke == 0.0) continue;
-      dq = emitflowchange(k);
-      E[k] -= dq;
+      if (a != NULL) dq = a->edq[k];
+      else
+      {
+         dq = emitflowchange(k);
+         E[k] -= dq;
+      }
       qsum += ABS(E[k]);
       dqsum += ABS(dq);
    }
@@ -1804,6 +2352,43 @@ double newflows()
 }                        /* End of newflows */
 
 
+double  flowchange(int k)
+/*
+**----------------------------------------------------------------
+**  Input:   k = link index
+**  Output:  returns flow change in link k
+**  Purpose: updates flow in a link after new nodal heads computed
+**----------------------------------------------------------------
+*/
+{
+   double  dh,                    /* Link head loss       */
+           dq;                    /* Link flow change     */
+   int     n;
+
+   /*
+   ** Apply flow update formula:                   
+   **   dq = Y - P*(new head loss)                 
+   **    P = 1/(dh/dq)                             
+   **    Y = P*(head loss based on current flow)   
+   ** where P & Y were computed in newcoeffs().   
+   */
+   dh = H[Link[k].N1] - H[Link[k].N2];
+   dq = Y[k] - P[k]*dh;
+
+   /* Adjust flow change by the relaxation factor */                        //(2.00.11 - LR)
+   dq *= RelaxFactor;                                                       //(2.00.11 - LR)
+
+   /* Prevent flow in constant HP pumps from going negative */
+   if (Link[k].Type == PUMP)
+   {
+      n = PUMPINDEX(k);
+      if (Pump[n].Ptype == CONST_HP && dq > Q[k]) dq = Q[k]/2.0;
+   }
+   Q[k] -= dq;
+   return(dq);
+}                        /* End of flowchange */
+
+
 void   newcoeffs()
 /*
 **--------------------------------------------------------------
@@ -1819,8 +2404,13 @@ void   newcoeffs()
    memset(X,0,(Nnodes+1)*sizeof(double));
    memset(P,0,(Nlinks+1)*sizeof(double));
    memset(Y,0,(Nlinks+1)*sizeof(double));
-   linkcoeffs();                            /* Compute link coeffs.  */
-   emittercoeffs();                         /* Compute emitter coeffs.*/
+   if (Hydassembly != NULL)
+      assemblecoeffs();                     /* Link & emitter coeffs. */
+   else                                     /* on assembly workers    */
+   {
+      linkcoeffs();                         /* Compute link coeffs.  */
+      emittercoeffs();                      /* Compute emitter coeffs.*/
+   }
    nodecoeffs();                            /* Compute node coeffs.  */
    valvecoeffs();                           /* Compute valve coeffs. */
 }                        /* End of newcoeffs */
@@ -1835,56 +2425,80 @@ void  linkcoeffs()
 **--------------------------------------------------------------
 */
 {
-   int   k,n1,n2;
+   int   k;
 
    /* Examine each link of network */
    for (k=1; k<=Nlinks; k++)
    {
-      n1 = Link[k].N1;           /* Start node of link */
-      n2 = Link[k].N2;           /* End node of link   */
+      if (linkcoeff(k)) addlinkcoeff(k);
+   }
+}                        /* End of linkcoeffs */
 
-      /* Compute P[k] = 1 / (dh/dQ) and Y[k] = h * P[k]   */
-      /* for each link k (where h = link head loss).      */
-      /* FCVs, PRVs, and PSVs with non-fixed status       */
-      /* are analyzed later.                              */
 
-      switch (Link[k].Type)
-      {
-         case CV:
-         case PIPE:  pipecoeff(k); break;
-         case PUMP:  pumpcoeff(k); break;
-         case PBV:   pbvcoeff(k);  break;
-         case TCV:   tcvcoeff(k);  break;
-         case GPV:   gpvcoeff(k);  break;
-         case FCV:   
-         case PRV:
-         case PSV:   /* If valve status fixed then treat as pipe */
-                     /* otherwise ignore the valve for now. */
-                     if (K[k] == MISSING) valvecoeff(k);  //pipecoeff(k);      //(2.00.11 - LR)    
-                     else continue;
-                     break;
-         default:    continue;                  
-      }                                         
-
-      /* Update net nodal inflows (X), solution matrix (A) and RHS array (F) */
-      /* (Use covention that flow out of node is (-), flow into node is (+)) */
-      X[n1] -= Q[k];
-      X[n2] += Q[k];
-      Aij[Ndx[k]] -= P[k];              /* Off-diagonal coeff. */
-      if (n1 <= Njuncs)                 /* Node n1 is junction */
-      {
-         Aii[Row[n1]] += P[k];          /* Diagonal coeff. */
-         F[Row[n1]] += Y[k];            /* RHS coeff.      */
-      }
-      else F[Row[n2]] += (P[k]*H[n1]);  /* Node n1 is a tank   */
-      if (n2 <= Njuncs)                 /* Node n2 is junction */
-      {
-         Aii[Row[n2]] += P[k];          /* Diagonal coeff. */
-         F[Row[n2]] -= Y[k];            /* RHS coeff.      */
-      }
-      else  F[Row[n1]] += (P[k]*H[n2]); /* Node n2 is a tank   */
+int  linkcoeff(int k)
+/*
+**--------------------------------------------------------------
+**   Input:   k = link index
+**   Output:  returns TRUE if link's coeffs. were computed
+**   Purpose: computes P[k] = 1 / (dh/dQ) and Y[k] = h * P[k]
+**            for link k (where h = link head loss). FCVs, PRVs,
+**            and PSVs with non-fixed status are analyzed later.
+**--------------------------------------------------------------
+*/
+{
+   switch (Link[k].Type)
+   {
+      case CV:
+      case PIPE:  pipecoeff(k); break;
+      case PUMP:  pumpcoeff(k); break;
+      case PBV:   pbvcoeff(k);  break;
+      case TCV:   tcvcoeff(k);  break;
+      case GPV:   gpvcoeff(k);  break;
+      case FCV:   
+      case PRV:
+      case PSV:   /* If valve status fixed then treat as pipe */
+                  /* otherwise ignore the valve for now. */
+                  if (K[k] == MISSING) valvecoeff(k);  //pipecoeff(k);      //(2.00.11 - LR)    
+                  else return(FALSE);
+                  break;
+      default:    return(FALSE);
+   }
+   return(TRUE);
+}                        /* End of linkcoeff */
+
+
+void  addlinkcoeff(int k)
+/*
+**--------------------------------------------------------------
+**   Input:   k = link index
+**   Output:  none
+**   Purpose: adds link k's coeffs. into the solution matrix
+**--------------------------------------------------------------
+*/
+{
+   int   n1,n2;
+
+   n1 = Link[k].N1;           /* Start node of link */
+   n2 = Link[k].N2;           /* End node of link   */
+
+   /* Update net nodal inflows (X), solution matrix (A) and RHS array (F) */
+   /* (Use covention that flow out of node is (-), flow into node is (+)) */
+   X[n1] -= Q[k];
+   X[n2] += Q[k];
+   Aij[Ndx[k]] -= P[k];              /* Off-diagonal coeff. */
+   if (n1 <= Njuncs)                 /* Node n1 is junction */
+   {
+      Aii[Row[n1]] += P[k];          /* Diagonal coeff. */
+      F[Row[n1]] += Y[k];            /* RHS coeff.      */
    }
-}                        /* End of linkcoeffs */
+   else F[Row[n2]] += (P[k]*H[n1]);  /* Node n1 is a tank   */
+   if (n2 <= Njuncs)                 /* Node n2 is junction */
+   {
+      Aii[Row[n2]] += P[k];          /* Diagonal coeff. */
+      F[Row[n2]] -= Y[k];            /* RHS coeff.      */
+   }
+   else  F[Row[n1]] += (P[k]*H[n2]); /* Node n2 is a tank   */
+}                        /* End of addlinkcoeff */
 
 
 void  nodecoeffs()
@@ -1953,28 +2567,56 @@ void  emittercoeffs()
 */
 {
    int   i;
-   double  ke;
    double  p;
-   double  q;
    double  y;
-   double  z;
    for (i=1; i<=Njuncs; i++)
    {
       if (Node[i].Ke == 0.0) continue;
-      ke = MAX(CSMALL, Node[i].Ke);
-      q = E[i];
-      z = ke*pow(ABS(q),Qexp);
-      p = Qexp*z/ABS(q);
-      if (p < RQtol) p = 1.0/RQtol;
-      else p = 1.0/p;
-      y = SGN(q)*z*p;
-      Aii[Row[i]] += p;
-      F[Row[i]] += y + p*Node[i].El; 
-      X[i] -= q;
+      emittercoeff(i,&p,&y);
+      addemittercoeff(i,p,y);
    }
 }
 
 
+void  emittercoeff(int i, double *p, double *y)
+/*
+**--------------------------------------------------------------
+**   Input:   i = junction index
+**   Output:  *p = inverse head loss gradient of its emitter
+**            *y = its flow correction term
+**   Purpose: computes matrix coeffs. for an emitter
+**--------------------------------------------------------------
+*/
+{
+   double  ke;
+   double  q;
+   double  z;
+   ke = MAX(CSMALL, Node[i].Ke);
+   q = E[i];
+   z = ke*hydpow(ABS(q),Qexp);
+   *p = Qexp*z/ABS(q);
+   if (*p < RQtol) *p = 1.0/RQtol;
+   else *p = 1.0/(*p);
+   *y = SGN(q)*z*(*p);
+}
+
+
+void  addemittercoeff(int i, double p, double y)
+/*
+**--------------------------------------------------------------
+**   Input:   i = junction index
+**            p, y = its emitter's coeffs. (see emittercoeff())
+**   Output:  none
+**   Purpose: adds an emitter's coeffs. into the solution matrix
+**--------------------------------------------------------------
+*/
+{
+   Aii[Row[i]] += p;
+   F[Row[i]] += y + p*Node[i].El; 
+   X[i] -= E[i];
+}
+
+
 double  emitflowchange(int i)
 /*
 **--------------------------------------------------------------
@@ -1986,7 +2628,7 @@ double  emitflowchange(int i)
 {
    double ke, p;
    ke = MAX(CSMALL, Node[i].Ke);
-   p = Qexp*ke*pow(ABS(E[i]),(Qexp-1.0));
+   p = Qexp*ke*hydpow(ABS(E[i]),(Qexp-1.0));
    if (p < RQtol)
       p = 1/RQtol;
    else
@@ -2495,5 +3137,520 @@ void valvecoeff(int k)
    }
 }
 
+
+void  openassembly()
+/*
+**--------------------------------------------------------------
+**   Input:   none
+**   Output:  none
+**   Purpose: starts (or stops) the workers that assemble link
+**            & emitter coeffs., as HydThreads & Fastpowflag
+**            ask for, and loads the pipe kernel's arrays with
+**            the links' current coeffs. Stays serial if the
+**            workers can't be started.
+**--------------------------------------------------------------
+*/
+{
+   int    i,j,k,n;
+   Shydassembly *a;
+   Shydworker   *w;
+
+   n = MIN(HydThreads, Nlinks/MINHYDLINKS);
+#ifndef PARALLEL_ASSEMBLY
+   n = 1;
+#endif
+   if (n < 1) n = 1;
+   if (n < 2 && !Fastpowflag)
+   {
+      closeassembly();
+      return;
+   }
+   if (Hydassembly == NULL || Hydassembly->n != n)
+   {
+      closeassembly();
+      if (newassembly(n)) return;
+   }
+   a = Hydassembly;
+
+   /* List the open-formula (H-W or C-M) pipes of each */
+   /* worker's links, in order of index                */
+   a->npipes = 0;
+   for (i=0; i<n; i++)
+   {
+      w = &a->worker[i];
+      w->plo = a->npipes;
+      for (k=w->lo; k<=w->hi; k++)
+      {
+         a->kernel[k] = (char)(Formflag != DW && Link[k].Type <= PIPE);
+         if (!a->kernel[k]) continue;
+         j = a->npipes++;
+         a->pipe[j] = k;
+         a->pr[j]   = Link[k].R;
+         a->pkm[j]  = Link[k].Km;
+      }
+      w->phi = a->npipes;
+   }
+}
+
+
+int  newassembly(int n)
+/*
+**--------------------------------------------------------------
+**   Input:   n = number of workers (incl. the calling thread)
+**   Output:  returns error code
+**   Purpose: allocates assembly workers & starts their threads
+**--------------------------------------------------------------
+*/
+{
+   int    errcode = 0;
+   int    i;
+   Shydassembly *a;
+   Shydworker   *w;
+
+   a = (Shydassembly *) calloc(1, sizeof(Shydassembly));
+   if (a == NULL) return(101);
+   Hydassembly = a;
+   a->n = n;
+#ifdef PARALLEL_ASSEMBLY
+   pthread_mutex_init(&a->lock, NULL);
+   pthread_cond_init(&a->cond, NULL);
+   a->count = n;
+#endif
+   a->worker = (Shydworker *) calloc(n, sizeof(Shydworker));
+   a->pipe   = (int *)    calloc(Nlinks+1, sizeof(int));
+   a->pr     = (double *) calloc(Nlinks+1, sizeof(double));
+   a->pkm    = (double *) calloc(Nlinks+1, sizeof(double));
+   a->pq     = (double *) calloc(Nlinks+1, sizeof(double));
+   a->ph     = (double *) calloc(Nlinks+1, sizeof(double));
+   a->kernel = (char *)   calloc(Nlinks+1, sizeof(char));
+   a->added  = (char *)   calloc(Nlinks+1, sizeof(char));
+   a->dq     = (double *) calloc(Nlinks+1, sizeof(double));
+   a->ep     = (double *) calloc(Njuncs+1, sizeof(double));
+   a->ey     = (double *) calloc(Njuncs+1, sizeof(double));
+   a->edq    = (double *) calloc(Njuncs+1, sizeof(double));
+   ERRCODE(MEMCHECK(a->worker));
+   ERRCODE(MEMCHECK(a->pipe));
+   ERRCODE(MEMCHECK(a->pr));
+   ERRCODE(MEMCHECK(a->pkm));
+   ERRCODE(MEMCHECK(a->pq));
+   ERRCODE(MEMCHECK(a->ph));
+   ERRCODE(MEMCHECK(a->kernel));
+   ERRCODE(MEMCHECK(a->added));
+   ERRCODE(MEMCHECK(a->dq));
+   ERRCODE(MEMCHECK(a->ep));
+   ERRCODE(MEMCHECK(a->ey));
+   ERRCODE(MEMCHECK(a->edq));
+   ERRCODE(copystate(&a->state));
+   if (errcode)
+   {
+      closeassembly();
+      return(errcode);
+   }
+
+   /* Share out links & junctions */
+   for (i=0; i<n; i++)
+   {
+      w = &a->worker[i];
+      w->index = i;
+      w->owner = a;
+      w->lo  = 1 + (int)((double)Nlinks*i/n);
+      w->hi  = (int)((double)Nlinks*(i+1)/n);
+      w->nlo = 1 + (int)((double)Njuncs*i/n);
+      w->nhi = (int)((double)Njuncs*(i+1)/n);
+   }
+
+#ifdef PARALLEL_ASSEMBLY
+   /* Start their threads (staying serial instead if */
+   /* they can't all be started)                     */
+   for (i=1; i<n; i++)
+   {
+      if (pthread_create(&a->worker[i].thread, NULL, assemblyworker,
+                         &a->worker[i]) != 0) break;
+      a->nthreads++;
+   }
+   if (a->nthreads < n-1)
+   {
+      closeassembly();
+      return(101);
+   }
+#endif
+   return(0);
+}
+
+
+void  closeassembly()
+/*
+**--------------------------------------------------------------
+**   Input:   none
+**   Output:  none
+**   Purpose: stops the threads that assemble coeffs. and frees
+**            their memory
+**--------------------------------------------------------------
+*/
+{
+   int i;
+   Shydassembly *a = Hydassembly;
+
+   if (a == NULL) return;
+   Hydassembly = NULL;
+
+#ifdef PARALLEL_ASSEMBLY
+   if (a->nthreads > 0)
+   {
+      pthread_mutex_lock(&a->lock);
+      a->count = a->nthreads + 1;
+      a->quit = TRUE;
+      pthread_mutex_unlock(&a->lock);
+      waitassembly(a);
+      for (i=1; i<=a->nthreads; i++) pthread_join(a->worker[i].thread, NULL);
+   }
+   pthread_mutex_destroy(&a->lock);
+   pthread_cond_destroy(&a->cond);
+#endif
+
+   free(a->worker);
+   free(a->pipe);
+   free(a->pr);
+   free(a->pkm);
+   free(a->pq);
+   free(a->ph);
+   free(a->kernel);
+   free(a->added);
+   free(a->dq);
+   free(a->ep);
+   free(a->ey);
+   free(a->edq);
+   free(a->state);
+   free(a);
+}
+
+
+void  *assemblyworker(void *arg)
+/*
+**--------------------------------------------------------------
+**   Input:   arg = worker
+**   Output:  returns NULL
+**   Purpose: runs an assembly worker's thread, which does its
+**            part of each job that runassembly() hands it
+**--------------------------------------------------------------
+*/
+{
+   Shydworker   *w = (Shydworker *) arg;
+   Shydassembly *a = w->owner;
+
+   for (;;)
+   {
+      /* Wait for a job, or to quit */
+      waitassembly(a);
+      if (a->quit) break;
+
+      /* Take on the caller's state & do its part */
+      usestate(a->state);
+      shareassembly(w);
+      waitassembly(a);
+   }
+   return(NULL);
+}
+
+
+void  waitassembly(Shydassembly *a)
+/*
+**--------------------------------------------------------------
+**   Input:   a = assembly workers
+**   Output:  none
+**   Purpose: waits until all of the workers have got here
+**--------------------------------------------------------------
+*/
+{
+#ifdef PARALLEL_ASSEMBLY
+   unsigned generation;
+
+   pthread_mutex_lock(&a->lock);
+   generation = a->generation;
+   if (++a->waiting == a->count)
+   {
+      a->waiting = 0;
+      a->generation++;
+      pthread_cond_broadcast(&a->cond);
+   }
+   else while (generation == a->generation)
+   {
+      pthread_cond_wait(&a->cond, &a->lock);
+   }
+   pthread_mutex_unlock(&a->lock);
+#endif
+}
+
+
+void  runassembly(int job)
+/*
+**--------------------------------------------------------------
+**   Input:   job = COEFFJOB or FLOWJOB
+**   Output:  none
+**   Purpose: has the assembly workers do a job, each its part,
+**            and waits for them to finish it
+**--------------------------------------------------------------
+*/
+{
+   int i;
+   Shydassembly *a = Hydassembly;
+
+   a->job = job;
+
+   /* Have the workers start from this thread's state, */
+   /* or do all their parts here if it can't be copied */
+   if (a->nthreads > 0 && !copystate(&a->state))
+   {
+      waitassembly(a);
+      shareassembly(&a->worker[0]);
+      waitassembly(a);
+   }
+   else for (i=0; i<a->n; i++) shareassembly(&a->worker[i]);
+}
+
+
+void  shareassembly(Shydworker *w)
+/*
+**--------------------------------------------------------------
+**   Input:   w = worker
+**   Output:  none
+**   Purpose: does a worker's part of the job being done: the
+**            coeffs. of its links & emitters, or their flow
+**            changes, each kept for the calling thread to add
+**            up in order of index
+**--------------------------------------------------------------
+*/
+{
+   int    i,k;
+   Shydassembly *a = w->owner;
+
+   if (a->job == COEFFJOB)
+   {
+      pipekernel(a,w->plo,w->phi);
+      for (k=w->lo; k<=w->hi; k++)
+      {
+         if (a->kernel[k]) a->added[k] = TRUE;
+         else a->added[k] = (char)linkcoeff(k);
+      }
+      for (i=w->nlo; i<=w->nhi; i++)
+      {
+         if (Node[i].Ke == 0.0) continue;
+         emittercoeff(i,&a->ep[i],&a->ey[i]);
+      }
+   }
+   else
+   {
+      for (k=w->lo; k<=w->hi; k++) a->dq[k] = flowchange(k);
+      for (i=w->nlo; i<=w->nhi; i++)
+      {
+         if (Node[i].Ke == 0.0) continue;
+         a->edq[i] = emitflowchange(i);
+         E[i] -= a->edq[i];
+      }
+   }
+}
+
+
+void  assemblecoeffs()
+/*
+**--------------------------------------------------------------
+**   Input:   none
+**   Output:  none
+**   Purpose: computes link & emitter coeffs. on the assembly
+**            workers, then adds them into the solution matrix
+**            in the same order as linkcoeffs() and
+**            emittercoeffs() do
+**--------------------------------------------------------------
+*/
+{
+   int    i,k;
+   Shydassembly *a = Hydassembly;
+
+   runassembly(COEFFJOB);
+   for (k=1; k<=Nlinks; k++)
+   {
+      if (a->added[k]) addlinkcoeff(k);
+   }
+   for (i=1; i<=Njuncs; i++)
+   {
+      if (Node[i].Ke == 0.0) continue;
+      addemittercoeff(i,a->ep[i],a->ey[i]);
+   }
+}
+
+
+void  pipekernel(Shydassembly *a, int lo, int hi)
+/*
+**--------------------------------------------------------------
+**   Input:   a = assembly workers
+**            lo, hi = range of their pipe kernel arrays
+**   Output:  none
+**   Purpose: computes P & Y coeffs. for a run of H-W or C-M
+**            pipes, as pipecoeff() does, from arrays of their
+**            own coeffs. -- their friction head losses all
+**            raised to Hexp by one call of powkernel()
+**--------------------------------------------------------------
+*/
+{
+   int    j,k;
+   double hml,       /* Minor head loss         */
+          ml,        /* Minor loss coeff.       */
+          p,         /* q*(dh/dq)               */
+          q;         /* Abs. value of flow      */
+
+   /* Friction head losses: r*q^Hexp */
+   for (j=lo; j<hi; j++) a->pq[j] = ABS(Q[a->pipe[j]]);
+   powkernel(a->pq+lo,hi-lo,Hexp,a->ph+lo);
+   for (j=lo; j<hi; j++) a->ph[j] *= a->pr[j];
+
+   for (j=lo; j<hi; j++)
+   {
+      k = a->pipe[j];
+
+      /* For closed pipe use headloss formula: h = CBIG*q */
+      if (S[k] <= CLOSED)
+      {
+         P[k] = 1.0/CBIG;
+         Y[k] = Q[k];
+         continue;
+      }
+
+      /* Use large P coefficient for small flow resistance product */
+      q = a->pq[j];
+      ml = a->pkm[j];
+      if ((a->pr[j]+ml)*q < RQtol)
+      {
+         P[k] = 1.0/RQtol;
+         Y[k] = Q[k]/Hexp;
+         continue;
+      }
+
+      /* Compute P and Y coefficients */
+      p = Hexp*a->ph[j];                /* Q*dh(friction)/dQ   */
+      if (ml > 0.0)
+      {
+         hml = ml*q*q;                  /* Minor head loss   */
+         p += 2.0*hml;                  /* Q*dh(Total)/dQ    */
+      }
+      else  hml = 0.0;
+      p = Q[k]/p;                       /* 1 / (dh/dQ) */
+      P[k] = ABS(p);
+      Y[k] = p*(a->ph[j] + hml);
+   }
+}                        /* End of pipekernel */
+
+
+void  powkernel(double *x, int n, double e, double *y)
+/*
+**--------------------------------------------------------------
+**   Input:   x = n numbers, none negative
+**            e = exponent
+**   Output:  y = each of them raised to e
+**   Purpose: raises numbers to a power, with pow(), or if
+**            Fastpowflag is set, to a relative error of under
+**            1e-13 with no branches, calls or conversions
+**            between integers & doubles, so that the compiler
+**            can vectorize the loop
+**
+**   The fast power is 2^(e*log2(x)). x = m*2^k with
+**   1/sqrt(2) <= m < sqrt(2), from its bits. ln(m) = 2*atanh(s),
+**   s = (m-1)/(m+1), |s| < 0.172, by its series to s^19. Then
+**   e*log2(x) = i + f with i whole & |f| <= 1/2, and
+**   2^f = exp(f*ln(2)) by its Taylor series to the 13th power;
+**   2^i is made from its bits. Whole numbers go between bits &
+**   doubles by way of 2^52, whose low mantissa bits they fill.
+**   Numbers too small to be normal are raised to 0; the power
+**   itself must be normal too, or what's returned is undefined.
+**--------------------------------------------------------------
+*/
+{
+   int    i;
+   union
+   {
+      double d;
+      unsigned long long u;
+   }  v, w;
+   unsigned long long bits, big, normal;
+   double k, m, s, t, z;
+
+   if (!Fastpowflag)
+   {
+      for (i=0; i<n; i++) y[i] = pow(x[i],e);
+      return;
+   }
+   for (i=0; i<n; i++)
+   {
+      /* Split x into mantissa & exponent, noting if it's normal */
+      v.d = x[i];
+      bits = (v.u >> 52) & 0x7ffULL;
+      normal = 0ULL - (unsigned long long)(bits != 0ULL);
+      big = (unsigned long long)((v.u & MANTISSA) > SQRT2BITS);
+      w.u = (bits + big) | TWO52BITS;
+      k = (w.d - TWO52) - 1023.0;
+      v.u = (v.u & MANTISSA) | ((0x3ffULL - big) << 52);
+      m = v.d;
+
+      /* ln(m), then e*log2(x) */
+      s = (m - 1.0)/(m + 1.0);
+      t = s*s;
+      z = 1.0/19.0;
+      z = 1.0/17.0 + t*z;
+      z = 1.0/15.0 + t*z;
+      z = 1.0/13.0 + t*z;
+      z = 1.0/11.0 + t*z;
+      z = 1.0/9.0 + t*z;
+      z = 1.0/7.0 + t*z;
+      z = 1.0/5.0 + t*z;
+      z = 1.0/3.0 + t*z;
+      z = 2.0*s*(1.0 + t*z);
+      z = e*(k + z*LOG2E);
+
+      /* 2^f, then scaled by 2^i */
+      k = (z + 1.5*TWO52) - 1.5*TWO52;    /* Nearest whole number */
+      t = (z - k)*LN2;
+      z = 1.0/6227020800.0;
+      z = 1.0/479001600.0 + t*z;
+      z = 1.0/39916800.0 + t*z;
+      z = 1.0/3628800.0 + t*z;
+      z = 1.0/362880.0 + t*z;
+      z = 1.0/40320.0 + t*z;
+      z = 1.0/5040.0 + t*z;
+      z = 1.0/720.0 + t*z;
+      z = 1.0/120.0 + t*z;
+      z = 1.0/24.0 + t*z;
+      z = 1.0/6.0 + t*z;
+      z = 0.5 + t*z;
+      z = 1.0 + t*z;
+      z = 1.0 + t*z;
+      w.d = k + (TWO52 + 1023.0);
+      v.u = w.u << 52;
+      v.d *= z;
+      v.u &= normal;
+      y[i] = v.d;
+   }
+}                        /* End of powkernel */
+
+
+double  hydpow(double x, double e)
+/*
+**--------------------------------------------------------------
+**   Input:   x = number, not negative
+**            e = exponent
+**   Output:  returns x raised to e
+**   Purpose: raises a number to a power as powkernel() does,
+**            when the coeffs. are assembled by workers
+**--------------------------------------------------------------
+*/
+{
+   double y;
+
+   if (Fastpowflag && Hydassembly != NULL && x >= FASTPOWMIN && x <= 1.0/FASTPOWMIN)
+   {
+      powkernel(&x,1,e,&y);
+      return(y);
+   }
+   return(pow(x,e));
+}
+
 /****************  END OF HYDRAUL.C  ***************/
 
@@ -26,7 +26,7 @@ data describing a piping network to a file in EPANET's text format.
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 /* Defined in enumstxt.h in EPANET.C */
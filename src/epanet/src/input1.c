@@ -29,7 +29,7 @@ AUTHOR:     L. Rossman
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 /*
@@ -75,7 +75,7 @@ int  getdata()
    int errcode = 0;
    setdefaults();                /* Assign default data values     */
    initreport();                 /* Initialize reporting options   */
-   rewind(InFile);               /* Rewind input file              */
+   rewindinput();                /* Rewind input file              */
    ERRCODE(readdata());          /* Read in network data           */
    if (!errcode) adjustdata();   /* Adjust data for default values */
    if (!errcode) initunits();    /* Initialize units on input data */
@@ -100,11 +100,16 @@ void  setdefaults()
    strncpy(TmpDir,"",MAXFNAME);                                                //(2.00.12 - LR)
    strncpy(TmpFname,"",MAXFNAME);                                              //(2.00.12 - LR)
    strncpy(HydFname,"",MAXFNAME);
+   strncpy(SparseFname,"",MAXFNAME);
    strncpy(MapFname,"",MAXFNAME);
    strncpy(ChemName,t_CHEMICAL,MAXID);
    strncpy(ChemUnits,u_MGperL,MAXID);
    strncpy(DefPatID,DEFPATID,MAXID);
    Hydflag   = SCRATCH;         /* No external hydraulics file    */
+   HydBuffer = 0;               /* Hydraulics via scratch file    */
+   QualThreads = 1;             /* WQ transport on one thread     */
+   HydThreads = 1;              /* Hyd. coeffs. on one thread     */
+   Fastpowflag = FALSE;         /* Exact powers in hyd. coeffs.   */
    Qualflag  = NONE;            /* No quality simulation          */
    Formflag  = HW;              /* Use Hazen-Williams formula     */
    Unitsflag = US;              /* US unit system                 */
@@ -150,6 +155,7 @@ void  setdefaults()
    CheckFreq = CHECKFREQ;
    MaxCheck  = MAXCHECK;
    DampLimit = DAMPLIMIT;                                                      //(2.00.12 - LR)
+   Warmflag  = TRUE;            /* Start from previous solution   */
 }                       /*  End of setdefaults  */
 
 
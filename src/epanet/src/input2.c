@@ -15,6 +15,13 @@ This module reads and interprets the input data from file InFile.
 The entry points for this module are:
    netsize()   -- called from ENopen() in EPANET.C
    readdata()  -- called from getdata() in INPUT1.C
+   rewindinput() -- called from getdata() in INPUT1.C
+   closeinput()  -- called from ENopen() in EPANET.C
+
+Both passes over the file take their lines from an image of it in
+memory (mapped with mmap() where there is one), which netsize()
+makes and closeinput() releases. Lines are cut from it just as
+fgets() would cut them, so the data read is the same either way.
 
 The following utility functions are all called from INPUT3.C
    addnodeID()
@@ -25,30 +32,48 @@ The following utility functions are all called from INPUT3.C
 **********************************************************************
 */
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L   /* fileno() and mmap(), under -std=c99 too */
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
+#include <locale.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#define MAPPED_INPUT
+#endif
 #include "hash.h"
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 #define   MAXERRS     10  /* Max. input errors reported        */
+#define   MAXDIGITS   19  /* Max. digits read by fastfloat()   */
 
-int    Ntokens,           /* Number of tokens in input line    */
+EN_THREAD int    Ntokens,           /* Number of tokens in input line    */
        Ntitle;            /* Number of title lines             */
-char   *Tok[MAXTOKS];     /* Array of token strings            */
+EN_THREAD char   *Tok[MAXTOKS];     /* Array of token strings            */
 
                           /* Used in INPUT3.C: */
-STmplist  *PrevPat;       /* Pointer to pattern list element   */
-STmplist  *PrevCurve;     /* Pointer to curve list element     */
-STmplist  *PrevCoord;     /* Pointer to coordinate list element     */ 
+EN_THREAD STmplist  *PrevPat;       /* Pointer to pattern list element   */
+EN_THREAD STmplist  *PrevCurve;     /* Pointer to curve list element     */
+EN_THREAD STmplist  *PrevCoord;     /* Pointer to coordinate list element     */ 
 						//06.02.2010 woohn
 
+                          /* Image of the input file: */
+EN_THREAD char   *Inpimage;         /* File contents (NULL = use fgets)  */
+EN_THREAD long   Inpsize;           /* Number of bytes in Inpimage       */
+EN_THREAD long   Inppos;            /* Offset of next line in Inpimage   */
+EN_THREAD char   Inpmapped;         /* TRUE if Inpimage is mmap'd        */
+
                           /* Defined in enumstxt.h in EPANET.C */
 extern char *SectTxt[];   /* Input section keywords            */
 extern char *RptSectTxt[];
@@ -80,12 +105,19 @@ int  netsize()
    sect        = -1;
    MaxCoords   = 0;				//06.02.2010 woohn
 
+/* Create hash tables for the IDs of patterns, curves & coordinates */
+   Patht   = HTcreate();
+   Curveht = HTcreate();
+   Coordht = HTcreate();
+   if (Patht == NULL || Curveht == NULL || Coordht == NULL) return(101);
+
 /* Add a default pattern 0 */
    MaxPats = -1;
    addpattern("");
 
 /* Make pass through data file counting number of each component */
-   while (fgets(line,MAXLINE,InFile) != NULL)
+   openinput();
+   while (nextline(line) != NULL)
    {
    /* Skip blank lines & those beginning with a comment */
       tok = strtok(line,SEPSTR);
@@ -180,7 +212,7 @@ int  readdata()
       errsum    = 0;
 
    /* Read each line from input file. */
-      while (fgets(line,MAXLINE,InFile) != NULL)
+      while (nextline(line) != NULL)
       {
 
       /* Make copy of line and scan for tokens */
@@ -459,7 +491,7 @@ int  addpattern(char *id)
    if (Patlist != NULL && strcmp(id,Patlist->ID) == 0) return(0);
 
 /* Check that pattern was not already created */
-   if (findID(id,Patlist) == NULL)
+   if (findID(id,Patht) == NULL)
    {
 
    /* Update pattern count & create new list element */
@@ -476,6 +508,7 @@ int  addpattern(char *id)
          p->y = NULL;
          p->next = Patlist;
          Patlist = p;
+         if (!HTinsertItem(Patht, p->ID, p)) return(101);
       }
    }
    return(0);
@@ -497,7 +530,7 @@ int  addcurve(char *id)
    if (Curvelist != NULL && strcmp(id,Curvelist->ID) == 0) return(0);
 
 /* Check that curve was not already created */
-   if (findID(id,Curvelist) == NULL)
+   if (findID(id,Curveht) == NULL)
    {
 
    /* Update curve count & create new list element */
@@ -514,6 +547,7 @@ int  addcurve(char *id)
          c->y = NULL;
          c->next = Curvelist;
          Curvelist = c;
+         if (!HTinsertItem(Curveht, c->ID, c)) return(101);
       }
    }
    return(0);
@@ -534,7 +568,7 @@ int  addcoord(char *id)
 	if (Coordlist != NULL && strcmp(id,Coordlist->ID) == 0) return(0);
 
 	/* Check that coordinate was not already created */
-	if (findID(id,Coordlist) == NULL)
+	if (findID(id,Coordht) == NULL)
 	{
 
 		/* Update coordinate count & create new list element */
@@ -551,31 +585,141 @@ int  addcoord(char *id)
 			c->y = NULL;
 			c->next = Coordlist;
 			Coordlist = c;
+			if (!HTinsertItem(Coordht, c->ID, c)) return(101);
 		}
 	}
 	return(0);
 }
 
 
-STmplist *findID(char *id, STmplist *list)
+void  openinput()
+/*
+**-------------------------------------------------------------
+**  Input:   none
+**  Output:  none
+**  Purpose: makes an image of the input file in memory, or
+**           leaves Inpimage NULL for nextline() to use fgets()
+**           if there is not the memory for one
+**-------------------------------------------------------------
+*/
+{
+   long n;
+   Inpimage = NULL;
+   Inpsize = 0;
+   Inppos = 0;
+   Inpmapped = FALSE;
+
+#ifdef MAPPED_INPUT
+/* Map the file, which POSIX reads the same in text or binary mode */
+   {
+      struct stat st;
+      void *p;
+      if (fstat(fileno(InFile),&st) == 0 && S_ISREG(st.st_mode)
+      &&  st.st_size > 0 && (off_t)(long)st.st_size == st.st_size)
+      {
+         p = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fileno(InFile),0);
+         if (p != MAP_FAILED)
+         {
+            Inpimage = (char *) p;
+            Inpsize = (long)st.st_size;
+            Inpmapped = TRUE;
+            return;
+         }
+      }
+   }
+#endif
+
+/* Otherwise read it through the stream, so that text mode */
+/* translates line endings as it would for fgets()         */
+   if (fseek(InFile,0L,SEEK_END) != 0 || (n = ftell(InFile)) <= 0)
+   {
+      rewind(InFile);
+      return;
+   }
+   rewind(InFile);
+   Inpimage = (char *) malloc(n);
+   if (Inpimage == NULL)
+   {
+      return;
+   }
+   Inpsize = (long) fread(Inpimage,1,n,InFile);
+   rewind(InFile);
+}
+
+
+char  *nextline(char *line)
+/*
+**-------------------------------------------------------------
+**  Input:   line = buffer of at least MAXLINE characters
+**  Output:  returns line, or NULL at end of file
+**  Purpose: reads the next line of the input file, as
+**           fgets(line,MAXLINE,InFile) would: up to and
+**           including a newline, or MAXLINE-1 characters
+**-------------------------------------------------------------
+*/
+{
+   long  n;
+   char  *s, *c;
+   if (Inpimage == NULL) return(fgets(line,MAXLINE,InFile));
+   n = Inpsize - Inppos;
+   if (n <= 0) return(NULL);
+   if (n > MAXLINE-1) n = MAXLINE-1;
+   s = Inpimage + Inppos;
+   c = (char *) memchr(s,'\n',n);
+   if (c != NULL) n = (long)(c - s) + 1;
+   memcpy(line,s,n);
+   line[n] = '\0';
+   Inppos += n;
+   return(line);
+}
+
+
+void  rewindinput()
+/*
+**-------------------------------------------------------------
+**  Input:   none
+**  Output:  none
+**  Purpose: returns nextline() to the start of the input file
+**-------------------------------------------------------------
+*/
+{
+   Inppos = 0;
+   rewind(InFile);
+}
+
+
+void  closeinput()
+/*
+**-------------------------------------------------------------
+**  Input:   none
+**  Output:  none
+**  Purpose: releases the image of the input file
+**-------------------------------------------------------------
+*/
+{
+#ifdef MAPPED_INPUT
+   if (Inpmapped) munmap(Inpimage,(size_t)Inpsize);
+   else
+#endif
+   free(Inpimage);
+   Inpimage = NULL;
+   Inpsize = 0;
+   Inppos = 0;
+   Inpmapped = FALSE;
+}
+
+
+STmplist *findID(char *id, HTtable *ht)
 /*
 **-------------------------------------------------------------
 **  Input:   id = ID label
-**           list = pointer to head of a temporary list
+**           ht = hash table of a temporary list's IDs
 **  Output:  returns list item with requested ID label 
 **  Purpose: searches for item in temporary list
 **-------------------------------------------------------------
 */
 {
-    STmplist *item;
-    for (item = list; item != NULL; item = item->next)
-    {
-        if (strcmp(item->ID,id) == 0)
-        {
-           return(item);
-        }
-    }
-    return(NULL);
+    return((STmplist *) HTfindItem(ht,id));
 }
 
 
@@ -978,6 +1122,85 @@ double  hour(char *time, char *units)
 }                        /* end of hour */
 
 
+int  fastfloat(char *s, double *y)
+/*
+**-----------------------------------------------------------
+**  Input:   *s = character string
+**  Output:  *y = floating point number
+**           returns 1 if s was converted, 0 if it is left
+**           for strtod()
+**  Purpose: converts a plain decimal number, [-]ddd.ddd[e[-]dd],
+**           without calling strtod()
+**
+** Only a number whose digits make an integer m of at most 2^53
+** and whose power of ten p is at most 22 either way is
+** converted, as m*10^p or m/10^-p. Since both operands are then
+** exact, the one rounding gives the correctly rounded value,
+** the same value strtod() returns. Anything else, including a
+** number followed by anything but the end of s, is left.
+**-----------------------------------------------------------
+*/
+{
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    static const double powers[] =
+    {
+       1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+       1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+       1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    unsigned long long m = 0;
+    int   neg = 0, eneg = 0;
+    int   ndigits = 0,          /* Digits of m after leading zeros */
+          nread = 0,            /* Digits read in all              */
+          e = 0, p = 0;
+    double v;
+
+    if (*s == '-' || *s == '+') neg = (*s++ == '-');
+    for (; *s >= '0' && *s <= '9'; s++, nread++)
+    {
+       if (m > 0 || *s != '0') ndigits++;
+       m = 10*m + (*s - '0');
+       if (ndigits > MAXDIGITS) return(0);
+    }
+    if (*s == '.')
+    {
+    /* Leave numbers to strtod() where it would not read '.' */
+       if (strcmp(localeconv()->decimal_point,".") != 0) return(0);
+       for (s++; *s >= '0' && *s <= '9'; s++, nread++)
+       {
+          if (m > 0 || *s != '0') ndigits++;
+          m = 10*m + (*s - '0');
+          if (ndigits > MAXDIGITS) return(0);
+          p--;
+       }
+    }
+    if (nread == 0) return(0);
+    if (*s == 'e' || *s == 'E')
+    {
+       s++;
+       if (*s == '-' || *s == '+') eneg = (*s++ == '-');
+       if (*s < '0' || *s > '9') return(0);
+       for (; *s >= '0' && *s <= '9'; s++)
+       {
+          e = 10*e + (*s - '0');
+          if (e > 1000) return(0);
+       }
+       p += eneg ? -e : e;
+    }
+    if (*s != '\0') return(0);
+
+    if (m == 0) v = 0.0;
+    else if (m > (1ULL << 53) || p > 22 || p < -22) return(0);
+    else if (p >= 0) v = (double)m * powers[p];
+    else v = (double)m / powers[-p];
+    *y = neg ? -v : v;
+    return(1);
+#else
+    return(0);
+#endif
+}
+
+
 int  getfloat(char *s, double *y)
 /*
 **-----------------------------------------------------------
@@ -989,6 +1212,7 @@ int  getfloat(char *s, double *y)
 */
 {
     char *endptr;
+    if (fastfloat(s,y)) return(1);
     *y = (double) strtod(s,&endptr);
     if (*endptr > 0) return(0);
     return(1);
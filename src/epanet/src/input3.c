@@ -28,7 +28,7 @@ All functions in this module are called from newline() in INPUT2.C.
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 /* Defined in enumstxt.h in EPANET.C */
@@ -36,11 +36,11 @@ extern char *MixTxt[];
 extern char *Fldname[]; 
 
 /* Defined in INPUT2.C */
-extern char      *Tok[MAXTOKS];
-extern STmplist  *PrevPat;
-extern STmplist  *PrevCurve;
-extern STmplist  *PrevCoord;
-extern int       Ntokens;
+extern EN_THREAD char      *Tok[MAXTOKS];
+extern EN_THREAD STmplist  *PrevPat;
+extern EN_THREAD STmplist  *PrevCurve;
+extern EN_THREAD STmplist  *PrevCoord;
+extern EN_THREAD int       Ntokens;
 
 
 int  juncdata()
@@ -73,7 +73,7 @@ int  juncdata()
    if (n >= 3  && !getfloat(Tok[2],&y)) return(202);
    if (n >= 4)
    {
-      pat = findID(Tok[3],Patlist);
+      pat = findID(Tok[3],Patht);
       if (pat == NULL) return(205);
       p = pat->i;
    }
@@ -147,7 +147,7 @@ int  tankdata()
    {
       if (n == 3)                            /* Pattern supplied  */
       {
-         t = findID(Tok[2],Patlist);
+         t = findID(Tok[2],Patht);
          if (t == NULL) return(205);
          p = t->i;
       }
@@ -167,7 +167,7 @@ int  tankdata()
       /* If volume curve supplied check it exists */
       if (n == 8)
       {                           
-         t = findID(Tok[7],Curvelist);
+         t = findID(Tok[7],Curveht);
          if (t == NULL) return(202);
          vcurve = t->i;
       }
@@ -379,13 +379,13 @@ int  pumpdata()
       }
       else if (match(Tok[m-1],w_HEAD))      /* Custom pump curve      */
       {
-         t = findID(Tok[m],Curvelist);
+         t = findID(Tok[m],Curveht);
          if (t == NULL) return(206);
          Pump[Npumps].Hcurve = t->i;
       }
       else if (match(Tok[m-1],w_PATTERN))   /* Speed/status pattern */
       {
-         t = findID(Tok[m],Patlist);
+         t = findID(Tok[m],Patht);
          if (t == NULL) return(205);
          Pump[Npumps].Upat = t->i;
       }
@@ -453,7 +453,7 @@ int  valvedata()
    if (diam <= 0.0) return(202);             /* Illegal diameter.*/
    if (type == GPV)                          /* Headloss curve for GPV */
    {
-      t = findID(Tok[5],Curvelist);
+      t = findID(Tok[5],Curveht);
       if (t == NULL) return(206);
       setting = t->i;
 
@@ -512,7 +512,7 @@ int  patterndata()
           PrevPat != NULL &&
           strcmp(Tok[0],PrevPat->ID) == 0
       ) p = PrevPat;
-   else p = findID(Tok[0],Patlist);
+   else p = findID(Tok[0],Patht);
    if (p == NULL) return(205);
    for (i=1; i<=n; i++)               /* Add multipliers to list */
    {
@@ -551,7 +551,7 @@ int  curvedata()
           PrevCurve != NULL &&
           strcmp(Tok[0],PrevCurve->ID) == 0
       ) c = PrevCurve;
-   else c = findID(Tok[0],Curvelist);
+   else c = findID(Tok[0],Curveht);
    if (c == NULL) return(205);
 
    /* Check for valid data */
@@ -598,9 +598,9 @@ int  coordata()
 		PrevCoord != NULL &&
 		strcmp(Tok[0],PrevCoord->ID) == 0
 		) c = PrevCoord;
-	else c = findID(Tok[0],Coordlist);
+	else c = findID(Tok[0],Coordht);
 
-//	c = findID(Tok[0],Coordlist);
+//	c = findID(Tok[0],Coordht);
 	if (c == NULL) return(205);
 
 	/* Check for valid data */
@@ -671,7 +671,7 @@ int  demanddata()
    if (j > Njuncs) return(208);
    if (n >= 3)
    {
-      pat = findID(Tok[2],Patlist);
+      pat = findID(Tok[2],Patht);
       if (pat == NULL)  return(205);
       p = pat->i;
    }
@@ -849,7 +849,7 @@ int  sourcedata()
 
    if (n > i+1 && strlen(Tok[i+1]) > 0 && strcmp(Tok[i+1], "*") != 0 )         //(2.00.11 - LR)
    {
-       pat = findID(Tok[i+1],Patlist);
+       pat = findID(Tok[i+1],Patht);
        if (pat == NULL) return(205);            /* Illegal pattern. */
        p = pat->i;
    }
@@ -1229,7 +1229,7 @@ int  energydata()
    }    
    else if (match(Tok[n-2],w_PATTERN))           /* Price pattern */
    {
-      t = findID(Tok[n-1],Patlist);              /* Check if pattern exists */
+      t = findID(Tok[n-1],Patht);              /* Check if pattern exists */
       if (t == NULL)
       {
          if (j == 0) return(213);
@@ -1249,7 +1249,7 @@ int  energydata()
       }
       else
       {
-         t = findID(Tok[n-1],Curvelist);         /* Check if curve exists */ 
+         t = findID(Tok[n-1],Curveht);         /* Check if curve exists */ 
          if (t == NULL) return(217);
          Pump[j].Ecurve = t->i;
       }
@@ -12,10 +12,12 @@
 **  AllocReset()    - reset the current pool
 **  AllocSetPool()  - set the current pool
 **  AllocFree()     - free the memory used by the current pool.
+**  AllocPoolBytes() - memory held by a pool.
 **
 */
 
 #include <stdlib.h>
+#include "types.h"
 #include "mempool.h"
 
 /*
@@ -45,13 +47,14 @@ typedef struct alloc_root_s
 {
     alloc_hdr_t *first,    /* First header in pool */
                 *current;  /* Current header       */
+    long        bytes;     /* Memory it holds      */
 }  alloc_root_t;
 
 /*
 **  root - Pointer to the current pool.
 */
 
-static alloc_root_t *root;
+static EN_THREAD alloc_root_t *root;
 
 
 /*
@@ -95,6 +98,7 @@ alloc_handle_t * AllocInit()
     if (root == NULL) return(NULL);
     if ( (root->first = AllocHdr()) == NULL) return(NULL);
     root->current = root->first;
+    root->bytes = sizeof(alloc_root_t) + sizeof(alloc_hdr_t) + ALLOC_BLOCK_SIZE;
     newpool = (alloc_handle_t *) root;
     return(newpool);
 }
@@ -138,6 +142,7 @@ char * Alloc(long size)
             /* extend the pool with a new block */
             if ( (hdr->next = AllocHdr()) == NULL) return(NULL);
             root->current = hdr->next;
+            root->bytes += sizeof(alloc_hdr_t) + ALLOC_BLOCK_SIZE;
         }
 
         /* set ptr to the first location in the next block */
@@ -201,3 +206,18 @@ void  AllocFreePool()
     free((char *) root);
     root = NULL;
 }
+
+
+/*
+**  AllocPoolBytes()
+**
+**  Memory held by a pool, its blocks and headers included.
+**  Blocks are only given back when the pool is freed, so
+**  this is also the most the pool has held.
+*/
+
+long  AllocPoolBytes(alloc_handle_t *pool)
+{
+    if (pool == NULL) return(0);
+    return(((alloc_root_t *) pool)->bytes);
+}
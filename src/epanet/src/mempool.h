@@ -17,3 +17,4 @@ char           *Alloc(long);
 alloc_handle_t *AllocSetPool(alloc_handle_t *);
 void            AllocReset(void);
 void            AllocFreePool(void);
+long            AllocPoolBytes(alloc_handle_t *);
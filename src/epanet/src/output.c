@@ -18,14 +18,19 @@ AUTHOR:     L. Rossman
 #include <math.h>
 #include "text.h"
 #include "types.h"
-#include "funcs.h"
-#define  EXTERN  extern
 #include "hash.h"
+#include "funcs.h"
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 /* Macro to write x[1] to x[n] to file OutFile: */
 #define   FSAVE(n)  (fwrite(x+1,sizeof(REAL4),(n),OutFile))
 
+/* Hydraulic solution n of the buffer kept in place of HydFile: */
+/* time, time step, then D, H, Q, S and K, like the file.       */
+#define   HYDRECSIZE   (2 + 2*Nnodes + 3*Nlinks)
+#define   HYDRECORD(n) (HydBuf + ((n) % HydBuffer)*HYDRECSIZE)
+
 int  savenetdata()
 /*
 **---------------------------------------------------------------
@@ -140,7 +145,26 @@ int  savehyd(long *htime)
    int i;
    INT4 t;
    int errcode = 0;
-   REAL4 *x = (REAL4 *) calloc(MAX(Nnodes,Nlinks) + 1, sizeof(REAL4));
+   REAL4 *x;
+   double *y;
+
+   /* Copy solution into the buffer if it replaces the file,  */
+   /* unless that would overwrite one that is still unread.   */
+   if (HydBuf != NULL)
+   {
+      if (HydBufCount - HydBufRead >= HydBuffer) return(308);
+      y = HYDRECORD(HydBufCount);
+      *y++ = *htime;
+      *y++ = 0.0;
+      for (i=1; i<=Nnodes; i++) *y++ = D[i];
+      for (i=1; i<=Nnodes; i++) *y++ = H[i];
+      for (i=1; i<=Nlinks; i++) *y++ = (S[i] <= CLOSED) ? 0.0 : Q[i];
+      for (i=1; i<=Nlinks; i++) *y++ = S[i];
+      for (i=1; i<=Nlinks; i++) *y++ = K[i];
+      return(0);
+   }
+
+   x = (REAL4 *) calloc(MAX(Nnodes,Nlinks) + 1, sizeof(REAL4));
    if ( x == NULL ) return 101;
 
    /* Save current time (htime) */
@@ -190,6 +214,16 @@ int  savehydstep(long *hydstep)
 {
    INT4 t;
    int errcode = 0;
+
+   /* A buffered solution is complete once it has its time step */
+   if (HydBuf != NULL)
+   {
+      if (HydBufCount - HydBufRead >= HydBuffer) return(308);
+      HYDRECORD(HydBufCount)[1] = *hydstep;
+      HydBufCount++;
+      return(0);
+   }
+
    t = (int)*hydstep;
    if (fwrite(&t,sizeof(INT4),1,HydFile) < 1) errcode = 308;
    if (t == 0) fputc(EOFMARK, HydFile);
@@ -272,7 +306,29 @@ int  readhyd(long *hydtime)
    int   i;
    INT4  t;
    int   result = 1;
-   REAL4 *x = (REAL4 *) calloc(MAX(Nnodes,Nlinks) + 1, sizeof(REAL4));
+   REAL4 *x;
+   double *y;
+
+   /* Read from the buffer if it replaces the file. Buffered  */
+   /* solutions are taken to follow on from one another, so   */
+   /* each one starts where the WQ solver has got to -- not   */
+   /* at the Htime it was solved at, which a caller stepping  */
+   /* the hydraulics a period at a time may have reset.       */
+   if (HydBuf != NULL)
+   {
+      if (HydBufRead >= HydBufCount) return(0);
+      y = HYDRECORD(HydBufRead);
+      *hydtime = Qtime;
+      y += 2;
+      for (i=1; i<=Nnodes; i++) D[i] = *y++;
+      for (i=1; i<=Nnodes; i++) H[i] = *y++;
+      for (i=1; i<=Nlinks; i++) Q[i] = *y++;
+      for (i=1; i<=Nlinks; i++) S[i] = (char) *y++;
+      for (i=1; i<=Nlinks; i++) K[i] = *y++;
+      return(1);
+   }
+
+   x = (REAL4 *) calloc(MAX(Nnodes,Nlinks) + 1, sizeof(REAL4));
    if ( x == NULL ) return 0;
 
    if (fread(&t,sizeof(INT4),1,HydFile) < 1)  result = 0;
@@ -309,12 +365,54 @@ int  readhydstep(long *hydstep)
 */
 {
    INT4  t;
+   if (HydBuf != NULL)
+   {
+      if (HydBufRead >= HydBufCount) return(0);
+      *hydstep = (long)HYDRECORD(HydBufRead)[1];
+      HydBufRead++;
+      return(1);
+   }
    if (fread(&t,sizeof(INT4),1,HydFile) < 1)  return(0);
    *hydstep = t;
    return(1);
 }                        /* End of readhydstep */
 
 
+int  openhydbuffer()
+/*
+**--------------------------------------------------------------
+**   Input:   none                                                
+**   Output:  returns error code                                  
+**   Purpose: allocates room for the last HydBuffer hydraulic
+**            solutions, kept in memory in place of a scratch
+**            hydraulics file
+**--------------------------------------------------------------
+*/
+{
+   if (HydBuf == NULL)
+      HydBuf = (double *) calloc((size_t)HydBuffer*HYDRECSIZE, sizeof(double));
+   if (HydBuf == NULL) return(101);
+   HydBufCount = 0;
+   HydBufRead = 0;
+   return(0);
+}
+
+
+void  rewindhyd()
+/*
+**--------------------------------------------------------------
+**   Input:   none                                                
+**   Output:  none                                  
+**   Purpose: goes back to the first hydraulic solution saved --
+**            the oldest one still kept, for a buffer
+**--------------------------------------------------------------
+*/
+{
+   if (HydBuf != NULL) HydBufRead = MAX(0, HydBufCount - HydBuffer);
+   else fseek(HydFile,HydOffset,SEEK_SET);
+}
+
+
 int  saveoutput()
 /*
 **--------------------------------------------------------------
@@ -0,0 +1,488 @@
+/*
+*******************************************************************
+
+PROJECT.C -- Separate simulator states for the EPANET Toolkit
+
+This module lets one process hold several networks at once, each
+with its own simulator state, and run them on separate threads.
+
+All of the simulator's state lives in global variables (those of
+VARS.H plus a few that are private to a module). Each of them is
+thread-local (see EN_THREAD in TYPES.H), and an ENproject is a
+place to keep a full copy of them. Attaching a project to a thread
+loads its copy into that thread's globals; detaching it saves them
+back. In between, every toolkit function (ENopen, ENrunH, ENnextH,
+...) works on that project alone:
+
+   ENcreateproject(&p);
+   ENattachproject(p);
+   ENopen(...); ... ENrunH(&t); ... ENnextH(&dt); ...
+   ENdetachproject(p);
+   ...
+   ENdeleteproject(p);
+
+A project can be detached on one thread and attached again on
+another, but it can only be attached to one thread at a time.
+Attaching it again on the thread that holds it just nests, and
+attaching a second project stacks it over the first until it is
+detached. A thread that never attaches a project works on its own
+globals, as the toolkit always has.
+
+The entry points for this module are:
+   ENcreateproject() -- allocates a project with a fresh state
+   ENdeleteproject() -- closes a project's network and frees it
+   ENattachproject() -- makes a project the current thread's state
+   ENdetachproject() -- saves a project's state and releases it
+
+It also lets the WQ solver's transport threads (see QUALITY.C)
+work with the state of the thread that runs them:
+   copystate()       -- copies this thread's globals
+   usestate()        -- loads a copy into this thread's globals
+
+*******************************************************************
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "text.h"
+#include "types.h"
+#include "funcs.h"
+#define  EXTERN  extern EN_THREAD
+#include "vars.h"
+#include "mempool.h"
+#include "toolkit.h"
+
+typedef void (*Pviewprog) (char *);
+
+/*
+** Project state: every global that a simulation reads or writes,
+** listed as X(type, name, array dimensions). A variable added to
+** VARS.H, or at file scope in any module, must be added here too.
+**
+** MEMPOOL.C's current pool is not listed: QUALITY.C selects SegPool
+** before each use of it, so it never carries over between calls.
+*/
+
+/* --- Variables of VARS.H (defined in EPANET.C) */
+#define VARS_STATE \
+  X(FILE *,    InFile,      ) \
+  X(FILE *,    OutFile,     ) \
+  X(FILE *,    RptFile,     ) \
+  X(FILE *,    HydFile,     ) \
+  X(FILE *,    TmpOutFile,  ) \
+  X(long,      HydOffset,   ) \
+  X(long,      OutOffset1,  ) \
+  X(long,      OutOffset2,  ) \
+  X(int,       HydBuffer,   ) \
+  X(long,      HydBufCount, ) \
+  X(long,      HydBufRead,  ) \
+  X(double *,  HydBuf,      ) \
+  X(int,       QualThreads, ) \
+  X(int,       HydThreads,  ) \
+  X(char,      Msg,         [MAXMSG+1]) \
+  X(char,      InpFname,    [MAXFNAME+1]) \
+  X(char,      Rpt1Fname,   [MAXFNAME+1]) \
+  X(char,      Rpt2Fname,   [MAXFNAME+1]) \
+  X(char,      HydFname,    [MAXFNAME+1]) \
+  X(char,      SparseFname, [MAXFNAME+1]) \
+  X(char,      OutFname,    [MAXFNAME+1]) \
+  X(char,      MapFname,    [MAXFNAME+1]) \
+  X(char,      TmpFname,    [MAXFNAME+1]) \
+  X(char,      TmpDir,      [MAXFNAME+1]) \
+  X(char,      Title,       [MAXTITLE][MAXMSG+1]) \
+  X(char,      ChemName,    [MAXID+1]) \
+  X(char,      ChemUnits,   [MAXID+1]) \
+  X(char,      DefPatID,    [MAXID+1]) \
+  X(char,      Atime,       [13]) \
+  X(char,      Outflag,     ) \
+  X(char,      Hydflag,     ) \
+  X(char,      Qualflag,    ) \
+  X(char,      Reactflag,   ) \
+  X(char,      Unitsflag,   ) \
+  X(char,      Flowflag,    ) \
+  X(char,      Pressflag,   ) \
+  X(char,      Formflag,    ) \
+  X(char,      Rptflag,     ) \
+  X(char,      Summaryflag, ) \
+  X(char,      Messageflag, ) \
+  X(char,      Statflag,    ) \
+  X(char,      Energyflag,  ) \
+  X(char,      Nodeflag,    ) \
+  X(char,      Linkflag,    ) \
+  X(char,      Tstatflag,   ) \
+  X(char,      Warnflag,    ) \
+  X(char,      Openflag,    ) \
+  X(char,      OpenHflag,   ) \
+  X(char,      SaveHflag,   ) \
+  X(char,      OpenQflag,   ) \
+  X(char,      SaveQflag,   ) \
+  X(char,      Saveflag,    ) \
+  X(char,      Warmflag,    ) \
+  X(char,      Fastpowflag, ) \
+  X(int,       MaxNodes,    ) \
+  X(int,       MaxLinks,    ) \
+  X(int,       MaxJuncs,    ) \
+  X(int,       MaxPipes,    ) \
+  X(int,       MaxTanks,    ) \
+  X(int,       MaxPumps,    ) \
+  X(int,       MaxValves,   ) \
+  X(int,       MaxControls, ) \
+  X(int,       MaxRules,    ) \
+  X(int,       MaxPats,     ) \
+  X(int,       MaxCurves,   ) \
+  X(int,       MaxCoords,   ) \
+  X(int,       Nnodes,      ) \
+  X(int,       Ntanks,      ) \
+  X(int,       Njuncs,      ) \
+  X(int,       Nlinks,      ) \
+  X(int,       Npipes,      ) \
+  X(int,       Npumps,      ) \
+  X(int,       Nvalves,     ) \
+  X(int,       Ncontrols,   ) \
+  X(int,       Nrules,      ) \
+  X(int,       Npats,       ) \
+  X(int,       Ncurves,     ) \
+  X(int,       Ncoords,     ) \
+  X(int,       Nperiods,    ) \
+  X(int,       Ncoeffs,     ) \
+  X(int,       DefPat,      ) \
+  X(int,       Epat,        ) \
+  X(int,       MaxIter,     ) \
+  X(int,       ExtraIter,   ) \
+  X(int,       TraceNode,   ) \
+  X(int,       PageSize,    ) \
+  X(int,       CheckFreq,   ) \
+  X(int,       MaxCheck,    ) \
+  X(double,    Ucf,         [MAXVAR]) \
+  X(double,    Ctol,        ) \
+  X(double,    Htol,        ) \
+  X(double,    Qtol,        ) \
+  X(double,    RQtol,       ) \
+  X(double,    Hexp,        ) \
+  X(double,    Qexp,        ) \
+  X(double,    Dmult,       ) \
+  X(double,    Hacc,        ) \
+  X(double,    DampLimit,   ) \
+  X(double,    BulkOrder,   ) \
+  X(double,    WallOrder,   ) \
+  X(double,    TankOrder,   ) \
+  X(double,    Kbulk,       ) \
+  X(double,    Kwall,       ) \
+  X(double,    Climit,      ) \
+  X(double,    Rfactor,     ) \
+  X(double,    Diffus,      ) \
+  X(double,    Viscos,      ) \
+  X(double,    SpGrav,      ) \
+  X(double,    Ecost,       ) \
+  X(double,    Dcost,       ) \
+  X(double,    Epump,       ) \
+  X(double,    Emax,        ) \
+  X(double,    Dsystem,     ) \
+  X(double,    Wbulk,       ) \
+  X(double,    Wwall,       ) \
+  X(double,    Wtank,       ) \
+  X(double,    Wsource,     ) \
+  X(long,      Tstart,      ) \
+  X(long,      Hstep,       ) \
+  X(long,      Qstep,       ) \
+  X(long,      Pstep,       ) \
+  X(long,      Pstart,      ) \
+  X(long,      Rstep,       ) \
+  X(long,      Rstart,      ) \
+  X(long,      Rtime,       ) \
+  X(long,      Htime,       ) \
+  X(long,      Qtime,       ) \
+  X(long,      Hydstep,     ) \
+  X(long,      Rulestep,    ) \
+  X(long,      Dur,         ) \
+  X(SField,    Field,       [MAXVAR]) \
+  X(char *,    S,           ) \
+  X(char *,    OldStat,     ) \
+  X(double *,  D,           ) \
+  X(double *,  C,           ) \
+  X(double *,  E,           ) \
+  X(double *,  K,           ) \
+  X(double *,  Q,           ) \
+  X(double *,  R,           ) \
+  X(double *,  X,           ) \
+  X(double *,  H,           ) \
+  X(STmplist *, Patlist,     ) \
+  X(STmplist *, Curvelist,   ) \
+  X(STmplist *, Coordlist,   ) \
+  X(HTtable *, Patht,       ) \
+  X(HTtable *, Curveht,     ) \
+  X(HTtable *, Coordht,     ) \
+  X(Spattern *, Pattern,     ) \
+  X(Scurve *,  Curve,       ) \
+  X(Scoord *,  Coord,       ) \
+  X(Snode *,   Node,        ) \
+  X(Slink *,   Link,        ) \
+  X(Stank *,   Tank,        ) \
+  X(Spump *,   Pump,        ) \
+  X(Svalve *,  Valve,       ) \
+  X(Scontrol *, Control,     ) \
+  X(HTtable *, Nht,         ) \
+  X(HTtable *, Lht,         ) \
+  X(Padjlist *, Adjlist,     ) \
+  X(int,       _relativeError, ) \
+  X(int,       _iterations, ) \
+  X(int,       _linsolveTime, ) \
+  X(double *,  Aii,         ) \
+  X(double *,  Aij,         ) \
+  X(double *,  F,           ) \
+  X(double *,  P,           ) \
+  X(double *,  Y,           ) \
+  X(int *,     Order,       ) \
+  X(int *,     Row,         ) \
+  X(int *,     Ndx,         ) \
+  X(int *,     XLNZ,        ) \
+  X(int *,     NZSUB,       ) \
+  X(int *,     LNZ,         )
+
+/* --- Variables private to a module */
+#define MODULE_STATE \
+  X(Pviewprog, viewprog,    ) \
+  X(int,       Haltflag,    ) \
+  X(double,    RelaxFactor, ) \
+  X(int *,     Tankctl,     ) \
+  X(int,       Ntankctl,    ) \
+  X(int *,     Juncctl,     ) \
+  X(int,       Njuncctl,    ) \
+  X(int *,     Timectl,     ) \
+  X(int,       Ntimectl,    ) \
+  X(int *,     Dayctl,      ) \
+  X(int,       Ndayctl,     ) \
+  X(int *,     Ctlfired,    ) \
+  X(int,       Ntokens,     ) \
+  X(int,       Ntitle,      ) \
+  X(char *,    Tok,         [MAXTOKS]) \
+  X(STmplist *, PrevPat,    ) \
+  X(STmplist *, PrevCurve,  ) \
+  X(STmplist *, PrevCoord,  ) \
+  X(char *,    Inpimage,    ) \
+  X(long,      Inpsize,     ) \
+  X(long,      Inppos,      ) \
+  X(char,      Inpmapped,   ) \
+  X(Pseg,      FreeSeg,     ) \
+  X(Pseg *,    FirstSeg,    ) \
+  X(Pseg *,    LastSeg,     ) \
+  X(char *,    FlowDir,     ) \
+  X(double *,  VolIn,       ) \
+  X(double *,  MassIn,      ) \
+  X(double,    Sc,          ) \
+  X(double,    Bucf,        ) \
+  X(double,    Tucf,        ) \
+  X(char,      OutOfMemory, ) \
+  X(alloc_handle_t *, SegPool, ) \
+  X(struct Stransport *, Transport, ) \
+  X(long,      PeakPoolBytes, ) \
+  X(struct Shydassembly *, Hydassembly, ) \
+  X(char,      Ownhydflag,  ) \
+  X(char,      QualSaveflag, ) \
+  X(char *,    QualS,       ) \
+  X(double *,  QualD,       ) \
+  X(double *,  QualH,       ) \
+  X(double *,  QualQ,       ) \
+  X(double *,  QualK,       ) \
+  X(double *,  QualX,       ) \
+  X(double *,  QualTankV,   ) \
+  X(long,      QualHtime,   ) \
+  X(long,      QualRtime,   ) \
+  X(int,       QualNperiods, ) \
+  X(long,      LineNum,     ) \
+  X(long,      PageNum,     ) \
+  X(char,      DateStamp,   [26]) \
+  X(char,      Fprinterr,   ) \
+  X(struct aRule *, Rule,   ) \
+  X(struct ActItem *, ActList, ) \
+  X(int,       RuleState,   ) \
+  X(long,      Time1,       ) \
+  X(struct Premise *, Plast, ) \
+  X(char *,    Rulevalue,   ) \
+  X(char *,    Ruletimed,   ) \
+  X(long *,    Rulewake,    ) \
+  X(int *,     Tankrulefirst, ) \
+  X(int *,     Tankrule,    ) \
+  X(double *,  Tankrulehead, ) \
+  X(char,      Rulesfresh,  ) \
+  X(int *,     Degree,      ) \
+  X(int *,     Linkmark,    ) \
+  X(double *,  Ltemp,       ) \
+  X(double *,  Ldense,      ) \
+  X(int *,     Llink,       ) \
+  X(int *,     Lfirst,      ) \
+  X(int *,     Lsuper,      ) \
+  X(int *,     Llast,       )
+
+#define X(type, name, dims)  extern EN_THREAD type name dims;
+MODULE_STATE
+#undef X
+
+struct ENproject
+{
+#define X(type, name, dims)  type name dims;
+   VARS_STATE
+   MODULE_STATE
+#undef X
+   int       Depth;         /* Times attached to its thread            */
+   ENproject *Previous;     /* Project it was attached over            */
+};
+
+static EN_THREAD ENproject *Current;  /* Project held by this thread's globals */
+
+
+static void loadproject(ENproject *p)
+/*----------------------------------------------------------------
+**  Input:   p = project
+**  Output:  none
+**  Purpose: copies a project's state into this thread's globals
+**----------------------------------------------------------------
+*/
+{
+#define X(type, name, dims)  memcpy(&name, &p->name, sizeof(p->name));
+   VARS_STATE
+   MODULE_STATE
+#undef X
+}
+
+
+static void saveproject(ENproject *p)
+/*----------------------------------------------------------------
+**  Input:   p = project
+**  Output:  none
+**  Purpose: copies this thread's globals into a project's state
+**----------------------------------------------------------------
+*/
+{
+#define X(type, name, dims)  memcpy(&p->name, &name, sizeof(p->name));
+   VARS_STATE
+   MODULE_STATE
+#undef X
+}
+
+
+int DLLEXPORT ENcreateproject(ENproject **p)
+/*----------------------------------------------------------------
+**  Input:   none
+**  Output:  *p = new project
+**  Returns: error code
+**  Purpose: allocates a project whose state is that of a toolkit
+**           that has not yet opened a network
+**----------------------------------------------------------------
+*/
+{
+   if (p == NULL) return(250);
+   *p = (ENproject *) calloc(1, sizeof(ENproject));
+   if (*p == NULL) return(101);
+   return(0);
+}
+
+
+int DLLEXPORT ENdeleteproject(ENproject *p)
+/*----------------------------------------------------------------
+**  Input:   p = project (not attached to any thread)
+**  Output:  none
+**  Returns: error code
+**  Purpose: closes any network the project has open and frees it
+**----------------------------------------------------------------
+*/
+{
+   if (p == NULL) return(0);
+   if (p->Depth > 0) return(250);
+   if (p->Openflag)
+   {
+      ENattachproject(p);
+      if (OpenQflag) ENcloseQ();
+      if (OpenHflag) ENcloseH();
+      ENclose();
+      ENdetachproject(p);
+   }
+   free(p);
+   return(0);
+}
+
+
+int DLLEXPORT ENattachproject(ENproject *p)
+/*----------------------------------------------------------------
+**  Input:   p = project
+**  Output:  none
+**  Returns: error code
+**  Purpose: makes the project's state the one toolkit functions
+**           called from this thread work on
+**----------------------------------------------------------------
+*/
+{
+   if (p == NULL) return(250);
+   if (p == Current)
+   {
+      p->Depth++;
+      return(0);
+   }
+
+/* Attached somewhere already: on another thread, or under another project here */
+   if (p->Depth > 0) return(250);
+
+   if (Current != NULL) saveproject(Current);
+   loadproject(p);
+   p->Previous = Current;
+   p->Depth = 1;
+   Current = p;
+   return(0);
+}
+
+
+int DLLEXPORT ENdetachproject(ENproject *p)
+/*----------------------------------------------------------------
+**  Input:   p = project (the one last attached on this thread)
+**  Output:  none
+**  Returns: error code
+**  Purpose: saves this thread's globals back into the project,
+**           and returns them to the project it was attached over
+**----------------------------------------------------------------
+*/
+{
+   if (p == NULL || p != Current) return(250);
+   p->Depth--;
+   if (p->Depth > 0) return(0);
+
+   saveproject(p);
+   Current = p->Previous;
+   p->Previous = NULL;
+   if (Current != NULL) loadproject(Current);
+   return(0);
+}
+
+
+int  copystate(ENproject **p)
+/*----------------------------------------------------------------
+**  Input:   *p = copy to overwrite, or NULL for a new one
+**  Output:  *p = copy of this thread's globals
+**  Returns: error code
+**  Purpose: copies this thread's globals, for another thread to
+**           load with usestate(); free() it when done
+**----------------------------------------------------------------
+*/
+{
+   if (*p == NULL) *p = (ENproject *) calloc(1, sizeof(ENproject));
+   if (*p == NULL) return(101);
+   saveproject(*p);
+   return(0);
+}
+
+
+void  usestate(ENproject *p)
+/*----------------------------------------------------------------
+**  Input:   p = copy made by copystate()
+**  Output:  none
+**  Purpose: loads a copy of another thread's globals into this
+**           thread's, without attaching a project. Arrays are
+**           shared with that thread, not copied.
+**----------------------------------------------------------------
+*/
+{
+   loadproject(p);
+}
+
+/************************* END OF PROJECT.C ************************/
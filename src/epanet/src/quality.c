@@ -15,10 +15,11 @@ AUTHOR:     L. Rossman
   This module contains the network water quality simulator.           
                                                                       
   For each time period, hydraulic results are read in from the        
-  binary file HydFile, hydraulic and water quality results are        
-  written to the binary output file OutFile (if the current period    
-  is a reporting period), and the water quality is transported
-  and reacted over the duration of the time period.                                      
+  binary file HydFile (or from the buffer HydBuf kept in memory in
+  its place -- see ENsethydbuffer()), hydraulic and water quality
+  results are written to the binary output file OutFile (if the
+  current period is a reporting period), and the water quality is
+  transported and reacted over the duration of the time period.
 
   The entry points for this module are:
     openqual()   -- called from ENopenQ() in EPANET.C
@@ -27,6 +28,9 @@ AUTHOR:     L. Rossman
     nextqual()   -- called from ENnextQ() in EPANET.C
     stepqual()   -- called from ENstepQ() in EPANET.C
     closequal()  -- called from ENcloseQ() in EPANET.C
+    openqualhyd()  -- called from ENopenQ() in EPANET.C
+    swapqualhyd()  -- called from ENopenQ() ... ENcloseQ() in EPANET.C
+    closequalhyd() -- called from ENcloseQ() in EPANET.C
                                                                       
   Calls are made to:
     AllocInit()
@@ -36,9 +40,16 @@ AUTHOR:     L. Rossman
   when constantly creating and destroying pipe sub-segments during    
   the water quality transport calculations.
 
+  With more than one thread set by ENsetqualthreads(), transport()
+  shares each time step among worker threads, which start with
+  the WQ solver (openworkers()) and stop with it (closeworkers()).
+  Each runs with a copy of the calling thread's globals, made by
+  copystate() and loaded by usestate() in PROJECT.C.
+
   Calls are also made to:
     readhyd()
     readhydstep()
+    rewindhyd()
     savenetdata()
     saveoutput()
     savefinaloutput()
@@ -55,9 +66,13 @@ AUTHOR:     L. Rossman
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 #include "mempool.h"
+#ifndef _WIN32
+#include <pthread.h>
+#define   PARALLEL_TRANSPORT   /* Transport can use worker threads */
+#endif
 
 /*
 ** Macros to identify upstream & downstream nodes of a link
@@ -67,21 +82,102 @@ AUTHOR:     L. Rossman
 #define   DOWN_NODE(x) ( (FlowDir[(x)]=='+') ? Link[(x)].N2 : Link[(x)].N1 )
 #define   LINKVOL(k)   ( 0.785398*Link[(k)].Len*SQR(Link[(k)].Diam) )
 
-Pseg      FreeSeg;              /* Pointer to unused segment               */
-Pseg      *FirstSeg,            /* First (downstream) segment in each pipe */
+EN_THREAD Pseg      FreeSeg;              /* Pointer to unused segment               */
+EN_THREAD Pseg      *FirstSeg,            /* First (downstream) segment in each pipe */
           *LastSeg;             /* Last (upstream) segment in each pipe    */
-char      *FlowDir;             /* Flow direction for each pipe            */
-double    *VolIn;               /* Total volume inflow to node             */
-double    *MassIn;              /* Total mass inflow to node               */
-double    Sc;                   /* Schmidt Number                          */
-double    Bucf;                 /* Bulk reaction units conversion factor   */
-double    Tucf;                 /* Tank reaction units conversion factor   */
+EN_THREAD char      *FlowDir;             /* Flow direction for each pipe            */
+EN_THREAD double    *VolIn;               /* Total volume inflow to node             */
+EN_THREAD double    *MassIn;              /* Total mass inflow to node               */
+EN_THREAD double    Sc;                   /* Schmidt Number                          */
+EN_THREAD double    Bucf;                 /* Bulk reaction units conversion factor   */
+EN_THREAD double    Tucf;                 /* Tank reaction units conversion factor   */
 
 /*** Moved to vars.h ***/                                                      //(2.00.12 - LR)
 //char      Reactflag;            /* Reaction indicator                      */
 
-char      OutOfMemory;          /* Out of memory indicator                 */
-static    alloc_handle_t *SegPool; // Memory pool for water quality segments   //(2.00.11 - LR)
+EN_THREAD char      OutOfMemory;          /* Out of memory indicator                 */
+
+/*
+** The WQ solver's own copy of the hydraulic state, used when
+** hydraulics come from memory (Ownhydflag) so that it can run
+** alongside the hydraulic solver. swapqualhyd() exchanges these
+** with the globals they stand in for around each WQ call.
+*/
+EN_THREAD char      Ownhydflag;           /* WQ solver has own copy of hydraulics    */
+EN_THREAD char      QualSaveflag;         /* Saveflag of the WQ solver               */
+EN_THREAD char      *QualS;               /* Link status of the WQ solver            */
+EN_THREAD double    *QualD,               /* Node demands of the WQ solver           */
+          *QualH,               /* Node heads of the WQ solver             */
+          *QualQ,               /* Link flows of the WQ solver             */
+          *QualK,               /* Link settings of the WQ solver          */
+          *QualX,               /* Scratch array of the WQ solver          */
+          *QualTankV;           /* Tank volumes of the WQ solver           */
+EN_THREAD long      QualHtime,            /* Htime of the WQ solver                  */
+          QualRtime;            /* Rtime of the WQ solver                  */
+EN_THREAD int       QualNperiods;         /* Nperiods of the WQ solver               */
+EN_THREAD alloc_handle_t *SegPool; // Memory pool for water quality segments   //(2.00.11 - LR)
+
+/*
+** Parallel transport. Each worker owns a range of links, whose
+** segments it reacts, moves and releases with its own memory pool
+** and list of unused segments. The volumes it moves out of a link
+** are kept with the link, not added to the downstream node, and
+** each node then sums what its links hold in order of link index
+** -- the order that accumulate() adds them in -- so the results
+** are the same as those of the serial transport.
+*/
+#define   MINWORKLINKS  1000   /* Fewest links worth a worker thread */
+
+typedef struct                 /* A link's part of a WQ time step    */
+{
+   double cfirst, clast;       /* Quality of first & last segments   */
+   char   hasfirst, haslast;   /* Whether it had these segments      */
+   int    worker;              /* Worker that owns the link          */
+   long   start;               /* First volume it moved, in worker's */
+   int    count;               /* Number of volumes it moved         */
+}  Sxfer;
+
+typedef struct Sworker         /* Transport worker                   */
+{
+   int    index;               /* 0 for the thread calling transport */
+   int    lo, hi;              /* Links it owns                      */
+   int    nlo, nhi;            /* Nodes it mixes                     */
+   alloc_handle_t *pool;       /* Its segment pool (SegPool for 0)   */
+   Pseg   freeseg;             /* Its unused segments                */
+   double *vout, *mout;        /* Volumes & masses moved from links  */
+   long   nout, maxout;        /* Number of them, & room for them    */
+   double wbulk, wwall;        /* Mass it reacted                    */
+   char   outofmemory;         /* Out of memory indicator            */
+   struct Stransport *owner;   /* Transport it works for             */
+#ifdef PARALLEL_TRANSPORT
+   pthread_t thread;
+#endif
+}  Sworker;
+
+struct Stransport              /* Workers of the WQ solver           */
+{
+   int       n;                /* Number of workers (incl. caller)   */
+   int       nthreads;         /* Worker threads started             */
+   int       count;            /* Threads that meet at the barrier   */
+   Sworker   *worker;
+   Sxfer     *xfer;            /* Part of each link in a time step   */
+   int       *firstlink;       /* Start of each node's links         */
+   int       *links;           /* Links at each node, by index       */
+   struct ENproject *state;    /* Globals of the calling thread      */
+   long      tstep;            /* Time step being transported        */
+   char      stop;             /* Stop transport (out of memory)     */
+   char      quit;             /* Stop the worker threads            */
+#ifdef PARALLEL_TRANSPORT
+   pthread_mutex_t lock;       /* Barrier that all workers meet at   */
+   pthread_cond_t  cond;
+   int       waiting;
+   unsigned  generation;
+#endif
+};
+typedef struct Stransport Stransport;
+
+EN_THREAD Stransport *Transport;   /* Workers, or NULL if serial     */
+EN_THREAD long PeakPoolBytes;      /* Most the segment pools have held */
 
 
 int  openqual()
@@ -120,6 +216,10 @@ int  openqual()
    ERRCODE(MEMCHECK(FlowDir));
    ERRCODE(MEMCHECK(VolIn));
    ERRCODE(MEMCHECK(MassIn));
+
+   /* Start transport workers */
+   Transport = NULL;
+   ERRCODE(openworkers());
    return(errcode);
 }
 
@@ -177,6 +277,7 @@ void  initqual()
       FreeSeg = NULL;
       AllocSetPool(SegPool);                                                   //(2.00.11 - LR)
       AllocReset();                                                            //(2.00.11 - LR)
+      initworkers();
    }
 
    /* Initialize avg. reaction rates */
@@ -186,7 +287,7 @@ void  initqual()
    Wsource = 0.0;
 
    /* Re-position hydraulics file */
-   fseek(HydFile,HydOffset,SEEK_SET);
+   rewindhyd();
 
    /* Set elapsed times to zero */
    Htime = 0;
@@ -305,11 +406,16 @@ int closequal()
 {
    int errcode = 0;
 
+   /* Note how big the segment pools got, and stop transport workers */
+   qualpoolbytes(TRUE);
+   closeworkers();
+
    /* Free memory pool */
    if ( SegPool )                                                              //(2.00.11 - LR)
    {                                                                           //(2.00.11 - LR)
         AllocSetPool(SegPool);                                                 //(2.00.11 - LR)
         AllocFreePool();                                                       //(2.00.11 - LR)
+        SegPool = NULL;
    }                                                                           //(2.00.11 - LR)
 
    free(FirstSeg);
@@ -323,6 +429,129 @@ int closequal()
 }
 
 
+long  qualpoolbytes(int peak)
+/*
+**--------------------------------------------------------------
+**   Input:   peak = TRUE for the most the pools have held
+**   Output:  returns bytes held by the WQ segment pools
+**   Purpose: finds the memory held by SegPool and the transport
+**            workers' pools (while WQ is open), and keeps the
+**            most it has been in PeakPoolBytes
+**--------------------------------------------------------------
+*/
+{
+   int  i;
+   long bytes = 0;
+
+   if (OpenQflag)
+   {
+      bytes = AllocPoolBytes(SegPool);
+      if (Transport != NULL)
+      {
+         for (i=1; i<Transport->n; i++) bytes += AllocPoolBytes(Transport->worker[i].pool);
+      }
+   }
+   PeakPoolBytes = MAX(PeakPoolBytes, bytes);
+   return(peak ? PeakPoolBytes : bytes);
+}
+
+
+int  openqualhyd()
+/*
+**--------------------------------------------------------------
+**   Input:   none     
+**   Output:  returns error code                                          
+**   Purpose: allocates the WQ solver's own copy of the hydraulic
+**            state if hydraulics are handed over in memory
+**--------------------------------------------------------------
+*/
+{
+   int errcode = 0;
+
+   /* Hydraulics from a file need no copy */
+   Ownhydflag = (HydBuf != NULL);
+   if (!Ownhydflag) return(0);
+
+   QualD = (double *) calloc(Nnodes+1, sizeof(double));
+   QualH = (double *) calloc(Nnodes+1, sizeof(double));
+   QualQ = (double *) calloc(Nlinks+1, sizeof(double));
+   QualK = (double *) calloc(Nlinks+1, sizeof(double));
+   QualS = (char *)   calloc(Nlinks+1, sizeof(char));
+   QualTankV = (double *) calloc(Ntanks+1, sizeof(double));
+   ERRCODE(MEMCHECK(QualD));
+   ERRCODE(MEMCHECK(QualH));
+   ERRCODE(MEMCHECK(QualQ));
+   ERRCODE(MEMCHECK(QualK));
+   ERRCODE(MEMCHECK(QualS));
+   ERRCODE(MEMCHECK(QualTankV));
+   QualX = NULL;                   /* allocated by openqual() */
+   QualSaveflag = FALSE;
+   QualHtime = 0;
+   QualRtime = Rstart;
+   QualNperiods = 0;
+   if (errcode) closequalhyd();
+   return(errcode);
+}
+
+
+void  swapqualhyd()
+/*
+**--------------------------------------------------------------
+**   Input:   none     
+**   Output:  none                                          
+**   Purpose: exchanges the hydraulic solver's state with the WQ
+**            solver's own copy of it, or back again
+**--------------------------------------------------------------
+*/
+{
+   int    i;
+   char   *s, f;
+   double *x, v;
+   long   t;
+   int    n;
+
+   if (!Ownhydflag) return;
+   s = S; S = QualS; QualS = s;
+   x = D; D = QualD; QualD = x;
+   x = H; H = QualH; QualH = x;
+   x = Q; Q = QualQ; QualQ = x;
+   x = K; K = QualK; QualK = x;
+   x = X; X = QualX; QualX = x;
+   f = Saveflag; Saveflag = QualSaveflag; QualSaveflag = f;
+   t = Htime; Htime = QualHtime; QualHtime = t;
+   t = Rtime; Rtime = QualRtime; QualRtime = t;
+   n = Nperiods; Nperiods = QualNperiods; QualNperiods = n;
+   for (i=1; i<=Ntanks; i++)
+   {
+      v = Tank[i].V;
+      Tank[i].V = QualTankV[i];
+      QualTankV[i] = v;
+   }
+}
+
+
+void  closequalhyd()
+/*
+**--------------------------------------------------------------
+**   Input:   none     
+**   Output:  none                                          
+**   Purpose: frees the WQ solver's own copy of the hydraulic state
+**--------------------------------------------------------------
+*/
+{
+   if (!Ownhydflag) return;
+   free(QualD);
+   free(QualH);
+   free(QualQ);
+   free(QualK);
+   free(QualS);
+   free(QualTankV);
+   QualD = QualH = QualQ = QualK = QualX = QualTankV = NULL;
+   QualS = NULL;
+   Ownhydflag = FALSE;
+}
+
+
 int  gethyd(long *hydtime, long *hydstep)
 /*
 **-----------------------------------------------------------
@@ -416,6 +645,11 @@ void  transport(long tstep)
    /* Repeat until elapsed time equals hydraulic time step */
 
    AllocSetPool(SegPool);                                                      //(2.00.11 - LR)
+   if (Transport != NULL)
+   {
+      paralleltransport(tstep);
+      return;
+   }
    qtime = 0;
    while (!OutOfMemory && qtime < tstep)
    {                                  /* Qstep is quality time step */
@@ -550,40 +784,51 @@ void  updatesegs(long dt)
 */
 {
    int    k;
-   Pseg   seg;
-   double  cseg, rsum, vsum;
 
    /* Examine each link in network */
-   for (k=1; k<=Nlinks; k++)
-   {
+   for (k=1; k<=Nlinks; k++) reactlink(k,dt);
+}
 
-      /* Skip zero-length links (pumps & valves) */
-      rsum = 0.0;
-      vsum = 0.0;
-      if (Link[k].Len == 0.0) continue;
 
-      /* Examine each segment of the link */
-      seg = FirstSeg[k];
-      while (seg != NULL)
-      {
+void  reactlink(int k, long dt)
+/*
+**-------------------------------------------------------------
+**   Input:   k = link index
+**            dt = time from last WQ segment update
+**   Output:  none
+**   Purpose: reacts material in the segments of link k
+**-------------------------------------------------------------
+*/
+{
+   Pseg   seg;
+   double  cseg, rsum, vsum;
 
-            /* React segment over time dt */
-            cseg = seg->c;
-            seg->c = pipereact(k,seg->c,seg->v,dt);
+   /* Skip zero-length links (pumps & valves) */
+   rsum = 0.0;
+   vsum = 0.0;
+   if (Link[k].Len == 0.0) return;
 
-            /* Accumulate volume-weighted reaction rate */
-            if (Qualflag == CHEM)
-            {
-               rsum += ABS((seg->c - cseg))*seg->v;
-               vsum += seg->v;
-            }
-            seg = seg->prev;
-      }
+   /* Examine each segment of the link */
+   seg = FirstSeg[k];
+   while (seg != NULL)
+   {
+
+         /* React segment over time dt */
+         cseg = seg->c;
+         seg->c = pipereact(k,seg->c,seg->v,dt);
 
-      /* Normalize volume-weighted reaction rate */
-      if (vsum > 0.0) R[k] = rsum/vsum/dt*SECperDAY;
-      else R[k] = 0.0;
+         /* Accumulate volume-weighted reaction rate */
+         if (Qualflag == CHEM)
+         {
+            rsum += ABS((seg->c - cseg))*seg->v;
+            vsum += seg->v;
+         }
+         seg = seg->prev;
    }
+
+   /* Normalize volume-weighted reaction rate */
+   if (vsum > 0.0) R[k] = rsum/vsum/dt*SECperDAY;
+   else R[k] = 0.0;
 }
 
 
@@ -902,44 +1147,57 @@ void release(long dt)
 **---------------------------------------------------------
 */
 {
-   int    k,n;
-   double  c,q,v;
-   Pseg   seg;
+   int    k;
 
    /* Examine each link */
-   for (k=1; k<=Nlinks; k++)
-   {
+   for (k=1; k<=Nlinks; k++) releaselink(k,dt);
+}
 
-      /* Ignore links with no flow */
-      if (Q[k] == 0.0) continue;
 
-      /* Find flow volume released to link from upstream node */
-      /* (NOTE: Flow volume is allowed to be > link volume.) */
-      n = UP_NODE(k);
-      q = ABS(Q[k]);
-      v = q*dt;
+void releaselink(int k, long dt)
+/*
+**---------------------------------------------------------
+**   Input:   k = link index
+**            dt = current WQ time step
+**   Output:  none
+**   Purpose: creates a new segment in link k from its
+**            upstream node's outflow.
+**---------------------------------------------------------
+*/
+{
+   int    n;
+   double  c,q,v;
+   Pseg   seg;
 
-      /* Include source contribution in quality released from node. */
-      c = C[n] + X[n];
+   /* Ignore links with no flow */
+   if (Q[k] == 0.0) return;
 
-      /* If link has a last seg, check if its quality     */
-      /* differs from that of the flow released from node.*/
-      if ( (seg = LastSeg[k]) != NULL)
-      {
-         /* Quality of seg close to that of node */
-         if (ABS(seg->c - c) < Ctol)
-         {
-            seg->c = (seg->c*seg->v + c*v) / (seg->v + v);                     //(2.00.11 - LR)
-            seg->v += v;
-         }
+   /* Find flow volume released to link from upstream node */
+   /* (NOTE: Flow volume is allowed to be > link volume.) */
+   n = UP_NODE(k);
+   q = ABS(Q[k]);
+   v = q*dt;
+
+   /* Include source contribution in quality released from node. */
+   c = C[n] + X[n];
 
-         /* Otherwise add a new seg to end of link */
-         else addseg(k,v,c);
+   /* If link has a last seg, check if its quality     */
+   /* differs from that of the flow released from node.*/
+   if ( (seg = LastSeg[k]) != NULL)
+   {
+      /* Quality of seg close to that of node */
+      if (ABS(seg->c - c) < Ctol)
+      {
+         seg->c = (seg->c*seg->v + c*v) / (seg->v + v);                        //(2.00.11 - LR)
+         seg->v += v;
       }
 
-      /* If link has no segs then add a new one. */
-      else addseg(k,LINKVOL(k),c);
+      /* Otherwise add a new seg to end of link */
+      else addseg(k,v,c);
    }
+
+   /* If link has no segs then add a new one. */
+   else addseg(k,LINKVOL(k),c);
 }
 
 
@@ -1650,4 +1908,491 @@ double  wallrate(double c, double d, double kw, double kf)
    else return(c*kf);          /* 1st-order reaction */
 }
 
+
+int  openworkers()
+/*
+**--------------------------------------------------------------
+**   Input:   none
+**   Output:  returns error code
+**   Purpose: starts the threads that share WQ transport, if
+**            QualThreads asks for them & the network is big
+**            enough to gain from them
+**--------------------------------------------------------------
+*/
+{
+   int    errcode = 0;
+   int    i,k,n;
+   Stransport *t;
+   Sworker    *w;
+
+   Transport = NULL;
+   n = MIN(QualThreads, Nlinks/MINWORKLINKS);
+#ifndef PARALLEL_TRANSPORT
+   n = 1;
+#endif
+   if (n < 2) return(0);
+
+   /* Allocate workers & each link's part of a time step */
+   t = (Stransport *) calloc(1, sizeof(Stransport));
+   if (t == NULL) return(101);
+   Transport = t;
+   t->n = n;
+#ifdef PARALLEL_TRANSPORT
+   pthread_mutex_init(&t->lock, NULL);
+   pthread_cond_init(&t->cond, NULL);
+   t->count = n;
+#endif
+   t->worker    = (Sworker *) calloc(n, sizeof(Sworker));
+   t->xfer      = (Sxfer *) calloc(Nlinks+1, sizeof(Sxfer));
+   t->firstlink = (int *) calloc(Nnodes+2, sizeof(int));
+   t->links     = (int *) calloc(2*Nlinks+1, sizeof(int));
+   ERRCODE(MEMCHECK(t->worker));
+   ERRCODE(MEMCHECK(t->xfer));
+   ERRCODE(MEMCHECK(t->firstlink));
+   ERRCODE(MEMCHECK(t->links));
+   ERRCODE(copystate(&t->state));
+   if (errcode)
+   {
+      closeworkers();
+      return(errcode);
+   }
+
+   /* List the links at each node in order of index: count */
+   /* them, find where each node's list ends, then fill    */
+   /* the lists in from their ends, from the last link.    */
+   for (k=1; k<=Nlinks; k++)
+   {
+      t->firstlink[Link[k].N1]++;
+      if (Link[k].N2 != Link[k].N1) t->firstlink[Link[k].N2]++;
+   }
+   for (i=1; i<=Nnodes; i++) t->firstlink[i] += t->firstlink[i-1];
+   t->firstlink[Nnodes+1] = t->firstlink[Nnodes];
+   for (k=Nlinks; k>=1; k--)
+   {
+      t->links[--t->firstlink[Link[k].N1]] = k;
+      if (Link[k].N2 != Link[k].N1) t->links[--t->firstlink[Link[k].N2]] = k;
+   }
+
+   /* Share out links & nodes, giving each worker beyond */
+   /* the first its own segment pool                     */
+   for (i=0; i<n; i++)
+   {
+      w = &t->worker[i];
+      w->index = i;
+      w->owner = t;
+      w->lo  = 1 + (int)((double)Nlinks*i/n);
+      w->hi  = (int)((double)Nlinks*(i+1)/n);
+      w->nlo = 1 + (int)((double)Nnodes*i/n);
+      w->nhi = (int)((double)Nnodes*(i+1)/n);
+      for (k=w->lo; k<=w->hi; k++) t->xfer[k].worker = i;
+      if (i > 0)
+      {
+         w->pool = AllocInit();
+         if (w->pool == NULL) errcode = 101;
+      }
+   }
+   AllocSetPool(SegPool);
+   if (errcode)
+   {
+      closeworkers();
+      return(errcode);
+   }
+
+#ifdef PARALLEL_TRANSPORT
+   /* Start their threads (running serially instead if */
+   /* they can't all be started)                       */
+   for (i=1; i<n; i++)
+   {
+      if (pthread_create(&t->worker[i].thread, NULL, transportworker,
+                         &t->worker[i]) != 0) break;
+      t->nthreads++;
+   }
+   if (t->nthreads < n-1) closeworkers();
+#endif
+   return(0);
+}
+
+
+void  initworkers()
+/*
+**--------------------------------------------------------------
+**   Input:   none
+**   Output:  none
+**   Purpose: resets the segment pools of transport workers
+**--------------------------------------------------------------
+*/
+{
+   int i;
+   Sworker *w;
+
+   if (Transport == NULL) return;
+   for (i=1; i<Transport->n; i++)
+   {
+      w = &Transport->worker[i];
+      w->freeseg = NULL;
+      AllocSetPool(w->pool);
+      AllocReset();
+   }
+   AllocSetPool(SegPool);
+}
+
+
+void  closeworkers()
+/*
+**--------------------------------------------------------------
+**   Input:   none
+**   Output:  none
+**   Purpose: stops the threads that share WQ transport and
+**            frees their memory
+**--------------------------------------------------------------
+*/
+{
+   int i;
+   Stransport *t = Transport;
+   Sworker    *w;
+
+   if (t == NULL) return;
+   Transport = NULL;
+
+#ifdef PARALLEL_TRANSPORT
+   if (t->nthreads > 0)
+   {
+      pthread_mutex_lock(&t->lock);
+      t->count = t->nthreads + 1;
+      t->quit = TRUE;
+      pthread_mutex_unlock(&t->lock);
+      waitworkers(t);
+      for (i=1; i<=t->nthreads; i++) pthread_join(t->worker[i].thread, NULL);
+   }
+   pthread_mutex_destroy(&t->lock);
+   pthread_cond_destroy(&t->cond);
+#endif
+
+   if (t->worker != NULL)
+   {
+      for (i=0; i<t->n; i++)
+      {
+         w = &t->worker[i];
+         if (w->pool != NULL)
+         {
+            AllocSetPool(w->pool);
+            AllocFreePool();
+         }
+         free(w->vout);
+         free(w->mout);
+      }
+   }
+   AllocSetPool(SegPool);
+   free(t->worker);
+   free(t->xfer);
+   free(t->firstlink);
+   free(t->links);
+   free(t->state);
+   free(t);
+}
+
+
+void  *transportworker(void *arg)
+/*
+**--------------------------------------------------------------
+**   Input:   arg = worker
+**   Output:  returns NULL
+**   Purpose: runs a transport worker's thread, which does its
+**            part of each time step that transport() hands it
+**--------------------------------------------------------------
+*/
+{
+   Sworker    *w = (Sworker *) arg;
+   Stransport *t = w->owner;
+
+   for (;;)
+   {
+      /* Wait for a time step, or to quit */
+      waitworkers(t);
+      if (t->quit) break;
+
+      /* Take on the caller's state, with worker's own segments */
+      usestate(t->state);
+      AllocSetPool(w->pool);
+      FreeSeg = w->freeseg;
+      OutOfMemory = FALSE;
+      Wbulk = 0.0;
+      Wwall = 0.0;
+
+      sharetransport(w);
+
+      /* Hand back what it reacted */
+      w->freeseg = FreeSeg;
+      w->wbulk = Wbulk;
+      w->wwall = Wwall;
+      w->outofmemory = OutOfMemory;
+      waitworkers(t);
+   }
+   return(NULL);
+}
+
+
+void  waitworkers(Stransport *t)
+/*
+**--------------------------------------------------------------
+**   Input:   t = transport workers
+**   Output:  none
+**   Purpose: waits until all of the workers have got here
+**--------------------------------------------------------------
+*/
+{
+#ifdef PARALLEL_TRANSPORT
+   unsigned generation;
+
+   pthread_mutex_lock(&t->lock);
+   generation = t->generation;
+   if (++t->waiting == t->count)
+   {
+      t->waiting = 0;
+      t->generation++;
+      pthread_cond_broadcast(&t->cond);
+   }
+   else while (generation == t->generation)
+   {
+      pthread_cond_wait(&t->cond, &t->lock);
+   }
+   pthread_mutex_unlock(&t->lock);
+#endif
+}
+
+
+void  paralleltransport(long tstep)
+/*
+**--------------------------------------------------------------
+**   Input:   tstep = length of current time step
+**   Output:  none
+**   Purpose: transports constituent mass through the network,
+**            as transport() does, with its workers
+**--------------------------------------------------------------
+*/
+{
+   int i;
+   Stransport *t = Transport;
+   Sworker    *w;
+
+   /* Have the workers start from this thread's state */
+   if (!OutOfMemory && copystate(&t->state)) OutOfMemory = TRUE;
+   if (!OutOfMemory)
+   {
+      t->tstep = tstep;
+      t->stop = FALSE;
+      waitworkers(t);
+      sharetransport(&t->worker[0]);
+      waitworkers(t);
+
+      /* Add up what they reacted, in order of worker */
+      for (i=1; i<t->n; i++)
+      {
+         w = &t->worker[i];
+         Wbulk += w->wbulk;
+         Wwall += w->wwall;
+         if (w->outofmemory) OutOfMemory = TRUE;
+      }
+   }
+   updatesourcenodes(tstep);          /* Update quality at source nodes */
+}
+
+
+void  sharetransport(Sworker *w)
+/*
+**--------------------------------------------------------------
+**   Input:   w = worker
+**   Output:  none
+**   Purpose: does a worker's part of transport over the time
+**            step being transported. The first worker (the
+**            calling thread) also does the parts that aren't
+**            shared: tanks & sources.
+**--------------------------------------------------------------
+*/
+{
+   int    i;
+   long   qtime, dt;
+   Stransport *t = w->owner;
+
+   qtime = 0;
+   while (qtime < t->tstep)
+   {
+      dt = MIN(Qstep,t->tstep-qtime); /* Current time step */
+      qtime += dt;                    /* Update elapsed time */
+      movelinks(w,dt);                /* React & move water in links */
+      waitworkers(t);
+      mixnodes(w,dt);                 /* Mix flows into nodes */
+      waitworkers(t);
+      if (w->index == 0)
+      {
+         updatetanks(dt);             /* Update tank quality */
+         if (Qualflag == TRACE) C[TraceNode] = 100.0;
+         sourceinput(dt);             /* Compute inputs from sources */
+         for (i=1; i<t->n; i++)
+            if (t->worker[i].outofmemory) OutOfMemory = TRUE;
+         t->stop = OutOfMemory;
+      }
+      waitworkers(t);
+      if (t->stop) break;
+      for (i=w->lo; i<=w->hi; i++)    /* Release new nodal flows */
+         releaselink(i,dt);
+      if (w->index > 0) w->outofmemory = OutOfMemory;
+   }
+}
+
+
+void  movelinks(Sworker *w, long dt)
+/*
+**--------------------------------------------------------------
+**   Input:   w = worker
+**            dt = current WQ time step
+**   Output:  none
+**   Purpose: reacts the segments of a worker's links, notes the
+**            quality at their ends & moves flow volume out of
+**            their leading segments, as updatesegs() and
+**            accumulate() do, keeping the volumes & masses moved
+**            for mixnodes() to add to downstream nodes
+**--------------------------------------------------------------
+*/
+{
+   int    k;
+   long   n;
+   double cseg,v,vseg;
+   double *vout,*mout;
+   Pseg   seg;
+   Sxfer  *x;
+
+   w->nout = 0;
+   for (k=w->lo; k<=w->hi; k++)
+   {
+      if (Reactflag) reactlink(k,dt);
+
+      /* Note quality of segments adjacent to each end */
+      x = &w->owner->xfer[k];
+      x->hasfirst = (FirstSeg[k] != NULL);
+      if (x->hasfirst) x->cfirst = FirstSeg[k]->c;
+      x->haslast = (LastSeg[k] != NULL);
+      if (x->haslast) x->clast = LastSeg[k]->c;
+
+      /* Remove flow volume from leading segments */
+      x->start = w->nout;
+      v = ABS(Q[k])*dt;
+      while (v > 0.0)
+      {
+         seg = FirstSeg[k];
+         if (seg == NULL) break;
+         vseg = seg->v;
+         vseg = MIN(vseg,v);
+         if (seg == LastSeg[k]) vseg = v;
+
+         /* Keep volume & mass moved, making room if need be */
+         if (w->nout == w->maxout)
+         {
+            n = MAX(2*w->maxout, 1024);
+            vout = (double *) realloc(w->vout, n*sizeof(double));
+            if (vout != NULL) w->vout = vout;
+            mout = (double *) realloc(w->mout, n*sizeof(double));
+            if (mout != NULL) w->mout = mout;
+            if (vout == NULL || mout == NULL)
+            {
+               OutOfMemory = TRUE;
+               break;
+            }
+            w->maxout = n;
+         }
+         cseg = seg->c;
+         w->vout[w->nout] = vseg;
+         w->mout[w->nout] = vseg*cseg;
+         w->nout++;
+         v -= vseg;
+
+         /* Recycle segment if all of its volume was moved */
+         if (v >= 0.0 && vseg >= seg->v)
+         {
+            FirstSeg[k] = seg->prev;
+            if (FirstSeg[k] == NULL) LastSeg[k] = NULL;
+            seg->prev = FreeSeg;
+            FreeSeg = seg;
+         }
+         else
+         {
+            seg->v -= vseg;
+         }
+      }
+      x->count = (int)(w->nout - x->start);
+   }
+}
+
+
+void  mixnodes(Sworker *w, long dt)
+/*
+**--------------------------------------------------------------
+**   Input:   w = worker
+**            dt = current WQ time step
+**   Output:  none
+**   Purpose: sums the flows into a worker's nodes from what
+**            movelinks() kept, adding them in the same order as
+**            accumulate() does, and updates junction quality as
+**            updatenodes() does
+**--------------------------------------------------------------
+*/
+{
+   int    i,j,k;
+   long   p;
+   double csum,nsum,vsum,msum;
+   Stransport *t = w->owner;
+   Sworker    *owner;
+   Sxfer      *x;
+
+   for (j=w->nlo; j<=w->nhi; j++)
+   {
+      /* Average conc. of segments adjacent to node */
+      csum = 0.0;
+      nsum = 0.0;
+      for (i=t->firstlink[j]; i<t->firstlink[j+1]; i++)
+      {
+         k = t->links[i];
+         x = &t->xfer[k];
+         if (DOWN_NODE(k) == j && x->hasfirst)
+         {
+            csum += x->cfirst;
+            nsum++;
+         }
+         if (UP_NODE(k) == j && x->haslast)
+         {
+            csum += x->clast;
+            nsum++;
+         }
+      }
+      if (nsum > 0.0) X[j] = csum/nsum;
+      else            X[j] = 0.0;
+
+      /* Volume & mass moved into node from its inflow links */
+      vsum = 0.0;
+      msum = 0.0;
+      for (i=t->firstlink[j]; i<t->firstlink[j+1]; i++)
+      {
+         k = t->links[i];
+         if (DOWN_NODE(k) != j) continue;
+         x = &t->xfer[k];
+         owner = &t->worker[x->worker];
+         for (p=x->start; p<x->start+x->count; p++)
+         {
+            vsum += owner->vout[p];
+            msum += owner->mout[p];
+         }
+      }
+      VolIn[j] = vsum;
+      MassIn[j] = msum;
+
+      /* Update junction quality */
+      if (j <= Njuncs)
+      {
+         if (D[j] < 0.0) VolIn[j] -= D[j]*dt;
+         if (VolIn[j] > 0.0) C[j] = MassIn[j]/VolIn[j];
+         else                C[j] = X[j];
+      }
+   }
+}
+
 /************************* End of QUALITY.C ***************************/
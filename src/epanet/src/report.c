@@ -34,14 +34,14 @@ formatted string S to the report file.
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 #define   MAXCOUNT 10     /* Max. # of disconnected nodes listed */
-long      LineNum;        /* Current line number     */
-long      PageNum;        /* Current page number     */
-char      DateStamp[26];  /* Current date & time     */
-char      Fprinterr;      /* File write error flag   */
+EN_THREAD long      LineNum;        /* Current line number     */
+EN_THREAD long      PageNum;        /* Current page number     */
+EN_THREAD char      DateStamp[26];  /* Current date & time     */
+EN_THREAD char      Fprinterr;      /* File write error flag   */
 
 /* Defined in enumstxt.h in EPANET.C */
 extern char *NodeTxt[];
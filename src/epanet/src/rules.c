@@ -18,18 +18,29 @@ AUTHOR:     L. Rossman
      allocrules() -- called from allocdata() in EPANET.C
      ruledata()   -- called from newline() in INPUT2.C
      freerules()  -- called from freedata() in EPANET.C
+     openrules()  -- called from openhyd() in HYDRAUL.C
+     closerules() -- called from closehyd() in HYDRAUL.C
+     resetrules() -- called from ruletimestep() in HYDRAUL.C
      checkrules() -- called from ruletimestep() in HYDRAUL.C
 
+  Within one hydraulic time step, ruletimestep() checks the rules at
+  each rule time step while only tank levels and the clock move on.
+  So a rule's premises are re-evaluated only when a tank they refer
+  to has changed level, or the clock has come to a time at which one
+  of its time premises can change; otherwise its last value is used.
+  Every rule is evaluated afresh at the start of each time step.
+
 **********************************************************************
 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "hash.h"
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
 struct      Premise         /* Rule Premise Clause */
@@ -69,11 +80,18 @@ struct      ActItem         /* Action list item */
    struct   ActItem  *next;     
 };
 
-struct  aRule *Rule;        /* Array of rules */
-struct  ActItem *ActList;   /* Linked list of action items */
-int     RuleState;          /* State of rule interpreter */
-long    Time1;              /* Start of rule evaluation time interval (sec) */
-struct  Premise *Plast;     /* Previous premise clause */
+EN_THREAD struct  aRule *Rule;        /* Array of rules */
+EN_THREAD struct  ActItem *ActList;   /* Linked list of action items */
+EN_THREAD int     RuleState;          /* State of rule interpreter */
+EN_THREAD long    Time1;              /* Start of rule evaluation time interval (sec) */
+EN_THREAD struct  Premise *Plast;     /* Previous premise clause */
+EN_THREAD char    *Rulevalue;         /* Value of each rule's premises when last evaluated */
+EN_THREAD char    *Ruletimed;         /* Whether each rule has premises on time */
+EN_THREAD long    *Rulewake;          /* Time by which each rule must be re-evaluated (sec) */
+EN_THREAD int     *Tankrulefirst;     /* Start of each tank's rules in Tankrule */
+EN_THREAD int     *Tankrule;          /* Rules with premises on each tank */
+EN_THREAD double  *Tankrulehead;      /* Head of each tank when its rules were evaluated */
+EN_THREAD char    Rulesfresh;         /* Whether rules have been evaluated in this time step */
 
 enum    Rulewords      {r_RULE,r_IF,r_AND,r_OR,r_THEN,r_ELSE,r_PRIORITY,r_ERROR};
 char    *Ruleword[]  = {w_RULE,w_IF,w_AND,w_OR,w_THEN,w_ELSE,w_PRIORITY,NULL};
@@ -98,8 +116,8 @@ enum    Values         {IS_NUMBER,IS_OPEN,IS_CLOSED,IS_ACTIVE};
 char    *Value[]     = {"XXXX",   w_OPEN, w_CLOSED, w_ACTIVE,NULL};
 
 /* External variables declared in INPUT2.C */
-extern char      *Tok[MAXTOKS];
-extern int       Ntokens;
+extern EN_THREAD char      *Tok[MAXTOKS];
+extern EN_THREAD int       Ntokens;
 
 /*
 **   Local function prototypes are defined here and not in FUNCS.H 
@@ -111,6 +129,8 @@ int     newpremise(int);
 int     newaction(void);
 int     newpriority(void);
 int     evalpremises(int);
+int     premisetank(struct Premise *);
+long    rulewake(int);
 void    updateactlist(int, struct Action *);
 int     checkaction(int, struct Action *);
 int     checkpremise(struct Premise *);
@@ -175,6 +195,92 @@ void freerules()
 }
 
 
+int  openrules()
+/*
+**--------------------------------------------------------------
+**    Allocates the rules' last values, and lists the rules
+**    with premises on each tank.
+**    Called by openhyd() in HYDRAUL.C module.
+**--------------------------------------------------------------
+*/
+{
+   int i,j;
+   struct Premise *p;
+
+   closerules();
+   Rulevalue = (char *) calloc(Nrules+1,sizeof(char));
+   Ruletimed = (char *) calloc(Nrules+1,sizeof(char));
+   Rulewake = (long *) calloc(Nrules+1,sizeof(long));
+   Tankrulefirst = (int *) calloc(Ntanks+2,sizeof(int));
+   Tankrulehead = (double *) calloc(Ntanks+1,sizeof(double));
+   if (Rulevalue == NULL || Ruletimed == NULL || Rulewake == NULL ||
+       Tankrulefirst == NULL || Tankrulehead == NULL) return(101);
+
+   /* Count each tank's rules */
+   for (i=1; i<=Nrules; i++)
+   {
+      for (p = Rule[i].Pchain; p != NULL; p = p->next)
+      {
+         if (p->variable == r_TIME || p->variable == r_CLOCKTIME)
+            Ruletimed[i] = TRUE;
+         else if ((j = premisetank(p)) > 0) Tankrulefirst[j+1]++;
+      }
+   }
+   Tankrulefirst[1] = 0;
+   for (j=1; j<=Ntanks; j++) Tankrulefirst[j+1] += Tankrulefirst[j];
+
+   /* Then list them, advancing each tank's start to its end */
+   /* as it goes, and moving the starts back after.          */
+   Tankrule = (int *) calloc(Tankrulefirst[Ntanks+1]+1,sizeof(int));
+   if (Tankrule == NULL) return(101);
+   for (i=1; i<=Nrules; i++)
+   {
+      for (p = Rule[i].Pchain; p != NULL; p = p->next)
+      {
+         if ((j = premisetank(p)) > 0) Tankrule[Tankrulefirst[j]++] = i;
+      }
+   }
+   for (j=Ntanks; j>=1; j--) Tankrulefirst[j+1] = Tankrulefirst[j];
+   Tankrulefirst[1] = 0;
+   Rulesfresh = FALSE;
+   return(0);
+}
+
+
+void closerules()
+/*
+**--------------------------------------------------------------
+**    Frees the memory allocated by openrules().
+**    Called by closehyd() in HYDRAUL.C module.
+**--------------------------------------------------------------
+*/
+{
+   free(Rulevalue);
+   free(Ruletimed);
+   free(Rulewake);
+   free(Tankrulefirst);
+   free(Tankrule);
+   free(Tankrulehead);
+   Rulevalue = Ruletimed = NULL;
+   Rulewake = NULL;
+   Tankrulefirst = Tankrule = NULL;
+   Tankrulehead = NULL;
+}
+
+
+void resetrules()
+/*
+**--------------------------------------------------------------
+**    Marks every rule for evaluation at the next checkrules(),
+**    since the hydraulic state has changed.
+**    Called by ruletimestep() in HYDRAUL.C module.
+**--------------------------------------------------------------
+*/
+{
+   Rulesfresh = FALSE;
+}
+
+
 int checkrules(long dt)
 /*
 **-----------------------------------------------------
@@ -183,19 +289,43 @@ int checkrules(long dt)
 **-----------------------------------------------------
 */
 {
-   int i,
+   int i,j,k,n,
        r;    /* Number of actions actually taken */
 
    /* Start of rule evaluation time interval */
    Time1 = Htime - dt + 1;
 
+   /* Mark the rules to re-evaluate for tanks that have */
+   /* changed level (or every rule, in a new time step) */
+   if (!Rulesfresh)
+   {
+      for (i=1; i<=Nrules; i++) Rulewake[i] = 0;
+      Rulesfresh = TRUE;
+   }
+   for (j=1; j<=Ntanks; j++)
+   {
+      if (Tankrulefirst[j] == Tankrulefirst[j+1]) continue;
+      n = Tank[j].Node;
+      if (H[n] == Tankrulehead[j]) continue;
+      Tankrulehead[j] = H[n];
+      for (k=Tankrulefirst[j]; k<Tankrulefirst[j+1]; k++)
+         Rulewake[Tankrule[k]] = 0;
+   }
+
    /* Iterate through each rule */
    ActList = NULL;
    r = 0;
    for (i=1; i<=Nrules; i++)
    {
+      /* Re-evaluate premises that may have changed */
+      if (Htime >= Rulewake[i])
+      {
+         Rulevalue[i] = (char)evalpremises(i);
+         Rulewake[i] = (Ruletimed[i]) ? rulewake(i) : LONG_MAX;
+      }
+
       /* If premises true, add THEN clauses to action list. */
-      if (evalpremises(i) == TRUE) updateactlist(i,Rule[i].Tchain);
+      if (Rulevalue[i] == TRUE) updateactlist(i,Rule[i].Tchain);
 
       /* If premises false, add ELSE actions to list. */
       else
@@ -615,6 +745,64 @@ int  evalpremises(int i)
 }
 
  
+int  premisetank(struct Premise *p)
+/*
+**----------------------------------------------------------
+**    Returns the index of the tank a premise is on, or 0
+**    if it's on anything else (reservoirs included, since
+**    tank levels are all that move between rule checks)
+**----------------------------------------------------------
+*/
+{
+    int j;
+    if (p->object != r_NODE || p->index <= Njuncs) return(0);
+    j = p->index - Njuncs;
+    if (Tank[j].A == 0.0) return(0);
+    return(j);
+}
+
+
+long  rulewake(int i)
+/*
+**----------------------------------------------------------
+**    Returns the time by which rule i's premises on time
+**    may have changed value, assuming the clock only moves
+**    forward (0 if they must be checked at every rule time
+**    step, as "=" and "<>" premises hold over an interval)
+**----------------------------------------------------------
+*/
+{
+    long  wake = LONG_MAX, t, x, c;
+    struct Premise *p;
+
+    for (p = Rule[i].Pchain; p != NULL; p = p->next)
+    {
+        if (p->variable != r_TIME && p->variable != r_CLOCKTIME) continue;
+        if (p->relop == EQ || p->relop == NE) return(0);
+
+        /* The first time at which the premise holds (for GT, GE) */
+        /* or fails (for LT, LE), in checktime()'s terms          */
+        x = (long)(p->value);
+        if (p->relop == LE || p->relop == GT) x++;
+
+        /* Elapsed time only passes it once; the time of day  */
+        /* passes it, and goes back past it again at midnight */
+        if (p->variable == r_TIME)
+        {
+            t = (Htime < x) ? x : LONG_MAX;
+        }
+        else
+        {
+            c = (Htime + Tstart) % SECperDAY;
+            if (c < x) t = Htime + MIN(x,SECperDAY) - c;
+            else       t = Htime + SECperDAY - c;
+        }
+        wake = MIN(wake,t);
+    }
+    return(wake);
+}
+
+
 int  checkpremise(struct Premise *p)
 /*
 **----------------------------------------------------------
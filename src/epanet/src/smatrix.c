@@ -13,9 +13,16 @@ a network's hydraulic equations. The entry points into this
 module are:                                                      
    createsparse() -- called from openhyd() in HYDRAUL.C           
    freesparse()   -- called from closehyd() in HYDRAUL.C           
+   matrixbytes()  -- called from ENgetstatistic() in EPANET.C       
    linsolve()     -- called from netsolve() in HYDRAUL.C          
+   linfactor()    -- called from demandresponse() in HYDRAUL.C   
+   linsubst()     -- called from demandresponse() in HYDRAUL.C   
                                                                    
-Createsparse() does the following:                               
+Createsparse() reads the node ordering and factor structure     
+found for the network by an earlier run from the sparse file, if 
+one is in use (see ENusesparsefile() and readsparse()). Otherwise 
+it does the following, and then keeps the results in the sparse  
+file for next time (see findsparse() and writesparse()):          
    1. for each node, builds an adjacency list that identifies    
       all links connected to the node (see buildlists())         
    2. re-orders the network's nodes to minimize the number       
@@ -24,8 +31,16 @@ Createsparse() does the following:
    3. converts the adjacency lists into a compact scheme         
       for storing the non-zero coeffs. in the lower diagonal     
       portion of the solution matrix (see storesparse())         
+   4. lays the coeffs. out in Aij in the order that linsolve()   
+      factorizes them (see factororder())                        
+Either way, it then groups the columns of the factor into        
+supernodes (see supernodes()) and allocates the work arrays that 
+linsolve() uses.                                                 
 Freesparse() frees the memory used for the sparse matrix.        
 Linsolve() solves the linearized system of hydraulic equations.  
+It factorizes the matrix (linfactor()) and then substitutes (see 
+linsubst()), which can also be done for many right hand sides    
+with one factorization.                                          
 
 ********************************************************************
 */
@@ -38,10 +53,23 @@ Linsolve() solves the linearized system of hydraulic equations.
 #include "text.h"
 #include "types.h"
 #include "funcs.h"
-#define  EXTERN  extern
+#define  EXTERN  extern EN_THREAD
 #include "vars.h"
 
-int      *Degree;     /* Number of links adjacent to each node  */
+#define  SPARSEMAGIC    516114523  /* Identifies a sparse file   */
+#define  SPARSEVERSION  1          /* Version of its layout      */
+#define  SPARSEHEAD     6          /* Ints in its header         */
+
+EN_THREAD int      *Degree;     /* Number of links adjacent to each node  */
+EN_THREAD int      *Linkmark;   /* Last node found to be linked to each   */
+
+/* Work arrays for linsolve(), allocated once by createsparse() */
+EN_THREAD double   *Ltemp,      /* Accumulated modifications of a column  */
+                   *Ldense;     /* A supernode's modification of a column */
+EN_THREAD int      *Llink,      /* Supernodes that modify each column     */
+                   *Lfirst,     /* Next row of each supernode to apply    */
+                   *Lsuper,     /* First column of each column's supernode*/
+                   *Llast;      /* Last column of each supernode          */
 
 
 int  createsparse()
@@ -59,9 +87,49 @@ int  createsparse()
    ERRCODE(allocsparse());
    if (errcode) return(errcode);
 
+   /* Read the node ordering and factor structure from the   */
+   /* sparse file, or else find them and keep them there.    */
+   if (!readsparse())
+   {
+      ERRCODE(findsparse());
+      if (!errcode && strlen(SparseFname) > 0) writesparse();
+   }
+
+   /* Find the supernodes, and allocate linsolve()'s work arrays */
+   ERRCODE(supernodes(Njuncs));
+   Ltemp  = (double *) calloc(Njuncs+1, sizeof(double));
+   Ldense = (double *) calloc(Njuncs+1, sizeof(double));
+   Llink  = (int *) calloc(Njuncs+1, sizeof(int));
+   Lfirst = (int *) calloc(Njuncs+1, sizeof(int));
+   ERRCODE(MEMCHECK(Ltemp));
+   ERRCODE(MEMCHECK(Ldense));
+   ERRCODE(MEMCHECK(Llink));
+   ERRCODE(MEMCHECK(Lfirst));
+
+   /* Re-build adjacency lists without removing parallel */
+   /* links for use in future connectivity checking.     */
+   ERRCODE(buildlists(FALSE));
+   return(errcode);
+}                        /* End of createsparse */
+
+
+int  findsparse()
+/*
+**--------------------------------------------------------------
+** Input:   none                                                
+** Output:  returns error code                                  
+** Purpose: re-orders the nodes and finds the structure of the  
+**          factorized solution matrix                          
+**--------------------------------------------------------------
+*/
+{
+   int errcode = 0;
+
    /* Build node-link adjacency lists with parallel links removed. */
    Degree = (int *) calloc(Nnodes+1, sizeof(int));
+   Linkmark = (int *) calloc(Nnodes+1, sizeof(int));
    ERRCODE(MEMCHECK(Degree));
+   ERRCODE(MEMCHECK(Linkmark));
    ERRCODE(buildlists(TRUE));
    if (!errcode)
    {
@@ -84,14 +152,14 @@ int  createsparse()
    if (!errcode) freelists();
    ERRCODE(ordersparse(Njuncs));
 
-   /* Re-build adjacency lists without removing parallel */
-   /* links for use in future connectivity checking.     */
-   ERRCODE(buildlists(FALSE));
+   /* Store the coeffs. in Aij column by column */
+   ERRCODE(factororder(Njuncs));
 
    /* Free allocated memory */
    free(Degree);
+   free(Linkmark);
    return(errcode);
-}                        /* End of createsparse */
+}                        /* End of findsparse */
 
 
 int  allocsparse()
@@ -133,9 +201,198 @@ void  freesparse()
    free(XLNZ);
    free(NZSUB);
    free(LNZ); 
+   free(Ltemp);
+   free(Ldense);
+   free(Llink);
+   free(Lfirst);
+   free(Lsuper);
+   free(Llast);
+   Ltemp = NULL;
+   Ldense = NULL;
+   Llink = NULL;
+   Lfirst = NULL;
+   Lsuper = NULL;
+   Llast = NULL;
 }                        /* End of freesparse */
 
 
+long  matrixbytes()
+/*
+**----------------------------------------------------------------
+** Input:   None                                                
+** Output:  returns bytes held by the solution matrix            
+** Purpose: adds up the memory allocated for the matrix's index  
+**          (see allocsparse() and storesparse()), the adjacency 
+**          lists kept for connectivity checks, linsolve()'s     
+**          work arrays and the coeffs. themselves (see          
+**          allocmatrix() in HYDRAUL.C), while they're open      
+**----------------------------------------------------------------
+*/
+{
+   long n = Njuncs;
+   long bytes = 0;
+
+   if (!OpenHflag) return(0);
+   bytes += (Nnodes+1)*(long)(sizeof(Padjlist) + 2*sizeof(int)); /* Adjlist, Order, Row  */
+   bytes += (Nlinks+1)*(long)sizeof(int);                        /* Ndx                  */
+   bytes += 2*Nlinks*(long)sizeof(struct Sadjlist);              /* Adjacency lists      */
+   bytes += (n+2)*(long)sizeof(int);                             /* XLNZ                 */
+   bytes += 2*(Ncoeffs+2)*(long)sizeof(int);                     /* NZSUB, LNZ           */
+   bytes += 2*(n+1)*(long)(sizeof(double) + sizeof(int));        /* Ltemp, Ldense, Llink,*/
+                                                                 /* Lfirst               */
+   bytes += 2*(n+2)*(long)sizeof(int);                           /* Lsuper, Llast        */
+   bytes += (3*(Nnodes+1) + (Ncoeffs+1) + 2*(Nlinks+1)
+            + MAX(Nnodes+1, Nlinks+1))*(long)sizeof(double);     /* Aii, F, E, Aij, P, Y,*/
+                                                                 /* X                    */
+   bytes += Nlinks + Ntanks + 1;                                 /* OldStat              */
+   return(bytes);
+}                        /* End of matrixbytes */
+
+
+int  readsparse()
+/*
+**--------------------------------------------------------------
+** Input:   none                                                
+** Output:  returns TRUE if the node ordering and factor        
+**          structure were read from the sparse file            
+** Purpose: reads what writesparse() kept for this network      
+**                                                              
+** NOTE:   The file is only used if it was written for a        
+**         network whose links have exactly the same end nodes  
+**         (the ordering depends on nothing else). What it      
+**         holds is range-checked before it is used, so that a  
+**         damaged file is passed over rather than trusted.     
+**--------------------------------------------------------------
+*/
+{
+   FILE *f;
+   int  head[SPARSEHEAD], ends[2];
+   int  i, j, k, n, ok;
+
+   if (strlen(SparseFname) == 0) return(FALSE);
+   if ((f = fopen(SparseFname,"rb")) == NULL) return(FALSE);
+   n = Njuncs;
+
+   /* Check that the file was written for this network */
+   ok = (fread(head,sizeof(int),SPARSEHEAD,f) == SPARSEHEAD
+         && head[0] == SPARSEMAGIC && head[1] == SPARSEVERSION
+         && head[2] == Nnodes && head[3] == Njuncs
+         && head[4] == Nlinks && head[5] >= 0);
+   for (k=1; ok && k<=Nlinks; k++)
+   {
+      ok = (fread(ends,sizeof(int),2,f) == 2
+            && ends[0] == Link[k].N1 && ends[1] == Link[k].N2);
+   }
+
+   /* Read the node ordering, the coeff. position of each */
+   /* link, and the factor's sparse storage scheme.       */
+   if (ok)
+   {
+      Ncoeffs = head[5];
+      XLNZ  = (int *) calloc(n+2, sizeof(int));
+      NZSUB = (int *) calloc(Ncoeffs+2, sizeof(int));
+      LNZ   = (int *) calloc(Ncoeffs+2, sizeof(int));
+      ok = (XLNZ != NULL && NZSUB != NULL && LNZ != NULL
+        && fread(&Order[1],sizeof(int),Nnodes,f) == (size_t)Nnodes
+        && fread(&Row[1],sizeof(int),Nnodes,f) == (size_t)Nnodes
+        && fread(&Ndx[1],sizeof(int),Nlinks,f) == (size_t)Nlinks
+        && fread(&XLNZ[1],sizeof(int),n+1,f) == (size_t)(n+1)
+        && fread(&NZSUB[1],sizeof(int),Ncoeffs,f) == (size_t)Ncoeffs);
+   }
+   fclose(f);
+
+   /* Junctions must be ordered among themselves, each link's   */
+   /* coeff. must be in range, and each column's rows must lie  */
+   /* below the diagonal in ascending order.                    */
+   for (k=1; ok && k<=Nnodes; k++)
+   {
+      ok = (Order[k] >= 1 && Order[k] <= Nnodes && Row[Order[k]] == k
+            && (Order[k] <= n) == (k <= n));
+   }
+   for (k=1; ok && k<=Nlinks; k++) ok = (Ndx[k] >= 0 && Ndx[k] <= Ncoeffs);
+   ok = ok && (XLNZ[1] == 1 && XLNZ[n+1] == Ncoeffs+1);
+   for (j=1; ok && j<=n; j++)
+   {
+      ok = (XLNZ[j+1] >= XLNZ[j] && XLNZ[j+1] <= Ncoeffs+1);
+      for (i=XLNZ[j]; ok && i<XLNZ[j+1]; i++)
+      {
+         ok = (NZSUB[i] <= n
+               && NZSUB[i] > ((i > XLNZ[j]) ? NZSUB[i-1] : j));
+      }
+   }
+
+   /* The coeffs. are stored in factor order (see factororder()) */
+   if (ok) for (k=1; k<=Ncoeffs; k++) LNZ[k] = k;
+
+   /* Otherwise leave the storage for findsparse() to allocate */
+   else
+   {
+      free(XLNZ);
+      free(NZSUB);
+      free(LNZ);
+      XLNZ = NULL;
+      NZSUB = NULL;
+      LNZ = NULL;
+   }
+   return(ok);
+}                        /* End of readsparse */
+
+
+int  writesparse()
+/*
+**--------------------------------------------------------------
+** Input:   none                                                
+** Output:  returns TRUE if the sparse file was written         
+** Purpose: keeps the node ordering and factor structure in     
+**          the sparse file, for readsparse()                   
+**                                                              
+** NOTE:   The file is written under a temporary name and then  
+**         renamed, so that no run reads it half-written. If it 
+**         can't be written, the next run just finds the        
+**         ordering again.                                      
+**--------------------------------------------------------------
+*/
+{
+   FILE *f;
+   int  head[SPARSEHEAD];
+   char tmpname[MAXFNAME+5];
+   int  k, n, ok;
+
+   n = Njuncs;
+   sprintf(tmpname,"%s.tmp",SparseFname);
+   if ((f = fopen(tmpname,"wb")) == NULL) return(FALSE);
+
+   head[0] = SPARSEMAGIC;
+   head[1] = SPARSEVERSION;
+   head[2] = Nnodes;
+   head[3] = Njuncs;
+   head[4] = Nlinks;
+   head[5] = Ncoeffs;
+   ok = (fwrite(head,sizeof(int),SPARSEHEAD,f) == SPARSEHEAD);
+   for (k=1; ok && k<=Nlinks; k++)
+   {
+      ok = (fwrite(&Link[k].N1,sizeof(int),1,f) == 1
+            && fwrite(&Link[k].N2,sizeof(int),1,f) == 1);
+   }
+   ok = (ok
+     && fwrite(&Order[1],sizeof(int),Nnodes,f) == (size_t)Nnodes
+     && fwrite(&Row[1],sizeof(int),Nnodes,f) == (size_t)Nnodes
+     && fwrite(&Ndx[1],sizeof(int),Nlinks,f) == (size_t)Nlinks
+     && fwrite(&XLNZ[1],sizeof(int),n+1,f) == (size_t)(n+1)
+     && fwrite(&NZSUB[1],sizeof(int),Ncoeffs,f) == (size_t)Ncoeffs);
+   if (fclose(f) != 0) ok = FALSE;
+
+   /* Replace any earlier file (where rename() won't) */
+   if (ok && rename(tmpname,SparseFname) != 0)
+   {
+      remove(SparseFname);
+      ok = (rename(tmpname,SparseFname) == 0);
+   }
+   if (!ok) remove(tmpname);
+   return(ok);
+}                        /* End of writesparse */
+
+
 int  buildlists(int paraflag)
 /*
 **--------------------------------------------------------------
@@ -396,8 +653,14 @@ int  newlink(Padjlist alink)
    int   inode, jnode;
    Padjlist blink;
 
-   /* Scan all entries in adjacency list that follow anode. */
+   /* Mark the nodes that inode is already linked to, so that */
+   /* each check below takes one look instead of a scan of    */
+   /* inode's list (see linked()).                            */
    inode = alink->node;             /* End node of connection to anode */
+   for (blink = Adjlist[inode]; blink != NULL; blink = blink->next)
+      Linkmark[blink->node] = inode;
+
+   /* Scan all entries in adjacency list that follow anode. */
    for (blink = alink->next; blink != NULL; blink = blink->next)
    {
       jnode = blink->node;          /* End node of next connection */
@@ -406,7 +669,7 @@ int  newlink(Padjlist alink)
       /* then add a new connection between inode and jnode.       */
       if (Degree[jnode] > 0)        /* jnode still active */
       {
-         if (!linked(inode,jnode))  /* inode not linked to jnode */
+         if (Linkmark[jnode] != inode)  /* inode not linked to jnode */
          {
 
             /* Since new connection represents a non-zero coeff. */
@@ -589,6 +852,93 @@ void  transpose(int n, int *il, int *jl, int *xl, int *ilt, int *jlt,
 }                        /* End of transpose */
 
 
+int  factororder(int n)
+/*
+**--------------------------------------------------------------
+** Input:   n = number of rows in solution matrix               
+** Output:  returns error code                                  
+** Purpose: renumbers the positions of the coeffs. in Aij so    
+**          that the i-th non-zero of the factorized matrix     
+**          (in column order) is stored in Aij[i]               
+**                                                              
+** NOTE:   linsolve() then reads and writes Aij in sequence,    
+**         without going through LNZ (which becomes the         
+**         identity). The coeff. of a link that is not in the   
+**         lower triangle (one connected to a tank or           
+**         reservoir) is given the unused position 0.           
+**--------------------------------------------------------------
+*/
+{
+   int  i, k, nnz;
+   int  *pos;
+   int  errcode = 0;
+
+   nnz = XLNZ[n+1] - 1;
+   pos = (int *) calloc(Ncoeffs+1, sizeof(int));
+   ERRCODE(MEMCHECK(pos));
+   if (!errcode)
+   {
+      for (k=1; k<=nnz; k++) pos[LNZ[k]] = k;
+      for (i=1; i<=Nlinks; i++) Ndx[i] = pos[Ndx[i]];
+      for (k=1; k<=nnz; k++) LNZ[k] = k;
+      Ncoeffs = nnz;
+   }
+   free(pos);
+   return(errcode);
+}                        /* End of factororder */
+
+
+int  supernodes(int n)
+/*
+**--------------------------------------------------------------
+** Input:   n = number of rows in solution matrix               
+** Output:  returns error code                                  
+** Purpose: partitions the columns of the factorized matrix     
+**          into supernodes, for linsolve()                     
+**                                                              
+** NOTE:   A supernode is a run of consecutive columns in which 
+**         each column's rows are the next column plus that     
+**         column's rows. Its columns are dense down to its     
+**         last one, and share the rows below it. For each      
+**         column j, Lsuper[j] is the first column of its       
+**         supernode, and for that first column s, Llast[s] is  
+**         the last one.                                        
+**--------------------------------------------------------------
+*/
+{
+   int  i, j, m, s;
+   int  same;
+   int  errcode = 0;
+
+   Lsuper = (int *) calloc(n+2, sizeof(int));
+   Llast  = (int *) calloc(n+2, sizeof(int));
+   ERRCODE(MEMCHECK(Lsuper));
+   ERRCODE(MEMCHECK(Llast));
+   if (errcode) return(errcode);
+
+   s = 1;
+   for (j=1; j<=n; j++)
+   {
+      Lsuper[j] = s;
+      Llast[s] = j;
+
+      /* Does column j+1 continue the supernode? */
+      same = FALSE;
+      m = (j < n) ? XLNZ[j+2] - XLNZ[j+1] : 0;
+      if (j < n && XLNZ[j+1] - XLNZ[j] == m + 1 && NZSUB[XLNZ[j]] == j+1)
+      {
+         same = TRUE;
+         for (i=0; i<m; i++)
+         {
+            if (NZSUB[XLNZ[j]+1+i] != NZSUB[XLNZ[j+1]+i]) same = FALSE;
+         }
+      }
+      if (!same) s = j+1;
+   }
+   return(errcode);
+}                        /* End of supernodes */
+
+
 int  linsolve(int n, double *Aii, double *Aij, double *B)
 /*
 **--------------------------------------------------------------
@@ -601,6 +951,25 @@ int  linsolve(int n, double *Aii, double *Aij, double *B)
 **          equation causing system to be ill-conditioned       
 ** Purpose: solves sparse symmetric system of linear            
 **          equations using Cholesky factorization              
+**--------------------------------------------------------------
+*/
+{
+   int errcode = linfactor(n,Aii,Aij);
+   if (!errcode) linsubst(n,Aii,Aij,B,1);
+   return(errcode);
+}                        /* End of linsolve */
+
+
+int  linfactor(int n, double *Aii, double *Aij)
+/*
+**--------------------------------------------------------------
+** Input:   n    = number of equations                          
+**          Aii  = diagonal entries of solution matrix          
+**          Aij  = non-zero off-diagonal entries of matrix      
+** Output:  Aii, Aij = entries of the Cholesky factor L         
+**          returns 0 if factorized, or index of equation       
+**          causing system to be ill-conditioned                
+** Purpose: factorizes sparse symmetric matrix into L*L'        
 **                                                              
 ** NOTE:   This procedure assumes that the solution matrix has  
 **         been symbolically factorized with the positions of   
@@ -608,7 +977,14 @@ int  linsolve(int n, double *Aii, double *Aij, double *B)
 **         stored in the following integer arrays:              
 **            XLNZ  (start position of each column in NZSUB)    
 **            NZSUB (row index of each non-zero in each column) 
-**            LNZ   (position of each NZSUB entry in Aij array) 
+**         and that Aij holds them in the same order, so that    
+**         NZSUB[i] is the row of Aij[i] (see factororder()).    
+**                                                              
+**         The factorization works a supernode at a time (see   
+**         supernodes()): the columns of a supernode share the  
+**         rows below it, so their combined modification of a   
+**         later column is summed in a dense vector, and        
+**         scattered into that column only once.                
 **                                                              
 **  This procedure has been adapted from subroutines GSFCT and  
 **  GSSLV in the book "Computer Solution of Large Sparse        
@@ -617,63 +993,106 @@ int  linsolve(int n, double *Aii, double *Aij, double *B)
 **--------------------------------------------------------------
 */
 {
-   int    *link, *first;
-   int    i, istop, istrt, isub, j, k, kfirst, newk;
-   int    errcode = 0;
-   double bj, diagj, ljk;
-   double *temp;
-
-   temp = (double *) calloc(n+1, sizeof(double));
-   link = (int *) calloc(n+1,sizeof(int));
-   first = (int *) calloc(n+1,sizeof(int));
-   ERRCODE(MEMCHECK(temp));
-   ERRCODE(MEMCHECK(link));
-   ERRCODE(MEMCHECK(first));
-   if (errcode)
-   {
-      errcode = -errcode;
-      goto ENDLINSOLVE;
-   }
+   int    *link = Llink, *first = Lfirst;
+   int    i, istop, istrt, isub, j, k, kfirst, koff, len, news, s, slast;
+   double diagj, ljk, l0, l1, l2, l3;
+   double *temp = Ltemp, *dense = Ldense;
+   double *c0, *c1, *c2, *c3;
+
    memset(temp,0,(n+1)*sizeof(double));
+   memset(dense,0,(n+1)*sizeof(double));
    memset(link,0,(n+1)*sizeof(int));
 
    /* Begin numerical factorization of matrix A into L */
    /*   Compute column L(*,j) for j = 1,...n */
    for (j=1; j<=n; j++)
    {
-      /* For each column L(*,k) that affects L(*,j): */
       diagj = 0.0;
-      newk = link[j];
-      k = newk;
-      while (k != 0)
-      {
+      istrt = XLNZ[j];
+      istop = XLNZ[j+1] - 1;
 
-         /* Outer product modification of L(*,j) by  */
-         /* L(*,k) starting at first[k] of L(*,k).   */
-         newk = link[k];
-         kfirst = first[k];
-         ljk = Aij[LNZ[kfirst]];
-         diagj += ljk*ljk;
-         istrt = kfirst + 1;
-         istop = XLNZ[k+1] - 1;
-         if (istop >= istrt)
+      /* For each supernode s (columns s to slast) that affects  */
+      /* L(*,j), starting at row j -- first[s] of L(*,slast):    */
+      s = link[j];
+      while (s != 0)
+      {
+         news = link[s];
+         slast = Llast[s];
+         kfirst = first[s];
+         len = XLNZ[slast+1] - kfirst;
+
+         /* Sum the outer product modifications by each of */
+         /* its columns into vector 'dense', four columns  */
+         /* at a time while there are that many left.      */
+         for (k=s; k+3<=slast; k+=4)
+         {
+            c0 = Aij + XLNZ[k+1] - len;
+            c1 = Aij + XLNZ[k+2] - len;
+            c2 = Aij + XLNZ[k+3] - len;
+            c3 = Aij + XLNZ[k+4] - len;
+            l0 = c0[0];
+            l1 = c1[0];
+            l2 = c2[0];
+            l3 = c3[0];
+            diagj += l0*l0 + l1*l1 + l2*l2 + l3*l3;
+            for (i=1; i<len; i++)
+               dense[i] += c0[i]*l0 + c1[i]*l1 + c2[i]*l2 + c3[i]*l3;
+         }
+         for (; k<=slast; k++)
+         {
+            c0 = Aij + XLNZ[k+1] - len;
+            l0 = c0[0];
+            diagj += l0*l0;
+            for (i=1; i<len; i++) dense[i] += c0[i]*l0;
+         }
+         if (len > 1)
          {
 
-	     /* Before modification, update vectors 'first' */
-	     /* and 'link' for future modification steps.   */
-            first[k] = istrt;
-            isub = NZSUB[istrt];
-            link[k] = link[isub];
-            link[isub] = k;
-
-	    /* The actual mod is saved in vector 'temp'. */
-            for (i=istrt; i<=istop; i++)
+	     /* Update vectors 'first' and 'link' for future */
+	     /* modification steps, and save the mod in      */
+	     /* vector 'temp'.                               */
+            first[s] = kfirst + 1;
+            isub = NZSUB[kfirst+1];
+            link[s] = link[isub];
+            link[isub] = s;
+            for (i=1; i<len; i++)
             {
-               isub = NZSUB[i];
-               temp[isub] += Aij[LNZ[i]]*ljk;
+               temp[NZSUB[kfirst+i]] += dense[i];
+               dense[i] = 0.0;
             }
          }
-         k = newk;
+         s = news;
+      }
+
+      /* The columns before j in its own supernode have the same */
+      /* rows below j as L(*,j), so modify it in place (again    */
+      /* four columns at a time).                                */
+      for (k=Lsuper[j]; k+3<j; k+=4)
+      {
+         c0 = Aij + XLNZ[k] + (j-k-1);
+         c1 = Aij + XLNZ[k+1] + (j-k-2);
+         c2 = Aij + XLNZ[k+2] + (j-k-3);
+         c3 = Aij + XLNZ[k+3] + (j-k-4);
+         l0 = c0[0];
+         l1 = c1[0];
+         l2 = c2[0];
+         l3 = c3[0];
+         diagj += l0*l0 + l1*l1 + l2*l2 + l3*l3;
+         koff = 1 - istrt;          /* so c0[i] is in the row of Aij[i] */
+         c0 += koff;
+         c1 += koff;
+         c2 += koff;
+         c3 += koff;
+         for (i=istrt; i<=istop; i++)
+            Aij[i] -= c0[i]*l0 + c1[i]*l1 + c2[i]*l2 + c3[i]*l3;
+      }
+      for (; k<j; k++)
+      {
+         c0 = Aij + XLNZ[k] + (j-k-1);
+         ljk = c0[0];
+         diagj += ljk*ljk;
+         c0 += 1 - istrt;
+         for (i=istrt; i<=istop; i++) Aij[i] -= c0[i]*ljk;
       }
 
       /* Apply the modifications accumulated */
@@ -681,69 +1100,117 @@ int  linsolve(int n, double *Aii, double *Aij, double *B)
       diagj = Aii[j] - diagj;
       if (diagj <= 0.0)        /* Check for ill-conditioning */
       {
-         errcode = j;
-         goto ENDLINSOLVE;
+         return(j);
       }
       diagj = sqrt(diagj);
       Aii[j] = diagj;
-      istrt = XLNZ[j];
-      istop = XLNZ[j+1] - 1;
-      if (istop >= istrt)
+      for (i=istrt; i<=istop; i++)
       {
-         first[j] = istrt;
+         isub = NZSUB[i];
+         Aij[i] = (Aij[i] - temp[isub])/diagj;
+         temp[isub] = 0.0;
+      }
+
+      /* Once its last column is done, the supernode goes on */
+      /* to modify the column of its first row below it.     */
+      s = Lsuper[j];
+      if (Llast[s] == j && istop >= istrt)
+      {
+         first[s] = istrt;
          isub = NZSUB[istrt];
-         link[j] = link[isub];
-         link[isub] = j;
-         for (i=istrt; i<=istop; i++)
+         link[s] = link[isub];
+         link[isub] = s;
+      }
+   }      /* next j */
+   return(0);
+}                        /* End of linfactor */
+
+
+void  linsubst(int n, double *Aii, double *Aij, double *B, int nrhs)
+/*
+**--------------------------------------------------------------
+** Input:   n    = number of equations                          
+**          Aii  = diagonal entries of Cholesky factor L        
+**          Aij  = off-diagonal entries of L (see linfactor())  
+**          B    = nrhs right hand sides, interleaved: the      
+**                 entry of row i for the r-th one (from 0) is  
+**                 B[i*nrhs + r]                                 
+**          nrhs = number of right hand sides                   
+** Output:  B    = solution values, laid out the same way       
+** Purpose: solves L*L'*x = b for each right hand side b        
+**                                                              
+** NOTE:   Each entry of L is read once for all of the right    
+**         hand sides, which sit side by side for it.           
+**--------------------------------------------------------------
+*/
+{
+   int    i, istop, istrt, isub, j, r;
+   double bj, ljk, *bi, *bk;
+
+   if (nrhs == 1)
+   {
+      /* Foward substitution */
+      for (j=1; j<=n; j++)
+      {
+         bj = B[j]/Aii[j];
+         B[j] = bj;
+         istrt = XLNZ[j];
+         istop = XLNZ[j+1] - 1;
+         if (istop >= istrt)
          {
-            isub = NZSUB[i];
-            bj = (Aij[LNZ[i]] - temp[isub])/diagj;
-            Aij[LNZ[i]] = bj;
-            temp[isub] = 0.0;
+            for (i=istrt; i<=istop; i++)
+            {
+               isub = NZSUB[i];
+               B[isub] -= Aij[i]*bj;
+            }
          }
       }
-   }      /* next j */
+
+      /* Backward substitution */
+      for (j=n; j>=1; j--)
+      {
+         bj = B[j];
+         istrt = XLNZ[j];
+         istop = XLNZ[j+1] - 1;
+         if (istop >= istrt)
+         {
+            for (i=istrt; i<=istop; i++)
+            {
+               isub = NZSUB[i];
+               bj -= Aij[i]*B[isub];
+            }
+         }
+         B[j] = bj/Aii[j];
+      }
+      return;
+   }
 
    /* Foward substitution */
    for (j=1; j<=n; j++)
    {
-      bj = B[j]/Aii[j];
-      B[j] = bj;
-      istrt = XLNZ[j];
-      istop = XLNZ[j+1] - 1;
-      if (istop >= istrt)
+      bi = B + j*nrhs;
+      for (r=0; r<nrhs; r++) bi[r] /= Aii[j];
+      for (i=XLNZ[j]; i<XLNZ[j+1]; i++)
       {
-         for (i=istrt; i<=istop; i++)
-         {
-            isub = NZSUB[i];
-            B[isub] -= Aij[LNZ[i]]*bj;
-         }
+         ljk = Aij[i];
+         bk = B + NZSUB[i]*nrhs;
+         for (r=0; r<nrhs; r++) bk[r] -= ljk*bi[r];
       }
    }
 
    /* Backward substitution */
    for (j=n; j>=1; j--)
    {
-      bj = B[j];
-      istrt = XLNZ[j];
-      istop = XLNZ[j+1] - 1;
-      if (istop >= istrt)
+      bi = B + j*nrhs;
+      for (i=XLNZ[j]; i<XLNZ[j+1]; i++)
       {
-         for (i=istrt; i<=istop; i++)
-         {
-            isub = NZSUB[i];
-            bj -= Aij[LNZ[i]]*B[isub];
-         }
+         ljk = Aij[i];
+         bk = B + NZSUB[i]*nrhs;
+         for (r=0; r<nrhs; r++) bi[r] -= ljk*bk[r];
       }
-      B[j] = bj/Aii[j];
+      for (r=0; r<nrhs; r++) bi[r] /= Aii[j];
    }
-
-ENDLINSOLVE:
-   free(temp);
-   free(link);
-   free(first);
-   return(errcode);
-}                        /* End of linsolve */
+}                        /* End of linsubst */
 
 
 /************************ END OF SMATRIX.C ************************/
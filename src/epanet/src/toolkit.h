@@ -75,6 +75,9 @@ AUTHOR:     L. Rossman
 #define EN_STATUS       11
 #define EN_SETTING      12
 #define EN_ENERGY       13
+#define EN_PUMP_ECURVE  14   /* efficiency curve index, 0 for none      */
+#define EN_PUMP_ECOST   15   /* energy price (the global one if unset)  */
+#define EN_PUMP_EPAT    16   /* price pattern index, 0 for the global   */
 
 #define EN_DURATION     0    /* Time parameters */
 #define EN_HYDSTEP      1
@@ -92,6 +95,10 @@ AUTHOR:     L. Rossman
 
 #define EN_ITERATIONS     0
 #define EN_RELATIVEERROR  1
+#define EN_LINSOLVETIME   2   /* microseconds in linsolve, last solution */
+#define EN_POOLBYTES      3   /* bytes in the WQ segment pools           */
+#define EN_PEAKPOOLBYTES  4   /* the most they've held                   */
+#define EN_MATRIXBYTES    5   /* bytes in the hydraulic solution matrix  */
 
 #define EN_NODECOUNT    0   /* Component counts */
 #define EN_TANKCOUNT    1
@@ -140,6 +147,15 @@ AUTHOR:     L. Rossman
 #define EN_TOLERANCE    2
 #define EN_EMITEXPON    3
 #define EN_DEMANDMULT   4
+#define EN_STARTMODE    5
+#define EN_GLOBALEFFIC  6   /* pump efficiency (%) without a curve     */
+#define EN_GLOBALPRICE  7   /* energy price per kwh                    */
+#define EN_GLOBALPATTERN 8  /* price pattern index, 0 for none         */
+#define EN_DEMANDCHARGE 9   /* price per maximum kw                    */
+#define EN_SPECGRAVITY  10
+
+#define EN_COLDSTART    0   /* Hydraulic start modes (EN_STARTMODE) */
+#define EN_WARMSTART    1
 
 #define EN_LOWLEVEL     0   /* Control types.  */
 #define EN_HILEVEL      1   /* See ControlType */
@@ -179,8 +195,17 @@ AUTHOR:     L. Rossman
  int  DLLEXPORT ENcloseH(void);
  int  DLLEXPORT ENsavehydfile(char *);
  int  DLLEXPORT ENusehydfile(char *);
+ int  DLLEXPORT ENusesparsefile(char *);
+ int  DLLEXPORT ENsethydbuffer(int);
+ int  DLLEXPORT ENsethydassembly(int, int);
+ int  DLLEXPORT ENgethydstatesize(int *);
+ int  DLLEXPORT ENsavehydstate(char *);
+ int  DLLEXPORT ENloadhydstate(char *);
+ int  DLLEXPORT ENgetdemandresponse(int, int, int *, double *, double *, double *);
+ int  DLLEXPORT ENsolvedemandchange(int, int *, double *, double *, double *, double *, int *);
 
  int  DLLEXPORT ENsolveQ(void);
+ int  DLLEXPORT ENsetqualthreads(int);
  int  DLLEXPORT ENopenQ(void);
  int  DLLEXPORT ENinitQ(int);
  int  DLLEXPORT ENrunQ(long *);
@@ -210,12 +235,14 @@ AUTHOR:     L. Rossman
  int  DLLEXPORT ENgetnodeid(int, char *);
  int  DLLEXPORT ENgetnodetype(int, int *);
  int  DLLEXPORT ENgetnodevalue(int, int, double *);
+ int  DLLEXPORT ENgetnodevalues(int, int, int *, double *);
 
  int  DLLEXPORT ENgetlinkindex(char *, int *);
  int  DLLEXPORT ENgetlinkid(int, char *);
  int  DLLEXPORT ENgetlinktype(int, int *);
  int  DLLEXPORT ENgetlinknodes(int, int *, int *);
  int  DLLEXPORT ENgetlinkvalue(int, int, double *);
+ int  DLLEXPORT ENgetlinkvalues(int, int, int *, double *);
 
  int  DLLEXPORT ENgetstatistic(int code, int* value);
 
@@ -224,6 +251,8 @@ AUTHOR:     L. Rossman
  int  DLLEXPORT ENsetcontrol(int, int, int, double, int, double);
  int  DLLEXPORT ENsetnodevalue(int, int, double);
  int  DLLEXPORT ENsetlinkvalue(int, int, double);
+ int  DLLEXPORT ENsetnodevalues(int, int, int *, double *);
+ int  DLLEXPORT ENsetlinkvalues(int, int, int *, double *);
  int  DLLEXPORT ENaddpattern(char *);
  int  DLLEXPORT ENsetpattern(int, double *, int);
  int  DLLEXPORT ENsetpatternvalue(int, int, double);
@@ -233,5 +262,16 @@ AUTHOR:     L. Rossman
  int  DLLEXPORT ENsetqualtype(int, char *, char *, char *);
 
  int  DLLEXPORT ENgetcurve(int curveIndex, int* nValues, double **xValues, double **yValues); // !sph
+ int  DLLEXPORT ENgetcurvelen(int curveIndex, int *len);
+ int  DLLEXPORT ENgetcurvevalue(int curveIndex, int pointIndex, double *x, double *y);
 
  int  DLLEXPORT ENgetcoord(int , double *, double *);  // 06.02.2010 woohn
+
+// --- Separate simulator states (see PROJECT.C)
+
+ typedef struct ENproject ENproject;
+
+ int  DLLEXPORT ENcreateproject(ENproject **);
+ int  DLLEXPORT ENdeleteproject(ENproject *);
+ int  DLLEXPORT ENattachproject(ENproject *);
+ int  DLLEXPORT ENdetachproject(ENproject *);
@@ -29,6 +29,21 @@ AUTHOR:     L. Rossman
 typedef  float        REAL4;                                                   //(2.00.11 - LR)
 typedef  int          INT4;                                                    //(2.00.12 - LR)
 
+/*
+-------------------------------------------
+   Storage class of the simulator's state
+-------------------------------------------
+   Every global variable is thread-local, so that separate
+   projects (see PROJECT.C) can run on separate threads.
+*/
+#ifndef EN_THREAD
+#ifdef _MSC_VER
+#define EN_THREAD __declspec(thread)
+#else
+#define EN_THREAD __thread
+#endif
+#endif
+
 /*
 -----------------------------
    Global Constants
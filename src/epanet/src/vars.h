@@ -19,11 +19,18 @@ EXTERN FILE     *InFile,               /* Input file pointer           */
 EXTERN long     HydOffset,             /* Hydraulics file byte offset  */
                 OutOffset1,            /* 1st output file byte offset  */
                 OutOffset2;            /* 2nd output file byte offset  */
+EXTERN int      HydBuffer;             /* Hyd. solutions kept in memory*/
+EXTERN long     HydBufCount,           /* Solutions saved to HydBuf    */
+                HydBufRead;            /* Next solution to read from it*/
+EXTERN double   *HydBuf;               /* Hyd. solutions (or NULL)     */
+EXTERN int      QualThreads;           /* Threads for WQ transport     */
+EXTERN int      HydThreads;            /* Threads for hyd. assembly    */
 EXTERN char     Msg[MAXMSG+1],         /* Text of output message       */
                 InpFname[MAXFNAME+1],  /* Input file name              */
                 Rpt1Fname[MAXFNAME+1], /* Primary report file name     */
                 Rpt2Fname[MAXFNAME+1], /* Secondary report file name   */
                 HydFname[MAXFNAME+1],  /* Hydraulics file name         */
+                SparseFname[MAXFNAME+1], /* Sparse matrix file name    */
                 OutFname[MAXFNAME+1],  /* Binary output file name      */
                 MapFname[MAXFNAME+1],  /* Map file name                */
                 TmpFname[MAXFNAME+1],  /* Temporary file name          */      //(2.00.12 - LR)
@@ -58,7 +65,9 @@ EXTERN char     Msg[MAXMSG+1],         /* Text of output message       */
                 SaveHflag,             /* Hydraul. results saved flag  */
                 OpenQflag,             /* Quality system opened flag   */
                 SaveQflag,             /* Quality results saved flag   */
-                Saveflag;              /* General purpose save flag    */
+                Saveflag,              /* General purpose save flag    */
+                Warmflag,              /* Warm start flag              */
+                Fastpowflag;           /* Fast powers in hyd. coeffs.  */
 EXTERN int      MaxNodes,              /* Node count from input file   */
                 MaxLinks,              /* Link count from input file   */
                 MaxJuncs,              /* Junction count               */
@@ -151,6 +160,8 @@ EXTERN double   *H;                    /* Node heads                   */
 EXTERN STmplist *Patlist;              /* Temporary time pattern list  */ 
 EXTERN STmplist *Curvelist;            /* Temporary list of curves     */
 EXTERN STmplist *Coordlist;            /* Temporary list of coordinates*/
+EXTERN HTtable  *Patht, *Curveht,      /* Hash tables for the IDs on   */
+                *Coordht;              /* the temporary lists          */
 EXTERN Spattern *Pattern;              /* Time patterns                */
 EXTERN Scurve   *Curve;                /* Curve data                   */
 EXTERN Scoord   *Coord;                /* Coord data                   */ //06.02.2010 woohn
@@ -163,7 +174,7 @@ EXTERN Scontrol *Control;              /* Control data                 */
 EXTERN HTtable  *Nht, *Lht;            /* Hash tables for ID labels    */
 EXTERN Padjlist *Adjlist;              /* Node adjacency lists         */
 
-EXTERN int _relativeError, _iterations;
+EXTERN int _relativeError, _iterations, _linsolveTime;
 /*
 ** NOTE: Hydraulic analysis of the pipe network at a given point in time
 **       is done by repeatedly solving a linearized version of the 
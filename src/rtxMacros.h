@@ -16,6 +16,14 @@
 #define RTX_MAX(x,y) x>y?x:y
 #define RTX_MIN(x,y) x<y?x:y
 
+// instrumentation (TimeSeries::stats, PointRecord::stats) costs a few atomic increments per read. build with
+// -DRTX_NO_INSTRUMENTATION to compile it out; the counters then stay at zero.
+#ifndef RTX_NO_INSTRUMENTATION
+#define RTX_STATS(statement) statement
+#else
+#define RTX_STATS(statement)
+#endif
+
 // silly macro for string comparison
 #include <boost/algorithm/string/predicate.hpp>
 #define RTX_STRINGS_ARE_EQUAL(x,y) (boost::algorithm::iequals(x,y))